@@ -21,26 +21,36 @@
 #include "a2_exprtk.h"
 #include "mpmc_queue.cc"
 #include "a2_impl.h"
+#include "a2_simd.h"
 #include "a2_support.h"
+#include "polygon_raster.h"
 #include "mdpp-sampling/mdpp_decode.h"
 #include "util/assert.h"
 #include "util/perf.h"
-#include <boost/dynamic_bitset/dynamic_bitset.hpp>
+#include "util/profiling.h"
 #include <cpp11-on-multicore/common/benaphore.h>
 #include <mesytec-mvlc/util/string_util.h>
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <mutex>
 #include <queue>
 #include <random>
+#include <thread>
 #include <vector>
 #include <zstr.hpp>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
 /* Circumvent compile errors related to the 'Q' numeric literal suffix.
  * See https://svn.boost.org/trac10/ticket/9240 and
  * https://www.boost.org/doc/libs/1_68_0/libs/math/doc/html/math_toolkit/config_macros.html
@@ -91,13 +101,11 @@ namespace a2
 
 using namespace data_filter;
 using namespace memory;
+namespace profiling = mesytec::mvme::profiling;
 
 /* TODO list
  * - Add tests for range_filter_step(). Test it in mvme.
  * - Test aggregate mean and meanx
- * - Add logic to force internal input/output vectors to be rounded up to a
- *   specific power of 2. This is needed to efficiently use vector instructions
- *   in the _step() loops I think.
  *
  * - Try an extractor for single word filters. Use the same system as for
  *   operators: a global function table. This means that
@@ -118,6 +126,13 @@ using namespace memory;
  */
 static const size_t ParamVecAlignment = 64;
 
+/* The storage of param vectors is rounded up to a multiple of this number of
+ * elements, the width of an AVX-512 register or one cache line. Vectors thus
+ * never share a cache line with other arena data and full width loads at the
+ * end of a vector stay inside its allocation. The size member is not
+ * affected. */
+static const s32 ParamVecPadding = ParamVecAlignment / sizeof(double);
+
 /* Asserted in extractor_process_module_data(). */
 static const size_t ModuleDataAlignment = alignof(u32);
 
@@ -146,7 +161,8 @@ ParamVec push_param_vector(Arena *arena, s32 size)
 
     ParamVec result;
 
-    result.data = arena->pushArray<double>(size, ParamVecAlignment);
+    s32 paddedSize = (size + ParamVecPadding - 1) / ParamVecPadding * ParamVecPadding;
+    result.data = arena->pushArray<double>(paddedSize, ParamVecAlignment);
     result.size = result.data ? size : 0;
     assert(is_aligned(result.data, ParamVecAlignment));
 
@@ -349,6 +365,33 @@ inline double extract_signed_data(Extractor *ex)
     return value;
 }
 
+// Called when all subfilters of the extractors filter have matched.
+inline void extractor_handle_completion(DataSource *ds, Extractor *ex)
+{
+    ex->currentCompletions++;
+
+    if (ex->currentCompletions >= ex->requiredCompletions)
+    {
+        ex->currentCompletions = 0;
+        u64 address = extract(&ex->filter, MultiWordFilter::CacheA);
+
+        assert(address < static_cast<u64>(ds->outputs[0].size));
+
+        if (!is_param_valid(ds->outputs[0][address]))
+        {
+            double dValue = extract_signed_data(ex);
+
+            if (!(ex->options & DataSourceOptions::NoAddedRandom))
+                dValue += RealDist01(ex->rng);
+
+            ds->outputs[0][address] = dValue;
+            ds->hitCounts[0][address]++;
+        }
+    }
+
+    clear_completion(&ex->filter);
+}
+
 void extractor_process_module_data(DataSource *ds, const u32 *data, u32 size)
 {
     assert(memory::is_aligned(data, ModuleDataAlignment));
@@ -364,28 +407,54 @@ void extractor_process_module_data(DataSource *ds, const u32 *data, u32 size)
 
         if (process_data(&ex->filter, dataWord, wordIndex))
         {
-            ex->currentCompletions++;
+            extractor_handle_completion(ds, ex);
+        }
+    }
+}
 
-            if (ex->currentCompletions >= ex->requiredCompletions)
-            {
-                ex->currentCompletions = 0;
-                u64 address = extract(&ex->filter, MultiWordFilter::CacheA);
+void fused_extractors_process_module_data(const FusedModuleExtractors *fused, const u32 *data, u32 size)
+{
+    assert(memory::is_aligned(data, ModuleDataAlignment));
+
+    const FusedExtractorEntry *entries = fused->entries;
+    const u32 entryCount = fused->entryCount;
+    const u32 commonMask = fused->commonMask;
+    const u32 commonValue = fused->commonValue;
+
+    for (u32 wordIndex = 0; wordIndex < size; wordIndex++)
+    {
+        const u32 dataWord = data[wordIndex];
+
+        if ((dataWord & commonMask) != commonValue)
+            continue;
 
-                assert(address < static_cast<u64>(ds->outputs[0].size));
+        for (u32 entryIndex = 0; entryIndex < entryCount;)
+        {
+            const auto &entry = entries[entryIndex];
+
+            if ((dataWord & entry.matchMask) == entry.matchValue
+                && (entry.matchWordIndex < 0 || entry.matchWordIndex == static_cast<s32>(wordIndex)))
+            {
+                auto ds = fused->sources[entry.sourceIndex];
+                auto ex = reinterpret_cast<Extractor *>(ds->d);
+                const u16 partMask = 1u << entry.subfilterIndex;
 
-                if (!is_param_valid(ds->outputs[0][address]))
+                // Same rule as in process_data(): the word is consumed by the
+                // first incomplete subfilter of the extractor that matches.
+                if (!(ex->filter.completionMask & partMask))
                 {
-                    double dValue = extract_signed_data(ex);
+                    ex->filter.results[entry.subfilterIndex] = dataWord;
+                    ex->filter.completionMask |= partMask;
 
-                    if (!(ex->options & DataSourceOptions::NoAddedRandom))
-                        dValue += RealDist01(ex->rng);
+                    if (is_complete(&ex->filter))
+                        extractor_handle_completion(ds, ex);
 
-                    ds->outputs[0][address] = dValue;
-                    ds->hitCounts[0][address]++;
+                    entryIndex += entry.skip;
+                    continue;
                 }
             }
 
-            clear_completion(&ex->filter);
+            ++entryIndex;
         }
     }
 }
@@ -751,21 +820,28 @@ namespace mdpp_sampling = mesytec::mvme::mdpp_sampling;
 
 struct MdppSampleDecoder
 {
-    using DecoderFunction = std::function<mdpp_sampling::DecodedMdppSampleEvent (
-        const u32 *data, const size_t size, mdpp_sampling::logger_function logger_fun)>;
-
-    DecoderFunction decoder;
+    // Decodes directly into the arena backed spans. No allocations or logging
+    // happen on the per-event path.
+    mdpp_sampling::SpanDecoderFunction decoder;
+    mdpp_sampling::MdppSampleSpans spans;
     // Max channels in this module.
     unsigned maxChannels;
     // Max number of samples per channel. Samples that do not fit are discarded
     // (currently higher numbered samples are discarded first).
     unsigned maxSamples;
+    std::string moduleType;
     mesytec::mvlc::Protected<mesytec::mvme::mdpp_sampling::DecodedMdppSampleEvent> *sharedSampleEvent;
+    // Snapshots of the decoded data are published to the UI at a bounded rate
+    // instead of on every event.
+    std::chrono::steady_clock::time_point nextSnapshot;
     pcg32_fast rng;
     DataSourceOptions::opt_t options;
 };
 
+static const auto MdppSampleSnapshotInterval = std::chrono::milliseconds(100);
+
 MdppSampleDecoder make_mdpp_sample_decoder(
+    memory::Arena *arena,
     const std::string &moduleType,
     unsigned maxChannels,
     unsigned maxSamples,
@@ -775,13 +851,16 @@ MdppSampleDecoder make_mdpp_sample_decoder(
 {
     MdppSampleDecoder result = {};
 
-    result.decoder = mesytec::mvme::mdpp_sampling::get_decoder_function(moduleType.c_str());
+    result.decoder = mdpp_sampling::get_span_decoder_function(moduleType.c_str());
 
     if (!result.decoder)
         throw std::runtime_error(fmt::format("Unsupported module type in MdppSampleDecoder: '{}'", moduleType));
 
+    auto storage = arena->pushSize(mdpp_sampling::sample_spans_storage_size(maxChannels, maxSamples), alignof(u32));
+    result.spans = mdpp_sampling::make_sample_spans(storage, maxChannels, maxSamples);
     result.maxChannels = maxChannels;
     result.maxSamples = maxSamples;
+    result.moduleType = moduleType;
     result.sharedSampleEvent = &sharedSampleEvent;
     result.rng.seed(rngSeed);
     result.options = options;
@@ -805,7 +884,7 @@ DataSource make_datasource_mdpp_sample_decoder(
     auto result = make_datasource(arena, DataSource_MdppSampleDecoder, moduleIndex, maxChannels + statsCount);
 
     auto ex = arena->pushObject<MdppSampleDecoder>();
-    *ex = make_mdpp_sample_decoder(moduleType, maxChannels, maxSamples, rngSeed, sharedSampleEvent, options);
+    *ex = make_mdpp_sample_decoder(arena, moduleType, maxChannels, maxSamples, rngSeed, sharedSampleEvent, options);
     result.d = ex;
 
     // TODO: this is duplicated between analysis::DataSourceMdppSampleDecoder
@@ -865,35 +944,39 @@ void mdpp_sample_decoder_process_module_data(DataSource *ds, const u32 *data, u3
     assert(memory::is_aligned(data, ModuleDataAlignment));
 
     auto ex = reinterpret_cast<MdppSampleDecoder *>(ds->d);
-    auto decodedEvent = ex->decoder(data, dataSize, {});
+    auto &spans = ex->spans;
 
-    for (const auto &trace: decodedEvent.traces)
+    if (!ex->decoder(data, dataSize, spans))
+        return;
+
+    for (unsigned i=0; i<spans.channelCount; ++i)
     {
-        if (trace.channel >= ds->outputCount)
+        const auto channel = spans.channels[i];
+
+        if (channel >= ds->outputCount)
             continue;
 
-        auto &output = ds->outputs[trace.channel];
-        auto &hitCounts = ds->hitCounts[trace.channel];
-        const size_t SampleCount = trace.samples.size();
+        auto &output = ds->outputs[channel];
+        auto &hitCounts = ds->hitCounts[channel];
+        const auto samples = spans.channelSamples(channel);
+        const size_t SampleCount = std::min(static_cast<size_t>(spans.sampleCounts[channel]),
+                                            static_cast<size_t>(output.size));
         // We want to write all of the output elements even if there are fewer samples in this trace.
         const size_t LastIndex = output.size;
 
-        for (size_t sampleIndex=0; sampleIndex<LastIndex; ++sampleIndex)
+        for (size_t sampleIndex=0; sampleIndex<SampleCount; ++sampleIndex)
         {
-            output[sampleIndex] = invalid_param();
-
-            if (sampleIndex < SampleCount)
-            {
-                assert(!is_param_valid(output[sampleIndex]));
-                double value = trace.samples[sampleIndex];
+            double value = samples[sampleIndex];
 
-                if (!(ex->options & DataSourceOptions::NoAddedRandom))
-                    value += RealDist01(ex->rng);
+            if (!(ex->options & DataSourceOptions::NoAddedRandom))
+                value += RealDist01(ex->rng);
 
-                output[sampleIndex] = value;
-                ++hitCounts[sampleIndex];
-            }
+            output[sampleIndex] = value;
+            ++hitCounts[sampleIndex];
         }
+
+        for (size_t sampleIndex=SampleCount; sampleIndex<LastIndex; ++sampleIndex)
+            output[sampleIndex] = invalid_param();
     }
 
     const auto statsCount = mesytec::mvme::mdpp_sampling::TraceHeader::PartNames.size(); (void) statsCount;
@@ -902,22 +985,34 @@ void mdpp_sample_decoder_process_module_data(DataSource *ds, const u32 *data, u3
 
     using PartIndex = mesytec::mvme::mdpp_sampling::TraceHeader::PartIndex;
 
-    for (const auto &trace: decodedEvent.traces)
+    for (unsigned i=0; i<spans.channelCount; ++i)
     {
-        if (trace.channel >= ds->outputs[firstStatsIndex].size)
+        const auto channel = spans.channels[i];
+
+        if (channel >= ds->outputs[firstStatsIndex].size)
             continue;
 
-        ds->outputs[firstStatsIndex + PartIndex::Debug][trace.channel] = trace.traceHeader.parts.debug;
-        ds->outputs[firstStatsIndex + PartIndex::Config][trace.channel] = trace.traceHeader.parts.config;
-        ds->outputs[firstStatsIndex + PartIndex::Phase][trace.channel] = normalize_phase(trace.traceHeader.parts.phase);
-        ds->outputs[firstStatsIndex + PartIndex::Length][trace.channel] = trace.traceHeader.parts.length;
+        const auto &traceHeader = spans.traceHeaders[channel];
+        ds->outputs[firstStatsIndex + PartIndex::Debug][channel] = traceHeader.parts.debug;
+        ds->outputs[firstStatsIndex + PartIndex::Config][channel] = traceHeader.parts.config;
+        ds->outputs[firstStatsIndex + PartIndex::Phase][channel] = normalize_phase(traceHeader.parts.phase);
+        ds->outputs[firstStatsIndex + PartIndex::Length][channel] = traceHeader.parts.length;
     }
 
-    // Move the decoded event into the shared event. The UI can pick this up and
-    // use it for debugging.
+    // Publish a copy of the decoded event to the shared event at a bounded
+    // rate. The UI picks this up and uses it for debugging.
     if (ex->sharedSampleEvent)
     {
-        ex->sharedSampleEvent->access().ref() = std::move(decodedEvent);
+        auto now = std::chrono::steady_clock::now();
+
+        if (now >= ex->nextSnapshot)
+        {
+            auto decodedEvent = mdpp_sampling::to_decoded_event(spans);
+            decodedEvent.inputData.assign(data, data + dataSize);
+            decodedEvent.moduleType = ex->moduleType;
+            ex->sharedSampleEvent->access().ref() = std::move(decodedEvent);
+            ex->nextSnapshot = now + MdppSampleSnapshotInterval;
+        }
     }
 }
 
@@ -1035,95 +1130,33 @@ void calibration_step(Operator *op, A2 *)
     assert(op->type == Operator_Calibration);
 
     auto d = reinterpret_cast<CalibrationData *>(op->d);
-    s32 maxIdx = op->inputs[0].size;
-
-    for (s32 idx = 0; idx < maxIdx; idx++)
-    {
-        op->outputs[0][idx] = calibrate(
-            op->inputs[0][idx], op->inputLowerLimits[0][idx],
-            op->outputLowerLimits[0][idx], d->calibFactors[idx]);
 
-        if (!is_param_valid(op->inputs[0][idx]))
-        {
-            assert(!is_param_valid(op->outputs[0][idx]));
-        }
-    }
+    simd::kernels().calibrate(
+        op->inputs[0].data, op->inputLowerLimits[0].data,
+        op->outputLowerLimits[0].data, d->calibFactors.data,
+        op->outputs[0].data, op->inputs[0].size);
 }
 
+/* Forces the SSE4.2 kernel. Falls back to the runtime selected kernel if
+ * SSE4.2 is not available. calibration_step() picks the widest supported
+ * instruction set, this one is kept for comparison in the benchmarks. */
 void calibration_sse_step(Operator *op, A2 *)
 {
-    /* Note: The partially transformed code below is slower than
-     * calibration_step(). With the right compiler flags gcc seems to auto
-     * SIMD'ize very well.
-     * TODO: Finish this implementation using intrinsics and then compare
-     * again.
-     */
     assert(op->inputCount == 1);
     assert(op->outputCount == 1);
     assert(op->inputs[0].size == op->outputs[0].size);
     assert(op->type == Operator_Calibration_sse);
 
     auto d = reinterpret_cast<CalibrationData *>(op->d);
-    s32 maxIdx = op->inputs[0].size;
+    auto table = simd::get_kernel_table(simd::InstructionSet::SSE42);
 
-    /* Below are attempts at transforming the loop into something that can be
-     * handled with SIMD intrinsics. */
-#if 0
-    assert((op->inputs[0].size % 2) == 0);
-    for (s32 idx = 0; idx < maxIdx; idx += 2)
-    {
-        double p0 = op->inputs[0][idx + 0];
-        double p1 = op->inputs[0][idx + 1];
-        double min0 = op->inputLowerLimits[0][idx + 0];
-        double min1 = op->inputLowerLimits[0][idx + 1];
-        double diff0 = p0 - min0;
-        double diff1 = p1 - min1;
-        double mul0 = diff0 * d->calibFactors[idx + 0];
-        double mul1 = diff1 * d->calibFactors[idx + 1];
-        double r0 =  mul0 + op->outputLowerLimits[0][idx + 0];
-        double r1 =  mul1 + op->outputLowerLimits[0][idx + 1];
-
-        if (is_param_valid(p0))
-            op->outputs[0][idx + 0] = r0;
-
-        if (is_param_valid(p1))
-            op->outputs[0][idx + 1] = r1;
-    }
-#else
-    assert((op->inputs[0].size % 4) == 0);
-    for (s32 idx = 0; idx < maxIdx; idx += 4)
-    {
-        double p0 = op->inputs[0][idx + 0];
-        double p1 = op->inputs[0][idx + 1];
-        double p2 = op->inputs[0][idx + 2];
-        double p3 = op->inputs[0][idx + 3];
-
-        double min0 = op->inputLowerLimits[0][idx + 0];
-        double min1 = op->inputLowerLimits[0][idx + 1];
-        double min2 = op->inputLowerLimits[0][idx + 2];
-        double min3 = op->inputLowerLimits[0][idx + 3];
-
-        double diff0 = p0 - min0;
-        double diff1 = p1 - min1;
-        double diff2 = p2 - min2;
-        double diff3 = p3 - min3;
-
-        double mul0 = diff0 * d->calibFactors[idx + 0];
-        double mul1 = diff1 * d->calibFactors[idx + 1];
-        double mul2 = diff2 * d->calibFactors[idx + 2];
-        double mul3 = diff3 * d->calibFactors[idx + 3];
-
-        double r0 =  mul0 + op->outputLowerLimits[0][idx + 0];
-        double r1 =  mul1 + op->outputLowerLimits[0][idx + 1];
-        double r2 =  mul2 + op->outputLowerLimits[0][idx + 2];
-        double r3 =  mul3 + op->outputLowerLimits[0][idx + 3];
-
-        op->outputs[0][idx + 0] = is_param_valid(p0) ? r0 : p0;
-        op->outputs[0][idx + 1] = is_param_valid(p1) ? r1 : p1;
-        op->outputs[0][idx + 2] = is_param_valid(p2) ? r2 : p2;
-        op->outputs[0][idx + 3] = is_param_valid(p3) ? r3 : p3;
-    }
-#endif
+    if (!table)
+        table = &simd::kernels();
+
+    table->calibrate(
+        op->inputs[0].data, op->inputLowerLimits[0].data,
+        op->outputLowerLimits[0].data, d->calibFactors.data,
+        op->outputs[0].data, op->inputs[0].size);
 }
 
 Operator make_calibration(
@@ -1523,45 +1556,13 @@ Operator make_array_map(
     return result;
 }
 
-using BinaryEquationFunction = void (*)(ParamVec a, ParamVec b, ParamVec out);
-
-#define add_binary_equation(x) \
-[](ParamVec a, ParamVec b, ParamVec o)\
-{\
-    for (s32 i = 0; i < a.size && i < b.size; ++i)\
-    {\
-        if (is_param_valid(a[i]) && is_param_valid(b[i])) \
-        {\
-            x;\
-        }\
-        else\
-        {\
-            o[i] = invalid_param();\
-        }\
-    }\
-}
-
-static BinaryEquationFunction BinaryEquationTable[] =
-{
-    add_binary_equation(o[i] = a[i] + b[i]),
-
-    add_binary_equation(o[i] = a[i] - b[i]),
-
-    add_binary_equation(o[i] = (a[i] + b[i]) / (a[i] - b[i])),
-
-    add_binary_equation(o[i] = (a[i] - b[i]) / (a[i] + b[i])),
-
-    add_binary_equation(o[i] = a[i] / (a[i] - b[i])),
-
-    add_binary_equation(o[i] = (a[i] - b[i]) / a[i]),
-
-    add_binary_equation(o[i] = (a[i] * b[i])),
-
-    add_binary_equation(o[i] = (a[i] / b[i])),
-};
-#undef add_binary_equation
-
-static const size_t BinaryEquationCount = ArrayCount(BinaryEquationTable);
+/* The non-index binary equations are implemented as vectorized kernels in
+ * a2_simd_kernels.h. The equations are in the same order as in the table
+ * below:
+ *   a + b, a - b, (a + b) / (a - b), (a - b) / (a + b),
+ *   a / (a - b), (a - b) / a, a * b, a / b
+ */
+static const size_t BinaryEquationCount = simd::BinaryEquationCount;
 
 using BinaryEquationFunction_idx = void (*)(ParamVec a, s32 ai, ParamVec b, s32 bi, ParamVec out);
 
@@ -1606,9 +1607,11 @@ void binary_equation_step(Operator *op, A2 *)
 {
     // The equationIndex is stored directly in the d pointer.
     u32 equationIndex = (uintptr_t)op->d;
+    auto a = op->inputs[0];
+    auto b = op->inputs[1];
 
-    BinaryEquationTable[equationIndex](
-        op->inputs[0], op->inputs[1], op->outputs[0]);
+    simd::kernels().binary_equation[equationIndex](
+        a.data, b.data, op->outputs[0].data, std::min(a.size, b.size));
 }
 
 Operator make_binary_equation(
@@ -1619,7 +1622,7 @@ Operator make_binary_equation(
     double outputLowerLimit,
     double outputUpperLimit)
 {
-    assert(equationIndex < ArrayCount(BinaryEquationTable));
+    assert(equationIndex < BinaryEquationCount);
 
     auto result = make_operator(arena, Operator_BinaryEquation, 2, 1);
 
@@ -1651,7 +1654,7 @@ Operator make_binary_equation_idx(
     double outputLowerLimit,
     double outputUpperLimit)
 {
-    assert(equationIndex < ArrayCount(BinaryEquationTable));
+    assert(equationIndex < BinaryEquationCount);
     assert(0 <= inputIndexA && inputIndexA < inputA.data.size);
     assert(0 <= inputIndexB && inputIndexB < inputB.data.size);
 
@@ -1764,22 +1767,9 @@ void aggregate_sum_step(Operator *op, A2 *)
     auto output = op->outputs[0];
     auto thresholds = *reinterpret_cast<Thresholds *>(op->d);
 
-    double theSum = 0.0;
-    bool validSeen = false;
-
-    for (s32 i = 0; i < input.size; i++)
-    {
-        //a2_trace("i=%d, input[i]=%lf, thresholds.min=%lf, thresholds.max=%lf, is_valid_and_inside()=%d\n",
-        //         i, input[i], thresholds.min, thresholds.max, is_valid_and_inside(input[i], thresholds));
-
-        if (is_valid_and_inside(input[i], thresholds))
-        {
-            theSum += input[i];
-            validSeen = true;
-        }
-    }
+    auto r = simd::kernels().sum(input.data, input.size, thresholds.min, thresholds.max);
 
-    output[0] = validSeen ? theSum : invalid_param();
+    output[0] = r.count ? r.value : invalid_param();
 }
 
 //
@@ -1805,15 +1795,10 @@ void aggregate_multiplicity_step(Operator *op, A2 *)
     auto output = op->outputs[0];
     auto thresholds = *reinterpret_cast<Thresholds *>(op->d);
 
-    output[0] = 0.0;
+    // The sum kernel counts the accepted inputs as a side effect.
+    auto r = simd::kernels().sum(input.data, input.size, thresholds.min, thresholds.max);
 
-    for (s32 i = 0; i < input.size; i++)
-    {
-        if (is_valid_and_inside(input[i], thresholds))
-        {
-            output[0]++;
-        }
-    }
+    output[0] = r.count;
 }
 
 //
@@ -1849,22 +1834,9 @@ void aggregate_min_step(Operator *op, A2 *)
     auto output = op->outputs[0];
     auto thresholds = *reinterpret_cast<Thresholds *>(op->d);
 
-    double result = invalid_param();
-
-    for (s32 i = 0; i < input.size; i++)
-    {
-        if (is_valid_and_inside(input[i], thresholds))
-        {
-            if (!is_param_valid(result))
-            {
-                result = std::numeric_limits<double>::max();
-            }
-
-            result = std::min(result, input[i]);
-        }
-    }
+    auto r = simd::kernels().min(input.data, input.size, thresholds.min, thresholds.max);
 
-    output[0] = result;
+    output[0] = r.count ? r.value : invalid_param();
 }
 
 //
@@ -1898,22 +1870,9 @@ void aggregate_max_step(Operator *op, A2 *)
     auto output = op->outputs[0];
     auto thresholds = *reinterpret_cast<Thresholds *>(op->d);
 
-    double result = invalid_param();
+    auto r = simd::kernels().max(input.data, input.size, thresholds.min, thresholds.max);
 
-    for (s32 i = 0; i < input.size; i++)
-    {
-        if (is_valid_and_inside(input[i], thresholds))
-        {
-            if (!is_param_valid(result))
-            {
-                result = std::numeric_limits<double>::lowest();
-            }
-
-            result = std::max(result, input[i]);
-        }
-    }
-
-    output[0] = result;
+    output[0] = r.count ? r.value : invalid_param();
 }
 
 //
@@ -1933,18 +1892,9 @@ struct SumAndValidCount
 
 inline SumAndValidCount calculate_sum_and_valid_count(ParamVec input, Thresholds thresholds)
 {
-    SumAndValidCount result = {};
-
-    for (s32 i = 0; i < input.size; i++)
-    {
-        if (is_valid_and_inside(input[i], thresholds))
-        {
-            result.sum += input[i];
-            result.validCount++;
-        }
-    }
+    auto r = simd::kernels().sum(input.data, input.size, thresholds.min, thresholds.max);
 
-    return result;
+    return { r.value, r.count };
 }
 
 // mean = (sum(x for x in input) / validCount)
@@ -2022,20 +1972,12 @@ void aggregate_sigma_step(Operator *op, A2 *)
     auto thresholds = *reinterpret_cast<Thresholds *>(op->d);
 
     auto sv = calculate_sum_and_valid_count(input, thresholds);
-    double mean = sv.mean();
-    double sigma = 0.0;
-
-    for (s32 i = 0; i < input.size; i++)
-    {
-        if (is_valid_and_inside(input[i], thresholds))
-        {
-            double d = input[i] - mean;
-            sigma += d * d;
-        }
-    }
 
     if (sv.validCount)
     {
+        double sigma = simd::kernels().sum_of_squares(
+            input.data, input.size, thresholds.min, thresholds.max, sv.mean());
+
         sigma = std::sqrt(sigma / static_cast<double>(sv.validCount));
         output[0] = sigma;
     }
@@ -2348,39 +2290,13 @@ void range_filter_step(Operator *op, A2 *)
     assert(op->inputs[0].size == op->outputs[0].size);
     assert(op->type == Operator_RangeFilter);
 
-    const double invalid_p = invalid_param();
     auto input = op->inputs[0];
     auto output = op->outputs[0];
     auto data = *reinterpret_cast<RangeFilterData *>(op->d);
 
-    if (data.invert)
-    {
-        for (s32 pi = 0; pi < input.size; pi++)
-        {
-            if (!in_range(data.thresholds, input[pi]))
-            {
-                output[pi] = input[pi];
-            }
-            else
-            {
-                output[pi] = invalid_p;
-            }
-        }
-    }
-    else
-    {
-        for (s32 pi = 0; pi < input.size; pi++)
-        {
-            if (in_range(data.thresholds, input[pi]))
-            {
-                output[pi] = input[pi];
-            }
-            else
-            {
-                output[pi] = invalid_p;
-            }
-        }
-    }
+    simd::kernels().range_filter(
+        input.data, output.data, input.size,
+        data.thresholds.min, data.thresholds.max, data.invert);
 }
 
 void range_filter_step_idx(Operator *op, A2 *)
@@ -3077,7 +2993,10 @@ void expression_operator_step(Operator *op, A2 *)
     /* References to the input and output have been bound in
      * make_expression_operator(). No need to pass anything here, just evaluate
      * the step expression. */
-    d->expr_step.eval();
+    if (d->native_step)
+        d->native_step.eval();
+    else
+        d->expr_step.eval();
 }
 
 //
@@ -3246,6 +3165,7 @@ using Polygon = bg::model::polygon<
 struct ConditionPolygonData: public ConditionBaseData
 {
     Polygon polygon;
+    PolygonRaster raster;
     s32 xIndex;
     s32 yIndex;
 };
@@ -3343,7 +3263,9 @@ Operator make_polygon_condition(
     PipeVectors yInput,
     s32 xIndex,
     s32 yIndex,
-    const std::vector<std::pair<double, double>> &polygon)
+    const std::vector<std::pair<double, double>> &polygon,
+    double cellWidthX,
+    double cellWidthY)
 {
     auto result = make_condition_operator(arena, Operator_PolygonCondition, 2);
 
@@ -3365,8 +3287,11 @@ Operator make_polygon_condition(
         bg::append(d->polygon, Point{p.first, p.second});
     }
 
-    return result;
+    d->raster = make_polygon_raster(
+        polygon, cellWidthX, cellWidthY,
+        [d] (double x, double y) { return bg::within(Point{x, y}, d->polygon); });
 
+    return result;
 }
 
 void polygon_condition_step(Operator *op, A2 *a2)
@@ -3383,9 +3308,9 @@ void polygon_condition_step(Operator *op, A2 *a2)
     assert(d->xIndex < op->inputs[0].size);
     assert(d->yIndex < op->inputs[1].size);
 
-    Point p = { op->inputs[0][d->xIndex], op->inputs[1][d->yIndex] };
-
-    bool result = bg::within(p, d->polygon);
+    bool result = polygon_raster_within(
+        d->raster, op->inputs[0][d->xIndex], op->inputs[1][d->yIndex],
+        [d] (double x, double y) { return bg::within(Point{x, y}, d->polygon); });
 
     a2->conditionBits.set(d->bitIndex, result);
     set_condition_output(op, result);
@@ -3399,6 +3324,7 @@ struct ExpressionConditionData: ConditionBaseData
     a2_exprtk::Expression expr;
     TypedBlock<s32> inputParamIndexes;
     TypedBlock<double> values; // storage for input values. updated in step()
+    expr_codegen::NativeExpression nativeExpr;
 };
 
 Operator make_expression_condition(
@@ -3456,12 +3382,62 @@ void expression_condition_step(Operator *op, A2 *a2)
     }
 
     // Evaluate and interpret the result as a boolean
-    bool result = static_cast<bool>(d->expr.eval());
+    bool result = static_cast<bool>(d->nativeExpr ? d->nativeExpr.eval() : d->expr.eval());
 
     a2->conditionBits.set(d->bitIndex, result);
     set_condition_output(op, result);
 }
 
+// Native expressions
+
+/* Compiles the step expression of an expression operator or the expression of
+ * an expression condition to native code if enable is true. Otherwise or if
+ * code generation fails the exprtk expression is used. */
+void expression_native_begin_run(Operator *op, bool enable, Logger logger)
+{
+    expr_codegen::NativeExpression *native = nullptr;
+    a2_exprtk::SymbolTable *symtab = nullptr;
+    std::string exprString;
+    bool requireResult = false;
+    const char *what = nullptr;
+
+    if (op->type == Operator_Expression)
+    {
+        auto d = reinterpret_cast<ExpressionOperatorData *>(op->d);
+        native = &d->native_step;
+        symtab = &d->symtab_step;
+        exprString = d->expr_step.getExpressionString();
+        what = "Expression operator";
+    }
+    else if (op->type == Operator_ExpressionCondition)
+    {
+        auto d = reinterpret_cast<ExpressionConditionData *>(op->d);
+        native = &d->nativeExpr;
+        symtab = &d->symtab;
+        exprString = d->expr.getExpressionString();
+        // The result of the expression is the condition value.
+        requireResult = true;
+        what = "Expression condition";
+    }
+    else
+        return;
+
+    *native = {};
+
+    if (!enable)
+        return;
+
+    try
+    {
+        *native = expr_codegen::build(exprString, *symtab, requireResult);
+    }
+    catch (const expr_codegen::CodegenError &e)
+    {
+        if (logger)
+            logger(std::string(what) + ": native code not available, using exprtk: " + e.what());
+    }
+}
+
 #undef register_symbol
 
 /* ===============================================
@@ -3533,7 +3509,7 @@ inline void HistoFillDirect::fill_h1d(H1D *histo, double x)
 
         if (0 <= bin1 && bin1 < histo->size)
         {
-            histo->data[bin1]++;
+            increment_bin(histo->data, histo->storageType, bin1);
             ++histo->entryCount;
         }
     }
@@ -3587,7 +3563,11 @@ inline void HistoFillDirect::fill_h2d(H2D *histo, double x, double y)
 
         if (0 <= linearBin && linearBin < histo->size)
         {
-            ++histo->data[linearBin];
+            if (histo->tiles)
+                histo->tiles->increment(binX, binY);
+            else
+                increment_bin(histo->data, histo->storageType, linearBin);
+
             ++histo->entryCount;
         }
     }
@@ -3602,22 +3582,56 @@ inline bool is_full(const FillBuffer &buffer)
     return buffer.used >= buffer.bins.size();
 }
 
-void flush(H1D *histo, FillBuffer &buffer)
+// Note: sorting the bins before applying them was tried and is slower: with
+// 1024 entries spread over a 64k bin histogram nearly every increment touches
+// a different cache line anyway. The gain comes from the increments being
+// independent of each other which lets the CPU overlap the cache misses.
+inline void flush_bins(H1D *histo, const FillBuffer &buffer)
 {
-    //std::sort(std::begin(buffer.bins), std::end(buffer.bins));
+    const auto storageType = histo->storageType;
 
     for (size_t i=0; i<buffer.used; i++)
+        increment_bin(histo->data, storageType, buffer.bins[i]);
+}
+
+inline void flush_bins(H2D *histo, const FillBuffer &buffer)
+{
+    if (histo->tiles)
+    {
+        for (size_t i=0; i<buffer.used; i++)
+            histo->tiles->incrementLinear(buffer.bins[i]);
+    }
+    else
     {
-        s32 bin = buffer.bins[i];
-        histo->data[bin]++;
+        const auto storageType = histo->storageType;
+
+        for (size_t i=0; i<buffer.used; i++)
+            increment_bin(histo->data, storageType, buffer.bins[i]);
     }
+}
+
+template<typename Histo>
+void flush(Histo *histo, FillBuffer &buffer)
+{
+    if (!buffer.used)
+        return;
+
+    flush_bins(histo, buffer);
 
     histo->entryCount += buffer.used;
     buffer.used = 0;
 }
 
+template<typename Histo>
+inline size_t find_histo_index(const TypedBlock<Histo *, size_t> &histos, Histo *histo)
+{
+    auto it = std::lower_bound(histos.begin(), histos.end(), histo);
+    assert(it != histos.end() && *it == histo);
+    return it - histos.begin();
+}
+
 HistoFillBuffered::HistoFillBuffered()
-    : m_arena(1024 * 1024 * 256)
+    : m_arena(Megabytes(1))
 {}
 
 void HistoFillBuffered::begin_run(A2 *a2)
@@ -3625,6 +3639,7 @@ void HistoFillBuffered::begin_run(A2 *a2)
     m_arena.reset();
 
     std::vector<H1D *> histos_1d;
+    std::vector<H2D *> histos_2d;
 
     for (unsigned ei=0; ei<a2->operatorCounts.size(); ++ei)
     {
@@ -3634,7 +3649,7 @@ void HistoFillBuffered::begin_run(A2 *a2)
         {
             const auto &op = a2->operators[ei][opIdx];
 
-            if (op.type == Operator_H1DSink)
+            if (op.type == Operator_H1DSink || op.type == Operator_H1DSink_idx)
             {
                 auto d = reinterpret_cast<H1DSinkData *>(op.d);
 
@@ -3642,102 +3657,227 @@ void HistoFillBuffered::begin_run(A2 *a2)
                     histos_1d.push_back(&h1d);
 
             }
-            else if (op.type == Operator_H1DSink_idx)
+            else if (op.type == Operator_H2DSink)
             {
-                auto d = reinterpret_cast<H1DSinkData_idx *>(op.d);
-
-                histos_1d.push_back(&d->histos[d->inputIndex]);
+                auto d = reinterpret_cast<H2DSinkData *>(op.d);
+                histos_2d.push_back(&d->histo);
             }
         }
     }
 
     // Sort so that std::lower_bound() works.
     std::sort(std::begin(histos_1d), std::end(histos_1d));
+    std::sort(std::begin(histos_2d), std::end(histos_2d));
+
+    m_histos1d = push_copy_typed_block<H1D *, size_t>(&m_arena, histos_1d);
+    m_buffers1d = push_typed_block<FillBuffer, size_t>(&m_arena, m_histos1d.size);
+    m_histos2d = push_copy_typed_block<H2D *, size_t>(&m_arena, histos_2d);
+    m_buffers2d = push_typed_block<FillBuffer, size_t>(&m_arena, m_histos2d.size);
 
-    m_histos =  push_copy_typed_block(&m_arena, histos_1d);
-    m_buffers = push_typed_block<FillBuffer, size_t>(&m_arena, m_histos.size);
+    for (auto &buffer: m_buffers1d)
+        buffer.used = 0;
+
+    for (auto &buffer: m_buffers2d)
+        buffer.used = 0;
 }
 
 void HistoFillBuffered::end_run(A2 *)
 {
-    for (size_t i=0; i<m_histos.size; i++)
-    {
-        auto histo = m_histos[i];
-        auto &buffer = m_buffers[i];
-        flush(histo, buffer);
-    }
+    flush();
+}
+
+void HistoFillBuffered::flush()
+{
+    for (size_t i=0; i<m_histos1d.size; i++)
+        a2::flush(m_histos1d[i], m_buffers1d[i]);
+
+    for (size_t i=0; i<m_histos2d.size; i++)
+        a2::flush(m_histos2d[i], m_buffers2d[i]);
 }
 
 void HistoFillBuffered::fill_h1d(H1D *histo, double x)
 {
     if (range_check_update(histo, x))
     {
-        auto it = std::lower_bound(m_histos.begin(), m_histos.end(), histo);
-        assert(it != m_histos.end());
-        auto idx = it - m_histos.begin();
-
-        auto &buffer = m_buffers[idx];
-        assert(buffer.used < buffer.bins.size());
-
         assert(0 <= get_bin(*histo, x) && get_bin(*histo, x) < histo->size);
 
         s32 bin = static_cast<s32>(get_bin_unchecked(x, histo->binning.min, histo->binningFactor));
-        buffer.bins[buffer.used++] = bin;
-
-        if (is_full(buffer))
-            flush(histo, buffer);
-    }
-}
-
-void HistoFillBuffered::fill_h2d(H2D *histo, double x, double y)
-{
-    HistoFillDirect().fill_h2d(histo, x, y);
-}
-
-inline double get_value(H1D histo, double x)
-{
-    s32 bin = get_bin(histo, x);
-    return (bin < 0) ? 0.0 : histo.data[bin];
-}
 
-void clear_histo(H1D *histo)
-{
-    histo->binningFactor = 0.0;
+        if (0 <= bin && bin < histo->size)
+        {
+            auto &buffer = m_buffers1d[find_histo_index(m_histos1d, histo)];
+            assert(buffer.used < buffer.bins.size());
 
-    histo->entryCount = 0.0;
-    histo->nans = 0.0;
-    histo->underflows = 0.0;
-    histo->overflows = 0.0;
+            buffer.bins[buffer.used++] = bin;
 
-    std::fill(histo->data, histo->data + histo->size, 0.0);
+            if (is_full(buffer))
+                a2::flush(histo, buffer);
+        }
+    }
 }
 
-/* Note: The H1D instances in the 'histos' variable are copied. This means
- * during runtime only the H1D structures inside H1DSinkData are updated.
- * Histogram storage itself is not copied. It is assumed that this storage is
- * handled separately.
- * The implementation could be changed to store an array of pointers to H1D.
- * Then the caller would have to keep the H1D instances around too.
- */
-Operator make_h1d_sink(
-    Arena *arena,
-    PipeVectors inPipe,
-    TypedBlock<H1D, s32> histos)
+void HistoFillBuffered::fill_h2d(H2D *histo, double x, double y)
 {
-    assert(inPipe.data.size == histos.size);
-    auto result = make_operator(arena, Operator_H1DSink, 1, 0);
-    assign_input(&result, inPipe, 0);
-
-    auto d = arena->pushStruct<H1DSinkData>();
-    result.d = d;
-
-    d->histos = push_typed_block<H1D, s32>(arena, histos.size);
+    // Same checks and counter updates as HistoFillDirect::fill_h2d().
+    const auto binX = get_bin(*histo, H2D::XAxis, x);
+    const auto binY = get_bin(*histo, H2D::YAxis, y);
 
-    for (s32 i = 0; i < histos.size; i++)
+    if (std::isnan(x))
     {
-        d->histos[i] = histos[i];
+        ++histo->nans[H2D::XAxis];
     }
-
+    else if (std::isnan(y))
+    {
+        ++histo->nans[H2D::YAxis];
+    }
+    else if (binX == Binning::Underflow)
+    {
+        ++histo->underflows[H2D::XAxis];
+    }
+    else if (binX == Binning::Overflow)
+    {
+        ++histo->overflows[H2D::XAxis];
+    }
+    else if (binX == Binning::Invalid)
+    {
+    }
+    else if (binY == Binning::Underflow)
+    {
+        ++histo->underflows[H2D::YAxis];
+    }
+    else if (binY == Binning::Overflow)
+    {
+        ++histo->overflows[H2D::YAxis];
+    }
+    else if (binY == Binning::Invalid)
+    {
+    }
+    else
+    {
+        const s32 linearBin = binY * histo->binCounts[H2D::XAxis] + binX;
+
+        assert(0 <= linearBin && linearBin < histo->size);
+
+        if (0 <= linearBin && linearBin < histo->size)
+        {
+            auto &buffer = m_buffers2d[find_histo_index(m_histos2d, histo)];
+            assert(buffer.used < buffer.bins.size());
+
+            buffer.bins[buffer.used++] = linearBin;
+
+            if (is_full(buffer))
+                a2::flush(histo, buffer);
+        }
+    }
+}
+
+//
+// HistoFillStrategy
+//
+
+const char *HistoFillStrategy::name() const
+{
+    switch (m_type)
+    {
+        case HistoFillStrategyType::Direct:
+            return HistoFillDirect::name();
+        case HistoFillStrategyType::Buffered:
+            return HistoFillBuffered::name();
+    }
+
+    return "unknown";
+}
+
+void HistoFillStrategy::setType(HistoFillStrategyType type)
+{
+    m_type = type;
+
+    if (m_type == HistoFillStrategyType::Buffered && !m_buffered)
+        m_buffered = std::make_unique<HistoFillBuffered>();
+    else if (m_type != HistoFillStrategyType::Buffered)
+        m_buffered.reset();
+}
+
+void HistoFillStrategy::begin_run(A2 *a2)
+{
+    if (m_buffered)
+        m_buffered->begin_run(a2);
+}
+
+void HistoFillStrategy::end_run(A2 *a2)
+{
+    if (m_buffered)
+        m_buffered->end_run(a2);
+}
+
+void HistoFillStrategy::flush()
+{
+    MVME_PROFILE_SCOPE("a2_histo_fill_flush");
+
+    if (m_buffered)
+        m_buffered->flush();
+}
+
+inline void HistoFillStrategy::fill_h1d(H1D *histo, double x)
+{
+    if (m_buffered)
+        m_buffered->fill_h1d(histo, x);
+    else
+        HistoFillDirect().fill_h1d(histo, x);
+}
+
+inline void HistoFillStrategy::fill_h2d(H2D *histo, double x, double y)
+{
+    if (m_buffered)
+        m_buffered->fill_h2d(histo, x, y);
+    else
+        HistoFillDirect().fill_h2d(histo, x, y);
+}
+
+inline double get_value(H1D histo, double x)
+{
+    s32 bin = get_bin(histo, x);
+    return (bin < 0) ? 0.0 : read_bin(histo.data, histo.storageType, bin);
+}
+
+void clear_histo(H1D *histo)
+{
+    histo->binningFactor = 0.0;
+
+    histo->entryCount = 0.0;
+    histo->nans = 0.0;
+    histo->underflows = 0.0;
+    histo->overflows = 0.0;
+
+    clear_bins(histo->data, histo->storageType, histo->size);
+}
+
+/* Note: The H1D instances in the 'histos' variable are copied. This means
+ * during runtime only the H1D structures inside H1DSinkData are updated.
+ * Histogram storage itself is not copied. It is assumed that this storage is
+ * handled separately.
+ * The implementation could be changed to store an array of pointers to H1D.
+ * Then the caller would have to keep the H1D instances around too.
+ */
+Operator make_h1d_sink(
+    Arena *arena,
+    PipeVectors inPipe,
+    TypedBlock<H1D, s32> histos)
+{
+    assert(inPipe.data.size == histos.size);
+    auto result = make_operator(arena, Operator_H1DSink, 1, 0);
+    assign_input(&result, inPipe, 0);
+
+    auto d = arena->pushStruct<H1DSinkData>();
+    result.d = d;
+
+    d->histos = push_typed_block<H1D, s32>(arena, histos.size);
+
+    for (s32 i = 0; i < histos.size; i++)
+    {
+        d->histos[i] = histos[i];
+    }
+
     return result;
 }
 
@@ -4078,16 +4218,16 @@ void rate_monitor_sample_flow(Operator *op)
 
 struct WaveformSinkData
 {
-    // Trace histories by input array index.
-    mesytec::mvlc::Protected<mesytec::mvme::waveforms::TraceHistories> *traceHistories_;
-    size_t traceHistoryMaxDepth_;
+    // Trace rings by input array index. Shared with the analysis::WaveformSink
+    // which hands out snapshots to the UI.
+    std::shared_ptr<mesytec::mvme::waveforms::TraceRings> traceRings_;
     size_t linearEventNumber_;
 };
 
 Operator make_waveform_sink(
     memory::Arena *arena,
     const std::vector<PipeVectors> &inputs,
-    mesytec::mvlc::Protected<mesytec::mvme::waveforms::TraceHistories> &traceHistories,
+    mesytec::mvlc::Protected<std::shared_ptr<mesytec::mvme::waveforms::TraceRings>> &traceRings,
     size_t traceHistoryMaxDepth
     )
 {
@@ -4105,9 +4245,14 @@ Operator make_waveform_sink(
         assign_input(&result, inputs[ii], ii);
     }
 
-    d->traceHistories_ = &traceHistories;
-    d->traceHistories_->access()->resize(inputCount-2);
-    d->traceHistoryMaxDepth_ = traceHistoryMaxDepth;
+    // One ring per channel input, sized to hold the full input array.
+    std::vector<size_t> maxSamples;
+
+    for (size_t ii = 2; ii < inputCount; ++ii)
+        maxSamples.push_back(inputs[ii].data.size);
+
+    d->traceRings_ = mesytec::mvme::waveforms::make_trace_rings(maxSamples, traceHistoryMaxDepth);
+    traceRings.access().ref() = d->traceRings_;
     d->linearEventNumber_ = 0;
 
     return result;
@@ -4119,12 +4264,9 @@ void waveform_sink_step(Operator *op, A2 *)
     assert(op->type == Operator_WaveformSink);
 
     auto d = reinterpret_cast<WaveformSinkData *>(op->d);
+    auto &rings = d->traceRings_->channels;
 
-    // lock the trace histories until the end of the function
-    auto access = d->traceHistories_->access();
-    auto &traceHistories = access.ref();
-
-    assert(op->inputCount == static_cast<s32>(traceHistories.size()) + 2);
+    assert(op->inputCount == static_cast<s32>(rings.size()) + 2);
 
     const auto &phases = op->inputs[0];
     const auto &configs = op->inputs[1];
@@ -4133,53 +4275,249 @@ void waveform_sink_step(Operator *op, A2 *)
     {
         const auto &input = op->inputs[idx];
         const s32 channelIdx = idx - 2;
-        auto &traceHistory = traceHistories[channelIdx];
+        auto &ring = *rings[channelIdx];
+
+        double *samples = ring.beginWrite();
+        const s32 maxSamples = std::min(input.size, static_cast<s32>(ring.maxSamples()));
+        s32 sampleCount = 0;
+
+        // Copy the samples, stop when hitting the first invalid parameter in
+        // the input array.
+        for (; sampleCount < maxSamples; ++sampleCount)
+        {
+            auto value = input[sampleCount];
+
+            if (!is_param_valid(value))
+                break;
+
+            samples[sampleCount] = value;
+        }
+
+        mesytec::mvme::waveforms::TraceRecordMeta meta;
+
+        // phase handling - no phase correction, just store the phase value
+        if (channelIdx < phases.size && is_param_valid(phases[channelIdx]))
+            meta.phase = phases[channelIdx];
 
-        mesytec::mvme::waveforms::Trace trace;
+        if (channelIdx < configs.size && is_param_valid(configs[channelIdx]))
+            meta.config = static_cast<u32>(configs[channelIdx]);
+
+        meta.eventNumber = static_cast<u32>(d->linearEventNumber_);
+
+        ring.commitWrite(sampleCount, meta);
+    }
+
+    ++d->linearEventNumber_;
+}
+
+//
+// WaveformFeatures
+//
+
+// Input 0 is the phase array, input 1 the config array, the channel sample
+// arrays follow.
+static const s32 WaveformFeaturesFirstChannelInput = 2;
+
+Operator make_waveform_features(
+    memory::Arena *arena,
+    const std::vector<PipeVectors> &inputs,
+    const WaveformFeaturesParameters &params)
+{
+    assert(inputs.size() >= static_cast<size_t>(WaveformFeaturesFirstChannelInput));
+
+    const auto inputCount = inputs.size();
+    const auto channelCount = inputCount - WaveformFeaturesFirstChannelInput;
+
+    auto result = make_operator(arena, Operator_WaveformFeatures, inputCount, WaveformFeature_Count);
+
+    auto d = arena->pushObject<WaveformFeaturesParameters>(params);
+    result.d = d;
+
+    for (auto ii = 0u; ii < inputCount; ii++)
+        assign_input(&result, inputs[ii], ii);
+
+    // Output limits are derived from the sample limits and the longest trace.
+    double sampleMin = 0.0;
+    double sampleMax = 0.0;
+    s32 maxSamples = 0;
 
-        // reuse the memory of the oldest trace object if the history is full
-        if (traceHistory.size() >= d->traceHistoryMaxDepth_)
+    for (auto ii = static_cast<size_t>(WaveformFeaturesFirstChannelInput); ii < inputCount; ++ii)
+    {
+        const auto &input = inputs[ii];
+
+        if (input.size() > 0)
         {
-            trace = std::move(traceHistory.back());
-            traceHistory.pop_back();
+            sampleMin = std::min(sampleMin, input.lowerLimits[0]);
+            sampleMax = std::max(sampleMax, input.upperLimits[0]);
+            maxSamples = std::max(maxSamples, input.size());
         }
+    }
+
+    const double sampleRange = sampleMax - sampleMin;
+    const double timeMax = (maxSamples + 1) * params.dtSample;
+
+    push_output_vectors(arena, &result, WaveformFeature_Baseline, channelCount, sampleMin, sampleMax);
+    push_output_vectors(arena, &result, WaveformFeature_Amplitude, channelCount, 0.0, sampleRange);
+    push_output_vectors(arena, &result, WaveformFeature_Integral, channelCount, 0.0, sampleRange * maxSamples);
+    push_output_vectors(arena, &result, WaveformFeature_RiseTime, channelCount, 0.0, timeMax);
+    push_output_vectors(arena, &result, WaveformFeature_CfdTime, channelCount, 0.0, timeMax);
+
+    return result;
+}
+
+// Interpolated position where the leading edge ending at peakIndex crosses
+// the given level.
+inline double find_leading_edge_crossing(const double *samples, s32 peakIndex, double level)
+{
+    for (s32 i = peakIndex; i > 0; --i)
+    {
+        if (samples[i-1] < level && samples[i] >= level)
+            return (i - 1) + (level - samples[i-1]) / (samples[i] - samples[i-1]);
+    }
+
+    return invalid_param();
+}
+
+WaveformFeatures extract_waveform_features(
+    const double *samples, s32 size, const WaveformFeaturesParameters &params)
+{
+    const double Inf = std::numeric_limits<double>::infinity();
+    const auto &kernels = simd::kernels();
+
+    WaveformFeatures result =
+    {
+        invalid_param(), invalid_param(), invalid_param(), invalid_param(), invalid_param()
+    };
+
+    const s32 baselineSamples = std::min(static_cast<s32>(params.baselineSamples), size);
+
+    if (size <= 0 || size <= baselineSamples)
+        return result;
+
+    double baseline = 0.0;
+
+    if (baselineSamples > 0)
+        baseline = kernels.sum(samples, baselineSamples, -Inf, Inf).value / baselineSamples;
+
+    auto maxResult = kernels.max(samples, size, -Inf, Inf);
+    const s32 peakIndex = std::find(samples, samples + size, maxResult.value) - samples;
+    const double amplitude = maxResult.value - baseline;
+
+    result.baseline = baseline;
+    result.amplitude = amplitude;
+
+    const s32 integralStart = std::min(static_cast<s32>(params.integralStart), size);
+    s32 integralLength = size - integralStart;
+
+    if (params.integralLength > 0)
+        integralLength = std::min(static_cast<s32>(params.integralLength), integralLength);
+
+    if (integralLength > 0)
+    {
+        result.integral = kernels.sum(samples + integralStart, integralLength, -Inf, Inf).value
+            - baseline * integralLength;
+    }
+
+    if (!(amplitude > 0.0))
+        return result;
+
+    const double t10 = find_leading_edge_crossing(samples, peakIndex, baseline + 0.1 * amplitude);
+    const double t90 = find_leading_edge_crossing(samples, peakIndex, baseline + 0.9 * amplitude);
+
+    if (is_param_valid(t10) && is_param_valid(t90))
+        result.riseTime = t90 - t10;
+
+    // Digital CFD: cfd[i] = fraction * x[i] - x[i - delay] with x being the
+    // baseline corrected samples. On the leading edge the attenuated signal
+    // rises first. The zero crossing after the maximum of the cfd signal is
+    // independent of the amplitude.
+    const s32 delay = std::max(static_cast<s32>(params.cfdDelay), 1);
+    const double fraction = params.cfdFraction;
+
+    auto cfd = [=] (s32 i)
+    {
+        return fraction * (samples[i] - baseline) - (samples[i - delay] - baseline);
+    };
+
+    if (delay >= size)
+        return result;
 
-        trace.clear();
-        trace.reserve(input.size);
+    s32 cfdMaxIndex = delay;
+    double cfdMax = cfd(delay);
 
-        // Fill the trace with (paramIndex, value) pairs
-        for (s32 paramIndex = 0; paramIndex < input.size; ++paramIndex)
+    for (s32 i = delay + 1; i <= std::min(peakIndex, size - 1); ++i)
+    {
+        if (double c = cfd(i); c > cfdMax)
         {
-            auto value = input[paramIndex];
+            cfdMax = c;
+            cfdMaxIndex = i;
+        }
+    }
 
-            // stop copying when hitting the first invalid parameter in the input array
-            if (!is_param_valid(value))
-                break;
+    if (!(cfdMax > 0.0))
+        return result;
+
+    double prev = cfdMax;
 
-            trace.push_back(paramIndex, value);
+    for (s32 i = cfdMaxIndex + 1; i < size; ++i)
+    {
+        double c = cfd(i);
+
+        if (c <= 0.0)
+        {
+            result.cfdTime = (i - 1) + prev / (prev - c);
+            break;
         }
 
-        // phase handling - no phase correction, just store the phase value
+        prev = c;
+    }
+
+    return result;
+}
+
+void waveform_features_step(Operator *op, A2 *)
+{
+    a2_trace("\n");
+    assert(op->type == Operator_WaveformFeatures);
+
+    const auto &params = *reinterpret_cast<WaveformFeaturesParameters *>(op->d);
+    const auto &phases = op->inputs[0];
+    const auto &configs = op->inputs[1];
+    const double Inf = std::numeric_limits<double>::infinity();
+
+    for (s32 idx = WaveformFeaturesFirstChannelInput; idx < op->inputCount; ++idx)
+    {
+        const auto &input = op->inputs[idx];
+        const s32 channelIdx = idx - WaveformFeaturesFirstChannelInput;
+
+        // The decoder writes the valid samples to the front of the array and
+        // invalidates the rest.
+        const s32 sampleCount = simd::kernels().sum(input.data, input.size, -Inf, Inf).count;
+        auto features = extract_waveform_features(input.data, sampleCount, params);
+
         double phase = 1.0;
         if (channelIdx < phases.size && is_param_valid(phases[channelIdx]))
-        {
             phase = phases[channelIdx];
-        }
 
         u32 config = 0;
         if (channelIdx < configs.size && is_param_valid(configs[channelIdx]))
-        {
             config = static_cast<u32>(configs[channelIdx]);
-        }
 
-        trace.meta["phase"] = phase;
-        trace.meta["config"] = config;
-        trace.meta["event_number"] = static_cast<u32>(d->linearEventNumber_);
+        bool correctPhase = params.phaseCorrection == WaveformPhaseCorrection::On
+            || (params.phaseCorrection == WaveformPhaseCorrection::Auto
+                && (config & mesytec::mvme::mdpp_sampling::SamplingSettings::NoResampling));
 
-        traceHistory.push_front(std::move(trace));
-    }
+        // Same x offset as used by waveforms::scale_x_values().
+        double timeOffset = correctPhase ? 1.0 - phase : 0.0;
 
-    ++d->linearEventNumber_;
+        op->outputs[WaveformFeature_Baseline][channelIdx] = features.baseline;
+        op->outputs[WaveformFeature_Amplitude][channelIdx] = features.amplitude;
+        op->outputs[WaveformFeature_Integral][channelIdx] = features.integral;
+        op->outputs[WaveformFeature_RiseTime][channelIdx] = is_param_valid(features.riseTime)
+            ? features.riseTime * params.dtSample : invalid_param();
+        op->outputs[WaveformFeature_CfdTime][channelIdx] = is_param_valid(features.cfdTime)
+            ? (features.cfdTime + timeOffset) * params.dtSample : invalid_param();
+    }
 }
 
 //
@@ -4271,50 +4609,227 @@ Operator make_export_sink(
  * > The export sink code enables exceptions both for the low level ofstream
  *   and for the zstr ostream.
  *
- *   All I/O operations must be wrapped in a try/catch block. Additionally any
- *   further I/O operations are only performed if the good() method of the
- *   stream returns true. This means after the first I/O exception is caught no
+ *   All I/O operations are done by the ExportSinkWriter thread and are wrapped
+ *   in a try/catch block. After the first I/O exception is caught the writer
+ *   sets its failed flag. The step functions stop producing data and no
  *   further attempts at writing to the file are performed.
  */
 
-void export_sink_begin_run(Operator *op, Logger logger)
+struct ExportSinkChunk
 {
-    a2_trace("\n");
-    assert(op->type == Operator_ExportSinkFull
-           || op->type == Operator_ExportSinkSparse
-           || op->type == Operator_ExportSinkCsv
-           );
+    std::unique_ptr<char[]> data;
+    size_t used = 0;
+};
 
-    auto d = reinterpret_cast<ExportSinkData *>(op->d);
+/* Moves raw export data from the analysis thread to a writer thread which
+ * does the (optional) compression and the file I/O.
+ *
+ * The analysis thread appends to the current chunk. Full chunks are passed to
+ * the writer via the filled queue, the writer returns them via the free
+ * queue. Both queues are lock-free, the semaphores count the chunks in each
+ * of the queues and are used to sleep while waiting. The analysis thread only
+ * ever blocks if all chunks are waiting to be written. */
+struct ExportSinkWriter
+{
+    ExportSinkData *d;
+    std::ostream *outp;
+    std::vector<ExportSinkChunk> chunks;
+    mpmc_bounded_queue<ExportSinkChunk *> freeQueue;
+    mpmc_bounded_queue<ExportSinkChunk *> filledQueue;
+    LightweightSemaphore freeSem;
+    LightweightSemaphore filledSem;
+    ExportSinkChunk *current = nullptr;
+    std::atomic<bool> quit;
+    std::atomic<bool> failed;
+    std::thread writerThread;
+
+    static size_t queue_size(size_t chunkCount)
+    {
+        size_t result = 2;
+
+        while (result < chunkCount)
+            result <<= 1;
 
-    if (op->type == Operator_ExportSinkCsv)
-        d->ostream.reset(new std::ofstream(d->filename, std::ios::trunc));
-    else
-        d->ostream.reset(new std::ofstream(d->filename, std::ios::binary | std::ios::trunc));
+        return result;
+    }
 
-    // Enable ios exceptions for the lowest level output stream. This operation can throw.
-    try
+    ExportSinkWriter(ExportSinkData *d_, std::ostream *outp_)
+        : d(d_)
+        , outp(outp_)
+        , chunks(ExportSinkData::WriterChunkCount)
+        , freeQueue(queue_size(ExportSinkData::WriterChunkCount))
+        , filledQueue(queue_size(ExportSinkData::WriterChunkCount))
+        , quit(false)
+        , failed(false)
     {
-        d->ostream->exceptions(std::ios::failbit | std::ios::badbit);
-
-        if (d->compressionLevel != 0)
+        for (auto &chunk: chunks)
         {
-            d->z_ostream.reset(new zstr::ostream(*d->ostream));
+            chunk.data.reset(new char[ExportSinkData::WriterChunkSize]);
+            freeQueue.enqueue(&chunk);
         }
 
-        std::ostringstream ss;
-        ss << "File Export: Opened output file " << d->filename;
-        logger(ss.str());
+        // One chunk is taken right away to be filled by the analysis.
+        freeQueue.dequeue(current);
+        freeSem.signal(chunks.size() - 1);
 
-        if (op->type == Operator_ExportSinkCsv)
-        {
-            auto outp = d->getOstream();
-            for (const auto &col: d->csvColumns)
-                *outp << col << ",";
-            *outp << "\n";
-        }
+        writerThread = std::thread(&ExportSinkWriter::writerLoop, this);
     }
-    catch (const std::exception &e)
+
+    ~ExportSinkWriter()
+    {
+        stop();
+    }
+
+    // Queues the remaining data, waits for the writer to finish writing and
+    // stops the writer thread.
+    void stop()
+    {
+        if (!writerThread.joinable())
+            return;
+
+        if (current && current->used)
+        {
+            queueCurrent();
+            current = nullptr;
+        }
+
+        quit = true;
+        filledSem.signal();
+        writerThread.join();
+    }
+
+    void writerLoop()
+    {
+        while (true)
+        {
+            filledSem.wait();
+
+            ExportSinkChunk *chunk = nullptr;
+
+            if (!filledQueue.dequeue(chunk))
+            {
+                // Chunks are queued before the quit flag is set, so the queue
+                // is drained at this point.
+                if (quit)
+                    break;
+                continue;
+            }
+
+            if (!failed)
+            {
+                try
+                {
+                    outp->write(chunk->data.get(), chunk->used);
+                }
+                catch (const std::exception &e)
+                {
+                    std::ostringstream ss;
+                    ss << "Error writing to output file " << d->filename << ": " << e.what();
+                    d->setLastError(ss.str());
+                    failed = true;
+                }
+            }
+
+            chunk->used = 0;
+            --d->writerQueueFill;
+            freeQueue.enqueue(chunk);
+            freeSem.signal();
+        }
+    }
+
+    void queueCurrent()
+    {
+        ++d->writerQueueFill;
+        filledQueue.enqueue(current);
+        filledSem.signal();
+    }
+
+    // Hands the current chunk to the writer and takes a free chunk. Blocks if
+    // all chunks are queued for writing.
+    void nextChunk()
+    {
+        queueCurrent();
+
+        if (!freeSem.tryWait())
+        {
+            ++d->writerStalls;
+            freeSem.wait();
+        }
+
+        bool dequeued = freeQueue.dequeue(current);
+        assert(dequeued); (void) dequeued;
+    }
+
+    void append(const void *data, size_t size)
+    {
+        auto src = reinterpret_cast<const char *>(data);
+
+        while (size)
+        {
+            if (current->used == ExportSinkData::WriterChunkSize)
+                nextChunk();
+
+            size_t bytes = std::min(size, ExportSinkData::WriterChunkSize - current->used);
+            std::memcpy(current->data.get() + current->used, src, bytes);
+            current->used += bytes;
+            src += bytes;
+            size -= bytes;
+        }
+    }
+
+    template<typename T>
+    void append(const T &value)
+    {
+        append(&value, sizeof(value));
+    }
+};
+
+void export_sink_begin_run(Operator *op, Logger logger)
+{
+    a2_trace("\n");
+    assert(op->type == Operator_ExportSinkFull
+           || op->type == Operator_ExportSinkSparse
+           || op->type == Operator_ExportSinkCsv
+           );
+
+    auto d = reinterpret_cast<ExportSinkData *>(op->d);
+
+    d->writer = {};
+    d->writerQueueFill = 0;
+    d->writerStalls = 0;
+
+    if (op->type == Operator_ExportSinkCsv)
+        d->ostream.reset(new std::ofstream(d->filename, std::ios::trunc));
+    else
+        d->ostream.reset(new std::ofstream(d->filename, std::ios::binary | std::ios::trunc));
+
+    // Enable ios exceptions for the lowest level output stream. This operation can throw.
+    try
+    {
+        d->ostream->exceptions(std::ios::failbit | std::ios::badbit);
+
+        if (d->compressionLevel != 0)
+        {
+            d->z_ostream.reset(new zstr::ostream(*d->ostream));
+        }
+
+        std::ostringstream ss;
+        ss << "File Export: Opened output file " << d->filename;
+        logger(ss.str());
+
+        d->writer = std::make_shared<ExportSinkWriter>(d, d->getOstream());
+
+        if (op->type == Operator_ExportSinkCsv)
+        {
+            for (const auto &col: d->csvColumns)
+            {
+                d->writer->append(col.data(), col.size());
+                d->writer->append(',');
+            }
+            d->writer->append('\n');
+        }
+    }
+    catch (const std::exception &e)
     {
         std::ostringstream ss;
         ss << "File Export: Error opening output file " << d->filename << ": " << e.what();
@@ -4323,18 +4838,17 @@ void export_sink_begin_run(Operator *op, Logger logger)
     }
 }
 
-void export_sink_full_step(Operator *op, A2 *)
+// Returns the writer if data should be written for the current event.
+// Otherwise nullptr is returned and dataInputCount is undefined.
+static ExportSinkWriter *export_sink_step_prepare(Operator *op, s32 &dataInputCount)
 {
-    a2_trace("\n");
-    assert(op->type == Operator_ExportSinkFull);
-
     auto d = reinterpret_cast<ExportSinkData *>(op->d);
+    auto writer = d->writer.get();
 
-    auto outp = d->getOstream();
-
-    if (!outp) return;
+    if (!writer || writer->failed.load(std::memory_order_relaxed))
+        return nullptr;
 
-    s32 dataInputCount = op->inputCount;
+    dataInputCount = op->inputCount;
 
     // Test the condition input if it's used
     if (d->condIndex >= 0)
@@ -4342,41 +4856,41 @@ void export_sink_full_step(Operator *op, A2 *)
         assert(d->condIndex < op->inputs[op->inputCount - 1].size);
 
         if (!is_param_valid(op->inputs[op->inputCount - 1][d->condIndex]))
-            return;
+            return nullptr;
 
         dataInputCount = op->inputCount - 1;
     }
 
-    try
-    {
-        if (outp->good())
-        {
-            for (s32 inputIndex = 0;
-                 inputIndex < dataInputCount && outp->good();
-                 inputIndex++)
-            {
-                auto input = op->inputs[inputIndex];
-                assert(input.size <= std::numeric_limits<u16>::max());
+    return writer;
+}
 
-                size_t bytes = input.size * sizeof(double);
+void export_sink_full_step(Operator *op, A2 *)
+{
+    a2_trace("\n");
+    assert(op->type == Operator_ExportSinkFull);
 
-                outp->write(reinterpret_cast<char *>(input.data), bytes);
+    auto d = reinterpret_cast<ExportSinkData *>(op->d);
+    s32 dataInputCount = 0;
+    auto writer = export_sink_step_prepare(op, dataInputCount);
 
-                d->bytesWritten += bytes;
-            }
+    if (!writer) return;
 
-            d->eventsWritten++;
-        }
-    }
-    catch (const std::exception &e)
+    for (s32 inputIndex = 0; inputIndex < dataInputCount; inputIndex++)
     {
-        std::ostringstream ss;
-        ss << "Error writing to output file " << d->filename << ": " << e.what();
-        d->setLastError(ss.str());
+        auto input = op->inputs[inputIndex];
+        assert(input.size <= std::numeric_limits<u16>::max());
+
+        size_t bytes = input.size * sizeof(double);
+
+        writer->append(input.data, bytes);
+
+        d->bytesWritten += bytes;
     }
+
+    d->eventsWritten++;
 }
 
-static size_t write_indexed_parameter_vector(std::ostream &out, const ParamVec &vec)
+static size_t write_indexed_parameter_vector(ExportSinkWriter &out, const ParamVec &vec)
 {
     assert(vec.size >= 0);
     assert(vec.size <= std::numeric_limits<u16>::max());
@@ -4393,7 +4907,7 @@ static size_t write_indexed_parameter_vector(std::ostream &out, const ParamVec &
     // Write a size prefix and two arrays with length 'validCount', one
     // containing 16-bit index values, the other containing the corresponding
     // parameter values.
-    out.write(reinterpret_cast<char *>(&validCount), sizeof(validCount));
+    out.append(validCount);
     bytesWritten += sizeof(validCount);
 
     for (u16 i = 0; i < static_cast<u16>(vec.size); i++)
@@ -4401,7 +4915,7 @@ static size_t write_indexed_parameter_vector(std::ostream &out, const ParamVec &
         if (is_param_valid(vec[i]))
         {
             // 16-bit index value
-            out.write(reinterpret_cast<char *>(&i), sizeof(i));
+            out.append(i);
             bytesWritten += sizeof(i);
         }
     }
@@ -4411,7 +4925,7 @@ static size_t write_indexed_parameter_vector(std::ostream &out, const ParamVec &
         if (is_param_valid(vec[i]))
         {
             // 64-bit double value
-            out.write(reinterpret_cast<char *>(vec.data + i), sizeof(double));
+            out.append(vec.data[i]);
             bytesWritten += sizeof(double);
         }
     }
@@ -4425,48 +4939,21 @@ void export_sink_sparse_step(Operator *op, A2 *)
     assert(op->type == Operator_ExportSinkSparse);
 
     auto d = reinterpret_cast<ExportSinkData *>(op->d);
+    s32 dataInputCount = 0;
+    auto writer = export_sink_step_prepare(op, dataInputCount);
 
-    auto outp = d->getOstream();
-
-    if (!outp) return;
+    if (!writer) return;
 
-    s32 dataInputCount = op->inputCount;
-
-    // Test the condition input if it's used
-    if (d->condIndex >= 0)
+    for (s32 inputIndex = 0; inputIndex < dataInputCount; inputIndex++)
     {
-        assert(d->condIndex < op->inputs[op->inputCount - 1].size);
+        auto input = op->inputs[inputIndex];
+        assert(input.size <= std::numeric_limits<u16>::max());
 
-        if (!is_param_valid(op->inputs[op->inputCount - 1][d->condIndex]))
-            return;
-
-        dataInputCount = op->inputCount - 1;
+        size_t bytes = write_indexed_parameter_vector(*writer, input);
+        d->bytesWritten += bytes;
     }
 
-    try
-    {
-        if (outp->good())
-        {
-            for (s32 inputIndex = 0;
-                 inputIndex < dataInputCount && outp->good();
-                 inputIndex++)
-            {
-                auto input = op->inputs[inputIndex];
-                assert(input.size <= std::numeric_limits<u16>::max());
-
-                size_t bytes = write_indexed_parameter_vector(*outp, input);
-                d->bytesWritten += bytes;
-            }
-
-            d->eventsWritten++;
-        }
-    }
-    catch (const std::exception &e)
-    {
-        std::ostringstream ss;
-        ss << "Error writing to output file " << d->filename << ": " << e.what();
-        d->setLastError(ss.str());
-    }
+    d->eventsWritten++;
 }
 
 void export_sink_csv_step(Operator *op, A2 *)
@@ -4475,56 +4962,35 @@ void export_sink_csv_step(Operator *op, A2 *)
     assert(op->type == Operator_ExportSinkCsv);
 
     auto d = reinterpret_cast<ExportSinkData *>(op->d);
+    s32 dataInputCount = 0;
+    auto writer = export_sink_step_prepare(op, dataInputCount);
 
-    auto outp = d->getOstream();
-
-    if (!outp) return;
-
-    s32 dataInputCount = op->inputCount;
+    if (!writer) return;
 
-    // Test the condition input if it's used
-    if (d->condIndex >= 0)
+    for (s32 inputIndex = 0; inputIndex < dataInputCount; inputIndex++)
     {
-        assert(d->condIndex < op->inputs[op->inputCount - 1].size);
-
-        if (!is_param_valid(op->inputs[op->inputCount - 1][d->condIndex]))
-            return;
-
-        dataInputCount = op->inputCount - 1;
-    }
+        auto input = op->inputs[inputIndex];
+        assert(input.size <= std::numeric_limits<u16>::max());
 
-    try
-    {
-        if (outp->good())
+        for (s32 i=0; i<input.size; ++i)
         {
-            for (s32 inputIndex = 0;
-                 inputIndex < dataInputCount && outp->good();
-                 inputIndex++)
+            if (is_param_valid(input[i]))
             {
-                auto input = op->inputs[inputIndex];
-                assert(input.size <= std::numeric_limits<u16>::max());
-
-                for (s32 i=0; i<input.size; ++i)
-                {
-                    if (is_param_valid(input[i]))
-                        *outp << input[i];
-                    *outp << ",";
-                }
-
-                //d->bytesWritten += bytes; // FIXME
+                // "%g" is the format used by std::ostream for doubles by default.
+                char buffer[32];
+                int len = std::snprintf(buffer, sizeof(buffer), "%g", input[i]);
+                writer->append(buffer, len);
+                d->bytesWritten += len;
             }
-
-            *outp << "\n";
-
-            d->eventsWritten++;
+            writer->append(',');
+            d->bytesWritten++;
         }
     }
-    catch (const std::exception &e)
-    {
-        std::ostringstream ss;
-        ss << "Error writing to output file " << d->filename << ": " << e.what();
-        d->setLastError(ss.str());
-    }
+
+    writer->append('\n');
+    d->bytesWritten++;
+
+    d->eventsWritten++;
 }
 
 void export_sink_end_run(Operator *op)
@@ -4537,6 +5003,12 @@ void export_sink_end_run(Operator *op)
 
     auto d = reinterpret_cast<ExportSinkData *>(op->d);
 
+    // Write out the remaining data before closing the streams.
+    if (d->writer)
+        d->writer->stop();
+
+    d->writer = {};
+
     // The destructors being called as a result of clearing the unique_ptrs
     // should not throw.
     d->z_ostream = {};
@@ -4561,6 +5033,63 @@ struct OperatorFunctions
     EndRunFunction end_run = nullptr;
 };
 
+} // end anon namespace
+
+const char *operator_type_name(u8 type)
+{
+    switch (static_cast<OperatorType>(type))
+    {
+        case Invalid_OperatorType: return "Invalid";
+        case Operator_Calibration: return "Calibration";
+        case Operator_Calibration_sse: return "Calibration_sse";
+        case Operator_Calibration_idx: return "Calibration_idx";
+        case Operator_KeepPrevious: return "KeepPrevious";
+        case Operator_KeepPrevious_idx: return "KeepPrevious_idx";
+        case Operator_Difference: return "Difference";
+        case Operator_Difference_idx: return "Difference_idx";
+        case Operator_ArrayMap: return "ArrayMap";
+        case Operator_BinaryEquation: return "BinaryEquation";
+        case Operator_BinaryEquation_idx: return "BinaryEquation_idx";
+        case Operator_H1DSink: return "H1DSink";
+        case Operator_H1DSink_idx: return "H1DSink_idx";
+        case Operator_H2DSink: return "H2DSink";
+        case Operator_RateMonitor_PrecalculatedRate: return "RateMonitor_PrecalculatedRate";
+        case Operator_RateMonitor_CounterDifference: return "RateMonitor_CounterDifference";
+        case Operator_RateMonitor_FlowRate: return "RateMonitor_FlowRate";
+        case Operator_WaveformSink: return "WaveformSink";
+        case Operator_WaveformFeatures: return "WaveformFeatures";
+        case Operator_ExportSinkFull: return "ExportSinkFull";
+        case Operator_ExportSinkSparse: return "ExportSinkSparse";
+        case Operator_ExportSinkCsv: return "ExportSinkCsv";
+        case Operator_RangeFilter: return "RangeFilter";
+        case Operator_RangeFilter_idx: return "RangeFilter_idx";
+        case Operator_RectFilter: return "RectFilter";
+        case Operator_ConditionFilter: return "ConditionFilter";
+        case Operator_Aggregate_Sum: return "Aggregate_Sum";
+        case Operator_Aggregate_Multiplicity: return "Aggregate_Multiplicity";
+        case Operator_Aggregate_Min: return "Aggregate_Min";
+        case Operator_Aggregate_Max: return "Aggregate_Max";
+        case Operator_Aggregate_Mean: return "Aggregate_Mean";
+        case Operator_Aggregate_Sigma: return "Aggregate_Sigma";
+        case Operator_Aggregate_MinX: return "Aggregate_MinX";
+        case Operator_Aggregate_MaxX: return "Aggregate_MaxX";
+        case Operator_Aggregate_MeanX: return "Aggregate_MeanX";
+        case Operator_Aggregate_SigmaX: return "Aggregate_SigmaX";
+        case Operator_Expression: return "Expression";
+        case Operator_ScalerOverflow: return "ScalerOverflow";
+        case Operator_ScalerOverflow_idx: return "ScalerOverflow_idx";
+        case Operator_IntervalCondition: return "IntervalCondition";
+        case Operator_PolygonCondition: return "PolygonCondition";
+        case Operator_ExpressionCondition: return "ExpressionCondition";
+        case OperatorTypeCount: break;
+    }
+
+    return "Unknown";
+}
+
+namespace
+{
+
 // TODO: simplify this or call it only once to get the table. Measure again
 // using perf or similar! Performance is critical here.
 const std::array<OperatorFunctions, OperatorTypeCount> &get_operator_table()
@@ -4593,6 +5122,7 @@ const std::array<OperatorFunctions, OperatorTypeCount> &get_operator_table()
     result[Operator_RateMonitor_FlowRate] = { rate_monitor_step };
 
     result[Operator_WaveformSink] = { waveform_sink_step };
+    result[Operator_WaveformFeatures] = { waveform_features_step };
 
     result[Operator_ExportSinkFull]   = { export_sink_full_step,   export_sink_begin_run, export_sink_end_run };
     result[Operator_ExportSinkSparse] = { export_sink_sparse_step, export_sink_begin_run, export_sink_end_run };
@@ -4629,83 +5159,323 @@ const std::array<OperatorFunctions, OperatorTypeCount> &get_operator_table()
     return result;
 }
 
-} // end anon namespace
-
-A2::A2(memory::Arena *arena)
-    : conditionBits(BitsetAllocator(arena))
+// Profiling call site of the operator step functions, indexed by operator
+// type.
+profiling::CallSiteId operator_step_call_site()
 {
-    //fprintf(stderr, "%s@%p\n", __PRETTY_FUNCTION__, this);
+    static const auto site = []
+    {
+        auto site = profiling::register_call_site("a2_operator_step");
 
-    dataSourceCounts.fill(0);
-    dataSources.fill(nullptr);
-    operatorCounts.fill(0);
-    operators.fill(nullptr);
-    operatorRanks.fill(0);
+        for (u8 type = 0; type < OperatorTypeCount; ++type)
+            profiling::set_index_name(site, type, operator_type_name(type));
+
+        return site;
+    }();
+
+    return site;
 }
 
-A2::~A2()
+inline u64 cost_counter()
 {
-    //fprintf(stderr, "%s@%p\n", __PRETTY_FUNCTION__, this);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
 }
 
-A2 *make_a2(
-    Arena *arena,
-    std::initializer_list<u8> dataSourceCounts,
-    std::initializer_list<u8> operatorCounts)
+// Returns the cost counters of the event's operators or nullptr if cost
+// accounting is disabled.
+inline ObjectCost *operator_costs(A2 *a2, int eventIndex)
 {
-    assert(dataSourceCounts.size() < MaxVMEEvents);
-    assert(operatorCounts.size() < MaxVMEEvents);
+    return unlikely(a2->costs != nullptr) ? a2->costs->operators[eventIndex].data() : nullptr;
+}
 
-    auto result = arena->pushObject<A2>(arena);
+inline void step_operator(Operator *op, A2 *a2, ObjectCost *cost)
+{
+    profiling::ScopedTimer timer(operator_step_call_site(), op->type);
 
-    const u8 *ec = dataSourceCounts.begin();
+    if (likely(cost == nullptr))
+    {
+        get_operator_table()[op->type].step(op, a2);
+        return;
+    }
 
-    for (size_t ei = 0; ei < dataSourceCounts.size(); ++ei, ++ec)
+    const u64 t0 = cost_counter();
+    get_operator_table()[op->type].step(op, a2);
+    cost->cycles += cost_counter() - t0;
+    ++cost->steps;
+}
+
+} // end anon namespace
+
+// Steps the operator if all of its condition bits are set. Otherwise the
+// outputs of the operator are invalidated. Returns true if the operator was
+// stepped. cost is nullptr unless cost accounting is enabled.
+inline bool step_operator_if_conditions_true(Operator *op, A2 *a2, ObjectCost *cost)
+{
+    assert(op);
+    assert(op->type < get_operator_table().size());
+    assert(get_operator_table()[op->type].step);
+
+    bool stepOperator = true;
+
+    // Figure out if the operator should be run or skipped by AND'ing
+    // together all the condition bits referenced by the operator.
+    for (auto bitIndex: op->conditionBitIndexes)
     {
-        //printf("%s: %lu -> %u\n", __PRETTY_FUNCTION__, ei, (u32)*ec);
-        result->dataSources[ei] = arena->pushArray<DataSource>(*ec);
+        assert(bitIndex < a2->conditionBits.size());
+        stepOperator = stepOperator && a2->conditionBits.test(bitIndex);
     }
 
-    for (size_t ei = 0; ei < operatorCounts.size(); ++ei)
+    if (stepOperator)
     {
-        result->operators[ei] = arena->pushArray<Operator>(operatorCounts.begin()[ei]);
-        result->operatorRanks[ei] = arena->pushArray<A2::OperatorCountType>(operatorCounts.begin()[ei]);
+        // no active condition or the condition is true
+        step_operator(op, a2, cost);
+    }
+    else
+    {
+        // condition is false -> invalidate all outputs
+        invalidate_outputs(op);
+
+        if (unlikely(cost != nullptr))
+            ++cost->conditionSkips;
     }
 
-    return result;
+    return stepOperator;
 }
 
-// run begin_event() on all sources for the given eventIndex
-void a2_begin_event(A2 *a2, int eventIndex)
+// Number of operators stepped and skipped due to their conditions. Same
+// statistics as collected by the serial a2_end_event() path.
+struct OperatorStepCounts
 {
-    assert(eventIndex < MaxVMEEvents);
+    s32 stepped = 0;
+    s32 condSkipped = 0;
 
-    int srcCount = a2->dataSourceCounts[eventIndex];
+    OperatorStepCounts &operator+=(const OperatorStepCounts &o)
+    {
+        stepped += o.stepped;
+        condSkipped += o.condSkipped;
+        return *this;
+    }
+};
 
-    a2_trace("a=%p, ei=%d, dataSources=%d\n", a2, eventIndex, srcCount);
+// Steps all non-condition operators in [first, last). Used by the worker
+// threads of the OperatorRangeWorkQueue. costs points to the cost counters of
+// the first operator or is nullptr.
+inline OperatorStepCounts step_operator_range(Operator *first, Operator *last, A2 *a2, ObjectCost *costs)
+{
+    OperatorStepCounts result;
 
-    for (int srcIdx = 0; srcIdx < srcCount; srcIdx++)
+    for (auto op = first; op < last; ++op)
     {
-        DataSource *ds = a2->dataSources[eventIndex] + srcIdx;
+        a2_trace("    op@%p\n", op);
 
-        switch (static_cast<DataSourceType>(ds->type))
+        if (likely(op->type != Invalid_OperatorType && !is_condition_operator(*op)))
         {
-            case DataSource_Extractor:
-                extractor_begin_event(ds);
-                break;
+            if (step_operator_if_conditions_true(op, a2, costs ? costs + (op - first) : nullptr))
+                result.stepped++;
+            else
+                result.condSkipped++;
+        }
+    }
 
-            case DataSource_ListFilterExtractor:
-                listfilter_extractor_begin_event(ds);
-                break;
+    return result;
+}
 
-            case DataSource_MultiHitExtractor_ArrayPerHit:
-            case DataSource_MultiHitExtractor_ArrayPerAddress:
-                multihit_extractor_begin_event(ds);
-                break;
+struct OperatorRangeWork
+{
+    Operator *begin = nullptr;
+    Operator *end = nullptr;
+    ObjectCost *costs = nullptr;
+    // Index into OperatorRangeWorkQueue::taskCounts.
+    size_t taskIndex = 0;
+};
 
-            case DataSource_MdppSampleDecoder:
-                mdpp_sample_decoder_begin_event(ds);
-                break;
+// Index range [begin, end) of operators sharing the same rank.
+struct OperatorRankRange
+{
+    A2::OperatorCountType begin;
+    A2::OperatorCountType end;
+};
+
+struct OperatorRangeWorkQueue
+{
+    // Ranks with fewer operators are stepped directly by the calling thread.
+    static const size_t MinParallelRankSize = 8;
+
+    // Number of tasks created per thread for each rank. Operators vary a lot
+    // in cost so handing out more than one task per thread evens out the load.
+    static const size_t TasksPerThread = 4;
+
+    mpmc_bounded_queue<OperatorRangeWork> queue;
+    LightweightSemaphore taskSem;
+    LightweightSemaphore tasksDoneSem;
+    std::atomic<bool> quit;
+    std::vector<std::thread> workers;
+    std::array<std::vector<OperatorRankRange>, MaxVMEEvents> rankRanges;
+    // Step counts of the tasks of the current rank. Each task writes its own
+    // entry, the calling thread sums them up once all tasks are done.
+    std::vector<OperatorStepCounts> taskCounts;
+    A2 *a2;
+
+    static size_t queue_size(size_t threadCount)
+    {
+        size_t result = 2;
+
+        while (result < threadCount * TasksPerThread)
+            result <<= 1;
+
+        return result;
+    }
+
+    // threadCount includes the thread calling a2_end_event(), so
+    // threadCount - 1 workers are started.
+    OperatorRangeWorkQueue(A2 *a2_, size_t threadCount)
+        : queue(queue_size(threadCount))
+        , quit(false)
+        , taskCounts(threadCount * TasksPerThread)
+        , a2(a2_)
+    {
+        assert(threadCount > 1);
+
+        for (size_t i = 0; i < threadCount - 1; ++i)
+            workers.emplace_back(std::thread(&OperatorRangeWorkQueue::workerLoop, this));
+    }
+
+    ~OperatorRangeWorkQueue()
+    {
+        quit = true;
+        taskSem.signal(workers.size());
+
+        for (auto &t: workers)
+            t.join();
+    }
+
+    size_t threadCount() const { return workers.size() + 1; }
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            taskSem.wait();
+
+            if (quit)
+                break;
+
+            // The dequeue can fail as the calling thread also consumes work
+            // from the queue.
+            OperatorRangeWork work;
+
+            if (queue.dequeue(work))
+            {
+                taskCounts[work.taskIndex] = step_operator_range(work.begin, work.end, a2, work.costs);
+                tasksDoneSem.signal();
+            }
+        }
+    }
+
+    void updateRankRanges()
+    {
+        for (int ei = 0; ei < MaxVMEEvents; ++ei)
+        {
+            auto &ranges = rankRanges[ei];
+            ranges.clear();
+
+            const auto opCount = a2->operatorCounts[ei];
+            const auto ranks = a2->operatorRanks[ei];
+
+            for (A2::OperatorCountType opIdx = 0; opIdx < opCount; ++opIdx)
+            {
+                if (ranges.empty() || ranks[opIdx] != ranks[ranges.back().begin])
+                    ranges.push_back({ opIdx, opIdx });
+
+                ranges.back().end = opIdx + 1;
+            }
+        }
+    }
+};
+
+A2::A2(memory::Arena *arena)
+    : conditionBits(ConditionBitset::Allocator(arena))
+{
+    //fprintf(stderr, "%s@%p\n", __PRETTY_FUNCTION__, this);
+
+    dataSourceCounts.fill(0);
+    dataSources.fill(nullptr);
+    operatorCounts.fill(0);
+    operators.fill(nullptr);
+    operatorRanks.fill(0);
+    fusedExtractors.fill(nullptr);
+    operatorGates.fill({});
+}
+
+A2::~A2()
+{
+    //fprintf(stderr, "%s@%p\n", __PRETTY_FUNCTION__, this);
+}
+
+A2 *make_a2(
+    Arena *arena,
+    std::initializer_list<u8> dataSourceCounts,
+    std::initializer_list<u8> operatorCounts)
+{
+    assert(dataSourceCounts.size() < MaxVMEEvents);
+    assert(operatorCounts.size() < MaxVMEEvents);
+
+    auto result = arena->pushObject<A2>(arena);
+
+    const u8 *ec = dataSourceCounts.begin();
+
+    for (size_t ei = 0; ei < dataSourceCounts.size(); ++ei, ++ec)
+    {
+        //printf("%s: %lu -> %u\n", __PRETTY_FUNCTION__, ei, (u32)*ec);
+        result->dataSources[ei] = arena->pushArray<DataSource>(*ec);
+    }
+
+    for (size_t ei = 0; ei < operatorCounts.size(); ++ei)
+    {
+        result->operators[ei] = arena->pushArray<Operator>(operatorCounts.begin()[ei]);
+        result->operatorRanks[ei] = arena->pushArray<A2::OperatorCountType>(operatorCounts.begin()[ei]);
+    }
+
+    return result;
+}
+
+// run begin_event() on all sources for the given eventIndex
+void a2_begin_event(A2 *a2, int eventIndex)
+{
+    assert(eventIndex < MaxVMEEvents);
+    MVME_PROFILE_SCOPE_INDEXED("a2_begin_event", eventIndex);
+
+    int srcCount = a2->dataSourceCounts[eventIndex];
+
+    a2_trace("a=%p, ei=%d, dataSources=%d\n", a2, eventIndex, srcCount);
+
+    for (int srcIdx = 0; srcIdx < srcCount; srcIdx++)
+    {
+        DataSource *ds = a2->dataSources[eventIndex] + srcIdx;
+
+        switch (static_cast<DataSourceType>(ds->type))
+        {
+            case DataSource_Extractor:
+                extractor_begin_event(ds);
+                break;
+
+            case DataSource_ListFilterExtractor:
+                listfilter_extractor_begin_event(ds);
+                break;
+
+            case DataSource_MultiHitExtractor_ArrayPerHit:
+            case DataSource_MultiHitExtractor_ArrayPerAddress:
+                multihit_extractor_begin_event(ds);
+                break;
+
+            case DataSource_MdppSampleDecoder:
+                mdpp_sample_decoder_begin_event(ds);
+                break;
 
 #if 0
             case DataSource_Copy:
@@ -4721,6 +5491,7 @@ void a2_process_module_data(A2 *a2, int eventIndex, int moduleIndex, const u32 *
 {
     assert(eventIndex < MaxVMEEvents);
     assert(moduleIndex < MaxVMEModules);
+    MVME_PROFILE_SCOPE_INDEXED("a2_process_module_data", eventIndex);
 
 #ifndef NDEBUG
     int nprocessed = 0;
@@ -4728,6 +5499,39 @@ void a2_process_module_data(A2 *a2, int eventIndex, int moduleIndex, const u32 *
 
     const int srcCount = a2->dataSourceCounts[eventIndex];
 
+    // If the module has a fused extraction table all its Extractors are
+    // handled in a single pass here and skipped in the loop below.
+    const FusedModuleExtractors *fused = (a2->fusedExtractors[eventIndex]
+                                          ? a2->fusedExtractors[eventIndex] + moduleIndex
+                                          : nullptr);
+
+    ObjectCost *costs = unlikely(a2->costs != nullptr) ? a2->costs->dataSources[eventIndex].data() : nullptr;
+
+    if (fused && fused->sourceCount)
+    {
+        if (likely(costs == nullptr))
+        {
+            fused_extractors_process_module_data(fused, data, dataSize);
+        }
+        else
+        {
+            const u64 t0 = cost_counter();
+            fused_extractors_process_module_data(fused, data, dataSize);
+            const u64 share = (cost_counter() - t0) / fused->sourceCount;
+
+            for (u16 i = 0; i < fused->sourceCount; ++i)
+            {
+                auto &cost = costs[fused->sources[i] - a2->dataSources[eventIndex]];
+                cost.cycles += share;
+                ++cost.steps;
+            }
+        }
+    }
+    else
+    {
+        fused = nullptr;
+    }
+
     // State for the data consuming ListFilterExtractors
     const u32 *curPtr = data;
     const u32 *endPtr = data + dataSize;
@@ -4739,11 +5543,16 @@ void a2_process_module_data(A2 *a2, int eventIndex, int moduleIndex, const u32 *
         if (ds->moduleIndex != moduleIndex)
             continue;
 
+        // Fused Extractors have been accounted for above.
+        const bool accountCost = unlikely(costs != nullptr) && !(fused && ds->type == DataSource_Extractor);
+        const u64 t0 = accountCost ? cost_counter() : 0;
+
         switch (static_cast<DataSourceType>(ds->type))
         {
             case DataSource_Extractor:
                 {
-                    extractor_process_module_data(ds, data, dataSize);
+                    if (!fused)
+                        extractor_process_module_data(ds, data, dataSize);
                 } break;
             case DataSource_ListFilterExtractor:
                 {
@@ -4769,6 +5578,12 @@ void a2_process_module_data(A2 *a2, int eventIndex, int moduleIndex, const u32 *
             default:
                 assert(!"unhandled datasource");
         }
+
+        if (accountCost)
+        {
+            costs[srcIdx].cycles += cost_counter() - t0;
+            ++costs[srcIdx].steps;
+        }
 #ifndef NDEBUG
         nprocessed++;
 #endif
@@ -4779,49 +5594,209 @@ void a2_process_module_data(A2 *a2, int eventIndex, int moduleIndex, const u32 *
 #endif
 }
 
-inline u32 step_operator_range(Operator *first, Operator *last, A2 *a2)
+void a2_build_fused_extractors(A2 *a2, Arena *arena)
 {
-    u32 opSteppedCount = 0;
-
-    for (auto op = first; op < last; ++op)
+    for (s32 ei = 0; ei < MaxVMEEvents; ei++)
     {
-        a2_trace("    op@%p\n", op);
+        a2->fusedExtractors[ei] = nullptr;
+
+        const s32 srcCount = a2->dataSourceCounts[ei];
+
+        if (!srcCount)
+            continue;
 
-        assert(op);
-        assert(op->type < get_operator_table().size());
+        auto modules = arena->pushArray<FusedModuleExtractors>(MaxVMEModules);
 
-        if (likely(op->type != Invalid_OperatorType))
+        for (s32 mi = 0; mi < MaxVMEModules; mi++)
         {
-            assert(get_operator_table()[op->type].step);
+            auto &fused = modules[mi];
+            fused = {};
+
+            u32 sourceCount = 0;
+            u32 entryCount = 0;
+            bool fusable = true;
+
+            for (s32 srcIdx = 0; srcIdx < srcCount; srcIdx++)
+            {
+                DataSource *ds = a2->dataSources[ei] + srcIdx;
+
+                if (ds->type != DataSource_Extractor || ds->moduleIndex != mi)
+                    continue;
+
+                auto ex = reinterpret_cast<Extractor *>(ds->d);
+
+                // An extractor without subfilters completes on every word.
+                // Leave this module to the per-extractor path.
+                if (ex->filter.filterCount <= 0)
+                    fusable = false;
+
+                sourceCount++;
+                entryCount += ex->filter.filterCount;
+            }
+
+            if (!fusable || !sourceCount
+                || entryCount > std::numeric_limits<u16>::max())
+            {
+                continue;
+            }
+
+            fused.sources = arena->pushArray<DataSource *>(sourceCount);
+            fused.entries = arena->pushArray<FusedExtractorEntry>(entryCount);
+            fused.commonMask = ~0u;
+
+            for (s32 srcIdx = 0; srcIdx < srcCount; srcIdx++)
+            {
+                DataSource *ds = a2->dataSources[ei] + srcIdx;
+
+                if (ds->type != DataSource_Extractor || ds->moduleIndex != mi)
+                    continue;
+
+                auto ex = reinterpret_cast<Extractor *>(ds->d);
+                const s32 filterCount = ex->filter.filterCount;
+
+                for (s32 fi = 0; fi < filterCount; fi++)
+                {
+                    const auto &filter = ex->filter.filters[fi];
+                    auto &entry = fused.entries[fused.entryCount++];
+
+                    entry.matchMask = filter.matchMask;
+                    entry.matchValue = filter.matchValue;
+                    entry.matchWordIndex = filter.matchWordIndex;
+                    entry.sourceIndex = fused.sourceCount;
+                    entry.subfilterIndex = fi;
+                    entry.skip = filterCount - fi;
+
+                    // Keep the bits which are part of every mask and have the
+                    // same match value in all entries.
+                    if (fused.entryCount == 1)
+                    {
+                        fused.commonMask = filter.matchMask;
+                        fused.commonValue = filter.matchValue;
+                    }
+                    else
+                    {
+                        fused.commonMask &= filter.matchMask;
+                        fused.commonMask &= ~(fused.commonValue ^ filter.matchValue);
+                    }
+
+                    fused.commonValue &= fused.commonMask;
+                }
 
-            get_operator_table()[op->type].step(op, a2);
-            opSteppedCount++;
+                fused.sources[fused.sourceCount++] = ds;
+            }
+
+            assert(fused.sourceCount == sourceCount);
+            assert(fused.entryCount == entryCount);
         }
+
+        a2->fusedExtractors[ei] = modules;
     }
+}
 
-    return opSteppedCount;
+void a2_clear_fused_extractors(A2 *a2)
+{
+    a2->fusedExtractors.fill(nullptr);
 }
 
-struct OperatorRangeWork
+namespace
 {
-    Operator *begin = nullptr;
-    Operator *end = nullptr;
-};
 
-struct OperatorRangeWorkQueue
+std::vector<ConditionMaskWord> make_condition_mask(const Operator &op)
 {
-    mpmc_bounded_queue<OperatorRangeWork> queue;
-    //NonRecursiveBenaphore mutex;
-    LightweightSemaphore taskSem;
-    LightweightSemaphore tasksDoneSem;
-    //std::atomic<int> tasksDone;
+    std::vector<ConditionMaskWord> result;
 
-    using Guard = std::lock_guard<NonRecursiveBenaphore>;
+    for (auto bitIndex: op.conditionBitIndexes)
+    {
+        const u32 wordIndex = bitIndex / ConditionBitset::BitsPerWord;
+        const auto bit = ConditionBitset::Word(1) << (bitIndex % ConditionBitset::BitsPerWord);
 
-    explicit OperatorRangeWorkQueue(size_t size)
-        : queue(size)
-    {}
-};
+        auto it = std::find_if(result.begin(), result.end(),
+                               [wordIndex] (const auto &mw) { return mw.wordIndex == wordIndex; });
+
+        if (it != result.end())
+            it->mask |= bit;
+        else
+            result.push_back({ bit, wordIndex });
+    }
+
+    std::sort(result.begin(), result.end(),
+              [] (const auto &a, const auto &b) { return a.wordIndex < b.wordIndex; });
+
+    return result;
+}
+
+} // end anon namespace
+
+void a2_build_condition_gates(A2 *a2, Arena *arena)
+{
+    struct GroupInfo
+    {
+        std::vector<ConditionMaskWord> mask;
+        std::vector<u16> operatorIndexes;
+    };
+
+    for (s32 ei = 0; ei < MaxVMEEvents; ei++)
+    {
+        a2->operatorGates[ei] = {};
+
+        const s32 opCount = a2->operatorCounts[ei];
+
+        if (!opCount)
+            continue;
+
+        // Operators are sorted by rank. Within each rank the operators are
+        // grouped by their condition mask in order of first appearance.
+        std::vector<GroupInfo> groups;
+        size_t rankGroupsBegin = 0;
+
+        for (s32 opIdx = 0; opIdx < opCount; opIdx++)
+        {
+            const auto &op = a2->operators[ei][opIdx];
+
+            if (op.type == Invalid_OperatorType)
+                continue;
+
+            if (opIdx > 0 && a2->operatorRanks[ei][opIdx] != a2->operatorRanks[ei][opIdx - 1])
+                rankGroupsBegin = groups.size();
+
+            auto mask = make_condition_mask(op);
+
+            auto it = std::find_if(groups.begin() + rankGroupsBegin, groups.end(),
+                                   [&mask] (const auto &g) { return g.mask == mask; });
+
+            if (it == groups.end())
+            {
+                groups.push_back({ mask, {} });
+                it = groups.end() - 1;
+            }
+
+            it->operatorIndexes.push_back(opIdx);
+        }
+
+        auto gates = push_typed_block<OperatorGateGroup, u16>(arena, groups.size());
+
+        for (size_t gi = 0; gi < groups.size(); gi++)
+        {
+            gates[gi].mask = push_copy_typed_block<ConditionMaskWord, u16>(arena, groups[gi].mask);
+            gates[gi].operatorIndexes = push_copy_typed_block<u16, u16>(arena, groups[gi].operatorIndexes);
+        }
+
+        a2->operatorGates[ei] = gates;
+    }
+}
+
+void a2_clear_condition_gates(A2 *a2)
+{
+    a2->operatorGates.fill({});
+}
+
+void a2_set_cost_accounting(A2 *a2, bool enable)
+{
+    if (enable && !a2->costs)
+        a2->costs = std::make_unique<CostAccounting>();
+    else if (!enable)
+        a2->costs = {};
+}
 
 void a2_begin_run(A2 *a2, Logger logger)
 {
@@ -4841,10 +5816,24 @@ void a2_begin_run(A2 *a2, Logger logger)
             {
                 get_operator_table()[op->type].begin_run(op, logger);
             }
+
+            expression_native_begin_run(op, a2->nativeExpressions, logger);
         }
     }
 
     a2->histoFillStrategy.begin_run(a2);
+
+    if (a2->operatorWorkQueue)
+        a2->operatorWorkQueue->updateRankRanges();
+
+    if (a2->costs)
+    {
+        for (s32 ei = 0; ei < MaxVMEEvents; ei++)
+        {
+            a2->costs->dataSources[ei].assign(a2->dataSourceCounts[ei], {});
+            a2->costs->operators[ei].assign(a2->operatorCounts[ei], {});
+        }
+    }
 }
 
 void a2_end_run(A2 *a2)
@@ -4874,59 +5863,161 @@ void a2_end_run(A2 *a2)
     //fprintf(stderr, "a2::%s() done\n", __FUNCTION__);
 }
 
-// step operators for the eventIndex
-// operators must be sorted by increasing rank otherwise the behavior is
-// undefined
-void a2_end_event(A2 *a2, int eventIndex)
+// Parallel version of a2_end_event(): the operators of each rank are split
+// into tasks which are processed by the worker threads and the calling thread.
+// Once all tasks of a rank are done the condition operators of the rank are
+// stepped by the calling thread.
+static void a2_end_event_parallel(A2 *a2, int eventIndex)
 {
-    assert(eventIndex < MaxVMEEvents);
-
-    const int opCount = a2->operatorCounts[eventIndex];
+    auto wq = a2->operatorWorkQueue.get();
     Operator *operators = a2->operators[eventIndex];
-    s32 opSteppedCount = 0;
-    s32 opCondSkipped  = 0;
+    ObjectCost *costs = operator_costs(a2, eventIndex);
+    OperatorStepCounts counts;
 
-    a2_trace("ei=%d, stepping %d operators\n", eventIndex, opCount);
+    a2_trace("ei=%d, stepping %d operators using %lu threads\n",
+             eventIndex, a2->operatorCounts[eventIndex], wq->threadCount());
 
-    for (int opIdx = 0; opIdx < opCount; opIdx++)
+    for (const auto &range: wq->rankRanges[eventIndex])
     {
-        Operator *op = operators + opIdx;
+        Operator *first = operators + range.begin;
+        Operator *last  = operators + range.end;
+        ObjectCost *firstCost = costs ? costs + range.begin : nullptr;
+        const size_t opCount = range.end - range.begin;
 
-        a2_trace("  op@%p\n", op);
+        if (opCount >= OperatorRangeWorkQueue::MinParallelRankSize)
+        {
+            const size_t taskCount = std::min(
+                opCount, wq->threadCount() * OperatorRangeWorkQueue::TasksPerThread);
+            const size_t taskSize = (opCount + taskCount - 1) / taskCount;
+            size_t tasksQueued = 0;
 
-        assert(op);
-        assert(op->type < get_operator_table().size());
+            for (size_t offset = 0; offset < opCount; offset += taskSize)
+            {
+                OperatorRangeWork work = {
+                    first + offset, first + std::min(offset + taskSize, opCount),
+                    firstCost ? firstCost + offset : nullptr, tasksQueued };
+                [[maybe_unused]] bool queued = wq->queue.enqueue(work);
+                assert(queued);
+                ++tasksQueued;
+            }
 
-        if (likely(op->type != Invalid_OperatorType))
-        {
-            assert(get_operator_table()[op->type].step);
+            wq->taskSem.signal(tasksQueued);
 
-            bool stepOperator = true;
+            // Help out instead of idling while the workers are busy.
+            OperatorRangeWork work;
 
-            // Figure out if the operator should be run or skipped by AND'ing
-            // together all the condition bits referenced by the operator.
-            for (auto bitIndex: op->conditionBitIndexes)
+            while (wq->queue.dequeue(work))
             {
-                assert(bitIndex < a2->conditionBits.size());
-                stepOperator = stepOperator && a2->conditionBits.test(bitIndex);
+                wq->taskCounts[work.taskIndex] = step_operator_range(work.begin, work.end, a2, work.costs);
+                wq->tasksDoneSem.signal();
             }
 
-            if (stepOperator)
+            for (size_t i = 0; i < tasksQueued; ++i)
+                wq->tasksDoneSem.wait();
+
+            for (size_t i = 0; i < tasksQueued; ++i)
+                counts += wq->taskCounts[i];
+        }
+        else
+        {
+            counts += step_operator_range(first, last, a2, firstCost);
+        }
+
+        // Conditions of this rank can only affect operators of higher ranks so
+        // it's safe to step them after the rest of the rank is done.
+        for (auto op = first; op < last; ++op)
+        {
+            if (is_condition_operator(*op))
             {
-                // no active condition or the condition is true
-                get_operator_table()[op->type].step(op, a2);
-                opSteppedCount++;
+                if (step_operator_if_conditions_true(op, a2, firstCost ? firstCost + (op - first) : nullptr))
+                    counts.stepped++;
+                else
+                    counts.condSkipped++;
+            }
+        }
+    }
+
+    assert(counts.stepped + counts.condSkipped == a2->operatorCounts[eventIndex]);
+
+    a2_trace("ei=%d, operators stepped=%d, condSkipped=%d\n",
+             eventIndex, counts.stepped, counts.condSkipped);
+}
+
+// step operators for the eventIndex
+// operators must be sorted by increasing rank otherwise the behavior is
+// undefined
+void a2_end_event(A2 *a2, int eventIndex)
+{
+    assert(eventIndex < MaxVMEEvents);
+    MVME_PROFILE_SCOPE_INDEXED("a2_end_event", eventIndex);
+
+    if (a2->operatorWorkQueue)
+    {
+        a2_end_event_parallel(a2, eventIndex);
+        return;
+    }
+
+    const int opCount = a2->operatorCounts[eventIndex];
+    Operator *operators = a2->operators[eventIndex];
+    ObjectCost *costs = operator_costs(a2, eventIndex);
+    s32 opSteppedCount = 0;
+    s32 opCondSkipped  = 0;
+
+    a2_trace("ei=%d, stepping %d operators\n", eventIndex, opCount);
+
+    if (const auto &gates = a2->operatorGates[eventIndex]; gates.size)
+    {
+        for (const auto &group: gates)
+        {
+            if (conditions_true(a2->conditionBits, group.mask))
+            {
+                for (auto opIdx: group.operatorIndexes)
+                {
+                    Operator *op = operators + opIdx;
+                    a2_trace("  op@%p\n", op);
+                    assert(op->type != Invalid_OperatorType);
+                    step_operator(op, a2, costs ? costs + opIdx : nullptr);
+                }
+
+                opSteppedCount += group.operatorIndexes.size;
             }
             else
             {
-                // condition is false -> invalidate all outputs
-                invalidate_outputs(op);
-                opCondSkipped++;
+                for (auto opIdx: group.operatorIndexes)
+                    invalidate_outputs(operators + opIdx);
+
+                if (unlikely(costs != nullptr))
+                {
+                    for (auto opIdx: group.operatorIndexes)
+                        ++costs[opIdx].conditionSkips;
+                }
+
+                opCondSkipped += group.operatorIndexes.size;
             }
         }
-        else
+    }
+    else
+    {
+        for (int opIdx = 0; opIdx < opCount; opIdx++)
         {
-            InvalidCodePath;
+            Operator *op = operators + opIdx;
+
+            a2_trace("  op@%p\n", op);
+
+            assert(op);
+            assert(op->type < get_operator_table().size());
+
+            if (likely(op->type != Invalid_OperatorType))
+            {
+                if (step_operator_if_conditions_true(op, a2, costs ? costs + opIdx : nullptr))
+                    opSteppedCount++;
+                else
+                    opCondSkipped++;
+            }
+            else
+            {
+                InvalidCodePath;
+            }
         }
     }
 
@@ -4953,10 +6044,39 @@ void a2_end_event(A2 *a2, int eventIndex)
     }
 }
 
+void a2_set_operator_thread_count(A2 *a2, unsigned threadCount)
+{
+    // Stops and joins the workers of the previous queue.
+    a2->operatorWorkQueue = {};
+
+    if (threadCount > 1)
+    {
+        a2->operatorWorkQueue = std::make_unique<OperatorRangeWorkQueue>(a2, threadCount);
+        a2->operatorWorkQueue->updateRankRanges();
+    }
+}
+
+unsigned a2_get_operator_thread_count(const A2 *a2)
+{
+    return a2->operatorWorkQueue ? a2->operatorWorkQueue->threadCount() : 1u;
+}
+
+void a2_set_histo_fill_strategy(A2 *a2, HistoFillStrategyType type)
+{
+    a2->histoFillStrategy.setType(type);
+}
+
+void a2_set_native_expressions(A2 *a2, bool enable)
+{
+    a2->nativeExpressions = enable;
+}
+
 void a2_timetick(A2 *a2)
 {
     a2_trace("\n");
 
+    a2->histoFillStrategy.flush();
+
     for (int ei = 0; ei < MaxVMEEvents; ei++)
     {
         const int opCount = a2->operatorCounts[ei];
@@ -4976,9 +6096,473 @@ void a2_timetick(A2 *a2)
     }
 }
 
+//
+// Event-parallel processing using A2 replicas
+//
+
+bool a2_operator_requires_event_order(const Operator *op)
+{
+    switch (op->type)
+    {
+        case Operator_KeepPrevious:
+        case Operator_KeepPrevious_idx:
+        case Operator_ScalerOverflow:
+        case Operator_ScalerOverflow_idx:
+        case Operator_RateMonitor_PrecalculatedRate:
+        case Operator_RateMonitor_CounterDifference:
+        case Operator_RateMonitor_FlowRate:
+        case Operator_WaveformSink:
+        case Operator_ExportSinkFull:
+        case Operator_ExportSinkSparse:
+        case Operator_ExportSinkCsv:
+            return true;
+
+        case Operator_Expression:
+            {
+                // Static variables keep their values across events.
+                auto d = reinterpret_cast<const ExpressionOperatorData *>(op->d);
+                return !d->static_vars.empty();
+            }
+
+        default:
+            break;
+    }
+
+    return false;
+}
+
+namespace
+{
+
+inline void clear_histo_stats(H1D &histo)
+{
+    histo.entryCount = 0;
+    histo.nans = 0.0;
+    histo.underflows = 0.0;
+    histo.overflows = 0.0;
+}
+
+inline void clear_histo_stats(H2D &histo)
+{
+    histo.entryCount = 0.0;
+
+    for (s32 axis = 0; axis < H2D::AxisCount; axis++)
+    {
+        histo.nans[axis] = 0.0;
+        histo.underflows[axis] = 0.0;
+        histo.overflows[axis] = 0.0;
+    }
+}
+
+void merge_histo(H1D &dest, H1D &src)
+{
+    assert(dest.size == src.size);
+    assert(dest.storageType == src.storageType);
+
+    for (s32 bin = 0; bin < src.size; bin++)
+        move_add_bin(dest.data, src.data, src.storageType, bin);
+
+    dest.entryCount += src.entryCount;
+    dest.nans += src.nans;
+    dest.underflows += src.underflows;
+    dest.overflows += src.overflows;
+    clear_histo_stats(src);
+}
+
+void merge_histo(H2D &dest, H2D &src)
+{
+    assert(dest.size == src.size);
+    assert(dest.storageType == src.storageType);
+    assert(!dest.tiles == !src.tiles);
+
+    if (dest.tiles && src.tiles)
+    {
+        dest.tiles->moveAddFrom(*src.tiles);
+    }
+    else
+    {
+        for (s32 bin = 0; bin < src.size; bin++)
+            move_add_bin(dest.data, src.data, src.storageType, bin);
+    }
+
+    dest.entryCount += src.entryCount;
+
+    for (s32 axis = 0; axis < H2D::AxisCount; axis++)
+    {
+        dest.nans[axis] += src.nans[axis];
+        dest.underflows[axis] += src.underflows[axis];
+        dest.overflows[axis] += src.overflows[axis];
+    }
+
+    clear_histo_stats(src);
+}
+
+// Replaces the histos bin storage with zeroed memory of the same type
+// allocated from the given arena.
+template<typename Histo>
+void push_histo_storage(Arena *arena, Histo &histo)
+{
+    auto storage = arena->pushSize(bin_storage_size(histo.storageType, histo.size), alignof(u64));
+    histo.data = reinterpret_cast<double *>(storage);
+    clear_bins(histo.data, histo.storageType, histo.size);
+}
+
+// Tiled histos get their own empty tiled storage.
+void push_histo_storage(Arena *arena, H2D &histo)
+{
+    if (histo.tiles)
+    {
+        histo.tiles = arena->pushObject<TiledHistoStorage>(
+            histo.tiles->getXBins(), histo.tiles->getYBins(), histo.storageType);
+        histo.data = nullptr;
+    }
+    else
+    {
+        push_histo_storage<H2D>(arena, histo);
+    }
+}
+
+} // end anon namespace
+
+void a2_detach_histo_storage(A2 *a2, memory::Arena *arena)
+{
+    for (s32 ei = 0; ei < MaxVMEEvents; ei++)
+    {
+        const int opCount = a2->operatorCounts[ei];
+
+        for (int opIdx = 0; opIdx < opCount; opIdx++)
+        {
+            Operator *op = a2->operators[ei] + opIdx;
+
+            switch (op->type)
+            {
+                case Operator_H1DSink:
+                case Operator_H1DSink_idx:
+                    {
+                        auto d = reinterpret_cast<H1DSinkData *>(op->d);
+
+                        for (s32 hi = 0; hi < d->histos.size; hi++)
+                        {
+                            auto &histo = d->histos[hi];
+                            push_histo_storage(arena, histo);
+                            clear_histo_stats(histo);
+                        }
+                    } break;
+
+                case Operator_H2DSink:
+                    {
+                        auto &histo = reinterpret_cast<H2DSinkData *>(op->d)->histo;
+                        push_histo_storage(arena, histo);
+                        clear_histo_stats(histo);
+                    } break;
+            }
+        }
+    }
+}
+
+bool a2_merge_sink_histos(Operator *destOp, Operator *srcOp)
+{
+    if (destOp->type != srcOp->type)
+        return false;
+
+    switch (srcOp->type)
+    {
+        case Operator_H1DSink:
+        case Operator_H1DSink_idx:
+            {
+                auto destData = reinterpret_cast<H1DSinkData *>(destOp->d);
+                auto srcData  = reinterpret_cast<H1DSinkData *>(srcOp->d);
+
+                if (destData->histos.size != srcData->histos.size)
+                    return false;
+
+                for (s32 hi = 0; hi < srcData->histos.size; hi++)
+                {
+                    const auto &dh = destData->histos[hi];
+                    const auto &sh = srcData->histos[hi];
+
+                    if (dh.size != sh.size || dh.storageType != sh.storageType)
+                        return false;
+                }
+
+                for (s32 hi = 0; hi < srcData->histos.size; hi++)
+                    merge_histo(destData->histos[hi], srcData->histos[hi]);
+            } return true;
+
+        case Operator_H2DSink:
+            {
+                auto &dh = reinterpret_cast<H2DSinkData *>(destOp->d)->histo;
+                auto &sh = reinterpret_cast<H2DSinkData *>(srcOp->d)->histo;
+
+                if (dh.size != sh.size || dh.storageType != sh.storageType || !dh.tiles != !sh.tiles)
+                    return false;
+
+                merge_histo(dh, sh);
+            } return true;
+    }
+
+    return false;
+}
+
+void a2_merge_histo_storage(A2 *dest, A2 *src)
+{
+    dest->histoFillStrategy.flush();
+    src->histoFillStrategy.flush();
+
+    for (s32 ei = 0; ei < MaxVMEEvents; ei++)
+    {
+        assert(dest->operatorCounts[ei] == src->operatorCounts[ei]);
+
+        const int opCount = std::min(dest->operatorCounts[ei], src->operatorCounts[ei]);
+
+        for (int opIdx = 0; opIdx < opCount; opIdx++)
+        {
+            Operator *destOp = dest->operators[ei] + opIdx;
+            Operator *srcOp  = src->operators[ei] + opIdx;
+
+            assert(destOp->type == srcOp->type);
+
+            a2_merge_sink_histos(destOp, srcOp);
+        }
+    }
+}
+
+// Copy of the module data of a number of events.
+struct ReplicaEventBatch
+{
+    struct Event
+    {
+        s32 eventIndex;
+        u32 firstPart;
+        u32 partCount;
+    };
+
+    struct ModulePart
+    {
+        s32 moduleIndex;
+        u32 size;
+        size_t offset;
+    };
+
+    std::vector<Event> events;
+    std::vector<ModulePart> parts;
+    std::vector<u32> data;
+
+    void clear()
+    {
+        events.clear();
+        parts.clear();
+        data.clear();
+    }
+};
+
+using BatchPtr = std::unique_ptr<ReplicaEventBatch>;
+
+struct ReplicaWorker
+{
+    A2 *a2 = nullptr;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<BatchPtr> queue;
+    bool busy = false;
+    bool quit = false;
+};
+
+static void process_batch(A2 *a2, const ReplicaEventBatch &batch)
+{
+    for (const auto &event: batch.events)
+    {
+        a2_begin_event(a2, event.eventIndex);
+
+        for (u32 pi = event.firstPart; pi < event.firstPart + event.partCount; pi++)
+        {
+            const auto &part = batch.parts[pi];
+            a2_process_module_data(a2, event.eventIndex, part.moduleIndex,
+                                   batch.data.data() + part.offset, part.size);
+        }
+
+        a2_end_event(a2, event.eventIndex);
+    }
+}
+
+struct EventReplicaSet::Private
+{
+    // Limits the number of batches queued up per replica. The producer blocks
+    // if the target replica is this far behind.
+    static const size_t MaxQueuedBatches = 4;
+
+    std::vector<std::unique_ptr<ReplicaWorker>> workers;
+    size_t eventsPerBatch;
+    size_t nextWorker = 0;
+    BatchPtr current;
+
+    std::mutex freeMutex;
+    std::vector<BatchPtr> freeBatches;
+
+    BatchPtr getFreeBatch()
+    {
+        std::unique_lock<std::mutex> guard(freeMutex);
+
+        if (freeBatches.empty())
+            return std::make_unique<ReplicaEventBatch>();
+
+        auto result = std::move(freeBatches.back());
+        freeBatches.pop_back();
+        return result;
+    }
+
+    void putFreeBatch(BatchPtr &&batch)
+    {
+        batch->clear();
+        std::unique_lock<std::mutex> guard(freeMutex);
+        freeBatches.emplace_back(std::move(batch));
+    }
+
+    void workerLoop(ReplicaWorker *w)
+    {
+        while (true)
+        {
+            BatchPtr batch;
+
+            {
+                std::unique_lock<std::mutex> guard(w->mutex);
+                w->cv.wait(guard, [w] { return w->quit || !w->queue.empty(); });
+
+                if (w->quit)
+                    return;
+
+                batch = std::move(w->queue.front());
+                w->queue.pop_front();
+                w->busy = true;
+            }
+
+            w->cv.notify_all();
+
+            process_batch(w->a2, *batch);
+            putFreeBatch(std::move(batch));
+
+            {
+                std::unique_lock<std::mutex> guard(w->mutex);
+                w->busy = false;
+            }
+
+            w->cv.notify_all();
+        }
+    }
+
+    void submitCurrent()
+    {
+        if (!current || current->events.empty())
+            return;
+
+        auto w = workers[nextWorker].get();
+        nextWorker = (nextWorker + 1) % workers.size();
+
+        {
+            std::unique_lock<std::mutex> guard(w->mutex);
+            w->cv.wait(guard, [w] { return w->queue.size() < MaxQueuedBatches; });
+            w->queue.emplace_back(std::move(current));
+        }
+
+        w->cv.notify_all();
+        current = getFreeBatch();
+    }
+};
+
+EventReplicaSet::EventReplicaSet(const std::vector<A2 *> &replicas, size_t eventsPerBatch)
+    : d(std::make_unique<Private>())
+{
+    assert(!replicas.empty());
+
+    d->eventsPerBatch = std::max(eventsPerBatch, static_cast<size_t>(1));
+    d->current = d->getFreeBatch();
+
+    for (auto a2: replicas)
+    {
+        auto w = std::make_unique<ReplicaWorker>();
+        w->a2 = a2;
+        d->workers.emplace_back(std::move(w));
+    }
+
+    for (auto &w: d->workers)
+        w->thread = std::thread(&Private::workerLoop, d.get(), w.get());
+}
+
+EventReplicaSet::~EventReplicaSet()
+{
+    for (auto &w: d->workers)
+    {
+        {
+            std::unique_lock<std::mutex> guard(w->mutex);
+            w->quit = true;
+        }
+        w->cv.notify_all();
+    }
+
+    for (auto &w: d->workers)
+    {
+        if (w->thread.joinable())
+            w->thread.join();
+    }
+}
+
+void EventReplicaSet::beginEvent(int eventIndex)
+{
+    auto &batch = *d->current;
+    batch.events.push_back({ eventIndex, static_cast<u32>(batch.parts.size()), 0u });
+}
+
+void EventReplicaSet::processModuleData(int eventIndex, int moduleIndex, const u32 *data, u32 size)
+{
+    auto &batch = *d->current;
+
+    assert(!batch.events.empty());
+    assert(batch.events.back().eventIndex == eventIndex); (void) eventIndex;
+
+    batch.parts.push_back({ moduleIndex, size, batch.data.size() });
+    batch.data.insert(batch.data.end(), data, data + size);
+    batch.events.back().partCount++;
+}
+
+void EventReplicaSet::endEvent(int eventIndex)
+{
+    (void) eventIndex;
+
+    if (d->current->events.size() >= d->eventsPerBatch)
+        d->submitCurrent();
+}
+
+void EventReplicaSet::sync()
+{
+    d->submitCurrent();
+
+    for (auto &w: d->workers)
+    {
+        std::unique_lock<std::mutex> guard(w->mutex);
+        w->cv.wait(guard, [&w] { return w->queue.empty() && !w->busy; });
+    }
+}
+
+void EventReplicaSet::mergeHistos(A2 *dest)
+{
+    sync();
+
+    for (auto &w: d->workers)
+        a2_merge_histo_storage(dest, w->a2);
+}
+
+size_t EventReplicaSet::replicaCount() const
+{
+    return d->workers.size();
+}
+
 /* Threaded histosink implementation.
 -----------------------------------------------------------------------------
 
+Note: per histogram buffering with flushes on a2_timetick() and a2_end_run()
+is implemented by HistoFillBuffered. The threaded part below is not.
+
 Push Histo1DSink or Histo2DSink work on a bounded queue. If the enqueue
 blocks it means histo filling is slowing us down.
 
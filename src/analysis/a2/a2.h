@@ -1,10 +1,12 @@
 #ifndef __MVME_A2_H__
 #define __MVME_A2_H__
 
-#include <boost/dynamic_bitset.hpp>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cpp11-on-multicore/common/rwlock.h>
 #include <pcg_random.hpp>
+#include <vector>
 
 #include <mesytec-mvlc/util/protected.h>
 
@@ -12,14 +14,18 @@
 #include "a2_export.h"
 #endif
 
+#include "a2_expr_codegen.h"
 #include "a2_exprtk.h"
 #include "a2_param.h"
+#include "histo_storage.h"
 #include "listfilter.h"
 #include "mdpp-sampling/waveform_interpolation.h"
+#include "mdpp-sampling/waveform_trace_ring.h"
 #include "mdpp-sampling/mdpp_decode.h"
 #include "memory.h"
 #include "multiword_datafilter.h"
 #include "rate_sampler.h"
+#include "tiled_histo_storage.h"
 #include "util/typed_block.h"
 
 namespace a2
@@ -184,6 +190,38 @@ void extractor_process_module_data(DataSource *ex, const u32 *data, u32 size);
 void listfilter_extractor_begin_event(DataSource *ex);
 const u32 *listfilter_extractor_process_module_data(DataSource *ex, const u32 *data, u32 dataSize);
 
+/* Fused single pass extraction for the Extractor data sources of a module.
+ *
+ * extractor_process_module_data() scans the complete module data once per
+ * Extractor. The fused variant scans the data once per module and compares
+ * each data word against a flat table containing the mask and match values of
+ * the subfilters of all Extractors attached to the module. Matching words are
+ * routed directly to the owning Extractor. The results are identical to
+ * calling extractor_process_module_data() for each of the Extractors. */
+struct FusedExtractorEntry
+{
+    u32 matchMask;
+    u32 matchValue;
+    s32 matchWordIndex;     // < 0 if the subfilter matches any word index
+    u16 sourceIndex;        // index into FusedModuleExtractors::sources
+    u8 subfilterIndex;
+    u8 skip;                // number of entries up to the next Extractors first entry
+};
+
+struct FusedModuleExtractors
+{
+    FusedExtractorEntry *entries;
+    DataSource **sources;
+    u16 entryCount;
+    u16 sourceCount;
+    // Bits on which all entries agree. Words not matching these cannot match
+    // any of the entries and are skipped.
+    u32 commonMask;
+    u32 commonValue;
+};
+
+void fused_extractors_process_module_data(const FusedModuleExtractors *fused, const u32 *data, u32 size);
+
 // MultiHitExtractor
 struct MultiHitExtractor
 {
@@ -503,6 +541,11 @@ struct ExpressionOperatorData
     using StaticVarMap = std::map<std::string, StaticVar>;
 
     StaticVarMap static_vars;
+
+    /* Native version of expr_step. Set up in a2_begin_run() if native
+     * expressions are enabled and the expression could be compiled, see
+     * a2_set_native_expressions(). */
+    expr_codegen::NativeExpression native_step;
 };
 
 enum class ExpressionOperatorBuildOptions: u8
@@ -569,13 +612,19 @@ Operator make_interval_condition(
     PipeVectors input,
     const std::vector<Interval> &intervals);
 
+/* The polygon is precompiled into a raster of inside/outside/edge cells (see
+ * polygon_raster.h). cellWidthX/Y should be set to the bin widths of the
+ * histogram the polygon was drawn in. Non-positive values make the raster use
+ * a fixed number of cells over the polygons bounding box. */
 Operator make_polygon_condition(
     memory::Arena *arena,
     PipeVectors xInput,
     PipeVectors yInput,
     s32 xIndex,
     s32 yIndex,
-    const std::vector<std::pair<double, double>> &polygon);
+    const std::vector<std::pair<double, double>> &polygon,
+    double cellWidthX = 0.0,
+    double cellWidthY = 0.0);
 
 Operator make_expression_condition(
     memory::Arena *arena,
@@ -596,8 +645,12 @@ struct Binning
     double range;
 };
 
+/* Note: for histograms the ParamVec data pointer points to bin storage of the
+ * type given by storageType. Only access it directly if storageType is
+ * BinStorageType::Double, otherwise use the functions from histo_storage.h. */
 struct H1D: public ParamVec
 {
+    BinStorageType storageType;
     Binning binning;
     // binningFactor = binCount / binning.range
     double binningFactor;
@@ -639,6 +692,12 @@ struct H2D: public ParamVec
         AxisCount
     };
 
+    BinStorageType storageType; // see the note above H1D
+
+    // If set the bins are kept in this sparse storage and data is unused.
+    // The storage is owned by the caller (Histo2D or the replica arena).
+    TiledHistoStorage *tiles;
+
     s32 binCounts[AxisCount];
     Binning binnings[AxisCount];
     double binningFactors[AxisCount];
@@ -755,9 +814,83 @@ Operator make_rate_monitor(
 Operator make_waveform_sink(
     memory::Arena *arena,
     const std::vector<PipeVectors> &inputs,
-    mesytec::mvlc::Protected<mesytec::mvme::waveforms::TraceHistories> &traceHistories,
+    mesytec::mvlc::Protected<std::shared_ptr<mesytec::mvme::waveforms::TraceRings>> &traceRings,
     size_t traceHistoryMaxDepth);
 
+//
+// WaveformFeatures
+//
+
+/* Extracts pulse features from sampled waveforms, e.g. the per channel
+ * sample arrays of the MdppSampleDecoder data source.
+ *
+ * Inputs: phase array, config array, then one sample array per channel. The
+ * phase and config arrays are indexed by channel like the corresponding
+ * decoder outputs. Unconnected phase/config inputs (size 0) disable the phase
+ * correction.
+ *
+ * Outputs: one array per feature, indexed by channel. Times are in units of
+ * dtSample, amplitudes in units of the input samples. Each output is invalid
+ * if the feature could not be determined for the trace.
+ *
+ * Only positive pulses are supported. The baseline, amplitude and integral
+ * are computed using the simd aggregate kernels. */
+
+enum class WaveformPhaseCorrection: u8
+{
+    // Correct only if the config indicates that the module did not resample
+    // the trace itself.
+    Auto,
+    On,
+    Off,
+};
+
+struct WaveformFeaturesParameters
+{
+    // Number of leading samples averaged to determine the baseline.
+    u32 baselineSamples = 8;
+    // Integration window. A length of 0 integrates until the end of the trace.
+    u32 integralStart = 0;
+    u32 integralLength = 0;
+    // Constant fraction discriminator settings. The delay is in samples.
+    double cfdFraction = 0.3;
+    u32 cfdDelay = 2;
+    // Time between two samples.
+    double dtSample = 12.5;
+    WaveformPhaseCorrection phaseCorrection = WaveformPhaseCorrection::Auto;
+};
+
+enum WaveformFeatureOutput
+{
+    WaveformFeature_Baseline,       // mean of the first baselineSamples samples
+    WaveformFeature_Amplitude,      // maximum sample minus baseline
+    WaveformFeature_Integral,       // sum of the baseline corrected samples in the window
+    WaveformFeature_RiseTime,       // 10% to 90% of the amplitude on the leading edge
+    WaveformFeature_CfdTime,        // zero crossing of the CFD signal, phase corrected
+
+    WaveformFeature_Count
+};
+
+Operator make_waveform_features(
+    memory::Arena *arena,
+    const std::vector<PipeVectors> &inputs,
+    const WaveformFeaturesParameters &params);
+
+// Pulse features of a single trace. Used by the operator, exposed for testing.
+struct WaveformFeatures
+{
+    double baseline;
+    double amplitude;
+    double integral;
+    double riseTime;    // in samples
+    double cfdTime;     // in samples, not phase corrected
+};
+
+// samples: valid samples of the trace, no invalid parameters allowed.
+// Features which cannot be determined are set to invalid_param().
+WaveformFeatures extract_waveform_features(
+    const double *samples, s32 size, const WaveformFeaturesParameters &params);
+
 //
 // ExportSink
 //
@@ -780,8 +913,18 @@ enum class ExportSinkFormat
     CSV,
 };
 
+// Background writer of an ExportSink. Defined in a2.cc.
+struct ExportSinkWriter;
+
 struct ExportSinkData
 {
+    // The step functions append raw event data to fixed size chunks which are
+    // handed to a writer thread for compression and file output. Once all
+    // chunks are queued for writing the analysis thread has to wait for the
+    // writer (a stall).
+    static const size_t WriterChunkSize  = 1u << 20;
+    static const size_t WriterChunkCount = 8;
+
     // Output filename. May include a path. Is relative to the application
     // working directory which is the workspace directory.
     std::string filename;
@@ -799,20 +942,32 @@ struct ExportSinkData
     // ostream used when compression is enabled.
     std::unique_ptr<std::ostream> z_ostream;
 
+    // Set between begin_run and end_run if the output file could be opened.
+    std::shared_ptr<ExportSinkWriter> writer;
+
     // Condition input index. If negative the condition input will be unused.
     s32 condIndex = -1;
 
     // runtime state
     u64 eventsWritten = 0;
-    u64 bytesWritten  = 0;
+    u64 bytesWritten  = 0;      // uncompressed bytes passed to the writer
     std::string lastError;
 
+    // Writer counters. Updated by the analysis and writer threads, read by the UI.
+    std::atomic<u32> writerQueueFill;   // number of full chunks waiting to be written
+    std::atomic<u64> writerStalls;      // number of times the analysis had to wait for a free chunk
+
     std::vector<std::string> csvColumns;
 
     mutable NonRecursiveRWLock lastErrorLock;
     using WriteGuard = WriteLockGuard<NonRecursiveRWLock>;
     using ReadGuard  = ReadLockGuard<NonRecursiveRWLock>;
 
+    ExportSinkData()
+        : writerQueueFill(0)
+        , writerStalls(0)
+    {}
+
     std::string getLastError() const
     {
         ReadGuard guard(lastErrorLock);
@@ -869,6 +1024,7 @@ struct HistoFillDirect
 
     void begin_run(A2 *) {};
     void end_run(A2 *) {};
+    void flush() {};
 
     void fill_h1d(H1D *histo, double x);
     void fill_h2d(H2D *histo, double x, double y);
@@ -882,6 +1038,15 @@ struct FillBuffer
     std::array<s32, FillBufferSize> bins; // bin values to increment
 };
 
+/* Collects the bins to increment in a per histogram FillBuffer. Full buffers
+ * are applied to the histogram storage in one tight loop instead of
+ * interleaving the cache misses of many histograms with operator processing.
+ * Under-/overflow and NaN counters are updated immediately, bin contents and
+ * entryCount on flush.
+ *
+ * Remaining contents are flushed on a2_timetick() and at the end of the run.
+ * Each FillBuffer belongs to a single histogram which is only filled by its
+ * sink operator, so parallel operator execution is safe. */
 class HistoFillBuffered
 {
     public:
@@ -891,6 +1056,7 @@ class HistoFillBuffered
 
         void begin_run(A2 *a2);
         void end_run(A2 *a2);
+        void flush();
 
         void fill_h1d(H1D *histo, double x);
         void fill_h2d(H2D *histo, double x, double y);
@@ -898,11 +1064,162 @@ class HistoFillBuffered
     private:
         memory::Arena m_arena;
 
-        TypedBlock<H1D *, size_t> m_histos;
-        TypedBlock<FillBuffer, size_t> m_buffers;
+        // Histograms sorted by address to allow lookups via
+        // std::lower_bound(). m_buffers1d/m_buffers2d are in the same order.
+        TypedBlock<H1D *, size_t> m_histos1d;
+        TypedBlock<FillBuffer, size_t> m_buffers1d;
+        TypedBlock<H2D *, size_t> m_histos2d;
+        TypedBlock<FillBuffer, size_t> m_buffers2d;
 };
 
-using TheHistoFillStrategy = HistoFillDirect;
+enum class HistoFillStrategyType: u8
+{
+    Direct,
+    Buffered,
+};
+
+/* Dispatches to the histo fill strategy selected via
+ * a2_set_histo_fill_strategy(). The buffered strategy is only allocated when
+ * selected. */
+class HistoFillStrategy
+{
+    public:
+        const char *name() const;
+        HistoFillStrategyType type() const { return m_type; }
+        void setType(HistoFillStrategyType type);
+
+        void begin_run(A2 *a2);
+        void end_run(A2 *a2);
+        void flush();
+
+        void fill_h1d(H1D *histo, double x);
+        void fill_h2d(H2D *histo, double x, double y);
+
+    private:
+        HistoFillStrategyType m_type = HistoFillStrategyType::Direct;
+        std::unique_ptr<HistoFillBuffered> m_buffered;
+};
+
+using TheHistoFillStrategy = HistoFillStrategy;
+
+/* Worker pool used by a2_end_event() to step the operators of a single rank
+ * concurrently. See a2_set_operator_thread_count(). */
+struct OperatorRangeWorkQueue;
+
+/* Storage for the condition bits. The bits are packed into plain 64-bit words
+ * so that all conditions gating an operator can be tested with a few
+ * word-wide AND operations, see ConditionMaskWord. Setting a bit is
+ * branchless. */
+class ConditionBitset
+{
+    public:
+        using Word = u64;
+        using Allocator = memory::ArenaAllocator<Word>;
+        static constexpr size_t BitsPerWord = sizeof(Word) * 8;
+
+        explicit ConditionBitset(const Allocator &alloc)
+            : m_words(alloc)
+        {}
+
+        size_t size() const { return m_size; }
+
+        // Resizes the bitset. Newly added bits are cleared.
+        void resize(size_t bitCount)
+        {
+            m_words.resize((bitCount + BitsPerWord - 1) / BitsPerWord, 0);
+
+            if (bitCount % BitsPerWord)
+                m_words.back() &= (Word(1) << (bitCount % BitsPerWord)) - 1;
+
+            m_size = bitCount;
+        }
+
+        // Clears all bits.
+        void reset()
+        {
+            std::fill(m_words.begin(), m_words.end(), 0);
+        }
+
+        void set(size_t bit, bool value = true)
+        {
+            assert(bit < m_size);
+            const Word mask = Word(1) << (bit % BitsPerWord);
+            Word &word = m_words[bit / BitsPerWord];
+            word = (word & ~mask) | (-static_cast<Word>(value) & mask);
+        }
+
+        bool test(size_t bit) const
+        {
+            assert(bit < m_size);
+            return (m_words[bit / BitsPerWord] >> (bit % BitsPerWord)) & 1u;
+        }
+
+        const Word *words() const { return m_words.data(); }
+        size_t wordCount() const { return m_words.size(); }
+
+    private:
+        std::vector<Word, Allocator> m_words;
+        size_t m_size = 0;
+};
+
+/* One word of the AND-mask formed by the condition bits gating an operator. */
+struct ConditionMaskWord
+{
+    ConditionBitset::Word mask;
+    u32 wordIndex;
+};
+
+inline bool operator==(const ConditionMaskWord &a, const ConditionMaskWord &b)
+{
+    return a.mask == b.mask && a.wordIndex == b.wordIndex;
+}
+
+/* Returns true if all bits of the given mask words are set. */
+inline bool conditions_true(const ConditionBitset &bits,
+                            const TypedBlock<ConditionMaskWord, u16> &mask)
+{
+    const auto words = bits.words();
+    bool result = true;
+
+    for (const auto &mw: mask)
+        result &= (words[mw.wordIndex] & mw.mask) == mw.mask;
+
+    return result;
+}
+
+/* Operators of the same rank gated by the same set of conditions. The mask is
+ * tested once per event. If it is false the outputs of all operators in the
+ * group are invalidated in bulk. Operators without conditions form a group
+ * with an empty mask. */
+struct OperatorGateGroup
+{
+    TypedBlock<ConditionMaskWord, u16> mask;
+    TypedBlock<u16, u16> operatorIndexes;
+};
+
+/* Cost counters of a single data source or operator, see
+ * a2_set_cost_accounting(). */
+struct ObjectCost
+{
+    /* Time spent in the process/step functions of the object. Time stamp
+     * counter ticks on x86, nanoseconds elsewhere. */
+    u64 cycles = 0;
+
+    /* Number of process_module_data calls for data sources, number of steps
+     * for operators. */
+    u64 steps = 0;
+
+    /* Operators only: number of events the operator was not stepped because
+     * its conditions were false. */
+    u64 conditionSkips = 0;
+};
+
+/* Per event cost counters, parallel to A2::dataSources and A2::operators. */
+struct CostAccounting
+{
+    std::array<std::vector<ObjectCost>, MaxVMEEvents> dataSources;
+    std::array<std::vector<ObjectCost>, MaxVMEEvents> operators;
+};
 
 struct A2
 {
@@ -915,17 +1232,31 @@ struct A2
     std::array<Operator *, MaxVMEEvents> operators;
     std::array<OperatorCountType *, MaxVMEEvents> operatorRanks;
 
-    using BlockType = unsigned long;
-    using BitsetAllocator = memory::ArenaAllocator<BlockType>;
-    using ConditionBitset = boost::dynamic_bitset<BlockType, BitsetAllocator>;
-
     /* FIXME: hide this member and provide an accessor that creates and returns
      * a copy of the bitset. The copy should use std::allocator instead of the
-     * BitsetAllocator. */
+     * arena allocator. */
     ConditionBitset conditionBits;
 
+    /* Per event operator groups in stepping order, see OperatorGateGroup.
+     * Empty if a2_build_condition_gates() has not been called. */
+    std::array<TypedBlock<OperatorGateGroup, u16>, MaxVMEEvents> operatorGates;
+
     TheHistoFillStrategy histoFillStrategy;
 
+    bool nativeExpressions = false;
+
+    /* Non-null if parallel operator execution is enabled. */
+    std::unique_ptr<OperatorRangeWorkQueue> operatorWorkQueue;
+
+    /* Per event arrays of MaxVMEModules fused extraction tables. nullptr if
+     * a2_build_fused_extractors() has not been called. */
+    std::array<FusedModuleExtractors *, MaxVMEEvents> fusedExtractors;
+
+    /* Non-null if cost accounting is enabled. The counters are updated by the
+     * threads processing the events and read without synchronization for
+     * display purposes. */
+    std::unique_ptr<CostAccounting> costs;
+
     explicit A2(memory::Arena *arena);
     ~A2();
 
@@ -946,6 +1277,130 @@ void a2_end_event(A2 *a2, int eventIndex);
 void a2_timetick(A2 *a2);
 void a2_end_run(A2 *a2);
 
+/* Parallel operator execution.
+ *
+ * Operators of the same rank do not depend on each others outputs. With a
+ * threadCount > 1 a2_end_event() splits the operators of each rank into tasks,
+ * hands them to a pool of worker threads and waits for the rank to complete
+ * before moving on to the next one. Condition operators are always stepped by
+ * the calling thread as they write to the shared A2::conditionBits.
+ *
+ * A threadCount of 0 or 1 stops the workers and restores serial execution.
+ * Must be called after the operators have been setup and not concurrently with
+ * a2_end_event(). */
+void a2_set_operator_thread_count(A2 *a2, unsigned threadCount);
+unsigned a2_get_operator_thread_count(const A2 *a2);
+
+/* Builds the fused extraction tables for the Extractor data sources of each
+ * module, see FusedModuleExtractors. Called by a2_adapter_build() after the
+ * data sources have been created. Without the tables a2_process_module_data()
+ * calls extractor_process_module_data() once per Extractor. */
+void a2_build_fused_extractors(A2 *a2, memory::Arena *arena);
+
+/* Removes the fused extraction tables, restoring the per-Extractor path. Used
+ * for benchmarking. */
+void a2_clear_fused_extractors(A2 *a2);
+
+/* Groups the operators of each event by rank and by the set of conditions
+ * gating them, see OperatorGateGroup. Called by a2_adapter_build() after the
+ * operators have been created. The serial a2_end_event() then tests the
+ * condition mask once per group instead of testing the condition bits of each
+ * operator. */
+void a2_build_condition_gates(A2 *a2, memory::Arena *arena);
+
+/* Removes the gate groups, restoring per operator condition checks. Used for
+ * benchmarking. */
+void a2_clear_condition_gates(A2 *a2);
+
+/* Selects the histogram fill strategy. Must be called before a2_begin_run().
+ * The buffered strategy delays the visibility of bin contents until the next
+ * a2_timetick() or a2_end_run(). */
+void a2_set_histo_fill_strategy(A2 *a2, HistoFillStrategyType type);
+
+/* Enables compiling the step expressions of expression operators and the
+ * expressions of expression conditions to native code in a2_begin_run(), see
+ * a2_expr_codegen.h. Expressions which cannot be translated or compiled keep
+ * using exprtk. Must be called before a2_begin_run(). */
+void a2_set_native_expressions(A2 *a2, bool enable);
+
+/* Per object cost accounting.
+ *
+ * If enabled the time spent in each data source and operator is recorded
+ * together with the number of calls and, for operators, the number of events
+ * in which the operator was skipped due to its conditions. The counters are
+ * cleared by a2_begin_run(). With fused extractors the cost of the fused pass
+ * is split evenly between the Extractors of the module.
+ *
+ * Must be called before a2_begin_run() and not concurrently with event
+ * processing. */
+void a2_set_cost_accounting(A2 *a2, bool enable);
+
+/* Event-parallel processing using A2 replicas.
+ *
+ * A replica is an A2 instance built from the same sources and operators as the
+ * primary A2 but allocated in its own arena. Each replica processes a disjoint
+ * subset of the events. Histogram sinks of a replica must write into private
+ * storage (a2_detach_histo_storage()). Their contents are summed into the
+ * primary A2 using a2_merge_histo_storage().
+ *
+ * This only yields correct results if no operator depends on the order of
+ * events, see a2_operator_requires_event_order(). */
+
+/* Returns true if the operator keeps state across events or has side effects
+ * which depend on the order in which events are processed. Examples are
+ * PreviousValue, ScalerOverflow, rate monitors, waveform and export sinks and
+ * expression operators using static variables. */
+bool a2_operator_requires_event_order(const Operator *op);
+
+/* Points all H1D and H2D sinks of the given A2 to zero initialized storage
+ * allocated from the arena. Must be called before a2_begin_run(). */
+void a2_detach_histo_storage(A2 *a2, memory::Arena *arena);
+
+/* Adds the histogram contents and statistics of src to the corresponding
+ * histograms in dest and clears the src histograms. Both instances must have
+ * been built from the same analysis. Must not be called concurrently with
+ * event processing of either instance. */
+void a2_merge_histo_storage(A2 *dest, A2 *src);
+
+/* Merges a single pair of H1D or H2D sink operators as described above. The
+ * operators may belong to A2 instances built from different analysis objects,
+ * e.g. when summing the results of multiple replays. Pending buffered fills of
+ * both instances must have been flushed. Returns false and leaves both sinks
+ * unmodified if the operator types, histogram counts, sizes or storage types
+ * differ. */
+bool a2_merge_sink_histos(Operator *dest, Operator *src);
+
+/* Distributes events across a set of replicas, each one processed by its own
+ * worker thread. Events are copied into batches which are handed to the
+ * replicas in round-robin fashion. */
+struct EventReplicaSet
+{
+    static const size_t DefaultEventsPerBatch = 256;
+
+    explicit EventReplicaSet(const std::vector<A2 *> &replicas,
+                             size_t eventsPerBatch = DefaultEventsPerBatch);
+    ~EventReplicaSet();
+
+    EventReplicaSet(const EventReplicaSet &) = delete;
+    EventReplicaSet &operator=(const EventReplicaSet &) = delete;
+
+    void beginEvent(int eventIndex);
+    void processModuleData(int eventIndex, int moduleIndex, const u32 *data, u32 size);
+    void endEvent(int eventIndex);
+
+    /* Hands out the partially filled batch and blocks until all replicas have
+     * processed their queued events. */
+    void sync();
+
+    /* sync() followed by merging the histograms of all replicas into dest. */
+    void mergeHistos(A2 *dest);
+
+    size_t replicaCount() const;
+
+    struct Private;
+    std::unique_ptr<Private> d;
+};
+
 //
 // Stuff used for debugging and tests
 //
@@ -0,0 +1,1356 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "a2_expr_codegen.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "a2_param.h"
+
+namespace a2
+{
+namespace expr_codegen
+{
+
+namespace
+{
+
+std::string to_lower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(),
+                   [] (unsigned char c) { return std::tolower(c); });
+    return str;
+}
+
+//
+// Lexer
+//
+
+struct Token
+{
+    enum Type
+    {
+        End,
+        Number,
+        Symbol,
+        Operator,
+    };
+
+    Type type = End;
+    std::string text;
+    size_t offset = 0;
+};
+
+std::vector<Token> tokenize(const std::string &expr)
+{
+    // Longest operators first.
+    static const char *const Operators[] =
+    {
+        "<=>",
+        ":=", "+=", "-=", "*=", "/=", "%=", "<=", ">=", "==", "!=", "<>",
+        "+", "-", "*", "/", "%", "^", "<", ">", "=", "(", ")", "[", "]",
+        "{", "}", ",", ";", "?", ":", "&", "|",
+    };
+
+    auto is_digit = [] (char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; };
+    auto is_alpha = [] (char c) { return std::isalpha(static_cast<unsigned char>(c)) != 0; };
+    auto is_symbol_char = [&] (char c) { return is_alpha(c) || is_digit(c) || c == '_' || c == '.'; };
+
+    std::vector<Token> result;
+    const size_t size = expr.size();
+    size_t i = 0;
+
+    auto error = [&] (const std::string &msg)
+    {
+        throw CodegenError(msg + " at offset " + std::to_string(i));
+    };
+
+    while (i < size)
+    {
+        const char c = expr[i];
+
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            ++i;
+            continue;
+        }
+
+        if (c == '#' || (c == '/' && i + 1 < size && expr[i + 1] == '/'))
+        {
+            while (i < size && expr[i] != '\n')
+                ++i;
+            continue;
+        }
+
+        if (c == '/' && i + 1 < size && expr[i + 1] == '*')
+        {
+            auto end = expr.find("*/", i + 2);
+
+            if (end == std::string::npos)
+                error("unterminated comment");
+
+            i = end + 2;
+            continue;
+        }
+
+        Token token;
+        token.offset = i;
+
+        if (is_alpha(c) || c == '_')
+        {
+            while (i < size && is_symbol_char(expr[i]))
+                ++i;
+
+            token.type = Token::Symbol;
+        }
+        else if (is_digit(c) || (c == '.' && i + 1 < size && is_digit(expr[i + 1])))
+        {
+            while (i < size && is_digit(expr[i]))
+                ++i;
+
+            if (i < size && expr[i] == '.')
+            {
+                ++i;
+                while (i < size && is_digit(expr[i]))
+                    ++i;
+            }
+
+            if (i < size && (expr[i] == 'e' || expr[i] == 'E'))
+            {
+                size_t j = i + 1;
+
+                if (j < size && (expr[j] == '+' || expr[j] == '-'))
+                    ++j;
+
+                if (j < size && is_digit(expr[j]))
+                {
+                    i = j;
+                    while (i < size && is_digit(expr[i]))
+                        ++i;
+                }
+            }
+
+            // Implicit multiplication like "2x" is not supported.
+            if (i < size && is_symbol_char(expr[i]))
+                error("unsupported numeric literal");
+
+            token.type = Token::Number;
+        }
+        else
+        {
+            for (auto op: Operators)
+            {
+                if (expr.compare(i, std::strlen(op), op) == 0)
+                {
+                    i += std::strlen(op);
+                    token.type = Token::Operator;
+                    break;
+                }
+            }
+
+            if (token.type != Token::Operator)
+                error(std::string("unsupported character '") + c + "'");
+        }
+
+        token.text = expr.substr(token.offset, i - token.offset);
+        result.emplace_back(token);
+    }
+
+    Token end;
+    end.offset = size;
+    result.emplace_back(end);
+
+    return result;
+}
+
+//
+// Translator
+//
+
+/* Emits a double literal which converts back to exactly the same value. */
+std::string double_literal(double value)
+{
+    if (std::isinf(value))
+        return value < 0.0 ? "(-std::numeric_limits<double>::infinity())"
+            : "std::numeric_limits<double>::infinity()";
+
+    if (std::isnan(value))
+        return "std::numeric_limits<double>::quiet_NaN()";
+
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%a", value);
+
+    if (value < 0.0)
+        return std::string("(") + buffer + ")";
+
+    return buffer;
+}
+
+struct Value
+{
+    enum Kind
+    {
+        Scalar,
+        Vector,
+    };
+
+    Kind kind = Scalar;
+    // C++ expression for scalars, always a primary expression (parenthesized
+    // if needed). Unused for vectors.
+    std::string code;
+    bool isLValue = false;
+    // Slot in the vector tables for vectors.
+    size_t vectorSlot = 0;
+
+    static Value scalar(const std::string &code, bool isLValue = false)
+    {
+        Value result;
+        result.code = code;
+        result.isLValue = isLValue;
+        return result;
+    }
+};
+
+struct Statement
+{
+    std::string code;
+    // Set for expression statements.
+    bool isExpression = false;
+    std::string expression;
+};
+
+struct BinaryOperator
+{
+    std::string op;
+    int left;
+    int right;
+};
+
+class Translator
+{
+    public:
+        Translator(const std::string &expr, a2_exprtk::SymbolTable &symtab)
+            : m_tokens(tokenize(expr))
+            , m_symtab(symtab)
+        {}
+
+        Translation run();
+
+    private:
+        // Tokens
+        const Token &peek(size_t ahead = 0) const
+        {
+            return m_tokens[std::min(m_pos + ahead, m_tokens.size() - 1)];
+        }
+
+        const Token &next()
+        {
+            const Token &result = peek();
+            if (m_pos < m_tokens.size() - 1)
+                ++m_pos;
+            return result;
+        }
+
+        bool peekOp(const char *op, size_t ahead = 0) const
+        {
+            const auto &t = peek(ahead);
+            return t.type == Token::Operator && t.text == op;
+        }
+
+        bool peekKeyword(const char *keyword, size_t ahead = 0) const
+        {
+            const auto &t = peek(ahead);
+            return t.type == Token::Symbol && to_lower(t.text) == keyword;
+        }
+
+        bool acceptOp(const char *op)
+        {
+            if (peekOp(op))
+            {
+                next();
+                return true;
+            }
+            return false;
+        }
+
+        void expectOp(const char *op)
+        {
+            if (!acceptOp(op))
+                syntaxError(std::string("expected '") + op + "'");
+        }
+
+        [[noreturn]] void unsupported(const std::string &what) const
+        {
+            throw CodegenError("unsupported " + what + " at offset "
+                               + std::to_string(peek().offset));
+        }
+
+        [[noreturn]] void syntaxError(const std::string &what) const
+        {
+            throw CodegenError("syntax error: " + what + " at offset "
+                               + std::to_string(peek().offset)
+                               + " ('" + peek().text + "')");
+        }
+
+        // Scopes and symbols
+        void pushScope() { m_scopes.emplace_back(); }
+        void popScope() { m_scopes.pop_back(); }
+
+        std::string declareLocal(const std::string &name)
+        {
+            auto code = "l" + std::to_string(m_localCount++);
+            m_scopes.back()[to_lower(name)] = code;
+            return code;
+        }
+
+        const std::string *findLocal(const std::string &name) const
+        {
+            auto lname = to_lower(name);
+
+            for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it)
+            {
+                auto jt = it->find(lname);
+                if (jt != it->end())
+                    return &jt->second;
+            }
+
+            return nullptr;
+        }
+
+        size_t scalarSlot(double *ptr)
+        {
+            auto it = std::find(m_result.scalars.begin(), m_result.scalars.end(), ptr);
+            if (it != m_result.scalars.end())
+                return it - m_result.scalars.begin();
+            m_result.scalars.push_back(ptr);
+            return m_result.scalars.size() - 1;
+        }
+
+        size_t vectorSlot(double *ptr, size_t size)
+        {
+            for (size_t i = 0; i < m_result.vectors.size(); ++i)
+            {
+                if (m_result.vectors[i] == ptr && m_result.sizes[i] == size)
+                    return i;
+            }
+
+            m_result.vectors.push_back(ptr);
+            m_result.sizes.push_back(size);
+            return m_result.vectors.size() - 1;
+        }
+
+        static std::string vecName(size_t slot) { return "v" + std::to_string(slot); }
+        static std::string sizeName(size_t slot) { return "n" + std::to_string(slot); }
+
+        // Statements
+        std::vector<Statement> parseStatementList();
+        Statement parseStatement();
+        std::string parseBody();
+        std::string parseVarDefinition();
+        Statement parseIf();
+        Statement parseFor();
+        Statement parseWhile();
+
+        // Expressions
+        Value parseExpression(int precedence = 0);
+        Value parseBranch(int precedence);
+        Value parseSymbol();
+        Value parseCall(const std::string &name);
+        Value parseTernary(const Value &condition);
+        bool peekBinaryOperator(BinaryOperator &op) const;
+        Value combine(const BinaryOperator &op, const Value &lhs, const Value &rhs);
+        std::string scalar(const Value &value) const;
+
+        static std::string truth(const std::string &code)
+        {
+            return "(" + code + " != 0.0)";
+        }
+
+        std::vector<Token> m_tokens;
+        size_t m_pos = 0;
+        a2_exprtk::SymbolTable &m_symtab;
+        std::vector<std::map<std::string, std::string>> m_scopes;
+        size_t m_localCount = 0;
+        int m_loopDepth = 0;
+        Translation m_result;
+};
+
+std::string Translator::scalar(const Value &value) const
+{
+    if (value.kind != Value::Scalar)
+        unsupported("vector operation");
+
+    return value.code;
+}
+
+std::vector<Statement> Translator::parseStatementList()
+{
+    std::vector<Statement> result;
+
+    for (;;)
+    {
+        while (acceptOp(";")) {}
+
+        if (peek().type == Token::End || peekOp("}"))
+            break;
+
+        result.emplace_back(parseStatement());
+    }
+
+    return result;
+}
+
+Statement Translator::parseStatement()
+{
+    if (peek().type == Token::Symbol)
+    {
+        const auto keyword = to_lower(peek().text);
+
+        if (keyword == "var")
+        {
+            Statement result;
+            result.code = parseVarDefinition();
+            return result;
+        }
+
+        if (keyword == "if")
+            return parseIf();
+
+        if (keyword == "for")
+            return parseFor();
+
+        if (keyword == "while")
+            return parseWhile();
+
+        if (keyword == "break" || keyword == "continue")
+        {
+            if (m_loopDepth == 0)
+                syntaxError(keyword + " outside of loop");
+
+            next();
+
+            // break[value] is not supported.
+            if (peekOp("["))
+                unsupported("break with value");
+
+            Statement result;
+            result.code = keyword + ";";
+            return result;
+        }
+    }
+
+    auto value = parseExpression();
+
+    Statement result;
+    result.isExpression = true;
+    result.expression = scalar(value);
+    result.code = result.expression + ";";
+    return result;
+}
+
+std::string Translator::parseBody()
+{
+    std::string result;
+
+    pushScope();
+
+    if (acceptOp("{"))
+    {
+        result = "{\n";
+
+        for (const auto &stmt: parseStatementList())
+            result += stmt.code + "\n";
+
+        expectOp("}");
+        result += "}";
+    }
+    else
+    {
+        result = "{\n" + parseStatement().code + "\n}";
+    }
+
+    popScope();
+
+    return result;
+}
+
+std::string Translator::parseVarDefinition()
+{
+    next(); // var
+
+    if (peek().type != Token::Symbol)
+        syntaxError("expected variable name");
+
+    const auto name = next().text;
+
+    if (peekOp("["))
+        unsupported("local vector definition");
+
+    std::string init = "0.0";
+
+    if (acceptOp(":="))
+    {
+        auto value = parseExpression();
+
+        if (value.kind != Value::Scalar)
+            unsupported("vector valued variable definition");
+
+        init = value.code;
+    }
+
+    // Declared after parsing the initializer which may not refer to the new
+    // variable.
+    return "double " + declareLocal(name) + " = " + init + ";";
+}
+
+Statement Translator::parseIf()
+{
+    next(); // if
+    expectOp("(");
+    auto condition = scalar(parseExpression());
+
+    // The function style if(c, x, y) is not supported.
+    if (peekOp(","))
+        unsupported("function style if");
+
+    expectOp(")");
+
+    Statement result;
+    result.code = "if " + truth(condition) + "\n" + parseBody();
+
+    if (peekKeyword("else") || (peekOp(";") && peekKeyword("else", 1)))
+    {
+        acceptOp(";");
+        next(); // else
+
+        if (peekKeyword("if"))
+            result.code += "\nelse\n{\n" + parseIf().code + "\n}";
+        else
+            result.code += "\nelse\n" + parseBody();
+    }
+
+    return result;
+}
+
+Statement Translator::parseFor()
+{
+    next(); // for
+    expectOp("(");
+
+    pushScope();
+
+    std::string init;
+
+    if (peekKeyword("var"))
+        init = parseVarDefinition();
+    else if (!peekOp(";"))
+        init = scalar(parseExpression()) + ";";
+
+    expectOp(";");
+
+    if (peekOp(";"))
+        syntaxError("missing loop condition");
+
+    auto condition = scalar(parseExpression());
+    expectOp(";");
+
+    std::string increment;
+
+    if (!peekOp(")"))
+        increment = scalar(parseExpression());
+
+    expectOp(")");
+
+    ++m_loopDepth;
+    auto body = parseBody();
+    --m_loopDepth;
+
+    popScope();
+
+    Statement result;
+    result.code = "{\n" + init + "\nfor (; " + truth(condition) + "; " + increment + ")\n"
+        + body + "\n}";
+    return result;
+}
+
+Statement Translator::parseWhile()
+{
+    next(); // while
+    expectOp("(");
+    auto condition = scalar(parseExpression());
+    expectOp(")");
+
+    ++m_loopDepth;
+    auto body = parseBody();
+    --m_loopDepth;
+
+    Statement result;
+    result.code = "while " + truth(condition) + "\n" + body;
+    return result;
+}
+
+/* Mirrors the precedence climbing of exprtk::parser::parse_expression(). Left
+ * and right precedence levels are the same as in exprtk. */
+bool Translator::peekBinaryOperator(BinaryOperator &op) const
+{
+    static const std::map<std::string, std::pair<int, int>> Levels =
+    {
+        { ":=", { 0, 0 } }, { "+=", { 0, 0 } }, { "-=", { 0, 0 } },
+        { "*=", { 0, 0 } }, { "/=", { 0, 0 } }, { "%=", { 0, 0 } },
+        { "<=>", { 0, 0 } },
+
+        { "or", { 1, 2 } }, { "|", { 1, 2 } }, { "nor", { 1, 2 } },
+        { "xor", { 1, 2 } }, { "xnor", { 1, 2 } },
+
+        { "and", { 3, 4 } }, { "&", { 3, 4 } }, { "nand", { 3, 4 } },
+
+        { "in", { 4, 4 } }, { "like", { 4, 4 } }, { "ilike", { 4, 4 } },
+
+        { "<", { 5, 6 } }, { "<=", { 5, 6 } }, { "=", { 5, 6 } }, { "==", { 5, 6 } },
+        { "!=", { 5, 6 } }, { "<>", { 5, 6 } }, { ">=", { 5, 6 } }, { ">", { 5, 6 } },
+
+        { "+", { 7, 8 } }, { "-", { 7, 8 } },
+
+        { "*", { 10, 11 } }, { "/", { 10, 11 } }, { "%", { 10, 11 } },
+
+        { "^", { 12, 12 } },
+    };
+
+    const auto &t = peek();
+
+    if (t.type != Token::Operator && t.type != Token::Symbol)
+        return false;
+
+    auto it = Levels.find(t.type == Token::Symbol ? to_lower(t.text) : t.text);
+
+    if (it == Levels.end())
+        return false;
+
+    op.op = it->first;
+    op.left = it->second.first;
+    op.right = it->second.second;
+    return true;
+}
+
+Value Translator::parseExpression(int precedence)
+{
+    auto lhs = parseBranch(precedence);
+
+    BinaryOperator op;
+
+    while (peekBinaryOperator(op))
+    {
+        if (op.left < precedence)
+            break;
+
+        if (op.op == "in" || op.op == "like" || op.op == "ilike")
+            unsupported("string operator '" + op.op + "'");
+
+        if (op.op == "<=>")
+            unsupported("swap operator");
+
+        next();
+
+        auto rhs = parseExpression(op.right);
+        lhs = combine(op, lhs, rhs);
+
+        if (precedence == 0 && peekOp("?"))
+            lhs = parseTernary(lhs);
+    }
+
+    return lhs;
+}
+
+Value Translator::parseBranch(int precedence)
+{
+    Value result;
+    const auto &t = peek();
+
+    if (t.type == Token::Number)
+    {
+        double value = 0.0;
+
+        if (!a2_exprtk::string_to_real(t.text, value))
+            syntaxError("invalid number");
+
+        next();
+        result = Value::scalar(double_literal(value));
+    }
+    else if (t.type == Token::Symbol)
+    {
+        result = parseSymbol();
+    }
+    else if (peekOp("(") || peekOp("[") || peekOp("{"))
+    {
+        const char *close = peekOp("(") ? ")" : (peekOp("[") ? "]" : "}");
+        next();
+        result = parseExpression();
+        expectOp(close);
+        result.isLValue = false;
+    }
+    else if (acceptOp("-"))
+    {
+        result = Value::scalar("(-" + scalar(parseExpression(11)) + ")");
+    }
+    else if (acceptOp("+"))
+    {
+        result = Value::scalar(scalar(parseExpression(13)));
+    }
+    else
+    {
+        syntaxError("unexpected token");
+    }
+
+    if (precedence == 0 && peekOp("?"))
+        result = parseTernary(result);
+
+    return result;
+}
+
+Value Translator::parseTernary(const Value &condition)
+{
+    expectOp("?");
+    auto consequent = scalar(parseExpression());
+    expectOp(":");
+    auto alternative = scalar(parseExpression());
+
+    return Value::scalar("(" + truth(scalar(condition)) + " ? "
+                         + consequent + " : " + alternative + ")");
+}
+
+Value Translator::parseSymbol()
+{
+    static const char *const UnsupportedKeywords[] =
+    {
+        "if", "for", "while", "var", "else", "break", "continue", "return",
+        "switch", "case", "default", "repeat", "until", "null", "swap",
+    };
+
+    const auto name = next().text;
+    const auto lname = to_lower(name);
+
+    if (lname == "true")
+        return Value::scalar("1.0");
+
+    if (lname == "false")
+        return Value::scalar("0.0");
+
+    for (auto keyword: UnsupportedKeywords)
+    {
+        if (lname == keyword)
+            unsupported("'" + lname + "' in expression context");
+    }
+
+    if (auto local = findLocal(name))
+        return Value::scalar(*local, true);
+
+    if (peekOp("("))
+        return parseCall(lname);
+
+    auto vec = m_symtab.getVector(name);
+
+    if (vec.first)
+    {
+        const size_t slot = vectorSlot(vec.first, vec.second);
+
+        if (acceptOp("["))
+        {
+            if (acceptOp("]"))
+                return Value::scalar("static_cast<double>(" + sizeName(slot) + ")");
+
+            auto index = scalar(parseExpression());
+            expectOp("]");
+
+            return Value::scalar(
+                "a2cg_at(" + vecName(slot) + ", " + sizeName(slot) + ", " + index + ", oob)",
+                true);
+        }
+
+        Value result;
+        result.kind = Value::Vector;
+        result.vectorSlot = slot;
+        result.isLValue = true;
+        return result;
+    }
+
+    if (auto ptr = m_symtab.getScalar(name))
+        return Value::scalar("(*s" + std::to_string(scalarSlot(ptr)) + ")", true);
+
+    if (m_symtab.getString(name))
+        unsupported("string variable '" + name + "'");
+
+    // Global constants registered by a2_exprtk::Expression::compile().
+    static a2_exprtk::SymbolTable constants = []
+    {
+        a2_exprtk::SymbolTable result;
+        result.addConstants();
+        return result;
+    }();
+
+    if (auto ptr = constants.getScalar(name))
+        return Value::scalar(double_literal(*ptr));
+
+    // Zero argument functions may be called without parentheses.
+    if (lname == "make_invalid")
+        return parseCall(lname);
+
+    throw CodegenError("unknown symbol '" + name + "'");
+}
+
+Value Translator::parseCall(const std::string &name)
+{
+    std::vector<std::string> args;
+
+    if (acceptOp("("))
+    {
+        if (!peekOp(")"))
+        {
+            do
+            {
+                auto arg = parseExpression();
+
+                if (arg.kind != Value::Scalar)
+                    unsupported("vector argument to '" + name + "'");
+
+                args.emplace_back(arg.code);
+            } while (acceptOp(","));
+        }
+
+        expectOp(")");
+    }
+
+    static const char *const StdFunctions[] =
+    {
+        "sqrt", "exp", "log", "log10", "log2", "sin", "cos", "tan", "asin",
+        "acos", "atan", "sinh", "cosh", "tanh", "floor", "ceil", "erf", "erfc",
+    };
+
+    static const std::map<std::string, std::pair<const char *, size_t>> Functions =
+    {
+        { "abs",            { "a2cg_abs", 1 } },
+        { "round",          { "a2cg_round", 1 } },
+        { "trunc",          { "a2cg_trunc", 1 } },
+        { "frac",           { "a2cg_frac", 1 } },
+        { "sgn",            { "a2cg_sgn", 1 } },
+        { "not",            { "a2cg_not", 1 } },
+        { "pow",            { "std::pow", 2 } },
+        { "atan2",          { "std::atan2", 2 } },
+        { "hypot",          { "a2cg_hypot", 2 } },
+        { "clamp",          { "a2cg_clamp", 3 } },
+        { "inrange",        { "a2cg_inrange", 3 } },
+        // Runtime library, see make_expression_operator_runtime_library().
+        { "is_valid",       { "a2cg_is_valid", 1 } },
+        { "is_invalid",     { "a2cg_is_invalid", 1 } },
+        { "make_invalid",   { "a2cg_make_invalid", 0 } },
+        { "is_nan",         { "a2cg_is_nan", 1 } },
+        { "valid_or",       { "a2cg_valid_or", 2 } },
+    };
+
+    auto join = [] (const std::vector<std::string> &parts)
+    {
+        std::string result;
+        for (size_t i = 0; i < parts.size(); ++i)
+            result += (i ? ", " : "") + parts[i];
+        return result;
+    };
+
+    for (auto fn: StdFunctions)
+    {
+        if (name == fn)
+        {
+            if (args.size() != 1)
+                syntaxError("wrong number of arguments to '" + name + "'");
+            return Value::scalar("std::" + name + "(" + args[0] + ")");
+        }
+    }
+
+    auto it = Functions.find(name);
+
+    if (it != Functions.end())
+    {
+        if (args.size() != it->second.second)
+            syntaxError("wrong number of arguments to '" + name + "'");
+        return Value::scalar(std::string(it->second.first) + "(" + join(args) + ")");
+    }
+
+    if (name == "min" || name == "max")
+    {
+        // Same grouping as exprtk::details::vararg_min_op/vararg_max_op. This
+        // matters for the handling of NaN arguments.
+        const std::string fn = "a2cg_" + name;
+        auto f = [&fn] (const std::string &a, const std::string &b)
+        {
+            return fn + "(" + a + ", " + b + ")";
+        };
+
+        switch (args.size())
+        {
+            case 0: syntaxError("wrong number of arguments to '" + name + "'");
+            case 1: return Value::scalar(args[0]);
+            case 2: return Value::scalar(f(args[0], args[1]));
+            case 3: return Value::scalar(f(f(args[0], args[1]), args[2]));
+            case 4: return Value::scalar(f(f(args[0], args[1]), f(args[2], args[3])));
+            case 5: return Value::scalar(f(f(f(args[0], args[1]), f(args[2], args[3])), args[4]));
+            default:
+            {
+                auto result = args[0];
+                for (size_t i = 1; i < args.size(); ++i)
+                    result = f(result, args[i]);
+                return Value::scalar(result);
+            }
+        }
+    }
+
+    unsupported("function '" + name + "'");
+}
+
+Value Translator::combine(const BinaryOperator &op, const Value &lhs, const Value &rhs)
+{
+    const auto &o = op.op;
+
+    if (op.left == 0) // assignments
+    {
+        if (!lhs.isLValue)
+            syntaxError("assignment to non-variable");
+
+        if (lhs.kind == Value::Vector)
+        {
+            if (o != ":=")
+                unsupported("vector compound assignment");
+
+            const auto dst = lhs.vectorSlot;
+
+            if (rhs.kind == Value::Vector)
+            {
+                // exprtk shrinks both vectors to the smaller size if the sizes
+                // differ.
+                if (m_result.sizes[dst] != m_result.sizes[rhs.vectorSlot])
+                    unsupported("assignment between vectors of different sizes");
+
+                return Value::scalar("a2cg_vec_assign(" + vecName(dst) + ", "
+                                     + vecName(rhs.vectorSlot) + ", " + sizeName(dst) + ")");
+            }
+
+            return Value::scalar("a2cg_vec_fill(" + vecName(dst) + ", " + sizeName(dst)
+                                 + ", " + rhs.code + ")");
+        }
+
+        if (o == ":=")
+            return Value::scalar("(" + lhs.code + " = " + scalar(rhs) + ")");
+
+        if (o == "%=")
+            return Value::scalar("a2cg_modass(" + lhs.code + ", " + scalar(rhs) + ")");
+
+        return Value::scalar("(" + lhs.code + " " + o + " " + scalar(rhs) + ")");
+    }
+
+    const auto a = scalar(lhs);
+    const auto b = scalar(rhs);
+
+    if (o == "+" || o == "-" || o == "*" || o == "/")
+        return Value::scalar("(" + a + " " + o + " " + b + ")");
+
+    if (o == "%")
+        return Value::scalar("std::fmod(" + a + ", " + b + ")");
+
+    if (o == "^")
+        return Value::scalar("std::pow(" + a + ", " + b + ")");
+
+    if (o == "<" || o == "<=" || o == ">" || o == ">=" || o == "==" || o == "!=")
+        return Value::scalar("(" + a + " " + o + " " + b + " ? 1.0 : 0.0)");
+
+    if (o == "=")
+        return Value::scalar("(" + a + " == " + b + " ? 1.0 : 0.0)");
+
+    if (o == "<>")
+        return Value::scalar("(" + a + " != " + b + " ? 1.0 : 0.0)");
+
+    // Short-circuiting logic operators.
+    if (o == "&")
+        return Value::scalar("(" + truth(a) + " && " + truth(b) + " ? 1.0 : 0.0)");
+
+    if (o == "|")
+        return Value::scalar("(" + truth(a) + " || " + truth(b) + " ? 1.0 : 0.0)");
+
+    // and, or, nand, nor, xor, xnor evaluate both operands.
+    return Value::scalar("a2cg_" + o + "_(" + a + ", " + b + ")");
+}
+
+// Helpers used by the generated code. Semantics follow the exprtk
+// implementation of the respective operators and functions.
+const char *const Prelude = R"~(#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+
+inline double a2cg_make_invalid()
+{
+    double result = std::numeric_limits<double>::quiet_NaN();
+    const std::uint32_t payload = a2cg_invalid_bit;
+    std::memcpy(&result, &payload, sizeof(payload));
+    return result;
+}
+
+inline double a2cg_is_valid(double p)
+{
+    std::uint32_t payload;
+    std::memcpy(&payload, &p, sizeof(payload));
+    return (std::isnan(p) && (payload & a2cg_invalid_bit)) ? 0.0 : 1.0;
+}
+
+inline double a2cg_is_invalid(double p) { return 1.0 - a2cg_is_valid(p); }
+inline double a2cg_is_nan(double d) { return std::isnan(d) ? 1.0 : 0.0; }
+inline double a2cg_valid_or(double p, double d) { return a2cg_is_valid(p) != 0.0 ? p : d; }
+
+inline double a2cg_abs(double v) { return v < 0.0 ? -v : v; }
+inline double a2cg_round(double v) { return v < 0.0 ? std::ceil(v - 0.5) : std::floor(v + 0.5); }
+inline double a2cg_trunc(double v) { return static_cast<double>(static_cast<long long>(v)); }
+inline double a2cg_frac(double v) { return v - static_cast<long long>(v); }
+inline double a2cg_sgn(double v) { return v > 0.0 ? 1.0 : (v < 0.0 ? -1.0 : 0.0); }
+inline double a2cg_not(double v) { return v != 0.0 ? 0.0 : 1.0; }
+inline double a2cg_hypot(double a, double b) { return std::sqrt((a * a) + (b * b)); }
+inline double a2cg_min(double a, double b) { return std::min(a, b); }
+inline double a2cg_max(double a, double b) { return std::max(a, b); }
+inline double a2cg_clamp(double l, double v, double u) { return v < l ? l : (v > u ? u : v); }
+inline double a2cg_inrange(double l, double v, double u) { return v < l ? 0.0 : (v > u ? 0.0 : 1.0); }
+
+inline double a2cg_and_(double a, double b) { return (a != 0.0 && b != 0.0) ? 1.0 : 0.0; }
+inline double a2cg_nand_(double a, double b) { return (a != 0.0 && b != 0.0) ? 0.0 : 1.0; }
+inline double a2cg_or_(double a, double b) { return (a != 0.0 || b != 0.0) ? 1.0 : 0.0; }
+inline double a2cg_nor_(double a, double b) { return (a != 0.0 || b != 0.0) ? 0.0 : 1.0; }
+inline double a2cg_xor_(double a, double b) { return ((a != 0.0) != (b != 0.0)) ? 1.0 : 0.0; }
+inline double a2cg_xnor_(double a, double b) { return ((a != 0.0) != (b != 0.0)) ? 0.0 : 1.0; }
+
+inline double a2cg_modass(double &l, double r) { l = std::fmod(l, r); return l; }
+
+// Out of range accesses read NaN and write to a scratch location.
+inline double &a2cg_at(double *v, std::size_t n, double i, double &oob)
+{
+    if (i > -1.0 && i < static_cast<double>(n))
+        return v[static_cast<std::size_t>(i)];
+    oob = std::numeric_limits<double>::quiet_NaN();
+    return oob;
+}
+
+inline double a2cg_vec_assign(double *dst, const double *src, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        dst[i] = src[i];
+    return dst[0];
+}
+
+inline double a2cg_vec_fill(double *dst, std::size_t n, double value)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        dst[i] = value;
+    return dst[0];
+}
+
+} // end anon namespace
+)~";
+
+Translation Translator::run()
+{
+    pushScope();
+    auto statements = parseStatementList();
+
+    if (peek().type != Token::End)
+        syntaxError("unexpected token");
+
+    popScope();
+
+    std::string body;
+
+    for (size_t i = 0; i < statements.size(); ++i)
+    {
+        const auto &stmt = statements[i];
+
+        if (i == statements.size() - 1 && stmt.isExpression)
+        {
+            body += "return " + stmt.expression + ";\n";
+            m_result.hasResult = true;
+        }
+        else
+            body += stmt.code + "\n";
+    }
+
+    if (!m_result.hasResult)
+        body += "return 0.0;\n";
+
+    std::string &src = m_result.source;
+
+    src = "// Generated by mvme from an analysis expression. Do not edit.\n";
+    src += "static const unsigned a2cg_invalid_bit = " + std::to_string(ParamInvalidBit) + "u;\n";
+    src += Prelude;
+    src += "\nextern \"C\" double a2_codegen_expr(double *const *s_, double *const *v_, const std::size_t *n_)\n{\n";
+
+    for (size_t i = 0; i < m_result.scalars.size(); ++i)
+        src += "double *const s" + std::to_string(i) + " = s_[" + std::to_string(i) + "];\n";
+
+    for (size_t i = 0; i < m_result.vectors.size(); ++i)
+    {
+        src += "double *const " + vecName(i) + " = v_[" + std::to_string(i) + "];\n";
+        src += "const std::size_t " + sizeName(i) + " = n_[" + std::to_string(i) + "];\n";
+    }
+
+    src += "double oob = 0.0;\n";
+    src += "(void) s_; (void) v_; (void) n_; (void) oob;\n";
+    src += body;
+    src += "}\n";
+
+    return m_result;
+}
+
+//
+// Compilation and loading
+//
+
+std::mutex g_mutex;
+std::unique_ptr<Options> g_options;
+// Loaded functions by source hash. The shared objects are never unloaded as
+// the functions may be referenced by other A2 instances.
+std::map<uint64_t, NativeFunction> g_loaded;
+
+uint64_t fnv1a_64(const std::string &str)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (unsigned char c: str)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+#ifndef _WIN32
+std::string shell_quote(const std::string &str)
+{
+    std::string result = "'";
+
+    for (char c: str)
+    {
+        if (c == '\'')
+            result += "'\\''";
+        else
+            result += c;
+    }
+
+    return result + "'";
+}
+
+// Creates the cache directory if needed and makes sure it is private to the
+// current user as the shared objects in it are loaded into the process.
+void ensure_cache_dir(const std::string &path)
+{
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+    {
+        auto dir = path.substr(0, pos);
+
+        if (!dir.empty() && mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+            throw CodegenError("could not create cache directory " + dir);
+
+        if (pos == std::string::npos)
+            break;
+    }
+
+    struct stat st = {};
+
+    if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        throw CodegenError("cache directory " + path + " is not a directory");
+
+    if (st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+        throw CodegenError("cache directory " + path + " is writable by other users");
+}
+
+NativeFunction load_function(const std::string &source)
+{
+    std::lock_guard<std::mutex> guard(g_mutex);
+
+    if (!g_options)
+        g_options = std::make_unique<Options>(default_options());
+
+    const auto &opts = *g_options;
+    const std::string command = opts.compiler + " " + opts.flags;
+    const uint64_t hash = fnv1a_64(source + "\n" + command);
+
+    if (auto it = g_loaded.find(hash); it != g_loaded.end())
+        return it->second;
+
+    ensure_cache_dir(opts.cacheDir);
+
+    char hashString[32];
+    std::snprintf(hashString, sizeof(hashString), "%016" PRIx64, hash);
+
+    const std::string basePath = opts.cacheDir + "/a2expr_" + hashString;
+    const std::string soPath = basePath + ".so";
+
+    if (access(soPath.c_str(), R_OK) != 0)
+    {
+        const std::string srcPath = basePath + ".cc";
+        const std::string logPath = basePath + ".log";
+        const std::string tmpPath = basePath + "." + std::to_string(getpid()) + ".tmp.so";
+
+        {
+            std::ofstream out(srcPath, std::ios::out | std::ios::trunc);
+            out << source;
+
+            if (!out)
+                throw CodegenError("could not write " + srcPath);
+        }
+
+        const std::string cmd = command + " -o " + shell_quote(tmpPath) + " " + shell_quote(srcPath)
+            + " > " + shell_quote(logPath) + " 2>&1";
+
+        if (std::system(cmd.c_str()) != 0)
+        {
+            std::remove(tmpPath.c_str());
+            throw CodegenError("compilation failed, see " + logPath);
+        }
+
+        // Atomically publish the result so that concurrent processes never
+        // load partially written files.
+        if (std::rename(tmpPath.c_str(), soPath.c_str()) != 0)
+        {
+            std::remove(tmpPath.c_str());
+            throw CodegenError("could not rename " + tmpPath);
+        }
+    }
+
+    void *handle = dlopen(soPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (!handle)
+    {
+        const char *err = dlerror();
+        throw CodegenError(std::string("dlopen failed: ") + (err ? err : soPath));
+    }
+
+    auto fn = reinterpret_cast<NativeFunction>(dlsym(handle, "a2_codegen_expr"));
+
+    if (!fn)
+    {
+        dlclose(handle);
+        throw CodegenError("a2_codegen_expr not found in " + soPath);
+    }
+
+    g_loaded[hash] = fn;
+
+    return fn;
+}
+#endif // !_WIN32
+
+} // end anon namespace
+
+Options default_options()
+{
+    Options result;
+
+    const char *cxx = std::getenv("CXX");
+    result.compiler = (cxx && *cxx) ? cxx : "c++";
+
+    // -ffp-contract=off: no fused multiply-add, exprtk does not use it either.
+    result.flags = "-std=c++17 -O2 -ffp-contract=off -fPIC -shared";
+
+    const char *tmpDir = std::getenv("TMPDIR");
+    result.cacheDir = std::string((tmpDir && *tmpDir) ? tmpDir : "/tmp") + "/mvme-expr-codegen";
+
+#ifndef _WIN32
+    result.cacheDir += "-" + std::to_string(getuid());
+#endif
+
+    return result;
+}
+
+Options get_options()
+{
+    std::lock_guard<std::mutex> guard(g_mutex);
+    return g_options ? *g_options : default_options();
+}
+
+void set_options(const Options &options)
+{
+    std::lock_guard<std::mutex> guard(g_mutex);
+    g_options = std::make_unique<Options>(options);
+}
+
+bool is_supported()
+{
+#ifdef _WIN32
+    return false;
+#else
+    return true;
+#endif
+}
+
+Translation translate(const std::string &expr, a2_exprtk::SymbolTable &symtab)
+{
+    return Translator(expr, symtab).run();
+}
+
+NativeExpression build(const std::string &expr, a2_exprtk::SymbolTable &symtab,
+                       bool requireResult)
+{
+    if (!is_supported())
+        throw CodegenError("native expressions are not supported on this platform");
+
+    auto translation = translate(expr, symtab);
+
+    if (requireResult && !translation.hasResult)
+        throw CodegenError("expression does not end in an expression statement");
+
+    NativeExpression result;
+
+#ifndef _WIN32
+    result.function = load_function(translation.source);
+#endif
+    result.scalars = std::move(translation.scalars);
+    result.vectors = std::move(translation.vectors);
+    result.sizes = std::move(translation.sizes);
+
+    return result;
+}
+
+} // namespace expr_codegen
+} // namespace a2
@@ -0,0 +1,126 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __A2_EXPR_CODEGEN_H__
+#define __A2_EXPR_CODEGEN_H__
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "a2_exprtk.h"
+
+namespace a2
+{
+namespace expr_codegen
+{
+
+/* Native code generation for exprtk expressions.
+ *
+ * A subset of the exprtk language is translated to C++, compiled into a shared
+ * object using the host compiler and loaded via dlopen(). Shared objects are
+ * cached in a directory using a hash of the generated source and the compiler
+ * command as the filename, so each distinct expression is only compiled once.
+ *
+ * Supported: scalar arithmetic, comparison and logic operators, the ternary
+ * operator, local 'var' definitions, if/else, for and while loops including
+ * break and continue, vector element access and size queries, whole vector
+ * assignments between equally sized vectors, the common math functions and the
+ * analysis runtime library (is_valid(), valid_or(), ...).
+ *
+ * Anything else (strings, vector arithmetic, local arrays, switch, return,
+ * ...) makes translate() throw a CodegenError. Callers are expected to keep
+ * using the exprtk expression in this case.
+ *
+ * Symbols are resolved through the SymbolTable of the expression at
+ * translation time. The generated function accesses the variables through
+ * pointer tables, so the symbols may not be re-registered afterwards. */
+
+struct CodegenError: public std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+using NativeFunction = double (*)(double *const *scalars, double *const *vectors,
+                                  const size_t *sizes);
+
+struct Options
+{
+    // Compiler executable. Defaults to the CXX environment variable or "c++".
+    std::string compiler;
+    // Flags passed to the compiler in addition to the source and output files.
+    std::string flags;
+    // Directory holding the generated sources and the compiled shared objects.
+    std::string cacheDir;
+};
+
+Options default_options();
+Options get_options();
+void set_options(const Options &options);
+
+/* Returns false if native code generation is not supported on this platform
+ * (currently windows). */
+bool is_supported();
+
+struct Translation
+{
+    std::string source;
+    std::vector<double *> scalars;
+    std::vector<double *> vectors;
+    std::vector<size_t> sizes;
+    // True if the last top-level statement is an expression. Its value is
+    // returned by the generated function.
+    bool hasResult = false;
+};
+
+/* Translates the expression to C++ source code. Throws CodegenError if the
+ * expression contains unsupported constructs or unknown symbols. The
+ * expression is expected to have been successfully compiled by exprtk. */
+Translation translate(const std::string &expr, a2_exprtk::SymbolTable &symtab);
+
+/* A loaded native expression together with the variable tables it operates
+ * on. */
+struct NativeExpression
+{
+    NativeFunction function = nullptr;
+    std::vector<double *> scalars;
+    std::vector<double *> vectors;
+    std::vector<size_t> sizes;
+
+    explicit operator bool() const { return function != nullptr; }
+
+    double eval() const
+    {
+        return function(scalars.data(), vectors.data(), sizes.data());
+    }
+};
+
+/* Translates, compiles and loads the expression. If requireResult is true the
+ * expression must end in an expression statement, e.g. for conditions.
+ * Compilation is skipped if the shared object exists in the cache directory.
+ * Throws CodegenError on failure. Thread-safe. */
+NativeExpression build(const std::string &expr, a2_exprtk::SymbolTable &symtab,
+                       bool requireResult = false);
+
+} // namespace expr_codegen
+} // namespace a2
+
+#endif /* __A2_EXPR_CODEGEN_H__ */
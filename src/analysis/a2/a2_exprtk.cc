@@ -612,5 +612,10 @@ bool FunctionCompositor::addFunction(const std::string &name, const std::string
     return result;
 }
 
+bool string_to_real(const std::string &str, double &dest)
+{
+    return exprtk::details::string_to_real(str, dest);
+}
+
 } // namespace a2_exprtk
 } // namespace a2
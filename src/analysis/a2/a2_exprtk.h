@@ -231,6 +231,10 @@ class FunctionCompositor
         std::unique_ptr<Private> m_d;
 };
 
+/* Converts a numeric literal to double in the same way the exprtk parser does.
+ * Returns false if the string is not a valid number. */
+bool string_to_real(const std::string &str, double &dest);
+
 } // namespace a2_exprtk
 } // namespace a2
 
@@ -86,6 +86,7 @@ enum OperatorType
     Operator_RateMonitor_FlowRate,
 
     Operator_WaveformSink,
+    Operator_WaveformFeatures,
 
     Operator_ExportSinkFull,
     Operator_ExportSinkSparse,
@@ -121,6 +122,9 @@ enum OperatorType
     OperatorTypeCount
 };
 
+// Name of the operator type for diagnostics, e.g. "H1DSink_idx".
+const char *operator_type_name(u8 type);
+
 void calibration_step(Operator *op, A2 *a2 = nullptr);
 void calibration_sse_step(Operator *op, A2 *a2 = nullptr);
 void calibration_step_idx(Operator *op, A2 *a2 = nullptr);
@@ -130,7 +134,11 @@ void array_map_step(Operator *op, A2 *a2 = nullptr);
 void binary_equation_step(Operator *op, A2 *a2 = nullptr);
 void aggregate_sum_step(Operator *op, A2 *a2 = nullptr);
 void aggregate_multiplicity_step(Operator *op, A2 *a2 = nullptr);
+void aggregate_min_step(Operator *op, A2 *a2 = nullptr);
 void aggregate_max_step(Operator *op, A2 *a2 = nullptr);
+void aggregate_mean_step(Operator *op, A2 *a2 = nullptr);
+void aggregate_sigma_step(Operator *op, A2 *a2 = nullptr);
+void range_filter_step(Operator *op, A2 *a2 = nullptr);
 
 void h1d_sink_step(Operator *op, A2 *a2 = nullptr);
 void h1d_sink_step_idx(Operator *op, A2 *a2 = nullptr);
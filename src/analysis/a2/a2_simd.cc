@@ -0,0 +1,153 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "a2_simd.h"
+#include "a2_simd_kernels.h"
+
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define A2_SIMD_X86
+#endif
+
+namespace a2
+{
+namespace simd
+{
+
+const KernelTable *get_kernel_table_scalar()
+{
+    static const KernelTable table = make_kernel_table<ScalarTraits>(InstructionSet::Scalar);
+    return &table;
+}
+
+namespace
+{
+
+bool cpu_supports(InstructionSet is)
+{
+    switch (is)
+    {
+        case InstructionSet::Scalar:
+            return true;
+
+#ifdef A2_SIMD_X86
+        case InstructionSet::SSE42:
+            return __builtin_cpu_supports("sse4.2");
+
+        case InstructionSet::AVX2:
+            return __builtin_cpu_supports("avx2");
+
+        case InstructionSet::AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+
+        default:
+            break;
+    }
+
+    return false;
+}
+
+const KernelTable *get_compiled_kernel_table(InstructionSet is)
+{
+    switch (is)
+    {
+        case InstructionSet::Scalar: return get_kernel_table_scalar();
+        case InstructionSet::SSE42:  return get_kernel_table_sse42();
+        case InstructionSet::AVX2:   return get_kernel_table_avx2();
+        case InstructionSet::AVX512: return get_kernel_table_avx512();
+    }
+
+    return nullptr;
+}
+
+std::atomic<const KernelTable *> g_kernels = { nullptr };
+
+} // anonymous namespace
+
+const KernelTable *get_kernel_table(InstructionSet is)
+{
+    if (auto table = get_compiled_kernel_table(is))
+    {
+        if (cpu_supports(is))
+            return table;
+    }
+
+    return nullptr;
+}
+
+InstructionSet detect_instruction_set()
+{
+    for (s32 i = InstructionSetCount - 1; i > 0; i--)
+    {
+        auto is = static_cast<InstructionSet>(i);
+
+        if (get_kernel_table(is))
+            return is;
+    }
+
+    return InstructionSet::Scalar;
+}
+
+const KernelTable &kernels()
+{
+    auto result = g_kernels.load(std::memory_order_acquire);
+
+    if (!result)
+    {
+        result = get_kernel_table(detect_instruction_set());
+        g_kernels.store(result, std::memory_order_release);
+    }
+
+    return *result;
+}
+
+InstructionSet get_instruction_set()
+{
+    return kernels().instructionSet;
+}
+
+bool set_instruction_set(InstructionSet is)
+{
+    if (auto table = get_kernel_table(is))
+    {
+        g_kernels.store(table, std::memory_order_release);
+        return true;
+    }
+
+    return false;
+}
+
+const char *to_string(InstructionSet is)
+{
+    switch (is)
+    {
+        case InstructionSet::Scalar: return "scalar";
+        case InstructionSet::SSE42:  return "sse4.2";
+        case InstructionSet::AVX2:   return "avx2";
+        case InstructionSet::AVX512: return "avx512";
+    }
+
+    return "unknown";
+}
+
+} // namespace simd
+} // namespace a2
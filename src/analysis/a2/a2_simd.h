@@ -0,0 +1,129 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __A2_SIMD_H__
+#define __A2_SIMD_H__
+
+#include "util/typedefs.h"
+
+/* Vectorized kernels used by the calibration, range filter, binary equation
+ * and aggregate operators.
+ *
+ * The kernels are implemented once in a2_simd_kernels.h and instantiated for
+ * each instruction set in its own translation unit which is compiled with the
+ * matching -m flags. The best instruction set supported by both the build and
+ * the cpu is picked at runtime.
+ *
+ * Note: this header is included by the per instruction set translation units.
+ * It must not contain inline functions, otherwise the linker could pick an
+ * AVX compiled copy for code running on a cpu without AVX.
+ */
+
+namespace a2
+{
+namespace simd
+{
+
+enum class InstructionSet: u8
+{
+    Scalar,
+    SSE42,
+    AVX2,
+    AVX512,
+};
+
+static const u8 InstructionSetCount = static_cast<u8>(InstructionSet::AVX512) + 1;
+
+// Number of equations implemented by the binary equation operator.
+static const u32 BinaryEquationCount = 8;
+
+/* Result of an aggregate kernel.
+ * value: the sum, minimum or maximum of the inputs inside the thresholds.
+ * count: the number of valid inputs inside the thresholds. If it is 0 the
+ * caller outputs an invalid parameter instead of value. */
+struct AggregateResult
+{
+    double value;
+    u32 count;
+};
+
+/* Inputs are accepted by the aggregate kernels if they are valid and inside
+ * [min, max]. This is the same as is_valid_and_inside() in a2.cc. The range
+ * filter kernel uses [min, max) like in_range().
+ *
+ * Pointers do not need any particular alignment. Outputs may alias inputs. */
+struct KernelTable
+{
+    InstructionSet instructionSet;
+
+    // out = is_param_valid(in) ? (in - inMin) * factors + outMin : in
+    void (*calibrate)(const double *in, const double *inMin, const double *outMin,
+                      const double *factors, double *out, s32 size);
+
+    // out = (min <= in < max) != invert ? in : invalid_param()
+    void (*range_filter)(const double *in, double *out, s32 size,
+                         double min, double max, bool invert);
+
+    // out = (is_param_valid(a) && is_param_valid(b)) ? f(a, b) : invalid_param()
+    void (*binary_equation[BinaryEquationCount])(
+        const double *a, const double *b, double *out, s32 size);
+
+    AggregateResult (*sum)(const double *in, s32 size, double min, double max);
+
+    // The value starts out as the largest finite double for min and as the
+    // lowest finite double for max.
+    AggregateResult (*min)(const double *in, s32 size, double min, double max);
+    AggregateResult (*max)(const double *in, s32 size, double min, double max);
+
+    // Sum of the squared differences to mean of the accepted inputs.
+    double (*sum_of_squares)(const double *in, s32 size, double min, double max,
+                             double mean);
+};
+
+// Table of the kernels for the currently selected instruction set. The
+// selection is done on first use.
+const KernelTable &kernels();
+
+// Returns the kernels for the given instruction set or nullptr if it was not
+// compiled in or is not supported by the cpu.
+const KernelTable *get_kernel_table(InstructionSet is);
+
+// Best instruction set supported by the build and the cpu.
+InstructionSet detect_instruction_set();
+
+InstructionSet get_instruction_set();
+
+// Overrides the runtime selection. Returns false and leaves the selection
+// unchanged if the instruction set is not available. Meant for tests and
+// benchmarks.
+bool set_instruction_set(InstructionSet is);
+
+const char *to_string(InstructionSet is);
+
+// Per instruction set tables, defined in a2_simd_<isa>.cc.
+const KernelTable *get_kernel_table_scalar();
+const KernelTable *get_kernel_table_sse42();
+const KernelTable *get_kernel_table_avx2();
+const KernelTable *get_kernel_table_avx512();
+
+} // namespace simd
+} // namespace a2
+
+#endif /* __A2_SIMD_H__ */
@@ -18,7 +18,26 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
-#include "timed_block.h"
 
-float gTimedBlockDurations[TimedBlockId_Max];
-u64 gTimedBlockHitCounts[TimedBlockId_Max];
+/* AVX2 kernels. This file is compiled with the matching -m flags if the
+ * target supports them, see CMakeLists.txt. Otherwise no table is provided. */
+
+#include "a2_simd_kernels.h"
+
+namespace a2
+{
+namespace simd
+{
+
+const KernelTable *get_kernel_table_avx2()
+{
+#ifdef __AVX2__
+    static const KernelTable table = make_kernel_table<AVX2Traits>(InstructionSet::AVX2);
+    return &table;
+#else
+    return nullptr;
+#endif
+}
+
+} // namespace simd
+} // namespace a2
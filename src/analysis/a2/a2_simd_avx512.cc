@@ -0,0 +1,50 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* AVX-512F kernels. This file is compiled with the matching -m flags if the
+ * target supports them, see CMakeLists.txt. Otherwise no table is provided. */
+
+// The _mm512_undefined_pd() idiom used inside gcc's avx512fintrin.h triggers
+// false -Wuninitialized warnings at every inlined call site.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include "a2_simd_kernels.h"
+
+namespace a2
+{
+namespace simd
+{
+
+const KernelTable *get_kernel_table_avx512()
+{
+#ifdef __AVX512F__
+    static const KernelTable table = make_kernel_table<AVX512Traits>(InstructionSet::AVX512);
+    return &table;
+#else
+    return nullptr;
+#endif
+}
+
+} // namespace simd
+} // namespace a2
@@ -0,0 +1,513 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __A2_SIMD_KERNELS_H__
+#define __A2_SIMD_KERNELS_H__
+
+/* Implementation of the kernels declared in a2_simd.h.
+ *
+ * Only include this from the a2_simd*.cc files. The kernels are templates
+ * over a traits struct wrapping the intrinsics of one instruction set. Which
+ * traits are available depends on the -m flags the including file is
+ * compiled with. Everything is in an anonymous namespace so that no code
+ * compiled for one instruction set can leak into another translation unit.
+ *
+ * The kernels compute all lanes and then blend the results based on masks
+ * instead of branching per parameter:
+ * - Invalid parameters are NaNs with ParamInvalidBit set in the payload. The
+ *   invalid mask is an unordered compare ANDed with an integer test of the
+ *   payload bit.
+ * - Threshold tests use ordered compares which are false for any NaN. This
+ *   means invalid inputs fail the tests without having to compute the
+ *   invalid mask.
+ * - Elements not divisible by the vector width are handled by the scalar
+ *   traits so that inputs not created by push_param_vector() work, too.
+ * - The AVX kernels clear the upper register state before returning. gcc
+ *   only inserts vzeroupper itself at -O2 and above. Without it the
+ *   following SSE code in a2.cc runs into the AVX-SSE transition penalty.
+ *
+ * The results are bitwise identical to the scalar code except for sum, mean
+ * and sigma where the vector lanes accumulate separately and thus round
+ * differently.
+ */
+
+#include <cfloat>
+#include <cstring>
+
+#include "a2_simd.h"
+
+#if defined(__SSE4_2__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace a2
+{
+namespace simd
+{
+namespace
+{
+
+// Bit pattern of invalid_param(): a quiet NaN with ParamInvalidBit set.
+static const u64 InvalidParamBits = 0x7ff8000000000001ull;
+static const u64 ParamInvalidBitMask = 1u;
+
+inline double invalid_param_value()
+{
+    double result;
+    memcpy(&result, &InvalidParamBits, sizeof(result));
+    return result;
+}
+
+struct ScalarTraits
+{
+    using Vec = double;
+    using Mask = bool;
+    static const s32 Width = 1;
+
+    static Vec load(const double *p) { return *p; }
+    static void store(double *p, Vec v) { *p = v; }
+    static Vec set1(double d) { return d; }
+
+    static Vec add(Vec a, Vec b) { return a + b; }
+    static Vec sub(Vec a, Vec b) { return a - b; }
+    static Vec mul(Vec a, Vec b) { return a * b; }
+    static Vec div(Vec a, Vec b) { return a / b; }
+    // Same argument order and results as std::min/std::max.
+    static Vec min(Vec a, Vec b) { return (b < a) ? b : a; }
+    static Vec max(Vec a, Vec b) { return (a < b) ? b : a; }
+
+    static Mask cmp_ge(Vec a, Vec b) { return a >= b; }
+    static Mask cmp_le(Vec a, Vec b) { return a <= b; }
+    static Mask cmp_lt(Vec a, Vec b) { return a < b; }
+    static Mask mask_and(Mask a, Mask b) { return a && b; }
+    static Mask mask_or(Mask a, Mask b) { return a || b; }
+
+    static Mask invalid(Vec v)
+    {
+        u64 bits;
+        memcpy(&bits, &v, sizeof(bits));
+        return v != v && (bits & ParamInvalidBitMask);
+    }
+
+    // m ? b : a
+    static Vec blend(Mask m, Vec a, Vec b) { return m ? b : a; }
+    static u32 count(Mask m) { return m; }
+
+    static double reduce_add(Vec v) { return v; }
+    static double reduce_min(Vec v) { return v; }
+    static double reduce_max(Vec v) { return v; }
+
+    static void zero_upper() {}
+};
+
+#ifdef __SSE4_2__
+struct SSE42Traits
+{
+    using Vec = __m128d;
+    using Mask = __m128d;
+    static const s32 Width = 2;
+
+    static Vec load(const double *p) { return _mm_loadu_pd(p); }
+    static void store(double *p, Vec v) { _mm_storeu_pd(p, v); }
+    static Vec set1(double d) { return _mm_set1_pd(d); }
+
+    static Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm_div_pd(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm_min_pd(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm_max_pd(a, b); }
+
+    static Mask cmp_ge(Vec a, Vec b) { return _mm_cmpge_pd(a, b); }
+    static Mask cmp_le(Vec a, Vec b) { return _mm_cmple_pd(a, b); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm_cmplt_pd(a, b); }
+    static Mask mask_and(Mask a, Mask b) { return _mm_and_pd(a, b); }
+    static Mask mask_or(Mask a, Mask b) { return _mm_or_pd(a, b); }
+
+    static Mask invalid(Vec v)
+    {
+        const __m128i bit = _mm_set1_epi64x(ParamInvalidBitMask);
+        __m128i hasBit = _mm_cmpeq_epi64(_mm_and_si128(_mm_castpd_si128(v), bit), bit);
+        return _mm_and_pd(_mm_cmpunord_pd(v, v), _mm_castsi128_pd(hasBit));
+    }
+
+    static Vec blend(Mask m, Vec a, Vec b) { return _mm_blendv_pd(a, b, m); }
+    static u32 count(Mask m) { return __builtin_popcount(_mm_movemask_pd(m)); }
+
+    static double reduce_add(Vec v)
+    {
+        return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+    }
+
+    static double reduce_min(Vec v)
+    {
+        return _mm_cvtsd_f64(_mm_min_sd(v, _mm_unpackhi_pd(v, v)));
+    }
+
+    static double reduce_max(Vec v)
+    {
+        return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v)));
+    }
+
+    static void zero_upper() {}
+};
+#endif // __SSE4_2__
+
+#ifdef __AVX2__
+struct AVX2Traits
+{
+    using Vec = __m256d;
+    using Mask = __m256d;
+    static const s32 Width = 4;
+
+    static Vec load(const double *p) { return _mm256_loadu_pd(p); }
+    static void store(double *p, Vec v) { _mm256_storeu_pd(p, v); }
+    static Vec set1(double d) { return _mm256_set1_pd(d); }
+
+    static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm256_min_pd(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+
+    static Mask cmp_ge(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    static Mask cmp_le(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return _mm256_and_pd(a, b); }
+    static Mask mask_or(Mask a, Mask b) { return _mm256_or_pd(a, b); }
+
+    static Mask invalid(Vec v)
+    {
+        const __m256i bit = _mm256_set1_epi64x(ParamInvalidBitMask);
+        __m256i hasBit = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_castpd_si256(v), bit), bit);
+        return _mm256_and_pd(_mm256_cmp_pd(v, v, _CMP_UNORD_Q), _mm256_castsi256_pd(hasBit));
+    }
+
+    static Vec blend(Mask m, Vec a, Vec b) { return _mm256_blendv_pd(a, b, m); }
+    static u32 count(Mask m) { return __builtin_popcount(_mm256_movemask_pd(m)); }
+
+    static double reduce_add(Vec v)
+    {
+        __m128d r = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(r, _mm_unpackhi_pd(r, r)));
+    }
+
+    static double reduce_min(Vec v)
+    {
+        __m128d r = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_min_sd(r, _mm_unpackhi_pd(r, r)));
+    }
+
+    static double reduce_max(Vec v)
+    {
+        __m128d r = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_max_sd(r, _mm_unpackhi_pd(r, r)));
+    }
+
+    static void zero_upper() { _mm256_zeroupper(); }
+};
+#endif // __AVX2__
+
+#ifdef __AVX512F__
+struct AVX512Traits
+{
+    using Vec = __m512d;
+    using Mask = __mmask8;
+    static const s32 Width = 8;
+
+    static Vec load(const double *p) { return _mm512_loadu_pd(p); }
+    static void store(double *p, Vec v) { _mm512_storeu_pd(p, v); }
+    static Vec set1(double d) { return _mm512_set1_pd(d); }
+
+    static Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm512_div_pd(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm512_min_pd(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm512_max_pd(a, b); }
+
+    static Mask cmp_ge(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+    static Mask cmp_le(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+    static Mask cmp_lt(Vec a, Vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static Mask mask_and(Mask a, Mask b) { return a & b; }
+    static Mask mask_or(Mask a, Mask b) { return a | b; }
+
+    static Mask invalid(Vec v)
+    {
+        Mask hasBit = _mm512_test_epi64_mask(
+            _mm512_castpd_si512(v), _mm512_set1_epi64(ParamInvalidBitMask));
+        return _mm512_cmp_pd_mask(v, v, _CMP_UNORD_Q) & hasBit;
+    }
+
+    static Vec blend(Mask m, Vec a, Vec b) { return _mm512_mask_blend_pd(m, a, b); }
+    static u32 count(Mask m) { return __builtin_popcount(m); }
+
+    static double reduce_add(Vec v) { return _mm512_reduce_add_pd(v); }
+    static double reduce_min(Vec v) { return _mm512_reduce_min_pd(v); }
+    static double reduce_max(Vec v) { return _mm512_reduce_max_pd(v); }
+
+    static void zero_upper() { _mm256_zeroupper(); }
+};
+#endif // __AVX512F__
+
+template<typename T>
+struct Kernels
+{
+    using Vec = typename T::Vec;
+    using Mask = typename T::Mask;
+    using S = ScalarTraits;
+
+    struct ZeroUpperGuard
+    {
+        ~ZeroUpperGuard() { T::zero_upper(); }
+    };
+
+    template<typename V>
+    static typename V::Vec calibrate_one(
+        typename V::Vec p, typename V::Vec inMin, typename V::Vec outMin, typename V::Vec factor)
+    {
+        auto r = V::add(V::mul(V::sub(p, inMin), factor), outMin);
+        return V::blend(V::invalid(p), r, p);
+    }
+
+    static void calibrate(const double *in, const double *inMin, const double *outMin,
+                          const double *factors, double *out, s32 size)
+    {
+        ZeroUpperGuard guard;
+        s32 i = 0;
+
+        for (; i + T::Width <= size; i += T::Width)
+        {
+            T::store(out + i, calibrate_one<T>(
+                    T::load(in + i), T::load(inMin + i),
+                    T::load(outMin + i), T::load(factors + i)));
+        }
+
+        for (; i < size; i++)
+            out[i] = calibrate_one<S>(in[i], inMin[i], outMin[i], factors[i]);
+    }
+
+    template<typename V>
+    static typename V::Vec range_filter_one(
+        typename V::Vec p, typename V::Vec min, typename V::Vec max,
+        typename V::Vec invalid, bool invert)
+    {
+        auto inside = V::mask_and(V::cmp_ge(p, min), V::cmp_lt(p, max));
+        return invert ? V::blend(inside, p, invalid) : V::blend(inside, invalid, p);
+    }
+
+    static void range_filter(const double *in, double *out, s32 size,
+                             double min, double max, bool invert)
+    {
+        ZeroUpperGuard guard;
+        const Vec vmin = T::set1(min);
+        const Vec vmax = T::set1(max);
+        const Vec vinvalid = T::set1(invalid_param_value());
+        s32 i = 0;
+
+        for (; i + T::Width <= size; i += T::Width)
+            T::store(out + i, range_filter_one<T>(T::load(in + i), vmin, vmax, vinvalid, invert));
+
+        for (; i < size; i++)
+            out[i] = range_filter_one<S>(in[i], min, max, invalid_param_value(), invert);
+    }
+
+    template<typename Equation>
+    static void binary_equation(const double *a, const double *b, double *out, s32 size)
+    {
+        ZeroUpperGuard guard;
+        const Vec vinvalid = T::set1(invalid_param_value());
+        s32 i = 0;
+
+        for (; i + T::Width <= size; i += T::Width)
+        {
+            Vec va = T::load(a + i);
+            Vec vb = T::load(b + i);
+            Mask invalid = T::mask_or(T::invalid(va), T::invalid(vb));
+            T::store(out + i, T::blend(invalid, Equation::template apply<T>(va, vb), vinvalid));
+        }
+
+        for (; i < size; i++)
+        {
+            bool invalid = S::invalid(a[i]) || S::invalid(b[i]);
+            out[i] = invalid ? invalid_param_value() : Equation::template apply<S>(a[i], b[i]);
+        }
+    }
+
+    template<typename V>
+    static typename V::Mask accept(typename V::Vec p, typename V::Vec min, typename V::Vec max)
+    {
+        return V::mask_and(V::cmp_ge(p, min), V::cmp_le(p, max));
+    }
+
+    static AggregateResult sum(const double *in, s32 size, double min, double max)
+    {
+        ZeroUpperGuard guard;
+        const Vec vmin = T::set1(min);
+        const Vec vmax = T::set1(max);
+        const Vec zero = T::set1(0.0);
+        Vec acc = zero;
+        AggregateResult result = {};
+        s32 i = 0;
+
+        for (; i + T::Width <= size; i += T::Width)
+        {
+            Vec p = T::load(in + i);
+            Mask m = accept<T>(p, vmin, vmax);
+            acc = T::add(acc, T::blend(m, zero, p));
+            result.count += T::count(m);
+        }
+
+        result.value = T::reduce_add(acc);
+
+        for (; i < size; i++)
+        {
+            if (accept<S>(in[i], min, max))
+            {
+                result.value += in[i];
+                result.count++;
+            }
+        }
+
+        return result;
+    }
+
+    template<bool IsMin>
+    static AggregateResult min_or_max(const double *in, s32 size, double min, double max)
+    {
+        ZeroUpperGuard guard;
+        const double start = IsMin ? DBL_MAX : -DBL_MAX;
+        const Vec vmin = T::set1(min);
+        const Vec vmax = T::set1(max);
+        const Vec vstart = T::set1(start);
+        Vec acc = vstart;
+        AggregateResult result = {};
+        s32 i = 0;
+
+        for (; i + T::Width <= size; i += T::Width)
+        {
+            Vec p = T::load(in + i);
+            Mask m = accept<T>(p, vmin, vmax);
+            p = T::blend(m, vstart, p);
+            acc = IsMin ? T::min(acc, p) : T::max(acc, p);
+            result.count += T::count(m);
+        }
+
+        result.value = IsMin ? T::reduce_min(acc) : T::reduce_max(acc);
+
+        for (; i < size; i++)
+        {
+            if (accept<S>(in[i], min, max))
+            {
+                result.value = IsMin ? S::min(result.value, in[i]) : S::max(result.value, in[i]);
+                result.count++;
+            }
+        }
+
+        return result;
+    }
+
+    static double sum_of_squares(const double *in, s32 size, double min, double max, double mean)
+    {
+        ZeroUpperGuard guard;
+        const Vec vmin = T::set1(min);
+        const Vec vmax = T::set1(max);
+        const Vec vmean = T::set1(mean);
+        const Vec zero = T::set1(0.0);
+        Vec acc = zero;
+        s32 i = 0;
+
+        for (; i + T::Width <= size; i += T::Width)
+        {
+            Vec p = T::load(in + i);
+            Vec d = T::sub(p, vmean);
+            acc = T::add(acc, T::blend(accept<T>(p, vmin, vmax), zero, T::mul(d, d)));
+        }
+
+        double result = T::reduce_add(acc);
+
+        for (; i < size; i++)
+        {
+            if (accept<S>(in[i], min, max))
+            {
+                double d = in[i] - mean;
+                result += d * d;
+            }
+        }
+
+        return result;
+    }
+};
+
+/* The binary equations in the order of their equation index. */
+#define a2_simd_binary_equation(name, expr)\
+struct name\
+{\
+    template<typename V>\
+    static typename V::Vec apply(typename V::Vec a, typename V::Vec b)\
+    {\
+        return expr;\
+    }\
+};
+
+a2_simd_binary_equation(Equation_APlusB,            V::add(a, b))
+a2_simd_binary_equation(Equation_AMinusB,           V::sub(a, b))
+a2_simd_binary_equation(Equation_SumOverDifference, V::div(V::add(a, b), V::sub(a, b)))
+a2_simd_binary_equation(Equation_DifferenceOverSum, V::div(V::sub(a, b), V::add(a, b)))
+a2_simd_binary_equation(Equation_AOverDifference,   V::div(a, V::sub(a, b)))
+a2_simd_binary_equation(Equation_DifferenceOverA,   V::div(V::sub(a, b), a))
+a2_simd_binary_equation(Equation_ATimesB,           V::mul(a, b))
+a2_simd_binary_equation(Equation_AOverB,            V::div(a, b))
+
+#undef a2_simd_binary_equation
+
+template<typename T>
+KernelTable make_kernel_table(InstructionSet is)
+{
+    using K = Kernels<T>;
+
+    KernelTable result = {};
+    result.instructionSet = is;
+    result.calibrate = K::calibrate;
+    result.range_filter = K::range_filter;
+    result.binary_equation[0] = K::template binary_equation<Equation_APlusB>;
+    result.binary_equation[1] = K::template binary_equation<Equation_AMinusB>;
+    result.binary_equation[2] = K::template binary_equation<Equation_SumOverDifference>;
+    result.binary_equation[3] = K::template binary_equation<Equation_DifferenceOverSum>;
+    result.binary_equation[4] = K::template binary_equation<Equation_AOverDifference>;
+    result.binary_equation[5] = K::template binary_equation<Equation_DifferenceOverA>;
+    result.binary_equation[6] = K::template binary_equation<Equation_ATimesB>;
+    result.binary_equation[7] = K::template binary_equation<Equation_AOverB>;
+    result.sum = K::sum;
+    result.min = K::template min_or_max<true>;
+    result.max = K::template min_or_max<false>;
+    result.sum_of_squares = K::sum_of_squares;
+
+    static_assert(BinaryEquationCount == 8, "make_kernel_table() needs to be updated");
+
+    return result;
+}
+
+} // anonymous namespace
+} // namespace simd
+} // namespace a2
+
+#endif /* __A2_SIMD_KERNELS_H__ */
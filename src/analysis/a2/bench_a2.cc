@@ -26,7 +26,9 @@
 #include "util/sizes.h"
 
 #include <benchmark/benchmark.h>
+#include <fstream>
 #include <iostream>
+#include <unistd.h>
 
 using namespace a2;
 using namespace memory;
@@ -146,4 +148,172 @@ static void BM_a2(benchmark::State &state)
 }
 BENCHMARK(BM_a2);
 
+/* Extraction of MDPP-32 SCP style module data using the default filters
+ * (amplitude, channel time, trigger time, module timestamp). The first
+ * argument selects the per-extractor path (0) or the fused extraction
+ * table (1). */
+static void BM_a2_module_extraction(benchmark::State &state)
+{
+    const bool useFused = state.range(0);
+    const int ChannelCount = 32;
+
+    Arena arena(::Kilobytes(256));
+
+    const char *filterStrings[] =
+    {
+        "0001XXXPO00AAAAADDDDDDDDDDDDDDDD", // amplitude
+        "0001XXXPO01AAAAADDDDDDDDDDDDDDDD", // channel time
+        "0001XXXXX100000ADDDDDDDDDDDDDDDD", // trigger time
+        "11DDDDDDDDDDDDDDDDDDDDDDDDDDDDDD", // module timestamp
+    };
+
+    const u8 sourceCount = sizeof(filterStrings) / sizeof(*filterStrings);
+    const int eventIndex = 0;
+    const int moduleIndex = 0;
+
+    auto a2 = make_a2(&arena, { sourceCount }, { 0 });
+
+    for (auto filterString: filterStrings)
+    {
+        MultiWordFilter filter = { make_filter(filterString) };
+        auto ds = make_datasource_extractor(&arena, filter, 1, 1234, moduleIndex);
+        a2->dataSources[eventIndex][a2->dataSourceCounts[eventIndex]++] = ds;
+    }
+
+    if (useFused)
+        a2_build_fused_extractors(a2, &arena);
+
+    // header, amplitudes and times for all channels, two trigger times, end of event
+    std::vector<u32> testdata;
+    testdata.push_back(0x40000000u | (2 * ChannelCount + 2 + 1));
+
+    for (u32 ch = 0; ch < ChannelCount; ch++)
+    {
+        testdata.push_back(0x10000000u | (ch << 16) | (1000 + ch));
+        testdata.push_back(0x10200000u | (ch << 16) | (2000 + ch));
+    }
+
+    testdata.push_back(0x10400000u | 3000);
+    testdata.push_back(0x10410000u | 3001);
+    testdata.push_back(0xc0000000u | 12345);
+
+    const u32 dataSize = testdata.size();
+
+    double bytesProcessed = 0;
+    double moduleCounter = 0;
+
+    while (state.KeepRunning())
+    {
+        a2_begin_event(a2, eventIndex);
+        a2_process_module_data(a2, eventIndex, moduleIndex, testdata.data(), dataSize);
+        benchmark::ClobberMemory();
+        bytesProcessed += dataSize * sizeof(u32);
+        moduleCounter++;
+    }
+
+    state.counters["byteRate"] = Counter(bytesProcessed, Counter::kIsRate);
+    state.counters["mR"] = Counter(moduleCounter, Counter::kIsRate);
+    state.SetLabel(useFused ? "fused" : "per-extractor");
+}
+BENCHMARK(BM_a2_module_extraction)->Arg(0)->Arg(1);
+
+// Resident set size of the process in bytes or 0 if it cannot be determined.
+static size_t current_rss()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0, residentPages = 0;
+
+    if (statm >> totalPages >> residentPages)
+        return residentPages * sysconf(_SC_PAGESIZE);
+
+    return 0;
+}
+
+/* Fills HistoCount 64k bin histograms with uniformly distributed random values
+ * using the fill strategy given as the first argument and the bin storage type
+ * given as the third argument. This is the worst case for HistoFillDirect:
+ * nearly every fill is a cache miss. */
+static void BM_a2_histo_fill(benchmark::State &state)
+{
+    const auto fillType = static_cast<HistoFillStrategyType>(state.range(0));
+    const s32 HistoCount = state.range(1);
+    const auto storageType = static_cast<BinStorageType>(state.range(2));
+    const s32 BinCount = 1 << 16;
+    const s32 InputSets = 1024;
+
+    const size_t rssStart = current_rss();
+    Arena arena(::Megabytes(1));
+
+    auto a2 = make_a2(&arena, { 0 }, { 1 });
+
+    auto input = push_param_vector(&arena, HistoCount);
+    PipeVectors inPipe =
+    {
+        input,
+        push_param_vector(&arena, HistoCount, 0.0),
+        push_param_vector(&arena, HistoCount, BinCount),
+    };
+
+    std::vector<H1D> histos(HistoCount);
+
+    for (auto &histo: histos)
+    {
+        histo = {};
+        histo.storageType = storageType;
+        histo.data = reinterpret_cast<double *>(
+            arena.pushSize(bin_storage_size(storageType, BinCount), alignof(u64)));
+        histo.size = BinCount;
+        clear_bins(histo.data, storageType, BinCount);
+        histo.binning.min = 0.0;
+        histo.binning.range = BinCount;
+        histo.binningFactor = histo.size / histo.binning.range;
+    }
+
+    a2->operators[0][0] = make_h1d_sink(&arena, inPipe, { histos.data(), HistoCount });
+    a2->operatorRanks[0][0] = 1;
+    a2->operatorCounts[0] = 1;
+
+    a2_set_histo_fill_strategy(a2, fillType);
+    a2_begin_run(a2, {});
+
+    // Precalculate input values so that the rng does not show up in the results.
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> dist(0.0, BinCount);
+    std::vector<double> inputValues(InputSets * HistoCount);
+
+    for (auto &value: inputValues)
+        value = dist(rng);
+
+    double eventCounter = 0;
+    size_t inputSet = 0;
+
+    while (state.KeepRunning())
+    {
+        std::copy_n(inputValues.data() + inputSet * HistoCount, HistoCount, input.data);
+        inputSet = (inputSet + 1) % InputSets;
+
+        a2_end_event(a2, 0);
+        eventCounter++;
+    }
+
+    a2_end_run(a2);
+
+    state.counters["eR"] = Counter(eventCounter, Counter::kIsRate);
+    state.counters["fillR"] = Counter(eventCounter * HistoCount, Counter::kIsRate);
+    state.counters["mem"] = Counter(arena.used());
+    state.counters["histoMem"] = Counter(HistoCount * bin_storage_size(storageType, BinCount));
+    const size_t rssEnd = current_rss();
+    state.counters["rss"] = Counter(rssEnd > rssStart ? rssEnd - rssStart : 0);
+    state.SetLabel(std::string(a2->histoFillStrategy.name()) + "/" + to_string(storageType));
+}
+BENCHMARK(BM_a2_histo_fill)
+    ->ArgsProduct({
+        { static_cast<int>(HistoFillStrategyType::Direct),
+          static_cast<int>(HistoFillStrategyType::Buffered) },
+        { 16, 128, 512 },
+        { static_cast<int>(BinStorageType::Double),
+          static_cast<int>(BinStorageType::U32),
+          static_cast<int>(BinStorageType::U64) }})
+    ->Unit(benchmark::kMicrosecond);
+
 BENCHMARK_MAIN();
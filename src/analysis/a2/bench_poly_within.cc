@@ -18,6 +18,7 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
+#include <algorithm>
 #include <benchmark/benchmark.h>
 #include <iostream>
 
@@ -31,6 +32,8 @@
 #include <boost/geometry/geometries/point_xy.hpp>
 #undef BOOST_ALLOW_DEPRECATED_HEADERS
 
+#include "polygon_raster.h"
+
 namespace bg = boost::geometry;
 using Point   = bg::model::d2::point_xy<double>;
 // template parameters: point type, clockwise, closed
@@ -361,4 +364,68 @@ static void BM_pip_test_with_correction(benchmark::State &state)
 }
 BENCHMARK(BM_pip_test_with_correction)->DenseRange(0, Benchmarks.size() - 1);
 
+/* Arg(0) is the index of the benchmark data to use in the Benchmarks vector.
+ * Arg(1) is the raster cell width. 0 selects the default number of cells.
+ * Uses the precompiled a2::PolygonRaster with boost::geometry::within() as the
+ * exact test for edge cells. */
+static void BM_pip_test_raster(benchmark::State &state)
+{
+    const size_t dataIndex = static_cast<size_t>(state.range(0));
+    const double cellWidth = static_cast<double>(state.range(1));
+    assert(dataIndex < Benchmarks.size());
+
+    const auto &benchData = Benchmarks[dataIndex];
+
+    // read input data
+    Polygon polygon;
+    std::vector<PointAndResult> pars;
+
+    bg::read_wkt(benchData.polygon, polygon);
+
+    for (const auto &ipar: benchData.pointsAndResults)
+    {
+        Point p;
+        bg::read_wkt(ipar.point, p);
+        pars.push_back({p, ipar.result});
+    }
+
+    std::vector<std::pair<double, double>> outline;
+
+    for (const auto &p: polygon.outer())
+        outline.push_back({ p.x(), p.y() });
+
+    auto exactTest = [&polygon] (double x, double y)
+    {
+        return bg::within(Point{x, y}, polygon);
+    };
+
+    auto raster = a2::make_polygon_raster(outline, cellWidth, cellWidth, exactTest);
+
+    // run the Point in Polygon tests
+    size_t pipCount = 0;
+
+    for (auto _: state)
+    {
+        for (const auto &par: pars)
+        {
+            bool is_within = a2::polygon_raster_within(
+                raster, par.point.x(), par.point.y(), exactTest);
+            benchmark::DoNotOptimize(is_within);
+            assert(is_within == par.result);
+            pipCount++;
+        }
+    }
+
+    size_t edgeCells = std::count(raster.cells.begin(), raster.cells.end(),
+                                  a2::PolygonRaster::Edge);
+
+    state.counters["PiP_count"] = Counter(pipCount);
+    state.counters["Pip_rate"]  = Counter(pipCount, Counter::kIsRate);
+    state.counters["poly_outer_points"] = polygon.outer().size();
+    state.counters["raster_cells"] = raster.cells.size();
+    state.counters["raster_edge_cells"] = edgeCells;
+}
+BENCHMARK(BM_pip_test_raster)->ArgsProduct({
+    benchmark::CreateDenseRange(0, Benchmarks.size() - 1, 1), { 0, 1 }});
+
 BENCHMARK_MAIN();
@@ -0,0 +1,246 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __A2_HISTO_STORAGE_H__
+#define __A2_HISTO_STORAGE_H__
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "util/typedefs.h"
+
+namespace a2
+{
+
+/* Element type used for histogram bin storage.
+ *
+ * Histograms filled by the analysis only ever see unweighted fills, so the
+ * bin contents are integer counts. Storing them as u32 halves the memory
+ * footprint compared to double which means twice as many bins per cache line
+ * during the random access fill pattern. U32 counters saturate at 2^32-1
+ * instead of wrapping around, U64 counters are not expected to ever
+ * overflow.
+ *
+ * Note: Double is zero so that zero-initialized histogram structures use
+ * double storage as before. */
+enum class BinStorageType: u8
+{
+    Double,
+    U32,
+    U64,
+};
+
+inline size_t bin_storage_element_size(BinStorageType type)
+{
+    switch (type)
+    {
+        case BinStorageType::Double: return sizeof(double);
+        case BinStorageType::U32:    return sizeof(u32);
+        case BinStorageType::U64:    return sizeof(u64);
+    }
+
+    return sizeof(double);
+}
+
+inline size_t bin_storage_size(BinStorageType type, size_t binCount)
+{
+    return bin_storage_element_size(type) * binCount;
+}
+
+inline const char *to_string(BinStorageType type)
+{
+    switch (type)
+    {
+        case BinStorageType::Double: return "double";
+        case BinStorageType::U32:    return "u32";
+        case BinStorageType::U64:    return "u64";
+    }
+
+    return "double";
+}
+
+// Unknown strings yield BinStorageType::Double.
+inline BinStorageType bin_storage_type_from_string(const std::string &str)
+{
+    if (str == "u32")
+        return BinStorageType::U32;
+
+    if (str == "u64")
+        return BinStorageType::U64;
+
+    return BinStorageType::Double;
+}
+
+inline double read_bin(const void *data, BinStorageType type, size_t bin)
+{
+    switch (type)
+    {
+        case BinStorageType::Double: return reinterpret_cast<const double *>(data)[bin];
+        case BinStorageType::U32:    return reinterpret_cast<const u32 *>(data)[bin];
+        case BinStorageType::U64:    return reinterpret_cast<const u64 *>(data)[bin];
+    }
+
+    return 0.0;
+}
+
+// Integer storage types round the value and clamp it to the representable
+// range. NaN is stored as 0.
+template<typename T>
+inline T clamp_to_counter(double value)
+{
+    if (!(value > 0.0))
+        return 0;
+
+    if (value >= static_cast<double>(std::numeric_limits<T>::max()))
+        return std::numeric_limits<T>::max();
+
+    return static_cast<T>(std::llround(value));
+}
+
+inline void write_bin(void *data, BinStorageType type, size_t bin, double value)
+{
+    switch (type)
+    {
+        case BinStorageType::Double:
+            reinterpret_cast<double *>(data)[bin] = value;
+            break;
+        case BinStorageType::U32:
+            reinterpret_cast<u32 *>(data)[bin] = clamp_to_counter<u32>(value);
+            break;
+        case BinStorageType::U64:
+            reinterpret_cast<u64 *>(data)[bin] = clamp_to_counter<u64>(value);
+            break;
+    }
+}
+
+// Unweighted fill. This is the hot path used by the a2 histo sinks.
+inline u32 increment_bin(void *data, BinStorageType type, size_t bin)
+{
+    switch (type)
+    {
+        case BinStorageType::Double:
+            ++reinterpret_cast<double *>(data)[bin];
+            return 1;
+        case BinStorageType::U32:
+            {
+                // Saturating increment without a branch.
+                u32 &v = reinterpret_cast<u32 *>(data)[bin];
+                const u32 inc = (v != std::numeric_limits<u32>::max());
+                v += inc;
+                return inc;
+            }
+        case BinStorageType::U64:
+            ++reinterpret_cast<u64 *>(data)[bin];
+            return 1;
+    }
+
+    return 0;
+}
+
+// Adds the value of src[bin] to dest[bin] and clears src[bin]. Both storages
+// must use the same type. Returns the amount dest[bin] actually changed by
+// which differs from the src value if a U32 bin saturates.
+inline double move_add_bin(void *dest, void *src, BinStorageType type, size_t bin)
+{
+    double added = 0.0;
+
+    switch (type)
+    {
+        case BinStorageType::Double:
+            added = reinterpret_cast<double *>(src)[bin];
+            reinterpret_cast<double *>(dest)[bin] += added;
+            reinterpret_cast<double *>(src)[bin] = 0.0;
+            break;
+        case BinStorageType::U32:
+            {
+                u32 &d = reinterpret_cast<u32 *>(dest)[bin];
+                u32 &s = reinterpret_cast<u32 *>(src)[bin];
+                u64 sum = static_cast<u64>(d) + s;
+                u32 result = sum > std::numeric_limits<u32>::max() ? std::numeric_limits<u32>::max() : sum;
+                added = result - d;
+                d = result;
+                s = 0;
+            }
+            break;
+        case BinStorageType::U64:
+            added = reinterpret_cast<u64 *>(src)[bin];
+            reinterpret_cast<u64 *>(dest)[bin] += reinterpret_cast<u64 *>(src)[bin];
+            reinterpret_cast<u64 *>(src)[bin] = 0;
+            break;
+    }
+
+    return added;
+}
+
+// Heap allocation for histograms owning their bin storage. The returned
+// memory is not initialized. Release with free_bins().
+inline void *allocate_bins(BinStorageType type, size_t binCount)
+{
+    return new u64[(bin_storage_size(type, binCount) + sizeof(u64) - 1) / sizeof(u64)];
+}
+
+inline void free_bins(void *data)
+{
+    delete[] reinterpret_cast<u64 *>(data);
+}
+
+// All zero bits is 0.0 for IEEE doubles so memset works for all types.
+inline void clear_bins(void *data, BinStorageType type, size_t binCount)
+{
+    std::memset(data, 0, bin_storage_size(type, binCount));
+}
+
+// Sum of the bins in [beginBin, endBin).
+inline double sum_bins(const void *data, BinStorageType type, size_t beginBin, size_t endBin)
+{
+    double result = 0.0;
+
+    switch (type)
+    {
+        case BinStorageType::Double:
+            for (auto bin = beginBin; bin < endBin; ++bin)
+                result += reinterpret_cast<const double *>(data)[bin];
+            break;
+        case BinStorageType::U32:
+            {
+                u64 sum = 0;
+                for (auto bin = beginBin; bin < endBin; ++bin)
+                    sum += reinterpret_cast<const u32 *>(data)[bin];
+                result = sum;
+            }
+            break;
+        case BinStorageType::U64:
+            {
+                u64 sum = 0;
+                for (auto bin = beginBin; bin < endBin; ++bin)
+                    sum += reinterpret_cast<const u64 *>(data)[bin];
+                result = sum;
+            }
+            break;
+    }
+
+    return result;
+}
+
+} // namespace a2
+
+#endif /* __A2_HISTO_STORAGE_H__ */
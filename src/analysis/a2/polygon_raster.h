@@ -0,0 +1,282 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __A2_POLYGON_RASTER_H__
+#define __A2_POLYGON_RASTER_H__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "util/typedefs.h"
+
+namespace a2
+{
+
+/* Precompiled point-in-polygon test.
+ *
+ * The bounding box of the polygon is divided into a grid of cells. At build
+ * time each cell is classified as either completely outside the polygon,
+ * completely inside or as being crossed by one of the polygon edges. Points
+ * outside the bounding box are rejected immediately, points in inside/outside
+ * cells are answered by a single table lookup and only points in edge cells
+ * need the exact test.
+ *
+ * The exact test is supplied by the caller, both when building the raster and
+ * when testing points. This way the results are identical to using the exact
+ * test alone, including the treatment of points on the polygon boundary and
+ * of self-intersecting polygons. */
+struct PolygonRaster
+{
+    enum CellState: u8
+    {
+        Outside,
+        Inside,
+        Edge,
+    };
+
+    static constexpr s32 DefaultCellsPerAxis = 256;
+    static constexpr s32 MaxCellsPerAxis = 1024;
+
+    // Bounding box of the polygon. Initialized so that every point is
+    // rejected, which is the result for an empty polygon.
+    double minX = std::numeric_limits<double>::infinity();
+    double minY = std::numeric_limits<double>::infinity();
+    double maxX = -std::numeric_limits<double>::infinity();
+    double maxY = -std::numeric_limits<double>::infinity();
+
+    // Number of cells per unit along each axis.
+    double scaleX = 0.0;
+    double scaleY = 0.0;
+
+    s32 cellsX = 0;
+    s32 cellsY = 0;
+
+    // cellsX * cellsY CellState values, row major.
+    std::vector<u8> cells;
+};
+
+namespace polygon_raster_detail
+{
+
+inline s32 cells_for_axis(double range, double cellWidth)
+{
+    if (!(cellWidth > 0.0) || !std::isfinite(cellWidth))
+        return PolygonRaster::DefaultCellsPerAxis;
+
+    double cells = std::ceil(range / cellWidth);
+
+    if (!std::isfinite(cells))
+        return PolygonRaster::MaxCellsPerAxis;
+
+    return static_cast<s32>(std::clamp(
+            cells, 1.0, static_cast<double>(PolygonRaster::MaxCellsPerAxis)));
+}
+
+inline s32 cell_index(double value, double min, double scale, s32 cellCount)
+{
+    s32 result = static_cast<s32>((value - min) * scale);
+    return std::clamp(result, 0, cellCount - 1);
+}
+
+// Returns true if the segment (x0, y0) -> (x1, y1) touches the given
+// rectangle. The caller has to ensure that the bounding box of the segment
+// overlaps the rectangle, so only the side of the rectangle corners relative to
+// the segment line has to be checked.
+inline bool segment_touches_rect(
+    double x0, double y0, double x1, double y1,
+    double rx0, double ry0, double rx1, double ry1)
+{
+    const double dx = x1 - x0;
+    const double dy = y1 - y0;
+
+    auto side = [&] (double cx, double cy)
+    {
+        return dx * (cy - y0) - dy * (cx - x0);
+    };
+
+    const double s0 = side(rx0, ry0);
+    const double s1 = side(rx1, ry0);
+    const double s2 = side(rx0, ry1);
+    const double s3 = side(rx1, ry1);
+
+    if (s0 > 0.0 && s1 > 0.0 && s2 > 0.0 && s3 > 0.0)
+        return false;
+
+    if (s0 < 0.0 && s1 < 0.0 && s2 < 0.0 && s3 < 0.0)
+        return false;
+
+    return true;
+}
+
+} // end namespace polygon_raster_detail
+
+/* Builds the raster for the given polygon outline. The closing edge from the
+ * last to the first point is always taken into account.
+ *
+ * cellWidthX/Y specify the desired cell size, e.g. the bin width of the
+ * histogram the polygon was drawn in. If a width is not positive the bounding
+ * box is divided into DefaultCellsPerAxis cells instead. The number of cells
+ * per axis is limited to MaxCellsPerAxis.
+ *
+ * exactTest must be callable as bool(double x, double y). */
+template<typename ExactTest>
+PolygonRaster make_polygon_raster(
+    const std::vector<std::pair<double, double>> &points,
+    double cellWidthX, double cellWidthY,
+    ExactTest exactTest)
+{
+    namespace detail = polygon_raster_detail;
+
+    PolygonRaster r;
+
+    if (points.empty())
+        return r;
+
+    bool allFinite = true;
+
+    for (const auto &p: points)
+    {
+        allFinite = allFinite && std::isfinite(p.first) && std::isfinite(p.second);
+        r.minX = std::min(r.minX, p.first);
+        r.maxX = std::max(r.maxX, p.first);
+        r.minY = std::min(r.minY, p.second);
+        r.maxY = std::max(r.maxY, p.second);
+    }
+
+    const double width  = r.maxX - r.minX;
+    const double height = r.maxY - r.minY;
+
+    // Degenerate or non-finite outline: use a single edge cell so that every
+    // point inside the bounding box gets the exact test.
+    if (!allFinite || !(width > 0.0 && height > 0.0 && std::isfinite(width) && std::isfinite(height)))
+    {
+        r.cellsX = r.cellsY = 1;
+        r.scaleX = r.scaleY = 0.0;
+        r.cells.assign(1, PolygonRaster::Edge);
+        return r;
+    }
+
+    r.cellsX = detail::cells_for_axis(width, cellWidthX);
+    r.cellsY = detail::cells_for_axis(height, cellWidthY);
+    r.scaleX = r.cellsX / width;
+    r.scaleY = r.cellsY / height;
+    r.cells.assign(static_cast<size_t>(r.cellsX) * r.cellsY, PolygonRaster::Outside);
+
+    const double cellW = width / r.cellsX;
+    const double cellH = height / r.cellsY;
+
+    // The cell rectangles are grown slightly to make the edge classification
+    // conservative with regards to the rounding of the cell index calculation.
+    const double epsX = cellW * 1e-6 + std::max(std::abs(r.minX), std::abs(r.maxX)) * 1e-12;
+    const double epsY = cellH * 1e-6 + std::max(std::abs(r.minY), std::abs(r.maxY)) * 1e-12;
+
+    // Pass 1: mark all cells touched by a polygon edge.
+    for (size_t pi = 0; pi < points.size(); pi++)
+    {
+        const auto &p0 = points[pi];
+        const auto &p1 = points[(pi + 1) % points.size()];
+
+        const s32 ix0 = detail::cell_index(std::min(p0.first, p1.first) - epsX, r.minX, r.scaleX, r.cellsX);
+        const s32 ix1 = detail::cell_index(std::max(p0.first, p1.first) + epsX, r.minX, r.scaleX, r.cellsX);
+        const s32 iy0 = detail::cell_index(std::min(p0.second, p1.second) - epsY, r.minY, r.scaleY, r.cellsY);
+        const s32 iy1 = detail::cell_index(std::max(p0.second, p1.second) + epsY, r.minY, r.scaleY, r.cellsY);
+
+        for (s32 iy = iy0; iy <= iy1; iy++)
+        {
+            const double ry0 = r.minY + iy * cellH - epsY;
+            const double ry1 = r.minY + (iy + 1) * cellH + epsY;
+
+            for (s32 ix = ix0; ix <= ix1; ix++)
+            {
+                const double rx0 = r.minX + ix * cellW - epsX;
+                const double rx1 = r.minX + (ix + 1) * cellW + epsX;
+
+                if (detail::segment_touches_rect(
+                        p0.first, p0.second, p1.first, p1.second,
+                        rx0, ry0, rx1, ry1))
+                {
+                    r.cells[iy * r.cellsX + ix] = PolygonRaster::Edge;
+                }
+            }
+        }
+    }
+
+    // Pass 2: classify the remaining cells. Neighbouring non-edge cells in a
+    // row are not separated by any polygon edge, so a single exact test of one
+    // cell center determines the state of the whole run.
+    for (s32 iy = 0; iy < r.cellsY; iy++)
+    {
+        u8 *row = r.cells.data() + static_cast<size_t>(iy) * r.cellsX;
+        s32 ix = 0;
+
+        while (ix < r.cellsX)
+        {
+            if (row[ix] == PolygonRaster::Edge)
+            {
+                ix++;
+                continue;
+            }
+
+            const double cx = r.minX + (ix + 0.5) * cellW;
+            const double cy = r.minY + (iy + 0.5) * cellH;
+            const u8 state = exactTest(cx, cy) ? PolygonRaster::Inside : PolygonRaster::Outside;
+
+            while (ix < r.cellsX && row[ix] != PolygonRaster::Edge)
+                row[ix++] = state;
+        }
+    }
+
+    return r;
+}
+
+template<typename ExactTest>
+inline bool polygon_raster_within(
+    const PolygonRaster &r, double x, double y, ExactTest exactTest)
+{
+    namespace detail = polygon_raster_detail;
+
+    // Bounding box reject. Also rejects NaN coordinates.
+    if (!(x >= r.minX && x <= r.maxX && y >= r.minY && y <= r.maxY))
+        return false;
+
+    const s32 ix = detail::cell_index(x, r.minX, r.scaleX, r.cellsX);
+    const s32 iy = detail::cell_index(y, r.minY, r.scaleY, r.cellsY);
+
+    switch (r.cells[iy * r.cellsX + ix])
+    {
+        case PolygonRaster::Inside:
+            return true;
+
+        case PolygonRaster::Outside:
+            return false;
+
+        default:
+            break;
+    }
+
+    return exactTest(x, y);
+}
+
+} // end namespace a2
+
+#endif /* __A2_POLYGON_RASTER_H__ */
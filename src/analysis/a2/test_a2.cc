@@ -1,6 +1,19 @@
 #include <gtest/gtest.h>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
 
 #include "a2.h"
+#include "a2_impl.h"
+#include "a2_simd.h"
+#include "polygon_raster.h"
+
+#define BOOST_MATH_DISABLE_FLOAT128
+#define BOOST_ALLOW_DEPRECATED_HEADERS
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/point_xy.hpp>
+#undef BOOST_ALLOW_DEPRECATED_HEADERS
 
 TEST(A2, histo_binning_1_to_1_pos_only)
 {
@@ -202,3 +215,1613 @@ TEST(A2, histo_binning_large_range)
         }
     }
 }
+
+TEST(A2, parallel_operator_execution)
+{
+    using namespace a2;
+
+    memory::Arena arena(Megabytes(4));
+
+    const int OperatorCount = 200;
+    const int ParamCount = 64;
+
+    auto a2 = arena.pushObject<A2>(&arena);
+    a2->operators[0] = arena.pushArray<Operator>(OperatorCount);
+    a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(OperatorCount);
+
+    auto input = push_param_vector(&arena, ParamCount);
+    PipeVectors inPipe =
+    {
+        input,
+        push_param_vector(&arena, ParamCount, 0.0),
+        push_param_vector(&arena, ParamCount, ParamCount),
+    };
+
+    // Four ranks of calibration operators all using the same input.
+    for (int i = 0; i < OperatorCount; ++i)
+    {
+        auto &opCount = a2->operatorCounts[0];
+        a2->operators[0][opCount] = make_calibration(&arena, inPipe, 0.0, 1.0 + i);
+        a2->operatorRanks[0][opCount] = 1 + i / 50;
+        ++opCount;
+    }
+
+    for (int i = 0; i < ParamCount; ++i)
+        input[i] = i;
+
+    a2_end_event(a2, 0);
+
+    std::vector<double> serialResults;
+
+    for (int i = 0; i < OperatorCount; ++i)
+    {
+        auto &out = a2->operators[0][i].outputs[0];
+        std::copy(out.begin(), out.end(), std::back_inserter(serialResults));
+        invalidate_all(out);
+    }
+
+    a2_set_operator_thread_count(a2, 4);
+    ASSERT_EQ(a2_get_operator_thread_count(a2), 4u);
+
+    for (int iter = 0; iter < 100; ++iter)
+        a2_end_event(a2, 0);
+
+    size_t resultIndex = 0;
+
+    for (int i = 0; i < OperatorCount; ++i)
+    {
+        for (double value: a2->operators[0][i].outputs[0])
+            ASSERT_EQ(value, serialResults[resultIndex++]);
+    }
+
+    a2_set_operator_thread_count(a2, 0);
+    ASSERT_EQ(a2_get_operator_thread_count(a2), 1u);
+}
+
+TEST(A2, event_replicas_merge_histos)
+{
+    using namespace a2;
+
+    const s32 ParamCount = 4;
+    const s32 BinCount = 16;
+    const int ReplicaCount = 3;
+    const int EventCount = 1000;
+
+    // Histogram storage shared by all instances, like the Histo1D storage the
+    // a2_adapter hands to each build.
+    memory::Arena histoArena(Kilobytes(64));
+    std::vector<H1D> histos(ParamCount);
+
+    for (auto &histo: histos)
+    {
+        histo = {};
+        static_cast<ParamVec &>(histo) = push_param_vector(&histoArena, BinCount, 0.0);
+        histo.binning.min = 0.0;
+        histo.binning.range = BinCount;
+        histo.binningFactor = histo.size / histo.binning.range;
+    }
+
+    auto build = [&] (memory::Arena *arena)
+    {
+        auto a2 = arena->pushObject<A2>(arena);
+        a2->operators[0] = arena->pushArray<Operator>(1);
+        a2->operatorRanks[0] = arena->pushArray<A2::OperatorCountType>(1);
+
+        PipeVectors inPipe =
+        {
+            push_param_vector(arena, ParamCount),
+            push_param_vector(arena, ParamCount, 0.0),
+            push_param_vector(arena, ParamCount, BinCount),
+        };
+
+        for (s32 i = 0; i < ParamCount; ++i)
+            inPipe.data[i] = i;
+
+        a2->operators[0][0] = make_h1d_sink(arena, inPipe, { histos.data(), ParamCount });
+        a2->operatorRanks[0][0] = 1;
+        a2->operatorCounts[0] = 1;
+
+        return a2;
+    };
+
+    memory::Arena destArena(Kilobytes(64));
+    auto dest = build(&destArena);
+
+    std::vector<std::unique_ptr<memory::Arena>> arenas;
+    std::vector<A2 *> replicas;
+
+    for (int i = 0; i < ReplicaCount; ++i)
+    {
+        arenas.emplace_back(std::make_unique<memory::Arena>(Kilobytes(64)));
+        auto replica = build(arenas.back().get());
+        a2_detach_histo_storage(replica, arenas.back().get());
+        replicas.push_back(replica);
+    }
+
+    const u32 moduleData[] = { 0x1, 0x2, 0x3 };
+
+    {
+        EventReplicaSet replicaSet(replicas, 64);
+        ASSERT_EQ(replicaSet.replicaCount(), static_cast<size_t>(ReplicaCount));
+
+        for (int i = 0; i < EventCount; ++i)
+        {
+            replicaSet.beginEvent(0);
+            replicaSet.processModuleData(0, 0, moduleData, 3);
+            replicaSet.endEvent(0);
+        }
+
+        // The shared storage must be untouched until the merge.
+        ASSERT_EQ(histos[0].data[0], 0.0);
+
+        replicaSet.mergeHistos(dest);
+    }
+
+    auto destData = reinterpret_cast<H1DSinkData *>(dest->operators[0][0].d);
+
+    for (s32 hi = 0; hi < ParamCount; ++hi)
+    {
+        auto &histo = destData->histos[hi];
+        ASSERT_EQ(histo.entryCount, static_cast<size_t>(EventCount));
+        ASSERT_EQ(histos[hi].data[hi], EventCount);
+    }
+
+    // Replica storage is cleared after merging.
+    for (auto replica: replicas)
+    {
+        auto d = reinterpret_cast<H1DSinkData *>(replica->operators[0][0].d);
+        ASSERT_EQ(d->histos[0].entryCount, 0u);
+        ASSERT_EQ(d->histos[0].data[0], 0.0);
+    }
+
+    ASSERT_FALSE(a2_operator_requires_event_order(&dest->operators[0][0]));
+
+    {
+        auto op = make_keep_previous(&destArena, { histos[0], histos[0], histos[0] }, false);
+        ASSERT_TRUE(a2_operator_requires_event_order(&op));
+    }
+}
+
+TEST(A2, buffered_histo_fill)
+{
+    using namespace a2;
+
+    const s32 ParamCount = 8;
+    const s32 BinCount = 256;
+    const int EventCount = 10000;
+
+    struct Instance
+    {
+        A2 *a2;
+        ParamVec input;
+        std::vector<H1D> histos;
+        H2D histo2d;
+    };
+
+    memory::Arena arena(Megabytes(4));
+
+    auto build = [&] (HistoFillStrategyType fillType)
+    {
+        Instance result = {};
+        result.a2 = arena.pushObject<A2>(&arena);
+        result.a2->operators[0] = arena.pushArray<Operator>(2);
+        result.a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(2);
+        result.input = push_param_vector(&arena, ParamCount);
+
+        PipeVectors inPipe =
+        {
+            result.input,
+            push_param_vector(&arena, ParamCount, 0.0),
+            push_param_vector(&arena, ParamCount, BinCount),
+        };
+
+        result.histos.resize(ParamCount);
+
+        for (auto &histo: result.histos)
+        {
+            histo = {};
+            static_cast<ParamVec &>(histo) = push_param_vector(&arena, BinCount, 0.0);
+            histo.binning = { 0.0, BinCount };
+            histo.binningFactor = histo.size / histo.binning.range;
+        }
+
+        result.histo2d = {};
+        static_cast<ParamVec &>(result.histo2d) = push_param_vector(&arena, BinCount * BinCount, 0.0);
+
+        for (s32 axis = 0; axis < H2D::AxisCount; axis++)
+        {
+            result.histo2d.binCounts[axis] = BinCount;
+            result.histo2d.binnings[axis] = { 0.0, BinCount };
+            result.histo2d.binningFactors[axis] = 1.0;
+        }
+
+        result.a2->operators[0][0] = make_h1d_sink(&arena, inPipe, { result.histos.data(), ParamCount });
+        result.a2->operators[0][1] = make_h2d_sink(&arena, inPipe, inPipe, 0, 1, result.histo2d);
+        result.a2->operatorRanks[0][0] = 1;
+        result.a2->operatorRanks[0][1] = 1;
+        result.a2->operatorCounts[0] = 2;
+
+        a2_set_histo_fill_strategy(result.a2, fillType);
+        a2_begin_run(result.a2, {});
+
+        return result;
+    };
+
+    auto direct = build(HistoFillStrategyType::Direct);
+    auto buffered = build(HistoFillStrategyType::Buffered);
+
+    ASSERT_STREQ(direct.a2->histoFillStrategy.name(), "HistoFillDirect");
+    ASSERT_STREQ(buffered.a2->histoFillStrategy.name(), "HistoFillBuffered");
+
+    std::mt19937 rng(1234);
+    // Includes values outside the binning range to exercise the underflow and
+    // overflow counters.
+    std::uniform_real_distribution<double> dist(-10.0, BinCount + 10.0);
+
+    auto run_events = [&] (int count)
+    {
+        for (int ev = 0; ev < count; ++ev)
+        {
+            for (s32 i = 0; i < ParamCount; ++i)
+                direct.input[i] = buffered.input[i] = dist(rng);
+
+            a2_end_event(direct.a2, 0);
+            a2_end_event(buffered.a2, 0);
+        }
+    };
+
+    auto compare = [&] ()
+    {
+        auto d1 = reinterpret_cast<H1DSinkData *>(direct.a2->operators[0][0].d);
+        auto b1 = reinterpret_cast<H1DSinkData *>(buffered.a2->operators[0][0].d);
+
+        for (s32 hi = 0; hi < ParamCount; ++hi)
+        {
+            ASSERT_EQ(d1->histos[hi].entryCount, b1->histos[hi].entryCount);
+            ASSERT_EQ(d1->histos[hi].underflows, b1->histos[hi].underflows);
+            ASSERT_EQ(d1->histos[hi].overflows, b1->histos[hi].overflows);
+
+            for (s32 bin = 0; bin < BinCount; ++bin)
+                ASSERT_EQ(direct.histos[hi].data[bin], buffered.histos[hi].data[bin]);
+        }
+
+        auto d2 = reinterpret_cast<H2DSinkData *>(direct.a2->operators[0][1].d);
+        auto b2 = reinterpret_cast<H2DSinkData *>(buffered.a2->operators[0][1].d);
+
+        ASSERT_EQ(d2->histo.entryCount, b2->histo.entryCount);
+
+        for (s32 bin = 0; bin < BinCount * BinCount; ++bin)
+            ASSERT_EQ(direct.histo2d.data[bin], buffered.histo2d.data[bin]);
+    };
+
+    run_events(EventCount);
+    a2_timetick(buffered.a2);
+    compare();
+
+    run_events(EventCount / 3);
+    a2_end_run(direct.a2);
+    a2_end_run(buffered.a2);
+    compare();
+}
+
+TEST(A2, integer_bin_storage)
+{
+    using namespace a2;
+
+    const s32 ParamCount = 4;
+    const s32 BinCount = 64;
+    const int EventCount = 5000;
+
+    struct Instance
+    {
+        A2 *a2;
+        ParamVec input;
+        H1DSinkData *h1d;
+        H2DSinkData *h2d;
+    };
+
+    memory::Arena arena(Megabytes(1));
+
+    auto build = [&] (BinStorageType storageType, HistoFillStrategyType fillType)
+    {
+        Instance result = {};
+        result.a2 = arena.pushObject<A2>(&arena);
+        result.a2->operators[0] = arena.pushArray<Operator>(2);
+        result.a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(2);
+        result.input = push_param_vector(&arena, ParamCount);
+
+        PipeVectors inPipe =
+        {
+            result.input,
+            push_param_vector(&arena, ParamCount, 0.0),
+            push_param_vector(&arena, ParamCount, BinCount),
+        };
+
+        auto push_storage = [&] (s32 bins)
+        {
+            auto result = arena.pushSize(bin_storage_size(storageType, bins), alignof(u64));
+            clear_bins(result, storageType, bins);
+            return reinterpret_cast<double *>(result);
+        };
+
+        std::vector<H1D> histos(ParamCount);
+
+        for (auto &histo: histos)
+        {
+            histo = {};
+            histo.storageType = storageType;
+            histo.data = push_storage(BinCount);
+            histo.size = BinCount;
+            histo.binning = { 0.0, BinCount };
+            histo.binningFactor = histo.size / histo.binning.range;
+        }
+
+        H2D histo2d = {};
+        histo2d.storageType = storageType;
+        histo2d.data = push_storage(BinCount * BinCount);
+        histo2d.size = BinCount * BinCount;
+
+        for (s32 axis = 0; axis < H2D::AxisCount; axis++)
+        {
+            histo2d.binCounts[axis] = BinCount;
+            histo2d.binnings[axis] = { 0.0, BinCount };
+            histo2d.binningFactors[axis] = 1.0;
+        }
+
+        result.a2->operators[0][0] = make_h1d_sink(&arena, inPipe, { histos.data(), ParamCount });
+        result.a2->operators[0][1] = make_h2d_sink(&arena, inPipe, inPipe, 0, 1, histo2d);
+        result.a2->operatorRanks[0][0] = 1;
+        result.a2->operatorRanks[0][1] = 1;
+        result.a2->operatorCounts[0] = 2;
+        result.h1d = reinterpret_cast<H1DSinkData *>(result.a2->operators[0][0].d);
+        result.h2d = reinterpret_cast<H2DSinkData *>(result.a2->operators[0][1].d);
+
+        a2_set_histo_fill_strategy(result.a2, fillType);
+        a2_begin_run(result.a2, {});
+
+        return result;
+    };
+
+    std::vector<Instance> instances =
+    {
+        build(BinStorageType::Double, HistoFillStrategyType::Direct), // reference
+        build(BinStorageType::U32, HistoFillStrategyType::Direct),
+        build(BinStorageType::U64, HistoFillStrategyType::Direct),
+        build(BinStorageType::U32, HistoFillStrategyType::Buffered),
+        build(BinStorageType::U64, HistoFillStrategyType::Buffered),
+    };
+
+    std::mt19937 rng(4321);
+    std::uniform_real_distribution<double> dist(-5.0, BinCount + 5.0);
+
+    for (int ev = 0; ev < EventCount; ++ev)
+    {
+        for (s32 i = 0; i < ParamCount; ++i)
+        {
+            double value = dist(rng);
+
+            for (auto &instance: instances)
+                instance.input[i] = value;
+        }
+
+        for (auto &instance: instances)
+            a2_end_event(instance.a2, 0);
+    }
+
+    for (auto &instance: instances)
+        a2_end_run(instance.a2);
+
+    const auto &ref = instances[0];
+
+    for (size_t ii = 1; ii < instances.size(); ++ii)
+    {
+        const auto &instance = instances[ii];
+
+        for (s32 hi = 0; hi < ParamCount; ++hi)
+        {
+            const auto &refHisto = ref.h1d->histos[hi];
+            const auto &histo = instance.h1d->histos[hi];
+
+            ASSERT_EQ(histo.entryCount, refHisto.entryCount);
+            ASSERT_EQ(histo.underflows, refHisto.underflows);
+            ASSERT_EQ(histo.overflows, refHisto.overflows);
+
+            for (s32 bin = 0; bin < BinCount; ++bin)
+                ASSERT_EQ(read_bin(histo.data, histo.storageType, bin), refHisto.data[bin]);
+        }
+
+        ASSERT_EQ(instance.h2d->histo.entryCount, ref.h2d->histo.entryCount);
+
+        for (s32 bin = 0; bin < BinCount * BinCount; ++bin)
+        {
+            ASSERT_EQ(read_bin(instance.h2d->histo.data, instance.h2d->histo.storageType, bin),
+                      ref.h2d->histo.data[bin]);
+        }
+    }
+
+    // Replica storage keeps the storage type and merges into the primary.
+    {
+        auto &dest = instances[1];
+        memory::Arena replicaArena(Megabytes(1));
+        auto replica = build(BinStorageType::U32, HistoFillStrategyType::Direct);
+        a2_detach_histo_storage(replica.a2, &replicaArena);
+
+        ASSERT_EQ(replica.h1d->histos[0].storageType, BinStorageType::U32);
+        ASSERT_NE(replica.h1d->histos[0].data, dest.h1d->histos[0].data);
+
+        const double before = read_bin(dest.h1d->histos[0].data, BinStorageType::U32, 1);
+        replica.input[0] = 1.5;
+        a2_end_event(replica.a2, 0);
+        a2_merge_histo_storage(dest.a2, replica.a2);
+
+        ASSERT_EQ(read_bin(dest.h1d->histos[0].data, BinStorageType::U32, 1), before + 1.0);
+        ASSERT_EQ(read_bin(replica.h1d->histos[0].data, BinStorageType::U32, 1), 0.0);
+    }
+
+    // U32 counters saturate instead of wrapping around.
+    {
+        u32 bins[2] = { std::numeric_limits<u32>::max() - 1, 0 };
+        increment_bin(bins, BinStorageType::U32, 0);
+        increment_bin(bins, BinStorageType::U32, 0);
+        ASSERT_EQ(bins[0], std::numeric_limits<u32>::max());
+        ASSERT_EQ(bins[1], 0u);
+
+        write_bin(bins, BinStorageType::U32, 1, 41.6);
+        ASSERT_EQ(bins[1], 42u);
+        write_bin(bins, BinStorageType::U32, 1, -1.0);
+        ASSERT_EQ(bins[1], 0u);
+    }
+}
+
+TEST(A2, merge_sink_histos)
+{
+    using namespace a2;
+
+    const s32 ParamCount = 2;
+    const s32 BinCount = 16;
+
+    struct Instance
+    {
+        A2 *a2;
+        ParamVec input;
+        H1DSinkData *h1d;
+        H2DSinkData *h2d;
+    };
+
+    memory::Arena arena(Megabytes(1));
+
+    auto build = [&] (BinStorageType storageType, HistoFillStrategyType fillType)
+    {
+        Instance result = {};
+        result.a2 = arena.pushObject<A2>(&arena);
+        result.a2->operators[0] = arena.pushArray<Operator>(2);
+        result.a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(2);
+        result.input = push_param_vector(&arena, ParamCount);
+
+        PipeVectors inPipe =
+        {
+            result.input,
+            push_param_vector(&arena, ParamCount, 0.0),
+            push_param_vector(&arena, ParamCount, BinCount),
+        };
+
+        auto push_storage = [&] (s32 bins)
+        {
+            auto result = arena.pushSize(bin_storage_size(storageType, bins), alignof(u64));
+            clear_bins(result, storageType, bins);
+            return reinterpret_cast<double *>(result);
+        };
+
+        std::vector<H1D> histos(ParamCount);
+
+        for (auto &histo: histos)
+        {
+            histo = {};
+            histo.storageType = storageType;
+            histo.data = push_storage(BinCount);
+            histo.size = BinCount;
+            histo.binning = { 0.0, BinCount };
+            histo.binningFactor = histo.size / histo.binning.range;
+        }
+
+        H2D histo2d = {};
+        histo2d.storageType = storageType;
+        histo2d.data = push_storage(BinCount * BinCount);
+        histo2d.size = BinCount * BinCount;
+
+        for (s32 axis = 0; axis < H2D::AxisCount; axis++)
+        {
+            histo2d.binCounts[axis] = BinCount;
+            histo2d.binnings[axis] = { 0.0, BinCount };
+            histo2d.binningFactors[axis] = 1.0;
+        }
+
+        result.a2->operators[0][0] = make_h1d_sink(&arena, inPipe, { histos.data(), ParamCount });
+        result.a2->operators[0][1] = make_h2d_sink(&arena, inPipe, inPipe, 0, 1, histo2d);
+        result.a2->operatorRanks[0][0] = 1;
+        result.a2->operatorRanks[0][1] = 1;
+        result.a2->operatorCounts[0] = 2;
+        result.h1d = reinterpret_cast<H1DSinkData *>(result.a2->operators[0][0].d);
+        result.h2d = reinterpret_cast<H2DSinkData *>(result.a2->operators[0][1].d);
+
+        a2_set_histo_fill_strategy(result.a2, fillType);
+        a2_begin_run(result.a2, {});
+
+        return result;
+    };
+
+    // Sinks of independently built instances merge pairwise. Mismatching
+    // storage types or sink types are rejected.
+    auto dest = build(BinStorageType::U64, HistoFillStrategyType::Direct);
+    auto src = build(BinStorageType::U64, HistoFillStrategyType::Buffered);
+    auto other = build(BinStorageType::Double, HistoFillStrategyType::Direct);
+
+    src.input[0] = 2.5;
+    a2_end_event(src.a2, 0);
+    src.a2->histoFillStrategy.flush();
+
+    ASSERT_FALSE(a2_merge_sink_histos(dest.a2->operators[0], other.a2->operators[0]));
+    ASSERT_FALSE(a2_merge_sink_histos(dest.a2->operators[0], src.a2->operators[0] + 1));
+    ASSERT_TRUE(a2_merge_sink_histos(dest.a2->operators[0], src.a2->operators[0]));
+    ASSERT_TRUE(a2_merge_sink_histos(dest.a2->operators[0] + 1, src.a2->operators[0] + 1));
+
+    ASSERT_EQ(read_bin(dest.h1d->histos[0].data, BinStorageType::U64, 2), 1.0);
+    ASSERT_EQ(dest.h1d->histos[0].entryCount, 1.0);
+    ASSERT_EQ(read_bin(src.h1d->histos[0].data, BinStorageType::U64, 2), 0.0);
+    ASSERT_EQ(dest.h2d->histo.entryCount, 1.0);
+}
+
+TEST(A2, tiled_h2d_storage)
+{
+    using namespace a2;
+
+    const s32 BinCount = 256;
+    const int EventCount = 20000;
+    // Input values are restricted to a small part of the histogram.
+    const double MinValue = 40.0;
+    const double MaxValue = 100.0;
+
+    struct Instance
+    {
+        A2 *a2;
+        ParamVec input;
+        H2DSinkData *h2d;
+        std::unique_ptr<TiledHistoStorage> tiles;
+    };
+
+    memory::Arena arena(Megabytes(2));
+
+    auto build = [&] (bool tiled, BinStorageType storageType, HistoFillStrategyType fillType)
+    {
+        Instance result = {};
+        result.a2 = arena.pushObject<A2>(&arena);
+        result.a2->operators[0] = arena.pushArray<Operator>(1);
+        result.a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(1);
+        result.input = push_param_vector(&arena, 2);
+
+        PipeVectors inPipe =
+        {
+            result.input,
+            push_param_vector(&arena, 2, 0.0),
+            push_param_vector(&arena, 2, BinCount),
+        };
+
+        H2D histo = {};
+        histo.storageType = storageType;
+        histo.size = BinCount * BinCount;
+
+        if (tiled)
+        {
+            result.tiles = std::make_unique<TiledHistoStorage>(BinCount, BinCount, storageType);
+            histo.tiles = result.tiles.get();
+        }
+        else
+        {
+            histo.data = reinterpret_cast<double *>(
+                arena.pushSize(bin_storage_size(storageType, histo.size), alignof(u64)));
+            clear_bins(histo.data, storageType, histo.size);
+        }
+
+        for (s32 axis = 0; axis < H2D::AxisCount; axis++)
+        {
+            histo.binCounts[axis] = BinCount;
+            histo.binnings[axis] = { 0.0, BinCount };
+            histo.binningFactors[axis] = 1.0;
+        }
+
+        result.a2->operators[0][0] = make_h2d_sink(&arena, inPipe, inPipe, 0, 1, histo);
+        result.a2->operatorRanks[0][0] = 1;
+        result.a2->operatorCounts[0] = 1;
+        result.h2d = reinterpret_cast<H2DSinkData *>(result.a2->operators[0][0].d);
+
+        a2_set_histo_fill_strategy(result.a2, fillType);
+        a2_begin_run(result.a2, {});
+
+        return result;
+    };
+
+    std::vector<Instance> instances;
+    instances.emplace_back(build(false, BinStorageType::Double, HistoFillStrategyType::Direct)); // reference
+    instances.emplace_back(build(true, BinStorageType::Double, HistoFillStrategyType::Direct));
+    instances.emplace_back(build(true, BinStorageType::U32, HistoFillStrategyType::Buffered));
+
+    std::mt19937 rng(1111);
+    std::uniform_real_distribution<double> dist(MinValue, MaxValue);
+
+    for (int ev = 0; ev < EventCount; ++ev)
+    {
+        double x = dist(rng);
+        double y = dist(rng);
+
+        for (auto &instance: instances)
+        {
+            instance.input[0] = x;
+            instance.input[1] = y;
+            a2_end_event(instance.a2, 0);
+        }
+    }
+
+    for (auto &instance: instances)
+        a2_end_run(instance.a2);
+
+    const auto &ref = instances[0].h2d->histo;
+
+    for (size_t ii = 1; ii < instances.size(); ++ii)
+    {
+        const auto &tiles = *instances[ii].tiles;
+
+        ASSERT_EQ(instances[ii].h2d->histo.entryCount, ref.entryCount);
+
+        for (u32 y = 0; y < BinCount; ++y)
+            for (u32 x = 0; x < BinCount; ++x)
+                ASSERT_EQ(tiles.getBin(x, y), ref.data[y * BinCount + x]);
+
+        // Only the tiles covering [MinValue, MaxValue) in both dimensions are
+        // allocated.
+        const u32 T = TiledHistoStorage::TileSize;
+        const size_t expectedTiles = (99 / T - 40 / T + 1) * (99 / T - 40 / T + 1);
+        ASSERT_EQ(tiles.getAllocatedTileCount(), expectedTiles);
+        ASSERT_LT(tiles.getAllocatedTileCount(), tiles.getTileCount());
+
+        ASSERT_TRUE(tiles.isRegionEmpty(0, BinCount, 0, 32));
+        ASSERT_TRUE(tiles.isRegionEmpty(128, BinCount, 0, BinCount));
+        ASSERT_FALSE(tiles.isRegionEmpty(0, BinCount, 0, BinCount));
+        ASSERT_EQ(tiles.sumRegion(0, BinCount, 0, BinCount), ref.entryCount);
+
+        size_t visited = 0;
+        tiles.visitBins(0, BinCount, 0, BinCount, [&visited] (u32, u32, double) { ++visited; });
+        ASSERT_EQ(visited, expectedTiles * TiledHistoStorage::BinsPerTile);
+    }
+
+    // Replicas get their own tiled storage which is merged into the primary.
+    {
+        auto &dest = instances[1];
+        memory::Arena replicaArena(Megabytes(1));
+        auto replica = build(true, BinStorageType::Double, HistoFillStrategyType::Direct);
+        a2_detach_histo_storage(replica.a2, &replicaArena);
+
+        auto replicaTiles = replica.h2d->histo.tiles;
+        ASSERT_NE(replicaTiles, replica.tiles.get());
+        ASSERT_EQ(replicaTiles->getAllocatedTileCount(), 0u);
+
+        const double before = dest.tiles->getBin(200, 10);
+        replica.input[0] = 200.5;
+        replica.input[1] = 10.5;
+        a2_end_event(replica.a2, 0);
+        ASSERT_EQ(replicaTiles->getAllocatedTileCount(), 1u);
+
+        a2_merge_histo_storage(dest.a2, replica.a2);
+
+        ASSERT_EQ(dest.tiles->getBin(200, 10), before + 1.0);
+        ASSERT_EQ(replicaTiles->getBin(200, 10), 0.0);
+        ASSERT_TRUE(replicaTiles->isRegionEmpty(0, BinCount, 0, BinCount));
+    }
+
+    // clear() keeps the tiles allocated but empty.
+    {
+        auto &tiles = *instances[1].tiles;
+        const auto allocated = tiles.getAllocatedTileCount();
+        tiles.clear();
+        ASSERT_EQ(tiles.getAllocatedTileCount(), allocated);
+        ASSERT_TRUE(tiles.isRegionEmpty(0, BinCount, 0, BinCount));
+
+        tiles.setBin(5, 5, 0.0);
+        ASSERT_EQ(tiles.getAllocatedTileCount(), allocated);
+        tiles.setBin(250, 250, 3.0);
+        ASSERT_EQ(tiles.getAllocatedTileCount(), allocated + 1);
+        ASSERT_EQ(tiles.getTileSum(tiles.tileIndex(250, 250)), 3.0);
+    }
+
+    // Tile sums follow the bin contents when U32 bins saturate.
+    {
+        const double Max = std::numeric_limits<u32>::max();
+        TiledHistoStorage tiles(BinCount, BinCount, BinStorageType::U32);
+        const auto ti = tiles.tileIndex(3, 4);
+
+        tiles.setBin(3, 4, Max - 1.0);
+        tiles.increment(3, 4);
+        tiles.increment(3, 4);
+        tiles.increment(3, 4);
+        ASSERT_EQ(tiles.getBin(3, 4), Max);
+        ASSERT_EQ(tiles.getTileSum(ti), Max);
+
+        TiledHistoStorage src(BinCount, BinCount, BinStorageType::U32);
+        src.setBin(3, 4, 10.0);
+        src.increment(5, 4);
+        tiles.moveAddFrom(src);
+        ASSERT_EQ(tiles.getBin(3, 4), Max);
+        ASSERT_EQ(tiles.getBin(5, 4), 1.0);
+        ASSERT_EQ(tiles.getTileSum(ti), Max + 1.0);
+        ASSERT_TRUE(src.isRegionEmpty(0, BinCount, 0, BinCount));
+    }
+}
+
+// Compares the kernels of the given instruction set against the scalar ones.
+// Skips the calling test if the instruction set is not available.
+static void check_simd_kernel_table(a2::simd::InstructionSet is)
+{
+    using namespace a2;
+    using namespace a2::simd;
+
+    // Same result or both NaN with the same payload.
+    auto same_param = [] (double a, double b)
+    {
+        if (std::isnan(a) || std::isnan(b))
+            return std::isnan(a) && std::isnan(b) && get_payload(a) == get_payload(b);
+        return a == b;
+    };
+
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> valueDist(0, 99);
+    const double ThresholdMin = 10.0;
+    const double ThresholdMax = 80.0;
+
+    auto make_input = [&] (s32 size)
+    {
+        std::vector<double> result(size);
+
+        for (auto &p: result)
+        {
+            switch (valueDist(rng) % 8)
+            {
+                case 0: p = invalid_param(); break;
+                // NaN without the invalid bit is a valid parameter.
+                case 1: p = make_quiet_nan(); break;
+                case 2: p = valueDist(rng) % 2 ? inf() : -inf(); break;
+                default: p = valueDist(rng); break;
+            }
+        }
+
+        return result;
+    };
+
+    auto scalar = get_kernel_table(InstructionSet::Scalar);
+    ASSERT_NE(scalar, nullptr);
+    auto table = get_kernel_table(is);
+
+    if (!table)
+        GTEST_SKIP() << "instruction set " << to_string(is) << " not available";
+
+    ASSERT_EQ(table->instructionSet, is);
+
+    // Sizes cover empty inputs, the vector loops and the scalar tails.
+    for (s32 size = 0; size < 40; size++)
+    {
+        SCOPED_TRACE(size);
+        auto a = make_input(size);
+        auto b = make_input(size);
+        std::vector<double> inMin(size, 5.0), outMin(size, -1.0), factors(size, 0.5);
+        std::vector<double> expected(size), actual(size);
+
+        scalar->calibrate(a.data(), inMin.data(), outMin.data(), factors.data(), expected.data(), size);
+        table->calibrate(a.data(), inMin.data(), outMin.data(), factors.data(), actual.data(), size);
+
+        for (s32 i = 0; i < size; i++)
+        {
+            ASSERT_TRUE(same_param(expected[i], actual[i]));
+            ASSERT_EQ(is_param_valid(a[i]), is_param_valid(actual[i]));
+        }
+
+        for (bool invert: { false, true })
+        {
+            scalar->range_filter(a.data(), expected.data(), size, ThresholdMin, ThresholdMax, invert);
+            table->range_filter(a.data(), actual.data(), size, ThresholdMin, ThresholdMax, invert);
+
+            for (s32 i = 0; i < size; i++)
+            {
+                ASSERT_TRUE(same_param(expected[i], actual[i]));
+                bool inside = ThresholdMin <= a[i] && a[i] < ThresholdMax;
+                ASSERT_EQ(is_param_valid(actual[i]), inside != invert && is_param_valid(a[i]));
+            }
+        }
+
+        for (u32 eq = 0; eq < BinaryEquationCount; eq++)
+        {
+            scalar->binary_equation[eq](a.data(), b.data(), expected.data(), size);
+            table->binary_equation[eq](a.data(), b.data(), actual.data(), size);
+
+            for (s32 i = 0; i < size; i++)
+            {
+                ASSERT_TRUE(same_param(expected[i], actual[i]));
+                ASSERT_EQ(is_param_valid(actual[i]), is_param_valid(a[i]) && is_param_valid(b[i]));
+            }
+        }
+
+        auto sum0 = scalar->sum(a.data(), size, ThresholdMin, ThresholdMax);
+        auto sum1 = table->sum(a.data(), size, ThresholdMin, ThresholdMax);
+        ASSERT_EQ(sum0.count, sum1.count);
+        // Integer values, the sums are exact.
+        ASSERT_EQ(sum0.value, sum1.value);
+
+        auto min0 = scalar->min(a.data(), size, ThresholdMin, ThresholdMax);
+        auto min1 = table->min(a.data(), size, ThresholdMin, ThresholdMax);
+        ASSERT_EQ(min0.count, min1.count);
+        ASSERT_EQ(min0.value, min1.value);
+
+        auto max0 = scalar->max(a.data(), size, ThresholdMin, ThresholdMax);
+        auto max1 = table->max(a.data(), size, ThresholdMin, ThresholdMax);
+        ASSERT_EQ(max0.count, max1.count);
+        ASSERT_EQ(max0.value, max1.value);
+
+        if (sum0.count)
+        {
+            double mean = sum0.value / sum0.count;
+            double sq0 = scalar->sum_of_squares(a.data(), size, ThresholdMin, ThresholdMax, mean);
+            double sq1 = table->sum_of_squares(a.data(), size, ThresholdMin, ThresholdMax, mean);
+            ASSERT_NEAR(sq0, sq1, sq0 * 1e-12);
+        }
+    }
+}
+
+TEST(A2, simd_kernels_sse42)
+{
+    check_simd_kernel_table(a2::simd::InstructionSet::SSE42);
+}
+
+TEST(A2, simd_kernels_avx2)
+{
+    check_simd_kernel_table(a2::simd::InstructionSet::AVX2);
+}
+
+TEST(A2, simd_kernels_avx512)
+{
+    check_simd_kernel_table(a2::simd::InstructionSet::AVX512);
+}
+
+TEST(A2, simd_kernels)
+{
+    using namespace a2;
+    using namespace a2::simd;
+
+    auto scalar = get_kernel_table(InstructionSet::Scalar);
+    ASSERT_NE(scalar, nullptr);
+    ASSERT_EQ(scalar->instructionSet, InstructionSet::Scalar);
+
+    // The operators produce the same results with every instruction set.
+    {
+        static double inputData[] =
+        {
+            0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0,
+            8.0, 9.0, 10.0, 11.0, 12.0, invalid_param() /* @[13] */, 14.0, 15.0,
+            16.0, 17.0, 18.0,
+        };
+        const s32 inputSize = sizeof(inputData) / sizeof(*inputData);
+        const s32 invalidIndex = 13;
+
+        memory::Arena arena(Kilobytes(256));
+
+        PipeVectors input =
+        {
+            ParamVec{inputData, inputSize},
+            push_param_vector(&arena, inputSize, 0.0),
+            push_param_vector(&arena, inputSize, 20.0),
+        };
+
+        auto calib = make_calibration(&arena, input, 0.0, 200.0);
+        auto sum = make_aggregate_sum(&arena, input, { 2.0, 17.0 });
+        auto max = make_aggregate_max(&arena, input, { 2.0, 17.0 });
+
+        const auto defaultInstructionSet = get_instruction_set();
+
+        for (u8 isIndex = 0; isIndex < InstructionSetCount; isIndex++)
+        {
+            if (!set_instruction_set(static_cast<InstructionSet>(isIndex)))
+                continue;
+
+            SCOPED_TRACE(to_string(get_instruction_set()));
+
+            calibration_step(&calib);
+            aggregate_sum_step(&sum);
+            aggregate_max_step(&max);
+
+            for (s32 i = 0; i < inputSize; i++)
+            {
+                if (i == invalidIndex)
+                    ASSERT_FALSE(is_param_valid(calib.outputs[0][i]));
+                else
+                    ASSERT_EQ(calib.outputs[0][i], inputData[i] * 10.0);
+            }
+
+            // 2 + 3 + ... + 17 without 13
+            ASSERT_EQ(sum.outputs[0][0], (17 * 18 / 2 - 1) - 13);
+            ASSERT_EQ(max.outputs[0][0], 17.0);
+        }
+
+        ASSERT_TRUE(set_instruction_set(defaultInstructionSet));
+    }
+}
+
+TEST(A2, waveform_features)
+{
+    using namespace a2;
+
+    // Baseline of 100, linear rise to 1100 between samples 10 and 14,
+    // exponential decay back to the baseline.
+    const s32 SampleCount = 48;
+    std::vector<double> pulse(SampleCount);
+
+    for (s32 i = 0; i < SampleCount; ++i)
+    {
+        if (i <= 10)
+            pulse[i] = 100.0;
+        else if (i <= 14)
+            pulse[i] = 100.0 + (i - 10) * 250.0;
+        else
+            pulse[i] = 100.0 + 1000.0 * std::exp(-(i - 14) / 8.0);
+    }
+
+    WaveformFeaturesParameters params;
+    params.baselineSamples = 8;
+    params.cfdFraction = 0.5;
+    params.cfdDelay = 2;
+    params.dtSample = 10.0;
+
+    auto features = extract_waveform_features(pulse.data(), SampleCount, params);
+
+    double expectedIntegral = 0.0;
+    for (double v: pulse)
+        expectedIntegral += v - 100.0;
+
+    ASSERT_DOUBLE_EQ(features.baseline, 100.0);
+    ASSERT_DOUBLE_EQ(features.amplitude, 1000.0);
+    ASSERT_NEAR(features.integral, expectedIntegral, 1e-6);
+    // 10% at 10.4, 90% at 13.6
+    ASSERT_NEAR(features.riseTime, 3.2, 1e-9);
+    // cfd[i] = 0.5 * x[i] - x[i-2] on the leading edge: cfd[12] = 250,
+    // cfd[13] = 125, cfd[14] = 0 => zero crossing at sample 14.
+    ASSERT_NEAR(features.cfdTime, 14.0, 1e-9);
+
+    // CFD timing does not depend on the amplitude.
+    std::vector<double> half(pulse);
+    for (auto &v: half)
+        v = 100.0 + (v - 100.0) * 0.5;
+    ASSERT_NEAR(extract_waveform_features(half.data(), SampleCount, params).cfdTime, features.cfdTime, 1e-9);
+
+    // Flat trace: no pulse, only baseline and integral are valid.
+    {
+        std::vector<double> flat(SampleCount, 42.0);
+        auto f = extract_waveform_features(flat.data(), SampleCount, params);
+        ASSERT_DOUBLE_EQ(f.baseline, 42.0);
+        ASSERT_DOUBLE_EQ(f.integral, 0.0);
+        ASSERT_FALSE(is_param_valid(f.riseTime));
+        ASSERT_FALSE(is_param_valid(f.cfdTime));
+    }
+
+    // Too short for the baseline
+    ASSERT_FALSE(is_param_valid(extract_waveform_features(pulse.data(), 8, params).baseline));
+
+    // Operator with two channels. The second trace is shifted by two samples
+    // and has trailing invalid parameters. Phase correction is done for the
+    // second channel only as only its config has the NoResampling bit set.
+    memory::Arena arena(Megabytes(1));
+    const s32 ArraySize = 64;
+
+    auto make_pipe = [&arena] (s32 size, double lower, double upper)
+    {
+        return PipeVectors
+        {
+            push_param_vector(&arena, size, invalid_param()),
+            push_param_vector(&arena, size, lower),
+            push_param_vector(&arena, size, upper),
+        };
+    };
+
+    std::vector<PipeVectors> inputs =
+    {
+        make_pipe(2, 0.0, 1.0),
+        make_pipe(2, 0.0, 1 << 10),
+        make_pipe(ArraySize, -8192.0, 8191.0),
+        make_pipe(ArraySize, -8192.0, 8191.0),
+    };
+
+    inputs[0].data[0] = 0.25;
+    inputs[0].data[1] = 0.25;
+    inputs[1].data[0] = 0.0;
+    inputs[1].data[1] = mesytec::mvme::mdpp_sampling::SamplingSettings::NoResampling;
+
+    std::copy(pulse.begin(), pulse.end(), inputs[2].data.begin());
+    inputs[3].data[0] = inputs[3].data[1] = 100.0;
+    std::copy(pulse.begin(), pulse.end(), inputs[3].data.begin() + 2);
+
+    auto op = make_waveform_features(&arena, inputs, params);
+
+    ASSERT_EQ(op.outputCount, WaveformFeature_Count);
+    ASSERT_EQ(op.outputs[WaveformFeature_CfdTime].size, 2);
+    ASSERT_EQ(op.outputUpperLimits[WaveformFeature_Amplitude][0], 8191.0 + 8192.0);
+
+    auto a2 = arena.pushObject<A2>(&arena);
+    a2->operators[0] = arena.pushArray<Operator>(1);
+    a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(1);
+    a2->operators[0][0] = op;
+    a2->operatorRanks[0][0] = 1;
+    a2->operatorCounts[0] = 1;
+
+    a2_end_event(a2, 0);
+
+    const auto &amplitudes = op.outputs[WaveformFeature_Amplitude];
+    const auto &riseTimes = op.outputs[WaveformFeature_RiseTime];
+    const auto &cfdTimes = op.outputs[WaveformFeature_CfdTime];
+
+    ASSERT_DOUBLE_EQ(amplitudes[0], 1000.0);
+    ASSERT_DOUBLE_EQ(amplitudes[1], 1000.0);
+    ASSERT_NEAR(riseTimes[0], 32.0, 1e-9);
+    ASSERT_NEAR(riseTimes[1], 32.0, 1e-9);
+    ASSERT_NEAR(cfdTimes[0], 140.0, 1e-9);
+    ASSERT_NEAR(cfdTimes[1], (16.0 + 0.75) * 10.0, 1e-9);
+
+    params.phaseCorrection = WaveformPhaseCorrection::Off;
+    a2->operators[0][0] = make_waveform_features(&arena, inputs, params);
+    a2_end_event(a2, 0);
+    ASSERT_NEAR(a2->operators[0][0].outputs[WaveformFeature_CfdTime][1], 160.0, 1e-9);
+}
+
+TEST(A2, export_sink_writer)
+{
+    using namespace a2;
+
+    memory::Arena arena(Megabytes(4));
+
+    // Enough data to cycle through all writer chunks multiple times.
+    const s32 ParamCount = 1000;
+    const u32 EventCount = 4 * ExportSinkData::WriterChunkCount * ExportSinkData::WriterChunkSize
+        / (ParamCount * sizeof(double));
+    const std::string filename = "test_a2_export_sink.bin";
+
+    auto a2 = arena.pushObject<A2>(&arena);
+    a2->operators[0] = arena.pushArray<Operator>(1);
+    a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(1);
+
+    auto input = push_param_vector(&arena, ParamCount);
+    PipeVectors inPipe =
+    {
+        input,
+        push_param_vector(&arena, ParamCount, 0.0),
+        push_param_vector(&arena, ParamCount, 1u << 20),
+    };
+
+    auto dataInputs = push_typed_block<PipeVectors, s32>(&arena, 1);
+    dataInputs[0] = inPipe;
+
+    a2->operators[0][0] = make_export_sink(&arena, filename, 0, ExportSinkFormat::Full, dataInputs);
+    a2->operatorRanks[0][0] = 1;
+    a2->operatorCounts[0] = 1;
+
+    auto d = reinterpret_cast<ExportSinkData *>(a2->operators[0][0].d);
+
+    a2_begin_run(a2, [] (const std::string &) {});
+    ASSERT_TRUE(d->getLastError().empty());
+
+    for (u32 eventIndex = 0; eventIndex < EventCount; ++eventIndex)
+    {
+        for (s32 i = 0; i < ParamCount; ++i)
+            input[i] = eventIndex * ParamCount + i;
+
+        a2_end_event(a2, 0);
+    }
+
+    a2_end_run(a2);
+
+    ASSERT_EQ(d->eventsWritten, EventCount);
+    ASSERT_EQ(d->bytesWritten, EventCount * ParamCount * sizeof(double));
+    ASSERT_EQ(d->writerQueueFill, 0u);
+    ASSERT_TRUE(d->getLastError().empty());
+
+    std::ifstream in(filename, std::ios::binary);
+    std::vector<double> buffer(ParamCount);
+
+    for (u32 eventIndex = 0; eventIndex < EventCount; ++eventIndex)
+    {
+        in.read(reinterpret_cast<char *>(buffer.data()), ParamCount * sizeof(double));
+        ASSERT_TRUE(in.good());
+
+        for (s32 i = 0; i < ParamCount; ++i)
+            ASSERT_EQ(buffer[i], eventIndex * ParamCount + i);
+    }
+
+    ASSERT_EQ(in.peek(), std::ifstream::traits_type::eof());
+    in.close();
+    std::remove(filename.c_str());
+}
+
+TEST(A2, fused_extraction)
+{
+    using namespace a2;
+    using namespace a2::data_filter;
+
+    struct SourceSetup
+    {
+        std::vector<DataFilter> subfilters;
+        u32 requiredCompletions;
+        int moduleIndex;
+    };
+
+    const std::vector<SourceSetup> setups =
+    {
+        { { make_filter("0001 XXXX XXXX AAAA DDDD DDDD DDDD DDDD") }, 1, 0 },
+        { { make_filter("0001 XXXX XXX1 AAAA DDDD DDDD DDDD DDDD") }, 1, 0 },
+        { { make_filter("0010 XXXX XXXX XXXA DDDD DDDD DDDD DDDD") }, 2, 0 },
+        // Two words, the second one has to follow the first one.
+        { { make_filter("0011 XXXX XXXX XXAA XXXX XXXX DDDD DDDD"),
+            make_filter("0011 XXXX XXXX XXXX XXXX XXXX XXXX DDDD") }, 1, 0 },
+        // Only matches the first word of the module data.
+        { { make_filter("XXXX XXXX XXXX XXXX XXXX XXXX DDDD DDDD", 0) }, 1, 0 },
+        { { make_filter("0001 XXXX XXXX AAAA DDDD DDDD DDDD DDDD") }, 1, 1 },
+        { { make_filter("11DD DDDD DDDD DDDD DDDD DDDD DDDD DDDD") }, 1, 1 },
+    };
+
+    auto build = [&setups] (memory::Arena *arena, bool fused)
+    {
+        auto a2 = arena->pushObject<A2>(arena);
+        a2->dataSources[0] = arena->pushArray<DataSource>(setups.size());
+
+        for (size_t si = 0; si < setups.size(); si++)
+        {
+            const auto &setup = setups[si];
+            MultiWordFilter filter;
+
+            for (const auto &subfilter: setup.subfilters)
+                add_subfilter(&filter, subfilter);
+
+            a2->dataSources[0][a2->dataSourceCounts[0]++] = make_datasource_extractor(
+                arena, filter, setup.requiredCompletions, 1234 + si, setup.moduleIndex);
+        }
+
+        if (fused)
+            a2_build_fused_extractors(a2, arena);
+
+        return a2;
+    };
+
+    memory::Arena arenaSerial(Kilobytes(256));
+    memory::Arena arenaFused(Kilobytes(256));
+    auto a2Serial = build(&arenaSerial, false);
+    auto a2Fused = build(&arenaFused, true);
+
+    ASSERT_EQ(a2Serial->fusedExtractors[0], nullptr);
+    ASSERT_NE(a2Fused->fusedExtractors[0], nullptr);
+    ASSERT_EQ(a2Fused->fusedExtractors[0][0].sourceCount, 5);
+    ASSERT_EQ(a2Fused->fusedExtractors[0][0].entryCount, 6);
+    ASSERT_EQ(a2Fused->fusedExtractors[0][1].sourceCount, 2);
+    ASSERT_EQ(a2Fused->fusedExtractors[0][2].sourceCount, 0);
+    ASSERT_EQ(a2Fused->fusedExtractors[1], nullptr);
+
+    std::mt19937 rng(42);
+    const u32 prefixes[] = { 0x1, 0x2, 0x3, 0x4, 0xc, 0xf };
+    std::uniform_int_distribution<size_t> prefixDist(0, std::size(prefixes) - 1);
+    std::uniform_int_distribution<u32> lowDist(0, 0x0fffffffu);
+    std::uniform_int_distribution<u32> sizeDist(0, 40);
+
+    auto outputs_equal = [] (const ParamVec &a, const ParamVec &b)
+    {
+        return a.size == b.size
+            && std::memcmp(a.data, b.data, a.size * sizeof(double)) == 0;
+    };
+
+    std::vector<size_t> validCounts(setups.size());
+
+    for (int event = 0; event < 2000; event++)
+    {
+        a2_begin_event(a2Serial, 0);
+        a2_begin_event(a2Fused, 0);
+
+        for (int mi = 0; mi < 2; mi++)
+        {
+            std::vector<u32> data(sizeDist(rng));
+
+            for (auto &word: data)
+                word = (prefixes[prefixDist(rng)] << 28) | lowDist(rng);
+
+            a2_process_module_data(a2Serial, 0, mi, data.data(), data.size());
+            a2_process_module_data(a2Fused, 0, mi, data.data(), data.size());
+        }
+
+        for (size_t si = 0; si < setups.size(); si++)
+        {
+            auto &dsSerial = a2Serial->dataSources[0][si];
+            auto &dsFused = a2Fused->dataSources[0][si];
+
+            ASSERT_TRUE(outputs_equal(dsSerial.outputs[0], dsFused.outputs[0]))
+                << "event=" << event << ", source=" << si;
+            ASSERT_TRUE(outputs_equal(dsSerial.hitCounts[0], dsFused.hitCounts[0]))
+                << "event=" << event << ", source=" << si;
+
+            for (s32 i = 0; i < dsFused.outputs[0].size; i++)
+                validCounts[si] += is_param_valid(dsFused.outputs[0][i]);
+        }
+    }
+
+    for (size_t si = 0; si < setups.size(); si++)
+        ASSERT_GT(validCounts[si], 0u) << "source=" << si;
+
+    // Without the tables the per-extractor path is used again.
+    a2_clear_fused_extractors(a2Fused);
+    ASSERT_EQ(a2Fused->fusedExtractors[0], nullptr);
+}
+
+TEST(A2, polygon_condition_raster)
+{
+    using namespace a2;
+
+    namespace bg = boost::geometry;
+    using Point = bg::model::d2::point_xy<double>;
+    using Polygon = bg::model::polygon<Point, true, true>;
+
+    const std::vector<std::vector<std::pair<double, double>>> polygons =
+    {
+        // concave star with 7 spikes
+        {
+            { 29.097, 87.6274 }, { 41.6945, 60.5531 }, { 44.2586, 91.8486 }, { 47.7146, 62.2999 },
+            { 66.4437, 87.6274 }, { 51.6165, 58.952 }, { 81.0479, 44.2504 }, { 50.1672, 47.4527 },
+            { 52.0624, 12.0815 }, { 40.5797, 46.2882 }, { 17.1683, 19.5051 }, { 36.0089, 49.1994 },
+            { 8.47269, 52.984 }, { 35.0056, 56.3319 }, { 29.097, 87.6274 },
+        },
+
+        // self-intersecting bowtie
+        {
+            { 18.5061, 75.2547 }, { 17.6143, 55.1674 }, { 66.6667, 80.2038 },
+            { 65.8863, 54.294 }, { 18.5061, 75.2547 },
+        },
+
+        // axis aligned square, edges on cell boundaries
+        {
+            { 0.0, 0.0 }, { 0.0, 16.0 }, { 16.0, 16.0 }, { 16.0, 0.0 }, { 0.0, 0.0 },
+        },
+    };
+
+    // Default resolution, coarse and histogram-like fine cells.
+    const std::vector<std::pair<double, double>> cellWidths =
+    {
+        { 0.0, 0.0 }, { 8.0, 8.0 }, { 1.0, 1.0 }, { 100.0 / 1024, 100.0 / 1024 },
+    };
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> coordDist(-10.0, 110.0);
+
+    for (const auto &outline: polygons)
+    {
+        // Test points: random, the vertices and points on the edges.
+        std::vector<std::pair<double, double>> points;
+
+        for (int i = 0; i < 20000; i++)
+            points.push_back({ coordDist(rng), coordDist(rng) });
+
+        for (size_t i = 0; i + 1 < outline.size(); i++)
+        {
+            auto p0 = outline[i], p1 = outline[i + 1];
+            points.push_back(p0);
+            points.push_back({ (p0.first + p1.first) * 0.5, (p0.second + p1.second) * 0.5 });
+        }
+
+        points.push_back({ make_quiet_nan(), 50.0 });
+
+        for (const auto &cw: cellWidths)
+        {
+            memory::Arena arena(Kilobytes(64));
+
+            auto a2 = arena.pushObject<A2>(&arena);
+            a2->conditionBits.resize(1);
+
+            PipeVectors xInput = { push_param_vector(&arena, 1), push_param_vector(&arena, 1, 0.0), push_param_vector(&arena, 1, 100.0) };
+            PipeVectors yInput = { push_param_vector(&arena, 1), push_param_vector(&arena, 1, 0.0), push_param_vector(&arena, 1, 100.0) };
+
+            a2->operators[0] = arena.pushArray<Operator>(1);
+            a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(1);
+            a2->operators[0][0] = make_polygon_condition(&arena, xInput, yInput, 0, 0, outline, cw.first, cw.second);
+            a2->operatorRanks[0][0] = 1;
+            a2->operatorCounts[0] = 1;
+
+            auto &op = a2->operators[0][0];
+            reinterpret_cast<ConditionBaseData *>(op.d)->bitIndex = 0;
+
+            Polygon polygon;
+
+            for (const auto &p: outline)
+                bg::append(polygon, Point{p.first, p.second});
+
+            auto exactTest = [&polygon] (double x, double y) { return bg::within(Point{x, y}, polygon); };
+            auto raster = make_polygon_raster(outline, cw.first, cw.second, exactTest);
+            size_t insideCells = std::count(raster.cells.begin(), raster.cells.end(), PolygonRaster::Inside);
+
+            ASSERT_GT(raster.cellsX, 0);
+            ASSERT_GT(raster.cellsY, 0);
+            ASSERT_LE(raster.cellsX, PolygonRaster::MaxCellsPerAxis);
+            ASSERT_LE(raster.cellsY, PolygonRaster::MaxCellsPerAxis);
+
+            if (cw.first == 1.0)
+            {
+                ASSERT_GT(insideCells, 0u);
+            }
+
+            for (const auto &p: points)
+            {
+                bool expected = exactTest(p.first, p.second);
+
+                ASSERT_EQ(polygon_raster_within(raster, p.first, p.second, exactTest), expected)
+                    << "x=" << p.first << ", y=" << p.second;
+
+                xInput.data[0] = p.first;
+                yInput.data[0] = p.second;
+                a2_end_event(a2, 0);
+
+                ASSERT_EQ(op.outputs[0][0], expected ? 1.0 : 0.0)
+                    << "x=" << p.first << ", y=" << p.second;
+                ASSERT_EQ(a2->conditionBits.test(0), expected);
+            }
+        }
+    }
+}
+
+TEST(A2, condition_bitset)
+{
+    using namespace a2;
+
+    memory::Arena arena(Kilobytes(4));
+    ConditionBitset bits((ConditionBitset::Allocator(&arena)));
+
+    bits.resize(130);
+    ASSERT_EQ(bits.size(), 130u);
+    ASSERT_EQ(bits.wordCount(), 3u);
+
+    for (size_t i = 0; i < bits.size(); i++)
+        ASSERT_FALSE(bits.test(i));
+
+    bits.set(0);
+    bits.set(64);
+    bits.set(129, true);
+    bits.set(65, false);
+
+    ASSERT_TRUE(bits.test(0));
+    ASSERT_TRUE(bits.test(64));
+    ASSERT_TRUE(bits.test(129));
+    ASSERT_FALSE(bits.test(65));
+    ASSERT_EQ(bits.words()[1], 1u);
+
+    bits.set(64, false);
+    ASSERT_FALSE(bits.test(64));
+
+    bits.reset();
+
+    for (size_t i = 0; i < bits.wordCount(); i++)
+        ASSERT_EQ(bits.words()[i], 0u);
+}
+
+TEST(A2, condition_gates)
+{
+    using namespace a2;
+
+    const int ConditionCount = 130; // spans three bitset words
+    const int GatedOperatorCount = 300;
+
+    memory::Arena arena(Megabytes(1));
+
+    auto input = push_param_vector(&arena, 1);
+    PipeVectors inPipe =
+    {
+        input,
+        push_param_vector(&arena, 1, 0.0),
+        push_param_vector(&arena, 1, 100.0),
+    };
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> valueDist(0.0, 100.0);
+    std::uniform_int_distribution<int> condDist(0, ConditionCount - 1);
+    std::uniform_int_distribution<int> condCountDist(0, 3);
+
+    std::vector<Interval> intervals;
+
+    for (int i = 0; i < ConditionCount; i++)
+    {
+        double a = valueDist(rng), b = valueDist(rng);
+        intervals.push_back({ std::min(a, b) * 0.5, std::max(a, b) * 1.5 });
+    }
+
+    // The condition bits of each gated operator. Operators share a small
+    // number of distinct condition sets so that groups are formed.
+    std::vector<std::vector<u16>> conditionSets(20);
+
+    for (auto &cs: conditionSets)
+    {
+        for (int i = condCountDist(rng); i > 0; i--)
+            cs.push_back(condDist(rng));
+
+        std::sort(cs.begin(), cs.end());
+        cs.erase(std::unique(cs.begin(), cs.end()), cs.end());
+    }
+
+    auto make_a2 = [&] ()
+    {
+        const int opCount = ConditionCount + GatedOperatorCount;
+        auto a2 = arena.pushObject<A2>(&arena);
+        a2->operators[0] = arena.pushArray<Operator>(opCount);
+        a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(opCount);
+        a2->conditionBits.resize(ConditionCount);
+
+        auto &count = a2->operatorCounts[0];
+
+        for (int ci = 0; ci < ConditionCount; ci++)
+        {
+            auto op = make_interval_condition(&arena, inPipe, { intervals[ci] });
+            reinterpret_cast<ConditionBaseData *>(op.d)->bitIndex = ci;
+            a2->operators[0][count] = op;
+            a2->operatorRanks[0][count] = 1;
+            ++count;
+        }
+
+        for (int oi = 0; oi < GatedOperatorCount; oi++)
+        {
+            auto op = make_calibration(&arena, inPipe, 0.0, 1.0 + oi);
+            op.conditionBitIndexes = push_copy_typed_block<u16>(
+                &arena, conditionSets[oi % conditionSets.size()]);
+            a2->operators[0][count] = op;
+            a2->operatorRanks[0][count] = 2 + oi / 100;
+            ++count;
+        }
+
+        return a2;
+    };
+
+    auto a2Plain = make_a2();
+    auto a2Gated = make_a2();
+
+    a2_build_condition_gates(a2Gated, &arena);
+
+    const auto &gates = a2Gated->operatorGates[0];
+    ASSERT_GT(gates.size, 0);
+    ASSERT_LT(gates.size, ConditionCount + GatedOperatorCount);
+
+    size_t groupedOps = 0;
+
+    for (const auto &group: gates)
+        groupedOps += group.operatorIndexes.size;
+
+    ASSERT_EQ(groupedOps, static_cast<size_t>(ConditionCount + GatedOperatorCount));
+
+    size_t steppedCount = 0, skippedCount = 0;
+
+    for (int event = 0; event < 1000; event++)
+    {
+        input[0] = valueDist(rng);
+
+        a2_end_event(a2Plain, 0);
+        a2_end_event(a2Gated, 0);
+
+        for (int ci = 0; ci < ConditionCount; ci++)
+            ASSERT_EQ(a2Plain->conditionBits.test(ci), a2Gated->conditionBits.test(ci));
+
+        for (int oi = 0; oi < ConditionCount + GatedOperatorCount; oi++)
+        {
+            const auto &outPlain = a2Plain->operators[0][oi].outputs[0];
+            const auto &outGated = a2Gated->operators[0][oi].outputs[0];
+
+            ASSERT_EQ(std::memcmp(outPlain.data, outGated.data, outPlain.size * sizeof(double)), 0)
+                << "event=" << event << ", op=" << oi;
+
+            if (oi >= ConditionCount)
+                is_param_valid(outGated[0]) ? ++steppedCount : ++skippedCount;
+        }
+    }
+
+    ASSERT_GT(steppedCount, 0u);
+    ASSERT_GT(skippedCount, 0u);
+
+    a2_clear_condition_gates(a2Gated);
+    ASSERT_EQ(a2Gated->operatorGates[0].size, 0);
+}
+
+TEST(A2, cost_accounting)
+{
+    using namespace a2;
+
+    const int ConditionCount = 10;
+    const int GatedOperatorCount = 100;
+    const int OpCount = ConditionCount + GatedOperatorCount;
+    const u64 EventCount = 500;
+
+    memory::Arena arena(Megabytes(1));
+
+    auto input = push_param_vector(&arena, 1);
+    PipeVectors inPipe =
+    {
+        input,
+        push_param_vector(&arena, 1, 0.0),
+        push_param_vector(&arena, 1, 100.0),
+    };
+
+    auto make_a2 = [&] ()
+    {
+        auto a2 = arena.pushObject<A2>(&arena);
+        a2->operators[0] = arena.pushArray<Operator>(OpCount);
+        a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(OpCount);
+        a2->conditionBits.resize(ConditionCount);
+
+        auto &count = a2->operatorCounts[0];
+
+        for (int ci = 0; ci < ConditionCount; ci++)
+        {
+            auto op = make_interval_condition(&arena, inPipe, { { ci * 10.0, ci * 10.0 + 30.0 } });
+            reinterpret_cast<ConditionBaseData *>(op.d)->bitIndex = ci;
+            a2->operators[0][count] = op;
+            a2->operatorRanks[0][count] = 1;
+            ++count;
+        }
+
+        for (int oi = 0; oi < GatedOperatorCount; oi++)
+        {
+            auto op = make_calibration(&arena, inPipe, 0.0, 1.0 + oi);
+            std::vector<u16> condBits = { static_cast<u16>(oi % ConditionCount) };
+            op.conditionBitIndexes = push_copy_typed_block<u16>(&arena, condBits);
+            a2->operators[0][count] = op;
+            a2->operatorRanks[0][count] = 2;
+            ++count;
+        }
+
+        return a2;
+    };
+
+    // The serial, the condition gated and the parallel operator paths must
+    // produce the same step and skip counts.
+    auto a2Serial = make_a2();
+    auto a2Gated = make_a2();
+    auto a2Parallel = make_a2();
+
+    a2_build_condition_gates(a2Gated, &arena);
+    a2_set_operator_thread_count(a2Parallel, 4);
+
+    for (auto a2: { a2Serial, a2Gated, a2Parallel })
+    {
+        a2_set_cost_accounting(a2, true);
+        a2_begin_run(a2, {});
+    }
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> valueDist(0.0, 100.0);
+    std::vector<u64> expectedSteps(OpCount, 0);
+
+    for (u64 event = 0; event < EventCount; event++)
+    {
+        input[0] = valueDist(rng);
+
+        for (auto a2: { a2Serial, a2Gated, a2Parallel })
+            a2_end_event(a2, 0);
+
+        for (int oi = 0; oi < OpCount; oi++)
+        {
+            if (oi < ConditionCount || is_param_valid(a2Serial->operators[0][oi].outputs[0][0]))
+                ++expectedSteps[oi];
+        }
+    }
+
+    for (auto a2: { a2Serial, a2Gated, a2Parallel })
+    {
+        const auto &costs = a2->costs->operators[0];
+        ASSERT_EQ(costs.size(), static_cast<size_t>(OpCount));
+
+        for (int oi = 0; oi < OpCount; oi++)
+        {
+            ASSERT_EQ(costs[oi].steps, expectedSteps[oi]) << "op=" << oi;
+            ASSERT_EQ(costs[oi].steps + costs[oi].conditionSkips, EventCount) << "op=" << oi;
+        }
+    }
+
+    a2_set_operator_thread_count(a2Parallel, 0);
+}
@@ -23,7 +23,9 @@
 #include "a2_impl.h"
 #include "util/sizes.h"
 
+#include <cstdlib>
 #include <iostream>
+#include <random>
 
 using namespace a2;
 using namespace memory;
@@ -276,3 +278,272 @@ TEST(a2ExpressionOperator, OutputSpecifications)
             ExpressionOperatorSemanticError);
     }
 }
+
+namespace
+{
+
+bool native_expressions_available()
+{
+    if (!expr_codegen::is_supported())
+        return false;
+
+    auto cmd = expr_codegen::get_options().compiler + " --version > /dev/null 2>&1";
+    return std::system(cmd.c_str()) == 0;
+}
+
+// The exprtk strength reduction reassociates some operations, e.g.
+// (a / b) / c becomes a / (b * c), so finite values may differ in the last
+// bits. NaNs have to match including the invalid marker.
+void expect_same_value(double exprtkValue, double nativeValue)
+{
+    if (std::isnan(exprtkValue))
+    {
+        EXPECT_TRUE(std::isnan(nativeValue)) << "native=" << nativeValue;
+        EXPECT_EQ(is_param_valid(exprtkValue), is_param_valid(nativeValue));
+    }
+    else if (std::isinf(exprtkValue))
+    {
+        EXPECT_EQ(exprtkValue, nativeValue);
+    }
+    else
+    {
+        EXPECT_NEAR(exprtkValue, nativeValue, 1e-12 * std::max(1.0, std::abs(exprtkValue)));
+    }
+}
+
+double random_param(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<double> dist(-10.0, 10.0);
+    std::uniform_int_distribution<int> kind(0, 9);
+
+    switch (kind(rng))
+    {
+        case 0: return invalid_param();
+        case 1: return 0.0;
+        case 2: return std::round(dist(rng)); // exercises equality tests
+        default: return dist(rng);
+    }
+}
+
+} // end anon namespace
+
+TEST(a2ExpressionOperator, NativeBackendConsistency)
+{
+    if (!native_expressions_available())
+        GTEST_SKIP() << "No compiler available for native expressions";
+
+    static const char *const ExprBegin =
+        "make_static('counter', 0);"
+        "make_static('sums', 4, 0.0);"
+        "return ["
+        "   'output0', input0.unit, input0.size, input0.lower_limits, input0.upper_limits,"
+        "   'output1', 'things', 4, 0, 100"
+        "];";
+
+    static const char *const StepExpressions[] =
+    {
+        // loops, if/else and the runtime library
+        "for (var i := 0; i < input0[]; i += 1)\n"
+        "{\n"
+        "    if (is_valid(input0[i]))\n"
+        "        output0[i] := input0[i] * 1.5 + 0.25 * i - (input0[i] / 3) ^ 2;\n"
+        "    else\n"
+        "        output0[i] := make_invalid();\n"
+        "}\n"
+        "output1 := valid_or(input2, -1);\n",
+
+        // operator precedence, ternary, comparison and logic operators
+        "for (var i := 0; i < output0[]; i += 1) {\n"
+        "    var x := valid_or(input0[i], -1);\n"
+        "    var y := valid_or(input1[i % input1[]], 2);\n"
+        "    output0[i] := x > 3 and y <= 2 ? -x^2 + y * -3 : x - y - 1 / (y + 11) / 3;\n"
+        "    output0[i] += (x = y) + (x != 2) - (x <> y) * 2 + (x >= 0 & y < 0) + (x < -5 | y == 1);\n"
+        "    output0[i] -= (x nand y) + (x nor y) * 2 + (x xor y) * 4 + (x xnor y) * 8 + (x or y);\n"
+        "    output0[i] *= x < 0 ? 2 : y > 0 ? 3 : 4;\n"
+        "};\n"
+        "output1[0] := output0[0] % 3;\n"
+        "output1[1] := -output0[1] % -4;\n"
+        "output1[2] := 2^3^0.5;\n"
+        "output1[3] := input2 + +2 - - 3;\n",
+
+        // math functions
+        "for (var i := 0; i < input0[]; i += 1)\n"
+        "{\n"
+        "    var x := valid_or(input0[i], 0.5);\n"
+        "    output0[i] := sqrt(abs(x)) + exp(x / 10) + log(abs(x) + 1) + log10(abs(x) + 1)\n"
+        "        + log2(abs(x) + 1) + sin(x) * cos(x) - tan(x / 20) + atan2(x, 3)\n"
+        "        + asin(x / 11) + acos(x / 11) + atan(x) + sinh(x / 10) + cosh(x / 10) + tanh(x)\n"
+        "        + floor(x) * ceil(x) + round(x) + trunc(x) + frac(x) + sgn(x) + not(x)\n"
+        "        + pow(abs(x), 1.5) + hypot(x, 2) + clamp(-2, x, 2) + inrange(-1, x, 1)\n"
+        "        + min(x, 1) + max(x, 1, 2) + min(x, 3, -1, 2) + max(4, x, 3, 2, 1) + min(1, 2, 3, 4, 5, x)\n"
+        "        + erf(x) + erfc(x) + is_nan(input0[i]) + is_invalid(input0[i]) + pi + epsilon;\n"
+        "}\n",
+
+        // while, break, continue and static variables
+        "counter += 1;\n"
+        "var n := 0;\n"
+        "var total := 0;\n"
+        "while (true)\n"
+        "{\n"
+        "    if (n >= input0[]) break;\n"
+        "    n += 1;\n"
+        "    if (is_invalid(input0[n - 1])) { continue; };\n"
+        "    total += input0[n - 1];\n"
+        "}\n"
+        "sums[counter % sums[]] += total;\n"
+        "output0 := total / counter;\n"
+        "output0[0] := counter;\n"
+        "output1 := sums;\n",
+    };
+
+    std::mt19937 rng(1234);
+
+    for (auto exprStep: StepExpressions)
+    {
+        SCOPED_TRACE(exprStep);
+
+        Arena arena(Kilobytes(256));
+
+        const s32 inputSize0 = 16;
+        const s32 inputSize1 = 5;
+        const s32 inputSize2 = 4;
+
+        std::vector<PipeVectors> inputs = {
+            {
+                push_param_vector(&arena, inputSize0, 0.0),
+                push_param_vector(&arena, inputSize0, -10.0),
+                push_param_vector(&arena, inputSize0, 10.0),
+            },
+            {
+                push_param_vector(&arena, inputSize1, 0.0),
+                push_param_vector(&arena, inputSize1, -10.0),
+                push_param_vector(&arena, inputSize1, 10.0),
+            },
+            {
+                push_param_vector(&arena, inputSize2, 0.0),
+                push_param_vector(&arena, inputSize2, -10.0),
+                push_param_vector(&arena, inputSize2, 10.0),
+            },
+        };
+
+        std::vector<std::string> input_prefixes = { "input0", "input1", "input2" };
+        std::vector<std::string> input_units    = { "mV", "mV", "ns" };
+        std::vector<s32> input_param_indexes    = { NoParamIndex, NoParamIndex, 2 };
+
+        auto make_op = [&] ()
+        {
+            return make_expression_operator(
+                &arena, inputs, input_param_indexes, input_prefixes, input_units,
+                ExprBegin, exprStep);
+        };
+
+        auto opExprtk = make_op();
+        auto opNative = make_op();
+
+        auto d = reinterpret_cast<ExpressionOperatorData *>(opNative.d);
+        d->native_step = expr_codegen::build(d->expr_step.getExpressionString(), d->symtab_step);
+        ASSERT_TRUE(d->native_step);
+
+        for (int event = 0; event < 50; ++event)
+        {
+            for (auto &input: inputs)
+                for (s32 i = 0; i < input.data.size; i++)
+                    input.data[i] = random_param(rng);
+
+            expression_operator_step(&opExprtk);
+            expression_operator_step(&opNative);
+
+            ASSERT_EQ(opExprtk.outputCount, opNative.outputCount);
+
+            for (s32 oi = 0; oi < opExprtk.outputCount; oi++)
+            {
+                for (s32 i = 0; i < opExprtk.outputs[oi].size; i++)
+                {
+                    SCOPED_TRACE("output" + std::to_string(oi) + "[" + std::to_string(i) + "]");
+                    expect_same_value(opExprtk.outputs[oi][i], opNative.outputs[oi][i]);
+                }
+            }
+        }
+    }
+}
+
+TEST(a2ExpressionOperator, NativeBackendConditionResult)
+{
+    if (!native_expressions_available())
+        GTEST_SKIP() << "No compiler available for native expressions";
+
+    static const char *const Expressions[] =
+    {
+        "x > 0 and y < 2",
+        "x * y - 3 > x / 2 ? 1 : 0",
+        "var r := x^2 + y^2; r <= 25 & r >= 4",
+        "not(inrange(-3, x, 3)) or abs(y) < 1",
+        "min(x, y) = 0 | max(x, y) <> 5",
+    };
+
+    std::mt19937 rng(4321);
+    double x = 0.0;
+    double y = 0.0;
+
+    for (auto exprString: Expressions)
+    {
+        SCOPED_TRACE(exprString);
+
+        a2_exprtk::SymbolTable symtab;
+        symtab.addScalar("x", x);
+        symtab.addScalar("y", y);
+
+        a2_exprtk::Expression expr;
+        expr.registerSymbolTable(symtab);
+        expr.setExpressionString(exprString);
+        expr.compile();
+
+        auto native = expr_codegen::build(exprString, symtab, true);
+        ASSERT_TRUE(native);
+
+        for (int i = 0; i < 100; i++)
+        {
+            x = random_param(rng);
+            y = random_param(rng);
+            expect_same_value(expr.eval(), native.eval());
+        }
+    }
+}
+
+TEST(a2ExpressionOperator, NativeBackendUnsupported)
+{
+    double x = 0.0;
+    std::vector<double> v(4);
+    std::string s = "foo";
+
+    a2_exprtk::SymbolTable symtab;
+    symtab.addScalar("x", x);
+    symtab.addVector("v", v);
+    symtab.addString("s", s);
+
+    // Supported. Translation does not need a compiler.
+    auto translation = expr_codegen::translate("v[0] := x + v[]; x < 2", symtab);
+    ASSERT_TRUE(translation.hasResult);
+    ASSERT_EQ(translation.scalars.size(), 1u);
+    ASSERT_EQ(translation.vectors.size(), 1u);
+    ASSERT_EQ(translation.sizes[0], v.size());
+
+    ASSERT_FALSE(expr_codegen::translate("for (var i := 0; i < 3; i += 1) { x += i; }", symtab).hasResult);
+
+    static const char *const Unsupported[] =
+    {
+        "var a[3] := { 1, 2, 3 }; x := a[0];",  // local vectors
+        "v := v * 2;",                          // vector arithmetic
+        "x := s[];",                            // strings
+        "return [x];",                          // return statements
+        "x := switch { case x > 0: 1; default: 0; };",
+        "x := sum(v);",                         // vector functions
+        "x := unknown_symbol;",
+    };
+
+    for (auto exprString: Unsupported)
+    {
+        SCOPED_TRACE(exprString);
+        ASSERT_THROW(expr_codegen::translate(exprString, symtab), expr_codegen::CodegenError);
+    }
+}
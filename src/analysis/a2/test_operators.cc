@@ -20,6 +20,7 @@
  */
 #include "a2.h"
 #include "a2_impl.h"
+#include "a2_simd.h"
 #include "a2_data_filter.h"
 #include "memory.h"
 #include "multiword_datafilter.h"
@@ -1324,7 +1325,7 @@ static void BM_h2d_sink_step(benchmark::State &state)
     double moduleCounter = 0;
 
     static const s32 histoBins = 20;
-    H2D histo;
+    H2D histo = {};
 
     Arena histArena(Kilobytes(256));
 
@@ -1585,5 +1586,286 @@ static void TEST_condition_filter_step(benchmark::State &state)
 BENCHMARK(TEST_condition_filter_step);
 #endif
 
+/* End of event processing of an analysis with many conditions. Each condition
+ * is an interval condition on a four element array and gates four operators.
+ * The operators of every third condition are additionally gated by a second
+ * condition. Half of the conditions are true in each event.
+ * Arguments: the number of conditions and 0 for the per operator condition
+ * checks or 1 for the grouped gates built by a2_build_condition_gates(). */
+static void BM_condition_gating(benchmark::State &state)
+{
+    const s32 conditionCount = state.range(0);
+    const bool useGates = state.range(1);
+    const s32 gatedCount = conditionCount * 4;
+    const s32 opCount = conditionCount + gatedCount;
+
+    Arena arena(Megabytes(4));
+
+    PipeVectors input =
+    {
+        push_param_vector(&arena, 4),
+        push_param_vector(&arena, 4, 0.0),
+        push_param_vector(&arena, 4, 100.0),
+    };
+
+    auto a2 = arena.pushObject<A2>(&arena);
+    a2->operators[0] = arena.pushArray<Operator>(opCount);
+    a2->operatorRanks[0] = arena.pushArray<A2::OperatorCountType>(opCount);
+    a2->conditionBits.resize(conditionCount);
+
+    auto &count = a2->operatorCounts[0];
+
+    for (s32 ci = 0; ci < conditionCount; ci++)
+    {
+        // Conditions with even indexes are true for the values used below.
+        std::vector<Interval> intervals(4, ci % 2 ? Interval{ 60.0, 70.0 } : Interval{ 0.0, 60.0 });
+        auto op = make_interval_condition(&arena, input, intervals);
+        reinterpret_cast<ConditionBaseData *>(op.d)->bitIndex = ci;
+        a2->operators[0][count] = op;
+        a2->operatorRanks[0][count] = 1;
+        ++count;
+    }
+
+    for (s32 oi = 0; oi < gatedCount; oi++)
+    {
+        const s32 ci = oi / 4;
+        std::vector<u16> bits = { static_cast<u16>(ci) };
+
+        if (ci % 3 == 0)
+            bits.push_back((ci * 7 + 2) % conditionCount);
+
+        std::sort(bits.begin(), bits.end());
+        bits.erase(std::unique(bits.begin(), bits.end()), bits.end());
+
+        auto op = make_calibration(&arena, input, 0.0, 200.0);
+        op.conditionBitIndexes = push_copy_typed_block<u16>(&arena, bits);
+        a2->operators[0][count] = op;
+        a2->operatorRanks[0][count] = 2;
+        ++count;
+    }
+
+    if (useGates)
+        a2_build_condition_gates(a2, &arena);
+
+    for (s32 i = 0; i < 4; i++)
+        input.data[i] = 10.0 * (i + 1);
+
+    double eventCounter = 0;
+
+    for (auto _: state)
+    {
+        a2_end_event(a2, 0);
+        eventCounter++;
+    }
+
+    state.counters["mem"] = Counter(arena.used());
+    state.counters["eR"] = Counter(eventCounter, Counter::kIsRate);
+    state.counters["gates"] = a2->operatorGates[0].size;
+}
+BENCHMARK(BM_condition_gating)->ArgsProduct({{ 16, 128, 512 }, { 0, 1 }});
+
+/* Benchmarks of the vectorized kernels used by the operators.
+ * Arguments: the simd::InstructionSet and the size of the input vectors.
+ * Instruction sets not supported by the build or the cpu are skipped. */
+static void simd_bench_args(benchmark::internal::Benchmark *b)
+{
+    for (int is = 0; is < simd::InstructionSetCount; is++)
+    {
+        for (int size: { 16, 256 })
+        {
+            b->Args({ is, size });
+        }
+    }
+}
+
+struct SimdBenchContext
+{
+    Arena arena;
+    PipeVectors inputA;
+    PipeVectors inputB;
+    simd::InstructionSet prevInstructionSet;
+    double bytesProcessed = 0;
+    double moduleCounter = 0;
+
+    // Values in [0, 20) with every 8th parameter invalid.
+    explicit SimdBenchContext(s32 size)
+        : arena(Megabytes(1))
+        , prevInstructionSet(simd::get_instruction_set())
+    {
+        inputA.data = push_param_vector(&arena, size);
+        inputA.lowerLimits = push_param_vector(&arena, size, 0.0);
+        inputA.upperLimits = push_param_vector(&arena, size, 20.0);
+        inputB = inputA;
+        inputB.data = push_param_vector(&arena, size);
+
+        for (s32 i = 0; i < size; i++)
+        {
+            inputA.data[i] = (i % 8 == 5) ? invalid_param() : i % 20;
+            inputB.data[i] = (i % 8 == 3) ? invalid_param() : (i * 7) % 20 + 1;
+        }
+    }
+
+    ~SimdBenchContext()
+    {
+        simd::set_instruction_set(prevInstructionSet);
+    }
+
+    bool begin(benchmark::State &state)
+    {
+        auto is = static_cast<simd::InstructionSet>(state.range(0));
+
+        if (!simd::set_instruction_set(is))
+        {
+            state.SkipWithError("instruction set not available");
+            return false;
+        }
+
+        state.SetLabel(simd::to_string(is));
+        return true;
+    }
+
+    void processed()
+    {
+        bytesProcessed += inputA.data.size * sizeof(double);
+        moduleCounter++;
+    }
+
+    void end(benchmark::State &state)
+    {
+        state.counters["mem"] = Counter(arena.used());
+        state.counters["bR"] = Counter(bytesProcessed, Counter::kIsRate);
+        state.counters["mR"] = Counter(moduleCounter, Counter::kIsRate);
+    }
+};
+
+static void BM_simd_calibration_step(benchmark::State &state)
+{
+    SimdBenchContext ctx(state.range(1));
+
+    if (!ctx.begin(state))
+        return;
+
+    auto op = make_calibration(&ctx.arena, ctx.inputA, 0.0, 200.0);
+
+    while (state.KeepRunning())
+    {
+        calibration_step(&op);
+        ctx.processed();
+
+        assert(op.outputs[0][1] == 10.0);
+        assert(!is_param_valid(op.outputs[0][5]));
+    }
+
+    ctx.end(state);
+}
+BENCHMARK(BM_simd_calibration_step)->Apply(simd_bench_args);
+
+static void BM_simd_range_filter_step(benchmark::State &state)
+{
+    SimdBenchContext ctx(state.range(1));
+
+    if (!ctx.begin(state))
+        return;
+
+    auto op = make_range_filter(&ctx.arena, ctx.inputA, { 5.0, 15.0 }, false);
+
+    while (state.KeepRunning())
+    {
+        range_filter_step(&op);
+        ctx.processed();
+
+        assert(!is_param_valid(op.outputs[0][1]));
+        assert(op.outputs[0][6] == 6.0);
+    }
+
+    ctx.end(state);
+}
+BENCHMARK(BM_simd_range_filter_step)->Apply(simd_bench_args);
+
+static void BM_simd_binary_equation_step(benchmark::State &state)
+{
+    SimdBenchContext ctx(state.range(1));
+
+    if (!ctx.begin(state))
+        return;
+
+    // (a - b) / (a + b)
+    auto op = make_binary_equation(&ctx.arena, ctx.inputA, ctx.inputB, 3, -1.0, 1.0);
+
+    while (state.KeepRunning())
+    {
+        binary_equation_step(&op);
+        ctx.processed();
+
+        assert(op.outputs[0][0] == -1.0);
+        assert(!is_param_valid(op.outputs[0][3]));
+    }
+
+    ctx.end(state);
+}
+BENCHMARK(BM_simd_binary_equation_step)->Apply(simd_bench_args);
+
+static void BM_simd_aggregate_sum_step(benchmark::State &state)
+{
+    SimdBenchContext ctx(state.range(1));
+
+    if (!ctx.begin(state))
+        return;
+
+    auto op = make_aggregate_sum(&ctx.arena, ctx.inputA, { 2.0, 17.0 });
+
+    while (state.KeepRunning())
+    {
+        aggregate_sum_step(&op);
+        ctx.processed();
+
+        assert(is_param_valid(op.outputs[0][0]));
+    }
+
+    ctx.end(state);
+}
+BENCHMARK(BM_simd_aggregate_sum_step)->Apply(simd_bench_args);
+
+static void BM_simd_aggregate_max_step(benchmark::State &state)
+{
+    SimdBenchContext ctx(state.range(1));
+
+    if (!ctx.begin(state))
+        return;
+
+    auto op = make_aggregate_max(&ctx.arena, ctx.inputA, { 2.0, 17.0 });
+
+    while (state.KeepRunning())
+    {
+        aggregate_max_step(&op);
+        ctx.processed();
+
+        assert(op.outputs[0][0] >= 15.0);
+    }
+
+    ctx.end(state);
+}
+BENCHMARK(BM_simd_aggregate_max_step)->Apply(simd_bench_args);
+
+static void BM_simd_aggregate_sigma_step(benchmark::State &state)
+{
+    SimdBenchContext ctx(state.range(1));
+
+    if (!ctx.begin(state))
+        return;
+
+    auto op = make_aggregate_sigma(&ctx.arena, ctx.inputA, { 2.0, 17.0 });
+
+    while (state.KeepRunning())
+    {
+        aggregate_sigma_step(&op);
+        ctx.processed();
+
+        assert(is_param_valid(op.outputs[0][0]));
+    }
+
+    ctx.end(state);
+}
+BENCHMARK(BM_simd_aggregate_sigma_step)->Apply(simd_bench_args);
 
 BENCHMARK_MAIN();
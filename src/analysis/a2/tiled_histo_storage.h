@@ -0,0 +1,303 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __A2_TILED_HISTO_STORAGE_H__
+#define __A2_TILED_HISTO_STORAGE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+
+#include "histo_storage.h"
+
+namespace a2
+{
+
+/* Sparse storage for 2D histograms.
+ *
+ * The bins are grouped into square tiles of TileSize x TileSize bins. A tile
+ * is allocated the first time one of its bins is written to. Most 2D spectra
+ * only populate a small part of their area, so the untouched tiles cost one
+ * pointer each instead of a full row of bins.
+ *
+ * A sum of the bin contents is kept per tile. Readers use it to skip empty
+ * regions in statistics and projections. A tile counts as empty if it is not
+ * allocated or its sum is zero, which is exact for unweighted fills.
+ *
+ * Threading: there is a single writer (the analysis thread while running,
+ * otherwise the GUI thread). Readers may run concurrently with the writer.
+ * Tile pointers are published with release semantics, so readers see either
+ * no tile or a fully cleared one. As with dense storage, bin values and tile
+ * sums themselves are read without synchronization. Tiles are only freed on
+ * destruction. clear() zeroes them and keeps them allocated, so a concurrent
+ * reader never sees freed memory.
+ */
+class TiledHistoStorage
+{
+    public:
+        static const u32 TileBits = 5;
+        static const u32 TileSize = 1u << TileBits;
+        static const u32 TileMask = TileSize - 1;
+        static const u32 BinsPerTile = TileSize * TileSize;
+
+        TiledHistoStorage(u32 xBins, u32 yBins, BinStorageType storageType)
+            : m_xBins(xBins)
+            , m_yBins(yBins)
+            , m_tilesX((xBins + TileMask) >> TileBits)
+            , m_tilesY((yBins + TileMask) >> TileBits)
+            , m_storageType(storageType)
+            , m_tiles(new std::atomic<void *>[getTileCount()])
+            , m_tileSums(new double[getTileCount()])
+        {
+            for (size_t ti = 0; ti < getTileCount(); ti++)
+            {
+                m_tiles[ti].store(nullptr, std::memory_order_relaxed);
+                m_tileSums[ti] = 0.0;
+            }
+        }
+
+        ~TiledHistoStorage()
+        {
+            for (size_t ti = 0; ti < getTileCount(); ti++)
+                free_bins(m_tiles[ti].load(std::memory_order_relaxed));
+        }
+
+        TiledHistoStorage(const TiledHistoStorage &) = delete;
+        TiledHistoStorage &operator=(const TiledHistoStorage &) = delete;
+
+        u32 getXBins() const { return m_xBins; }
+        u32 getYBins() const { return m_yBins; }
+        u32 getXTiles() const { return m_tilesX; }
+        u32 getYTiles() const { return m_tilesY; }
+        size_t getTileCount() const { return static_cast<size_t>(m_tilesX) * m_tilesY; }
+        BinStorageType getStorageType() const { return m_storageType; }
+
+        size_t getAllocatedTileCount() const
+        {
+            return m_allocatedTiles.load(std::memory_order_relaxed);
+        }
+
+        // Memory used by the tiles plus the per tile bookkeeping.
+        size_t getStorageSize() const
+        {
+            return (getAllocatedTileCount() * bin_storage_size(m_storageType, BinsPerTile)
+                    + getTileCount() * (sizeof(void *) + sizeof(double)));
+        }
+
+        static size_t binInTile(u32 x, u32 y)
+        {
+            return (static_cast<size_t>(y & TileMask) << TileBits) | (x & TileMask);
+        }
+
+        size_t tileIndex(u32 x, u32 y) const
+        {
+            return static_cast<size_t>(y >> TileBits) * m_tilesX + (x >> TileBits);
+        }
+
+        const void *getTile(size_t ti) const
+        {
+            return m_tiles[ti].load(std::memory_order_acquire);
+        }
+
+        double getTileSum(size_t ti) const { return m_tileSums[ti]; }
+
+        bool isTileEmpty(size_t ti) const
+        {
+            return !getTile(ti) || m_tileSums[ti] == 0.0;
+        }
+
+        double getBin(u32 x, u32 y) const
+        {
+            assert(x < m_xBins && y < m_yBins);
+
+            if (auto tile = getTile(tileIndex(x, y)))
+                return read_bin(tile, m_storageType, binInTile(x, y));
+
+            return 0.0;
+        }
+
+        // Sum of the bins in [x1, x2) x [y1, y2).
+        double sumRegion(u32 x1, u32 x2, u32 y1, u32 y2) const
+        {
+            double result = 0.0;
+
+            visitBins(x1, x2, y1, y2, [&result] (u32, u32, double v) { result += v; });
+
+            return result;
+        }
+
+        // True if all tiles touching [x1, x2) x [y1, y2) are empty.
+        bool isRegionEmpty(u32 x1, u32 x2, u32 y1, u32 y2) const
+        {
+            x2 = std::min(x2, m_xBins);
+            y2 = std::min(y2, m_yBins);
+
+            if (x1 >= x2 || y1 >= y2)
+                return true;
+
+            for (u32 ty = y1 >> TileBits; ty <= ((y2 - 1) >> TileBits); ty++)
+            {
+                for (u32 tx = x1 >> TileBits; tx <= ((x2 - 1) >> TileBits); tx++)
+                {
+                    if (!isTileEmpty(static_cast<size_t>(ty) * m_tilesX + tx))
+                        return false;
+                }
+            }
+
+            return true;
+        }
+
+        /* Calls visitor(x, y, value) for the bins in [x1, x2) x [y1, y2)
+         * that are part of non-empty tiles. Bins of empty tiles are skipped.
+         * The order is tile by tile, row-major inside each tile. */
+        template<typename Visitor>
+        void visitBins(u32 x1, u32 x2, u32 y1, u32 y2, Visitor &&visitor) const
+        {
+            x2 = std::min(x2, m_xBins);
+            y2 = std::min(y2, m_yBins);
+
+            if (x1 >= x2 || y1 >= y2)
+                return;
+
+            for (u32 ty = y1 >> TileBits; ty <= ((y2 - 1) >> TileBits); ty++)
+            {
+                const u32 tileY1 = std::max(y1, ty << TileBits);
+                const u32 tileY2 = std::min(y2, (ty + 1) << TileBits);
+
+                for (u32 tx = x1 >> TileBits; tx <= ((x2 - 1) >> TileBits); tx++)
+                {
+                    const size_t ti = static_cast<size_t>(ty) * m_tilesX + tx;
+
+                    if (isTileEmpty(ti))
+                        continue;
+
+                    const void *tile = getTile(ti);
+                    const u32 tileX1 = std::max(x1, tx << TileBits);
+                    const u32 tileX2 = std::min(x2, (tx + 1) << TileBits);
+
+                    for (u32 y = tileY1; y < tileY2; y++)
+                        for (u32 x = tileX1; x < tileX2; x++)
+                            visitor(x, y, read_bin(tile, m_storageType, binInTile(x, y)));
+                }
+            }
+        }
+
+        // Unweighted fill. This is the a2 hot path.
+        void increment(u32 x, u32 y)
+        {
+            assert(x < m_xBins && y < m_yBins);
+            const size_t ti = tileIndex(x, y);
+            // Saturated U32 bins do not change and must not change the sum.
+            m_tileSums[ti] += increment_bin(getOrAllocTile(ti), m_storageType, binInTile(x, y));
+        }
+
+        void incrementLinear(size_t linearBin)
+        {
+            increment(linearBin % m_xBins, linearBin / m_xBins);
+        }
+
+        void setBin(u32 x, u32 y, double value)
+        {
+            assert(x < m_xBins && y < m_yBins);
+            const size_t ti = tileIndex(x, y);
+
+            if (value == 0.0 && !getTile(ti))
+                return;
+
+            void *tile = getOrAllocTile(ti);
+            const size_t bin = binInTile(x, y);
+            const double prev = read_bin(tile, m_storageType, bin);
+            write_bin(tile, m_storageType, bin, value);
+            m_tileSums[ti] += read_bin(tile, m_storageType, bin) - prev;
+        }
+
+        double getLinearBin(size_t linearBin) const
+        {
+            return getBin(linearBin % m_xBins, linearBin / m_xBins);
+        }
+
+        void setLinearBin(size_t linearBin, double value)
+        {
+            setBin(linearBin % m_xBins, linearBin / m_xBins, value);
+        }
+
+        // Adds the contents of src to this storage and clears src. Both
+        // storages must have the same dimensions and storage type.
+        void moveAddFrom(TiledHistoStorage &src)
+        {
+            assert(src.m_xBins == m_xBins && src.m_yBins == m_yBins);
+            assert(src.m_storageType == m_storageType);
+
+            for (size_t ti = 0; ti < getTileCount(); ti++)
+            {
+                if (src.isTileEmpty(ti))
+                    continue;
+
+                void *destTile = getOrAllocTile(ti);
+                void *srcTile = src.m_tiles[ti].load(std::memory_order_relaxed);
+
+                for (size_t bin = 0; bin < BinsPerTile; bin++)
+                    m_tileSums[ti] += move_add_bin(destTile, srcTile, m_storageType, bin);
+
+                src.m_tileSums[ti] = 0.0;
+            }
+        }
+
+        void clear()
+        {
+            for (size_t ti = 0; ti < getTileCount(); ti++)
+            {
+                if (auto tile = m_tiles[ti].load(std::memory_order_relaxed))
+                    clear_bins(tile, m_storageType, BinsPerTile);
+
+                m_tileSums[ti] = 0.0;
+            }
+        }
+
+    private:
+        void *getOrAllocTile(size_t ti)
+        {
+            void *tile = m_tiles[ti].load(std::memory_order_relaxed);
+
+            if (!tile)
+            {
+                tile = allocate_bins(m_storageType, BinsPerTile);
+                clear_bins(tile, m_storageType, BinsPerTile);
+                m_tiles[ti].store(tile, std::memory_order_release);
+                m_allocatedTiles.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            return tile;
+        }
+
+        u32 m_xBins;
+        u32 m_yBins;
+        u32 m_tilesX;
+        u32 m_tilesY;
+        BinStorageType m_storageType;
+        std::unique_ptr<std::atomic<void *>[]> m_tiles;
+        std::unique_ptr<double[]> m_tileSums;
+        std::atomic<size_t> m_allocatedTiles = { 0 };
+};
+
+} // namespace a2
+
+#endif /* __A2_TILED_HISTO_STORAGE_H__ */
@@ -664,7 +664,8 @@ DEF_OP_MAGIC(histo1d_sink_magic)
         assert(histo->getNumberOfBins() < a2::H1D::size_max);
 
         a2::H1D a2_histo = {};
-        a2_histo.data = histo->data();
+        a2_histo.data = reinterpret_cast<double *>(histo->data());
+        a2_histo.storageType = histo->getStorageType();
         a2_histo.size = histo->getNumberOfBins();
         a2_histo.binning.min = histo->getXMin();
         a2_histo.binning.range = histo->getXMax() - histo->getXMin();
@@ -733,7 +734,9 @@ DEF_OP_MAGIC(histo2d_sink_magic)
 
     a2::H2D a2_histo = {};
 
-    a2_histo.data = histo->data();
+    a2_histo.data = reinterpret_cast<double *>(histo->data());
+    a2_histo.storageType = histo->getStorageType();
+    a2_histo.tiles = histo->getTiledStorage();
     a2_histo.size = binnings[H2D::XAxis].getBins() * binnings[H2D::YAxis].getBins();
 
     for (s32 axis = 0; axis < H2D::AxisCount; axis++)
@@ -824,12 +827,40 @@ DEF_OP_MAGIC(waveform_sink_magic)
     a2::Operator result = a2::make_waveform_sink(
         arena,
         a2_inputs,
-        a1_sink->getTraceHistoriesProtected(),
+        a1_sink->getTraceRingsProtected(),
         a1_sink->getTraceHistoryMaxDepth());
 
     return result;
 }
 
+DEF_OP_MAGIC(waveform_features_magic)
+{
+    OP_MAGIC_NOWARN;
+    LOG("");
+    assert(inputSlots.size() >= 3);
+
+    auto a1_op = qobject_cast<analysis::WaveformFeatureExtractor *>(op.get());
+
+    assert(a1_op);
+
+    std::vector<a2::PipeVectors> a2_inputs;
+
+    for (s32 si = 0; si < inputSlots.size(); si++)
+    {
+        if (inputSlots[si] && inputSlots[si]->isConnected())
+            a2_inputs.emplace_back(find_output_pipe(adapterState, inputSlots[si]).first);
+        else
+            a2_inputs.emplace_back(a2::PipeVectors{});
+    }
+
+    a2::Operator result = a2::make_waveform_features(
+        arena,
+        a2_inputs,
+        a1_op->getParameters());
+
+    return result;
+}
+
 DEF_OP_MAGIC(export_sink_magic)
 {
     OP_MAGIC_NOWARN;
@@ -919,6 +950,53 @@ DEF_OP_MAGIC(interval_condition_magic)
     return result;
 }
 
+/* Returns the bin widths of a 2D histogram fed by the same x and y inputs as
+ * the given polygon condition input slots. This is the resolution the polygon
+ * was drawn at and is used for the polygon raster. Returns (0, 0) if no such
+ * histogram exists, making the raster fall back to its default resolution. */
+std::pair<double, double> find_polygon_raster_cell_widths(
+    const a2::PipeVectors &xInput, const analysis::Slot *xSlot,
+    const a2::PipeVectors &yInput, const analysis::Slot *ySlot)
+{
+    auto same_input = [] (const analysis::Slot &a, const analysis::Slot *b)
+    {
+        return a.inputPipe == b->inputPipe && a.paramIndex == b->paramIndex;
+    };
+
+    for (auto destSlot: xSlot->inputPipe->getDestinations())
+    {
+        auto sink = qobject_cast<analysis::Histo2DSink *>(destSlot->parentOperator);
+
+        if (!sink || !same_input(sink->m_inputX, xSlot) || !same_input(sink->m_inputY, ySlot))
+            continue;
+
+        double xMin = xInput.lowerLimits[xSlot->paramIndex];
+        double xMax = xInput.upperLimits[xSlot->paramIndex];
+        double yMin = yInput.lowerLimits[ySlot->paramIndex];
+        double yMax = yInput.upperLimits[ySlot->paramIndex];
+
+        if (sink->hasActiveLimits(Qt::XAxis))
+        {
+            xMin = sink->m_xLimitMin;
+            xMax = sink->m_xLimitMax;
+        }
+
+        if (sink->hasActiveLimits(Qt::YAxis))
+        {
+            yMin = sink->m_yLimitMin;
+            yMax = sink->m_yLimitMax;
+        }
+
+        return
+        {
+            std::abs(xMax - xMin) / std::max(sink->getHistoBinsX(), 1),
+            std::abs(yMax - yMin) / std::max(sink->getHistoBinsY(), 1)
+        };
+    }
+
+    return { 0.0, 0.0 };
+}
+
 DEF_OP_MAGIC(polygon_condition_magic)
 {
     OP_MAGIC_NOWARN;
@@ -938,13 +1016,21 @@ DEF_OP_MAGIC(polygon_condition_magic)
         a2_polygon.push_back({ point.x(), point.y() });
     }
 
+    auto a2_xInput = find_output_pipe(adapterState, inputSlots[0]).first;
+    auto a2_yInput = find_output_pipe(adapterState, inputSlots[1]).first;
+
+    auto cellWidths = find_polygon_raster_cell_widths(
+        a2_xInput, inputSlots[0], a2_yInput, inputSlots[1]);
+
     a2::Operator result = make_polygon_condition(
         arena,
-        find_output_pipe(adapterState, inputSlots[0]).first,
-        find_output_pipe(adapterState, inputSlots[1]).first,
+        a2_xInput,
+        a2_yInput,
         inputSlots[0]->paramIndex,
         inputSlots[1]->paramIndex,
-        a2_polygon);
+        a2_polygon,
+        cellWidths.first,
+        cellWidths.second);
 
     return result;
 }
@@ -994,6 +1080,7 @@ static const QHash<const QMetaObject *, OperatorMagic *> OperatorMagicTable =
     { &analysis::Sum::staticMetaObject,                     sum_magic },
     { &analysis::ExpressionOperator::staticMetaObject,      expression_operator_magic },
     { &analysis::ScalerOverflow::staticMetaObject,          scaler_overflow_magic },
+    { &analysis::WaveformFeatureExtractor::staticMetaObject, waveform_features_magic },
 
     { &analysis::IntervalCondition::staticMetaObject,       interval_condition_magic },
     { &analysis::PolygonCondition::staticMetaObject,        polygon_condition_magic },
@@ -1119,6 +1206,37 @@ find_output_pipe(const A2AdapterState *state, analysis::Pipe *pipe)
         pipe->sourceOutputIndex);
 }
 
+QVector<ObjectCostInfo> a2_adapter_collect_costs(const A2AdapterState &state)
+{
+    QVector<ObjectCostInfo> result;
+
+    if (!state.a2 || !state.a2->costs)
+        return result;
+
+    const auto &costs = *state.a2->costs;
+
+    for (s32 ei = 0; ei < a2::MaxVMEEvents; ei++)
+    {
+        const auto &srcCosts = costs.dataSources[ei];
+
+        for (size_t si = 0; si < srcCosts.size(); si++)
+        {
+            if (auto src = state.sourceMap.value(state.a2->dataSources[ei] + si))
+                result.push_back({ src->getId(), ei, true, srcCosts[si] });
+        }
+
+        const auto &opCosts = costs.operators[ei];
+
+        for (size_t oi = 0; oi < opCosts.size(); oi++)
+        {
+            if (auto op = state.operatorMap.value(state.a2->operators[ei] + oi))
+                result.push_back({ op->getId(), ei, false, opCosts[oi] });
+        }
+    }
+
+    return result;
+}
+
 void a2_adapter_build_datasources(
     memory::Arena *arena,
     A2AdapterState *state,
@@ -1654,6 +1772,8 @@ A2AdapterState a2_adapter_build(
         activeSources,
         vmeMap);
 
+    a2::a2_build_fused_extractors(result.a2, arena);
+
     LOG("data sources:");
 
     for (s32 ei = 0; ei < a2::MaxVMEEvents; ei++)
@@ -1764,6 +1884,8 @@ A2AdapterState a2_adapter_build(
         runInfo
         );
 
+    a2::a2_build_condition_gates(result.a2, arena);
+
     LOG("operators after type sort:");
 
     for (s32 ei = 0; ei < a2::MaxVMEEvents; ei++)
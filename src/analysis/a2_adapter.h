@@ -93,6 +93,11 @@ A2AdapterState a2_adapter_build(
 std::pair<a2::PipeVectors, bool>
     find_output_pipe(const A2AdapterState *state, analysis::Pipe *pipe);
 
+/* Maps the a2 cost counters back to the analysis objects, see ObjectCostInfo
+ * in analysis.h. Returns an empty
+ * vector if cost accounting is disabled for the A2 instance. */
+QVector<ObjectCostInfo> a2_adapter_collect_costs(const A2AdapterState &state);
+
 template<typename T, typename SizeType>
 QVector<T> to_qvector(TypedBlock<T, SizeType> block)
 {
@@ -26,6 +26,7 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <set>
 #include <sstream>
@@ -3130,12 +3131,14 @@ void Histo1DSink::beginRun(const RunInfo &runInfo, Logger)
     {
         binCountChanged = false;
     }
-    bool structureChanged = histoCountChanged || binCountChanged;
+    bool storageTypeChanged = (!m_histos.isEmpty() && m_histos[0]
+                               && m_histos[0]->getStorageType() != m_binStorageType);
+    bool structureChanged = histoCountChanged || binCountChanged || storageTypeChanged;
 
     m_histos.resize(histoCount);
 
     // Space for the histos plus space to allow proper alignment
-    size_t requiredMemory = (histoCount * m_bins * sizeof(double)
+    size_t requiredMemory = (histoCount * a2::bin_storage_size(m_binStorageType, m_bins)
                              + histoCount * HistoMemAlignment);
 
     if (!m_histoArena || m_histoArena->size() < requiredMemory)
@@ -3170,8 +3173,10 @@ void Histo1DSink::beginRun(const RunInfo &runInfo, Logger)
             histoMem =
             {
                 m_histoArena,
-                m_histoArena->pushArray<double>(m_bins, HistoMemAlignment),
-                m_bins
+                m_histoArena->pushSize(a2::bin_storage_size(m_binStorageType, m_bins),
+                                       HistoMemAlignment),
+                m_bins,
+                m_binStorageType
             };
         }
 
@@ -3196,6 +3201,10 @@ void Histo1DSink::beginRun(const RunInfo &runInfo, Logger)
         {
             assert(!histo->ownsMemory());
             histo->setData(histoMem, binning);
+
+            // The old contents cannot be interpreted using the new type.
+            if (storageTypeChanged)
+                histo->clear();
         }
         else
         {
@@ -3264,6 +3273,8 @@ void Histo1DSink::read(const QJsonObject &json)
     m_xLimitMin = json["xLimitMin"].toDouble(::mesytec::mvme::util::make_quiet_nan());
     m_xLimitMax = json["xLimitMax"].toDouble(::mesytec::mvme::util::make_quiet_nan());
     m_rrf = json["resolutionReductionFactor"].toInt(Histo1D::NoRR);
+    m_binStorageType = a2::bin_storage_type_from_string(
+        json["binStorage"].toString().toStdString());
 
     Q_ASSERT(m_bins > 0);
 }
@@ -3275,6 +3286,7 @@ void Histo1DSink::write(QJsonObject &json) const
     json["xLimitMin"]  = m_xLimitMin;
     json["xLimitMax"]  = m_xLimitMax;
     json["resolutionReductionFactor"] = static_cast<qint64>(getResolutionReductionFactor());
+    json["binStorage"] = QString(a2::to_string(m_binStorageType));
 }
 
 size_t Histo1DSink::getStorageSize() const
@@ -3374,6 +3386,10 @@ void Histo2DSink::beginRun(const RunInfo &runInfo, Logger)
             }
         }
 
+        // These clear the histo if the storage type or layout changes.
+        m_histo->setStorageType(m_binStorageType);
+        m_histo->setTiled(m_tiledStorage);
+
         m_histo->setObjectName(objectName());
         m_histo->setTitle(objectName());
 
@@ -3442,6 +3458,10 @@ void Histo2DSink::read(const QJsonObject &json)
 
     m_rrf.x = json["rrfX"].toInt(AxisBinning::NoResolutionReduction);
     m_rrf.y = json["rrfY"].toInt(AxisBinning::NoResolutionReduction);
+
+    m_binStorageType = a2::bin_storage_type_from_string(
+        json["binStorage"].toString().toStdString());
+    m_tiledStorage = json["tiledStorage"].toBool(false);
 }
 
 void Histo2DSink::write(QJsonObject &json) const
@@ -3459,6 +3479,9 @@ void Histo2DSink::write(QJsonObject &json) const
 
     json["rrfX"] = static_cast<qint64>(m_rrf.x);
     json["rrfY"] = static_cast<qint64>(m_rrf.y);
+
+    json["binStorage"] = QString(a2::to_string(m_binStorageType));
+    json["tiledStorage"] = m_tiledStorage;
 }
 
 size_t Histo2DSink::getStorageSize() const
@@ -3707,7 +3730,15 @@ struct WaveformSink::Private
 {
     QVector<std::shared_ptr<Slot>> inputs_;
     size_t traceHistoryMaxDepth_ = WaveformSink::DefaultTraceHistoryMaxDepth;
-    mutable mesytec::mvlc::Protected<mesytec::mvme::waveforms::TraceHistories> traceHistories_;
+    // Replaced by the a2 runtime when the analysis is built. The analysis
+    // thread writes into the rings without locking, the mutex only guards
+    // the pointer itself.
+    mutable mesytec::mvlc::Protected<std::shared_ptr<mesytec::mvme::waveforms::TraceRings>> traceRings_;
+
+    std::shared_ptr<mesytec::mvme::waveforms::TraceRings> getTraceRings() const
+    {
+        return traceRings_.copy();
+    }
 
     static const int PhaseInput = 0;
     static const int ConfigInput = 1;
@@ -3777,7 +3808,11 @@ void WaveformSink::clearState()
     qDebug() << __PRETTY_FUNCTION__ << objectName();
 #endif
 
-    d->traceHistories_.access()->clear();
+    if (auto rings = d->getTraceRings())
+    {
+        for (auto &ring: rings->channels)
+            ring->clear();
+    }
 }
 
 void WaveformSink::beginRun(const RunInfo &runInfo, Logger)
@@ -3816,8 +3851,10 @@ void WaveformSink::read(const QJsonObject &json)
 
 size_t WaveformSink::getStorageSize() const
 {
-    // locks the history but does not make a copy
-    return mesytec::mvme::waveforms::get_used_memory(d->traceHistories_.access().ref());
+    if (auto rings = d->getTraceRings())
+        return mesytec::mvme::waveforms::get_used_memory(*rings);
+
+    return 0;
 }
 
 void WaveformSink::setTraceHistoryMaxDepth(size_t maxDepth)
@@ -3832,15 +3869,40 @@ size_t WaveformSink::getTraceHistoryMaxDepth() const
 
 mesytec::mvme::waveforms::TraceHistories WaveformSink::getTraceHistories() const
 {
-    return d->traceHistories_.copy();
+    mesytec::mvme::waveforms::TraceHistories result;
+    getTraceHistories(result);
+    return result;
 }
 
-mesytec::mvlc::Protected<mesytec::mvme::waveforms::TraceHistories> &WaveformSink::getTraceHistoriesProtected()
+void WaveformSink::getTraceHistories(mesytec::mvme::waveforms::TraceHistories &dest) const
 {
-    return d->traceHistories_;
+    if (auto rings = d->getTraceRings())
+        mesytec::mvme::waveforms::snapshot(*rings, dest);
+    else
+        dest.clear();
 }
 
-void connect_mdpp_sample_decoder_to_waveform_sink(DataSourceMdppSampleDecoder *decoder, WaveformSink *sink)
+u64 WaveformSink::getTraceHistoryVersion() const
+{
+    u64 result = 0;
+
+    if (auto rings = d->getTraceRings())
+    {
+        for (const auto &ring: rings->channels)
+            result += ring->writeCount() + ring->clearedCount();
+    }
+
+    return result;
+}
+
+mesytec::mvlc::Protected<std::shared_ptr<mesytec::mvme::waveforms::TraceRings>> &WaveformSink::getTraceRingsProtected()
+{
+    return d->traceRings_;
+}
+
+// Connects the decoder to an operator with phase, config and sample array
+// inputs. Used for the WaveformSink and the WaveformFeatureExtractor.
+static void connect_mdpp_sample_decoder_to_waveform_inputs(DataSourceMdppSampleDecoder *decoder, OperatorInterface *sink)
 {
     // sink input0 is the phase input
     // the other sink inputs are trace data inputs
@@ -3886,6 +3948,214 @@ void connect_mdpp_sample_decoder_to_waveform_sink(DataSourceMdppSampleDecoder *d
     }
 }
 
+void connect_mdpp_sample_decoder_to_waveform_sink(DataSourceMdppSampleDecoder *decoder, WaveformSink *sink)
+{
+    connect_mdpp_sample_decoder_to_waveform_inputs(decoder, sink);
+}
+
+//
+// WaveformFeatureExtractor
+//
+
+static const QString WaveformFeatureNames[a2::WaveformFeature_Count] =
+{
+    QSL("baseline"),
+    QSL("amplitude"),
+    QSL("integral"),
+    QSL("risetime"),
+    QSL("cfdtime"),
+};
+
+static const char *to_string(a2::WaveformPhaseCorrection pc)
+{
+    switch (pc)
+    {
+        case a2::WaveformPhaseCorrection::Auto: return "auto";
+        case a2::WaveformPhaseCorrection::On: return "on";
+        case a2::WaveformPhaseCorrection::Off: return "off";
+    }
+
+    return "auto";
+}
+
+static a2::WaveformPhaseCorrection waveform_phase_correction_from_string(const QString &str)
+{
+    if (str == QSL("on"))
+        return a2::WaveformPhaseCorrection::On;
+    if (str == QSL("off"))
+        return a2::WaveformPhaseCorrection::Off;
+    return a2::WaveformPhaseCorrection::Auto;
+}
+
+WaveformFeatureExtractor::WaveformFeatureExtractor(QObject *parent)
+    : OperatorInterface(parent)
+{
+    addSlot(); // phase input
+    addSlot(); // config input
+    addSlot(); // first channel input
+
+    for (s32 i = 0; i < a2::WaveformFeature_Count; ++i)
+        m_outputs.push_back(std::make_shared<Pipe>(this, i));
+
+    setProperty("operator_category", "Math");
+}
+
+WaveformFeatureExtractor::~WaveformFeatureExtractor()
+{
+}
+
+bool WaveformFeatureExtractor::addSlot()
+{
+    auto inputType = InputType::Array;
+    const s32 slotIndex = getNumberOfSlots();
+
+    QString slotName;
+
+    if (slotIndex == 0)
+        slotName = QSL("Phase Input (optional)");
+    else if (slotIndex == 1)
+        slotName = QSL("Config Input (optional)");
+    else
+        slotName = QSL("Channel #") + QString::number(slotIndex - 2);
+
+    auto slot = std::make_shared<Slot>(this, slotIndex, slotName, inputType);
+
+    if (slotIndex < 2)
+        slot->isOptional = true;
+
+    m_inputs.push_back(slot);
+
+    return true;
+}
+
+bool WaveformFeatureExtractor::removeLastSlot()
+{
+    if (m_inputs.size() > 3)
+    {
+        m_inputs.back()->disconnectPipe();
+        m_inputs.pop_back();
+        return true;
+    }
+
+    return false;
+}
+
+s32 WaveformFeatureExtractor::getNumberOfSlots() const
+{
+    return m_inputs.size();
+}
+
+Slot *WaveformFeatureExtractor::getSlot(s32 slotIndex)
+{
+    return m_inputs.value(slotIndex).get();
+}
+
+s32 WaveformFeatureExtractor::getNumberOfOutputs() const
+{
+    return m_outputs.size();
+}
+
+QString WaveformFeatureExtractor::getOutputName(s32 outputIndex) const
+{
+    if (0 <= outputIndex && outputIndex < a2::WaveformFeature_Count)
+        return WaveformFeatureNames[outputIndex];
+    return {};
+}
+
+Pipe *WaveformFeatureExtractor::getOutput(s32 outputIndex)
+{
+    return m_outputs.value(outputIndex).get();
+}
+
+void WaveformFeatureExtractor::beginRun(const RunInfo &, Logger)
+{
+    const s32 channelCount = std::max(getNumberOfSlots() - 2, 0);
+
+    // Same limits as calculated by a2::make_waveform_features().
+    double sampleMin = 0.0;
+    double sampleMax = 0.0;
+    s32 maxSamples = 0;
+
+    for (s32 si = 2; si < getNumberOfSlots(); ++si)
+    {
+        auto slot = getSlot(si);
+
+        if (slot->isConnected() && slot->inputPipe->getSize() > 0)
+        {
+            const auto &param = slot->inputPipe->getParameters()[0];
+            sampleMin = std::min(sampleMin, param.lowerLimit);
+            sampleMax = std::max(sampleMax, param.upperLimit);
+            maxSamples = std::max(maxSamples, slot->inputPipe->getSize());
+        }
+    }
+
+    const double sampleRange = sampleMax - sampleMin;
+    const double timeMax = (maxSamples + 1) * m_params.dtSample;
+
+    const std::pair<double, double> limits[a2::WaveformFeature_Count] =
+    {
+        { sampleMin, sampleMax },
+        { 0.0, sampleRange },
+        { 0.0, sampleRange * maxSamples },
+        { 0.0, timeMax },
+        { 0.0, timeMax },
+    };
+
+    for (s32 oi = 0; oi < a2::WaveformFeature_Count; ++oi)
+    {
+        auto &params = m_outputs[oi]->parameters;
+        params.name = objectName() + QSL(".") + WaveformFeatureNames[oi];
+        params.resize(channelCount);
+        params.invalidateAll();
+
+        for (auto &param: params)
+        {
+            param.lowerLimit = limits[oi].first;
+            param.upperLimit = limits[oi].second;
+        }
+    }
+}
+
+void WaveformFeatureExtractor::write(QJsonObject &json) const
+{
+    json["numberOfInputs"] = getNumberOfSlots();
+    json["baselineSamples"] = static_cast<qint64>(m_params.baselineSamples);
+    json["integralStart"] = static_cast<qint64>(m_params.integralStart);
+    json["integralLength"] = static_cast<qint64>(m_params.integralLength);
+    json["cfdFraction"] = m_params.cfdFraction;
+    json["cfdDelay"] = static_cast<qint64>(m_params.cfdDelay);
+    json["dtSample"] = m_params.dtSample;
+    json["phaseCorrection"] = to_string(m_params.phaseCorrection);
+}
+
+void WaveformFeatureExtractor::read(const QJsonObject &json)
+{
+    for (auto &slot: m_inputs)
+        slot->disconnectPipe();
+
+    m_inputs.clear();
+
+    s32 inputCount = std::max(json["numberOfInputs"].toInt(3), 3);
+
+    for (s32 inputIndex = 0; inputIndex < inputCount; ++inputIndex)
+        addSlot();
+
+    a2::WaveformFeaturesParameters defaults;
+    m_params.baselineSamples = json["baselineSamples"].toInt(defaults.baselineSamples);
+    m_params.integralStart = json["integralStart"].toInt(defaults.integralStart);
+    m_params.integralLength = json["integralLength"].toInt(defaults.integralLength);
+    m_params.cfdFraction = json["cfdFraction"].toDouble(defaults.cfdFraction);
+    m_params.cfdDelay = json["cfdDelay"].toInt(defaults.cfdDelay);
+    m_params.dtSample = json["dtSample"].toDouble(defaults.dtSample);
+    m_params.phaseCorrection = waveform_phase_correction_from_string(json["phaseCorrection"].toString());
+}
+
+void connect_mdpp_sample_decoder_to_waveform_features(
+    DataSourceMdppSampleDecoder *decoder, WaveformFeatureExtractor *op)
+{
+    connect_mdpp_sample_decoder_to_waveform_inputs(decoder, op);
+}
+
 //
 // ExportSink
 //
@@ -4301,6 +4571,59 @@ static const size_t A2ArenaSegmentSize = Kilobytes(256);
 struct Analysis::Private
 {
     vme_analysis_common::EventModuleIndexMaps eventModuleIndexMaps_;
+
+    // Event-parallel replay: A2 replicas, each one built into its own arena.
+    // Only populated while a run using replicas is active.
+    struct Replica
+    {
+        std::unique_ptr<memory::Arena> arena;
+        std::unique_ptr<A2AdapterState> state;
+    };
+
+    std::vector<Replica> replicas_;
+    // Declared after replicas_ so that the worker threads are stopped before
+    // the replica arenas are destroyed.
+    std::unique_ptr<a2::EventReplicaSet> replicaSet_;
+
+    // Cost counters published by the analysis thread on timetick and at the
+    // end of a run. The GUI only reads this snapshot, never the live A2
+    // structures which are rebuilt on beginRun().
+    mutable std::mutex costsMutex_;
+    QVector<ObjectCostInfo> costs_;
+
+    void stopReplicas()
+    {
+        replicaSet_.reset();
+        replicas_.clear();
+    }
+
+    // Must be called from the analysis thread with the replicas idle, e.g.
+    // right after EventReplicaSet::mergeHistos().
+    void publishCosts(const A2AdapterState &primary)
+    {
+        auto result = a2_adapter_collect_costs(primary);
+
+        // The replicas are built from the same objects in the same order as
+        // the primary A2, so the entries line up.
+        for (const auto &replica: replicas_)
+        {
+            auto replicaCosts = a2_adapter_collect_costs(*replica.state);
+
+            if (replicaCosts.size() != result.size())
+                continue;
+
+            for (int i = 0; i < result.size(); i++)
+            {
+                assert(result[i].objectId == replicaCosts[i].objectId);
+                result[i].cost.cycles += replicaCosts[i].cost.cycles;
+                result[i].cost.steps += replicaCosts[i].cost.steps;
+                result[i].cost.conditionSkips += replicaCosts[i].cost.conditionSkips;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(costsMutex_);
+        costs_ = std::move(result);
+    }
 };
 
 Analysis::Analysis(QObject *parent)
@@ -4330,6 +4653,7 @@ Analysis::Analysis(QObject *parent)
     m_objectFactory.registerOperator<AggregateOps>();
     m_objectFactory.registerOperator<ExpressionOperator>();
     m_objectFactory.registerOperator<ScalerOverflow>();
+    m_objectFactory.registerOperator<WaveformFeatureExtractor>();
 #if 1
     // conditions
     m_objectFactory.registerOperator<IntervalCondition>();
@@ -5566,6 +5890,13 @@ void Analysis::beginRun(const RunInfo &runInfo,
 
         // Build the a2 system
 
+        d->stopReplicas();
+
+        {
+            std::lock_guard<std::mutex> guard(d->costsMutex_);
+            d->costs_.clear();
+        }
+
         // a2 arena swap
         m_a2ArenaIndex = (m_a2ArenaIndex + 1) % m_a2Arenas.size();
         m_a2Arenas[m_a2ArenaIndex]->reset();
@@ -5587,11 +5918,81 @@ void Analysis::beginRun(const RunInfo &runInfo,
 
         assert(m_a2State);
 
+        if (auto threadCount = getOperatorThreadCount(); threadCount > 1)
+        {
+            a2::a2_set_operator_thread_count(m_a2State->a2, threadCount);
+            qDebug() << __PRETTY_FUNCTION__ << "a2: parallel operator execution using"
+                << threadCount << "threads";
+        }
+
+        const auto histoFillType = (getUseBufferedHistoFill()
+                                    ? a2::HistoFillStrategyType::Buffered
+                                    : a2::HistoFillStrategyType::Direct);
+
+        a2::a2_set_histo_fill_strategy(m_a2State->a2, histoFillType);
+        a2::a2_set_native_expressions(m_a2State->a2, getUseNativeExpressions());
+        a2::a2_set_cost_accounting(m_a2State->a2, isCostAccountingEnabled());
+
         a2::a2_begin_run(m_a2State->a2, [logger] (const std::string &str) {
             if (logger)
                 logger(QString::fromStdString(str));
         });
 
+        if (auto replicaCount = getReplayReplicaCount(); runInfo.isReplay && replicaCount > 1)
+        {
+            auto blockers = getEventOrderDependentOperators();
+
+            if (!blockers.empty())
+            {
+                if (logger)
+                {
+                    QStringList names;
+                    for (const auto &op: blockers)
+                        names.push_back(QSL("%1 (%2)").arg(op->objectName()).arg(op->getDisplayName()));
+
+                    logger(QSL("Event-parallel replay disabled. The following operators depend on"
+                               " the event order: %1").arg(names.join(", ")));
+                }
+            }
+            else
+            {
+                std::vector<a2::A2 *> replicaA2s;
+
+                for (int i = 0; i < replicaCount; i++)
+                {
+                    Private::Replica replica;
+                    replica.arena = std::make_unique<memory::Arena>(A2ArenaSegmentSize);
+                    m_a2WorkArena->reset();
+
+                    replica.state = std::make_unique<A2AdapterState>(
+                        a2_adapter_build_memory_wrapper(
+                            replica.arena,
+                            m_a2WorkArena,
+                            this,
+                            m_sources,
+                            m_operators,
+                            m_vmeMap,
+                            runInfo));
+
+                    // Replicas fill private histograms which are merged into
+                    // the primary ones on timeticks and at the end of the run.
+                    a2::a2_detach_histo_storage(replica.state->a2, replica.arena.get());
+                    a2::a2_set_histo_fill_strategy(replica.state->a2, histoFillType);
+                    a2::a2_set_native_expressions(replica.state->a2, getUseNativeExpressions());
+                    a2::a2_set_cost_accounting(replica.state->a2, isCostAccountingEnabled());
+                    a2::a2_begin_run(replica.state->a2, {});
+
+                    replicaA2s.push_back(replica.state->a2);
+                    d->replicas_.emplace_back(std::move(replica));
+                }
+
+                d->replicaSet_ = std::make_unique<a2::EventReplicaSet>(replicaA2s);
+
+                qDebug() << __PRETTY_FUNCTION__ << "a2: event-parallel replay using"
+                    << replicaCount << "replicas";
+            }
+        }
+
         // HACK: restore ExpressionOperator static variable values
         for (auto &op: m_operators)
         {
@@ -5688,6 +6089,24 @@ void Analysis::beginRun(BeginRunOption option, const VMEConfig *vmeConfig, Logge
 
 void Analysis::endRun()
 {
+    if (d->replicaSet_)
+    {
+        d->replicaSet_->mergeHistos(m_a2State->a2);
+
+        // The replicas are idle after the merge. Take the final cost snapshot
+        // before they are destroyed.
+        d->publishCosts(*m_a2State);
+
+        for (auto &replica: d->replicas_)
+            a2::a2_end_run(replica.state->a2);
+
+        d->stopReplicas();
+    }
+    else
+    {
+        d->publishCosts(*m_a2State);
+    }
+
     a2::a2_end_run(m_a2State->a2);
 
 #if ENABLE_ANALYSIS_DEBUG
@@ -5716,7 +6135,10 @@ void Analysis::endRun()
 //
 void Analysis::beginEvent(int eventIndex)
 {
-    a2_begin_event(m_a2State->a2, eventIndex);
+    if (d->replicaSet_)
+        d->replicaSet_->beginEvent(eventIndex);
+    else
+        a2_begin_event(m_a2State->a2, eventIndex);
 }
 
 void Analysis::processModuleData(int crateIndex, int eventIndex,
@@ -5742,18 +6164,32 @@ void Analysis::processModuleData(int eventIndex, int moduleIndex, const u32 *dat
     //{
     //    logBuffer(BufferIterator{const_cast<u32 *>(data), size}, [] (const QString &str) { qDebug() << str; });
     //}
-    a2_process_module_data(m_a2State->a2, eventIndex, moduleIndex, data, size);
+    if (d->replicaSet_)
+        d->replicaSet_->processModuleData(eventIndex, moduleIndex, data, size);
+    else
+        a2_process_module_data(m_a2State->a2, eventIndex, moduleIndex, data, size);
 }
 
 void Analysis::endEvent(int eventIndex)
 {
-    a2_end_event(m_a2State->a2, eventIndex);
+    if (d->replicaSet_)
+        d->replicaSet_->endEvent(eventIndex);
+    else
+        a2_end_event(m_a2State->a2, eventIndex);
 }
 
 void Analysis::processTimetick()
 {
     m_timetickCount += 1.0;
+
+    // Make the replica histogram contents visible.
+    if (d->replicaSet_)
+        d->replicaSet_->mergeHistos(m_a2State->a2);
+
     a2_timetick(m_a2State->a2);
+
+    if (m_a2State->a2->costs)
+        d->publishCosts(*m_a2State);
 }
 
 double Analysis::getTimetickCount() const
@@ -6067,6 +6503,116 @@ QVector<bool> Analysis::getUserLevelsHidden() const
         property("HiddenUserLevels").value<QVariantList>());
 }
 
+void Analysis::setOperatorThreadCount(int threadCount)
+{
+    if (threadCount != getOperatorThreadCount())
+    {
+        setProperty("OperatorThreadCount", threadCount);
+        setModified();
+    }
+}
+
+int Analysis::getOperatorThreadCount() const
+{
+    return property("OperatorThreadCount").toInt();
+}
+
+void Analysis::setReplayReplicaCount(int replicaCount)
+{
+    if (replicaCount != getReplayReplicaCount())
+    {
+        setProperty("ReplayReplicaCount", replicaCount);
+        setModified();
+    }
+}
+
+int Analysis::getReplayReplicaCount() const
+{
+    return property("ReplayReplicaCount").toInt();
+}
+
+void Analysis::setUseBufferedHistoFill(bool useBuffered)
+{
+    if (useBuffered != getUseBufferedHistoFill())
+    {
+        setProperty("BufferedHistoFill", useBuffered);
+        setModified();
+    }
+}
+
+bool Analysis::getUseBufferedHistoFill() const
+{
+    return property("BufferedHistoFill").toBool();
+}
+
+void Analysis::setUseNativeExpressions(bool useNative)
+{
+    if (useNative != getUseNativeExpressions())
+    {
+        setProperty("NativeExpressions", useNative);
+        setModified();
+    }
+}
+
+bool Analysis::getUseNativeExpressions() const
+{
+    return property("NativeExpressions").toBool();
+}
+
+void Analysis::setCostAccountingEnabled(bool enable)
+{
+    if (enable != isCostAccountingEnabled())
+    {
+        setProperty("CostAccounting", enable);
+        setModified();
+    }
+}
+
+bool Analysis::isCostAccountingEnabled() const
+{
+    return property("CostAccounting").toBool();
+}
+
+QVector<ObjectCostInfo> Analysis::getObjectCosts() const
+{
+    std::lock_guard<std::mutex> guard(d->costsMutex_);
+    return d->costs_;
+}
+
+bool Analysis::isUsingReplicas() const
+{
+    return static_cast<bool>(d->replicaSet_);
+}
+
+void Analysis::disableReplicas()
+{
+    d->stopReplicas();
+}
+
+OperatorVector Analysis::getEventOrderDependentOperators() const
+{
+    OperatorVector result;
+
+    for (const auto &op: m_operators)
+    {
+        // RetainValid has no a2 implementation but keeps the last valid input
+        // across events.
+        if (qobject_cast<RetainValid *>(op.get()))
+        {
+            result.push_back(op);
+            continue;
+        }
+
+        if (auto a2_op = m_a2State->operatorMap.value(op.get(), nullptr))
+        {
+            if (a2::a2_operator_requires_event_order(a2_op))
+                result.push_back(op);
+        }
+    }
+
+    return result;
+}
+
 vme_analysis_common::VMEIdToIndex Analysis::getVMEIdToIndexMapping() const
 {
     return m_vmeMap;
@@ -74,6 +74,16 @@ namespace analysis
 {
 struct A2AdapterState;
 
+/* Cost counters of an analysis data source or operator, see
+ * a2::a2_set_cost_accounting(). */
+struct ObjectCostInfo
+{
+    QUuid objectId;
+    s32 eventIndex = -1;
+    bool isSource = false;
+    a2::ObjectCost cost;
+};
+
 struct LIBMVME_EXPORT Parameter
 {
     bool valid = false;
@@ -1789,6 +1799,14 @@ class LIBMVME_EXPORT Histo1DSink: public BasicSink
         s32 m_bins = 1u << 13;
         QString m_xAxisTitle;
 
+        // Element type of the histogram bins. The integer types use less
+        // memory and fill faster but cannot hold weighted or fractional
+        // contents.
+        a2::BinStorageType m_binStorageType = a2::BinStorageType::Double;
+
+        a2::BinStorageType getBinStorageType() const { return m_binStorageType; }
+        void setBinStorageType(a2::BinStorageType type) { m_binStorageType = type; }
+
         // Subrange limits
         double m_xLimitMin = make_quiet_nan();
         double m_xLimitMax = make_quiet_nan();
@@ -1840,6 +1858,19 @@ class LIBMVME_EXPORT Histo2DSink: public SinkInterface
         s32 m_xBins = 1u << 10;
         s32 m_yBins = 1u << 10;
 
+        // Element type of the histogram bins. See Histo1DSink.
+        a2::BinStorageType m_binStorageType = a2::BinStorageType::Double;
+
+        // Use sparse tiled storage which only allocates memory for regions
+        // that were hit. Meant for large, mostly empty histograms.
+        bool m_tiledStorage = false;
+
+        bool isTiledStorage() const { return m_tiledStorage; }
+        void setTiledStorage(bool tiled) { m_tiledStorage = tiled; }
+
+        a2::BinStorageType getBinStorageType() const { return m_binStorageType; }
+        void setBinStorageType(a2::BinStorageType type) { m_binStorageType = type; }
+
         // For subrange selection. Makes it possible to get a high resolution
         // view of a rectangular part of the input without having to add a cut
         // operator. This might be temporary or stay in even after cuts are
@@ -2024,12 +2055,21 @@ class LIBMVME_EXPORT WaveformSink: public SinkInterface
         void setTraceHistoryMaxDepth(size_t maxDepth);
         size_t getTraceHistoryMaxDepth() const;
 
-        // Returns a deep copy of the trace histories. Possibly expensive.
+        // Returns a snapshot of the trace histories, newest trace first in
+        // each channel. Copies the data out of the trace rings written by the
+        // analysis. Does not block the analysis thread.
         mesytec::mvme::waveforms::TraceHistories getTraceHistories() const;
 
-        // Reference to the internal trace histories guarded by a mutex. Do not
-        // keep locked for long as it will stall analysis processing.
-        mesytec::mvlc::Protected<mesytec::mvme::waveforms::TraceHistories> &getTraceHistoriesProtected();
+        // Same as above but reuses the memory of the traces in dest.
+        void getTraceHistories(mesytec::mvme::waveforms::TraceHistories &dest) const;
+
+        // Changes whenever traces are recorded or the history is cleared.
+        // Cheap way to check for new data before taking a snapshot.
+        u64 getTraceHistoryVersion() const;
+
+        // The trace rings are created and written by the a2 runtime. The mutex
+        // only guards the pointer, it is not locked while processing events.
+        mesytec::mvlc::Protected<std::shared_ptr<mesytec::mvme::waveforms::TraceRings>> &getTraceRingsProtected();
 
     private:
         struct Private;
@@ -2038,6 +2078,55 @@ class LIBMVME_EXPORT WaveformSink: public SinkInterface
 
 void connect_mdpp_sample_decoder_to_waveform_sink(DataSourceMdppSampleDecoder *decoder, WaveformSink *sink);
 
+// Extracts baseline, amplitude, integral, rise time and CFD time from sampled
+// waveforms. Inputs are laid out like those of the WaveformSink: phase array,
+// config array, then one sample array per channel. Each output is an array
+// indexed by channel. See a2::make_waveform_features() for details.
+class LIBMVME_EXPORT WaveformFeatureExtractor: public OperatorInterface
+{
+    Q_OBJECT
+    Q_INTERFACES(analysis::OperatorInterface)
+    public:
+        Q_INVOKABLE WaveformFeatureExtractor(QObject *parent = nullptr);
+        ~WaveformFeatureExtractor() override;
+
+        // Init and execute
+        virtual void beginRun(const RunInfo &runInfo, Logger logger = {}) override;
+
+        // Inputs
+        virtual bool hasVariableNumberOfSlots() const override { return true; }
+        virtual bool addSlot() override;
+        virtual bool removeLastSlot() override;
+
+        virtual s32 getNumberOfSlots() const override;
+        virtual Slot *getSlot(s32 slotIndex) override;
+
+        // Outputs
+        virtual bool hasVariableNumberOfOutputs() const override { return false; }
+        virtual s32 getNumberOfOutputs() const override;
+        virtual QString getOutputName(s32 outputIndex) const override;
+        virtual Pipe *getOutput(s32 outputIndex) override;
+
+        // Serialization
+        virtual void read(const QJsonObject &json) override;
+        virtual void write(QJsonObject &json) const override;
+
+        // Info
+        virtual QString getDisplayName() const override { return QSL("Waveform Features"); }
+        virtual QString getShortName() const override { return QSL("WaveformFeatures"); }
+
+        a2::WaveformFeaturesParameters getParameters() const { return m_params; }
+        void setParameters(const a2::WaveformFeaturesParameters &params) { m_params = params; }
+
+    private:
+        QVector<std::shared_ptr<Slot>> m_inputs;
+        QVector<std::shared_ptr<Pipe>> m_outputs;
+        a2::WaveformFeaturesParameters m_params;
+};
+
+void connect_mdpp_sample_decoder_to_waveform_features(
+    DataSourceMdppSampleDecoder *decoder, WaveformFeatureExtractor *op);
+
 class LIBMVME_EXPORT ExportSink: public SinkInterface
 {
     Q_OBJECT
@@ -2446,6 +2535,64 @@ class LIBMVME_EXPORT Analysis:
         void setUserLevelsHidden(const QVector<bool> &hidden);
         QVector<bool> getUserLevelsHidden() const;
 
+        /* Number of threads used to step the operators of each rank in
+         * parallel. Values <= 1 select the serial a2 path. Takes effect on the
+         * next beginRun(). See a2::a2_set_operator_thread_count(). */
+        void setOperatorThreadCount(int threadCount);
+        int getOperatorThreadCount() const;
+
+        /* Number of A2 replicas used to process events in parallel during
+         * replays. Each replica runs in its own thread and handles a subset
+         * of the events. Histogram contents are merged into the visible
+         * histograms on timeticks and at the end of the run. Values <= 1
+         * disable the mode. The mode is also disabled if any operator depends
+         * on the order of events, see
+         * getEventOrderDependentOperators(). While active the primary
+         * A2 instance does not process events, so per-event output values
+         * and condition bits are not updated. Stream consumers reading those
+         * disable the mode for their run, see disableReplicas(). Takes effect
+         * on the next beginRun(). */
+        void setReplayReplicaCount(int replicaCount);
+        int getReplayReplicaCount() const;
+        bool isUsingReplicas() const;
+
+        /* Stops the replicas of the current run so that the primary A2
+         * processes the events. Must be called from the analysis thread after
+         * beginRun() and before the first event is processed. */
+        void disableReplicas();
+
+        /* Selects the buffered histogram fill strategy which collects fills
+         * per histogram and applies them in batches. Histogram contents
+         * become visible on the next timetick. Takes effect on the next
+         * beginRun(). See a2::HistoFillBuffered. */
+        void setUseBufferedHistoFill(bool useBuffered);
+        bool getUseBufferedHistoFill() const;
+
+        /* Compiles expression operator and expression condition scripts to
+         * native code using the host compiler. Scripts which cannot be
+         * translated keep using the exprtk interpreter. Takes effect on the
+         * next beginRun(). See a2::expr_codegen. */
+        void setUseNativeExpressions(bool useNative);
+        bool getUseNativeExpressions() const;
+
+        /* Records the time spent in and the number of steps and condition
+         * skips of each data source and operator. Takes effect on the next
+         * beginRun(). See a2::a2_set_cost_accounting(). */
+        void setCostAccountingEnabled(bool enable);
+        bool isCostAccountingEnabled() const;
+
+        /* Cost counters of the current or last run, summed over the A2
+         * replicas if event-parallel replay is active. Empty if cost
+         * accounting was disabled for the run. Returns a snapshot published
+         * by the analysis thread on each timetick and at the end of the run,
+         * so it is safe to call from the GUI thread. */
+        QVector<ObjectCostInfo> getObjectCosts() const;
+
+        /* Returns the operators which prevent event-parallel replays, e.g.
+         * PreviousValue, RetainValid, ExportSink and rate monitors. Only valid
+         * after beginRun(). */
+        OperatorVector getEventOrderDependentOperators() const;
+
         vme_analysis_common::VMEIdToIndex getVMEIdToIndexMapping() const;
 
         vme_analysis_common::EventModuleIndexMaps getModuleIndexMappings() const;
@@ -0,0 +1,256 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "analysis_cost_widget.h"
+
+#include <cmath>
+#include <QCheckBox>
+#include <QHeaderView>
+#include <QLabel>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QTimer>
+
+#include "analysis.h"
+#include "qt_util.h"
+#include "vme_config.h"
+
+namespace analysis
+{
+
+namespace
+{
+
+enum Column
+{
+    Col_Name,
+    Col_Type,
+    Col_Event,
+    Col_Directory,
+    Col_Cycles,
+    Col_CostPercent,
+    Col_Steps,
+    Col_CyclesPerStep,
+    Col_ConditionSkips,
+    ColumnCount
+};
+
+static const char *ColumnTitles[ColumnCount] =
+{
+    "Name",
+    "Type",
+    "Event",
+    "Directory",
+    "Cycles",
+    "Cost %",
+    "Steps",
+    "Cycles/Step",
+    "Cond. Skips",
+};
+
+// Item showing the given value. Numeric values sort numerically.
+QTableWidgetItem *make_item(const QVariant &value)
+{
+    auto item = new QTableWidgetItem;
+    item->setData(Qt::DisplayRole, value);
+    item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled);
+
+    if (value.type() != QVariant::String)
+        item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+
+    return item;
+}
+
+}
+
+struct AnalysisCostWidget::Private
+{
+    AnalysisServiceProvider *serviceProvider;
+    QCheckBox *cb_enable;
+    QCheckBox *cb_autoRefresh;
+    QLabel *label_summary;
+    QTableWidget *table;
+    QTimer refreshTimer;
+};
+
+AnalysisCostWidget::AnalysisCostWidget(AnalysisServiceProvider *asp, QWidget *parent)
+    : QWidget(parent)
+    , d(std::make_unique<Private>())
+{
+    d->serviceProvider = asp;
+
+    setWindowTitle(QSL("Analysis Object Costs"));
+
+    d->cb_enable = new QCheckBox(QSL("Enable cost accounting"));
+    d->cb_enable->setToolTip(QSL("Record the time spent in each data source and operator.\n"
+                                 "Adds a small overhead to each step. Takes effect on the next run start."));
+    d->cb_enable->setChecked(asp->getAnalysis()->isCostAccountingEnabled());
+
+    d->cb_autoRefresh = new QCheckBox(QSL("Auto refresh"));
+    d->cb_autoRefresh->setChecked(true);
+
+    auto pb_refresh = new QPushButton(QSL("Refresh"));
+
+    d->label_summary = new QLabel;
+
+    d->table = new QTableWidget(0, ColumnCount);
+    {
+        QStringList titles;
+        for (auto title: ColumnTitles)
+            titles.push_back(title);
+
+        auto t = d->table;
+        t->setHorizontalHeaderLabels(titles);
+        t->setSelectionBehavior(QAbstractItemView::SelectRows);
+        t->setSortingEnabled(true);
+        t->sortByColumn(Col_Cycles, Qt::DescendingOrder);
+        t->verticalHeader()->hide();
+        t->horizontalHeader()->setHighlightSections(false);
+        t->horizontalHeader()->setStretchLastSection(true);
+    }
+
+    auto controlsLayout = make_hbox<0, 2>();
+    controlsLayout->addWidget(d->cb_enable);
+    controlsLayout->addWidget(d->cb_autoRefresh);
+    controlsLayout->addWidget(pb_refresh);
+    controlsLayout->addStretch(1);
+
+    auto layout = make_vbox<2, 2>(this);
+    layout->addLayout(controlsLayout);
+    layout->addWidget(d->label_summary);
+    layout->addWidget(d->table, 1);
+
+    connect(d->cb_enable, &QCheckBox::toggled, this, [this] (bool enable)
+    {
+        d->serviceProvider->getAnalysis()->setCostAccountingEnabled(enable);
+    });
+
+    connect(pb_refresh, &QPushButton::clicked, this, &AnalysisCostWidget::update);
+
+    connect(&d->refreshTimer, &QTimer::timeout, this, [this]
+    {
+        if (d->cb_autoRefresh->isChecked())
+            update();
+    });
+
+    d->refreshTimer.setInterval(1000);
+    d->refreshTimer.start();
+
+    resize(1000, 600);
+    update();
+}
+
+AnalysisCostWidget::~AnalysisCostWidget()
+{
+}
+
+void AnalysisCostWidget::update()
+{
+    auto analysis = d->serviceProvider->getAnalysis();
+    auto vmeConfig = d->serviceProvider->getVMEConfig();
+
+    {
+        QSignalBlocker sb(d->cb_enable);
+        d->cb_enable->setChecked(analysis->isCostAccountingEnabled());
+    }
+
+    const auto costs = analysis->getObjectCosts();
+
+    u64 totalCycles = 0;
+
+    for (const auto &info: costs)
+        totalCycles += info.cost.cycles;
+
+    d->label_summary->setText(costs.isEmpty()
+        ? QSL("No data. Enable cost accounting and (re)start the run.")
+        : QSL("%1 objects, %2 cycles total").arg(costs.size()).arg(totalCycles));
+
+    // Keep the row of the current object selected.
+    QString currentId;
+
+    if (auto item = d->table->item(d->table->currentRow(), Col_Name))
+        currentId = item->data(Qt::UserRole).toString();
+
+    d->table->setSortingEnabled(false);
+    d->table->clearContents();
+    d->table->setRowCount(costs.size());
+
+    int row = 0;
+
+    for (const auto &info: costs)
+    {
+        auto obj = analysis->getObject(info.objectId);
+
+        if (!obj)
+            continue;
+
+        QString typeName;
+
+        if (auto op = std::dynamic_pointer_cast<OperatorInterface>(obj))
+            typeName = op->getDisplayName();
+        else if (auto src = std::dynamic_pointer_cast<SourceInterface>(obj))
+            typeName = src->getDisplayName();
+
+        QString eventName = QString::number(info.eventIndex);
+
+        if (vmeConfig)
+        {
+            if (auto eventConfig = vmeConfig->getEventConfig(info.eventIndex))
+                eventName = eventConfig->objectName();
+        }
+
+        QString dirName;
+
+        if (auto dir = analysis->getParentDirectory(obj))
+            dirName = dir->objectName();
+
+        const auto &cost = info.cost;
+        const double percent = totalCycles ? cost.cycles * 100.0 / totalCycles : 0.0;
+        const qulonglong perStep = cost.steps ? cost.cycles / cost.steps : 0;
+
+        auto nameItem = make_item(obj->objectName());
+        nameItem->setData(Qt::UserRole, info.objectId.toString());
+
+        d->table->setItem(row, Col_Name, nameItem);
+        d->table->setItem(row, Col_Type, make_item(typeName));
+        d->table->setItem(row, Col_Event, make_item(eventName));
+        d->table->setItem(row, Col_Directory, make_item(dirName));
+        d->table->setItem(row, Col_Cycles, make_item(static_cast<qulonglong>(cost.cycles)));
+        d->table->setItem(row, Col_CostPercent, make_item(std::round(percent * 100.0) / 100.0));
+        d->table->setItem(row, Col_Steps, make_item(static_cast<qulonglong>(cost.steps)));
+        d->table->setItem(row, Col_CyclesPerStep, make_item(perStep));
+        d->table->setItem(row, Col_ConditionSkips, make_item(info.isSource
+                                                             ? QVariant(QString())
+                                                             : QVariant(static_cast<qulonglong>(cost.conditionSkips))));
+
+        if (!currentId.isEmpty() && currentId == info.objectId.toString())
+            d->table->setCurrentItem(nameItem);
+
+        ++row;
+    }
+
+    d->table->setRowCount(row);
+    d->table->setSortingEnabled(true);
+
+    if (d->table->columnWidth(Col_Name) < 50)
+        d->table->resizeColumnsToContents();
+}
+
+}
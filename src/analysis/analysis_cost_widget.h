@@ -0,0 +1,52 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __MVME_ANALYSIS_COST_WIDGET_H__
+#define __MVME_ANALYSIS_COST_WIDGET_H__
+
+#include <memory>
+#include <QWidget>
+
+#include "libmvme_export.h"
+#include "analysis_service_provider.h"
+
+namespace analysis
+{
+
+// Table of the per object cost counters recorded by the a2 runtime, see
+// Analysis::setCostAccountingEnabled(). Sortable by each column to find the
+// most expensive data sources and operators.
+class LIBMVME_EXPORT AnalysisCostWidget: public QWidget
+{
+    Q_OBJECT
+    public:
+        explicit AnalysisCostWidget(AnalysisServiceProvider *asp, QWidget *parent = nullptr);
+        ~AnalysisCostWidget() override;
+
+    private:
+        void update();
+
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+}
+
+#endif /* __MVME_ANALYSIS_COST_WIDGET_H__ */
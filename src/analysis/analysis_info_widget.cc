@@ -23,15 +23,18 @@
 #include <cmath>
 #include <sstream>
 
+#include <QCheckBox>
 #include <QFormLayout>
 #include <QGroupBox>
 #include <QPlainTextEdit>
 #include <QPushButton>
+#include <QScrollBar>
 #include <QTabWidget>
 #include <QTimer>
 
 #include "util/qt_font.h"
 #include "util/qt_monospace_textedit.h"
+#include "util/profiling.h"
 #include "util/strings.h"
 #include "multiplot_widget.h"
 #include "mvlc_stream_worker.h"
@@ -104,6 +107,10 @@ struct AnalysisInfoWidgetPrivate
 
     mesytec::mvlc::event_builder2::BuilderCounters prevEventBuilder2Counters;
 
+    QWidget *profilingWidget;
+    QCheckBox *cb_profilingEnabled;
+    QPlainTextEdit *profilingText;
+
     void updateMVLCWidget(
         const mesytec::mvlc::readout_parser::ReadoutParserCounters &counters,
         double dt);
@@ -115,6 +122,7 @@ struct AnalysisInfoWidgetPrivate
 
     void showEventBuilder2HistosWidget();
     void updateEventBuilder2HistosWidget(const mesytec::mvlc::event_builder2::BuilderCounters &counters);
+    void updateProfilingWidget();
 };
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 8, 0))
@@ -237,12 +245,46 @@ AnalysisInfoWidget::AnalysisInfoWidget(AnalysisServiceProvider *serviceProvider,
         m_d->showEventBuilder2HistosWidget();
     });
 
+    // Scoped timer results of the readout parser and the analysis.
+    m_d->profilingWidget = new QWidget;
+    m_d->cb_profilingEnabled = new QCheckBox("Enable profiling");
+    m_d->cb_profilingEnabled->setChecked(mvme::profiling::is_enabled());
+    m_d->cb_profilingEnabled->setToolTip(
+        "Records per call site timings of the readout parser and the analysis."
+        " Adds a small overhead to each measured scope while enabled.");
+    auto pb_resetProfiling = new QPushButton("Reset");
+    m_d->profilingText = mvme::util::make_monospace_plain_textedit().release();
+    m_d->profilingText->setLineWrapMode(QPlainTextEdit::NoWrap);
+    {
+        auto buttonLayout = make_hbox<0, 2>();
+        buttonLayout->addWidget(m_d->cb_profilingEnabled);
+        buttonLayout->addWidget(pb_resetProfiling);
+        buttonLayout->addStretch(1);
+
+        auto l = make_layout<QVBoxLayout, 0, 2>(m_d->profilingWidget);
+        l->addLayout(buttonLayout);
+        l->addWidget(m_d->profilingText);
+    }
+
+    connect(m_d->cb_profilingEnabled, &QCheckBox::toggled, this, [this] (bool enable)
+    {
+        mvme::profiling::set_enabled(enable);
+        m_d->updateProfilingWidget();
+    });
+
+    connect(pb_resetProfiling, &QPushButton::clicked, this, [this]
+    {
+        mvme::profiling::reset();
+        m_d->updateProfilingWidget();
+    });
+
     // tabwidget for mvlc and event builder counters
     m_d->tabbedWidget = new QTabWidget;
     auto tabWidget = m_d->tabbedWidget;
     tabWidget->addTab(m_d->mvlcInfoWidget, "MVLC Readout Parser Counters");
     tabWidget->addTab(m_d->multiEventSplitterInfoWidget, "Multi Event Splitter Counters");
     tabWidget->addTab(m_d->eventBuilder2Widget, "Event Builder Counters");
+    tabWidget->addTab(m_d->profilingWidget, "Profiling");
 
     // outer widget layout
     auto outerLayout = new QVBoxLayout(this);
@@ -501,9 +543,22 @@ void AnalysisInfoWidget::update()
     // multievent: module size exceeds buffer
     m_d->labels[ii++]->setText(multiEventSizeExceededText);
 
+    // The profiling tab applies to all controllers, the others to the MVLC
+    // only.
+    for (int tabIndex = 0; tabIndex < m_d->tabbedWidget->count(); ++tabIndex)
+    {
+        if (m_d->tabbedWidget->widget(tabIndex) != m_d->profilingWidget)
+            m_d->tabbedWidget->setTabEnabled(tabIndex, mvlcWorker);
+    }
+
+    if (!mvlcWorker)
+        m_d->tabbedWidget->setCurrentWidget(m_d->profilingWidget);
+
+    if (m_d->tabbedWidget->currentWidget() == m_d->profilingWidget)
+        m_d->updateProfilingWidget();
+
     if (mvlcWorker)
     {
-        m_d->tabbedWidget->setVisible(true);
 
         {
             auto counters = mvlcWorker->getReadoutParserCounters();
@@ -518,10 +573,6 @@ void AnalysisInfoWidget::update()
             m_d->prevEventBuilder2Counters = counters;
         }
     }
-    else
-    {
-        m_d->tabbedWidget->setVisible(false);
-    }
 
     m_d->prevCounters = counters;
     m_d->lastUpdateTime = QDateTime::currentDateTime();
@@ -693,6 +744,25 @@ void AnalysisInfoWidgetPrivate::updateEventBuilder2Widget(
     append_lines(oss, eventBuilder2StatsText);
 }
 
+void AnalysisInfoWidgetPrivate::updateProfilingWidget()
+{
+    if (!mvme::profiling::is_enabled() && profilingText->document()->isEmpty())
+    {
+        profilingText->setPlainText("Profiling is disabled.");
+        return;
+    }
+
+    std::ostringstream oss;
+    mvme::profiling::format_snapshot_tabular(oss, mvme::profiling::snapshot());
+
+    // Keep the scroll position across updates.
+    auto vScroll = profilingText->verticalScrollBar()->value();
+    auto hScroll = profilingText->horizontalScrollBar()->value();
+    profilingText->setPlainText(QString::fromStdString(oss.str()));
+    profilingText->verticalScrollBar()->setValue(vScroll);
+    profilingText->horizontalScrollBar()->setValue(hScroll);
+}
+
 void AnalysisInfoWidgetPrivate::showEventBuilder2HistosWidget()
 {
     if (qobject_cast<MVLC_StreamWorker *>(serviceProvider->getMVMEStreamWorker()))
@@ -42,6 +42,85 @@ QByteArray to_json(T *obj)
     return QJsonDocument(json).toBinaryData();
 }
 
+/* Histogram bins are always stored as doubles in session files, independent
+ * of the in-memory bin storage type. This keeps existing sessions loadable and
+ * allows changing the storage type of a sink between saving and loading. */
+static const size_t BinConversionChunkSize = 1u << 14;
+
+void write_bins(QDataStream &out, const void *data, a2::BinStorageType type, size_t binCount)
+{
+    if (type == a2::BinStorageType::Double)
+    {
+        out.writeRawData(reinterpret_cast<const char *>(data), binCount * sizeof(double));
+        return;
+    }
+
+    std::vector<double> buffer(std::min(binCount, BinConversionChunkSize));
+
+    for (size_t offset = 0; offset < binCount; offset += buffer.size())
+    {
+        size_t count = std::min(buffer.size(), binCount - offset);
+
+        for (size_t i = 0; i < count; i++)
+            buffer[i] = a2::read_bin(data, type, offset + i);
+
+        out.writeRawData(reinterpret_cast<const char *>(buffer.data()), count * sizeof(double));
+    }
+}
+
+// Tiled 2D histograms are written in the dense format as well.
+void write_tiled_bins(QDataStream &out, const a2::TiledHistoStorage &tiles, size_t binCount)
+{
+    std::vector<double> buffer(std::min(binCount, BinConversionChunkSize));
+
+    for (size_t offset = 0; offset < binCount; offset += buffer.size())
+    {
+        size_t count = std::min(buffer.size(), binCount - offset);
+
+        for (size_t i = 0; i < count; i++)
+            buffer[i] = tiles.getLinearBin(offset + i);
+
+        out.writeRawData(reinterpret_cast<const char *>(buffer.data()), count * sizeof(double));
+    }
+}
+
+// Zero bins do not allocate tiles, so the loaded histogram stays sparse.
+void read_tiled_bins(QDataStream &in, a2::TiledHistoStorage &tiles, size_t binCount)
+{
+    std::vector<double> buffer(std::min(binCount, BinConversionChunkSize));
+
+    for (size_t offset = 0; offset < binCount; offset += buffer.size())
+    {
+        size_t count = std::min(buffer.size(), binCount - offset);
+
+        in.readRawData(reinterpret_cast<char *>(buffer.data()), count * sizeof(double));
+
+        for (size_t i = 0; i < count; i++)
+            tiles.setLinearBin(offset + i, buffer[i]);
+    }
+}
+
+void read_bins(QDataStream &in, void *data, a2::BinStorageType type, size_t binCount)
+{
+    if (type == a2::BinStorageType::Double)
+    {
+        in.readRawData(reinterpret_cast<char *>(data), binCount * sizeof(double));
+        return;
+    }
+
+    std::vector<double> buffer(std::min(binCount, BinConversionChunkSize));
+
+    for (size_t offset = 0; offset < binCount; offset += buffer.size())
+    {
+        size_t count = std::min(buffer.size(), binCount - offset);
+
+        in.readRawData(reinterpret_cast<char *>(buffer.data()), count * sizeof(double));
+
+        for (size_t i = 0; i < count; i++)
+            a2::write_bin(data, type, offset + i, buffer[i]);
+    }
+}
+
 }
 
 namespace analysis
@@ -64,8 +143,7 @@ void save(QDataStream &out, const Histo1DSink *obj)
         {
             out << static_cast<u32>(histo->getNumberOfBins());
             out << static_cast<u32>(histo->getEntryCount());
-            out.writeRawData(reinterpret_cast<const char *>(histo->data()),
-                             histo->getNumberOfBins() * sizeof(double));
+            write_bins(out, histo->data(), histo->getStorageType(), histo->getNumberOfBins());
         }
         else
         {
@@ -106,8 +184,7 @@ void load(QDataStream &in, Histo1DSink *obj)
             throw std::runtime_error("1d histo bin mismatch");
         }
 
-        in.readRawData(reinterpret_cast<char *>(histo->data()),
-                       binCount * sizeof(double));
+        read_bins(in, histo->data(), histo->getStorageType(), binCount);
         histo->setEntryCount(entryCount);
     }
 }
@@ -122,8 +199,12 @@ void save(QDataStream &out, const Histo2DSink *obj)
     if (const auto &histo = obj->getHisto().get())
     {
         out << histo->getNumberOfXBins() << histo->getNumberOfYBins();
-        out.writeRawData(reinterpret_cast<const char *>(histo->data()),
-                         obj->getHistoBinsX() * obj->getHistoBinsY() * sizeof(double));
+        const size_t binCount = histo->getNumberOfXBins() * histo->getNumberOfYBins();
+
+        if (auto tiles = histo->getTiledStorage())
+            write_tiled_bins(out, *tiles, binCount);
+        else
+            write_bins(out, histo->data(), histo->getStorageType(), binCount);
     }
     else
     {
@@ -154,8 +235,10 @@ void load(QDataStream &in, Histo2DSink *obj)
         throw std::runtime_error("2d histo bin mismatch");
     }
 
-    in.readRawData(reinterpret_cast<char *>(histo->data()),
-                    xBins * yBins * sizeof(double));
+    if (auto tiles = histo->getTiledStorage())
+        read_tiled_bins(in, *tiles, xBins * yBins);
+    else
+        read_bins(in, histo->data(), histo->getStorageType(), xBins * yBins);
 }
 
 // RateMonitorSink save/load
@@ -24,6 +24,7 @@
 #include <memory>
 #include <QApplication>
 #include <QComboBox>
+#include <QCheckBox>
 #include <QClipboard>
 #include <QCursor>
 #include <QDesktopServices>
@@ -38,17 +39,20 @@
 #include <QMimeData>
 #include <QProgressDialog>
 #include <QScrollArea>
+#include <QSpinBox>
 #include <QSplitter>
 #include <QStackedWidget>
 #include <QStandardPaths>
 #include <QStatusBar>
 #include <QtConcurrent>
+#include <QThread>
 #include <QTimer>
 #include <QToolBar>
 #include <QToolButton>
 #include <QWidgetAction>
 
 #include "analysis/a2_adapter.h"
+#include "analysis/analysis_cost_widget.h"
 #include "analysis/analysis_info_widget.h"
 #include "analysis/analysis_serialization.h"
 #include "analysis/analysis_session.h"
@@ -129,8 +133,13 @@ struct AnalysisWidgetPrivate
     QTimer *m_periodicUpdateTimer;
     WidgetGeometrySaver *m_geometrySaver;
     AnalysisInfoWidget *m_analysisInfoWidget = nullptr;
+    AnalysisCostWidget *m_analysisCostWidget = nullptr;
     QAction *m_actionPause;
     QAction *m_actionStepNextEvent;
+    QSpinBox *m_spinOperatorThreads = nullptr;
+    QSpinBox *m_spinReplayReplicas = nullptr;
+    QCheckBox *m_cbBufferedHistoFill = nullptr;
+    QCheckBox *m_cbNativeExpressions = nullptr;
     bool m_repopEnabled = true;
     QSettings m_settings;
     MVLCParserDebugHandler *mvlcParserDebugHandler = nullptr;
@@ -277,6 +286,30 @@ void AnalysisWidgetPrivate::repopulate()
 
     m_eventWidgetScrollArea->setWidget(m_eventWidget);
 
+    if (m_spinOperatorThreads)
+    {
+        QSignalBlocker sb(m_spinOperatorThreads);
+        m_spinOperatorThreads->setValue(getAnalysis()->getOperatorThreadCount());
+    }
+
+    if (m_spinReplayReplicas)
+    {
+        QSignalBlocker sb(m_spinReplayReplicas);
+        m_spinReplayReplicas->setValue(getAnalysis()->getReplayReplicaCount());
+    }
+
+    if (m_cbBufferedHistoFill)
+    {
+        QSignalBlocker sb(m_cbBufferedHistoFill);
+        m_cbBufferedHistoFill->setChecked(getAnalysis()->getUseBufferedHistoFill());
+    }
+
+    if (m_cbNativeExpressions)
+    {
+        QSignalBlocker sb(m_cbNativeExpressions);
+        m_cbNativeExpressions->setChecked(getAnalysis()->getUseNativeExpressions());
+    }
+
     updateWindowTitle();
     updateAddRemoveUserLevelButtons();
 }
@@ -850,6 +883,31 @@ AnalysisWidget::AnalysisWidget(AnalysisServiceProvider *asp, QWidget *parent)
             show_and_activate(widget);
         });
 
+        m_d->m_toolbar->addAction(QIcon(":/table.png"), QSL("Object Costs"), this, [this]() {
+
+            AnalysisCostWidget *widget = nullptr;
+
+            if (m_d->m_analysisCostWidget)
+            {
+                widget = m_d->m_analysisCostWidget;
+            }
+            else
+            {
+                widget = new AnalysisCostWidget(m_d->m_serviceProvider);
+                widget->setAttribute(Qt::WA_DeleteOnClose);
+                add_widget_close_action(widget);
+                m_d->m_geometrySaver->addAndRestore(widget, QSL("WindowGeometries/AnalysisCosts"));
+
+                connect(widget, &QObject::destroyed, this, [this]() {
+                    m_d->m_analysisCostWidget = nullptr;
+                });
+
+                m_d->m_analysisCostWidget = widget;
+            }
+
+            show_and_activate(widget);
+        });
+
         // pause, resume, step actions and MVLC parser debugging
         m_d->mvlcParserDebugHandler = new MVLCParserDebugHandler(this);
 
@@ -912,6 +970,81 @@ AnalysisWidget::AnalysisWidget(AnalysisServiceProvider *asp, QWidget *parent)
                     });
         }
 
+        {
+            auto spinbox = new QSpinBox;
+            spinbox->setMinimum(1);
+            spinbox->setMaximum(std::max(1, QThread::idealThreadCount()));
+            spinbox->setSpecialValueText(QSL("serial"));
+            spinbox->setValue(m_d->getAnalysis()->getOperatorThreadCount());
+            spinbox->setToolTip(QSL("Number of threads used to step the analysis operators.\n"
+                                    "Takes effect on the next run start."));
+            auto boxStruct = make_vbox_container(QSL("Operator Threads"), spinbox, 0, -2);
+            m_d->m_toolbar->addWidget(boxStruct.container.release());
+            m_d->m_spinOperatorThreads = spinbox;
+
+            connect(spinbox, qOverload<int>(&QSpinBox::valueChanged),
+                    this, [this](int threadCount) {
+                        m_d->getAnalysis()->setOperatorThreadCount(threadCount);
+                        m_d->updateWindowTitle();
+                    });
+        }
+
+        {
+            auto spinbox = new QSpinBox;
+            spinbox->setMinimum(1);
+            spinbox->setMaximum(std::max(1, QThread::idealThreadCount()));
+            spinbox->setSpecialValueText(QSL("off"));
+            spinbox->setValue(m_d->getAnalysis()->getReplayReplicaCount());
+            spinbox->setToolTip(QSL("Number of analysis instances processing events in parallel during replays.\n"
+                                    "Histograms are merged once per second. Not available if operators\n"
+                                    "depending on the event order are present.\n"
+                                    "Takes effect on the next run start."));
+            auto boxStruct = make_vbox_container(QSL("Replay Replicas"), spinbox, 0, -2);
+            m_d->m_toolbar->addWidget(boxStruct.container.release());
+            m_d->m_spinReplayReplicas = spinbox;
+
+            connect(spinbox, qOverload<int>(&QSpinBox::valueChanged),
+                    this, [this](int replicaCount) {
+                        m_d->getAnalysis()->setReplayReplicaCount(replicaCount);
+                        m_d->updateWindowTitle();
+                    });
+        }
+
+        {
+            auto checkbox = new QCheckBox;
+            checkbox->setChecked(m_d->getAnalysis()->getUseBufferedHistoFill());
+            checkbox->setToolTip(QSL("Collect histogram fills and apply them in batches.\n"
+                                     "Faster with many large histograms, contents are updated once per second.\n"
+                                     "Takes effect on the next run start."));
+            auto boxStruct = make_vbox_container(QSL("Buffered Fill"), checkbox, 0, -2);
+            m_d->m_toolbar->addWidget(boxStruct.container.release());
+            m_d->m_cbBufferedHistoFill = checkbox;
+
+            connect(checkbox, &QCheckBox::toggled,
+                    this, [this](bool checked) {
+                        m_d->getAnalysis()->setUseBufferedHistoFill(checked);
+                        m_d->updateWindowTitle();
+                    });
+        }
+
+        if (a2::expr_codegen::is_supported())
+        {
+            auto checkbox = new QCheckBox;
+            checkbox->setChecked(m_d->getAnalysis()->getUseNativeExpressions());
+            checkbox->setToolTip(QSL("Compile expression operators and expression conditions to native code\n"
+                                     "using the system C++ compiler. Unsupported scripts keep using the interpreter.\n"
+                                     "Takes effect on the next run start."));
+            auto boxStruct = make_vbox_container(QSL("Native Expr"), checkbox, 0, -2);
+            m_d->m_toolbar->addWidget(boxStruct.container.release());
+            m_d->m_cbNativeExpressions = checkbox;
+
+            connect(checkbox, &QCheckBox::toggled,
+                    this, [this](bool checked) {
+                        m_d->getAnalysis()->setUseNativeExpressions(checked);
+                        m_d->updateWindowTitle();
+                    });
+        }
+
         m_d->m_toolbar->addSeparator();
         m_d->m_toolbar->addAction(QIcon(":/document-open.png"), QSL("Load Session"),
                                   this, [this]() { m_d->actionLoadSession(); });
@@ -1549,6 +1549,9 @@ OperatorConfigurationWidget::OperatorConfigurationWidget(OperatorInterface *op,
         select_by_resolution(combo_xBins, histoSink->m_bins);
         formLayout->addRow(QSL("Resolution"), combo_xBins);
 
+        combo_binStorage = make_bin_storage_combo(histoSink->m_binStorageType);
+        formLayout->addRow(QSL("Bin Storage"), combo_binStorage);
+
         limits_x = make_axis_limits_ui(QSL("X Limits"),
                                        std::numeric_limits<double>::lowest(),
                                        std::numeric_limits<double>::max(),
@@ -1579,6 +1582,15 @@ OperatorConfigurationWidget::OperatorConfigurationWidget(OperatorInterface *op,
         formLayout->addRow(QSL("X Resolution"), combo_xBins);
         formLayout->addRow(QSL("Y Resolution"), combo_yBins);
 
+        combo_binStorage = make_bin_storage_combo(histoSink->m_binStorageType);
+        formLayout->addRow(QSL("Bin Storage"), combo_binStorage);
+
+        cb_tiledStorage = new QCheckBox(QSL("Sparse (tiled) storage"));
+        cb_tiledStorage->setChecked(histoSink->m_tiledStorage);
+        cb_tiledStorage->setToolTip(QSL("Only allocate memory for regions of the histogram that"
+                                        " received entries. Useful for large, mostly empty histograms."));
+        formLayout->addRow(cb_tiledStorage);
+
         limits_x = make_axis_limits_ui(QSL("X Limits"),
                                        std::numeric_limits<double>::lowest(),
                                        std::numeric_limits<double>::max(),
@@ -2188,6 +2200,69 @@ OperatorConfigurationWidget::OperatorConfigurationWidget(OperatorInterface *op,
         label->setAlignment(Qt::AlignLeft | Qt::AlignTop);
         formLayout->addRow(label);
     }
+    else if (auto wfOp = qobject_cast<WaveformFeatureExtractor *>(op))
+    {
+        const auto params = wfOp->getParameters();
+
+        spin_baselineSamples = new QSpinBox;
+        spin_baselineSamples->setMinimum(0);
+        spin_baselineSamples->setMaximum(1u << 16);
+        spin_baselineSamples->setValue(params.baselineSamples);
+        formLayout->addRow(QSL("Baseline Samples"), spin_baselineSamples);
+
+        spin_integralStart = new QSpinBox;
+        spin_integralStart->setMinimum(0);
+        spin_integralStart->setMaximum(1u << 16);
+        spin_integralStart->setValue(params.integralStart);
+        formLayout->addRow(QSL("Integral Start Sample"), spin_integralStart);
+
+        spin_integralLength = new QSpinBox;
+        spin_integralLength->setMinimum(0);
+        spin_integralLength->setMaximum(1u << 16);
+        spin_integralLength->setSpecialValueText(QSL("to end of trace"));
+        spin_integralLength->setValue(params.integralLength);
+        formLayout->addRow(QSL("Integral Length"), spin_integralLength);
+
+        spin_cfdFraction = new QDoubleSpinBox;
+        spin_cfdFraction->setDecimals(3);
+        spin_cfdFraction->setSingleStep(0.05);
+        spin_cfdFraction->setMinimum(0.001);
+        spin_cfdFraction->setMaximum(1.0);
+        spin_cfdFraction->setValue(params.cfdFraction);
+        formLayout->addRow(QSL("CFD Fraction"), spin_cfdFraction);
+
+        spin_cfdDelay = new QSpinBox;
+        spin_cfdDelay->setMinimum(1);
+        spin_cfdDelay->setMaximum(1u << 10);
+        spin_cfdDelay->setSuffix(QSL(" samples"));
+        spin_cfdDelay->setValue(params.cfdDelay);
+        formLayout->addRow(QSL("CFD Delay"), spin_cfdDelay);
+
+        spin_dtSample = new QDoubleSpinBox;
+        spin_dtSample->setDecimals(3);
+        spin_dtSample->setMinimum(0.001);
+        spin_dtSample->setMaximum(1e6);
+        spin_dtSample->setSuffix(QSL(" ns"));
+        spin_dtSample->setValue(params.dtSample);
+        formLayout->addRow(QSL("Sample Period"), spin_dtSample);
+
+        combo_phaseCorrection = new QComboBox;
+        combo_phaseCorrection->addItem(QSL("Auto"), static_cast<int>(a2::WaveformPhaseCorrection::Auto));
+        combo_phaseCorrection->addItem(QSL("On"), static_cast<int>(a2::WaveformPhaseCorrection::On));
+        combo_phaseCorrection->addItem(QSL("Off"), static_cast<int>(a2::WaveformPhaseCorrection::Off));
+        combo_phaseCorrection->setCurrentIndex(
+            combo_phaseCorrection->findData(static_cast<int>(params.phaseCorrection)));
+        formLayout->addRow(QSL("Phase Correction"), combo_phaseCorrection);
+
+        auto label = make_framed_description_label(QSL(
+                "Outputs one value per input channel for each feature. Times are "
+                "relative to the first sample of the trace. With phase correction "
+                "set to 'Auto' the phase is applied if the module did not resample "
+                "the trace."
+                ));
+        label->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+        formLayout->addRow(label);
+    }
 }
 
 // NOTE: This will be called after construction for each slot by AddEditOperatorDialog::repopulateSlotGrid()!
@@ -2465,6 +2540,8 @@ void OperatorConfigurationWidget::configureOperator()
 
         s32 bins = combo_xBins->currentData().toInt();
         histoSink->m_bins = bins;
+        histoSink->m_binStorageType = static_cast<a2::BinStorageType>(
+            combo_binStorage->currentData().toInt());
 
         if (limits_x.rb_limited->isChecked())
         {
@@ -2489,6 +2566,9 @@ void OperatorConfigurationWidget::configureOperator()
 
         histoSink->m_xBins = xBins;
         histoSink->m_yBins = yBins;
+        histoSink->m_binStorageType = static_cast<a2::BinStorageType>(
+            combo_binStorage->currentData().toInt());
+        histoSink->m_tiledStorage = cb_tiledStorage->isChecked();
 
         if (limits_x.rb_limited->isChecked())
         {
@@ -2614,6 +2694,19 @@ void OperatorConfigurationWidget::configureOperator()
     {
         evhist->setTraceHistoryMaxDepth(spin_historyMaxDepth->value());
     }
+    else if (auto wfOp = qobject_cast<WaveformFeatureExtractor *>(op))
+    {
+        auto params = wfOp->getParameters();
+        params.baselineSamples = spin_baselineSamples->value();
+        params.integralStart = spin_integralStart->value();
+        params.integralLength = spin_integralLength->value();
+        params.cfdFraction = spin_cfdFraction->value();
+        params.cfdDelay = spin_cfdDelay->value();
+        params.dtSample = spin_dtSample->value();
+        params.phaseCorrection = static_cast<a2::WaveformPhaseCorrection>(
+            combo_phaseCorrection->currentData().toInt());
+        wfOp->setParameters(params);
+    }
 }
 
 void OperatorConfigurationWidget::updateOutputLimits(BinarySumDiff *op)
@@ -3701,6 +3794,8 @@ ExportSinkStatusMonitor::ExportSinkStatusMonitor(const std::shared_ptr<ExportSin
     , label_fileSize(new QLabel)
     , label_eventsWritten(new QLabel)
     , label_bytesWritten(new QLabel)
+    , label_writerQueue(new QLabel)
+    , label_writerStalls(new QLabel)
     , label_status(new QLabel)
     , pb_openDirectory(new QPushButton(QIcon(":/folder_orange.png"), QSL("Open")))
 {
@@ -3722,6 +3817,8 @@ ExportSinkStatusMonitor::ExportSinkStatusMonitor(const std::shared_ptr<ExportSin
         l->addRow(QSL("Output File Size"),  label_fileSize);
         l->addRow(QSL("Bytes Written"),     label_bytesWritten);
         l->addRow(QSL("Events Written"),    label_eventsWritten);
+        l->addRow(QSL("Writer Queue"),      label_writerQueue);
+        l->addRow(QSL("Writer Stalls"),     label_writerStalls);
         l->addRow(QSL("Status"),            label_status);
     }
 
@@ -3759,6 +3856,12 @@ void ExportSinkStatusMonitor::update()
         label_fileSize->setText(format_number(fileSize, QSL("B"), UnitScaling::Binary));
         label_eventsWritten->setText(QString::number(d->eventsWritten));
         label_bytesWritten->setText(format_number(d->bytesWritten, QSL("B"), UnitScaling::Binary));
+        label_writerQueue->setText(QSL("%1 / %2 chunks of %3")
+                                   .arg(d->writerQueueFill.load())
+                                   .arg(a2::ExportSinkData::WriterChunkCount)
+                                   .arg(format_number(a2::ExportSinkData::WriterChunkSize,
+                                                      QSL("B"), UnitScaling::Binary)));
+        label_writerStalls->setText(QString::number(d->writerStalls.load()));
 
         auto lastError = QString::fromStdString(d->getLastError());
 
@@ -290,6 +290,8 @@ class OperatorConfigurationWidget: public AbstractOpConfigWidget
         // Histo1DSink and Histo2DSink
         QComboBox *combo_xBins = nullptr;
         QComboBox *combo_yBins = nullptr;
+        QComboBox *combo_binStorage = nullptr;
+        QCheckBox *cb_tiledStorage = nullptr;
         QLineEdit *le_xAxisTitle = nullptr;
         QLineEdit *le_yAxisTitle = nullptr;
         HistoAxisLimitsUI limits_x;
@@ -359,6 +361,17 @@ class OperatorConfigurationWidget: public AbstractOpConfigWidget
 
         // EventHistoryRecorder
         QSpinBox *spin_historyMaxDepth = nullptr;
+
+        // WaveformFeatureExtractor
+        QSpinBox *spin_baselineSamples = nullptr,
+                 *spin_integralStart = nullptr,
+                 *spin_integralLength = nullptr,
+                 *spin_cfdDelay = nullptr;
+
+        QDoubleSpinBox *spin_cfdFraction = nullptr,
+                       *spin_dtSample = nullptr;
+
+        QComboBox *combo_phaseCorrection = nullptr;
 };
 
 class CalibrationMinMaxConfigWidget: public AbstractOpConfigWidget
@@ -501,6 +514,8 @@ class ExportSinkStatusMonitor: public QWidget
                *label_fileSize,
                *label_eventsWritten,
                *label_bytesWritten,
+               *label_writerQueue,
+               *label_writerStalls,
                *label_status;
 
         QPushButton *pb_openDirectory;
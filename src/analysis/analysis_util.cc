@@ -758,6 +758,43 @@ DirectoryPtr add_condition_to_analysis(Analysis *analysis, const ConditionPtr &c
     return destDir;
 }
 
+size_t merge_histogram_sinks(Analysis &dest, Analysis &src)
+{
+    auto destState = dest.getA2AdapterState();
+    auto srcState = src.getA2AdapterState();
+
+    if (!destState || !destState->a2 || !srcState || !srcState->a2)
+        return dest.getSinkOperators().size();
+
+    destState->a2->histoFillStrategy.flush();
+    srcState->a2->histoFillStrategy.flush();
+
+    size_t failed = 0;
+
+    for (const auto &destSink: dest.getSinkOperators())
+    {
+        if (!qobject_cast<Histo1DSink *>(destSink.get())
+            && !qobject_cast<Histo2DSink *>(destSink.get()))
+        {
+            continue;
+        }
+
+        auto srcSink = src.getObject<SinkInterface>(destSink->getId());
+        auto destOp = destState->operatorMap.value(destSink.get(), nullptr);
+        auto srcOp = srcSink ? srcState->operatorMap.value(srcSink.get(), nullptr) : nullptr;
+
+        // Sinks that are not part of the a2 system in both analyses, e.g.
+        // because their inputs are not connected, have nothing to merge.
+        if (!destOp && !srcOp)
+            continue;
+
+        if (!destOp || !srcOp || !a2::a2_merge_sink_histos(destOp, srcOp))
+            ++failed;
+    }
+
+    return failed;
+}
+
 QJsonObject to_qjson(const mesytec::mvlc::readout_parser::ReadoutParserCounters &counters)
 {
     using namespace mesytec::mvlc;
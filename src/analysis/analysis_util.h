@@ -238,7 +238,18 @@ std::pair<std::shared_ptr<Analysis>, std::error_code> LIBMVME_EXPORT read_analys
 // not exist yet. Returns the destination directory where the condition was placed.
 DirectoryPtr LIBMVME_EXPORT add_condition_to_analysis(Analysis *analysis, const ConditionPtr &cond);
 
+// Adds the histogram contents of the 1D and 2D sinks of src to the sinks with
+// the same ids in dest and clears the src histograms. Both analyses have to be
+// loaded from the same analysis config and beginRun() must have been called on
+// both. Must not be called while either analysis is processing events.
+// Returns the number of sinks that could not be merged because they are
+// missing in one of the analyses or their histograms differ in size or storage
+// type.
+size_t LIBMVME_EXPORT merge_histogram_sinks(Analysis &dest, Analysis &src);
+
 QJsonObject LIBMVME_EXPORT to_qjson(const mesytec::mvlc::readout_parser::ReadoutParserCounters &parserCounters);
+// Data source hit counts and 1D histogram statistics of the given analysis.
+QJsonObject LIBMVME_EXPORT analysis_statistics_to_json(const Analysis &ana);
 std::pair<bool, QString> LIBMVME_EXPORT save_run_statistics_to_json(
     const RunInfo &runInfo,
     const QString &filename,
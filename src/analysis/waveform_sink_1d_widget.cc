@@ -111,6 +111,7 @@ struct WaveformSink1DWidget::Private
 
     waveforms::TraceHistories analysisTraceData_;
     QTime traceDataUpdateTime_; // when analysisTraceData_ was last updated
+    u64 traceHistoryVersion_ = 0; // sink trace history version at the time of the last update
 
     // Post processed trace data. One history buffer per channel in the source
     // sink. A new trace is prepended to each history buffer every ReplotInterval_ms.
@@ -339,16 +340,16 @@ WaveformSink1DWidget::~WaveformSink1DWidget()
 
 bool WaveformSink1DWidget::Private::updateDataFromAnalysis()
 {
-    auto newAnalysisTraceData = sink_->getTraceHistories();
+    // Cheap check first, the snapshot copies the whole trace history.
+    auto version = sink_->getTraceHistoryVersion();
 
-    if (newAnalysisTraceData != analysisTraceData_)
-    {
-        std::swap(analysisTraceData_, newAnalysisTraceData);
-        traceDataUpdateTime_ = QTime::currentTime();
-        return true;
-    }
+    if (version == traceHistoryVersion_ && !analysisTraceData_.empty())
+        return false;
 
-    return false;
+    traceHistoryVersion_ = version;
+    sink_->getTraceHistories(analysisTraceData_);
+    traceDataUpdateTime_ = QTime::currentTime();
+    return true;
 }
 
 void WaveformSink1DWidget::Private::postProcessData()
@@ -227,9 +227,9 @@ void WaveformSink2DWidget::replot()
 {
     spdlog::trace("begin WaveformSink2DWidget::replot()");
 
-    // Thread-safe copy of the trace history shared with the analysis runtime.
-    // Might be very expensive depending on the size of the trace history.
-    d->traceHistories_ = d->sink_->getTraceHistories();
+    // Lock-free snapshot of the trace rings written by the analysis runtime.
+    // Might be expensive depending on the size of the trace history.
+    d->sink_->getTraceHistories(d->traceHistories_);
 
     d->updateUi(); // update, selection boxes, buttons, etc.
 
@@ -383,15 +383,14 @@ void WaveformSink2DWidget::Private::makeStatusText(std::ostringstream &out, cons
     // About memory: initially a trace history consists of an empty vector of
     // queues of empty vectors.
     //
-    // The analysis sink will quickly fill each channels history buffer to the
-    // max size, then reuse existing buffers.
+    // The analysis sink preallocates a ring of traces with the maximum number
+    // of samples per channel.
     //
     // The UI calls getTraceHistories() on the sink which copies the entire
-    // history. When the internal vectors and queues are copied, the copies may
-    // have less memory reserved than the originals. This happens when traces
-    // are empty due to the sink input data consisting only of invalid
-    // parameters: the sinks reused trace buffers will have the full capacity,
-    // the copies will be empty without any allocation done.
+    // history. The copies only allocate memory for the samples actually
+    // present in each trace. This differs when traces are short or empty due
+    // to the sink input data consisting only of invalid parameters: the sinks
+    // ring slots have the full capacity, the copies will be small or empty.
     //
     // Two effects follow:
     //
@@ -41,6 +41,7 @@ enum CompressionPreset
     Fast_LZ4 = 1,           // LZ4, level 0 (faster than ZIP level 1)
     Fast_ZIP = 2,           // ZIP, level 1 aka "super fast"
     ZmqServer_Ganil = 3,    // Hack to be able to choose ZMQ pub via the compression combo. TODO: redesign the GUI!
+    MT_ZSTD = 4,            // ZSTD, level 3, multi-threaded
 };
 
 static void fill_compression_combo(QComboBox *combo, bool isMVLC)
@@ -55,6 +56,9 @@ static void fill_compression_combo(QComboBox *combo, bool isMVLC)
 
     combo->addItem(QSL("ZIP fast compression"), CompressionPreset::Fast_ZIP);
 
+    if (isMVLC)
+        combo->addItem(QSL("ZSTD multi-threaded compression"), CompressionPreset::MT_ZSTD);
+
 #ifdef MVLC_HAVE_ZMQ
     if (isMVLC)
         combo->addItem(QSL("ZMQ Publisher"), CompressionPreset::ZmqServer_Ganil);
@@ -180,6 +184,11 @@ DAQControlWidget::DAQControlWidget(QWidget *parent)
                 m_listFileOutputInfo.compressionLevel = 0;
                 break;
 
+            case CompressionPreset::MT_ZSTD:
+                m_listFileOutputInfo.format = ListFileFormat::ZSTD;
+                m_listFileOutputInfo.compressionLevel = 3;
+                break;
+
             case CompressionPreset::ZmqServer_Ganil:
                 m_listFileOutputInfo.format = ListFileFormat::ZMQ_Ganil;
                 // Requested by GANIL: always enable "listfile writing" when ZMQ output is selected.
@@ -586,6 +595,8 @@ void DAQControlWidget::updateWidget()
         }
         else if (outputInfo.format == ListFileFormat::LZ4)
             comboData = 1;
+        else if (outputInfo.format == ListFileFormat::ZSTD)
+            comboData = CompressionPreset::MT_ZSTD;
         else if (outputInfo.format == ListFileFormat::ZMQ_Ganil)
             comboData = CompressionPreset::ZmqServer_Ganil;
 
@@ -812,6 +823,11 @@ WorkspaceSettingsDialog::WorkspaceSettingsDialog(const std::shared_ptr<QSettings
     , spin_jsonRPCListenPort(new QSpinBox)
     , spin_eventServerListenPort(new QSpinBox)
     , cb_ignoreStartupErrors(new QCheckBox("Ignore VME Init Startup Errors"))
+    , cb_eventServerSharedMemory(new QCheckBox(QSL("Enable shared memory transport")))
+    , le_eventServerSharedMemoryName(new QLineEdit)
+    , spin_eventServerSharedMemorySize(new QSpinBox)
+    , combo_eventServerOverflowPolicy(new QComboBox)
+    , spin_eventServerClientQueueSize(new QSpinBox)
     , m_bb(new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this))
     , m_settings(settings)
 {
@@ -880,6 +896,15 @@ WorkspaceSettingsDialog::WorkspaceSettingsDialog(const std::shared_ptr<QSettings
     gb_eventServer->setCheckable(true);
     spin_eventServerListenPort->setMinimum(1);
     spin_eventServerListenPort->setMaximum((1 << 16) - 1);
+    spin_eventServerSharedMemorySize->setMinimum(1);
+    spin_eventServerSharedMemorySize->setMaximum(4096);
+    spin_eventServerSharedMemorySize->setSuffix(QSL(" MB"));
+    combo_eventServerOverflowPolicy->addItem(QSL("Block the analysis"), QSL("block"));
+    combo_eventServerOverflowPolicy->addItem(QSL("Drop event data"), QSL("drop"));
+    combo_eventServerOverflowPolicy->addItem(QSL("Disconnect the client"), QSL("disconnect"));
+    spin_eventServerClientQueueSize->setMinimum(1);
+    spin_eventServerClientQueueSize->setMaximum(4096);
+    spin_eventServerClientQueueSize->setSuffix(QSL(" MB"));
 
     {
         auto label = make_explanation_label(QSL(
@@ -888,10 +913,21 @@ WorkspaceSettingsDialog::WorkspaceSettingsDialog(const std::shared_ptr<QSettings
                 "The listen address may be a hostname or an IP address. Leave blank to"
                 " bind to all local interfaces."));
 
+        auto shmLabel = make_explanation_label(QSL(
+                "Clients running on the same host can additionally read the data"
+                " from a shared memory ring buffer (address 'shm:<name>')."
+                " Not supported on Windows."));
+
         auto l = new QFormLayout(gb_eventServer);
         l->addRow(label);
         l->addRow(QSL("Listen Address"), le_eventServerListenAddress);
         l->addRow(QSL("Listen Port"), spin_eventServerListenPort);
+        l->addRow(QSL("Client Queue Size"), spin_eventServerClientQueueSize);
+        l->addRow(QSL("If a Client Queue is full"), combo_eventServerOverflowPolicy);
+        l->addRow(shmLabel);
+        l->addRow(cb_eventServerSharedMemory);
+        l->addRow(QSL("Shared Memory Name"), le_eventServerSharedMemoryName);
+        l->addRow(QSL("Shared Memory Size"), spin_eventServerSharedMemorySize);
     }
 
     widgetLayout->addWidget(gb_jsonRPC);
@@ -933,6 +969,14 @@ void WorkspaceSettingsDialog::populate()
     gb_eventServer->setChecked(m_settings->value(QSL("EventServer/Enabled")).toBool());
     le_eventServerListenAddress->setText(m_settings->value(QSL("EventServer/ListenAddress")).toString());
     spin_eventServerListenPort->setValue(m_settings->value(QSL("EventServer/ListenPort")).toInt());
+    cb_eventServerSharedMemory->setChecked(m_settings->value(QSL("EventServer/SharedMemoryEnabled")).toBool());
+    le_eventServerSharedMemoryName->setText(m_settings->value(QSL("EventServer/SharedMemoryName")).toString());
+    spin_eventServerSharedMemorySize->setValue(m_settings->value(QSL("EventServer/SharedMemorySizeMB")).toInt());
+    spin_eventServerClientQueueSize->setValue(m_settings->value(QSL("EventServer/ClientQueueSizeMB")).toInt());
+
+    auto policyIndex = combo_eventServerOverflowPolicy->findData(
+        m_settings->value(QSL("EventServer/OverflowPolicy")).toString());
+    combo_eventServerOverflowPolicy->setCurrentIndex(std::max(policyIndex, 0));
 }
 
 void WorkspaceSettingsDialog::accept()
@@ -951,6 +995,11 @@ void WorkspaceSettingsDialog::accept()
     m_settings->setValue(QSL("EventServer/Enabled"), gb_eventServer->isChecked());
     m_settings->setValue(QSL("EventServer/ListenAddress"), le_eventServerListenAddress->text());
     m_settings->setValue(QSL("EventServer/ListenPort"), spin_eventServerListenPort->value());
+    m_settings->setValue(QSL("EventServer/SharedMemoryEnabled"), cb_eventServerSharedMemory->isChecked());
+    m_settings->setValue(QSL("EventServer/SharedMemoryName"), le_eventServerSharedMemoryName->text());
+    m_settings->setValue(QSL("EventServer/SharedMemorySizeMB"), spin_eventServerSharedMemorySize->value());
+    m_settings->setValue(QSL("EventServer/OverflowPolicy"), combo_eventServerOverflowPolicy->currentData());
+    m_settings->setValue(QSL("EventServer/ClientQueueSizeMB"), spin_eventServerClientQueueSize->value());
 
     m_settings->sync();
 
@@ -176,7 +176,13 @@ class LIBMVME_EXPORT WorkspaceSettingsDialog: public QDialog
         QSpinBox *spin_jsonRPCListenPort,
                  *spin_eventServerListenPort;
 
-        QCheckBox *cb_ignoreStartupErrors;
+        QCheckBox *cb_ignoreStartupErrors,
+                  *cb_eventServerSharedMemory;
+
+        QLineEdit *le_eventServerSharedMemoryName;
+        QSpinBox *spin_eventServerSharedMemorySize;
+        QComboBox *combo_eventServerOverflowPolicy;
+        QSpinBox *spin_eventServerClientQueueSize;
 
         QDialogButtonBox *m_bb;
 
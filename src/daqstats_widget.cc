@@ -68,6 +68,8 @@ struct DAQStatsWidgetPrivate
            *label_bufferRates,
            *label_bytesRead,
 
+           *label_replayStages,
+
            *label_sisEventLoss,
 
            *label_mvlcFrameTypeErrors,
@@ -80,6 +82,7 @@ struct DAQStatsWidgetPrivate
                ;
 
     QWidget *genericWidget,
+            *replayStagesWidget,
             *sisWidget,
             *mvlcUSBWidget,
             *mvlcETHWidget,
@@ -123,6 +126,29 @@ struct DAQStatsWidgetPrivate
                                 );
     }
 
+    // Throughput of the stages of the parallel replay pipeline: decompression,
+    // in order delivery to the readout parser and buffers flushed to the
+    // analysis.
+    void update_replayStages(const DAQStats &stats, const DAQStats &prevStats, double dt_s)
+    {
+        auto rate = [dt_s] (u64 value, u64 prevValue)
+        {
+            double result = mvlc::util::calc_delta0(value, prevValue) / dt_s;
+            return std::isnan(result) ? 0.0 : result;
+        };
+
+        const double mb = Megabytes(1);
+
+        label_replayStages->setText(
+            QSL("decompress: %1 MB/s (input %2 MB/s, %3 threads), parser: %4 MB/s, analysis: %5 buffers/s")
+            .arg(rate(stats.replayDecompressedBytes, prevStats.replayDecompressedBytes) / mb, 6, 'f', 2)
+            .arg(rate(stats.replayCompressedBytes, prevStats.replayCompressedBytes) / mb, 6, 'f', 2)
+            .arg(stats.replayDecompressionThreads)
+            .arg(rate(stats.replayDeliveredBytes, prevStats.replayDeliveredBytes) / mb, 6, 'f', 2)
+            .arg(rate(stats.buffersFlushed, prevStats.buffersFlushed), 6, 'f', 2)
+            );
+    }
+
     void update_SIS3153(const SIS3153ReadoutWorker::Counters &sisCounters,
                         const SIS3153ReadoutWorker::Counters &prevSISCounters,
                         double dt_s)
@@ -285,6 +311,12 @@ struct DAQStatsWidgetPrivate
         double elapsed_s = startTime.msecsTo(endTime) / 1000.0;
 
         update_generic(daqStats, prevCounters.daqStats, dt_s, elapsed_s);
+
+        replayStagesWidget->setVisible(daqStats.replayDecompressionThreads > 0);
+
+        if (daqStats.replayDecompressionThreads > 0)
+            update_replayStages(daqStats, prevCounters.daqStats, dt_s);
+
         prevCounters.daqStats = daqStats;
 
         if (sisWorker)
@@ -375,6 +407,8 @@ DAQStatsWidget::DAQStatsWidget(MVMEContext *context, QWidget *parent)
     m_d->label_bufferRates = new QLabel;
     m_d->label_bytesRead = new QLabel;
 
+    m_d->label_replayStages = new QLabel;
+
     m_d->label_sisEventLoss = new QLabel;
 
     m_d->label_mvlcFrameTypeErrors = new QLabel;
@@ -390,6 +424,7 @@ DAQStatsWidget::DAQStatsWidget(MVMEContext *context, QWidget *parent)
         m_d->label_buffersRead,
         m_d->label_bufferRates,
         m_d->label_bytesRead,
+        m_d->label_replayStages,
         m_d->label_sisEventLoss,
         m_d->label_mvlcFrameTypeErrors,
         //m_d->label_mvlcPartialFrameTotalBytes,
@@ -405,6 +440,7 @@ DAQStatsWidget::DAQStatsWidget(MVMEContext *context, QWidget *parent)
     }
 
     m_d->genericWidget = new QWidget;
+    m_d->replayStagesWidget = new QWidget;
     m_d->sisWidget = new QWidget;
     m_d->mvlcUSBWidget = new QWidget;
     m_d->mvlcETHWidget = new QWidget;
@@ -417,6 +453,7 @@ DAQStatsWidget::DAQStatsWidget(MVMEContext *context, QWidget *parent)
     m_d->fillLevelBarDefaultColor = m_d->listfileQueueFillLevel->palette().highlight().color();
 
     auto genericLayout = make_layout<QFormLayout, 0, 2>(m_d->genericWidget);
+    auto replayStagesLayout = make_layout<QFormLayout, 0, 2>(m_d->replayStagesWidget);
     auto sisLayout = make_layout<QFormLayout, 0, 2>(m_d->sisWidget);
     auto mvlcUSBLayout = make_layout<QFormLayout, 0, 2>(m_d->mvlcUSBWidget);
     auto mvlcETHLayout = make_layout<QFormLayout, 0, 2>(m_d->mvlcETHWidget);
@@ -426,6 +463,7 @@ DAQStatsWidget::DAQStatsWidget(MVMEContext *context, QWidget *parent)
 
     auto vboxLayout = make_layout<QVBoxLayout, 0, 0>(this);
     vboxLayout->addWidget(m_d->genericWidget);
+    vboxLayout->addWidget(m_d->replayStagesWidget);
     vboxLayout->addWidget(m_d->sisWidget);
     vboxLayout->addWidget(m_d->mvlcUSBWidget);
     vboxLayout->addWidget(m_d->mvlcETHWidget);
@@ -437,6 +475,8 @@ DAQStatsWidget::DAQStatsWidget(MVMEContext *context, QWidget *parent)
     genericLayout->addRow("Bytes read:", m_d->label_bytesRead);
     genericLayout->addRow("Data rates:", m_d->label_bufferRates);
 
+    replayStagesLayout->addRow("Replay stages:", m_d->label_replayStages);
+
     sisLayout->addRow("Event Loss:", m_d->label_sisEventLoss);
 
     mvlcUSBLayout->addRow("MVLC USB Frame Type Errors:", m_d->label_mvlcFrameTypeErrors);
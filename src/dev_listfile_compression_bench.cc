@@ -0,0 +1,222 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mesytec-mvlc/mesytec-mvlc.h>
+
+#include "listfile_replay.h"
+#include "mvlc_listfile_zstd.h"
+#include "mvme_session.h"
+
+// Compares compression ratio and throughput of the listfile compression
+// methods (deflate, LZ4 and zstd) using the data of a recorded listfile. The
+// data is loaded into memory, then written to a temporary archive and read
+// back for each method.
+
+using namespace mesytec;
+using namespace mesytec::mvme_mvlc;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace
+{
+
+enum class Method { Deflate, LZ4, Zstd };
+
+struct BenchSetup
+{
+    std::string name;
+    Method method;
+    int level;
+    unsigned threads;
+};
+
+struct BenchResult
+{
+    double compressedSize = 0;
+    double writeSeconds = 0;
+    double readSeconds = 0;
+    bool dataOk = false;
+};
+
+static const size_t ChunkSize = 1u << 20;
+static const char *EntryName = "bench.mvlclst";
+
+std::vector<u8> load_listfile_data(const QString &filename, size_t maxBytes)
+{
+    auto handle = open_listfile(filename);
+
+    mvlc::listfile::ZipReader zipReader;
+    zipReader.openArchive(filename.toStdString());
+    std::unique_ptr<ZstdReadHandle> zstdHandle;
+    auto rh = open_listfile_entry(zipReader, handle.listfileFilename.toStdString(), zstdHandle);
+
+    std::vector<u8> result(maxBytes);
+    size_t total = 0;
+
+    while (total < maxBytes)
+    {
+        size_t n = rh->read(result.data() + total, std::min(ChunkSize, maxBytes - total));
+
+        if (n == 0)
+            break;
+
+        total += n;
+    }
+
+    result.resize(total);
+    return result;
+}
+
+BenchResult run_bench(const BenchSetup &setup, const std::vector<u8> &data, const std::string &archiveName)
+{
+    using Clock = std::chrono::steady_clock;
+    using Seconds = std::chrono::duration<double>;
+
+    BenchResult result;
+
+    // Write
+    {
+        auto tStart = Clock::now();
+
+        mvlc::listfile::ZipCreator zipCreator;
+        zipCreator.createArchive(archiveName, mvlc::listfile::OverwriteMode::Overwrite);
+
+        auto write_data = [&data] (mvlc::listfile::WriteHandle &wh)
+        {
+            for (size_t offset = 0; offset < data.size(); offset += ChunkSize)
+                wh.write(data.data() + offset, std::min(ChunkSize, data.size() - offset));
+        };
+
+        switch (setup.method)
+        {
+            case Method::Deflate:
+                write_data(*zipCreator.createZIPEntry(EntryName, setup.level));
+                break;
+
+            case Method::LZ4:
+                write_data(*zipCreator.createLZ4Entry(EntryName));
+                break;
+
+            case Method::Zstd:
+                {
+                    auto entry = zipCreator.createZIPEntry(EntryName, 0);
+                    // Non-owning, the entry handle belongs to the ZipCreator.
+                    std::shared_ptr<mvlc::listfile::WriteHandle> dest(&*entry, [] (mvlc::listfile::WriteHandle *) {});
+                    ZstdWriteHandle wh(dest, setup.level, setup.threads);
+                    write_data(wh);
+                    wh.flush();
+                }
+                break;
+        }
+
+        zipCreator.closeCurrentEntry();
+        zipCreator.closeArchive();
+
+        result.writeSeconds = std::chrono::duration_cast<Seconds>(Clock::now() - tStart).count();
+        result.compressedSize = QFileInfo(QString::fromStdString(archiveName)).size();
+    }
+
+    // Read back and compare
+    {
+        auto tStart = Clock::now();
+
+        mvlc::listfile::ZipReader zipReader;
+        zipReader.openArchive(archiveName);
+        std::unique_ptr<ZstdReadHandle> zstdHandle;
+        auto rh = open_listfile_entry(zipReader, EntryName, zstdHandle, setup.threads);
+
+        std::vector<u8> buffer(ChunkSize);
+        size_t offset = 0;
+        result.dataOk = true;
+
+        while (size_t n = rh->read(buffer.data(), buffer.size()))
+        {
+            if (offset + n > data.size() || std::memcmp(buffer.data(), data.data() + offset, n) != 0)
+                result.dataOk = false;
+
+            offset += n;
+        }
+
+        result.dataOk = result.dataOk && offset == data.size();
+        result.readSeconds = std::chrono::duration_cast<Seconds>(Clock::now() - tStart).count();
+    }
+
+    return result;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    auto args = app.arguments();
+
+    if (args.size() < 2)
+    {
+        cerr << "Usage: " << args[0].toStdString() << " <listfile.zip> [<MiB of data to use, default 256>] [<threads>]" << endl;
+        return 1;
+    }
+
+    mvme_init(args[0]);
+
+    const size_t maxBytes = (args.size() > 2 ? args[2].toULongLong() : 256u) << 20;
+    const unsigned threads = args.size() > 3 ? args[3].toUInt() : zstd_default_thread_count();
+    const auto archiveName = QDir(QDir::tempPath()).filePath("mvme_listfile_compression_bench.zip").toStdString();
+
+    int ret = 0;
+
+    try
+    {
+        auto data = load_listfile_data(args[1], maxBytes);
+        const double dataMB = data.size() / (1024.0 * 1024.0);
+
+        cout << "Loaded " << dataMB << " MB of listfile data from " << args[1].toStdString() << endl;
+
+        const std::vector<BenchSetup> setups =
+        {
+            { "deflate level 1", Method::Deflate, 1, 1 },
+            { "deflate level 6", Method::Deflate, 6, 1 },
+            { "lz4", Method::LZ4, 0, 1 },
+            { "zstd level 1, 1 thread", Method::Zstd, 1, 1 },
+            { "zstd level 3, 1 thread", Method::Zstd, 3, 1 },
+            { "zstd level 1, " + std::to_string(threads) + " threads", Method::Zstd, 1, threads },
+            { "zstd level 3, " + std::to_string(threads) + " threads", Method::Zstd, 3, threads },
+            { "zstd level 6, " + std::to_string(threads) + " threads", Method::Zstd, 6, threads },
+        };
+
+        cout << "method, ratio, compress MB/s, decompress MB/s" << endl;
+
+        for (const auto &setup: setups)
+        {
+            auto result = run_bench(setup, data, archiveName);
+
+            cout << setup.name
+                << ", " << data.size() / result.compressedSize
+                << ", " << dataMB / result.writeSeconds
+                << ", " << dataMB / result.readSeconds
+                << (result.dataOk ? "" : ", DATA MISMATCH")
+                << endl;
+
+            if (!result.dataOk)
+                ret = 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        ret = 1;
+    }
+    catch (const QString &e)
+    {
+        cerr << "Error: " << e.toStdString() << endl;
+        ret = 1;
+    }
+
+    QFile::remove(QString::fromStdString(archiveName));
+    mvme_shutdown();
+    return ret;
+}
@@ -56,6 +56,15 @@ class Context: public mvme::event_server::Client
         void setSingleRun(bool b) { m_singleRun = b; }
         void setPrintData(bool b) { m_printData = b; }
 
+        // Requests protocol version 2 with the given encoding.
+        void setRequestedEncoding(Encoding encoding) { m_requestedEncoding = encoding; m_requestV2 = true; }
+
+        // True if a ClientConfig message should be sent in response to the
+        // initial ServerInfo message.
+        bool shouldSendClientConfig() const { return m_clientConfigPending; }
+        void clientConfigSent() { m_clientConfigPending = false; }
+        ClientConfiguration getClientConfig() const { return { 2, m_requestedEncoding }; }
+
     protected:
         virtual void serverInfo(const Message &msg, const json &info) override;
 
@@ -64,6 +73,9 @@ class Context: public mvme::event_server::Client
         virtual void eventData(const Message &msg, int eventIndex,
                                 const std::vector<DataSourceContents> &contents) override;
 
+        virtual void eventDataOutputs(const Message &msg, int eventIndex,
+                                      const std::vector<std::vector<DataSourceContents>> &contents) override;
+
         virtual void endRun(const Message &msg, const json &info) override;
 
         virtual void error(const Message &msg, const std::exception &e) override;
@@ -73,11 +85,16 @@ class Context: public mvme::event_server::Client
         bool m_quit = false;
         bool m_singleRun = false;
         bool m_printData = false;
+        bool m_requestV2 = false;
+        bool m_clientConfigPending = false;
+        Encoding m_requestedEncoding = Encoding::Auto;
+        std::vector<std::vector<DataSourceDescription>> m_dataSources;
 };
 
 void Context::serverInfo(const Message &/*msg*/, const json &info)
 {
     cout << __FUNCTION__ << ": serverInfo=" << endl << info.dump(2) << endl;
+    m_clientConfigPending = m_requestV2 && server_supports_protocol(info, 2);
 }
 
 void Context::beginRun(const Message &/*msg*/, const StreamInfo &streamInfo)
@@ -86,6 +103,8 @@ void Context::beginRun(const Message &/*msg*/, const StreamInfo &streamInfo)
         << streamInfo.infoJson.dump(2) << endl;
 
     cout << __FUNCTION__ << ": runId=" << streamInfo.runId
+        << ", protocol_version=" << streamInfo.protocolVersion
+        << ", encoding=" << to_string(streamInfo.encoding)
         << endl;
 
     m_stats = {};
@@ -98,10 +117,12 @@ void Context::beginRun(const Message &/*msg*/, const StreamInfo &streamInfo)
     m_stats.eventDataBytes.resize(streamInfo.eventDataDescriptions.size(), 0u);
 
     m_stats.eventDSBytes.clear();
+    m_dataSources.clear();
 
     for (auto &edd: streamInfo.eventDataDescriptions)
     {
         m_stats.eventDSBytes.push_back(std::vector<size_t>(edd.dataSources.size()));
+        m_dataSources.push_back(edd.dataSources);
     }
 
     m_stats.tStart = ClockType::now();
@@ -136,6 +157,41 @@ void Context::eventData(const Message &msg, int eventIndex,
     }
 }
 
+// Protocol version 2: the byte counts are those of the decoded data.
+void Context::eventDataOutputs(const Message &msg, int eventIndex,
+                               const std::vector<std::vector<DataSourceContents>> &contents)
+{
+    m_stats.messageCount++;
+    m_stats.eventCounts[eventIndex]++;
+    m_stats.dataMessageCount++;
+    m_stats.dataMessageSizeSum += msg.size();
+
+    if (m_printData)
+    {
+        cout << "EventData, eventIndex=" << eventIndex << endl;
+    }
+
+    for (size_t dsIndex = 0; dsIndex < contents.size(); dsIndex++)
+    {
+        const auto &dsd = m_dataSources[eventIndex][dsIndex];
+
+        for (size_t outIndex = 0; outIndex < contents[dsIndex].size(); outIndex++)
+        {
+            auto &dsc = contents[dsIndex][outIndex];
+            size_t bytes = get_entry_size(dsc) * dsc.count;
+            m_stats.totalDataBytes += bytes;
+            m_stats.eventDataBytes[eventIndex] += bytes;
+            m_stats.eventDSBytes[eventIndex][dsIndex] += bytes;
+
+            if (m_printData)
+            {
+                cout << "  dsIndex=" << dsIndex << ", " << dsd.outputs[outIndex].name << ": ";
+                print(cout, dsc);
+            }
+        }
+    }
+}
+
 void Context::endRun(const Message &/*msg*/, const json &info)
 {
     m_stats.tEnd = ClockType::now();
@@ -217,6 +273,8 @@ int main(int argc, char *argv[])
     // send out a reply is response to the EndRun message?
     std::string host = "localhost";
     std::string port = "13801";
+    std::string shmName;
+    bool useShm = false;
     bool showHelp = false;
 
     setup_signal_handlers();
@@ -236,6 +294,8 @@ int main(int argc, char *argv[])
         {
             { "single-run",             no_argument, nullptr,    0 },
             { "print-data",             no_argument, nullptr,    0 },
+            { "shm",                    optional_argument, nullptr, 0 },
+            { "encoding",               required_argument, nullptr, 0 },
             { "help",                   no_argument, nullptr,    0 },
             { nullptr, 0, nullptr, 0 },
         };
@@ -255,19 +315,40 @@ int main(int argc, char *argv[])
 
         if (opt_name == "single-run") ctx.setSingleRun(true);
         if (opt_name == "print-data") ctx.setPrintData(true);
+        if (opt_name == "shm") { useShm = true; if (optarg) shmName = optarg; }
         if (opt_name == "help") showHelp = true;
+
+        if (opt_name == "encoding")
+        {
+            Encoding encoding = Encoding::Auto;
+
+            if (!encoding_from_string(optarg, encoding))
+            {
+                cerr << "Unknown encoding '" << optarg << "'" << endl;
+                return 1;
+            }
+
+            ctx.setRequestedEncoding(encoding);
+        }
     }
 
     if (showHelp)
     {
         cout << "Usage: " << argv[0]
-            << " [--single-run] [--print-data] [host=localhost] [port=13801]"
+            << " [--single-run] [--print-data] [--shm[=name]] [--encoding=<encoding>]"
+            << " [host=localhost] [port=13801]"
             << endl << endl
             ;
 
         cout << "  If single-run is set the process will exit after receiving" << endl
              << "  data from one run. Otherwise it will wait for the next run to" << endl
              << "  start." << endl << endl
+             << "  If shm is set the data is read from the shared memory ring of" << endl
+             << "  an mvme instance running on the same host instead of via TCP." << endl
+             << "  The default segment name is 'mvme_event_server'." << endl << endl
+             << "  If encoding is set protocol version 2 is requested from the" << endl
+             << "  server. This transmits all outputs of the data sources using" << endl
+             << "  the given encoding: indexed, varint, bitmap or auto." << endl << endl
              ;
 
         return 0;
@@ -276,31 +357,35 @@ int main(int argc, char *argv[])
     if (optind < argc) { host = argv[optind++]; }
     if (optind < argc) { port = argv[optind++]; }
 
+    const std::string address = useShm
+        ? (shmName.empty() ? std::string("shm") : "shm:" + shmName)
+        : host + ":" + port;
+
     Message msg;
-    int sockfd = -1;
+    std::unique_ptr<Connection> con;
     int retval = 0;
 
     while (!ctx.doQuit() && !signal_received)
     {
-        if (sockfd < 0)
+        if (!con)
         {
-            cout << "Connecting to " << host << ":" << port << " ..." << endl;
+            cout << "Connecting to " << address << " ..." << endl;
         }
 
-        while (sockfd < 0 && !signal_received)
+        while (!con && !signal_received)
         {
             try
             {
-                sockfd = connect_to(host.c_str(), port.c_str());
+                con = connect(address, port);
             }
             catch (const mvme::event_server::exception &e)
             {
-                sockfd = -1;
+                con.reset();
             }
 
-            if (sockfd >= 0)
+            if (con)
             {
-                cout << "Connected to " << host << ":" << port << endl;
+                cout << "Connected to " << con->describe() << endl;
                 break;
             }
 
@@ -314,13 +399,19 @@ int main(int argc, char *argv[])
 
         try
         {
-            read_message(sockfd, msg);
+            con->readMessage(msg);
             ctx.handleMessage(msg);
+
+            if (ctx.shouldSendClientConfig())
+            {
+                con->sendClientConfig(ctx.getClientConfig());
+                ctx.clientConfigSent();
+            }
         }
-        catch (const mvme::event_server::connection_closed &)
+        catch (const mvme::event_server::connection_closed &e)
         {
-            cout << "Error: The remote host closed the connection." << endl;
-            sockfd = -1;
+            cout << "Error: The connection was closed: " << e.what() << endl;
+            con.reset();
             // Reset context state as we're going to attempt to reconnect.
             ctx.reset();
         }
@@ -332,9 +423,9 @@ int main(int argc, char *argv[])
         }
         catch (const std::system_error &e)
         {
-            cout << "Disconnected from " << host << ":" << port
+            cout << "Disconnected from " << con->describe()
                 << ", reason: " << e.what() << endl;
-            sockfd = -1;
+            con.reset();
             retval = 1;
             break;
         }
@@ -1162,6 +1162,8 @@ void setup_signal_handlers()
 int client_main(
     const std::string &host,
     const std::string &port,
+    bool useShm,
+    const std::string &shmName,
     const Options::Opt_t &clientOpts,
     const std::vector<std::string> &additionalArgs,
     const ssize_t rootMaxTreeSize)
@@ -1179,32 +1181,41 @@ int client_main(
     // A single message object, whose buffer is reused for each incoming
     // message.
     Message msg;
-    int sockfd = -1;
+    std::unique_ptr<Connection> con;
     bool doQuit = false;
 
+    // Either attach to the shared memory ring of a local mvme instance or
+    // connect via TCP.
+    const std::string address = useShm
+        ? (shmName.empty() ? std::string("shm") : "shm:" + shmName)
+        : host + ":" + port;
+
     while (!doQuit && !signal_received)
     {
-        if (sockfd < 0)
+        if (!con)
         {
-            cout << "Connecting to " << host << ":" << port << " ..." << endl;
+            cout << "Connecting to " << address << " ..." << endl;
         }
 
         // auto reconnect loop until connected or a signal arrived
-        while (sockfd < 0 && !signal_received)
+        while (!con && !signal_received)
         {
             try
             {
-                sockfd = connect_to(host.c_str(), port.c_str());
+                con = connect(address, port);
             }
             catch (const mvme::event_server::exception &e)
             {
-                sockfd = -1;
+                con.reset();
             }
 
-            if (sockfd >= 0)
+            if (con)
             {
-                cout << "Connected to " << host << ":" << port << endl;
-                ctx.setHostAndPort(host, port);
+                cout << "Connected to " << con->describe() << endl;
+                if (useShm)
+                    ctx.setHostAndPort("shm", shmName.empty() ? shm::DefaultName : shmName);
+                else
+                    ctx.setHostAndPort(host, port);
                 break;
             }
 
@@ -1218,9 +1229,9 @@ int client_main(
 
         try
         {
-            // Read messages from the network and let the context object
+            // Read messages from the server and let the context object
             // process them.
-            read_message(sockfd, msg);
+            con->readMessage(msg);
             ctx.handleMessage(msg);
 
             if ((clientOpts & Options::SingleRun) && msg.type == MessageType::EndRun)
@@ -1232,10 +1243,10 @@ int client_main(
                 doQuit = ctx.ShouldQuit();
             }
         }
-        catch (const mvme::event_server::connection_closed &)
+        catch (const mvme::event_server::connection_closed &e)
         {
-            cout << "Error: The remote host closed the connection." << endl;
-            sockfd = -1;
+            cout << "Error: The connection was closed: " << e.what() << endl;
+            con.reset();
             // Reset context state as we're going to attempt to reconnect.
             ctx.reset();
         }
@@ -1247,9 +1258,9 @@ int client_main(
         }
         catch (const std::system_error &e)
         {
-            cout << "Disconnected from " << host << ":" << port
+            cout << "Disconnected from " << con->describe()
                 << ", reason: " << e.what() << endl;
-            sockfd = -1;
+            con.reset();
             retval = 1;
             break;
         }
@@ -1428,6 +1439,8 @@ int main(int argc, char *argv[])
 {
     std::string host = "localhost";
     std::string port = "13801";
+    std::string shmName;
+    bool useShm = false;
     std::string analysisArg;
     ssize_t rootMaxTreeSize = 100000000000LL;
     bool showHelp = false;
@@ -1445,6 +1458,7 @@ int main(int argc, char *argv[])
             { "help", no_argument, nullptr, 0 },
             { "host", required_argument, nullptr, 0 },
             { "port", required_argument, nullptr, 0 },
+            { "shm", optional_argument, nullptr, 0 },
             { "root-max-tree-size", required_argument, nullptr, 0 },
             { "replay", no_argument, nullptr, 0 },
             { "analysis-args", required_argument, nullptr, 0 },
@@ -1472,6 +1486,7 @@ int main(int argc, char *argv[])
                     else if (opt_name == "run-in-progress-is-ok") clientOpts |= Opts::RunInProgressOk;
                     else if (opt_name == "host") host = optarg;
                     else if (opt_name == "port") port = optarg;
+                    else if (opt_name == "shm") { useShm = true; if (optarg) shmName = optarg; }
                     else if (opt_name == "help") showHelp = true;
                     else if (opt_name == "replay") clientOpts |= Opts::ReplayMode;
                     else if (opt_name == "analysis-args") analysisArg = optarg;
@@ -1495,7 +1510,7 @@ int main(int argc, char *argv[])
 
     if (showHelp)
     {
-        cout << "Usage as a mvme client: " << argv[0] << " [--single-run] [--root-max-tree-size=<bytes>] [--host=localhost] [--port=13801] [--analysis-args=<args>] [--show-stream-info]" << endl << endl;
+        cout << "Usage as a mvme client: " << argv[0] << " [--single-run] [--root-max-tree-size=<bytes>] [--host=localhost] [--port=13801] [--shm[=name]] [--analysis-args=<args>] [--show-stream-info]" << endl << endl;
 
         cout << "  In this mode the program connects to and receives data from a mvme process." << endl
              << endl
@@ -1503,6 +1518,9 @@ int main(int argc, char *argv[])
              << "  data from one run. Otherwise it will wait for the next run to" << endl
              << "  start." << endl
              << endl
+             << "  If 'shm' is set the data is read from the shared memory ring of an mvme instance\n"
+             << "  running on the same host instead of via TCP. The default segment name is 'mvme_event_server'.\n"
+             << endl
              << "  --root-max-tree-size can be used to specify the maximum number of bytes per output ROOT file.\n"
              << "  The argument is passed to TTree::SetMaxTreeSize(). Default is 100000000000LL (100GB).\n"
              << endl;
@@ -1568,7 +1586,7 @@ int main(int argc, char *argv[])
 
     if (!(clientOpts & Opts::ReplayMode))
     {
-        retval = client_main(host, port, clientOpts, analysisArgs, rootMaxTreeSize);
+        retval = client_main(host, port, useShm, shmName, clientOpts, analysisArgs, rootMaxTreeSize);
     }
     else
     {
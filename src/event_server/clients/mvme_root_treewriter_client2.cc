@@ -468,6 +468,8 @@ int main(int argc, char *argv[])
     std::string host = "localhost";
     std::string port = "13801";
     std::string outputDirectory = ".";
+    std::string shmName;
+    bool useShm = false;
     bool singleRun = false;
     bool convertNaNsToZero = false;
     bool showHelp = false;
@@ -479,6 +481,7 @@ int main(int argc, char *argv[])
             { "single-run", no_argument, nullptr, 0 },
             { "convert-nans", no_argument, nullptr, 0 },
             { "output-directory", required_argument, nullptr, 0 },
+            { "shm", optional_argument, nullptr, 0 },
             { "help", no_argument, nullptr, 0 },
             { nullptr, 0, nullptr, 0 },
         };
@@ -505,6 +508,7 @@ int main(int argc, char *argv[])
                     if (opt_name == "single-run") singleRun = true;
                     if (opt_name == "convert-nans") convertNaNsToZero = true;
                     if (opt_name == "output-directory") outputDirectory = optarg;
+                    if (opt_name == "shm") { useShm = true; if (optarg) shmName = optarg; }
                     if (opt_name == "help") showHelp = true;
                 }
         }
@@ -514,7 +518,7 @@ int main(int argc, char *argv[])
     {
         cout << "Usage: " << argv[0]
             << " [--single-run] [--convert-nans] [--output-directory <dir>=.]"
-               " [host=localhost] [port=13801]"
+               " [--shm[=name]] [host=localhost] [port=13801]"
             << endl << endl
             ;
 
@@ -526,10 +530,17 @@ int main(int argc, char *argv[])
              << "  converted to 0.0 before they are written to their respective ROOT" << endl
              << "  tree Branch." << endl
              << endl
+             << "  If shm is set the data is read from the shared memory ring of" << endl
+             << "  an mvme instance running on the same host instead of via TCP." << endl
+             << "  The default segment name is 'mvme_event_server'." << endl
+             << endl
              ;
 
         return 0;
     }
+
+    if (optind < argc) { host = argv[optind++]; }
+    if (optind < argc) { port = argv[optind++]; }
 #endif
 
     setup_signal_handlers();
@@ -545,32 +556,36 @@ int main(int argc, char *argv[])
     // A single message object, whose buffer is reused for each incoming
     // message.
     Message msg;
-    int sockfd = -1;
+    std::unique_ptr<Connection> con;
     int retval = 0;
     bool doQuit = false;
 
+    const std::string address = useShm
+        ? (shmName.empty() ? std::string("shm") : "shm:" + shmName)
+        : host + ":" + port;
+
     while (!doQuit && !signal_received)
     {
-        if (sockfd < 0)
+        if (!con)
         {
-            cout << "Connecting to " << host << ":" << port << " ..." << endl;
+            cout << "Connecting to " << address << " ..." << endl;
         }
 
         // auto reconnect loop
-        while (sockfd < 0 && !signal_received)
+        while (!con && !signal_received)
         {
             try
             {
-                sockfd = connect_to(host.c_str(), port.c_str());
+                con = connect(address, port);
             }
             catch (const mvme::event_server::exception &e)
             {
-                sockfd = -1;
+                con.reset();
             }
 
-            if (sockfd >= 0)
+            if (con)
             {
-                cout << "Connected to " << host << ":" << port << endl;
+                cout << "Connected to " << con->describe() << endl;
                 break;
             }
 
@@ -584,7 +599,7 @@ int main(int argc, char *argv[])
 
         try
         {
-            read_message(sockfd, msg);
+            con->readMessage(msg);
             ctx.handleMessage(msg);
 
             if (singleRun && msg.type == MessageType::EndRun)
@@ -592,10 +607,10 @@ int main(int argc, char *argv[])
                 doQuit = true;
             }
         }
-        catch (const mvme::event_server::connection_closed &)
+        catch (const mvme::event_server::connection_closed &e)
         {
-            cout << "Error: The remote host closed the connection." << endl;
-            sockfd = -1;
+            cout << "Error: The connection was closed: " << e.what() << endl;
+            con.reset();
             // Reset context state as we're going to attempt to reconnect.
             ctx.reset();
         }
@@ -607,9 +622,9 @@ int main(int argc, char *argv[])
         }
         catch (const std::system_error &e)
         {
-            cout << "Disconnected from " << host << ":" << port
+            cout << "Disconnected from " << con->describe()
                 << ", reason: " << e.what() << endl;
-            sockfd = -1;
+            con.reset();
             retval = 1;
             break;
         }
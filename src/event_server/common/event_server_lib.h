@@ -35,6 +35,7 @@
 #include <cstring> // memcpy
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <system_error>
 
 #include <unistd.h>
@@ -43,6 +44,7 @@
 #include <nlohmann/json.hpp>
 
 #include "event_server_proto.h"
+#include "event_server_shm.h"
 
 namespace mvme
 {
@@ -294,6 +296,41 @@ static void read_message(int fd, Message &msg)
     assert(msg.isValid());
 }
 
+// Writes exactly size bytes from the source buffer to the file descriptor fd.
+// Throws std::system_error in case a write fails.
+static void write_data(int fd, const uint8_t *src, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t bytesWritten = write(fd, src, size);
+
+        if (bytesWritten < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            throw std::system_error(errno, std::system_category(), "write_data");
+        }
+
+        size -= bytesWritten;
+        src += bytesWritten;
+    }
+}
+
+// Writes a single framed message to the given file descriptor.
+__attribute__((__used__))
+static void write_message(int fd, MessageType type, const std::string &contents)
+{
+    uint8_t headerBuffer[MessageFrameSize];
+    uint32_t size = contents.size();
+
+    memcpy(headerBuffer,                &type, sizeof(type));
+    memcpy(headerBuffer + sizeof(type), &size, sizeof(size));
+
+    write_data(fd, headerBuffer, sizeof(headerBuffer));
+    write_data(fd, reinterpret_cast<const uint8_t *>(contents.data()), contents.size());
+}
+
 // Connects via TCP to the given host and service (the port in our case).
 // Returns the socket file descriptor on success, throws if an error occured.
 inline int connect_to(const char *host, const char *service)
@@ -354,6 +391,196 @@ inline int connect_to(const char *host, uint16_t port)
     return connect_to(host, buffer);
 }
 
+//
+// Protocol negotiation
+//
+
+// Contents of the ClientConfig message which a client can send in response to
+// ServerInfo to request protocol version 2 and an event data encoding. Servers
+// wait a short time for this message before falling back to version 1.
+struct ClientConfiguration
+{
+    int protocolVersion = ProtocolVersion;
+    Encoding encoding = Encoding::Auto;
+};
+
+inline json to_json(const ClientConfiguration &cfg)
+{
+    json result;
+    result["protocol_version"] = cfg.protocolVersion;
+    result["encoding"] = to_string(cfg.encoding);
+    return result;
+}
+
+// Unknown encodings are replaced by Encoding::Indexed which is always
+// supported. Throws protocol_error on malformed input.
+inline ClientConfiguration parse_client_config(const json &j)
+{
+    ClientConfiguration result;
+
+    try
+    {
+        result.protocolVersion = j.value("protocol_version", 1);
+
+        if (!encoding_from_string(j.value("encoding", std::string()), result.encoding))
+            result.encoding = Encoding::Indexed;
+    }
+    catch (const json::exception &e)
+    {
+        throw protocol_error(e.what());
+    }
+
+    return result;
+}
+
+// Returns true if the server sending the given ServerInfo json supports the
+// protocol version.
+inline bool server_supports_protocol(const json &serverInfo, int version)
+{
+    if (serverInfo.count("supported_protocol_versions"))
+    {
+        for (const auto &vj: serverInfo["supported_protocol_versions"])
+        {
+            if (vj.is_number_integer() && vj.get<int>() == version)
+                return true;
+        }
+
+        return false;
+    }
+
+    return version == 1;
+}
+
+//
+// Transport independent connections
+//
+
+// A connection to the event server from which messages can be read.
+// Throws the same exceptions as read_message().
+class Connection
+{
+    public:
+        virtual ~Connection() {}
+        virtual void readMessage(Message &msg) = 0;
+        virtual std::string describe() const = 0;
+
+        // Sends the ClientConfig message. Must be called right after
+        // receiving ServerInfo. Transports without a back channel ignore
+        // this and use the format chosen by the server.
+        virtual void sendClientConfig(const ClientConfiguration &cfg) { (void) cfg; }
+};
+
+// Message stream read from a TCP socket.
+class TcpConnection: public Connection
+{
+    public:
+        TcpConnection(const std::string &host, const std::string &service)
+            : m_fd(connect_to(host.c_str(), service.c_str()))
+            , m_description(host + ":" + service)
+        {}
+
+        ~TcpConnection() override
+        {
+            close(m_fd);
+        }
+
+        TcpConnection(const TcpConnection &) = delete;
+        TcpConnection &operator=(const TcpConnection &) = delete;
+
+        void readMessage(Message &msg) override
+        {
+            read_message(m_fd, msg);
+        }
+
+        void sendClientConfig(const ClientConfiguration &cfg) override
+        {
+            write_message(m_fd, MessageType::ClientConfig, to_json(cfg).dump());
+        }
+
+        std::string describe() const override { return m_description; }
+        int fd() const { return m_fd; }
+
+    private:
+        int m_fd;
+        std::string m_description;
+};
+
+#ifndef _WIN32
+// Message stream read from the shared memory ring of a server running on the
+// same host. See event_server_shm.h.
+class ShmConnection: public Connection
+{
+    public:
+        explicit ShmConnection(const std::string &name = shm::DefaultName)
+            : m_reader(name)
+        {}
+
+        void readMessage(Message &msg) override
+        {
+            using Status = shm::ShmReader::Status;
+
+            switch (m_reader.readMessage(msg, MaxMessageSize))
+            {
+                case Status::Ok:
+                    break;
+                case Status::ServerClosed:
+                    throw connection_closed("server closed the shared memory segment");
+                case Status::Evicted:
+                    throw connection_closed("reader was evicted by the server for being too slow");
+                case Status::Overrun:
+                    throw connection_closed("shared memory ring overrun, data was lost");
+                case Status::ProtocolError:
+                    throw protocol_error("Invalid message frame in shared memory ring");
+            }
+        }
+
+        std::string describe() const override { return "shm:" + m_reader.name(); }
+
+    private:
+        shm::ShmReader m_reader;
+};
+#endif
+
+// Connects to the event server. The address is either "shm[:name]" to attach
+// to the shared memory ring of a local server or "host[:port]" to connect via
+// TCP. Throws mvme::event_server::exception on error.
+inline std::unique_ptr<Connection> connect(const std::string &address,
+                                           const std::string &defaultPort = "13801")
+{
+    if (address == "shm" || address.compare(0, 4, "shm:") == 0)
+    {
+#ifndef _WIN32
+        std::string name = address.size() > 4 ? address.substr(4) : shm::DefaultName;
+
+        try
+        {
+            return std::unique_ptr<Connection>(new ShmConnection(name));
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw exception(e.what());
+        }
+#else
+        throw exception("The shared memory transport is not supported on this platform");
+#endif
+    }
+
+    std::string host = address;
+    std::string port = defaultPort;
+
+    // Only split off the port if there is a single colon. Otherwise this is
+    // an IPv6 address.
+    auto colon = address.find(':');
+
+    if (colon != std::string::npos && address.find(':', colon + 1) == std::string::npos)
+    {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+
+    return std::unique_ptr<Connection>(new TcpConnection(host, port));
+}
+
 //
 // Network data storage utils
 //
@@ -429,10 +656,95 @@ R read_storage(StorageType st, const uint8_t *buffer)
     return result;
 }
 
+/* Same as read_storage() but interprets the stored value as a two's
+ * complement signed integer. */
+template <typename R>
+R read_storage_signed(StorageType st, const uint8_t *buffer)
+{
+    R result = {};
+
+    switch (st)
+    {
+        case StorageType::st_uint8_t:
+            result = *reinterpret_cast<const int8_t *>(buffer);
+            break;
+        case StorageType::st_uint16_t:
+            result = *reinterpret_cast<const int16_t *>(buffer);
+            break;
+        case StorageType::st_uint32_t:
+            result = *reinterpret_cast<const int32_t *>(buffer);
+            break;
+        case StorageType::st_uint64_t:
+            result = *reinterpret_cast<const int64_t *>(buffer);
+            break;
+    }
+
+    return result;
+}
+
+// LEB128 varints and zigzag encoding as used by Encoding::Varint.
+// Encoding a 64 bit value takes at most MaxVarintSize bytes.
+static const size_t MaxVarintSize = 10;
+
+inline uint8_t *encode_varint(uint64_t value, uint8_t *dest)
+{
+    while (value >= 0x80)
+    {
+        *dest++ = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+
+    *dest++ = static_cast<uint8_t>(value);
+    return dest;
+}
+
+inline uint64_t decode_varint(BufferIterator &iter)
+{
+    uint64_t result = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t byte = iter.extractU8();
+        result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+            return result;
+    }
+
+    throw protocol_error("Invalid varint in EventData message");
+}
+
+inline uint64_t zigzag_encode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+
+// Description of one output array of a datasource.
+struct OutputDescription
+{
+    std::string name;           // Name of the output.
+    uint32_t size = 0u;         // Number of elements in the output array.
+    double lowerLimit = 0.0;    // Lower and upper limits of the values in the array.
+    double upperLimit = 0.0;
+    uint8_t bits = 0u;          // Number of data bits including the sign bit.
+    bool isSigned = false;      // True if the values can be negative.
+
+    StorageType indexType;      // Data types used to store the index and data values during network
+    StorageType valueType;      // transfer. Signed values are stored in two's complement.
+};
 
 // Description of a datasource contained in the data stream.
 // Multiple datasources can be attached to the same vme module and thus become
 // a part of the same readout event.
+//
+// The members name to valueType describe the first output of the datasource.
+// This is the only output transmitted in protocol version 1.
 struct DataSourceDescription
 {
     std::string name;           // Name of the datasource.
@@ -449,6 +761,12 @@ struct DataSourceDescription
     // to have the same length as the size of this datasource as not all
     // parameters have to be named.
     std::vector<std::string> paramNames;
+
+    // All outputs of the datasource. Multi hit extractors and the MDPP sample
+    // decoder have more than one output. Protocol version 2 transmits all of
+    // them in this order. When parsing a description without output
+    // information a single entry for the first output is created.
+    std::vector<OutputDescription> outputs;
 };
 
 // Description of the data layout for one mvme event. This contains
@@ -493,6 +811,10 @@ struct StreamInfo
     std::string runId;
     bool isReplay = false;
     json infoJson;
+
+    // Protocol version and encoding of the EventData messages of this run.
+    int protocolVersion = 1;
+    Encoding encoding = Encoding::Indexed;
 };
 
 static EventDataDescriptions parse_stream_data_description(const json &j)
@@ -523,6 +845,35 @@ static EventDataDescriptions parse_stream_data_description(const json &j)
                     for (const auto &namej: dsj["paramNames"])
                         dsd.paramNames.push_back(namej);
 
+                    if (dsj.count("outputs"))
+                    {
+                        for (const auto &outj: dsj["outputs"])
+                        {
+                            OutputDescription od;
+                            od.name = outj["name"];
+                            od.size = outj["size"];
+                            od.lowerLimit = outj["lowerLimit"];
+                            od.upperLimit = outj["upperLimit"];
+                            od.bits = outj["bits"];
+                            od.isSigned = outj["signed"];
+                            od.indexType = storage_type_from_string(outj["indexType"]);
+                            od.valueType = storage_type_from_string(outj["valueType"]);
+                            dsd.outputs.emplace_back(od);
+                        }
+                    }
+                    else
+                    {
+                        OutputDescription od;
+                        od.name = dsd.name;
+                        od.size = dsd.size;
+                        od.lowerLimit = dsd.lowerLimit;
+                        od.upperLimit = dsd.upperLimit;
+                        od.bits = dsd.bits;
+                        od.indexType = dsd.indexType;
+                        od.valueType = dsd.valueType;
+                        dsd.outputs.emplace_back(od);
+                    }
+
                     eds.dataSources.emplace_back(dsd);
                 }
             }
@@ -563,6 +914,22 @@ inline json to_json(const EventDataDescriptions &edds)
                 namesj.push_back(name);
             dsj["paramNames"] = namesj;
 
+            json outputsj = json::array();
+            for (auto &od: dsd.outputs)
+            {
+                json outj;
+                outj["name"] = od.name;
+                outj["size"] = od.size;
+                outj["lowerLimit"] = od.lowerLimit;
+                outj["upperLimit"] = od.upperLimit;
+                outj["bits"] = static_cast<uint32_t>(od.bits);
+                outj["signed"] = od.isSigned;
+                outj["indexType"] = to_string(od.indexType);
+                outj["valueType"] = to_string(od.valueType);
+                outputsj.push_back(outj);
+            }
+            dsj["outputs"] = outputsj;
+
             eddj["dataSources"].push_back(dsj);
         }
 
@@ -638,6 +1005,14 @@ static StreamInfo parse_stream_info(const json &j)
         result.runId = j["runId"];
         result.eventDataDescriptions = parse_stream_data_description(j["eventDataSources"]);
         result.vmeTree = parse_vme_tree(j["vmeTree"]);
+        result.protocolVersion = j.value("protocol_version", 1);
+
+        if (!encoding_from_string(j.value("encoding", std::string("indexed")), result.encoding))
+            throw protocol_error("Unknown event data encoding");
+
+        if (result.protocolVersion < 1 || result.protocolVersion > ProtocolVersion)
+            throw protocol_error("Unsupported protocol version "
+                                 + std::to_string(result.protocolVersion));
 
         for (const auto &edd: result.eventDataDescriptions)
         {
@@ -660,15 +1035,31 @@ static StreamInfo parse_stream_info(const json &j)
 // The firstIndex member points to a buffer containing packed (index, value)
 // pairs with their data types specified in the members indexType and
 // valueType. The count field contains the number of packed pairs available in
-// the buffer.
+// the buffer. If isSigned is set the values are stored in two's complement,
+// use read_value() to read them.
+//
+// With protocol version 2 the Varint and Bitmap encoded blocks are decoded
+// into a buffer owned by the Client object using 32 bit indexes and 64 bit
+// values.
 struct DataSourceContents
 {
     StorageType indexType;
     StorageType valueType;
     uint16_t count = 0;
     const uint8_t *firstIndex = nullptr;
+    bool isSigned = false;
 };
 
+// Reads a value of the packed (index, value) array respecting the signedness
+// of the data.
+inline int64_t read_value(const DataSourceContents &dsc, const uint8_t *valuePtr)
+{
+    if (dsc.isSigned)
+        return read_storage_signed<int64_t>(dsc.valueType, valuePtr);
+
+    return read_storage<uint64_t>(dsc.valueType, valuePtr);
+}
+
 // Returns the size of one element of the packed (index, value) array described
 // by the given DataSourceContents structure.
 static size_t get_entry_size(const DataSourceContents &dsc)
@@ -700,7 +1091,7 @@ void print(Out &out, const DataSourceContents &dsc)
         const uint8_t *valuePtr = indexPtr + get_storage_type_size(dsc.indexType);
 
         uint32_t index = read_storage<uint32_t>(dsc.indexType, indexPtr);
-        uint64_t value = read_storage<uint64_t>(dsc.valueType, valuePtr);
+        int64_t value = read_value(dsc, valuePtr);
 
         bool last = (entryIndex == dsc.count - 1);
 
@@ -722,24 +1113,43 @@ class Client
     protected:
         virtual void serverInfo(const Message &msg, const json &info) = 0;
 
+        // Called for the ServerInfo updates of protocol version 2 streams.
+        virtual void serverInfoUpdate(const Message &msg, const json &info)
+        {
+            (void) msg;
+            (void) info;
+        }
+
         virtual void beginRun(const Message &msg, const StreamInfo &streamInfo) = 0;
 
         virtual void eventData(const Message &msg, int eventIndex,
                                const std::vector<DataSourceContents> &contents) = 0;
 
+        // Called for EventData messages of protocol version 2 streams.
+        // contents[dsIndex][outputIndex] holds the data of each output of each
+        // datasource as described in DataSourceDescription::outputs. The
+        // default implementation passes the first output of each datasource to
+        // eventData().
+        virtual void eventDataOutputs(const Message &msg, int eventIndex,
+                                      const std::vector<std::vector<DataSourceContents>> &contents);
+
         virtual void endRun(const Message &msg, const json &info) = 0;
 
         virtual void error(const Message &msg, const std::exception &e) = 0;
 
     private:
+        bool isServerInfoUpdate(const Message &msg) const;
         void _serverInfo(const Message &msg);
         void _beginRun(const Message &msg);
         void _eventData(const Message &msg);
+        void _eventDataV2(const Message &msg);
         void _endRun(const Message &msg);
 
         MessageType m_prevMsgType = MessageType::Invalid;
         StreamInfo m_streamInfo;
         std::vector<DataSourceContents> m_contentsVec;
+        std::vector<std::vector<DataSourceContents>> m_outputContents;
+        std::vector<std::vector<uint8_t>> m_decodeBuffers;
 };
 
 inline void Client::reset()
@@ -747,12 +1157,20 @@ inline void Client::reset()
     m_prevMsgType = MessageType::Invalid;
     m_streamInfo = {};
     m_contentsVec.clear();
+    m_outputContents.clear();
+    m_decodeBuffers.clear();
 }
 
 inline void Client::handleMessage(const Message &msg)
 {
     try
     {
+        if (isServerInfoUpdate(msg))
+        {
+            serverInfoUpdate(msg, json::parse(msg.contents));
+            return;
+        }
+
         if (!is_valid_transition(m_prevMsgType, msg.type))
         {
             throw protocol_error("Unexpected message sequence: '"
@@ -796,6 +1214,14 @@ inline void Client::handleMessage(const Message &msg)
     }
 }
 
+inline bool Client::isServerInfoUpdate(const Message &msg) const
+{
+    return (msg.type == MessageType::ServerInfo
+            && (m_prevMsgType == MessageType::BeginRun
+                || m_prevMsgType == MessageType::EventData)
+            && m_streamInfo.protocolVersion >= 2);
+}
+
 inline void Client::_serverInfo(const Message &msg)
 {
     auto infoJson = json::parse(msg.contents);
@@ -818,6 +1244,12 @@ inline void Client::_eventData(const Message &msg)
     if (msg.contents.size() == 0u)
         throw protocol_error("Received empty EventData message");
 
+    if (m_streamInfo.protocolVersion >= 2)
+    {
+        _eventDataV2(msg);
+        return;
+    }
+
     try
     {
         uint8_t *contentsBegin = const_cast<uint8_t *>(msg.contents.data());
@@ -850,6 +1282,7 @@ inline void Client::_eventData(const Message &msg)
             dsc.valueType = dsd.valueType;
             dsc.count = elementCount;
             dsc.firstIndex = ci.buffp;
+            dsc.isSigned = !dsd.outputs.empty() && dsd.outputs[0].isSigned;
             m_contentsVec[dsIndex] = dsc;
 
             // Skip over the (index, value) pairs to make the iterator point to the
@@ -871,6 +1304,182 @@ inline void Client::_eventData(const Message &msg)
     }
 }
 
+// Protocol version 2 EventData layout:
+// u8 eventIndex
+// for each datasource:
+//   u8 dataSourceIndex
+//   for each output of the datasource:
+//     u8  encoding
+//     u16 elementCount
+//     encoding specific payload, see the Encoding enum.
+inline void Client::_eventDataV2(const Message &msg)
+{
+    try
+    {
+        uint8_t *contentsBegin = const_cast<uint8_t *>(msg.contents.data());
+
+        BufferIterator ci(contentsBegin, msg.contents.size());
+        uint8_t eventIndex = ci.extractU8();
+
+        if (eventIndex >= m_streamInfo.eventDataDescriptions.size())
+            throw data_consistency_error("eventIndex out of range");
+
+        const auto &edd = m_streamInfo.eventDataDescriptions[eventIndex];
+        m_outputContents.resize(edd.dataSources.size());
+        size_t decodeBufferIndex = 0;
+
+        // Varint and Bitmap blocks are decoded into packed (u32 index, u64
+        // value) pairs.
+        const size_t decodedEntrySize = sizeof(uint32_t) + sizeof(uint64_t);
+
+        for (size_t dsIndex = 0; dsIndex < edd.dataSources.size(); dsIndex++)
+        {
+            uint8_t indexCheck = ci.extractU8();
+
+            if (indexCheck != dsIndex)
+            {
+                throw data_consistency_error(
+                    "Wrong dataSourceIndex in EventData message, expected "
+                    + std::to_string(dsIndex) + ", got " + std::to_string(indexCheck));
+            }
+
+            const auto &dsd = edd.dataSources[dsIndex];
+            auto &outputContents = m_outputContents[dsIndex];
+            outputContents.resize(dsd.outputs.size());
+
+            for (size_t outIndex = 0; outIndex < dsd.outputs.size(); outIndex++)
+            {
+                const auto &od = dsd.outputs[outIndex];
+                auto encoding = static_cast<Encoding>(ci.extractU8());
+                uint16_t elementCount = ci.extractU16();
+
+                if (elementCount > od.size)
+                    throw data_consistency_error("EventData element count exceeds output size");
+
+                DataSourceContents dsc;
+                dsc.indexType = od.indexType;
+                dsc.valueType = od.valueType;
+                dsc.count = elementCount;
+                dsc.isSigned = od.isSigned;
+
+                if (encoding == Encoding::Indexed)
+                {
+                    dsc.firstIndex = ci.buffp;
+                    ci.skip(elementCount * get_entry_size(dsc));
+
+                    if (get_end_pointer(dsc) > ci.endp)
+                        throw end_of_buffer();
+
+                    outputContents[outIndex] = dsc;
+                    continue;
+                }
+
+                if (encoding != Encoding::Varint && encoding != Encoding::Bitmap)
+                    throw protocol_error("Invalid encoding in EventData message");
+
+                if (decodeBufferIndex >= m_decodeBuffers.size())
+                    m_decodeBuffers.resize(decodeBufferIndex + 1);
+
+                auto &decodeBuffer = m_decodeBuffers[decodeBufferIndex++];
+                decodeBuffer.resize(elementCount * decodedEntrySize);
+                uint8_t *dest = decodeBuffer.data();
+
+                auto push_entry = [&dest] (uint32_t index, uint64_t value)
+                {
+                    memcpy(dest, &index, sizeof(index));
+                    memcpy(dest + sizeof(index), &value, sizeof(value));
+                    dest += decodedEntrySize;
+                };
+
+                if (encoding == Encoding::Varint)
+                {
+                    uint64_t index = 0;
+
+                    for (uint16_t i = 0; i < elementCount; i++)
+                    {
+                        index += decode_varint(ci) + (i > 0 ? 1 : 0);
+                        uint64_t value = decode_varint(ci);
+
+                        if (index >= od.size)
+                            throw data_consistency_error("EventData index out of range");
+
+                        if (od.isSigned)
+                            value = static_cast<uint64_t>(zigzag_decode(value));
+
+                        push_entry(index, value);
+                    }
+                }
+                else
+                {
+                    const size_t bitmapBytes = (od.size + 7) / 8;
+                    const size_t valueSize = get_storage_type_size(od.valueType);
+
+                    if (bitmapBytes + elementCount * valueSize > ci.bytesLeft())
+                        throw end_of_buffer();
+
+                    const uint8_t *bitmap = ci.buffp;
+                    const uint8_t *values = bitmap + bitmapBytes;
+                    uint16_t decoded = 0;
+
+                    for (uint32_t index = 0; index < od.size && decoded < elementCount; index++)
+                    {
+                        if (bitmap[index / 8] & (1u << (index % 8)))
+                        {
+                            uint64_t value = od.isSigned
+                                ? static_cast<uint64_t>(
+                                    read_storage_signed<int64_t>(od.valueType, values))
+                                : read_storage<uint64_t>(od.valueType, values);
+
+                            push_entry(index, value);
+                            values += valueSize;
+                            ++decoded;
+                        }
+                    }
+
+                    if (decoded != elementCount)
+                        throw data_consistency_error("EventData bitmap does not match the element count");
+
+                    ci.skip(bitmapBytes + elementCount * valueSize);
+                }
+
+                dsc.indexType = StorageType::st_uint32_t;
+                dsc.valueType = StorageType::st_uint64_t;
+                dsc.firstIndex = decodeBuffer.data();
+                outputContents[outIndex] = dsc;
+            }
+        }
+
+        // Call the virtual data handler
+        eventDataOutputs(msg, eventIndex, m_outputContents);
+
+        // Unlike in the version 1 case the contents vectors are not cleared
+        // to avoid reallocating them for each event. They are overwritten by
+        // the next EventData message.
+    }
+    catch (const end_of_buffer &)
+    {
+        throw data_consistency_error(
+            "Unexpectedly hit end of buffer while parsing EventData message");
+    }
+}
+
+inline void Client::eventDataOutputs(
+    const Message &msg, int eventIndex,
+    const std::vector<std::vector<DataSourceContents>> &contents)
+{
+    m_contentsVec.resize(contents.size());
+
+    for (size_t dsIndex = 0; dsIndex < contents.size(); dsIndex++)
+    {
+        m_contentsVec[dsIndex] = contents[dsIndex].empty()
+            ? DataSourceContents{}
+            : contents[dsIndex][0];
+    }
+
+    eventData(msg, eventIndex, m_contentsVec);
+    m_contentsVec.clear();
+}
+
 inline void Client::_endRun(const Message &msg)
 {
     auto infoJson = json::parse(msg.contents);
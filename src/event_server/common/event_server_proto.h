@@ -25,6 +25,7 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <string>
 #include <vector>
 
 // Message framing format and message types of the mvme analysis data server
@@ -37,14 +38,26 @@ namespace mvme
 namespace event_server
 {
 
-static const int ProtocolVersion = 1;
+// Highest protocol version supported by this implementation. Clients start
+// out with version 1 and can request a newer version by replying to ServerInfo
+// with a ClientConfig message. The version and encoding used for the event
+// data of a run are stated in the BeginRun message.
+static const int ProtocolVersion = 2;
 
-// Valid transitions:
+// Valid transitions of the messages sent by the server:
 // initial      -> ServerInfo
 // ServerInfo   -> BeginRun
 // BeginRun     -> EventData | EndRun
 // EventData    -> EventData | EndRun
 // EndRun       -> BeginRun
+//
+// Protocol version 2 streams additionally contain ServerInfo updates during a
+// run, i.e. after BeginRun and before EndRun. They carry the per client
+// counters of the run under the "clients" key and do not change the state of
+// the sequence.
+//
+// ClientConfig is the only message sent from the client to the server. It is
+// optional and must be sent right after receiving ServerInfo.
 enum MessageType: uint8_t
 {
     Invalid = 0,
@@ -52,10 +65,32 @@ enum MessageType: uint8_t
     BeginRun,
     EventData,
     EndRun,
+    ClientConfig,
 
     MessageTypeCount
 };
 
+// Encodings of the per output data blocks in protocol version 2 EventData
+// messages. Each block starts with the encoding tag and the number of valid
+// parameters. Auto is only used during negotiation and lets the server pick
+// the smallest encoding for each block.
+//
+// Indexed: packed (index, value) pairs, same as in protocol version 1.
+// Varint:  for each valid parameter the delta to the previous index minus one
+//          followed by the value, both as LEB128 varints. Signed values are
+//          zigzag encoded.
+// Bitmap:  a bitmap of (size + 7) / 8 bytes with a bit set for each valid
+//          parameter followed by the packed values.
+enum class Encoding: uint8_t
+{
+    Indexed,
+    Varint,
+    Bitmap,
+    Auto,
+};
+
+static const uint8_t EncodingCount = static_cast<uint8_t>(Encoding::Auto) + 1;
+
 // Size of the frame of each message. The message type is followed by a uin32_t
 // value specifying the size of the message contents in bytes.
 static const size_t MessageFrameSize = sizeof(MessageType) + sizeof(uint32_t);
@@ -86,6 +121,7 @@ inline TransitionTable make_transition_table()
     ret[MessageType::BeginRun]   = { { MessageType::EventData, MessageType::EndRun } };
     ret[MessageType::EventData]  = { { MessageType::EventData, MessageType::EndRun } };
     ret[MessageType::EndRun]     = { { MessageType::BeginRun } };
+    ret[MessageType::ClientConfig] = {};
 
     return ret;
 }
@@ -113,6 +149,7 @@ inline MessageTypeStringTable make_messagetype_stringtable()
     ret[MessageType::BeginRun]   = "BeginRun";
     ret[MessageType::EventData]  = "EventData";
     ret[MessageType::EndRun]     = "EndRun";
+    ret[MessageType::ClientConfig] = "ClientConfig";
 
     return ret;
 }
@@ -124,6 +161,34 @@ inline const std::string &to_string(MessageType t)
     return stringTable[t];
 }
 
+inline const char *to_string(Encoding encoding)
+{
+    switch (encoding)
+    {
+        case Encoding::Indexed: return "indexed";
+        case Encoding::Varint: return "varint";
+        case Encoding::Bitmap: return "bitmap";
+        case Encoding::Auto: return "auto";
+    }
+
+    return "indexed";
+}
+
+// Returns false if the string does not name an encoding.
+inline bool encoding_from_string(const std::string &str, Encoding &dest)
+{
+    for (uint8_t i = 0; i < EncodingCount; i++)
+    {
+        if (str == to_string(static_cast<Encoding>(i)))
+        {
+            dest = static_cast<Encoding>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 } // end namespace data_server
 } // end namespace mvme
 
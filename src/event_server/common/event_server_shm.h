@@ -0,0 +1,955 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __MVME_EVENT_SERVER_SHM_H__
+#define __MVME_EVENT_SERVER_SHM_H__
+
+// Shared memory transport for the event server protocol.
+//
+// The server publishes framed messages (MessageType, u32 size, contents)
+// exactly once into a ring buffer living in a POSIX shared memory segment.
+// Local clients map the segment and read the messages at their own pace. This
+// avoids the per-client socket writes and kernel copies of the TCP transport.
+//
+// Segment layout:
+//   ShmHeader | ServerInfo json | BeginRun snapshot json | ring
+//
+// Each reader owns one slot in the header containing its read position. The
+// writer never overwrites data that an active reader has not consumed yet:
+// publish() blocks until enough space is available, tryPublish() and friends
+// return WouldBlock instead. Readers which stay stuck for longer than the
+// writers timeout are evicted and see a connection_closed exception on their
+// next read. Readers of crashed processes are detected via their pid and
+// released automatically.
+//
+// Readers attaching during a run get the ServerInfo message and the BeginRun
+// message of the active run from the snapshot areas, so the message sequence
+// they see is the same as for a TCP client connecting during a run.
+//
+// The transport is only available on POSIX systems.
+
+#include <cstddef>
+
+namespace mvme
+{
+namespace event_server
+{
+namespace shm
+{
+
+static const char *const DefaultName = "mvme_event_server";
+static const size_t DefaultRingSize = 64u * 1024 * 1024;
+
+} // end namespace shm
+} // end namespace event_server
+} // end namespace mvme
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event_server_proto.h"
+
+namespace mvme
+{
+namespace event_server
+{
+namespace shm
+{
+
+static const size_t MinRingSize = 1024u * 1024;
+static const size_t ServerInfoCapacity = 64u * 1024;
+static const size_t BeginRunSnapshotCapacity = 4u * 1024 * 1024;
+static const uint32_t MaxReaders = 16;
+
+static const uint32_t HeaderMagic = 0x4d53484du; // "MHSM" in little endian
+static const uint32_t LayoutVersion = 1;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "lock-free atomics are required for inter-process use");
+
+enum ServerState: uint32_t
+{
+    ServerStarting,
+    ServerRunning,
+    ServerClosed,
+};
+
+enum ReaderState: uint32_t
+{
+    ReaderFree,
+    ReaderClaiming,     // Slot taken but the read position is not valid yet.
+    ReaderActive,       // The writer respects the read position of the slot.
+    ReaderEvicted,      // The writer gave up waiting for the reader.
+};
+
+struct alignas(64) ShmReaderSlot
+{
+    std::atomic<uint32_t> state;
+    std::atomic<int32_t> pid;
+    std::atomic<uint64_t> readPos;
+};
+
+struct ShmHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ringSize;
+    uint64_t serverInfoCapacity;
+    uint64_t snapshotCapacity;
+    int32_t serverPid;
+    std::atomic<uint32_t> serverState;
+
+    // Total number of bytes ever published into the ring. Data is located at
+    // (pos % ringSize).
+    alignas(64) std::atomic<uint64_t> writePos;
+
+    // Seqlock protecting the snapshot fields and data areas. Odd while the
+    // writer is updating them.
+    alignas(64) std::atomic<uint32_t> snapshotSeq;
+    std::atomic<uint32_t> runActive;
+    std::atomic<uint64_t> beginRunPos; // writePos directly after the BeginRun message
+    std::atomic<uint32_t> beginRunSize; // 0 if the json did not fit the snapshot area
+    std::atomic<uint32_t> serverInfoSize;
+
+    ShmReaderSlot readers[MaxReaders];
+};
+
+inline std::string make_segment_name(const std::string &name)
+{
+    if (!name.empty() && name[0] == '/')
+        return name;
+    return "/" + name;
+}
+
+inline size_t round_up_to_page_size(size_t size)
+{
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return ((size + pageSize - 1) / pageSize) * pageSize;
+}
+
+inline size_t get_data_offset()
+{
+    return round_up_to_page_size(sizeof(ShmHeader));
+}
+
+inline size_t get_segment_size(size_t ringSize)
+{
+    return get_data_offset() + ServerInfoCapacity + BeginRunSnapshotCapacity + ringSize;
+}
+
+inline bool is_process_alive(int32_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+// Sleeps for an increasing amount of time. Used by both sides while waiting
+// for the other side to make progress.
+struct Backoff
+{
+    unsigned iteration = 0;
+
+    void operator()()
+    {
+        if (iteration++ < 64)
+            return;
+
+        struct timespec ts = { 0, iteration < 1024 ? 10 * 1000 : 200 * 1000 };
+        nanosleep(&ts, nullptr);
+    }
+
+    void reset() { iteration = 0; }
+};
+
+// Copies size bytes starting at the absolute position pos out of the ring.
+inline void ring_read(const uint8_t *ring, uint64_t ringSize, uint64_t pos,
+                      uint8_t *dest, size_t size)
+{
+    size_t offset = pos % ringSize;
+    size_t part1 = std::min(size, static_cast<size_t>(ringSize - offset));
+    std::memcpy(dest, ring + offset, part1);
+    std::memcpy(dest + part1, ring, size - part1);
+}
+
+inline void ring_write(uint8_t *ring, uint64_t ringSize, uint64_t pos,
+                       const uint8_t *src, size_t size)
+{
+    size_t offset = pos % ringSize;
+    size_t part1 = std::min(size, static_cast<size_t>(ringSize - offset));
+    std::memcpy(ring + offset, src, part1);
+    std::memcpy(ring, src + part1, size - part1);
+}
+
+class Segment
+{
+    public:
+        Segment() {}
+        Segment(const Segment &) = delete;
+        Segment &operator=(const Segment &) = delete;
+
+        ~Segment() { unmap(); }
+
+        void map(int fd, size_t size)
+        {
+            void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (addr == MAP_FAILED)
+                throw std::system_error(errno, std::system_category(), "mmap");
+
+            m_addr = reinterpret_cast<uint8_t *>(addr);
+            m_size = size;
+        }
+
+        void unmap()
+        {
+            if (m_addr)
+                munmap(m_addr, m_size);
+
+            m_addr = nullptr;
+            m_size = 0;
+        }
+
+        ShmHeader *header() const { return reinterpret_cast<ShmHeader *>(m_addr); }
+        uint8_t *serverInfoData() const { return m_addr + get_data_offset(); }
+        uint8_t *snapshotData() const { return serverInfoData() + ServerInfoCapacity; }
+        uint8_t *ring() const { return snapshotData() + BeginRunSnapshotCapacity; }
+        bool isMapped() const { return m_addr != nullptr; }
+
+    private:
+        uint8_t *m_addr = nullptr;
+        size_t m_size = 0;
+};
+
+// Server side of the transport. Not thread-safe, the owner must serialize all
+// calls except for readerCount() and releaseDeadReaders() which only touch the
+// reader slots and may be called from any thread.
+class ShmWriter
+{
+    public:
+        enum class PublishResult
+        {
+            Ok,
+            WouldBlock, // An active reader has not consumed enough data yet.
+            TooLarge,   // The message does not fit into the ring.
+        };
+
+        // Creates the shared memory segment. An existing segment of the same
+        // name is replaced unless the server owning it is still alive in
+        // which case an exception is thrown.
+        ShmWriter(const std::string &name = DefaultName, size_t ringSize = DefaultRingSize)
+            : m_name(make_segment_name(name))
+        {
+            ringSize = round_up_to_page_size(std::max(ringSize, MinRingSize));
+
+            if (auto pid = get_segment_owner())
+            {
+                throw std::system_error(
+                    EEXIST, std::system_category(),
+                    "shm segment " + m_name + " is in use by pid " + std::to_string(pid));
+            }
+
+            shm_unlink(m_name.c_str());
+
+            int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+            if (fd < 0)
+                throw std::system_error(errno, std::system_category(), "shm_open " + m_name);
+
+            const size_t segmentSize = get_segment_size(ringSize);
+
+            try
+            {
+                if (ftruncate(fd, segmentSize) != 0)
+                    throw std::system_error(errno, std::system_category(), "ftruncate");
+
+                m_segment.map(fd, segmentSize);
+            }
+            catch (...)
+            {
+                close(fd);
+                shm_unlink(m_name.c_str());
+                throw;
+            }
+
+            close(fd);
+
+            // The segment is zero filled. Construct the header in place.
+            auto hdr = new (m_segment.header()) ShmHeader;
+            hdr->magic = HeaderMagic;
+            hdr->version = LayoutVersion;
+            hdr->ringSize = ringSize;
+            hdr->serverInfoCapacity = ServerInfoCapacity;
+            hdr->snapshotCapacity = BeginRunSnapshotCapacity;
+            hdr->serverPid = getpid();
+            hdr->writePos.store(0);
+            hdr->snapshotSeq.store(0);
+            hdr->runActive.store(0);
+            hdr->beginRunPos.store(0);
+            hdr->beginRunSize.store(0);
+            hdr->serverInfoSize.store(0);
+
+            for (auto &slot: hdr->readers)
+            {
+                slot.pid.store(0);
+                slot.readPos.store(0);
+                slot.state.store(ReaderFree);
+            }
+
+            hdr->serverState.store(ServerRunning, std::memory_order_release);
+        }
+
+        ~ShmWriter()
+        {
+            if (m_segment.isMapped())
+            {
+                m_segment.header()->serverState.store(ServerClosed, std::memory_order_release);
+                m_segment.unmap();
+                shm_unlink(m_name.c_str());
+            }
+        }
+
+        ShmWriter(const ShmWriter &) = delete;
+        ShmWriter &operator=(const ShmWriter &) = delete;
+
+        const std::string &name() const { return m_name; }
+        size_t ringSize() const { return m_segment.header()->ringSize; }
+
+        // Time the writer waits for slow readers before evicting them.
+        void setBlockTimeout(std::chrono::milliseconds timeout) { m_blockTimeout = timeout; }
+
+        // Sets the contents of the ServerInfo message sent to newly attaching
+        // readers.
+        void setServerInfo(const std::string &json)
+        {
+            if (json.size() > ServerInfoCapacity)
+                throw std::length_error("ServerInfo json exceeds the shm snapshot capacity");
+
+            auto hdr = m_segment.header();
+            beginSnapshotUpdate();
+            std::memcpy(m_segment.serverInfoData(), json.data(), json.size());
+            hdr->serverInfoSize.store(json.size(), std::memory_order_relaxed);
+            endSnapshotUpdate();
+        }
+
+        // Publishes the BeginRun message. snapshotJson is the variant sent to
+        // readers attaching while the run is in progress. Blocks until there
+        // is enough space in the ring.
+        bool beginRun(const std::string &json, const std::string &snapshotJson)
+        {
+            return waitFor([&] { return tryBeginRun(json, snapshotJson); });
+        }
+
+        bool endRun(const std::string &json)
+        {
+            return waitFor([&] { return tryEndRun(json); });
+        }
+
+        // Frames and publishes a message.
+        bool publish(MessageType type, const uint8_t *contents, uint32_t size)
+        {
+            return waitFor([&] { return tryPublish(type, contents, size); });
+        }
+
+        // Publishes one or more already framed messages. Returns false if the
+        // data is larger than the ring.
+        bool publishFramed(const uint8_t *data, size_t size)
+        {
+            return waitFor([&] { return tryPublishFramed(data, size); });
+        }
+
+        // Non-blocking variants of the above. Return WouldBlock if the data
+        // does not fit without overwriting unread data of an active reader.
+        // The call has to be repeated later in this case. Readers that do not
+        // make progress within the block timeout are evicted by one of the
+        // repeated calls.
+        PublishResult tryBeginRun(const std::string &json, const std::string &snapshotJson)
+        {
+            auto hdr = m_segment.header();
+            auto result = checkSpace(MessageFrameSize + json.size());
+
+            if (result != PublishResult::Ok)
+                return result;
+
+            // The snapshot stays locked while the message is written. Readers
+            // load writePos before the snapshot and can thus decide whether
+            // the BeginRun message is in front or behind their read position.
+            beginSnapshotUpdate();
+
+            if (snapshotJson.size() <= BeginRunSnapshotCapacity)
+            {
+                std::memcpy(m_segment.snapshotData(), snapshotJson.data(), snapshotJson.size());
+                hdr->beginRunSize.store(snapshotJson.size(), std::memory_order_relaxed);
+            }
+            else
+            {
+                // Readers attaching during this run will wait for the next one.
+                hdr->beginRunSize.store(0, std::memory_order_relaxed);
+            }
+
+            writeMessage(MessageType::BeginRun,
+                         reinterpret_cast<const uint8_t *>(json.data()), json.size());
+
+            hdr->beginRunPos.store(hdr->writePos.load(std::memory_order_relaxed),
+                                   std::memory_order_relaxed);
+            hdr->runActive.store(1, std::memory_order_relaxed);
+            endSnapshotUpdate();
+
+            return PublishResult::Ok;
+        }
+
+        PublishResult tryEndRun(const std::string &json)
+        {
+            auto result = checkSpace(MessageFrameSize + json.size());
+
+            if (result != PublishResult::Ok)
+                return result;
+
+            beginSnapshotUpdate();
+            m_segment.header()->runActive.store(0, std::memory_order_relaxed);
+            endSnapshotUpdate();
+
+            writeMessage(MessageType::EndRun,
+                         reinterpret_cast<const uint8_t *>(json.data()), json.size());
+
+            return PublishResult::Ok;
+        }
+
+        PublishResult tryPublish(MessageType type, const uint8_t *contents, uint32_t size)
+        {
+            auto result = checkSpace(MessageFrameSize + size);
+
+            if (result == PublishResult::Ok)
+                writeMessage(type, contents, size);
+
+            return result;
+        }
+
+        PublishResult tryPublishFramed(const uint8_t *data, size_t size)
+        {
+            assert(size >= MessageFrameSize);
+
+            auto result = checkSpace(size);
+
+            if (result == PublishResult::Ok)
+            {
+                auto hdr = m_segment.header();
+                const uint64_t pos = hdr->writePos.load(std::memory_order_relaxed);
+                ring_write(m_segment.ring(), hdr->ringSize, pos, data, size);
+                hdr->writePos.store(pos + size, std::memory_order_release);
+            }
+
+            return result;
+        }
+
+        // Evicts all active readers. Used when the readers cannot keep up
+        // with the data rate.
+        void evictReaders()
+        {
+            for (auto &slot: m_segment.header()->readers)
+            {
+                uint32_t expected = ReaderActive;
+                slot.state.compare_exchange_strong(expected, ReaderEvicted);
+            }
+        }
+
+        // Number of attached readers. Cheap enough to be called per event.
+        size_t readerCount() const
+        {
+            size_t result = 0;
+
+            for (auto &slot: m_segment.header()->readers)
+            {
+                if (slot.state.load(std::memory_order_relaxed) == ReaderActive)
+                    ++result;
+            }
+
+            return result;
+        }
+
+        // Releases the slots of reader processes that exited without
+        // detaching. Performs a syscall per used slot, so call it
+        // periodically, not per event.
+        void releaseDeadReaders()
+        {
+            for (auto &slot: m_segment.header()->readers)
+            {
+                auto state = slot.state.load(std::memory_order_acquire);
+
+                if (state != ReaderFree
+                    && !is_process_alive(slot.pid.load(std::memory_order_relaxed)))
+                {
+                    slot.state.compare_exchange_strong(state, ReaderFree);
+                }
+            }
+        }
+
+    private:
+        // Returns the pid of the live server owning an existing segment or 0.
+        int32_t get_segment_owner() const
+        {
+            int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+
+            if (fd < 0)
+                return 0;
+
+            int32_t result = 0;
+            struct stat sb = {};
+
+            if (fstat(fd, &sb) == 0 && static_cast<size_t>(sb.st_size) >= sizeof(ShmHeader))
+            {
+                void *addr = mmap(nullptr, sizeof(ShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+
+                if (addr != MAP_FAILED)
+                {
+                    auto hdr = reinterpret_cast<const ShmHeader *>(addr);
+
+                    if (hdr->magic == HeaderMagic
+                        && hdr->serverState.load() != ServerClosed
+                        && hdr->serverPid != getpid()
+                        && is_process_alive(hdr->serverPid))
+                    {
+                        result = hdr->serverPid;
+                    }
+
+                    munmap(addr, sizeof(ShmHeader));
+                }
+            }
+
+            close(fd);
+            return result;
+        }
+
+        void beginSnapshotUpdate()
+        {
+            auto &seq = m_segment.header()->snapshotSeq;
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void endSnapshotUpdate()
+        {
+            auto &seq = m_segment.header()->snapshotSeq;
+            seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // The caller must have checked that there is enough space.
+        void writeMessage(MessageType type, const uint8_t *contents, uint32_t size)
+        {
+            uint8_t frame[MessageFrameSize];
+            std::memcpy(frame, &type, sizeof(type));
+            std::memcpy(frame + sizeof(type), &size, sizeof(size));
+
+            auto hdr = m_segment.header();
+            const uint64_t pos = hdr->writePos.load(std::memory_order_relaxed);
+            ring_write(m_segment.ring(), hdr->ringSize, pos, frame, sizeof(frame));
+            ring_write(m_segment.ring(), hdr->ringSize, pos + sizeof(frame), contents, size);
+            hdr->writePos.store(pos + sizeof(frame) + size, std::memory_order_release);
+        }
+
+        // Repeats a try*() call until it does not return WouldBlock anymore.
+        template<typename F>
+        bool waitFor(F &&f)
+        {
+            Backoff backoff;
+            PublishResult result;
+
+            while ((result = f()) == PublishResult::WouldBlock)
+                backoff();
+
+            return result == PublishResult::Ok;
+        }
+
+        // Checks if the ring can hold size more bytes without overwriting
+        // unread data of an active reader. Releases readers of dead processes
+        // and evicts readers that did not make progress within the block
+        // timeout, measured from the first WouldBlock result.
+        PublishResult checkSpace(size_t size)
+        {
+            auto hdr = m_segment.header();
+
+            if (size > hdr->ringSize)
+                return PublishResult::TooLarge;
+
+            const uint64_t writePos = hdr->writePos.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                ShmReaderSlot *slowest = nullptr;
+                uint64_t minReadPos = writePos;
+
+                for (auto &slot: hdr->readers)
+                {
+                    if (slot.state.load(std::memory_order_acquire) != ReaderActive)
+                        continue;
+
+                    uint64_t readPos = slot.readPos.load(std::memory_order_acquire);
+
+                    if (readPos < minReadPos)
+                    {
+                        minReadPos = readPos;
+                        slowest = &slot;
+                    }
+                }
+
+                if (writePos + size - minReadPos <= hdr->ringSize)
+                {
+                    m_isBlocked = false;
+                    return PublishResult::Ok;
+                }
+
+                assert(slowest);
+
+                if (!is_process_alive(slowest->pid.load(std::memory_order_relaxed)))
+                {
+                    uint32_t expected = ReaderActive;
+                    slowest->state.compare_exchange_strong(expected, ReaderFree);
+                    continue;
+                }
+
+                auto now = std::chrono::steady_clock::now();
+
+                if (!m_isBlocked)
+                {
+                    m_isBlocked = true;
+                    m_blockedSince = now;
+                }
+
+                if (now - m_blockedSince > m_blockTimeout)
+                {
+                    uint32_t expected = ReaderActive;
+                    slowest->state.compare_exchange_strong(expected, ReaderEvicted);
+                    continue;
+                }
+
+                return PublishResult::WouldBlock;
+            }
+        }
+
+        std::string m_name;
+        Segment m_segment;
+        std::chrono::milliseconds m_blockTimeout = std::chrono::milliseconds(30 * 1000);
+        bool m_isBlocked = false;
+        std::chrono::steady_clock::time_point m_blockedSince;
+};
+
+// Client side of the transport. Each reader occupies one slot in the segment.
+class ShmReader
+{
+    public:
+        // Attaches to the segment created by the server. Throws
+        // std::system_error if the segment does not exist and
+        // std::runtime_error if the server is not running or all reader slots
+        // are taken.
+        explicit ShmReader(const std::string &name = DefaultName)
+            : m_name(make_segment_name(name))
+        {
+            int fd = shm_open(m_name.c_str(), O_RDWR, 0);
+
+            if (fd < 0)
+                throw std::system_error(errno, std::system_category(), "shm_open " + m_name);
+
+            struct stat sb = {};
+
+            if (fstat(fd, &sb) != 0)
+            {
+                int err = errno;
+                close(fd);
+                throw std::system_error(err, std::system_category(), "fstat " + m_name);
+            }
+
+            try
+            {
+                if (static_cast<size_t>(sb.st_size) < sizeof(ShmHeader))
+                    throw std::runtime_error("shm segment " + m_name + " is too small");
+
+                m_segment.map(fd, sb.st_size);
+            }
+            catch (...)
+            {
+                close(fd);
+                throw;
+            }
+
+            close(fd);
+
+            auto hdr = m_segment.header();
+
+            if (hdr->magic != HeaderMagic || hdr->version != LayoutVersion
+                || hdr->serverState.load(std::memory_order_acquire) != ServerRunning
+                || static_cast<size_t>(sb.st_size) < get_segment_size(hdr->ringSize))
+            {
+                throw std::runtime_error("shm segment " + m_name + " is not ready");
+            }
+
+            for (auto &slot: hdr->readers)
+            {
+                uint32_t expected = ReaderFree;
+
+                if (slot.state.compare_exchange_strong(expected, ReaderClaiming))
+                {
+                    m_slot = &slot;
+                    break;
+                }
+            }
+
+            if (!m_slot)
+                throw std::runtime_error("no free reader slot in shm segment " + m_name);
+
+            m_slot->pid.store(getpid(), std::memory_order_relaxed);
+
+            // Start reading at the current write position. This is always a
+            // message boundary.
+            m_readPos = hdr->writePos.load(std::memory_order_acquire);
+            m_slot->readPos.store(m_readPos, std::memory_order_relaxed);
+            m_slot->state.store(ReaderActive, std::memory_order_release);
+
+            loadSnapshot();
+        }
+
+        ~ShmReader()
+        {
+            if (m_slot)
+                m_slot->state.store(ReaderFree, std::memory_order_release);
+        }
+
+        ShmReader(const ShmReader &) = delete;
+        ShmReader &operator=(const ShmReader &) = delete;
+
+        const std::string &name() const { return m_name; }
+
+        enum class Status
+        {
+            Ok,
+            ServerClosed,
+            Evicted,
+            Overrun,
+            ProtocolError,
+        };
+
+        // Reads the next message into msg, blocking until one is available.
+        // Returns a status other than Ok if the server shut down, the reader
+        // was evicted or data was overwritten before it could be read. See
+        // ShmConnection in event_server_lib.h for the mapping to exceptions.
+        Status readMessage(Message &msg, size_t maxMessageSize)
+        {
+            while (true)
+            {
+                if (!m_pending.empty())
+                {
+                    msg = std::move(m_pending.front());
+                    m_pending.pop_front();
+                    return Status::Ok;
+                }
+
+                auto status = readRingMessage(msg, maxMessageSize);
+
+                if (status != Status::Ok)
+                    return status;
+
+                // After attaching skip the remainder of a run whose BeginRun
+                // message was missed.
+                if (m_waitForBeginRun)
+                {
+                    if (msg.type != MessageType::BeginRun)
+                        continue;
+
+                    m_waitForBeginRun = false;
+                }
+
+                return Status::Ok;
+            }
+        }
+
+    private:
+        void loadSnapshot()
+        {
+            auto hdr = m_segment.header();
+            Message serverInfo;
+            Message beginRun;
+            bool runActive = false;
+            Backoff backoff;
+
+            while (true)
+            {
+                uint32_t seq0 = hdr->snapshotSeq.load(std::memory_order_acquire);
+
+                if (seq0 & 1u)
+                {
+                    backoff();
+                    continue;
+                }
+
+                uint32_t serverInfoSize = std::min<uint64_t>(
+                    hdr->serverInfoSize.load(std::memory_order_relaxed), ServerInfoCapacity);
+                uint32_t beginRunSize = std::min<uint64_t>(
+                    hdr->beginRunSize.load(std::memory_order_relaxed), BeginRunSnapshotCapacity);
+                runActive = (hdr->runActive.load(std::memory_order_relaxed)
+                             && hdr->beginRunPos.load(std::memory_order_relaxed) <= m_readPos);
+
+                serverInfo.type = MessageType::ServerInfo;
+                serverInfo.contents.resize(serverInfoSize);
+                std::memcpy(serverInfo.contents.data(), m_segment.serverInfoData(), serverInfoSize);
+
+                if (runActive)
+                {
+                    beginRun.type = MessageType::BeginRun;
+                    beginRun.contents.resize(beginRunSize);
+                    std::memcpy(beginRun.contents.data(), m_segment.snapshotData(), beginRunSize);
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (hdr->snapshotSeq.load(std::memory_order_relaxed) == seq0)
+                    break;
+
+                backoff();
+            }
+
+            m_pending.emplace_back(std::move(serverInfo));
+
+            if (runActive && !beginRun.contents.empty())
+            {
+                m_pending.emplace_back(std::move(beginRun));
+                m_waitForBeginRun = false;
+            }
+            else
+            {
+                m_waitForBeginRun = true;
+            }
+        }
+
+        Status readRingMessage(Message &msg, size_t maxMessageSize)
+        {
+            auto hdr = m_segment.header();
+            const uint64_t ringSize = hdr->ringSize;
+            uint64_t writePos = 0;
+            Backoff backoff;
+
+            if (m_slot->state.load(std::memory_order_acquire) != ReaderActive)
+                return Status::Evicted;
+
+            while ((writePos = hdr->writePos.load(std::memory_order_acquire)) == m_readPos)
+            {
+                if (auto status = checkState())
+                    return *status;
+
+                backoff();
+            }
+
+            if (writePos - m_readPos < MessageFrameSize || writePos - m_readPos > ringSize)
+                return Status::Overrun;
+
+            uint8_t frame[MessageFrameSize];
+            uint32_t size = 0;
+            ring_read(m_segment.ring(), ringSize, m_readPos, frame, sizeof(frame));
+
+            msg.type = MessageType::Invalid;
+            std::memcpy(&msg.type, frame, sizeof(msg.type));
+            std::memcpy(&size, frame + sizeof(msg.type), sizeof(size));
+
+            // The frame may be garbage if it was overwritten while copying.
+            if (!msg.isValid() || size > maxMessageSize
+                || MessageFrameSize + size > writePos - m_readPos)
+            {
+                return isOverrun() ? Status::Overrun : Status::ProtocolError;
+            }
+
+            msg.contents.resize(size);
+            ring_read(m_segment.ring(), ringSize, m_readPos + MessageFrameSize,
+                      msg.contents.data(), size);
+
+            if (isOverrun())
+                return Status::Overrun;
+
+            m_readPos += MessageFrameSize + size;
+            m_slot->readPos.store(m_readPos, std::memory_order_release);
+
+            return Status::Ok;
+        }
+
+        // True if the writer wrapped around and overwrote data at the current
+        // read position. Must be checked after copying data out of the ring.
+        bool isOverrun() const
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            auto hdr = m_segment.header();
+            return hdr->writePos.load(std::memory_order_relaxed) - m_readPos > hdr->ringSize;
+        }
+
+        struct OptionalStatus
+        {
+            bool valid = false;
+            Status status = Status::Ok;
+            explicit operator bool() const { return valid; }
+            Status operator*() const { return status; }
+        };
+
+        OptionalStatus checkState()
+        {
+            auto hdr = m_segment.header();
+
+            if (m_slot->state.load(std::memory_order_acquire) != ReaderActive)
+                return { true, Status::Evicted };
+
+            if (hdr->serverState.load(std::memory_order_acquire) != ServerRunning)
+                return { true, Status::ServerClosed };
+
+            // Detect a crashed server. kill() is cheap but not free so only do
+            // it every now and then.
+            if ((++m_idleChecks & 0xffu) == 0 && !is_process_alive(hdr->serverPid))
+                return { true, Status::ServerClosed };
+
+            return {};
+        }
+
+        std::string m_name;
+        Segment m_segment;
+        ShmReaderSlot *m_slot = nullptr;
+        uint64_t m_readPos = 0;
+        std::deque<Message> m_pending;
+        bool m_waitForBeginRun = true;
+        unsigned m_idleChecks = 0;
+};
+
+} // end namespace shm
+} // end namespace event_server
+} // end namespace mvme
+
+#endif // _WIN32
+
+#endif /* __MVME_EVENT_SERVER_SHM_H__ */
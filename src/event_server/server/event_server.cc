@@ -20,7 +20,15 @@
  */
 #include "event_server/server/event_server.h"
 
-#include <QCoreApplication>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+#include <QElapsedTimer>
 #include <QHostInfo>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -28,15 +36,135 @@
 #include <QSettings>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
 
 #include "analysis/a2/a2.h"
 #include "analysis/a2_adapter.h"
 #include "event_server/common/event_server_proto.h"
+#include "event_server/common/event_server_shm.h"
 #include "event_server/server/event_server_util.h"
 #include "git_sha1.h"
 
 using namespace mvme::event_server;
 
+namespace
+{
+
+// Buffer holding one or more complete, framed messages. Event data is
+// collected into batches of multiple EventData messages which are written to
+// the clients with a single socket write. The wire format is unchanged:
+// clients still see a sequence of individual messages.
+struct OutBuffer
+{
+    std::vector<u8> data;
+    size_t used = 0;
+    size_t eventCount = 0;
+};
+
+using OutBufferPtr = std::shared_ptr<const OutBuffer>;
+
+struct QueueEntry
+{
+    OutBufferPtr buffer;
+    bool isEventData;
+};
+
+struct ClientStats
+{
+    size_t bytesSent = 0;
+    size_t eventsSent = 0;
+    size_t eventsDropped = 0;
+    size_t batchesDropped = 0;
+    size_t maxQueuedBytes = 0;
+};
+
+// Event data formats sent to the clients. Format 0 is protocol version 1,
+// the others are protocol version 2 using one of the encodings. Event data is
+// serialized once per format in use.
+static const size_t FormatCount = 1 + EncodingCount;
+
+size_t get_format_index(int protocolVersion, Encoding encoding)
+{
+    return protocolVersion < 2 ? 0 : 1 + static_cast<size_t>(encoding);
+}
+
+int get_format_protocol_version(size_t format)
+{
+    return format == 0 ? 1 : 2;
+}
+
+Encoding get_format_encoding(size_t format)
+{
+    return format == 0 ? Encoding::Indexed : static_cast<Encoding>(format - 1);
+}
+
+// The shared memory ring has no back channel for negotiation. It carries all
+// data source outputs using the cheap to decode indexed encoding.
+static const size_t ShmFormat = 1 + static_cast<size_t>(Encoding::Indexed);
+
+// State of a TCP client shared between the analysis and the sender thread.
+// All members except socket and inBuffer are guarded by
+// EventServer::Private::m_clientsMutex.
+// Clients become ready once they sent a ClientConfig message or the
+// negotiation timed out. Only ready clients receive run data.
+// The shared memory ring is served through a ClientState as well, see
+// EventServer::Private::m_shmClient.
+struct ClientState
+{
+    QTcpSocket *socket = nullptr; // Only accessed from within the sender thread.
+    QByteArray inBuffer;          // Same as socket.
+    QString peerAddress;
+    bool isShm = false;
+    std::deque<QueueEntry> queue;
+    size_t queuedBytes = 0;
+    bool ready = false;
+    size_t format = 0;
+    bool disconnectRequested = false;
+    bool disconnected = false;
+    ClientStats stats;
+    QElapsedTimer runTimer;
+};
+
+using ClientStatePtr = std::shared_ptr<ClientState>;
+
+const char *to_string(EventServer::OverflowPolicy policy)
+{
+    switch (policy)
+    {
+        case EventServer::OverflowPolicy::Block: return "block";
+        case EventServer::OverflowPolicy::Drop: return "drop";
+        case EventServer::OverflowPolicy::Disconnect: return "disconnect";
+    }
+
+    return "block";
+}
+
+EventServer::OverflowPolicy overflow_policy_from_string(const QString &str)
+{
+    if (str == QSL("drop"))
+        return EventServer::OverflowPolicy::Drop;
+
+    if (str == QSL("disconnect"))
+        return EventServer::OverflowPolicy::Disconnect;
+
+    return EventServer::OverflowPolicy::Block;
+}
+
+OutBufferPtr make_message_buffer(MessageType type, const std::string &contents)
+{
+    auto result = std::make_shared<OutBuffer>();
+    u32 size = contents.size();
+    result->data.resize(MessageFrameSize + size);
+    std::memcpy(result->data.data(), &type, sizeof(type));
+    std::memcpy(result->data.data() + sizeof(type), &size, sizeof(size));
+    std::memcpy(result->data.data() + MessageFrameSize, contents.data(), size);
+    result->used = result->data.size();
+    return result;
+}
+
+} // end anon namespace
+
 struct EventServer::Private
 {
     struct RunContext
@@ -55,217 +183,1140 @@ struct EventServer::Private
         json outputInfoJSON;
     };
 
+    // Time a newly connected client has to send its ClientConfig message.
+    // After this the client is served with protocol version 1.
+    static const int ClientConfigTimeout_ms = 250;
+    static const u32 MaxClientConfigSize = 64 * 1024;
+
     struct RunStats
     {
         size_t dataBytesPerClient = 0;
     };
 
-    struct ClientInfo
-    {
-        std::unique_ptr<QTcpSocket> socket;
-    };
+    // Event data is flushed to the client queues once a batch reaches this
+    // size or the batch is older than BatchFlushInterval_ms.
+    static const size_t BatchSize = Kilobytes(64);
+    static const qint64 BatchFlushInterval_ms = 50;
 
-    static const size_t InitialOutBufferSize = Kilobytes(10);
+    // Queued data is moved into the sockets write buffer while less than this
+    // amount of bytes is pending there.
+    static const qint64 SocketWriteThreshold = Megabytes(1);
+
+    static const size_t BufferPoolSize = 16;
+
+    // Time endRun() waits for the client queues to drain.
+    static const int DrainTimeout_ms = 30 * 1000;
+
+    // Interval at which the sender thread retries to publish into the shared
+    // memory ring while it is full.
+    static const int ShmRetryInterval_ms = 1;
+
+    // Interval at which endEvent() releases the slots of dead shm readers.
+    static const qint64 ReleaseDeadReadersInterval_ms = 50;
+
+    // Interval of the ServerInfo updates sent during a run.
+    static const qint64 ServerInfoUpdateInterval_ms = 1000;
 
     explicit Private(EventServer *q)
         : m_q(q)
-        , m_server(q)
-        , m_outBuf(InitialOutBufferSize)
-        , m_enabled(false)
-    { }
+        , m_sender(new QObject)
+        , m_server(new QTcpServer(m_sender))
+    {
+        for (auto &count: m_formatClientCounts)
+            count = 0;
+
+        m_sender->moveToThread(&m_senderThread);
+        m_senderThread.setObjectName("mvme EventServer");
+        m_senderThread.start();
+    }
+
+    ~Private()
+    {
+        runInSenderThread([this] { closeAll(); });
+        m_senderThread.quit();
+        m_senderThread.wait();
+        delete m_sender;
+    }
 
     EventServer *m_q;
-    QTcpServer m_server;
-    std::vector<u8> m_outBuf;
+
+    // Sender thread: owns the QTcpServer and the client sockets and writes
+    // out the queued data.
+    QThread m_senderThread;
+    QObject *m_sender;
+    QTcpServer *m_server;
+    std::atomic<bool> m_isListening = { false };
+    std::atomic<bool> m_pumpScheduled = { false };
+
+    // Shared between the analysis and the sender thread.
+    std::mutex m_clientsMutex;
+    std::condition_variable m_clientsCond;
+    std::vector<ClientStatePtr> m_clients;
+    std::atomic<size_t> m_clientCount = { 0 };
+    std::array<std::atomic<size_t>, FormatCount> m_formatClientCounts; // ready clients per format
+    OutBufferPtr m_serverInfoBuffer;
+    std::array<OutBufferPtr, FormatCount> m_beginRunSnapshotBuffers; // set while a run is in progress
+    OverflowPolicy m_overflowPolicy = OverflowPolicy::Block;
+    size_t m_maxQueuedBytes = EventServer::Default_ClientQueueSize;
+
+    // Analysis thread only.
     QHostAddress m_listenAddress = QHostAddress::Any;
     quint16 m_listenPort = EventServer::Default_ListenPort;
     bool m_needRestart = false; // set to true if listening host and/or port are changed
     EventServer::Logger m_logger;
-    std::vector<ClientInfo> m_clients;
     bool m_runInProgress = false;
     RunContext m_runContext;
     RunStats m_runStats;
-    bool m_enabled;
+    bool m_enabled = false;
+    QElapsedTimer m_releaseDeadReadersTimer;
+    QElapsedTimer m_serverInfoUpdateTimer;
+    std::array<std::shared_ptr<OutBuffer>, FormatCount> m_batches; // allocated on first use
+    QElapsedTimer m_batchTimer;
+    std::vector<std::shared_ptr<OutBuffer>> m_bufferPool;
+    size_t m_maxEventMessageSize = 0;
+
+    bool m_shmEnabled = false;
+    std::string m_shmName = shm::DefaultName;
+    size_t m_shmRingSize = shm::DefaultRingSize;
+#ifndef _WIN32
+    // Created and destroyed in the sender thread while the analysis thread
+    // waits in runInSenderThread(). Data is published into the ring by the
+    // sender thread only. The analysis thread queries the reader count.
+    std::unique_ptr<shm::ShmWriter> m_shm;
+#endif
+    // Queue of the shm ring using the ShmFormat. Subject to the same
+    // overflow policy as the TCP clients so that slow shm readers do not
+    // block the analysis. Guarded by m_clientsMutex.
+    ClientStatePtr m_shmClient;
+    // Sender thread only: progress within the front entry of the shm queue.
+    OutBufferPtr m_shmEntry;
+    size_t m_shmEntryOffset = 0;
+    bool m_shmRetryScheduled = false;
+
+    template<typename F>
+    void runInSenderThread(F &&f)
+    {
+        bool invoked = QMetaObject::invokeMethod(m_sender, std::forward<F>(f),
+                                                 Qt::BlockingQueuedConnection);
+        assert(invoked);
+        (void) invoked;
+    }
 
+    // Sender thread
+    void listen(const QHostAddress &address, quint16 port);
+    void closeAll();
     void handleNewConnection();
-    void handleClientSocketError(QTcpSocket *socket, QAbstractSocket::SocketError error);
-    void cleanupClients();
+    void readClientConfig(const ClientStatePtr &client);
+    void setClientReady(const ClientStatePtr &client, const ClientConfiguration &cfg);
+    void removeClient(const ClientStatePtr &client);
+    void pump(const ClientStatePtr &client);
+    void pumpShm();
+    void pumpAll();
+    void openShm();
+
+    // Analysis thread
+    bool hasShmReaders();
+    bool hasTcpClients(size_t format) const
+    {
+        return m_formatClientCounts[format].load(std::memory_order_relaxed) > 0;
+    }
+    std::shared_ptr<OutBuffer> allocBuffer(size_t capacity);
+    void enqueueLocked(std::unique_lock<std::mutex> &guard, const OutBufferPtr &buffer,
+                       bool isEventData, size_t format);
+    void enqueueLocked(std::unique_lock<std::mutex> &guard, const ClientStatePtr &client,
+                       const OutBufferPtr &buffer, bool isEventData);
+    void enqueueLocked(std::unique_lock<std::mutex> &guard,
+                       const std::array<OutBufferPtr, FormatCount> &buffers);
+    void schedulePump();
+    void flushBatch(size_t format);
+    void flushBatches();
+    bool waitForClientQueues(int timeout_ms);
+    json makeServerInfoJSON() const;
+    json makeClientStatsJSON();
+    void enqueueServerInfoUpdate();
     void logMessage(const QString &msg);
+    void releaseDeadReadersThrottled();
 };
 
 namespace
 {
 
-enum class WriteOption
+json make_server_info()
 {
-    None,
-    Flush
-};
+    json serverInfo;
+
+    serverInfo["mvme_version"] = std::string(mvme_git_version());
+    serverInfo["protocol_version"] = ProtocolVersion;
+    serverInfo["supported_protocol_versions"] = { 1, ProtocolVersion };
 
-static const int FlushTimeout_ms = 1000;
+    json encodings = json::array();
+    for (u8 i = 0; i < EncodingCount; i++)
+        encodings.push_back(to_string(static_cast<Encoding>(i)));
+    serverInfo["encodings"] = encodings;
 
-qint64 write_data(QIODevice &out, const char *data, size_t size)
+    return serverInfo;
+}
+
+// Upper bound of the size of an EventData message for the given event in any
+// of the formats, including the message frame.
+size_t get_max_event_data_message_size(const EventDataDescription &edd)
 {
-    const char *curPtr = data;
-    const char *endPtr = data + size;
+    size_t result = MessageFrameSize + sizeof(u8); // frame + eventIndex
 
-    while (curPtr < endPtr)
+    for (const auto &dsd: edd.dataSources)
     {
-        qint64 written = out.write(data, size);
+        result += sizeof(u8); // dataSourceIndex
 
-        if (written < 0)
+        for (const auto &od: dsd.outputs)
         {
-            return written;
+            const size_t valueSize = get_storage_type_size(od.valueType);
+            const size_t indexedSize = od.size * (get_storage_type_size(od.indexType) + valueSize);
+            const size_t bitmapSize = (od.size + 7) / 8 + od.size * valueSize;
+            const size_t varintSize = od.size * 2 * MaxVarintSize;
+
+            result += sizeof(u8) + sizeof(u16); // encoding + elementCount
+            result += std::max({ indexedSize, bitmapSize, varintSize });
         }
+    }
+
+    return result;
+}
+
+using MessageIterator = mvme::event_server::BufferIterator;
+
+// Strip the random added by the datasource. Use floor to make sure we round
+// down in all cases (datasources do add a random in the range [0, 1)).
+inline s64 to_integer_value(double paramValue)
+{
+    return std::floor(paramValue);
+}
 
-        curPtr += written;
+// Pushes the value using the given storage type. Negative values are stored
+// in two's complement.
+inline void push_storage(MessageIterator &out, StorageType st, u64 value)
+{
+    switch (st)
+    {
+        case StorageType::st_uint8_t:
+            out.push(static_cast<u8>(value));
+            break;
+        case StorageType::st_uint16_t:
+            out.push(static_cast<u16>(value));
+            break;
+        case StorageType::st_uint32_t:
+            out.push(static_cast<u32>(value));
+            break;
+        case StorageType::st_uint64_t:
+            out.push(static_cast<u64>(value));
+            break;
     }
+}
 
-    assert(curPtr == endPtr);
+inline void push_varint(MessageIterator &out, u64 value)
+{
+    if (out.bytesLeft() < MaxVarintSize)
+        throw mvme::event_server::end_of_buffer();
+
+    out.buffp = encode_varint(value, out.buffp);
+}
+
+// The encoders write the payload of the valid parameters in data and return
+// the number of valid parameters.
+
+u16 encode_indexed_block(MessageIterator &out, const a2::ParamVec &data,
+                   StorageType indexType, StorageType valueType)
+{
+    u16 count = 0u;
+
+    for (s32 paramIndex = 0; paramIndex < data.size; paramIndex++)
+    {
+        if (a2::is_param_valid(data[paramIndex]))
+        {
+            push_storage(out, indexType, paramIndex);
+            push_storage(out, valueType, static_cast<u64>(to_integer_value(data[paramIndex])));
+            ++count;
+        }
+    }
 
-    return curPtr - data;
+    return count;
 }
 
-/* Write a Plain-Old-Datatype to the output device. */
-template<typename T>
-qint64 write_pod(QIODevice &out, const T &t)
+u16 encode_varint_block(MessageIterator &out, const a2::ParamVec &data, bool isSigned)
 {
-    return write_data(out, reinterpret_cast<const char *>(&t), sizeof(T));
+    u16 count = 0u;
+    s32 prevIndex = -1;
+
+    for (s32 paramIndex = 0; paramIndex < data.size; paramIndex++)
+    {
+        if (a2::is_param_valid(data[paramIndex]))
+        {
+            s64 value = to_integer_value(data[paramIndex]);
+            push_varint(out, paramIndex - prevIndex - 1);
+            push_varint(out, isSigned ? zigzag_encode(value) : static_cast<u64>(value));
+            prevIndex = paramIndex;
+            ++count;
+        }
+    }
+
+    return count;
 }
 
-/* Write header and size information, not contents. */
-qint64 write_message_header(QIODevice &out, MessageType type, u32 size)
+u16 encode_bitmap_block(MessageIterator &out, const a2::ParamVec &data, StorageType valueType)
 {
-    qint64 result = 0, written = 0;
+    const size_t bitmapBytes = (data.size + 7) / 8;
 
-    if ((written = write_pod(out, type)) < 0) return written; else result += written;
-    if ((written = write_pod(out, size)) < 0) return written; else result += written;
+    if (out.bytesLeft() < bitmapBytes)
+        throw mvme::event_server::end_of_buffer();
 
-    return result;
+    u8 *bitmap = out.asU8();
+    std::memset(bitmap, 0, bitmapBytes);
+    out.skip(bitmapBytes);
+
+    u16 count = 0u;
+
+    for (s32 paramIndex = 0; paramIndex < data.size; paramIndex++)
+    {
+        if (a2::is_param_valid(data[paramIndex]))
+        {
+            bitmap[paramIndex / 8] |= 1u << (paramIndex % 8);
+            push_storage(out, valueType, static_cast<u64>(to_integer_value(data[paramIndex])));
+            ++count;
+        }
+    }
+
+    return count;
 }
 
-qint64 write_message(QIODevice &out, MessageType type, const char *data, u32 size,
-                     WriteOption opt = WriteOption::None)
+// Writes one protocol version 2 output block. With Encoding::Auto the data
+// is varint encoded first. If the indexed or bitmap encoding turns out to be
+// smaller the block is rewritten using that encoding.
+void encode_output(MessageIterator &out, const a2::ParamVec &data,
+                   const OutputDescription &od, Encoding encoding)
 {
-    qint64 result = 0, written = 0;
+    u8 *encodingPtr = out.push(static_cast<u8>(encoding));
+    u16 *countPtr = out.push(static_cast<u16>(0u));
+    u8 *payloadBegin = out.asU8();
 
-    if ((written = write_message_header(out, type, size)) < 0)
-        return written;
-    else
-        result += written;
+    switch (encoding)
+    {
+        case Encoding::Indexed:
+            *countPtr = encode_indexed_block(out, data, od.indexType, od.valueType);
+            break;
 
-    if ((written = write_data(out, data, size)) < 0)
-        return written;
-    else
-        result += written;
+        case Encoding::Varint:
+            *countPtr = encode_varint_block(out, data, od.isSigned);
+            break;
 
-    if (opt == WriteOption::Flush)
-        out.waitForBytesWritten(FlushTimeout_ms);
+        case Encoding::Bitmap:
+            *countPtr = encode_bitmap_block(out, data, od.valueType);
+            break;
 
-    return result;
+        case Encoding::Auto:
+            {
+                u16 count = encode_varint_block(out, data, od.isSigned);
+                const size_t varintSize = out.asU8() - payloadBegin;
+                const size_t valueSize = get_storage_type_size(od.valueType);
+                const size_t indexedSize = count * (get_storage_type_size(od.indexType) + valueSize);
+                const size_t bitmapSize = (data.size + 7) / 8 + count * valueSize;
+
+                Encoding chosen = Encoding::Varint;
+
+                if (indexedSize < varintSize && indexedSize <= bitmapSize)
+                {
+                    out.buffp = payloadBegin;
+                    encode_indexed_block(out, data, od.indexType, od.valueType);
+                    chosen = Encoding::Indexed;
+                }
+                else if (bitmapSize < varintSize)
+                {
+                    out.buffp = payloadBegin;
+                    encode_bitmap_block(out, data, od.valueType);
+                    chosen = Encoding::Bitmap;
+                }
+
+                *encodingPtr = static_cast<u8>(chosen);
+                *countPtr = count;
+            }
+            break;
+    }
 }
 
-qint64 write_message(QIODevice &out, MessageType type, const QByteArray &contents,
-                     WriteOption opt = WriteOption::None)
+// Serializes the data source outputs of the given event into a framed
+// EventData message using the format. Returns the size of the message.
+// Throws end_of_buffer if the destination buffer is too small.
+//
+// Protocol version 1 contents:
+// u8  eventIndex
+// for each data source:
+//   u8  dataSourceIndex
+//   u16 elementCount
+//   (index, value) pairs of the first output
+//
+// Protocol version 2 contents are described in Client::_eventDataV2().
+size_t serialize_event_data(u8 *dest, size_t capacity, const a2::A2 *a2,
+                            const EventDataDescription &edd, s32 eventIndex,
+                            size_t format)
 {
-    return write_message(out, type, contents.data(),
-                         static_cast<u32>(contents.size()),
-                         opt);
+    MessageIterator out(dest, capacity);
+
+    out.push(MessageType::EventData);
+    u32 *msgSizePtr = out.push(static_cast<u32>(0u));
+    out.push(static_cast<u8>(eventIndex));
+
+    const Encoding encoding = get_format_encoding(format);
+
+    for (size_t dsIndex = 0; dsIndex < edd.dataSources.size(); dsIndex++)
+    {
+        const a2::DataSource *ds = a2->dataSources[eventIndex] + dsIndex;
+        const auto &dsd = edd.dataSources[dsIndex];
+
+        out.push(static_cast<u8>(dsIndex));
+
+        if (get_format_protocol_version(format) < 2)
+        {
+            u16 *countPtr = out.push(static_cast<u16>(0u));
+            *countPtr = encode_indexed_block(out, ds->outputs[0], dsd.indexType, dsd.valueType);
+            continue;
+        }
+
+        assert(dsd.outputs.size() == ds->outputCount);
+
+        for (size_t outIndex = 0; outIndex < dsd.outputs.size(); outIndex++)
+            encode_output(out, ds->outputs[outIndex], dsd.outputs[outIndex], encoding);
+    }
+
+    *msgSizePtr = out.asU8() - reinterpret_cast<u8 *>(msgSizePtr + 1);
+
+    return out.used();
 }
 
 } // end anon namespace
 
+//
+// Sender thread
+//
+
+void EventServer::Private::listen(const QHostAddress &address, quint16 port)
+{
+    if (!m_server->isListening())
+    {
+        if (!m_server->listen(address, port))
+        {
+            logMessage(QSL("Error listening on %1:%2")
+                       .arg(address.toString())
+                       .arg(port));
+        }
+    }
+
+    m_isListening = m_server->isListening();
+}
+
+void EventServer::Private::closeAll()
+{
+    m_server->close();
+    m_isListening = false;
+
+    std::vector<ClientStatePtr> clients;
+
+    {
+        std::unique_lock<std::mutex> guard(m_clientsMutex);
+        std::swap(clients, m_clients);
+
+        for (auto &client: clients)
+        {
+            client->disconnected = true;
+            client->queue.clear();
+            client->queuedBytes = 0;
+        }
+
+        m_clientCount = 0;
+
+        for (auto &count: m_formatClientCounts)
+            count = 0;
+
+        if (m_shmClient)
+        {
+            m_shmClient->disconnected = true;
+            m_shmClient->queue.clear();
+            m_shmClient->queuedBytes = 0;
+            m_shmClient = {};
+        }
+    }
+
+    m_clientsCond.notify_all();
+
+#ifndef _WIN32
+    m_shm.reset();
+#endif
+    m_shmEntry = nullptr;
+    m_shmEntryOffset = 0;
+
+    for (auto &client: clients)
+    {
+        if (client->socket)
+        {
+            client->socket->disconnect(m_sender);
+            client->socket->abort();
+            client->socket->deleteLater();
+            client->socket = nullptr;
+        }
+    }
+}
+
 void EventServer::Private::handleNewConnection()
 {
-    if (auto clientSocket = m_server.nextPendingConnection())
+    while (auto clientSocket = m_server->nextPendingConnection())
     {
-        qDebug() << "DataServer: new connection from" << clientSocket->peerAddress()
-            << ", new client count =" << m_clients.size() + 1;
+        auto client = std::make_shared<ClientState>();
+        client->socket = clientSocket;
+        client->peerAddress = QSL("%1:%2")
+            .arg(clientSocket->peerAddress().toString())
+            .arg(clientSocket->peerPort());
+        client->runTimer.start();
+
+        QObject::connect(clientSocket, &QTcpSocket::bytesWritten,
+                         m_sender, [this, client] { pump(client); });
 
-        ClientInfo clientInfo = { std::unique_ptr<QTcpSocket>(clientSocket) };
+        QObject::connect(clientSocket, &QTcpSocket::readyRead,
+                         m_sender, [this, client] { readClientConfig(client); });
+
+        QObject::connect(clientSocket, &QAbstractSocket::disconnected,
+                         m_sender, [this, client] { removeClient(client); });
 
         // ugly cast due to overloaded QAbstractSocket::error() method
-        connect(clientInfo.socket.get(),
-                static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(
-                    &QAbstractSocket::error),
-                m_q, [this, clientSocket] (QAbstractSocket::SocketError error) {
-                    handleClientSocketError(clientSocket, error);
+        QObject::connect(clientSocket,
+                         static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(
+                             &QAbstractSocket::error),
+                         m_sender, [this, client] (QAbstractSocket::SocketError) {
+                             removeClient(client);
+                         });
+
+        {
+            std::unique_lock<std::mutex> guard(m_clientsMutex);
+
+            // Initial ServerInfo message. Run data is queued once the client
+            // is ready.
+            client->queue.push_back({ m_serverInfoBuffer, false });
+            client->queuedBytes += m_serverInfoBuffer->used;
+
+            m_clients.emplace_back(client);
+            m_clientCount = m_clients.size();
+        }
+
+        // Clients not sending a ClientConfig message are served with protocol
+        // version 1.
+        QTimer::singleShot(ClientConfigTimeout_ms, m_sender, [this, client] {
+            setClientReady(client, { 1, Encoding::Indexed });
         });
 
-        // Initial ServerInfo message
+        qDebug() << "EventServer: new connection from" << client->peerAddress
+            << ", new client count =" << m_clientCount.load();
+
+        pump(client);
+        emit m_q->clientConnected();
+    }
+}
+
+void EventServer::Private::readClientConfig(const ClientStatePtr &client)
+{
+    if (!client->socket)
+        return;
+
+    client->inBuffer.append(client->socket->readAll());
+
+    if (client->inBuffer.size() < static_cast<int>(MessageFrameSize))
+        return;
+
+    MessageType type = MessageType::Invalid;
+    u32 size = 0;
 
-        json serverInfo;
+    std::memcpy(&type, client->inBuffer.constData(), sizeof(type));
+    std::memcpy(&size, client->inBuffer.constData() + sizeof(type), sizeof(size));
+
+    if (type != MessageType::ClientConfig || size > MaxClientConfigSize)
+    {
+        logMessage(QSL("Disconnecting client %1: received invalid message")
+                   .arg(client->peerAddress));
+        removeClient(client);
+        return;
+    }
 
-        serverInfo["mvme_version"] = std::string(mvme_git_version());
-        serverInfo["protocol_version"] = ProtocolVersion;
+    if (client->inBuffer.size() < static_cast<int>(MessageFrameSize + size))
+        return;
 
-        auto jsonString = QByteArray::fromStdString(serverInfo.dump());
-        write_message(*clientInfo.socket, MessageType::ServerInfo, jsonString, WriteOption::Flush);
+    ClientConfiguration cfg;
 
-        // If a run is in progress immediately send out a BeginRun message to
-        // the client. This reuses the information built in beginRun() when the
-        // run was started.
-        if (m_runInProgress)
+    try
+    {
+        auto begin = client->inBuffer.constData() + MessageFrameSize;
+        cfg = parse_client_config(json::parse(begin, begin + size));
+    }
+    catch (const std::exception &e)
+    {
+        logMessage(QSL("Disconnecting client %1: invalid ClientConfig message: %2")
+                   .arg(client->peerAddress)
+                   .arg(e.what()));
+        removeClient(client);
+        return;
+    }
+
+    client->inBuffer.remove(0, MessageFrameSize + size);
+    setClientReady(client, cfg);
+}
+
+// Selects the event data format for the client and queues the BeginRun
+// message if a run is in progress. Noop if the client is already ready, e.g.
+// because its ClientConfig message arrived after the timeout.
+void EventServer::Private::setClientReady(const ClientStatePtr &client, const ClientConfiguration &cfg)
+{
+    {
+        std::unique_lock<std::mutex> guard(m_clientsMutex);
+
+        if (client->ready || client->disconnected)
+            return;
+
+        client->ready = true;
+        client->format = get_format_index(std::min(cfg.protocolVersion, ProtocolVersion),
+                                          cfg.encoding);
+        ++m_formatClientCounts[client->format];
+
+        // If a run is in progress immediately send out a BeginRun message
+        // to the client. This reuses the information built in beginRun()
+        // when the run was started.
+        if (auto &snapshot = m_beginRunSnapshotBuffers[client->format])
         {
-            qDebug() << "DataServer: client connected during an active run. Sending"
+            qDebug() << "EventServer: client connected during an active run. Sending"
                 " outputInfo.";
+            client->queue.push_back({ snapshot, false });
+            client->queuedBytes += snapshot->used;
+        }
+    }
 
-            auto outputInfo = m_runContext.outputInfoJSON;
-            outputInfo["runInProgress"] = true;
+    qDebug() << "EventServer: client" << client->peerAddress << "uses protocol version"
+        << get_format_protocol_version(client->format) << ", encoding"
+        << to_string(get_format_encoding(client->format));
 
-            auto jsonString = QByteArray::fromStdString(outputInfo.dump());
+    pump(client);
+}
 
-            write_message(*clientSocket, MessageType::BeginRun, jsonString, WriteOption::Flush);
-        }
+void EventServer::Private::removeClient(const ClientStatePtr &client)
+{
+    {
+        std::unique_lock<std::mutex> guard(m_clientsMutex);
+
+        if (client->disconnected)
+            return;
 
-        if (clientInfo.socket->isValid())
+        client->disconnected = true;
+        client->queue.clear();
+        client->queuedBytes = 0;
+
+        if (client->ready)
+            --m_formatClientCounts[client->format];
+
+        m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client),
+                        m_clients.end());
+        m_clientCount = m_clients.size();
+    }
+
+    m_clientsCond.notify_all();
+
+    if (client->socket)
+    {
+        qDebug() << "EventServer: removing client" << client->peerAddress
+            << ", new client count =" << m_clientCount.load();
+        client->socket->disconnect(m_sender);
+        client->socket->abort();
+        client->socket->deleteLater();
+        client->socket = nullptr;
+    }
+
+    emit m_q->clientDisconnected();
+}
+
+void EventServer::Private::pump(const ClientStatePtr &client)
+{
+    if (!client->socket)
+        return;
+
+    std::unique_lock<std::mutex> guard(m_clientsMutex);
+
+    if (client->disconnectRequested)
+    {
+        guard.unlock();
+        logMessage(QSL("Disconnecting client %1: send queue overflow")
+                   .arg(client->peerAddress));
+        removeClient(client);
+        return;
+    }
+
+    bool dequeued = false;
+
+    while (!client->queue.empty()
+           && client->socket->bytesToWrite() < SocketWriteThreshold)
+    {
+        auto entry = std::move(client->queue.front());
+        client->queue.pop_front();
+        client->queuedBytes -= entry.buffer->used;
+        dequeued = true;
+
+        guard.unlock();
+
+        auto written = client->socket->write(
+            reinterpret_cast<const char *>(entry.buffer->data.data()),
+            entry.buffer->used);
+
+        guard.lock();
+
+        if (written < 0)
         {
-            m_clients.emplace_back(std::move(clientInfo));
+            guard.unlock();
+            m_clientsCond.notify_all();
+            removeClient(client);
+            return;
         }
+
+        client->stats.bytesSent += entry.buffer->used;
+        client->stats.eventsSent += entry.buffer->eventCount;
     }
+
+    guard.unlock();
+
+    if (dequeued)
+        m_clientsCond.notify_all();
 }
 
-void EventServer::Private::handleClientSocketError(
-    QTcpSocket * /*socket*/,
-    QAbstractSocket::SocketError /*error*/)
+void EventServer::Private::pumpAll()
 {
-    if (!m_runInProgress)
+    m_pumpScheduled = false;
+
+    std::vector<ClientStatePtr> clients;
+
     {
-        qDebug() << __PRETTY_FUNCTION__ << "calling cleanupClients()";
-        cleanupClients();
+        std::unique_lock<std::mutex> guard(m_clientsMutex);
+        clients = m_clients;
     }
+
+    for (auto &client: clients)
+        pump(client);
+
+    pumpShm();
 }
 
-// remove invalid clients (error, disconnected, etc)
-void EventServer::Private::cleanupClients()
+// Publishes the queued data into the shared memory ring. Event data batches
+// are published message by message. Entries stay queued until they have been
+// published completely. If the ring is full a retry is scheduled instead of
+// blocking the sender thread so that the TCP clients are still served.
+void EventServer::Private::pumpShm()
 {
-    qDebug() << __PRETTY_FUNCTION__;
+#ifndef _WIN32
+    using PublishResult = shm::ShmWriter::PublishResult;
+
+    std::unique_lock<std::mutex> guard(m_clientsMutex);
+    auto client = m_shmClient;
+
+    if (!client || !m_shm)
+        return;
 
-    auto to_be_removed = [] (const Private::ClientInfo &ci) -> bool
+    if (client->disconnectRequested)
     {
-        if (!ci.socket) return true;
-        if (!ci.socket->isValid()) return true;
-        return ci.socket->state() == QAbstractSocket::UnconnectedState;
-    };
+        client->disconnectRequested = false;
+        guard.unlock();
+        logMessage(QSL("Evicting shared memory readers: send queue overflow"));
+        m_shm->evictReaders();
+        guard.lock();
+    }
 
-    for (auto &client: m_clients)
+    bool dequeued = false;
+
+    while (!client->queue.empty())
     {
-        if (to_be_removed(client))
+        auto entry = client->queue.front();
+        auto snapshot = m_beginRunSnapshotBuffers[ShmFormat];
+
+        if (entry.buffer != m_shmEntry)
+        {
+            m_shmEntry = entry.buffer;
+            m_shmEntryOffset = 0;
+        }
+
+        guard.unlock();
+
+        const u8 *data = entry.buffer->data.data();
+        const size_t used = entry.buffer->used;
+        auto result = PublishResult::Ok;
+
+        while (m_shmEntryOffset + MessageFrameSize <= used)
+        {
+            const u8 *message = data + m_shmEntryOffset;
+            MessageType type = MessageType::Invalid;
+            u32 contentsSize = 0;
+            std::memcpy(&type, message, sizeof(type));
+            std::memcpy(&contentsSize, message + sizeof(type), sizeof(contentsSize));
+            const size_t messageSize = MessageFrameSize + contentsSize;
+
+            if (type == MessageType::BeginRun || type == MessageType::EndRun)
+            {
+                std::string contents(reinterpret_cast<const char *>(message) + MessageFrameSize,
+                                     contentsSize);
+
+                if (type == MessageType::BeginRun)
+                {
+                    // The contents of the snapshot message of the current run.
+                    std::string snapshotContents;
+
+                    if (snapshot && snapshot->used >= MessageFrameSize)
+                        snapshotContents.assign(
+                            reinterpret_cast<const char *>(snapshot->data.data()) + MessageFrameSize,
+                            snapshot->used - MessageFrameSize);
+
+                    result = m_shm->tryBeginRun(contents, snapshotContents);
+                }
+                else
+                {
+                    result = m_shm->tryEndRun(contents);
+                }
+            }
+            else
+            {
+                result = m_shm->tryPublishFramed(message, messageSize);
+            }
+
+            if (result == PublishResult::WouldBlock)
+                break;
+
+            if (result == PublishResult::TooLarge)
+            {
+                logMessage(QSL("Dropping message of size %1 which does not fit into the"
+                               " shared memory ring").arg(messageSize));
+            }
+
+            m_shmEntryOffset += messageSize;
+        }
+
+        guard.lock();
+
+        if (result == PublishResult::WouldBlock)
         {
-            if (client.socket)
+            if (!m_shmRetryScheduled)
             {
-                qDebug() << __PRETTY_FUNCTION__ << "removing client " << client.socket->peerAddress();
-                client.socket->deleteLater();
-                (void) client.socket.release();
+                m_shmRetryScheduled = true;
+                QTimer::singleShot(ShmRetryInterval_ms, m_sender, [this]
+                {
+                    m_shmRetryScheduled = false;
+                    pumpShm();
+                });
             }
+            break;
+        }
+
+        // The queue may have been cleared due to an overflow while the lock
+        // was released.
+        if (!client->queue.empty() && client->queue.front().buffer == entry.buffer)
+        {
+            client->queue.pop_front();
+            client->queuedBytes -= used;
+            client->stats.bytesSent += used;
+            client->stats.eventsSent += entry.buffer->eventCount;
+            dequeued = true;
+        }
+
+        m_shmEntry = {};
+        m_shmEntryOffset = 0;
+    }
+
+    guard.unlock();
+
+    if (dequeued)
+        m_clientsCond.notify_all();
+#endif
+}
+
+// Creates the shm segment and the queue feeding it.
+void EventServer::Private::openShm()
+{
+#ifndef _WIN32
+    if (!m_shmEnabled || m_shm)
+        return;
+
+    try
+    {
+        m_shm = std::make_unique<shm::ShmWriter>(m_shmName, m_shmRingSize);
+        m_shm->setServerInfo(make_server_info().dump());
+    }
+    catch (const std::exception &e)
+    {
+        m_shm.reset();
+        logMessage(QSL("Error creating shared memory segment '%1': %2")
+                   .arg(QString::fromStdString(m_shmName))
+                   .arg(e.what()));
+        return;
+    }
+
+    auto client = std::make_shared<ClientState>();
+    client->peerAddress = QSL("shm:%1").arg(QString::fromStdString(m_shmName));
+    client->isShm = true;
+    client->ready = true;
+    client->format = ShmFormat;
+    client->runTimer.start();
+
+    std::unique_lock<std::mutex> guard(m_clientsMutex);
+    m_shmClient = client;
+#endif
+}
+
+//
+// Analysis thread
+//
+
+bool EventServer::Private::hasShmReaders()
+{
+#ifndef _WIN32
+    return m_shm && m_shm->readerCount() > 0;
+#else
+    return false;
+#endif
+}
+
+std::shared_ptr<OutBuffer> EventServer::Private::allocBuffer(size_t capacity)
+{
+    // Reuse buffers that are not referenced by any client queue anymore.
+    for (auto &buffer: m_bufferPool)
+    {
+        if (buffer.use_count() == 1)
+        {
+            buffer->used = 0;
+            buffer->eventCount = 0;
+            if (buffer->data.size() < capacity)
+                buffer->data.resize(capacity);
+            return buffer;
+        }
+    }
+
+    auto result = std::make_shared<OutBuffer>();
+    result->data.resize(capacity);
+
+    if (m_bufferPool.size() < BufferPoolSize)
+        m_bufferPool.push_back(result);
+
+    return result;
+}
+
+// Appends the buffer to the queues of all ready clients using the given
+// format, including the shm queue if the format is ShmFormat. Note: with the
+// Block policy the mutex is released while waiting.
+void EventServer::Private::enqueueLocked(
+    std::unique_lock<std::mutex> &guard, const OutBufferPtr &buffer, bool isEventData,
+    size_t format)
+{
+    auto clients = m_clients;
+    auto shmClient = m_shmClient;
+
+    for (auto &client: clients)
+    {
+        if (client->ready && client->format == format)
+            enqueueLocked(guard, client, buffer, isEventData);
+    }
+
+    // Event data is only published if there is someone to read it. Run
+    // control messages always go into the ring to keep the snapshot for
+    // attaching readers up to date.
+    if (shmClient && format == ShmFormat && (!isEventData || hasShmReaders()))
+        enqueueLocked(guard, shmClient, buffer, isEventData);
+}
+
+// Appends the buffer to the queue of a single client. Run control messages
+// are always queued. If the queue is full the overflow policy is applied to
+// event data. For the shm queue the Disconnect policy drops the queued event
+// data and makes the sender thread evict the shm readers.
+void EventServer::Private::enqueueLocked(
+    std::unique_lock<std::mutex> &guard, const ClientStatePtr &client,
+    const OutBufferPtr &buffer, bool isEventData)
+{
+    // A pending disconnect of the shm queue only evicts the current readers.
+    if (client->disconnected || (client->disconnectRequested && !client->isShm))
+        return;
+
+    const size_t size = buffer->used;
+
+    auto is_full = [&] ()
+    {
+        return (!client->queue.empty()
+                && client->queuedBytes + size > m_maxQueuedBytes);
+    };
+
+    if (isEventData && is_full())
+    {
+        switch (m_overflowPolicy)
+        {
+            case OverflowPolicy::Drop:
+                client->stats.eventsDropped += buffer->eventCount;
+                client->stats.batchesDropped++;
+                return;
+
+            case OverflowPolicy::Disconnect:
+                client->disconnectRequested = true;
+
+                if (client->isShm)
+                {
+                    auto &queue = client->queue;
+                    queue.erase(std::remove_if(queue.begin(), queue.end(),
+                                               [] (const QueueEntry &entry)
+                                               {
+                                                   return entry.isEventData;
+                                               }),
+                                queue.end());
+                    client->queuedBytes = 0;
+                    for (const auto &entry: queue)
+                        client->queuedBytes += entry.buffer->used;
+                }
+                else
+                {
+                    client->queue.clear();
+                    client->queuedBytes = 0;
+                }
+
+                schedulePump();
+                return;
+
+            case OverflowPolicy::Block:
+                schedulePump();
+                m_clientsCond.wait(guard, [&] ()
+                {
+                    return (!is_full() || client->disconnected
+                            || client->disconnectRequested);
+                });
+
+                if (client->disconnected || client->disconnectRequested)
+                    return;
+
+                break;
         }
     }
 
-    // Remove the now stale pointers from the list of clients.
-    m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), to_be_removed),
-                    m_clients.end());
+    client->queue.push_back({ buffer, isEventData });
+    client->queuedBytes += size;
+    client->stats.maxQueuedBytes = std::max(client->stats.maxQueuedBytes,
+                                            client->queuedBytes);
+}
 
-    qDebug() << __PRETTY_FUNCTION__ << ", new client count =" << m_clients.size();
+// Queues a run control message. The buffer for each format is sent to the
+// clients using that format.
+void EventServer::Private::enqueueLocked(
+    std::unique_lock<std::mutex> &guard, const std::array<OutBufferPtr, FormatCount> &buffers)
+{
+    for (size_t format = 0; format < FormatCount; format++)
+        enqueueLocked(guard, buffers[format], false, format);
+}
+
+void EventServer::Private::schedulePump()
+{
+    if (!m_pumpScheduled.exchange(true))
+    {
+        QMetaObject::invokeMethod(m_sender, [this] { pumpAll(); }, Qt::QueuedConnection);
+    }
+}
+
+void EventServer::Private::flushBatch(size_t format)
+{
+    auto &batch = m_batches[format];
+
+    if (!batch || !batch->used)
+        return;
+
+    {
+        std::unique_lock<std::mutex> guard(m_clientsMutex);
+        enqueueLocked(guard, batch, true, format);
+    }
+
+    schedulePump();
+    batch = {};
+}
+
+void EventServer::Private::flushBatches()
+{
+    for (size_t format = 0; format < FormatCount; format++)
+        flushBatch(format);
+
+    m_batchTimer.restart();
+}
+
+// Waits until all queued data has been handed to the client sockets.
+bool EventServer::Private::waitForClientQueues(int timeout_ms)
+{
+    schedulePump();
+
+    std::unique_lock<std::mutex> guard(m_clientsMutex);
+
+    return m_clientsCond.wait_for(
+        guard, std::chrono::milliseconds(timeout_ms), [this] ()
+        {
+            return (std::all_of(m_clients.begin(), m_clients.end(),
+                                [] (const ClientStatePtr &client)
+                                {
+                                    return client->queue.empty();
+                                })
+                    && (!m_shmClient || m_shmClient->queue.empty()));
+        });
+}
+
+json EventServer::Private::makeServerInfoJSON() const
+{
+    json serverInfo = make_server_info();
+    serverInfo["overflow_policy"] = to_string(m_overflowPolicy);
+    serverInfo["client_queue_size"] = m_maxQueuedBytes;
+    return serverInfo;
+}
+
+// Per client counters of the current run. Must be called with m_clientsMutex
+// locked.
+json EventServer::Private::makeClientStatsJSON()
+{
+    json result = json::array();
+    auto clients = m_clients;
+
+    if (m_shmClient)
+        clients.push_back(m_shmClient);
+
+    for (const auto &client: clients)
+    {
+        const auto &stats = client->stats;
+        double elapsed_s = client->runTimer.elapsed() / 1000.0;
+        double rate_MBps = elapsed_s > 0.0
+            ? stats.bytesSent / (1024.0 * 1024.0) / elapsed_s
+            : 0.0;
+
+        json j;
+        j["address"] = client->peerAddress.toStdString();
+        j["bytesSent"] = stats.bytesSent;
+        j["eventsSent"] = stats.eventsSent;
+        j["eventsDropped"] = stats.eventsDropped;
+        j["batchesDropped"] = stats.batchesDropped;
+        j["maxQueuedBytes"] = stats.maxQueuedBytes;
+        j["rate_MBps"] = rate_MBps;
+        result.push_back(j);
+    }
+
+    return result;
+}
+
+// Sends the current client counters to the protocol version 2 clients and the
+// shm ring. Version 1 clients do not expect ServerInfo messages during a run.
+void EventServer::Private::enqueueServerInfoUpdate()
+{
+    {
+        std::unique_lock<std::mutex> guard(m_clientsMutex);
+
+        json serverInfo = makeServerInfoJSON();
+        serverInfo["clients"] = makeClientStatsJSON();
+
+        auto buffer = make_message_buffer(MessageType::ServerInfo, serverInfo.dump());
+
+        for (size_t format = 1; format < FormatCount; format++)
+            enqueueLocked(guard, buffer, false, format);
+    }
+
+    schedulePump();
 }
 
 void EventServer::Private::logMessage(const QString &msg)
@@ -276,12 +1327,27 @@ void EventServer::Private::logMessage(const QString &msg)
     }
 }
 
+// Lets hasShmReaders() notice reader processes that exited without detaching.
+void EventServer::Private::releaseDeadReadersThrottled()
+{
+#ifndef _WIN32
+    if (!m_releaseDeadReadersTimer.isValid()
+        || m_releaseDeadReadersTimer.elapsed() >= ReleaseDeadReadersInterval_ms)
+    {
+        m_releaseDeadReadersTimer.restart();
+
+        if (m_shm)
+            m_shm->releaseDeadReaders();
+    }
+#endif
+}
+
 EventServer::EventServer(QObject *parent)
     : QObject(parent)
     , m_d(std::make_unique<Private>(this))
 {
-    connect(&m_d->m_server, &QTcpServer::newConnection,
-            this, [this] { m_d->handleNewConnection(); });
+    QObject::connect(m_d->m_server, &QTcpServer::newConnection,
+                     m_d->m_sender, [this] { m_d->handleNewConnection(); });
 }
 
 EventServer::~EventServer()
@@ -294,23 +1360,21 @@ void EventServer::startup()
     qDebug() << __PRETTY_FUNCTION__ << this << "enabled =" << m_d->m_enabled;
     if (m_d->m_enabled)
     {
-        if (!m_d->m_server.isListening())
         {
-            if (m_d->m_server.listen(m_d->m_listenAddress, m_d->m_listenPort))
-            {
-#if 0
-                m_d->logMessage(QSL("Listening on %1:%2")
-                           .arg(m_d->m_listenAddress.toString())
-                           .arg(m_d->m_listenPort));
-#endif
-            }
-            else
-            {
-                m_d->logMessage(QSL("Error listening on %1:%2")
-                           .arg(m_d->m_listenAddress.toString())
-                           .arg(m_d->m_listenPort));
-            }
+            std::unique_lock<std::mutex> guard(m_d->m_clientsMutex);
+
+            m_d->m_serverInfoBuffer = make_message_buffer(
+                MessageType::ServerInfo, m_d->makeServerInfoJSON().dump());
         }
+
+        auto address = m_d->m_listenAddress;
+        auto port = m_d->m_listenPort;
+
+        m_d->runInSenderThread([this, address, port]
+        {
+            m_d->listen(address, port);
+            m_d->openShm();
+        });
     }
     else
     {
@@ -320,8 +1384,7 @@ void EventServer::startup()
 
 void EventServer::shutdown()
 {
-    m_d->m_server.close();
-    m_d->m_clients.clear();
+    m_d->runInSenderThread([this] { m_d->closeAll(); });
 }
 
 QSettings get_workspace_settings()
@@ -349,6 +1412,18 @@ static std::tuple<bool, QHostInfo, int> get_event_server_listen_info(const QSett
 void EventServer::reloadConfiguration()
 {
     auto settings = get_workspace_settings();
+
+    setSharedMemoryInfo(
+        settings.value(QSL("EventServer/SharedMemoryEnabled")).toBool(),
+        settings.value(QSL("EventServer/SharedMemoryName")).toString(),
+        static_cast<size_t>(settings.value(QSL("EventServer/SharedMemorySizeMB")).toUInt())
+        * Megabytes(1));
+
+    setClientQueueOptions(
+        overflow_policy_from_string(settings.value(QSL("EventServer/OverflowPolicy")).toString()),
+        static_cast<size_t>(settings.value(QSL("EventServer/ClientQueueSizeMB")).toUInt())
+        * Megabytes(1));
+
     bool enabled = false;
     QHostInfo hostInfo;
     int port = 0;
@@ -393,14 +1468,48 @@ void EventServer::setListeningInfo(const QHostAddress &address, quint16 port)
     m_d->m_listenPort = port;
 }
 
+void EventServer::setClientQueueOptions(OverflowPolicy policy, size_t maxQueuedBytes)
+{
+    if (!maxQueuedBytes)
+        maxQueuedBytes = Default_ClientQueueSize;
+
+    std::unique_lock<std::mutex> guard(m_d->m_clientsMutex);
+    m_d->m_overflowPolicy = policy;
+    m_d->m_maxQueuedBytes = maxQueuedBytes;
+}
+
+void EventServer::setSharedMemoryInfo(bool enabled, const QString &name,
+                                      size_t ringSizeBytes)
+{
+    auto shmName = name.isEmpty() ? std::string(shm::DefaultName) : name.toStdString();
+
+    if (!ringSizeBytes)
+        ringSizeBytes = shm::DefaultRingSize;
+
+    if (enabled != m_d->m_shmEnabled || shmName != m_d->m_shmName
+        || ringSizeBytes != m_d->m_shmRingSize)
+    {
+        m_d->m_needRestart = true;
+    }
+
+    m_d->m_shmEnabled = enabled;
+    m_d->m_shmName = shmName;
+    m_d->m_shmRingSize = ringSizeBytes;
+}
+
 bool EventServer::isListening() const
 {
-    return m_d->m_server.isListening();
+    return m_d->m_isListening;
 }
 
 size_t EventServer::getNumberOfClients() const
 {
-    return m_d->m_clients.size();
+    size_t result = m_d->m_clientCount;
+#ifndef _WIN32
+    if (m_d->m_shm)
+        result += m_d->m_shm->readerCount();
+#endif
+    return result;
 }
 
 void EventServer::setEnabled(bool b)
@@ -424,9 +1533,6 @@ void EventServer::beginRun(const RunInfo &runInfo,
 
     assert(!m_d->m_runInProgress);
 
-    qDebug() << __PRETTY_FUNCTION__ << "calling cleanupClients()";
-    m_d->cleanupClients();
-
     if (!(analysis->getA2AdapterState() && analysis->getA2AdapterState()->a2))
         return;
 
@@ -463,18 +1569,79 @@ void EventServer::beginRun(const RunInfo &runInfo,
     qDebug() << "EventServer::beginRun: outputInfo to be sent to clients:";
     qDebug().noquote() << QString::fromStdString(outputInfo.dump(2));
 
-    auto jsonString = QByteArray::fromStdString(outputInfo.dump());
+    // The BeginRun message states the protocol version and encoding of the
+    // event data that follows.
+    std::array<OutBufferPtr, FormatCount> beginRunBuffers;
+    std::array<OutBufferPtr, FormatCount> snapshotBuffers;
+
+    for (size_t format = 0; format < FormatCount; format++)
+    {
+        auto formatInfo = outputInfo;
+        formatInfo["protocol_version"] = get_format_protocol_version(format);
+        formatInfo["encoding"] = to_string(get_format_encoding(format));
+
+        auto snapshotInfo = formatInfo;
+        snapshotInfo["runInProgress"] = true;
+
+        beginRunBuffers[format] = make_message_buffer(MessageType::BeginRun, formatInfo.dump());
+        snapshotBuffers[format] = make_message_buffer(MessageType::BeginRun, snapshotInfo.dump());
+    }
 
-    for (auto &client: m_d->m_clients)
     {
-        write_message(*client.socket, MessageType::BeginRun, jsonString, WriteOption::Flush);
+        // Queue the BeginRun message and publish the snapshot for late
+        // joining clients atomically with regard to new connections.
+        std::unique_lock<std::mutex> guard(m_d->m_clientsMutex);
+
+        auto clients = m_d->m_clients;
+
+        if (m_d->m_shmClient)
+            clients.push_back(m_d->m_shmClient);
+
+        for (auto &client: clients)
+        {
+            client->stats = {};
+            client->runTimer.restart();
+        }
+
+        m_d->m_beginRunSnapshotBuffers = snapshotBuffers;
+        m_d->enqueueLocked(guard, beginRunBuffers);
     }
 
+    m_d->schedulePump();
+
+    // Size the batch buffers so that the largest possible EventData message
+    // always fits behind a batch that is just below the flush threshold.
+    m_d->m_maxEventMessageSize = 0;
+
+    for (const auto &edd: outputDescription.eventDataDescriptions)
+    {
+        if (0 <= edd.eventIndex && edd.eventIndex < a2::MaxVMEEvents
+            && edd.dataSources.size() == ctx.a2->dataSourceCounts[edd.eventIndex])
+        {
+            m_d->m_maxEventMessageSize = std::max(
+                m_d->m_maxEventMessageSize,
+                get_max_event_data_message_size(edd));
+        }
+    }
+
+    m_d->m_batches = {};
+    m_d->m_batchTimer.start();
+    m_d->m_serverInfoUpdateTimer.start();
     m_d->m_runInProgress = true;
 }
 
-// Send out event data to clients. At this point the analysis has processed an
-// event and extracted module data is available at the a2 datasource outputs.
+// endEvent() serializes the data source outputs of the primary A2.
+QString EventServer::analysisEventDataReader() const
+{
+    if (m_d->m_enabled && m_d->m_runInProgress)
+        return QSL("Event Server");
+    return {};
+}
+
+// Serialize event data. At this point the analysis has processed an event and
+// extracted module data is available at the a2 datasource outputs. The
+// message is appended to the current batch which is handed to the sender
+// thread once it is full or old enough.
 void EventServer::endEvent(s32 eventIndex)
 {
     if (!m_d->m_enabled) return;
@@ -488,14 +1655,16 @@ void EventServer::endEvent(s32 eventIndex)
         return;
     }
 
-    if (getNumberOfClients() == 0)
-    {
-        // Allows QTcpServer to accept new connections
-        // FIXME: measure performance without this call. I think this can have
-        // a huge impact. If so only perform it based on a timeout.
-        QCoreApplication::processEvents();
+    m_d->releaseDeadReadersThrottled();
+
+    const bool hasShmReaders = m_d->hasShmReaders();
+    bool hasTcpClients = false;
+
+    for (size_t format = 0; format < FormatCount; format++)
+        hasTcpClients = hasTcpClients || m_d->hasTcpClients(format);
+
+    if (!m_d->m_enabled || (!hasTcpClients && !hasShmReaders))
         return;
-    }
 
     const a2::A2 *a2 = m_d->m_runContext.a2;
     const u32 dataSourceCount = a2->dataSourceCounts[eventIndex];
@@ -506,135 +1675,61 @@ void EventServer::endEvent(s32 eventIndex)
     if (!dataSourceCount)
         return;
 
-    while (true)
+    // Serialize the event once for each format in use. The batches of the
+    // ShmFormat are also queued for the shared memory ring.
+    for (size_t format = 0; format < FormatCount; format++)
     {
-        try
-        {
-            using BufferIterator = mvme::event_server::BufferIterator;
-            BufferIterator out(m_d->m_outBuf.data(), m_d->m_outBuf.size());
-
-            // Push message type, space for the message size and the eventIndex
-            // onto the output buffer:
-            // u8  MessageType   -> Part of the header
-            // u32 ContentsSize  -> Part of the header
-            // u8  eventIndex    -> Part of the contents of an EventData message
-            out.push(MessageType::EventData);
-            u32 *msgSizePtr = out.push(static_cast<u32>(0u));
-            out.push(static_cast<u8>(eventIndex));
-
-            for (size_t dsIndex = 0; dsIndex < edd.dataSources.size(); dsIndex++)
-            {
-                // For each data source push its index and space for the number
-                // of following (index, value) pairs.
-                // u8  dataSourceIndex
-                // u16 elementCount
-                out.push(static_cast<u8>(dsIndex));
-                u16 *countPtr = out.push(static_cast<u16>(0u));
-
-                const a2::DataSource *ds = a2->dataSources[eventIndex] + dsIndex;
-                // TODO: support multi output data sources
-                a2::PipeVectors dataPipe = {};
-                dataPipe.data = ds->outputs[0];
-                dataPipe.lowerLimits = ds->outputLowerLimits[0];
-                dataPipe.upperLimits = ds->outputUpperLimits[0];
-                const auto &dsd = edd.dataSources[dsIndex];
-                u16 count = 0u; // Count of valid values.
-
-                // Write out the (index, value) pairs for valid parameters
-                // using the data types specified in the DataSourceDescription.
-                for (s32 paramIndex = 0; paramIndex < dataPipe.size(); paramIndex++)
-                {
-                    double dParamValue = dataPipe.data[paramIndex];
-
-                    if (a2::is_param_valid(dParamValue))
-                    {
-                        switch (dsd.indexType)
-                        {
-                            case StorageType::st_uint8_t:
-                                out.push(static_cast<u8>(paramIndex));
-                                break;
-                            case StorageType::st_uint16_t:
-                                out.push(static_cast<u16>(paramIndex));
-                                break;
-                            case StorageType::st_uint32_t:
-                                out.push(static_cast<u32>(paramIndex));
-                                break;
-                            case StorageType::st_uint64_t:
-                                out.push(static_cast<u64>(paramIndex));
-                                break;
-                        }
-
-                        // Strip the random added by the datasource. Use floor
-                        // to make sure we round down in all cases (datasources
-                        // do add a random in the range [0, 1)).
-                        u64 iParamValue = std::floor(dParamValue);
-
-                        switch (dsd.valueType)
-                        {
-                            case StorageType::st_uint8_t:
-                                out.push(static_cast<u8>(iParamValue));
-                                break;
-                            case StorageType::st_uint16_t:
-                                out.push(static_cast<u16>(iParamValue));
-                                break;
-                            case StorageType::st_uint32_t:
-                                out.push(static_cast<u32>(iParamValue));
-                                break;
-                            case StorageType::st_uint64_t:
-                                out.push(static_cast<u64>(iParamValue));
-                                break;
-                        }
-
-                        ++count; // cound this valid parameter
-                    }
-                }
+        const bool toTcp = m_d->hasTcpClients(format);
+        const bool toShm = hasShmReaders && format == ShmFormat;
 
-                // write the element count to the buffer
-                *countPtr = count;
-            }
+        if (!toTcp && !toShm)
+            continue;
 
-            u32 contentsBytes = out.asU8() - reinterpret_cast<u8 *>((msgSizePtr + 1));
-            *msgSizePtr = contentsBytes;
+        auto &batch = m_d->m_batches[format];
 
-            for (auto &client: m_d->m_clients)
-            {
-                if (!client.socket->isValid()) continue;
-                write_data(*client.socket, reinterpret_cast<const char *>(out.data),
-                           out.used());
-            }
+        if (!batch)
+            batch = m_d->allocBuffer(Private::BatchSize + m_d->m_maxEventMessageSize);
 
-            m_d->m_runStats.dataBytesPerClient += out.used();
+        u8 *messageBegin = batch->data.data() + batch->used;
+        size_t messageSize = 0;
 
-            break;
-        } catch (const mvme::event_server::end_of_buffer &)
+        try
         {
-            // Ran out of space in the output buffer. Double the buffer size
-            // and retry.
-            qDebug() << __PRETTY_FUNCTION__ << "doubling buffer size from"
-                << m_d->m_outBuf.size() << "to" << m_d->m_outBuf.size() * 2;
-            m_d->m_outBuf.resize(m_d->m_outBuf.size() * 2);
+            messageSize = serialize_event_data(
+                messageBegin, batch->data.size() - batch->used, a2, edd, eventIndex, format);
         }
-    }
-
-    // block if there's enough pending data
-    for (auto &client: m_d->m_clients)
-    {
-        static const qint64 WriteFlushTreshold = Megabytes(10);
-
-        if (client.socket->isValid() && client.socket->bytesToWrite() > WriteFlushTreshold)
+        catch (const mvme::event_server::end_of_buffer &)
         {
-            client.socket->waitForBytesWritten();
+            // The batch buffers are sized in beginRun() based on the data
+            // source output sizes so this should not happen.
+            InvalidCodePath;
+            return;
         }
+
+        m_d->m_runStats.dataBytesPerClient += messageSize;
+
+        batch->used += messageSize;
+        batch->eventCount++;
+
+        if (batch->used >= Private::BatchSize)
+            m_d->flushBatch(format);
     }
 
-    // allow QTcpServer to handle new connections
-    QCoreApplication::processEvents();
+    if (m_d->m_batchTimer.elapsed() >= Private::BatchFlushInterval_ms)
+        m_d->flushBatches();
 }
 
 void EventServer::endRun(const DAQStats &daqStats, const std::exception * /*e*/)
 {
     if (!m_d->m_enabled) return;
 
+    // Hand out the remaining event data and wait for the sender thread to
+    // move it into the sockets so that the client counters are complete.
+    m_d->flushBatches();
+
+    if (!m_d->waitForClientQueues(Private::DrainTimeout_ms))
+        m_d->logMessage(QSL("Timeout waiting for clients to receive the run data"));
+
     json endRunInfo;
     // FIXME: I think during a replay these contain the current (real time)
     // time values instead of the values from the replay
@@ -647,33 +1742,33 @@ void EventServer::endRun(const DAQStats &daqStats, const std::exception * /*e*/)
     endRunInfo["analysis_processedBuffers"] = std::to_string(daqStats.getAnalyzedBuffers());
     endRunInfo["analysis_efficiency"] = std::to_string(daqStats.getAnalysisEfficiency());
 
-    qDebug() << "EventServer::endRun: endRunInfo to be sent to clients:";
-    qDebug().noquote() << QString::fromStdString(endRunInfo.dump(2));
+    {
+        std::unique_lock<std::mutex> guard(m_d->m_clientsMutex);
 
-    auto jsonString = QByteArray::fromStdString(endRunInfo.dump());
+        endRunInfo["clients"] = m_d->makeClientStatsJSON();
 
-    for (auto &client: m_d->m_clients)
-    {
-        if (!client.socket->isValid()) continue;
-        write_message(*client.socket, MessageType::EndRun, jsonString, WriteOption::Flush);
+        qDebug() << "EventServer::endRun: endRunInfo to be sent to clients:";
+        qDebug().noquote() << QString::fromStdString(endRunInfo.dump(2));
+
+        m_d->m_beginRunSnapshotBuffers = {};
+
+        auto endRunBuffer = make_message_buffer(MessageType::EndRun, endRunInfo.dump());
+        std::array<OutBufferPtr, FormatCount> endRunBuffers;
+        endRunBuffers.fill(endRunBuffer);
+        m_d->enqueueLocked(guard, endRunBuffers);
     }
 
     // flush all data on endrun
-    for (auto &client: m_d->m_clients)
-    {
-        while (client.socket->isValid() && client.socket->bytesToWrite() > 0)
-            client.socket->waitForBytesWritten();
-    }
+    m_d->waitForClientQueues(Private::DrainTimeout_ms);
 
     m_d->m_runContext = {};
     m_d->m_runInProgress = false;
+    m_d->m_batches = {};
 
     qDebug() << __PRETTY_FUNCTION__ << "dataPerClient ="
         << m_d->m_runStats.dataBytesPerClient
         << "bytes, " << m_d->m_runStats.dataBytesPerClient / (1024.0 * 1024.0)
         << "MB";
-
-    m_d->cleanupClients();
 }
 
 void EventServer::beginEvent(s32 eventIndex)
@@ -720,6 +1815,19 @@ void EventServer::processModuleData(s32 crateIndex, s32 eventIndex, const Module
 void EventServer::processTimetick()
 {
     if (!m_d->m_enabled) return;
-    // TODO: how to handle timeticks? handle them at all?
     assert(m_d->m_runInProgress);
+
+    // Timeticks arrive once per second. Use them to hand out partial batches
+    // during low rate runs and to send the client counters. Replays can
+    // produce timeticks at a much higher rate, thus the update timer.
+    if (m_d->m_runInProgress)
+    {
+        m_d->flushBatches();
+
+        if (m_d->m_serverInfoUpdateTimer.elapsed() >= Private::ServerInfoUpdateInterval_ms)
+        {
+            m_d->enqueueServerInfoUpdate();
+            m_d->m_serverInfoUpdateTimer.restart();
+        }
+    }
 }
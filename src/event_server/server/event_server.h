@@ -35,6 +35,16 @@ class LIBMVME_EXPORT EventServer: public QObject, public IStreamModuleConsumer
     public:
         static const uint16_t Default_ListenPort = 13801;
 
+        // What to do with a TCP client whose send queue is full.
+        enum class OverflowPolicy
+        {
+            Block,      // Block the analysis until the client catches up.
+            Drop,       // Drop event data for this client. Run control messages are always sent.
+            Disconnect, // Disconnect the client.
+        };
+
+        static const size_t Default_ClientQueueSize = 16u * 1024 * 1024;
+
         explicit EventServer(QObject *parent = nullptr);
         ~EventServer();
 
@@ -56,6 +66,7 @@ class LIBMVME_EXPORT EventServer: public QObject, public IStreamModuleConsumer
                                const ModuleData *moduleDataList, unsigned moduleCount) override;
         void processTimetick() override;
         void processSystemEvent(s32 /*crateIndex*/, const u32 */*header*/, u32 /*size*/) override {} // noop
+        QString analysisEventDataReader() const override;
         void setLogger(Logger logger) override;
         Logger &getLogger() override;
 
@@ -63,6 +74,18 @@ class LIBMVME_EXPORT EventServer: public QObject, public IStreamModuleConsumer
         void setListeningInfo(const QHostAddress &address,
                               quint16 port = Default_ListenPort);
 
+        // Limits the amount of data queued per TCP client. Event data is
+        // serialized on the analysis thread and written to the sockets by a
+        // separate sender thread.
+        void setClientQueueOptions(OverflowPolicy policy, size_t maxQueuedBytes);
+
+        // Enables the shared memory transport for clients running on the same
+        // host. The ring is written by the sender thread and its queue is
+        // subject to the client queue options like a TCP client. Only
+        // supported on POSIX systems.
+        void setSharedMemoryInfo(bool enabled, const QString &name,
+                                 size_t ringSizeBytes);
+
         bool isListening() const;
         size_t getNumberOfClients() const;
 
@@ -20,6 +20,9 @@
  */
 #include "event_server/server/event_server_util.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include "analysis/a2_adapter.h"
 #include "util/variablify.h"
 
@@ -40,8 +43,8 @@ static StorageType get_storage_type(unsigned bits)
     return StorageType::st_uint64_t;
 }
 
-/* Returns the name of the smallest unsigned type able to store data values
- * produced by the given data source. */
+/* Returns the number of data bits produced by the given data source or 0 if
+ * the data source is not based on a data filter. */
 static unsigned get_data_storage_bits(const analysis::SourceInterface *dataSource)
 {
     unsigned bits = 0;
@@ -54,13 +57,68 @@ static unsigned get_data_storage_bits(const analysis::SourceInterface *dataSourc
     {
         bits = ds->getDataBits();
     }
+    else if (auto ds = qobject_cast<const analysis::MultiHitExtractor *>(dataSource))
+    {
+        bits = a2::data_filter::get_extract_bits(ds->getFilter(), 'D');
+    }
 
     return bits;
 }
 
-static StorageType get_data_storage_type(const analysis::SourceInterface *dataSource)
+/* Number of bits needed to store the integer part of values in the range
+ * [lowerLimit, upperLimit] including a sign bit if lowerLimit is negative. */
+static unsigned get_limits_storage_bits(double lowerLimit, double upperLimit)
 {
-    return get_storage_type(get_data_storage_bits(dataSource));
+    double maxMagnitude = std::max(std::abs(std::floor(lowerLimit)), std::floor(upperLimit));
+    unsigned bits = maxMagnitude >= 1.0 ? std::ceil(std::log2(maxMagnitude + 1.0)) : 1u;
+
+    if (lowerLimit < 0.0)
+        ++bits;
+
+    return std::min(bits, 64u);
+}
+
+static OutputDescription make_output_description(
+    const a2::DataSource *a2_dataSource, const analysis::SourceInterface *a1_dataSource,
+    unsigned outputIndex)
+{
+    const auto &lowerLimits = a2_dataSource->outputLowerLimits[outputIndex];
+    const auto &upperLimits = a2_dataSource->outputUpperLimits[outputIndex];
+
+    OutputDescription od;
+
+    if (static_cast<s32>(outputIndex) < a1_dataSource->getNumberOfOutputs())
+        od.name = variablify(a1_dataSource->getOutputName(outputIndex)).toStdString();
+
+    if (od.name.empty())
+        od.name = "output" + std::to_string(outputIndex);
+
+    od.size = a2_dataSource->outputs[outputIndex].size;
+
+    if (od.size)
+    {
+        od.lowerLimit = *std::min_element(lowerLimits.begin(), lowerLimits.end());
+        od.upperLimit = *std::max_element(upperLimits.begin(), upperLimits.end());
+    }
+
+    od.isSigned = od.lowerLimit < 0.0;
+
+    // The filter data bits are exact for the extracted values. The last
+    // output of multi hit extractors contains hit counts which do not fit
+    // this, so use the output limits there and for all other data sources.
+    unsigned filterBits = get_data_storage_bits(a1_dataSource);
+    bool isHitCounts = (a2_dataSource->type == a2::DataSource_MultiHitExtractor_ArrayPerHit
+                        || a2_dataSource->type == a2::DataSource_MultiHitExtractor_ArrayPerAddress)
+        && outputIndex == a2_dataSource->outputCount - 1u;
+
+    od.bits = (filterBits && !isHitCounts && !od.isSigned)
+        ? filterBits
+        : get_limits_storage_bits(od.lowerLimit, od.upperLimit);
+
+    od.indexType = get_storage_type(std::ceil(std::log2(od.size)));
+    od.valueType = get_storage_type(od.bits);
+
+    return od;
 }
 
 VMETree make_vme_tree_description(const VMEConfig *vmeConfig)
@@ -95,7 +153,6 @@ VMETree make_vme_tree_description(const VMEConfig *vmeConfig)
     return result;
 }
 
-// TODO: support multi output data sources
 EventDataDescriptions make_event_data_descriptions(
     const VMEConfig *vmeConfig, const analysis::Analysis *analysis)
 {
@@ -129,8 +186,6 @@ EventDataDescriptions make_event_data_descriptions(
             auto a2_dataSource = a2->dataSources[eventIndex] + dsIndex;
             auto a1_dataSource = a2_adapter->sourceMap.value(a2_dataSource);
             s32 moduleIndex = a2_dataSource->moduleIndex;
-            u32 outputSize = a2_dataSource->outputs[0].size;
-            u32 outputBits = std::ceil(std::log2(outputSize));
 
             QStringList paramNames;
 
@@ -144,14 +199,24 @@ EventDataDescriptions make_event_data_descriptions(
             }
 
             DataSourceDescription dsd;
+
+            for (unsigned outIndex = 0; outIndex < a2_dataSource->outputCount; outIndex++)
+            {
+                dsd.outputs.emplace_back(
+                    make_output_description(a2_dataSource, a1_dataSource, outIndex));
+            }
+
+            assert(!dsd.outputs.empty());
+            const auto &firstOutput = dsd.outputs[0];
+
             dsd.name = variablify(a1_dataSource->objectName()).toStdString();
             dsd.moduleIndex = moduleIndex;
-            dsd.size = outputSize;
+            dsd.size = firstOutput.size;
             dsd.lowerLimit = a2_dataSource->outputLowerLimits[0][0];
             dsd.upperLimit = a2_dataSource->outputUpperLimits[0][0];
-            dsd.bits = get_data_storage_bits(a1_dataSource);
-            dsd.indexType  = get_storage_type(outputBits);
-            dsd.valueType  = get_data_storage_type(a1_dataSource);
+            dsd.bits = firstOutput.bits;
+            dsd.indexType  = firstOutput.indexType;
+            dsd.valueType  = firstOutput.valueType;
             size_t paramCount = std::min(static_cast<size_t>(paramNames.size()),
                                          static_cast<size_t>(dsd.size));
 
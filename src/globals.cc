@@ -35,6 +35,8 @@ QString toString(const ListFileFormat &fmt)
             return QSL("LZ4");
         case ListFileFormat::ZMQ_Ganil:
             return QSL("ZMQ_GANIL");
+        case ListFileFormat::ZSTD:
+            return QSL("ZSTD");
     }
 
     return QString();
@@ -54,6 +56,9 @@ ListFileFormat listFileFormat_fromString(const QString &str)
     if (str == "ZMQ_GANIL")
         return ListFileFormat::ZMQ_Ganil;
 
+    if (str == "ZSTD")
+        return ListFileFormat::ZSTD;
+
     return ListFileFormat::Invalid;
 }
 
@@ -101,6 +106,7 @@ QString generate_output_filename(const ListFileOutputInfo &info)
 
         case ListFileFormat::ZIP:
         case ListFileFormat::LZ4:
+        case ListFileFormat::ZSTD:
             result += QSL(".zip");
             break;
 
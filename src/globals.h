@@ -137,6 +137,10 @@ struct DAQStats
         buffersFlushed = 0;
         listFileBytesWritten = 0;
         listFileTotalBytes = 0;
+        replayCompressedBytes = 0;
+        replayDecompressedBytes = 0;
+        replayDeliveredBytes = 0;
+        replayDecompressionThreads = 0;
         startTime = QDateTime::currentDateTime();
         endTime = {};
     }
@@ -161,6 +165,14 @@ struct DAQStats
     u64 listFileTotalBytes = 0; // For replay mode: the size of the replay file
     QString listfileFilename; // For replay mode: the current replay filename
 
+    // Replay with parallel decompression: per-stage counters of the
+    // decompression pipeline. The parser stage is covered by totalBytesRead,
+    // the analysis stage by buffersFlushed.
+    u64 replayCompressedBytes = 0;      // compressed input consumed by the decompression threads (if known)
+    u64 replayDecompressedBytes = 0;    // uncompressed data produced by the decompression threads
+    u64 replayDeliveredBytes = 0;       // uncompressed data passed on in order to the readout parser
+    unsigned replayDecompressionThreads = 0; // 0 if parallel decompression is not in use
+
     u64 getAnalyzedBuffers() const { return totalBuffersRead - droppedBuffers; }
     double getAnalysisEfficiency() const;
 };
@@ -172,6 +184,7 @@ enum class ListFileFormat
     ZIP,
     LZ4,
     ZMQ_Ganil,
+    ZSTD,       // MVLC only: zstd frames in a ZIP container
 };
 
 QString toString(const ListFileFormat &fmt);
@@ -193,7 +206,7 @@ struct ListFileOutputInfo
     QString directory;          // Path to the output directory. If it's not a
                                 // full path it's relative to the workspace directory.
                                 //
-    int compressionLevel = 1;   // zlib/lz4 compression level
+    int compressionLevel = 1;   // zlib/lz4/zstd compression level
 
     QString prefix = QSL("mvmelst");
     QString suffix;
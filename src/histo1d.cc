@@ -24,7 +24,7 @@
 Histo1D::Histo1D(u32 nBins, double xMin, double xMax, QObject *parent)
     : QObject(parent)
     , m_xAxisBinning(nBins, xMin, xMax)
-    , m_data(new double[nBins])
+    , m_data(a2::allocate_bins(a2::BinStorageType::Double, nBins))
 {
     //qDebug() << __PRETTY_FUNCTION__ << this;
     clear();
@@ -34,6 +34,7 @@ Histo1D::Histo1D(AxisBinning binning, const SharedHistoMem &mem, QObject *parent
     : QObject(parent)
     , m_xAxisBinning(binning)
     , m_data(mem.data)
+    , m_storageType(mem.storageType)
     , m_externalMemory(mem)
 {
     clear();
@@ -46,7 +47,7 @@ Histo1D::~Histo1D()
     if (ownsMemory())
     {
         //qDebug() << __PRETTY_FUNCTION__ << this << "delete m_data" << m_data;
-        delete[] m_data;
+        a2::free_bins(m_data);
         m_data = nullptr;
     }
 }
@@ -62,10 +63,10 @@ void Histo1D::resize(u32 nBins)
 
     if (nBins != m_xAxisBinning.getBins())
     {
-        delete[] m_data;
+        a2::free_bins(m_data);
         try
         {
-            m_data = new double[nBins];
+            m_data = a2::allocate_bins(m_storageType, nBins);
         }
         catch (const std::bad_alloc &)
         {
@@ -87,6 +88,7 @@ void Histo1D::setData(const SharedHistoMem &mem, AxisBinning newBinning)
 
     m_externalMemory = mem;
     m_data = mem.data;
+    m_storageType = mem.storageType;
     setAxisBinning(Qt::XAxis, newBinning);
 }
 
@@ -100,6 +102,24 @@ SharedHistoMem Histo1D::getSharedMemory() const
     return m_externalMemory;
 }
 
+void Histo1D::setStorageType(a2::BinStorageType type)
+{
+    if (!ownsMemory())
+    {
+        throw HistoLogicError("setStorageType() not available when using external memory");
+    }
+
+    if (type != m_storageType)
+    {
+        const auto nBins = m_xAxisBinning.getBins();
+        a2::free_bins(m_data);
+        m_data = nullptr;
+        m_data = a2::allocate_bins(type, nBins);
+        m_storageType = type;
+        clear();
+    }
+}
+
 s32 Histo1D::fill(double x, double weight)
 {
     if (!std::isnan(x))
@@ -112,8 +132,8 @@ s32 Histo1D::fill(double x, double weight)
             m_overflow += weight;
         else
         {
-            double &value = m_data[bin];
-            value += weight;
+            double value = a2::read_bin(m_data, m_storageType, bin) + weight;
+            a2::write_bin(m_data, m_storageType, bin, value);
 
             if (value >= m_maxValue)
             {
@@ -153,10 +173,7 @@ void Histo1D::clear()
     m_underflow = 0.0;
     m_overflow = 0.0;
 
-    for (u32 i=0; i<m_xAxisBinning.getBins(); ++i)
-    {
-        m_data[i] = 0.0;
-    }
+    a2::clear_bins(m_data, m_storageType, m_xAxisBinning.getBins());
 }
 
 bool Histo1D::setBinContent(u32 bin, double value, size_t entryCount)
@@ -165,7 +182,7 @@ bool Histo1D::setBinContent(u32 bin, double value, size_t entryCount)
 
     if (bin < getNumberOfBins())
     {
-        m_data[bin] = value;
+        a2::write_bin(m_data, m_storageType, bin, value);
         m_entryCount += entryCount;
         result = true;
     }
@@ -181,8 +198,10 @@ void Histo1D::debugDump(bool dumpEmptyBins) const
 
     for (u32 bin = 0; bin < m_xAxisBinning.getBins(); ++bin)
     {
-        if (dumpEmptyBins || m_data[bin] > 0.0)
-            qDebug() << "  bin =" << bin << ", lowEdge=" << m_xAxisBinning.getBinLowEdge(bin) << ", value =" << m_data[bin];
+        const double value = a2::read_bin(m_data, m_storageType, bin);
+
+        if (dumpEmptyBins || value > 0.0)
+            qDebug() << "  bin =" << bin << ", lowEdge=" << m_xAxisBinning.getBinLowEdge(bin) << ", value =" << value;
     }
 }
 
@@ -357,6 +376,7 @@ Histo1DStatistics Histo1D::calcBinStatistics(u32 startBin, u32 onePastEndBin, u3
 std::unique_ptr<Histo1D> Histo1D::clone() const
 {
     auto result = std::make_unique<Histo1D>(getNumberOfBins(), getXMin(), getXMax());
+    result->setStorageType(m_storageType);
     result->m_xAxisInfo = m_xAxisInfo;
     result->m_underflow = m_underflow;
     result->m_overflow = m_overflow;
@@ -24,6 +24,7 @@
 #include <memory>
 #include <QObject>
 
+#include "analysis/a2/histo_storage.h"
 #include "analysis/a2/memory.h"
 #include "histo_util.h"
 #include "libmvme_export.h"
@@ -66,9 +67,13 @@ struct SharedHistoMem
     std::shared_ptr<memory::Arena> arena;
 
     // Pointer into the arena where this Histograms data starts.
-    double *data = nullptr;
+    void *data = nullptr;
 
+    // Number of bins.
     s32 size = 0;
+
+    // Element type of the bins pointed to by data.
+    a2::BinStorageType storageType = a2::BinStorageType::Double;
 };
 
 class LIBMVME_EXPORT Histo1D: public QObject
@@ -107,9 +112,17 @@ class LIBMVME_EXPORT Histo1D: public QObject
         /* Throws HistoLogicError if internal memory is used. */
         SharedHistoMem getSharedMemory() const;
 
+        /* Changes the element type of the internal bin storage. Clears the
+         * histogram if the type changes. Throws HistoLogicError if external
+         * memory is used, use setData() in that case. */
+        void setStorageType(a2::BinStorageType type);
+        a2::BinStorageType getStorageType() const { return m_storageType; }
+
         // Returns the bin number that was filled or -1 in case of under/overflow.
         // Note: No Resolution Reduction for the fill operation.
         // Increments the entry count by one, independent of the weight.
+        // Integer bin storage rounds the resulting bin value and clamps it to
+        // the counter range.
         s32 fill(double x, double weight = 1.0);
 
         /* Returns the counts of the bin containing the given x value. */
@@ -119,14 +132,19 @@ class LIBMVME_EXPORT Histo1D: public QObject
         std::pair<double, double> getValueAndBinLowEdge(double x, u32 rrf = NoRR) const;
 
         void clear();
-        inline double *data() { return m_data; }
+
+        // Raw bin storage. The element type is given by getStorageType().
+        inline void *data() { return m_data; }
 
         inline u32 getNumberOfBins(u32 rrf = NoRR) const
         {
             return m_xAxisBinning.getBins(rrf);
         }
 
-        inline size_t getStorageSize() const { return getNumberOfBins() * sizeof(double); }
+        inline size_t getStorageSize() const
+        {
+            return a2::bin_storage_size(m_storageType, getNumberOfBins());
+        }
 
         /* If rrf is in effect the given inputBin is interpreted in terms of the reduced
          * total bin count. Otherwise it represents the physical bin number. */
@@ -137,7 +155,7 @@ class LIBMVME_EXPORT Histo1D: public QObject
             if (rrf == NoRR)
             {
                 // no resolution reduction -> direct indexing
-                return (inputBin < physBins) ? m_data[inputBin] : 0.0;
+                return (inputBin < physBins) ? a2::read_bin(m_data, m_storageType, inputBin) : 0.0;
             }
 
             // Go from reduced bins to physical bins
@@ -159,14 +177,15 @@ class LIBMVME_EXPORT Histo1D: public QObject
             if (beginBin < physBins && endBin <= physBins)
             {
                 // consecutive summation of the bins in [beginBin, endBin)
-                return std::accumulate(m_data + beginBin, m_data + endBin, 0.0);
+                return a2::sum_bins(m_data, m_storageType, beginBin, endBin);
             }
 
             // out of range
             return 0.0;
         }
 
-        // Sets the specified bin to the given value. The last parameter allows
+        // Sets the specified bin to the given value. Integer bin storage
+        // rounds the value and clamps it to the counter range. The last parameter allows
         // to adjust the  amount by which the internal entry count is
         // incremented. This allows to set the bin content once with a
         // calculated value which might correspond to multiple fill() operations
@@ -297,7 +316,8 @@ class LIBMVME_EXPORT Histo1D: public QObject
         AxisBinning m_xAxisBinning;
         AxisInfo m_xAxisInfo;
 
-        double *m_data = nullptr;
+        void *m_data = nullptr;
+        a2::BinStorageType m_storageType = a2::BinStorageType::Double;
         SharedHistoMem m_externalMemory;
 
         double m_underflow = 0.0;
@@ -26,7 +26,7 @@ Histo2D::Histo2D(u32 xBins, double xMin, double xMax,
                  u32 yBins, double yMin, double yMax,
                  QObject *parent)
     : QObject(parent)
-    , m_data(new double[xBins * yBins])
+    , m_data(a2::allocate_bins(a2::BinStorageType::Double, xBins * yBins))
 {
     m_axisBinnings[Qt::XAxis] = AxisBinning(xBins, xMin, xMax);
     m_axisBinnings[Qt::YAxis] = AxisBinning(yBins, yMin, yMax);
@@ -35,7 +35,22 @@ Histo2D::Histo2D(u32 xBins, double xMin, double xMax,
 
 Histo2D::~Histo2D()
 {
-    delete[] m_data;
+    a2::free_bins(m_data);
+}
+
+// Replaces the current bin storage with new, uncleared storage.
+void Histo2D::reallocate(u32 xBins, u32 yBins, a2::BinStorageType type, bool tiled)
+{
+    a2::free_bins(m_data);
+    m_data = nullptr;
+    m_tiles.reset();
+
+    if (tiled)
+        m_tiles = std::make_unique<a2::TiledHistoStorage>(xBins, yBins, type);
+    else
+        m_data = a2::allocate_bins(type, xBins * yBins);
+
+    m_storageType = type;
 }
 
 void Histo2D::resize(s32 xBins, s32 yBins)
@@ -45,19 +60,16 @@ void Histo2D::resize(s32 xBins, s32 yBins)
     u32 xBinsNew = static_cast<u32>(xBins);
     u32 yBinsNew = static_cast<u32>(yBins);
 
-    if (xBinsNew * yBinsNew != m_axisBinnings[Qt::XAxis].getBins() * m_axisBinnings[Qt::YAxis].getBins())
+    if (m_tiles)
+    {
+        // The tile layout depends on the number of bins on each axis.
+        if (xBinsNew != m_tiles->getXBins() || yBinsNew != m_tiles->getYBins())
+            reallocate(xBinsNew, yBinsNew, m_storageType, true);
+    }
+    else if (xBinsNew * yBinsNew != m_axisBinnings[Qt::XAxis].getBins() * m_axisBinnings[Qt::YAxis].getBins())
     {
         // Reallocate memory for the new size
-        delete[] m_data;
-        try
-        {
-            m_data = new double[xBinsNew * yBinsNew];
-        }
-        catch (const std::bad_alloc &)
-        {
-            m_data = nullptr;
-            throw;
-        }
+        reallocate(xBinsNew, yBinsNew, m_storageType, false);
     }
 
     // Always update the number of bins on both axes, even if the total number
@@ -67,6 +79,24 @@ void Histo2D::resize(s32 xBins, s32 yBins)
     clear();
 }
 
+void Histo2D::setStorageType(a2::BinStorageType type)
+{
+    if (type != m_storageType)
+    {
+        reallocate(getNumberOfXBins(), getNumberOfYBins(), type, isTiled());
+        clear();
+    }
+}
+
+void Histo2D::setTiled(bool tiled)
+{
+    if (tiled != isTiled())
+    {
+        reallocate(getNumberOfXBins(), getNumberOfYBins(), m_storageType, tiled);
+        clear();
+    }
+}
+
 void Histo2D::fill(double x, double y, double weight)
 {
     s64 xBin = m_axisBinnings[Qt::XAxis].getBin(x);
@@ -82,9 +112,17 @@ void Histo2D::fill(double x, double y, double weight)
     }
     else
     {
-        u32 linearBin = yBin * m_axisBinnings[Qt::XAxis].getBins() + xBin;
+        if (m_tiles)
+        {
+            m_tiles->setBin(xBin, yBin, m_tiles->getBin(xBin, yBin) + weight);
+        }
+        else
+        {
+            u32 linearBin = yBin * m_axisBinnings[Qt::XAxis].getBins() + xBin;
 
-        m_data[linearBin] += weight;
+            double value = a2::read_bin(m_data, m_storageType, linearBin) + weight;
+            a2::write_bin(m_data, m_storageType, linearBin, value);
+        }
     }
 }
 
@@ -123,16 +161,17 @@ double Histo2D::getBinContent(u32 xInputBin, u32 yInputBin,
     iy1 = qBound(0u, iy1, yBinCount - 1);
     iy2 = qBound(0u, iy2, yBinCount);
 
+    // Sparse storage skips empty tiles.
+    if (m_tiles)
+        return m_tiles->sumRegion(ix1, ix2, iy1, iy2);
+
     double result = 0.0;
     int nBins  = 0;
 
     for (s64 iy = iy1; iy < iy2; iy++)
     {
-        for (s64 ix = ix1; ix < ix2; ix++)
-        {
-            result += m_data[iy * xBinCount + ix];
-            nBins++;
-        }
+        result += a2::sum_bins(m_data, m_storageType, iy * xBinCount + ix1, iy * xBinCount + ix2);
+        nBins += ix2 - ix1;
     }
 
 #if 0
@@ -153,8 +192,15 @@ double Histo2D::getBinContent(u32 xInputBin, u32 yInputBin,
 
 void Histo2D::clear()
 {
-    size_t binCount = m_axisBinnings[Qt::XAxis].getBins() * m_axisBinnings[Qt::YAxis].getBins();
-    std::fill(m_data, m_data + binCount, 0.0);
+    if (m_tiles)
+    {
+        m_tiles->clear();
+    }
+    else
+    {
+        size_t binCount = m_axisBinnings[Qt::XAxis].getBins() * m_axisBinnings[Qt::YAxis].getBins();
+        a2::clear_bins(m_data, m_storageType, binCount);
+    }
 
     m_underflow = 0.0;
     m_overflow = 0.0;
@@ -232,14 +278,35 @@ Histo2DStatistics Histo2D::calcStatistics(AxisInterval xInterval,
     if (yMaxBin < 0)
         yMaxBin = m_axisBinnings[Qt::YAxis].getBinCount(rrf.y) - 1;
 
+    // Physical bin ranges covered by reduced bins. Used to skip empty tiles.
+    const u32 rrfX = rrf.getXFactor();
+    const u32 rrfY = rrf.getYFactor();
+    const u32 TileSize = a2::TiledHistoStorage::TileSize;
+
     for (s64 yBin = yMinBin;
          yBin <= yMaxBin;
          ++yBin)
     {
+        if (m_tiles && m_tiles->isRegionEmpty(xMinBin * rrfX, (xMaxBin + 1) * rrfX,
+                                              yBin * rrfY, (yBin + 1) * rrfY))
+        {
+            continue;
+        }
+
         for (s64 xBin = xMinBin;
              xBin <= xMaxBin;
              ++xBin)
         {
+            if (m_tiles && m_tiles->isRegionEmpty(xBin * rrfX, (xBin + 1) * rrfX,
+                                                  yBin * rrfY, (yBin + 1) * rrfY))
+            {
+                // Empty bins do not change the stats. Continue with the first
+                // reduced bin reaching into the next tile column.
+                s64 tileEnd = ((xBin + 1) * rrfX + TileSize - 1) / TileSize * TileSize;
+                xBin = std::max(xBin, tileEnd / rrfX - 1);
+                continue;
+            }
+
             //s64 linearBin = yBin * m_axisBinnings[Qt::XAxis].getBins() + xBin;
             //double v = m_data[linearBin];
 
@@ -27,6 +27,8 @@
 #include <QDebugStateSaver>
 #include <array>
 
+#include "analysis/a2/histo_storage.h"
+#include "analysis/a2/tiled_histo_storage.h"
 #include "libmvme_export.h"
 
 struct Histo2DStatistics
@@ -78,6 +80,21 @@ class LIBMVME_EXPORT Histo2D: public QObject
 
         void resize(s32 xBins, s32 yBins);
 
+        /* Changes the element type of the bin storage. Clears the histogram if
+         * the type changes. */
+        void setStorageType(a2::BinStorageType type);
+        a2::BinStorageType getStorageType() const { return m_storageType; }
+
+        /* Switches between dense and tiled sparse bin storage. Clears the
+         * histogram if the layout changes. With tiled storage data() returns
+         * nullptr and the bins are accessed through getTiledStorage(). */
+        void setTiled(bool tiled);
+        bool isTiled() const { return static_cast<bool>(m_tiles); }
+        a2::TiledHistoStorage *getTiledStorage() { return m_tiles.get(); }
+        const a2::TiledHistoStorage *getTiledStorage() const { return m_tiles.get(); }
+
+        // Integer bin storage rounds the resulting bin value and clamps it to
+        // the counter range.
         void fill(double x, double y, double weight = 1.0);
 
         double getValue(double x, double y,
@@ -87,14 +104,20 @@ class LIBMVME_EXPORT Histo2D: public QObject
                              const ResolutionReductionFactors &rrf = {}) const;
 
         void clear();
-        inline double *data() { return m_data; }
+
+        // Raw dense bin storage. The element type is given by
+        // getStorageType(). nullptr if tiled storage is used.
+        inline void *data() { return m_data; }
 
         void debugDump() const;
         inline size_t getStorageSize() const
         {
-            return getAxisBinning(Qt::XAxis).getBins()
+            if (m_tiles)
+                return m_tiles->getStorageSize();
+
+            return static_cast<size_t>(getAxisBinning(Qt::XAxis).getBins())
                 * getAxisBinning(Qt::YAxis).getBins()
-                * sizeof(double);
+                * a2::bin_storage_element_size(m_storageType);
         }
 
         AxisBinning getAxisBinning(Qt::Axis axis) const
@@ -201,10 +224,14 @@ class LIBMVME_EXPORT Histo2D: public QObject
         inline double getYMax() const { return m_axisBinnings[Qt::YAxis].getMax(); }
 
     private:
+        void reallocate(u32 xBins, u32 yBins, a2::BinStorageType type, bool tiled);
+
         AxisBinnings m_axisBinnings;
         AxisInfos m_axisInfos;
 
-        double *m_data = nullptr;
+        void *m_data = nullptr;
+        a2::BinStorageType m_storageType = a2::BinStorageType::Double;
+        std::unique_ptr<a2::TiledHistoStorage> m_tiles;
 
         double m_underflow = 0.0;
         double m_overflow = 0.0;
@@ -0,0 +1,16 @@
+#include <gtest/gtest.h>
+
+#include "histo2d.h"
+
+TEST(Histo2D, storage_size)
+{
+    Histo2D histo(16, 0.0, 16.0, 8, 0.0, 8.0);
+
+    ASSERT_EQ(histo.getStorageSize(), 16u * 8u * sizeof(double));
+
+    histo.setStorageType(a2::BinStorageType::U32);
+    ASSERT_EQ(histo.getStorageSize(), 16u * 8u * sizeof(u32));
+
+    histo.resize(32, 4);
+    ASSERT_EQ(histo.getStorageSize(), 32u * 4u * sizeof(u32));
+}
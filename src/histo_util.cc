@@ -28,6 +28,7 @@
 #include <QFrame>
 #include <QGroupBox>
 #include <QRadioButton>
+#include <vector>
 
 QString makeAxisTitle(const QString &title, const QString &unit)
 {
@@ -77,6 +78,21 @@ QComboBox *make_resolution_combo(s32 minBits, s32 maxBits, s32 selectedBits)
     return result;
 }
 
+QComboBox *make_bin_storage_combo(a2::BinStorageType selected)
+{
+    QComboBox *result = new QComboBox;
+
+    result->addItem("double", static_cast<int>(a2::BinStorageType::Double));
+    result->addItem("u32 counters", static_cast<int>(a2::BinStorageType::U32));
+    result->addItem("u64 counters", static_cast<int>(a2::BinStorageType::U64));
+    result->setToolTip("Element type of the histogram bins. The integer types"
+                       " use less memory and fill faster. u32 counters saturate at 2^32-1.");
+
+    result->setCurrentIndex(result->findData(static_cast<int>(selected)));
+
+    return result;
+}
+
 /* inputMin and inputMax are used as the min and max possible values for the spin boxes.
  *
  * limitMin and limitMax are the values used to populate both spinboxes.
@@ -212,6 +228,27 @@ std::shared_ptr<Histo1D> make_projection(Histo2D *histo, Qt::Axis axis,
                           + (axis == Qt::XAxis ? QSL(" X") : QSL(" Y"))
                           + QSL(" Projection"));
 
+    if (auto tiles = histo->getTiledStorage())
+    {
+        // Sparse storage: only the bins of non-empty tiles are visited.
+        std::vector<double> values(nProjBins, 0.0);
+        const bool isX = (axis == Qt::XAxis);
+
+        tiles->visitBins(isX ? projStartBin : otherStartBin,
+                         isX ? projEndBin : otherEndBin,
+                         isX ? otherStartBin : projStartBin,
+                         isX ? otherEndBin : projEndBin,
+                         [&] (u32 x, u32 y, double v)
+                         {
+                             values[(isX ? x : y) - projStartBin] += v;
+                         });
+
+        for (s64 i = 0; i < nProjBins; ++i)
+            result->setBinContent(i, values[i], values[i]);
+
+        return result;
+    }
+
     u32 destBin = 0;
 
     for (u32 binI = projStartBin;
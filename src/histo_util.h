@@ -22,6 +22,7 @@
 #define __HISTO_UTIL_H__
 
 #include "typedefs.h"
+#include "analysis/a2/histo_storage.h"
 
 #include <cmath>
 #include <memory>
@@ -346,6 +347,10 @@ QComboBox *make_resolution_combo(s32 minBits, s32 maxBits, s32 selectedBits);
 // Assumes that selectedRes is a power of 2!
 void select_by_resolution(QComboBox *combo, s32 selectedRes);
 
+// Combo box for the histogram bin storage type. The item data contains the
+// a2::BinStorageType value as an int.
+QComboBox *make_bin_storage_combo(a2::BinStorageType selected);
+
 struct HistoAxisLimitsUI
 {
     QFrame *outerFrame;
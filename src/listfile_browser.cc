@@ -20,7 +20,10 @@
  */
 #include "listfile_browser.h"
 
+#include <limits>
+
 #include <QHeaderView>
+#include <QLabel>
 #include <QBoxLayout>
 #include <QMessageBox>
 #include <QTimer>
@@ -43,6 +46,9 @@ ListfileBrowser::ListfileBrowser(MVMEContext *context, MVMEMainWindow *mainWindo
     , m_fsView(new QTableView(this))
     , m_analysisLoadActionCombo(new QComboBox(this))
     , m_cb_replayAllParts(new QCheckBox(this))
+    , m_cb_parallelDecompression(new QCheckBox(this))
+    , m_spin_replayStart(new QSpinBox(this))
+    , m_spin_replayStop(new QSpinBox(this))
 {
     setWindowTitle(QSL("Listfile Browser"));
 
@@ -68,9 +74,35 @@ ListfileBrowser::ListfileBrowser(MVMEContext *context, MVMEMainWindow *mainWindo
         m_cb_replayAllParts->setText("replay all parts");
         m_cb_replayAllParts->setChecked(true);
 
+        m_cb_parallelDecompression->setText("parallel decompression");
+        m_cb_parallelDecompression->setToolTip(
+            QSL("MVLC only: decompress split listfile parts or the blocks of indexed"
+                " ZIP archives (.mvlcidx) using multiple threads."));
+
+        for (auto spin: { m_spin_replayStart, m_spin_replayStop })
+        {
+            spin->setMinimum(0);
+            spin->setMaximum(std::numeric_limits<int>::max());
+            spin->setSuffix(QSL(" s"));
+        }
+
+        m_spin_replayStart->setSpecialValueText(QSL("begin"));
+        m_spin_replayStop->setSpecialValueText(QSL("end"));
+        m_spin_replayStart->setToolTip(QSL("MVLC only: start the replay at the given number of seconds into the run."
+                                           " Uses the listfile index (.mvlcidx) to seek if available."));
+        m_spin_replayStop->setToolTip(QSL("MVLC only: stop the replay at the given number of seconds into the run."));
+
+        auto rangeLayout = new QHBoxLayout;
+        rangeLayout->addWidget(m_spin_replayStart);
+        rangeLayout->addWidget(new QLabel(QSL("to")));
+        rangeLayout->addWidget(m_spin_replayStop);
+        rangeLayout->addStretch(1);
+
         auto layout = new QFormLayout;
         layout->addRow(QSL("On listfile load"), m_analysisLoadActionCombo);
         layout->addRow(QSL("Split Listfiles"),  m_cb_replayAllParts);
+        layout->addRow(QSL("Decompression"),    m_cb_parallelDecompression);
+        layout->addRow(QSL("Replay range"),     rangeLayout);
 
         widgetLayout->addLayout(layout);
     }
@@ -164,6 +196,9 @@ void ListfileBrowser::onItemDoubleClicked(const QModelIndex &mi)
 
     opts.loadAnalysis = m_analysisLoadActionCombo->currentData().toBool();
     opts.replayAllParts = m_cb_replayAllParts->isChecked();
+    opts.replayStart = std::chrono::seconds(m_spin_replayStart->value());
+    opts.replayStop = std::chrono::seconds(m_spin_replayStop->value());
+    opts.parallelDecompression = m_cb_parallelDecompression->isChecked();
 
     if (opts.loadAnalysis && m_context->getAnalysis()->isModified())
     {
@@ -24,6 +24,7 @@
 #include <QComboBox>
 #include <QCheckBox>
 #include <QFileSystemModel>
+#include <QSpinBox>
 #include <QTableView>
 
 class MVMEContext;
@@ -49,6 +50,9 @@ class ListfileBrowser: public QWidget
         QTableView *m_fsView;
         QComboBox *m_analysisLoadActionCombo;
         QCheckBox *m_cb_replayAllParts;
+        QCheckBox *m_cb_parallelDecompression;
+        QSpinBox *m_spin_replayStart;
+        QSpinBox *m_spin_replayStop;
 };
 
 #endif /* __LISTFILE_BROWSER_H__ */
@@ -359,6 +359,14 @@ void ListfileFilterStreamConsumer::beginEvent(s32 eventIndex)
     (void) eventIndex;
 }
 
+// processModuleData() tests the condition bits of the primary A2.
+QString ListfileFilterStreamConsumer::analysisEventDataReader() const
+{
+    if (d->config_.enabled)
+        return QSL("Listfile Filter");
+    return {};
+}
+
 void ListfileFilterStreamConsumer::endEvent(s32 eventIndex)
 {
     (void) eventIndex;
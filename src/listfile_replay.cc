@@ -29,6 +29,7 @@
 
 #include "analysis/analysis_util.h"
 #include "mvlc_listfile_worker.h"
+#include "mvlc_listfile_zstd.h"
 #include "mvlc_stream_worker.h"
 #include "mvme_listfile_utils.h"
 #include "mvme_listfile_worker.h"
@@ -135,7 +136,10 @@ ListfileReplayHandle open_listfile(const QString &filename)
             {
                 mvlc::listfile::ZipReader zipReader;
                 zipReader.openArchive(filename.toStdString());
-                auto lfh = zipReader.openEntry(lfName.toStdString());
+                std::unique_ptr<mvme_mvlc::ZstdReadHandle> zstdHandle;
+                auto lfh = mvme_mvlc::open_listfile_entry(
+                    zipReader, lfName.toStdString(), zstdHandle, 1);
+
                 auto preamble = mvlc::listfile::read_preamble(*lfh);
                 if (preamble.magic == mvlc::listfile::get_filemagic_eth())
                     result.format = ListfileBufferFormat::MVLC_ETH;
@@ -209,7 +213,10 @@ std::pair<std::unique_ptr<VMEConfig>, std::error_code>
             {
                 mvlc::listfile::ZipReader zipReader;
                 zipReader.openArchive(handle.inputFilename.toStdString());
-                auto lfh = zipReader.openEntry(handle.listfileFilename.toStdString());
+                std::unique_ptr<mvme_mvlc::ZstdReadHandle> zstdHandle;
+                auto lfh = mvme_mvlc::open_listfile_entry(
+                    zipReader, handle.listfileFilename.toStdString(), zstdHandle, 1);
+
                 auto preamble = mvlc::listfile::read_preamble(*lfh);
 
                 #if 0
@@ -631,6 +638,9 @@ void ListfileCommandExecutor::Private::operator()(const ReplayCommand &cmd)
 
         qDebug() << "replayWorker=" << replayWorker.get();
 
+        info.handle.options.replayStart = cmd.replayStart;
+        info.handle.options.replayStop = cmd.replayStop;
+
         replayWorker->setLogger(logger_);
         replayWorker->setListfile(&info.handle);
 
@@ -23,6 +23,7 @@
 
 #include "libmvme_export.h"
 
+#include <chrono>
 #include <memory>
 #include <quazip.h>
 #include <QDebug>
@@ -43,6 +44,16 @@ struct OpenListfileOptions
     // MVLC only: if true the given file and all following parts of split-file
     // listfiles will be replayed.
     bool replayAllParts = false;
+    // MVLC only: replay the data between the given offsets from the start of
+    // the run. Offsets are counted in timeticks (seconds). Zero values mean no
+    // limit. Uses the listfile index sidecar file to seek to the start if
+    // available.
+    std::chrono::seconds replayStart = {};
+    std::chrono::seconds replayStop = {};
+    // MVLC only: decompress the listfile using multiple threads. Split
+    // listfiles are decompressed part by part, single deflate compressed
+    // archives between the access points of their listfile index.
+    bool parallelDecompression = false;
 };
 
 struct LIBMVME_EXPORT ListfileReplayHandle
@@ -186,6 +197,9 @@ struct LIBMVME_EXPORT ReplayCommand: public ListfileCommandBase
 {
     QByteArray analysisBlob;
     QString analysisFilename; // For info purposes only. Data is kept in the blob.
+    // Time range to replay, see OpenListfileOptions.
+    std::chrono::seconds replayStart = {};
+    std::chrono::seconds replayStop = {};
 };
 
 struct LIBMVME_EXPORT MergeCommand: public ListfileCommandBase
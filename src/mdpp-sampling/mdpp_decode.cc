@@ -139,7 +139,7 @@ void reset_trace(ChannelTrace &trace)
 // extended timestamp words are considered. Null fillwords are skipped. Only the
 // first hits for the timestamp and extended timestamp filter masks are
 // considered. Searching is done in reverse order as the timestamps should be at
-// or near the end of the data.
+// or near the end of the data. logger_fun may be empty.
 template<typename Filters>
 std::optional<u64> extract_timestamp(const u32 *data, const size_t size, const Filters &filters, logger_function logger_fun)
 {
@@ -153,7 +153,7 @@ std::optional<u64> extract_timestamp(const u32 *data, const size_t size, const F
         it != std::rend(dataView))
     {
         ret = mvlc::util::extract(filters.fTimeStamp, *it, 'D');
-        logger_fun("trace", fmt::format("timestamp matched (30 low bits): 0b{:030b}, 0x{:08x}", *ret, *ret));
+        if (logger_fun) logger_fun("trace", fmt::format("timestamp matched (30 low bits): 0b{:030b}, 0x{:08x}", *ret, *ret));
     }
     else
     {
@@ -166,9 +166,9 @@ std::optional<u64> extract_timestamp(const u32 *data, const size_t size, const F
         // optional 16 high bits of the extended timestamp if enabled
         auto value = *mvlc::util::extract(filters.fExtentedTs, *it, 'D');
         ret = *ret | (static_cast<std::uint64_t>(value) << 30);
-        logger_fun("trace", fmt::format("extended timestamp matched (16 high bits): 0b{:016b}, 0x{:08x}", value, value));
+        if (logger_fun) logger_fun("trace", fmt::format("extended timestamp matched (16 high bits): 0b{:016b}, 0x{:08x}", value, value));
     }
-    else
+    else if (logger_fun)
     {
         logger_fun("trace", fmt::format("decode_mdpp_samples: no extended timestamp present"));
     }
@@ -349,6 +349,123 @@ DecodedMdppSampleEvent decode_mdpp_samples_impl(const u32 *data, const size_t si
     return ret;
 }
 
+// Same decoding logic as decode_mdpp_samples_impl() but writing into
+// preallocated spans. Keep the two in sync.
+template<typename Filters>
+bool decode_mdpp_samples_into_impl(const u32 *data, const size_t size, const Filters &filters, MdppSampleSpans &out)
+{
+    out.channelCount = 0;
+    out.header = 0;
+    out.timestamp = 0;
+    out.headerModuleId = 0;
+    out.droppedSamples = 0;
+
+    if (size < 2)
+        return false;
+
+    if (mvlc::util::matches(filters.fModuleId, data[0]))
+    {
+        out.header = data[0];
+        out.headerModuleId = *mvlc::util::extract(filters.fModuleId, data[0], 'D');
+    }
+
+    if (auto timestamp = extract_timestamp(data, size, filters, {}))
+        out.timestamp = *timestamp;
+
+    s32 channel = -1;
+    TraceHeader traceHeader;
+    u32 traceSamples = 0; // Total samples of the current trace including dropped ones.
+
+    // Samples are written directly into the slot of the current channel. A
+    // finished trace only has to record its header and sample count.
+    auto finish_trace = [&out, &channel, &traceHeader, &traceSamples] ()
+    {
+        if (channel < 0 || static_cast<unsigned>(channel) >= out.maxChannels)
+            return;
+
+        const auto ch = static_cast<unsigned>(channel);
+        bool seen = false;
+
+        for (unsigned i = 0; i < out.channelCount; ++i)
+            seen = seen || out.channels[i] == ch;
+
+        if (!seen)
+            out.channels[out.channelCount++] = ch;
+
+        out.traceHeaders[ch] = traceHeader;
+        out.sampleCounts[ch] = std::min(traceSamples, out.maxSamples);
+    };
+
+    auto push_sample = [&out, &channel, &traceSamples] (s16 sample)
+    {
+        if (static_cast<unsigned>(channel) < out.maxChannels && traceSamples < out.maxSamples)
+            out.channelSamples(channel)[traceSamples] = sample;
+        else
+            ++out.droppedSamples;
+
+        ++traceSamples;
+    };
+
+    for (auto wordPtr = data+1, dataEnd = data + size; wordPtr < dataEnd; ++wordPtr)
+    {
+        const FilterWithCaches *channelFilter = nullptr;
+        for (const auto &filter: filters.channelFilters)
+        {
+            if (mvlc::util::matches(filter, *wordPtr))
+            {
+                channelFilter = &filter;
+                break;
+            }
+        }
+
+        if (channelFilter)
+        {
+            s32 addr = *mvlc::util::extract(*channelFilter, *wordPtr, 'A');
+
+            if (channel >= 0 && channel != addr && traceSamples > 0)
+            {
+                finish_trace();
+                traceHeader = {};
+                traceSamples = 0;
+            }
+
+            channel = addr;
+        }
+        else if (mvlc::util::matches(filters.fSamples, *wordPtr))
+        {
+            if (channel < 0)
+            {
+                out.channelCount = 0;
+                return false;
+            }
+
+            if (traceHeader.value == 0)
+            {
+                traceHeader.parts.debug = *mvlc::util::extract(filters.fSamplesHeader, *wordPtr, 'D');
+                traceHeader.parts.config = *mvlc::util::extract(filters.fSamplesHeader, *wordPtr, 'C');
+                traceHeader.parts.phase = *mvlc::util::extract(filters.fSamplesHeader, *wordPtr, 'P');
+                traceHeader.parts.length = *mvlc::util::extract(filters.fSamplesHeader, *wordPtr, 'L');
+            }
+            else
+            {
+                constexpr u32 SampleMask = (1u << SampleBits) - 1;
+
+                auto value = *mvlc::util::extract(filters.fSamples, *wordPtr, 'D');
+                u32 evenRaw = value & SampleMask;
+                u32 oddRaw  = (value >> SampleBits) & SampleMask;
+
+                push_sample(a2::convert_to_signed(evenRaw, SampleBits));
+                push_sample(a2::convert_to_signed(oddRaw, SampleBits));
+            }
+        }
+    }
+
+    if (channel >= 0 && traceSamples > 0)
+        finish_trace();
+
+    return true;
+}
+
 DecoderFunction get_decoder_function(const char *moduleType)
 {
     if (strcmp(moduleType, "mdpp16_scp") == 0)
@@ -402,6 +519,103 @@ DecodedMdppSampleEvent decode_mdpp_samples(const u32 *data, const size_t size, c
     return result;
 }
 
+size_t sample_spans_storage_size(unsigned maxChannels, unsigned maxSamples)
+{
+    return maxChannels * (sizeof(TraceHeader) + sizeof(u32) + sizeof(u16))
+        + maxChannels * maxSamples * sizeof(s16);
+}
+
+MdppSampleSpans make_sample_spans(void *storage, unsigned maxChannels, unsigned maxSamples)
+{
+    static_assert(sizeof(TraceHeader) == sizeof(u32));
+    assert(reinterpret_cast<uintptr_t>(storage) % alignof(u32) == 0);
+
+    MdppSampleSpans result;
+    result.maxChannels = maxChannels;
+    result.maxSamples = maxSamples;
+
+    auto mem = reinterpret_cast<u8 *>(storage);
+    result.traceHeaders = reinterpret_cast<TraceHeader *>(mem);
+    mem += maxChannels * sizeof(TraceHeader);
+    result.sampleCounts = reinterpret_cast<u32 *>(mem);
+    mem += maxChannels * sizeof(u32);
+    result.channels = reinterpret_cast<u16 *>(mem);
+    mem += maxChannels * sizeof(u16);
+    result.samples = reinterpret_cast<s16 *>(mem);
+
+    std::fill(result.traceHeaders, result.traceHeaders + maxChannels, TraceHeader{});
+    std::fill(result.sampleCounts, result.sampleCounts + maxChannels, 0u);
+
+    return result;
+}
+
+SpanDecoderFunction get_span_decoder_function(const char *moduleType)
+{
+    if (strcmp(moduleType, "mdpp16_scp") == 0)
+    {
+        return [] (const u32 *data, const size_t size, MdppSampleSpans &out)
+        {
+            return decode_mdpp_samples_into_impl(data, size, mdpp16ScpFilters, out);
+        };
+    }
+    else if (strcmp(moduleType, "mdpp16_qdc") == 0)
+    {
+        return [] (const u32 *data, const size_t size, MdppSampleSpans &out)
+        {
+            return decode_mdpp_samples_into_impl(data, size, mdpp16QdcFilters, out);
+        };
+    }
+    else if (strcmp(moduleType, "mdpp32_scp") == 0)
+    {
+        return [] (const u32 *data, const size_t size, MdppSampleSpans &out)
+        {
+            return decode_mdpp_samples_into_impl(data, size, mdpp32ScpFilters, out);
+        };
+    }
+    else if (strcmp(moduleType, "mdpp32_qdc") == 0)
+    {
+        return [] (const u32 *data, const size_t size, MdppSampleSpans &out)
+        {
+            return decode_mdpp_samples_into_impl(data, size, mdpp32QdcFilters, out);
+        };
+    }
+
+    return nullptr;
+}
+
+bool decode_mdpp_samples_into(const u32 *data, const size_t size, const char *moduleType, MdppSampleSpans &out)
+{
+    if (auto decoder = get_span_decoder_function(moduleType))
+        return decoder(data, size, out);
+
+    out.channelCount = 0;
+    return false;
+}
+
+DecodedMdppSampleEvent to_decoded_event(const MdppSampleSpans &spans)
+{
+    DecodedMdppSampleEvent result;
+    result.header = spans.header;
+    result.timestamp = spans.timestamp;
+    result.headerModuleId = spans.headerModuleId;
+
+    for (unsigned i = 0; i < spans.channelCount; ++i)
+    {
+        const auto channel = spans.channels[i];
+        const auto samples = spans.channelSamples(channel);
+
+        ChannelTrace trace;
+        trace.channel = channel;
+        trace.moduleHeader = spans.header;
+        trace.traceHeader = spans.traceHeaders[channel];
+        trace.samples.resize(spans.sampleCounts[channel]);
+        std::copy(samples, samples + spans.sampleCounts[channel], trace.samples.begin());
+        result.traces.push_back(trace);
+    }
+
+    return result;
+}
+
 std::string sampling_config_to_string(u32 config)
 {
     unsigned source = config & SamplingSettings::SourceMask;
@@ -123,6 +123,65 @@ using DecoderFunction = std::function<DecodedMdppSampleEvent (
 // the decoder once, instead of re-checking the module type for each event.
 DecoderFunction LIBMVME_MDPP_DECODE_EXPORT get_decoder_function(const char *moduleType);
 
+// Allocation free decoding
+// -----------------------
+// decode_mdpp_samples() returns a freshly allocated event for each call and
+// logs through a std::function. For use in the analysis the decoder can write
+// into caller provided fixed-size storage instead.
+
+// Output of the span decoder. The storage is provided by the caller, see
+// sample_spans_storage_size() and make_sample_spans(). Samples are stored
+// channel major: the samples of channel c start at samples + c * maxSamples.
+// Only the first sampleCounts[c] samples of a channel are valid and only the
+// channels listed in channels[0, channelCount) were present in the decoded
+// event.
+//
+// Differences to DecodedMdppSampleEvent: samples exceeding maxSamples and
+// traces of channels >= maxChannels are dropped and counted in droppedSamples.
+// If a channel appears multiple times in an event the last trace wins.
+struct LIBMVME_MDPP_DECODE_EXPORT MdppSampleSpans
+{
+    unsigned maxChannels = 0;
+    unsigned maxSamples = 0;
+
+    TraceHeader *traceHeaders = nullptr;    // [maxChannels]
+    u32 *sampleCounts = nullptr;            // [maxChannels]
+    u16 *channels = nullptr;                // [maxChannels], channels in decoding order
+    s16 *samples = nullptr;                 // [maxChannels * maxSamples]
+    unsigned channelCount = 0;
+
+    u32 header = 0;             // raw mdpp module header
+    u64 timestamp = 0;          // extracted timestamp, see DecodedMdppSampleEvent
+    u8 headerModuleId = 0;      // extracted from the header word
+    u32 droppedSamples = 0;
+
+    const s16 *channelSamples(unsigned channel) const { return samples + channel * maxSamples; }
+    s16 *channelSamples(unsigned channel) { return samples + channel * maxSamples; }
+};
+
+// Number of bytes of storage required for the given dimensions. The storage
+// passed to make_sample_spans() must be aligned to alignof(u32).
+size_t LIBMVME_MDPP_DECODE_EXPORT sample_spans_storage_size(unsigned maxChannels, unsigned maxSamples);
+
+MdppSampleSpans LIBMVME_MDPP_DECODE_EXPORT make_sample_spans(
+    void *storage, unsigned maxChannels, unsigned maxSamples);
+
+// Decodes the module data into the given spans. Previous contents are
+// discarded. Returns false on decoding errors in which case the spans contain
+// no traces. Does not allocate memory and does not log.
+using SpanDecoderFunction = bool (*)(const u32 *data, const size_t size, MdppSampleSpans &out);
+
+// Returns nullptr for unsupported module types.
+SpanDecoderFunction LIBMVME_MDPP_DECODE_EXPORT get_span_decoder_function(const char *moduleType);
+
+bool LIBMVME_MDPP_DECODE_EXPORT decode_mdpp_samples_into(
+    const u32 *data, const size_t size, const char *moduleType, MdppSampleSpans &out);
+
+// Converts the spans into the allocating event representation. Used to publish
+// snapshots of the decoded data to the UI. The raw input data and the module
+// type are not part of the spans and have to be filled in by the caller.
+DecodedMdppSampleEvent LIBMVME_MDPP_DECODE_EXPORT to_decoded_event(const MdppSampleSpans &spans);
+
 using TraceBuffer = QList<ChannelTrace>;
 using ModuleTraceHistory = std::vector<TraceBuffer>; // indexed by the traces channel number
 using TraceHistoryMap = QMap<QUuid, ModuleTraceHistory>;
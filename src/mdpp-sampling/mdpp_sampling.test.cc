@@ -1,7 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <numeric>
+#include <random>
+
+#include "mdpp-sampling/mdpp_decode.h"
 #include "mdpp-sampling/waveform_interpolation.h"
 #include <mesytec-mvlc/cpp_compat.h>
+#include <mesytec-mvlc/util/protected.h>
 #include <mesytec-mvlc/util/fmt.h>
 #include <string_view>
 #include <QVector>
@@ -154,3 +160,156 @@ TEST(MdppSampling, interpolate_move_window)
     }
 }
 #endif
+
+// Builds an MDPP-32 SCP event with sampling enabled for the given channels.
+static std::vector<u32> make_mdpp32_scp_event(const std::vector<s32> &channels, size_t samplesPerChannel, std::mt19937 &rng)
+{
+    std::uniform_int_distribution<u32> sampleDist(0, (1u << mdpp_sampling::SampleBits) - 1);
+    std::uniform_int_distribution<u32> phaseDist(0, 511);
+
+    std::vector<u32> result;
+    result.push_back(0x40000000u | (0x0du << 16)); // module header, length is not checked
+
+    for (auto channel: channels)
+    {
+        result.push_back(0x10200000u | (static_cast<u32>(channel) << 16) | 0x1234u); // amplitude
+        // samples header: debug=0, config=0x03, phase, length in words
+        result.push_back(0x30000000u | (0x03u << 19) | (phaseDist(rng) << 10) | (samplesPerChannel / 2));
+
+        for (size_t i = 0; i < samplesPerChannel / 2; ++i)
+            result.push_back(0x30000000u | (sampleDist(rng) << mdpp_sampling::SampleBits) | sampleDist(rng));
+    }
+
+    result.push_back(0x20001234u); // extended timestamp
+    result.push_back(0xc0000000u | 0x1abcdefu); // end of event with timestamp
+    return result;
+}
+
+struct SpanStorage
+{
+    std::vector<u32> storage;
+    mdpp_sampling::MdppSampleSpans spans;
+
+    SpanStorage(unsigned maxChannels, unsigned maxSamples)
+        : storage((mdpp_sampling::sample_spans_storage_size(maxChannels, maxSamples) + sizeof(u32) - 1) / sizeof(u32))
+        , spans(mdpp_sampling::make_sample_spans(storage.data(), maxChannels, maxSamples))
+    { }
+};
+
+TEST(MdppSampling, span_decoder_matches_decoder)
+{
+    std::mt19937 rng(1234);
+    const std::vector<s32> channels = { 3, 0, 31, 17, 5 };
+    const auto data = make_mdpp32_scp_event(channels, 64, rng);
+
+    auto decoded = mdpp_sampling::decode_mdpp_samples(data.data(), data.size(), "mdpp32_scp");
+
+    SpanStorage out(32, 64);
+    ASSERT_TRUE(mdpp_sampling::decode_mdpp_samples_into(data.data(), data.size(), "mdpp32_scp", out.spans));
+
+    ASSERT_EQ(out.spans.header, decoded.header);
+    ASSERT_EQ(out.spans.timestamp, decoded.timestamp);
+    ASSERT_EQ(out.spans.headerModuleId, decoded.headerModuleId);
+    ASSERT_EQ(out.spans.droppedSamples, 0u);
+    ASSERT_EQ(out.spans.channelCount, channels.size());
+    ASSERT_EQ(decoded.traces.size(), static_cast<int>(channels.size()));
+
+    for (size_t i = 0; i < channels.size(); ++i)
+    {
+        const auto &trace = decoded.traces[i];
+        const auto ch = out.spans.channels[i];
+
+        ASSERT_EQ(ch, trace.channel);
+        ASSERT_EQ(out.spans.traceHeaders[ch].value, trace.traceHeader.value);
+        ASSERT_EQ(out.spans.sampleCounts[ch], trace.size());
+
+        for (size_t si = 0; si < trace.size(); ++si)
+            ASSERT_EQ(out.spans.channelSamples(ch)[si], trace.samples[si]);
+    }
+
+    // The conversion used for UI snapshots yields the same traces.
+    auto converted = mdpp_sampling::to_decoded_event(out.spans);
+    ASSERT_EQ(converted.traces.size(), decoded.traces.size());
+
+    for (int i = 0; i < decoded.traces.size(); ++i)
+    {
+        ASSERT_EQ(converted.traces[i].channel, decoded.traces[i].channel);
+        ASSERT_EQ(converted.traces[i].samples, decoded.traces[i].samples);
+    }
+
+    // Samples and channels exceeding the span dimensions are dropped.
+    SpanStorage small(16, 10);
+    ASSERT_TRUE(mdpp_sampling::decode_mdpp_samples_into(data.data(), data.size(), "mdpp32_scp", small.spans));
+    ASSERT_EQ(small.spans.channelCount, 3u); // channels 3, 0, 5
+    ASSERT_EQ(small.spans.sampleCounts[3], 10u);
+    ASSERT_EQ(small.spans.droppedSamples, 3 * (64 - 10) + 2 * 64);
+    ASSERT_EQ(small.spans.channelSamples(5)[9], decoded.traces[4].samples[9]);
+
+    // Samples without a preceding channel word are an error.
+    const std::vector<u32> bad = { 0x400d0003, 0x30000000, 0x30000001, 0xc0000000 };
+    ASSERT_FALSE(mdpp_sampling::decode_mdpp_samples_into(bad.data(), bad.size(), "mdpp32_scp", out.spans));
+    ASSERT_EQ(out.spans.channelCount, 0u);
+
+    ASSERT_EQ(mdpp_sampling::get_span_decoder_function("mdpp32_foo"), nullptr);
+}
+
+// Compares the allocating decoder with the span decoder for MDPP-32 SCP events
+// with 32 channels of 64 samples each. Prints the event rates of both.
+TEST(MdppSampling, span_decoder_benchmark)
+{
+    std::mt19937 rng(4321);
+    std::vector<s32> channels(32);
+    std::iota(std::begin(channels), std::end(channels), 0);
+
+    std::vector<std::vector<u32>> events;
+
+    for (int i = 0; i < 16; ++i)
+        events.emplace_back(make_mdpp32_scp_event(channels, 64, rng));
+
+    const size_t EventCount = 5000;
+
+    auto measure = [&] (auto &&decode_one)
+    {
+        auto tStart = std::chrono::steady_clock::now();
+        size_t sampleSum = 0;
+
+        for (size_t i = 0; i < EventCount; ++i)
+            sampleSum += decode_one(events[i % events.size()]);
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tStart;
+        return std::make_pair(EventCount / elapsed.count(), sampleSum);
+    };
+
+    auto decoder = mdpp_sampling::get_decoder_function("mdpp32_scp");
+    mesytec::mvlc::Protected<mdpp_sampling::DecodedMdppSampleEvent> shared;
+
+    // The previous analysis path: decode into a new event, then move it into
+    // the shared event under the lock.
+    auto [allocRate, allocSamples] = measure([&] (const std::vector<u32> &data)
+    {
+        auto decoded = decoder(data.data(), data.size(), {});
+        size_t samples = 0;
+        for (const auto &trace: decoded.traces)
+            samples += trace.size();
+        shared.access().ref() = std::move(decoded);
+        return samples;
+    });
+
+    auto spanDecoder = mdpp_sampling::get_span_decoder_function("mdpp32_scp");
+    SpanStorage out(32, 64);
+
+    auto [spanRate, spanSamples] = measure([&] (const std::vector<u32> &data)
+    {
+        spanDecoder(data.data(), data.size(), out.spans);
+        size_t samples = 0;
+        for (unsigned i = 0; i < out.spans.channelCount; ++i)
+            samples += out.spans.sampleCounts[out.spans.channels[i]];
+        return samples;
+    });
+
+    ASSERT_EQ(allocSamples, spanSamples);
+    ASSERT_EQ(spanSamples, EventCount * 32 * 64);
+
+    fmt::print("mdpp32_scp 32x64 samples: decoder: {:.0f} events/s, span decoder: {:.0f} events/s, speedup {:.1f}x\n",
+        allocRate, spanRate, spanRate / allocRate);
+}
@@ -3,9 +3,16 @@
 #include <cassert>
 #include <cmath>
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
 
 #include <mesytec-mvlc/util/algo.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace mesytec::mvme::waveforms
 {
 
@@ -32,89 +39,219 @@ static double sinc(double phase) // one period runs 0...1, minima at +-0.5
     return (sinc);
 }
 
-// phase= 0...1 (= a2...a3)
-static double ipol(double a0, double a1, double a2, double a3, double a4, double a5, double phase) // one period runs 0...1, minima at +-0.5
+static const u32 MinInterpolationSamples = 6;
+static_assert(InterpolationTable::Taps == MinInterpolationSamples);
+
+InterpolationTable make_interpolation_table(u32 factor)
 {
-#define LIN_INT 0 // 1 for linear interpolation
+    InterpolationTable result;
+
+    if (factor <= 1)
+        return result;
+
+    const u32 Taps = InterpolationTable::Taps;
+    const double factor_1 = 1.0 / factor;
+
+    result.factor = factor;
+    result.phases.resize(factor);
+    result.coefficients.resize(Taps * factor);
+
+    // Phase 0 is the original sample. Use exact weights instead of
+    // sinc(integer) which is only close to 0 due to rounding.
+    result.phases[0] = 0.0;
+    for (u32 tap=0; tap<Taps; ++tap)
+        result.coefficients[tap * factor] = tap == (Taps - 1) / 2 ? 1.0 : 0.0;
 
-    double ipol;
-    if (!LIN_INT)
+    for (u32 k=1; k<factor; ++k)
     {
-        // phase runs from 0 (position A1) to 1 (position A2)
-        ipol = a0 * sinc(-2.0 - phase) + a1 * sinc(-1 - phase) + a2 * sinc(-phase) + a3 * sinc(1.0 - phase) + a4 * sinc(2.0 - phase) + a5 * sinc(3.0 - phase);
+        // phase runs from 0 (position a2) to 1 (position a3). The taps are
+        // the window samples a0..a5.
+        const double phase = k * factor_1;
+        result.phases[k] = phase;
+        result.coefficients[0 * factor + k] = sinc(-2.0 - phase);
+        result.coefficients[1 * factor + k] = sinc(-1 - phase);
+        result.coefficients[2 * factor + k] = sinc(-phase);
+        result.coefficients[3 * factor + k] = sinc(1.0 - phase);
+        result.coefficients[4 * factor + k] = sinc(2.0 - phase);
+        result.coefficients[5 * factor + k] = sinc(3.0 - phase);
     }
-    else
-        ipol = a2 + (phase * (a3 - a2)); // only linear interpolation
 
-    return (ipol);
+    return result;
 }
 
-inline void emit(const span<const double> &xs, const span<const double> &ys, EmitterFun emitter)
+const InterpolationTable &get_interpolation_table(u32 factor)
 {
-    assert(xs.size() == ys.size());
+    static std::mutex mutex;
+    static std::map<u32, std::unique_ptr<InterpolationTable>> tables;
+
+    std::lock_guard<std::mutex> guard(mutex);
+    auto &table = tables[factor];
+
+    if (!table)
+        table = std::make_unique<InterpolationTable>(make_interpolation_table(factor));
 
-    return mvlc::util::for_each(std::begin(xs), std::end(xs), std::begin(ys), emitter);
+    return *table;
 }
 
-inline void emit(const double *xsBegin, const double *xsEnd, const double *ysBegin, EmitterFun emitter)
+size_t interpolated_size(size_t inputSize, u32 factor)
 {
-    return mvlc::util::for_each(xsBegin, xsEnd, ysBegin, emitter);
+    if (factor <= 1 || inputSize < MinInterpolationSamples)
+        return inputSize;
+
+    // Each window produces the original sample at the window center plus
+    // factor-1 interpolated points. The samples before the first and after
+    // the last window center are copied.
+    const size_t windowCount = inputSize - MinInterpolationSamples + 1;
+    return windowCount * factor + (MinInterpolationSamples - 1);
 }
 
-static const u32 MinInterpolationSamples = 6;
+namespace
+{
 
-void interpolate(const span<const double> &xs, const span<const double> &ys, u32 factor, EmitterFun emitter)
+// Computes the interpolated points for phases [kBegin, kEnd) of the window
+// starting at wys. The sum is evaluated from tap 0 to tap 5 like in the
+// SSE2 version.
+inline void interpolate_window_scalar(
+    const InterpolationTable &table, const double *wys, double sampleX, double dtSample,
+    u32 kBegin, u32 kEnd, double *outXs, double *outYs)
 {
-    using mvlc::util::span;
+    const u32 factor = table.factor;
+    const double *phases = table.phases.data();
+    const double *c = table.coefficients.data();
 
-    assert(xs.size() == ys.size());
-    if (xs.size() != ys.size())
-        return;
+    for (u32 k=kBegin; k<kEnd; ++k)
+    {
+        outXs[k] = sampleX + phases[k] * dtSample;
+        outYs[k] = wys[0] * c[0 * factor + k] + wys[1] * c[1 * factor + k]
+            + wys[2] * c[2 * factor + k] + wys[3] * c[3 * factor + k]
+            + wys[4] * c[4 * factor + k] + wys[5] * c[5 * factor + k];
+    }
+}
+
+#ifdef __SSE2__
+// Two phases per iteration. No fused multiply-add is available with SSE2 so
+// the results are bitwise identical to the scalar version.
+inline u32 interpolate_window_sse2(
+    const InterpolationTable &table, const double *wys, double sampleX, double dtSample,
+    u32 kBegin, double *outXs, double *outYs)
+{
+    const u32 factor = table.factor;
+    const double *phases = table.phases.data();
+    const double *c = table.coefficients.data();
+
+    const __m128d a0 = _mm_set1_pd(wys[0]);
+    const __m128d a1 = _mm_set1_pd(wys[1]);
+    const __m128d a2 = _mm_set1_pd(wys[2]);
+    const __m128d a3 = _mm_set1_pd(wys[3]);
+    const __m128d a4 = _mm_set1_pd(wys[4]);
+    const __m128d a5 = _mm_set1_pd(wys[5]);
+    const __m128d x0 = _mm_set1_pd(sampleX);
+    const __m128d dx = _mm_set1_pd(dtSample);
+
+    u32 k = kBegin;
+
+    for (; k + 2 <= factor; k += 2)
+    {
+        __m128d x = _mm_add_pd(x0, _mm_mul_pd(_mm_loadu_pd(phases + k), dx));
+
+        __m128d y = _mm_mul_pd(a0, _mm_loadu_pd(c + 0 * factor + k));
+        y = _mm_add_pd(y, _mm_mul_pd(a1, _mm_loadu_pd(c + 1 * factor + k)));
+        y = _mm_add_pd(y, _mm_mul_pd(a2, _mm_loadu_pd(c + 2 * factor + k)));
+        y = _mm_add_pd(y, _mm_mul_pd(a3, _mm_loadu_pd(c + 3 * factor + k)));
+        y = _mm_add_pd(y, _mm_mul_pd(a4, _mm_loadu_pd(c + 4 * factor + k)));
+        y = _mm_add_pd(y, _mm_mul_pd(a5, _mm_loadu_pd(c + 5 * factor + k)));
+
+        _mm_storeu_pd(outXs + k, x);
+        _mm_storeu_pd(outYs + k, y);
+    }
+
+    return k;
+}
+#endif
+
+}
 
-    if (factor <= 1 || xs.size() < MinInterpolationSamples)
+void interpolate(const InterpolationTable &table,
+                 const double *xs, const double *ys, size_t size,
+                 double *outXs, double *outYs)
+{
+    const u32 factor = table.factor;
+
+    if (factor <= 1 || size < MinInterpolationSamples)
     {
-        emit(xs.begin(), xs.end(), ys.begin(), emitter);
+        std::copy(xs, xs + size, outXs);
+        std::copy(ys, ys + size, outYs);
         return;
     }
 
     const size_t WindowMid = (MinInterpolationSamples - 1) / 2;
-    const double factor_1 = 1.0 / factor;
+    const size_t windowCount = size - MinInterpolationSamples + 1;
     const double dtSample = xs[1] - xs[0];
-    const auto samplesEnd = std::end(xs);
-    auto windowStart = std::begin(xs);
-    auto windowEnd = windowStart + MinInterpolationSamples;
 
-    // Emit the first few input samples before interpolation starts.
-    emit(windowStart, windowStart+WindowMid, std::begin(ys), emitter);
+    // Copy the first few input samples before interpolation starts.
+    std::copy(xs, xs + WindowMid, outXs);
+    std::copy(ys, ys + WindowMid, outYs);
+    outXs += WindowMid;
+    outYs += WindowMid;
 
-    while (windowEnd <= samplesEnd)
+    for (size_t window=0; window<windowCount; ++window, outXs += factor, outYs += factor)
     {
-        assert(std::distance(windowStart, windowEnd) == MinInterpolationSamples);
+        const double *wys = ys + window;
+        const double sampleX = xs[window + WindowMid];
+
+        // The original sample.
+        outXs[0] = sampleX;
+        outYs[0] = wys[WindowMid];
+
+        u32 k = 1;
+#ifdef __SSE2__
+        k = interpolate_window_sse2(table, wys, sampleX, dtSample, k, outXs, outYs);
+#endif
+        interpolate_window_scalar(table, wys, sampleX, dtSample, k, factor, outXs, outYs);
+    }
 
-        const auto windowOffset = std::distance(std::begin(xs), windowStart);
-        span<const double> wxs(windowStart, MinInterpolationSamples);
-        span<const double> wys(std::begin(ys) + windowOffset, MinInterpolationSamples);
+    // Copy the last few samples after interpolation ends.
+    std::copy(xs + windowCount + WindowMid, xs + size, outXs);
+    std::copy(ys + windowCount + WindowMid, ys + size, outYs);
+}
+
+void interpolate(const InterpolationTable &table, const waveforms::Trace &input, waveforms::Trace &output)
+{
+    assert(input.xs.size() == input.ys.size());
+    const size_t inputSize = std::min(input.xs.size(), input.ys.size());
+    const size_t outputSize = interpolated_size(inputSize, table.factor);
 
-        emitter(wxs[WindowMid], wys[WindowMid]); // Emit the original sample.
+    output.xs.resize(outputSize);
+    output.ys.resize(outputSize);
+    interpolate(table, input.xs.data(), input.ys.data(), inputSize, output.xs.data(), output.ys.data());
+    output.meta = input.meta;
+}
 
-        const auto sampleX = wxs[WindowMid];
+void interpolate(const InterpolationTable &table, const TraceHistory &inputs, TraceHistory &outputs)
+{
+    outputs.resize(inputs.size());
 
-        for (size_t step=0; step<factor-1; ++step)
-        {
-            double phase = (step+1) * factor_1;
-            double x = sampleX + phase * dtSample;
-            double y = ipol(wys[0], wys[1], wys[2], wys[3], wys[4], wys[5], phase);
-            emitter(x, y);
-        }
+    for (size_t i=0; i<inputs.size(); ++i)
+        interpolate(table, inputs[i], outputs[i]);
+}
 
-        // Done with this window, advance both start and end by one.
-        ++windowStart;
-        ++windowEnd;
-    }
+// EmitterFun based wrappers
 
-    // Emit the last few samples after interpolation ends.
-    const auto windowOffset = std::distance(std::begin(xs), windowStart);
-    emit(windowStart+WindowMid, samplesEnd, std::begin(ys) + windowOffset + WindowMid, emitter);
+void interpolate(const span<const double> &xs, const span<const double> &ys, u32 factor, EmitterFun emitter)
+{
+    assert(xs.size() == ys.size());
+    if (xs.size() != ys.size())
+        return;
+
+    thread_local std::vector<double> outXs;
+    thread_local std::vector<double> outYs;
+
+    const size_t outputSize = interpolated_size(xs.size(), factor);
+    outXs.resize(outputSize);
+    outYs.resize(outputSize);
+
+    interpolate(get_interpolation_table(factor), xs.data(), ys.data(), xs.size(), outXs.data(), outYs.data());
+    mvlc::util::for_each(std::begin(outXs), std::end(outXs), std::begin(outYs), emitter);
 }
 
 void interpolate(const mvlc::util::span<const s16> &samples, double dtSample, u32 factor, EmitterFun emitter)
@@ -133,25 +270,31 @@ void interpolate(const mvlc::util::span<const s16> &samples, double dtSample, u3
 
 void interpolate(const waveforms::Trace &input, waveforms::Trace &output, u32 factor)
 {
-    auto emitter = [&output] (double x, double y)
-    {
-        output.push_back(x, y);
-    };
-
-    output.clear();
-    waveforms::interpolate(input.xs, input.ys, factor, emitter);
-    output.meta = input.meta;
+    interpolate(get_interpolation_table(factor), input, output);
 }
 
 void interpolate(const span<const s16> &samples, double dtSample, u32 factor, waveforms::Trace &output)
 {
-    auto emitter = [&output] (double x, double y)
-    {
-        output.push_back(x, y);
-    };
+    const size_t size = samples.size();
+    const size_t outputSize = interpolated_size(size, factor);
 
     output.clear();
-    waveforms::interpolate(samples, dtSample, factor, emitter);
+    output.xs.resize(size);
+    output.ys.resize(size);
+
+    for (size_t i=0; i<size; ++i)
+    {
+        output.xs[i] = i * dtSample;
+        output.ys[i] = samples[i];
+    }
+
+    if (outputSize == size)
+        return;
+
+    waveforms::Trace input;
+    std::swap(input.xs, output.xs);
+    std::swap(input.ys, output.ys);
+    interpolate(get_interpolation_table(factor), input, output);
 }
 
 }
@@ -2,6 +2,7 @@
 #define C9134348_739A_4F90_B3CA_B790902989BF
 
 #include <functional>
+#include <vector>
 
 #include "mdpp-sampling/waveform_traces.h"
 #include "typedefs.h"
@@ -28,6 +29,55 @@ void interpolate(const waveforms::Trace &input, waveforms::Trace &output, u32 fa
 // From raw samples to interpolated trace. The output trace is cleared before writing.
 void interpolate(const span<const s16> &samples, double dtSample, u32 factor, waveforms::Trace &output);
 
+// Polyphase interpolation
+// -----------------------
+// The interpolated points between two samples always use the same phases
+// 1/factor, 2/factor, ... so the sinc() values only depend on the factor and
+// can be computed once. The table based functions below produce the same
+// results as the EmitterFun based interpolate() above but write whole traces
+// into contiguous output buffers and compute multiple points at once using
+// SIMD instructions where available. The interpolate() overloads above are
+// implemented using these.
+
+struct InterpolationTable
+{
+    // Number of taps of the windowed sinc filter.
+    static const u32 Taps = 6;
+
+    u32 factor = 0;
+    // phases[k] = k / factor, k in [0, factor)
+    std::vector<double> phases;
+    // Filter coefficients, phase contiguous: coefficients[tap * factor + k]
+    // is the weight of tap 'tap' for phase k.
+    std::vector<double> coefficients;
+};
+
+// Computes the coefficients for the given factor. Factors <= 1 result in an
+// empty table which makes the interpolation functions copy the input.
+InterpolationTable make_interpolation_table(u32 factor);
+
+// Returns a cached table for the given factor. Thread-safe, the returned
+// reference stays valid for the lifetime of the program.
+const InterpolationTable &get_interpolation_table(u32 factor);
+
+// Number of points produced when interpolating inputSize samples.
+size_t interpolated_size(size_t inputSize, u32 factor);
+
+// Interpolates 'size' input points into outXs and outYs which must have room
+// for interpolated_size(size, table.factor) elements. The input x values must
+// be equidistant.
+void interpolate(const InterpolationTable &table,
+                 const double *xs, const double *ys, size_t size,
+                 double *outXs, double *outYs);
+
+// Resizes the output trace and writes the interpolated points. Copies the
+// input meta data.
+void interpolate(const InterpolationTable &table, const waveforms::Trace &input, waveforms::Trace &output);
+
+// Interpolates a batch of traces. outputs is resized to the size of inputs,
+// existing output traces are reused to avoid reallocations.
+void interpolate(const InterpolationTable &table, const TraceHistory &inputs, TraceHistory &outputs);
+
 }
 
 #endif /* C9134348_739A_4F90_B3CA_B790902989BF */
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <cmath>
+#include <random>
 #include "mdpp-sampling/waveform_interpolation.h"
 #include <mesytec-mvlc/cpp_compat.h>
 #include <mesytec-mvlc/util/fmt.h>
@@ -27,6 +30,194 @@ TEST(WaveformInterpolation, interpolate_no_interpolation)
 {
 }
 
+namespace
+{
+
+// The original point by point implementation evaluating the windowed sinc for
+// each tap of each output point. Used as the reference for the table based
+// interpolation.
+double reference_sinc(double phase)
+{
+    const double Limit = 3.0;
+
+    if (phase == 0)
+        return 1.0;
+
+    if (phase < -Limit || phase > Limit)
+        return 0.0;
+
+    return ((std::sin(phase * M_PI)) / (phase * M_PI)) * ((std::sin(phase * M_PI / Limit)) / (phase * M_PI / Limit));
+}
+
+waveforms::Trace reference_interpolate(const waveforms::Trace &input, u32 factor)
+{
+    const size_t size = input.size();
+
+    if (factor <= 1 || size < 6)
+        return input;
+
+    waveforms::Trace result;
+    const auto &xs = input.xs;
+    const auto &ys = input.ys;
+    const double factor_1 = 1.0 / factor;
+    const double dtSample = xs[1] - xs[0];
+
+    result.push_back(xs[0], ys[0]);
+    result.push_back(xs[1], ys[1]);
+
+    for (size_t w=0; w+6<=size; ++w)
+    {
+        const double *a = ys.data() + w;
+        result.push_back(xs[w+2], a[2]);
+
+        for (size_t step=0; step<factor-1; ++step)
+        {
+            double phase = (step+1) * factor_1;
+            double y = a[0] * reference_sinc(-2.0 - phase) + a[1] * reference_sinc(-1 - phase)
+                + a[2] * reference_sinc(-phase) + a[3] * reference_sinc(1.0 - phase)
+                + a[4] * reference_sinc(2.0 - phase) + a[5] * reference_sinc(3.0 - phase);
+            result.push_back(xs[w+2] + phase * dtSample, y);
+        }
+    }
+
+    for (size_t i=size-3; i<size; ++i)
+        result.push_back(xs[i], ys[i]);
+
+    return result;
+}
+
+waveforms::Trace make_random_trace(size_t size, double dtSample, std::mt19937 &rng)
+{
+    std::uniform_int_distribution<s16> dist(-8192, 8191);
+    waveforms::Trace result;
+
+    for (size_t i=0; i<size; ++i)
+        result.push_back(i * dtSample + 0.25, dist(rng));
+
+    return result;
+}
+
+void expect_traces_near(const waveforms::Trace &a, const waveforms::Trace &b)
+{
+    ASSERT_EQ(a.size(), b.size());
+
+    for (size_t i=0; i<a.size(); ++i)
+    {
+        ASSERT_NEAR(a.xs[i], b.xs[i], 1e-9) << "i=" << i;
+        ASSERT_NEAR(a.ys[i], b.ys[i], 1e-9) << "i=" << i;
+    }
+}
+
+}
+
+TEST(WaveformInterpolation, table_matches_reference)
+{
+    std::mt19937 rng(1234);
+
+    for (u32 factor: { 0u, 1u, 2u, 3u, 4u, 5u, 7u, 10u, 16u, 33u })
+    {
+        const auto &table = waveforms::get_interpolation_table(factor);
+        ASSERT_EQ(&table, &waveforms::get_interpolation_table(factor));
+
+        for (size_t size: { 0u, 1u, 5u, 6u, 7u, 28u, 64u, 129u })
+        {
+            auto input = make_random_trace(size, 12.5, rng);
+            auto expected = reference_interpolate(input, factor);
+
+            ASSERT_EQ(waveforms::interpolated_size(size, factor), expected.size());
+
+            waveforms::Trace output;
+            waveforms::interpolate(table, input, output);
+            expect_traces_near(output, expected);
+
+            // The Trace wrapper and the emitter based interpolate()
+            waveforms::Trace wrapperOutput;
+            waveforms::interpolate(input, wrapperOutput, factor);
+            ASSERT_EQ(output, wrapperOutput);
+
+            waveforms::Trace emitterOutput;
+            waveforms::interpolate(input.xs, input.ys, factor,
+                [&emitterOutput] (double x, double y) { emitterOutput.push_back(x, y); });
+            ASSERT_EQ(output.xs, emitterOutput.xs);
+            ASSERT_EQ(output.ys, emitterOutput.ys);
+        }
+    }
+
+    // Known values from the original implementation.
+    {
+        waveforms::Trace input(std::vector<double>{0, 1, 2, 3, 4, 5}, std::vector<double>{4, 5, 6, 5, 3, 5});
+        waveforms::Trace output;
+        waveforms::interpolate(input, output, 10);
+
+        const std::vector<double> expectedYs = { 4, 5, 6, 6.00896, 5.99537, 5.96031, 5.90397, 5.82529, 5.72194, 5.59065, 5.42797, 5.2313, 5, 3, 5 };
+        ASSERT_EQ(output.size(), expectedYs.size());
+
+        for (size_t i=0; i<expectedYs.size(); ++i)
+            ASSERT_NEAR(output.ys[i], expectedYs[i], 0.00001);
+    }
+}
+
+TEST(WaveformInterpolation, table_batch)
+{
+    std::mt19937 rng(4321);
+    const u32 factor = 10;
+    const auto &table = waveforms::get_interpolation_table(factor);
+
+    waveforms::TraceHistory inputs;
+    for (size_t i=0; i<10; ++i)
+    {
+        inputs.emplace_back(make_random_trace(16 + i * 7, 1.0, rng));
+        inputs.back().meta["channel"] = static_cast<u32>(i);
+    }
+
+    // Outputs are reused and resized.
+    waveforms::TraceHistory outputs(3);
+    outputs[0] = make_random_trace(1000, 1.0, rng);
+
+    waveforms::interpolate(table, inputs, outputs);
+    ASSERT_EQ(outputs.size(), inputs.size());
+
+    for (size_t i=0; i<inputs.size(); ++i)
+    {
+        expect_traces_near(outputs[i], reference_interpolate(inputs[i], factor));
+        ASSERT_EQ(outputs[i].meta, inputs[i].meta);
+    }
+}
+
+TEST(WaveformInterpolation, table_benchmark)
+{
+    std::mt19937 rng(42);
+    const u32 factor = 10;
+    const size_t TraceCount = 2000;
+    waveforms::TraceHistory inputs;
+
+    for (size_t i=0; i<TraceCount; ++i)
+        inputs.emplace_back(make_random_trace(64, 12.5, rng));
+
+    using Clock = std::chrono::steady_clock;
+
+    auto tReference = Clock::now();
+    size_t referencePoints = 0;
+    for (const auto &input: inputs)
+        referencePoints += reference_interpolate(input, factor).size();
+    auto referenceElapsed = std::chrono::duration<double>(Clock::now() - tReference).count();
+
+    waveforms::TraceHistory outputs;
+    auto tTable = Clock::now();
+    waveforms::interpolate(waveforms::get_interpolation_table(factor), inputs, outputs);
+    auto tableElapsed = std::chrono::duration<double>(Clock::now() - tTable).count();
+
+    size_t tablePoints = 0;
+    for (const auto &output: outputs)
+        tablePoints += output.size();
+
+    ASSERT_EQ(referencePoints, tablePoints);
+
+    fmt::print("interpolation 64 samples x{}: reference: {:.1f} Mpoints/s, table: {:.1f} Mpoints/s, speedup {:.1f}x\n",
+        factor, referencePoints / referenceElapsed * 1e-6, tablePoints / tableElapsed * 1e-6,
+        referenceElapsed / tableElapsed);
+}
+
 #if 0
 TEST(MdppSampling, interpolate_no_interpolation)
 {
@@ -252,6 +252,7 @@ size_t post_process_waveforms(
         [maxDepth] (auto &traces) { maybe_shrink_trace_history(traces, maxDepth); });
 
     size_t tracesProcessed = 0;
+    const auto &ipolTable = waveforms::get_interpolation_table(std::max(interpolationFactor, 0));
 
     for (size_t chan=0; chan<analysisTraceData.size(); ++chan)
     {
@@ -301,7 +302,7 @@ size_t post_process_waveforms(
             rawDestTrace.meta = inputTrace.meta;
             ipolDestTrace.meta = inputTrace.meta;
             waveforms::scale_x_values(inputTrace, rawDestTrace, dtSample, phase);
-            waveforms::interpolate(rawDestTrace, ipolDestTrace, interpolationFactor);
+            waveforms::interpolate(ipolTable, rawDestTrace, ipolDestTrace);
 
             rawDestTraces.push_front(std::move(rawDestTrace));
             ipolDestTraces.push_front(std::move(ipolDestTrace));
@@ -329,6 +330,7 @@ size_t post_process_waveform_snapshot(
     rawDisplayTraces.resize(analysisTraceData.size());
     interpolatedDisplayTraces.resize(analysisTraceData.size());
     size_t tracesProcessed = 0;
+    const auto &ipolTable = waveforms::get_interpolation_table(std::max(interpolationFactor, 0));
 
     for (size_t chan=0; chan<analysisTraceData.size(); ++chan)
     {
@@ -376,7 +378,7 @@ size_t post_process_waveform_snapshot(
             rawDestTrace.meta = inputTrace.meta;
             ipolDestTrace.meta = inputTrace.meta;
             waveforms::scale_x_values(inputTrace, rawDestTrace, dtSample, phase);
-            waveforms::interpolate(rawDestTrace, ipolDestTrace, interpolationFactor);
+            waveforms::interpolate(ipolTable, rawDestTrace, ipolDestTrace);
             ++tracesProcessed;
         }
     }
@@ -394,17 +396,16 @@ size_t reprocess_waveforms(
 {
     interpolatedDisplayTraces.resize(rawDisplayTraces.size());
     size_t tracesProcessed = 0;
+    const auto &ipolTable = waveforms::get_interpolation_table(std::max(interpolationFactor, 0));
 
     for (size_t chan=0; chan<rawDisplayTraces.size(); ++chan)
     {
         auto &rawTraces = rawDisplayTraces[chan];
         auto &ipolTraces = interpolatedDisplayTraces[chan];
-        ipolTraces.resize(rawTraces.size());
 
         for (size_t traceIndex=0; traceIndex<rawTraces.size(); ++traceIndex)
         {
             auto &rawTrace = rawTraces[traceIndex];
-            auto &ipolTrace = ipolTraces[traceIndex];
 
             double phase = 1.0;
             u32 traceConfig = 0;
@@ -427,9 +428,10 @@ size_t reprocess_waveforms(
             }
 
             waveforms::rescale_x_values(rawTrace, dtSample, phase);
-            waveforms::interpolate(rawTrace, ipolTrace, interpolationFactor);
             ++tracesProcessed;
         }
+
+        waveforms::interpolate(ipolTable, rawTraces, ipolTraces);
     }
 
     return tracesProcessed;
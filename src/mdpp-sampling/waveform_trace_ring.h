@@ -0,0 +1,217 @@
+#ifndef E1B6A2F4_3C7D_4E59_9B08_6F2D1C8A7E35
+#define E1B6A2F4_3C7D_4E59_9B08_6F2D1C8A7E35
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "mdpp-sampling/waveform_traces.h"
+
+namespace mesytec::mvme::waveforms
+{
+
+using mvlc::u64;
+
+// Fixed layout meta data of a trace recorded by the analysis. Converted to the
+// "phase", "config" and "event_number" Trace::MetaMap entries when a snapshot
+// is taken.
+struct TraceRecordMeta
+{
+    double phase = 1.0;
+    u32 config = 0;
+    u32 eventNumber = 0;
+};
+
+// Preallocated single producer ring of trace records for one channel.
+//
+// The producer (the analysis thread) does not lock or allocate. Once the ring
+// is full the oldest record is overwritten. Readers copy records without
+// locking: each slot carries a sequence number which is odd while the
+// producer writes the slot and 2 * (recordIndex + 1) once the record is
+// committed. A reader checks the sequence number before and after copying a
+// record and discards the copy if it changed (seqlock). Readers can thus miss
+// records which are overwritten while being copied but never see torn ones.
+class TraceRing
+{
+    public:
+        TraceRing(size_t capacity, size_t maxSamples)
+            : capacity_(std::max(capacity, static_cast<size_t>(1)))
+            , maxSamples_(maxSamples)
+            , slots_(new Slot[capacity_])
+            , samples_(capacity_ * maxSamples_)
+        {
+        }
+
+        TraceRing(const TraceRing &) = delete;
+        TraceRing &operator=(const TraceRing &) = delete;
+
+        size_t capacity() const { return capacity_; }
+        size_t maxSamples() const { return maxSamples_; }
+
+        // Producer: returns storage for maxSamples() samples of the next
+        // record. Must be followed by a call to commitWrite().
+        double *beginWrite()
+        {
+            const u64 recordIndex = writeCount_.load(std::memory_order_relaxed);
+            const size_t slotIndex = recordIndex % capacity_;
+            slots_[slotIndex].seq.store(2 * recordIndex + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return samples_.data() + slotIndex * maxSamples_;
+        }
+
+        // Producer: publishes the record started by beginWrite().
+        void commitWrite(size_t sampleCount, const TraceRecordMeta &meta)
+        {
+            const u64 recordIndex = writeCount_.load(std::memory_order_relaxed);
+            auto &slot = slots_[recordIndex % capacity_];
+            slot.sampleCount = std::min(sampleCount, maxSamples_);
+            slot.meta = meta;
+            slot.seq.store(2 * (recordIndex + 1), std::memory_order_release);
+            writeCount_.store(recordIndex + 1, std::memory_order_release);
+        }
+
+        // Total number of records committed since the ring was created.
+        u64 writeCount() const { return writeCount_.load(std::memory_order_acquire); }
+
+        // Hides all records committed so far from future snapshots. Only
+        // touches reader state so it can be called while the producer is
+        // running.
+        void clear() { clearedCount_.store(writeCount(), std::memory_order_release); }
+
+        // Value of writeCount() at the time of the last clear() call.
+        u64 clearedCount() const { return clearedCount_.load(std::memory_order_acquire); }
+
+        // Copies up to maxCount of the most recent records into dest, newest
+        // first. Only records with an index less than endRecord are
+        // considered. Existing Trace objects in dest are reused. Returns the
+        // number of records copied.
+        size_t snapshot(TraceHistory &dest,
+                        size_t maxCount = std::numeric_limits<size_t>::max(),
+                        u64 endRecord = std::numeric_limits<u64>::max()) const
+        {
+            const u64 writeCount = std::min(this->writeCount(), endRecord);
+            const u64 firstRecord = std::max(
+                clearedCount_.load(std::memory_order_acquire),
+                writeCount > capacity_ ? writeCount - capacity_ : 0);
+            size_t copied = 0;
+
+            for (u64 recordIndex = writeCount; recordIndex > firstRecord && copied < maxCount; --recordIndex, ++copied)
+            {
+                const u64 expectedSeq = 2 * recordIndex;
+                const size_t slotIndex = (recordIndex - 1) % capacity_;
+                const auto &slot = slots_[slotIndex];
+
+                // The slot has been reused for a newer record. All older
+                // records are gone as well.
+                if (slot.seq.load(std::memory_order_acquire) != expectedSeq)
+                    break;
+
+                if (dest.size() <= copied)
+                    dest.resize(copied + 1);
+
+                auto &trace = dest[copied];
+                const size_t sampleCount = std::min(slot.sampleCount, maxSamples_);
+                const auto meta = slot.meta;
+                const double *samples = samples_.data() + slotIndex * maxSamples_;
+
+                trace.xs.resize(sampleCount);
+                trace.ys.resize(sampleCount);
+                if (sampleCount)
+                    std::memcpy(trace.ys.data(), samples, sampleCount * sizeof(double));
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (slot.seq.load(std::memory_order_relaxed) != expectedSeq)
+                    break;
+
+                for (size_t i=0; i<sampleCount; ++i)
+                    trace.xs[i] = i;
+
+                trace.meta.clear();
+                trace.meta["phase"] = meta.phase;
+                trace.meta["config"] = meta.config;
+                trace.meta["event_number"] = meta.eventNumber;
+            }
+
+            dest.resize(copied);
+            return copied;
+        }
+
+        size_t usedMemory() const
+        {
+            return sizeof(*this) + capacity_ * sizeof(Slot) + samples_.capacity() * sizeof(double);
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<u64> seq = 0;
+            size_t sampleCount = 0;
+            TraceRecordMeta meta;
+        };
+
+        const size_t capacity_;
+        const size_t maxSamples_;
+        std::unique_ptr<Slot[]> slots_;
+        std::vector<double> samples_;
+        std::atomic<u64> writeCount_ = 0;
+        std::atomic<u64> clearedCount_ = 0;
+};
+
+// The trace rings of all channels of a waveform sink, indexed by channel.
+struct TraceRings
+{
+    std::vector<std::unique_ptr<TraceRing>> channels;
+};
+
+// Creates one ring per entry in maxSamples, each holding up to capacity records.
+inline std::shared_ptr<TraceRings> make_trace_rings(const std::vector<size_t> &maxSamples, size_t capacity)
+{
+    auto result = std::make_shared<TraceRings>();
+
+    for (auto channelMaxSamples: maxSamples)
+        result->channels.emplace_back(std::make_unique<TraceRing>(capacity, channelMaxSamples));
+
+    return result;
+}
+
+// Snapshot of all channels, newest trace first in each channels history.
+// The producer writes one record to each channel per event. The snapshot is
+// limited to the events completed in all channels and the channel histories
+// are truncated to the same length. This way traces with the same index in
+// each history are from the same event.
+inline void snapshot(const TraceRings &rings, TraceHistories &dest,
+                     size_t maxCount = std::numeric_limits<size_t>::max())
+{
+    dest.resize(rings.channels.size());
+
+    u64 endRecord = std::numeric_limits<u64>::max();
+
+    for (const auto &ring: rings.channels)
+        endRecord = std::min(endRecord, ring->writeCount());
+
+    size_t minCopied = std::numeric_limits<size_t>::max();
+
+    for (size_t chan=0; chan<rings.channels.size(); ++chan)
+        minCopied = std::min(minCopied, rings.channels[chan]->snapshot(dest[chan], maxCount, endRecord));
+
+    for (auto &history: dest)
+        history.resize(std::min(history.size(), minCopied));
+}
+
+inline size_t get_used_memory(const TraceRings &rings)
+{
+    size_t result = sizeof(rings);
+
+    for (const auto &ring: rings.channels)
+        result += ring->usedMemory();
+
+    return result;
+}
+
+}
+
+#endif /* E1B6A2F4_3C7D_4E59_9B08_6F2D1C8A7E35 */
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include "mdpp-sampling/waveform_trace_ring.h"
+#include "typedefs.h"
+
+using namespace mesytec::mvme;
+
+namespace
+{
+
+void write_record(waveforms::TraceRing &ring, size_t sampleCount, u32 eventNumber)
+{
+    auto samples = ring.beginWrite();
+
+    for (size_t i=0; i<std::min(sampleCount, ring.maxSamples()); ++i)
+        samples[i] = eventNumber * 1000.0 + i;
+
+    waveforms::TraceRecordMeta meta;
+    meta.phase = 0.5;
+    meta.config = 42;
+    meta.eventNumber = eventNumber;
+    ring.commitWrite(sampleCount, meta);
+}
+
+}
+
+TEST(WaveformTraceRing, snapshot)
+{
+    waveforms::TraceRing ring(4, 8);
+    waveforms::TraceHistory history;
+
+    ASSERT_EQ(ring.snapshot(history), 0u);
+    ASSERT_TRUE(history.empty());
+
+    for (u32 eventNumber=0; eventNumber<3; ++eventNumber)
+        write_record(ring, eventNumber + 1, eventNumber);
+
+    ASSERT_EQ(ring.snapshot(history), 3u);
+
+    // newest first
+    for (size_t i=0; i<history.size(); ++i)
+    {
+        const auto &trace = history[i];
+        const u32 eventNumber = 2 - i;
+        ASSERT_EQ(trace.size(), eventNumber + 1);
+        ASSERT_EQ(std::get<u32>(trace.meta.at("event_number")), eventNumber);
+        ASSERT_EQ(std::get<u32>(trace.meta.at("config")), 42u);
+        ASSERT_EQ(std::get<double>(trace.meta.at("phase")), 0.5);
+
+        for (size_t s=0; s<trace.size(); ++s)
+        {
+            ASSERT_EQ(trace.xs[s], s);
+            ASSERT_EQ(trace.ys[s], eventNumber * 1000.0 + s);
+        }
+    }
+
+    // Overwrite the oldest records. Samples exceeding maxSamples are dropped.
+    for (u32 eventNumber=3; eventNumber<10; ++eventNumber)
+        write_record(ring, 20, eventNumber);
+
+    ASSERT_EQ(ring.writeCount(), 10u);
+    ASSERT_EQ(ring.snapshot(history), 4u);
+    ASSERT_EQ(std::get<u32>(history.front().meta.at("event_number")), 9u);
+    ASSERT_EQ(std::get<u32>(history.back().meta.at("event_number")), 6u);
+    ASSERT_EQ(history.front().size(), 8u);
+
+    ASSERT_EQ(ring.snapshot(history, 2), 2u);
+    ASSERT_EQ(history.size(), 2u);
+
+    ring.clear();
+    ASSERT_EQ(ring.snapshot(history), 0u);
+    write_record(ring, 1, 10);
+    ASSERT_EQ(ring.snapshot(history), 1u);
+}
+
+TEST(WaveformTraceRing, multi_channel_snapshot)
+{
+    auto rings = waveforms::make_trace_rings({ 4, 0, 16 }, 10);
+    ASSERT_EQ(rings->channels.size(), 3u);
+
+    for (u32 eventNumber=0; eventNumber<5; ++eventNumber)
+        for (auto &ring: rings->channels)
+            write_record(*ring, 4, eventNumber);
+
+    // An incomplete event: only the first channel has been written.
+    write_record(*rings->channels[0], 4, 5);
+
+    waveforms::TraceHistories histories;
+    waveforms::snapshot(*rings, histories);
+
+    ASSERT_EQ(histories.size(), 3u);
+
+    for (const auto &history: histories)
+    {
+        ASSERT_EQ(history.size(), 5u);
+        ASSERT_EQ(std::get<u32>(history.front().meta.at("event_number")), 4u);
+    }
+
+    ASSERT_EQ(histories[1].front().size(), 0u);
+    ASSERT_GT(waveforms::get_used_memory(*rings), 10 * (4 + 16) * sizeof(double));
+}
+
+TEST(WaveformTraceRing, concurrent_reader)
+{
+    const size_t MaxSamples = 64;
+    const u32 EventCount = 200000;
+    waveforms::TraceRing ring(16, MaxSamples);
+    std::atomic<bool> done = false;
+
+    std::thread producer([&]
+    {
+        for (u32 eventNumber=0; eventNumber<EventCount; ++eventNumber)
+            write_record(ring, 1 + eventNumber % MaxSamples, eventNumber);
+        done = true;
+    });
+
+    waveforms::TraceHistory history;
+    size_t snapshots = 0;
+
+    while (!done || snapshots == 0)
+    {
+        ring.snapshot(history);
+        ++snapshots;
+
+        u32 prevEventNumber = 0;
+
+        for (size_t i=0; i<history.size(); ++i)
+        {
+            const auto &trace = history[i];
+            const auto eventNumber = std::get<u32>(trace.meta.at("event_number"));
+
+            // Records are complete and consecutive, newest first.
+            ASSERT_EQ(trace.size(), 1 + eventNumber % MaxSamples);
+            ASSERT_EQ(trace.ys.front(), eventNumber * 1000.0);
+            ASSERT_EQ(trace.ys.back(), eventNumber * 1000.0 + trace.size() - 1);
+
+            if (i > 0)
+            {
+                ASSERT_EQ(eventNumber + 1, prevEventNumber);
+            }
+
+            prevEventNumber = eventNumber;
+        }
+    }
+
+    producer.join();
+
+    ASSERT_EQ(ring.snapshot(history), 16u);
+    ASSERT_EQ(std::get<u32>(history.front().meta.at("event_number")), EventCount - 1);
+}
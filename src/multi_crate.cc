@@ -1084,6 +1084,16 @@ void log_socket_work_counters(const SocketWorkPerformanceCounters &counters, con
 
     spdlog::info("{}: tx: tSend={:.2f} ms, msgs={}, {:.2f} msg/s, bytes={:.2f} MiB, {:.2f} MiB/s",
         info, counters.tSend.count() / 1000.0, counters.messagesSent, msgSendRate, mibSent, bytesSendRate);
+
+    for (size_t i=0; i<counters.workerLoads.size(); ++i)
+    {
+        const auto &load = counters.workerLoads[i];
+        auto busy = elapsed.count() ? load.tProcess.count() / 1000.0 / elapsed.count() : 0.0;
+
+        spdlog::info("{}: worker{}: tProcess={:.2f} ms, msgs={}, bytes={:.2f} MiB, busy={:.2f}",
+            info, i, load.tProcess.count() / 1000.0, load.messagesProcessed,
+            load.bytesProcessed * 1.0 / mvlc::util::Megabytes(1), busy);
+    }
 }
 
 void mvlc_eth_readout_loop(MvlcEthReadoutLoopContext &context)
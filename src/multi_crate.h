@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <set>
+#include <vector>
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -452,10 +453,22 @@ struct LIBMVME_EXPORT SocketWorkPerformanceCounters
     size_t bytesReceived = 0;
     size_t bytesSent = 0;
 
+    // Load of the individual workers of steps which distribute their input to
+    // multiple worker threads, e.g. the parallel analysis. Empty otherwise.
+    struct WorkerLoad
+    {
+        size_t messagesProcessed = 0;
+        size_t bytesProcessed = 0;
+        std::chrono::microseconds tProcess = {};
+    };
+
+    std::vector<WorkerLoad> workerLoads;
+
     void start()
     {
         tReceive = tProcess = tSend = tTotal = {};
         messagesReceived = messagesLost = messagesSent = bytesReceived = bytesSent = 0;
+        workerLoads.clear();
         tpStart = std::chrono::steady_clock::now();
         tpStop = {};
     }
@@ -2,6 +2,7 @@
 
 #include <mesytec-mvlc/mesytec-mvlc.h>
 
+#include "analysis/a2_adapter.h"
 #include "mvlc_daq.h"
 
 using namespace mesytec::mvlc;
@@ -815,6 +816,220 @@ std::unique_ptr<AnalysisProcessingContext> make_analysis_context(const std::stri
     return make_analysis_context(analysis, vmeConfig);
 }
 
+AnalysisProcessingContext::~AnalysisProcessingContext()
+{
+    teardown_analysis_workers(*this);
+}
+
+bool setup_analysis_workers(AnalysisProcessingContext &context)
+{
+    teardown_analysis_workers(context);
+
+    if (!context.analysis || !context.asp)
+        return false;
+
+    // The workers read the same analysis config as the primary analysis. This
+    // way the a2 structures built by beginRun() match and the histograms can
+    // be merged using a2_merge_histo_storage().
+    auto analysisJson = analysis::serialize_analysis_to_json_object(
+        *context.analysis)[QStringLiteral("AnalysisNG")].toObject();
+
+    const auto url = fmt::format("inproc://analysis_crate{}_workers_{}",
+        context.crateId, fmt::ptr(&context));
+
+    context.fanoutSocket = make_push_socket();
+
+    if (int res = nng_listen(context.fanoutSocket, url.c_str(), nullptr, 0))
+    {
+        mesy_nng_error("setup_analysis_workers: nng_listen", res);
+        teardown_analysis_workers(context);
+        return false;
+    }
+
+    for (unsigned wi=0; wi<context.workerCount; ++wi)
+    {
+        auto worker = std::make_unique<AnalysisProcessingContext::Worker>();
+        worker->analysis = std::make_shared<analysis::Analysis>();
+
+        if (auto ec = worker->analysis->read(analysisJson, context.asp->vmeConfig_))
+        {
+            spdlog::error("setup_analysis_workers (crateId={}): error creating analysis for worker {}: {}",
+                context.crateId, wi, ec.message());
+            teardown_analysis_workers(context);
+            return false;
+        }
+
+        worker->socket = make_pull_socket();
+
+        if (int res = nng_dial(worker->socket, url.c_str(), nullptr, 0))
+        {
+            mesy_nng_error("setup_analysis_workers: nng_dial", res);
+            nng_close(worker->socket);
+            teardown_analysis_workers(context);
+            return false;
+        }
+
+        context.workers.emplace_back(std::move(worker));
+    }
+
+    spdlog::info("setup_analysis_workers (crateId={}): created {} analysis workers",
+        context.crateId, context.workers.size());
+
+    return true;
+}
+
+void teardown_analysis_workers(AnalysisProcessingContext &context)
+{
+    for (auto &worker: context.workers)
+        nng_close(worker->socket);
+
+    context.workers.clear();
+
+    if (nng_socket_id(context.fanoutSocket) > 0)
+        nng_close(context.fanoutSocket);
+
+    context.fanoutSocket = NNG_SOCKET_INITIALIZER;
+}
+
+void merge_analysis_workers(AnalysisProcessingContext &context)
+{
+    auto dest = context.analysis ? context.analysis->getA2AdapterState() : nullptr;
+
+    if (!dest || !dest->a2)
+        return;
+
+    for (auto &worker: context.workers)
+    {
+        std::lock_guard<std::mutex> guard(worker->mutex);
+        auto src = worker->analysis->getA2AdapterState();
+
+        if (src && src->a2)
+            a2::a2_merge_histo_storage(dest->a2, src->a2);
+    }
+}
+
+bool use_parallel_analysis(const AnalysisProcessingContext &context)
+{
+    return (!context.workers.empty() && context.analysis
+            && context.analysis->getEventOrderDependentOperators().empty());
+}
+
+namespace
+{
+
+// Feeds the events contained in a ParsedEvents message to the analysis. The
+// message header must have been removed already. Timeticks contained in the
+// message are passed to the onTimetick callback.
+template<typename OnTimetick>
+void process_parsed_events(u8 crateId, analysis::Analysis &analysis, nng_msg *msg, OnTimetick onTimetick)
+{
+    ParsedEventMessageIterator messageIter(msg);
+
+    for (auto eventData = next_event(messageIter);
+            eventData.type != EventContainer::Type::None;
+            eventData = next_event(messageIter))
+    {
+        if (eventData.type == EventContainer::Type::Readout)
+        {
+            analysis.beginEvent(eventData.readout.eventIndex);
+
+            analysis.processModuleData(crateId, eventData.readout.eventIndex,
+                eventData.readout.moduleDataList, eventData.readout.moduleCount);
+
+            analysis.endEvent(eventData.readout.eventIndex);
+        }
+        else if (eventData.type == EventContainer::Type::System && eventData.system.size)
+        {
+            auto frameInfo = mvlc::extract_frame_info(eventData.system.header[0]);
+            assert(frameInfo.type == mvlc::frame_headers::SystemEvent);
+
+            if (frameInfo.sysEventSubType == mvlc::system_event::subtype::UnixTimetick)
+                onTimetick();
+        }
+        else if (nng_msg_len(msg))
+        {
+            spdlog::warn("analysis_loop (crateId={}): incoming message contains unknown subsection '{}'",
+                crateId, *reinterpret_cast<const u8 *>(nng_msg_body(msg)));
+            break;
+        }
+    }
+}
+
+// State shared between analysis_loop() and its worker threads.
+struct AnalysisWorkerSync
+{
+    std::atomic<bool> quit = false;
+    std::atomic<size_t> messagesProcessed = 0;
+    std::atomic<size_t> runningWorkers = 0;
+    // Replay timeticks seen by the workers. Processed by the primary analysis.
+    std::atomic<size_t> timeticks = 0;
+};
+
+void analysis_worker_loop(AnalysisProcessingContext &context, size_t workerIndex, AnalysisWorkerSync &sync)
+{
+    set_thread_name(fmt::format("analysis_w{}", workerIndex).c_str());
+
+    auto &worker = *context.workers[workerIndex];
+    const auto crateId = context.crateId;
+    const bool isReplay = context.runInfo.isReplay;
+
+    spdlog::debug("entering analysis_worker_loop (crateId={}, worker={})", crateId, workerIndex);
+
+    while (!sync.quit)
+    {
+        auto [msg, res] = receive_message(worker.socket);
+
+        if (res && res != NNG_ETIMEDOUT)
+        {
+            spdlog::error("analysis_worker_loop (crateId={}, worker={}) - receive_message: {}",
+                crateId, workerIndex, nng_strerror(res));
+            break;
+        }
+        else if (res)
+            continue;
+
+        Stopwatch sw;
+        const auto msgLen = nng_msg_len(msg.get());
+
+        {
+            std::lock_guard<std::mutex> guard(worker.mutex);
+
+            process_parsed_events(crateId, *worker.analysis, msg.get(), [&]
+            {
+                if (isReplay)
+                    ++sync.timeticks;
+            });
+        }
+
+        auto tProcess = sw.interval();
+
+        {
+            auto load = worker.load.access();
+            load->messagesProcessed++;
+            load->bytesProcessed += msgLen;
+            load->tProcess += tProcess;
+        }
+
+        ++sync.messagesProcessed;
+    }
+
+    --sync.runningWorkers;
+
+    spdlog::debug("leaving analysis_worker_loop (crateId={}, worker={})", crateId, workerIndex);
+}
+
+void update_worker_loads(AnalysisProcessingContext &context)
+{
+    std::vector<SocketWorkPerformanceCounters::WorkerLoad> loads;
+
+    for (auto &worker: context.workers)
+        loads.emplace_back(worker->load.copy());
+
+    context.readerCounters().access()->workerLoads = std::move(loads);
+}
+
+} // end anon namespace
+
 LoopResult analysis_loop(AnalysisProcessingContext &context)
 {
     set_thread_name("analysis_loop");
@@ -831,6 +1046,48 @@ LoopResult analysis_loop(AnalysisProcessingContext &context)
 
     spdlog::info("entering analysis_loop (crateId={})", crateId);
 
+    const bool parallel = use_parallel_analysis(context);
+
+    if (!parallel && !context.workers.empty())
+    {
+        spdlog::warn("analysis_loop (crateId={}): parallel analysis disabled, {} operators depend on the event order",
+            crateId, context.analysis->getEventOrderDependentOperators().size());
+    }
+
+    AnalysisWorkerSync workerSync;
+    std::vector<std::thread> workerThreads;
+    size_t messagesDispatched = 0;
+    Stopwatch mergeTimer;
+
+    SocketOutputWriter fanoutWriter(context.fanoutSocket);
+    fanoutWriter.debugInfo = fmt::format("analysis_loop (crateId={}) fanout", crateId);
+    fanoutWriter.retryPredicate = [&context] { return !context.shouldQuit(); };
+
+    if (parallel)
+    {
+        // Worker histograms are merged and cleared so their state must not be
+        // kept across runs.
+        auto workerRunInfo = context.runInfo;
+        workerRunInfo.keepAnalysisState = false;
+
+        for (auto &worker: context.workers)
+        {
+            // Discard messages left over from an aborted previous run.
+            while (receive_message(worker->socket, NNG_FLAG_NONBLOCK).second == 0) {}
+
+            worker->analysis->beginRun(workerRunInfo, context.asp->vmeConfig_);
+            worker->load.access().ref() = {};
+        }
+
+        workerSync.runningWorkers = context.workers.size();
+
+        for (size_t wi=0; wi<context.workers.size(); ++wi)
+            workerThreads.emplace_back(analysis_worker_loop, std::ref(context), wi, std::ref(workerSync));
+
+        mergeTimer.start();
+        spdlog::info("analysis_loop (crateId={}): using {} analysis workers", crateId, workerThreads.size());
+    }
+
     while (!error && !context.shouldQuit())
     {
         if (!context.runInfo.isReplay)
@@ -844,6 +1101,19 @@ LoopResult analysis_loop(AnalysisProcessingContext &context)
             }
         }
 
+        if (parallel)
+        {
+            for (auto n = workerSync.timeticks.exchange(0); n; --n)
+                context.analysis->processTimetick();
+
+            if (mergeTimer.get_interval() >= context.mergeInterval)
+            {
+                merge_analysis_workers(context);
+                update_worker_loads(context);
+                mergeTimer.interval();
+            }
+        }
+
         Stopwatch sw;
 
         auto [inputMsg, res] = context.inputReader()->readMessage();
@@ -902,38 +1172,26 @@ LoopResult analysis_loop(AnalysisProcessingContext &context)
             a->totalBuffersRead += 1;
         }
 
-        ParsedEventMessageIterator messageIter(inputMsg.get());
-
-        for (auto eventData = next_event(messageIter);
-                eventData.type != EventContainer::Type::None;
-                eventData = next_event(messageIter))
+        if (parallel)
         {
-            if (eventData.type == EventContainer::Type::Readout)
+            // Hand the message to the next idle worker. Blocks while all
+            // workers are busy.
+            if (int res = fanoutWriter.writeMessage(std::move(inputMsg)))
             {
-                context.analysis->beginEvent(eventData.readout.eventIndex);
-
-                context.analysis->processModuleData(crateId, eventData.readout.eventIndex,
-                    eventData.readout.moduleDataList, eventData.readout.moduleCount);
-
-                context.analysis->endEvent(eventData.readout.eventIndex);
+                spdlog::error("analysis_loop (crateId={}) - fanout send: {}", crateId, nng_strerror(res));
+                result.nngError = res;
+                break;
             }
-            else if (eventData.type == EventContainer::Type::System && eventData.system.size)
-            {
-                auto frameInfo = mvlc::extract_frame_info(eventData.system.header[0]);
-                assert(frameInfo.type == mvlc::frame_headers::SystemEvent);
 
-                if (frameInfo.sysEventSubType == mvlc::system_event::subtype::UnixTimetick)
-                {
-                    if (context.analysis && context.runInfo.isReplay)
-                        context.analysis->processTimetick();
-                }
-            }
-            else if (nng_msg_len(inputMsg.get()))
+            ++messagesDispatched;
+        }
+        else
+        {
+            process_parsed_events(crateId, *context.analysis, inputMsg.get(), [&]
             {
-                spdlog::warn("analysis_loop (crateId={}): incoming message contains unknown subsection '{}'",
-                    crateId, *reinterpret_cast<const u8 *>(nng_msg_body(inputMsg.get())));
-                break;
-            }
+                if (context.analysis && context.runInfo.isReplay)
+                    context.analysis->processTimetick();
+            });
         }
 
         auto tProcess = sw.interval();
@@ -949,6 +1207,29 @@ LoopResult analysis_loop(AnalysisProcessingContext &context)
         }
     }
 
+    if (!workerThreads.empty())
+    {
+        // Let the workers finish the already dispatched messages, then stop
+        // them and do a final merge.
+        while (workerSync.messagesProcessed < messagesDispatched
+               && workerSync.runningWorkers > 0
+               && !context.shouldQuit())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        workerSync.quit = true;
+
+        for (auto &t: workerThreads)
+            t.join();
+
+        for (auto n = workerSync.timeticks.exchange(0); n; --n)
+            context.analysis->processTimetick();
+
+        merge_analysis_workers(context);
+        update_worker_loads(context);
+    }
+
     //spdlog::info("analysis_nng: lastInputMessageNumber={}, inputBuffersLost={}, totalInput={:.2f} MiB",
     //    lastInputMessageNumber, inputBuffersLost, 1.0 * totalInputBytes / mvlc::util::Megabytes(1));
     spdlog::info("leaving analysis_loop, crateId={} (shouldQuit={})", crateId, context.shouldQuit());
@@ -1943,6 +2224,12 @@ CratePipelineStep make_multievent_splitter_step(const std::shared_ptr<MultiEvent
 
 CratePipelineStep make_analysis_step(const std::shared_ptr<AnalysisProcessingContext> &context, nng::SocketLink inputLink)
 {
+    if (context->workerCount > 1 && context->workers.empty())
+    {
+        if (!setup_analysis_workers(*context))
+            spdlog::warn("make_analysis_step: could not setup analysis workers, using serial processing");
+    }
+
     auto reader = std::make_shared<nng::SocketInputReader>(inputLink.dialer);
     reader->debugInfo = context->name();
     context->setInputReader(reader.get());
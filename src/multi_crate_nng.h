@@ -1,6 +1,8 @@
 #ifndef DF704338_EE9D_465F_9467_11BAD11A0DDF
 #define DF704338_EE9D_465F_9467_11BAD11A0DDF
 
+#include <mutex>
+
 #include "multi_crate.h"
 #include "multi_event_splitter.h"
 
@@ -218,16 +220,41 @@ struct LIBMVME_EXPORT EventBuilderContext: public AbstractJobContext
 
 struct AnalysisProcessingContext;
 
-// Consumes ParsedEventsMessageHeader type messages.
+// Consumes ParsedEventsMessageHeader type messages. If analysis workers have
+// been setup by make_analysis_step() the messages are distributed to the
+// workers and their histograms are periodically merged into the primary
+// analysis. Otherwise the messages are processed in the loop's own thread.
 LoopResult LIBMVME_EXPORT analysis_loop(AnalysisProcessingContext &context);
 
 struct LIBMVME_EXPORT AnalysisProcessingContext: public AbstractJobContext
 {
+    // Processes a subset of the incoming messages using its own copy of the
+    // primary analysis. The worker threads are started and stopped by
+    // analysis_loop().
+    struct Worker
+    {
+        std::shared_ptr<analysis::Analysis> analysis;
+        nng_socket socket = NNG_SOCKET_INITIALIZER; // pull socket, dialed to fanoutSocket
+        std::mutex mutex; // Held while processing a message or merging histograms.
+        mvlc::Protected<SocketWorkPerformanceCounters::WorkerLoad> load;
+    };
+
     u8 crateId = 0;
     RunInfo runInfo;
     std::shared_ptr<analysis::Analysis> analysis;
     std::unique_ptr<multi_crate::MinimalAnalysisServiceProvider> asp = nullptr;
 
+    // Number of parallel analysis workers. Values > 1 make
+    // make_analysis_step() create the workers. Parallel processing is
+    // disabled at runtime if any operator depends on the order of events.
+    unsigned workerCount = 1;
+    // Interval in which the worker histograms are merged into the primary analysis.
+    std::chrono::milliseconds mergeInterval = std::chrono::milliseconds(1000);
+    nng_socket fanoutSocket = NNG_SOCKET_INITIALIZER; // push socket feeding the workers
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    ~AnalysisProcessingContext() override;
+
     job_function function() override
     {
         return [this] { return analysis_loop(*this); };
@@ -237,6 +264,22 @@ struct LIBMVME_EXPORT AnalysisProcessingContext: public AbstractJobContext
 std::unique_ptr<AnalysisProcessingContext> LIBMVME_EXPORT make_analysis_context(const std::shared_ptr<analysis::Analysis> &analysis, VMEConfig *vmeConfig);
 std::unique_ptr<AnalysisProcessingContext> LIBMVME_EXPORT make_analysis_context(const std::string &filename, VMEConfig *vmeConfig);
 
+// Copies the primary analysis once per worker and links the workers to the
+// fanout socket. Called by make_analysis_step() if workerCount > 1. Returns
+// false and leaves the context without workers on error.
+bool LIBMVME_EXPORT setup_analysis_workers(AnalysisProcessingContext &context);
+void LIBMVME_EXPORT teardown_analysis_workers(AnalysisProcessingContext &context);
+
+// Adds the worker histogram contents to the primary analysis and clears the
+// worker histograms.
+void LIBMVME_EXPORT merge_analysis_workers(AnalysisProcessingContext &context);
+
+// True if analysis_loop() hands the incoming messages to the workers. False if
+// there are no workers or operators of the primary analysis depend on the
+// order of events, see Analysis::getEventOrderDependentOperators(). Call after
+// beginRun() of the primary analysis.
+bool LIBMVME_EXPORT use_parallel_analysis(const AnalysisProcessingContext &context);
+
 struct ReplayJobContext;
 
 LoopResult LIBMVME_EXPORT replay_loop(ReplayJobContext &context);
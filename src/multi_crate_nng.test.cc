@@ -1,7 +1,9 @@
+#include <deque>
 #include <gtest/gtest.h>
 #include <mesytec-mvlc/util/string_util.h>
 #include <mesytec-mvlc/util/logging.h>
 
+#include "analysis/analysis.h"
 #include "multi_crate_nng.h"
 
 using namespace mesytec;
@@ -260,3 +262,286 @@ TEST(MultiCrateNng, stress_recreate_links)
         ASSERT_EQ(nng::close_links(links), 0);
     }
 }
+
+TEST(MultiCrateNng, analysis_workers_fanout)
+{
+    VMEConfig vmeConfig;
+    auto context = make_analysis_context(std::make_shared<analysis::Analysis>(), &vmeConfig);
+    ASSERT_TRUE(context);
+    context->crateId = 1;
+    context->workerCount = 3;
+
+    ASSERT_TRUE(setup_analysis_workers(*context));
+    ASSERT_EQ(context->workers.size(), 3u);
+    ASSERT_TRUE(nng_socket_id(context->fanoutSocket) > 0);
+
+    for (const auto &worker: context->workers)
+    {
+        ASSERT_TRUE(worker->analysis);
+        ASSERT_NE(worker->analysis, context->analysis);
+        ASSERT_TRUE(nng_socket_id(worker->socket) > 0);
+    }
+
+    // Messages pushed to the fanout socket are received by exactly one worker.
+    const size_t MessageCount = 30;
+
+    for (size_t i = 0; i < MessageCount; ++i)
+    {
+        ParsedEventsMessageHeader header;
+        header.messageNumber = i + 1;
+        auto msg = allocate_prepare_message<ParsedEventsMessageHeader>(header);
+        ASSERT_EQ(nng::send_message_retry(context->fanoutSocket, msg.get()), 0);
+        msg.release();
+    }
+
+    size_t received = 0;
+
+    for (size_t attempt = 0; attempt < 100 && received < MessageCount; ++attempt)
+    {
+        for (auto &worker: context->workers)
+        {
+            while (nng::receive_message(worker->socket, NNG_FLAG_NONBLOCK).second == 0)
+                ++received;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    ASSERT_EQ(received, MessageCount);
+
+    teardown_analysis_workers(*context);
+    ASSERT_TRUE(context->workers.empty());
+    ASSERT_TRUE(nng_socket_id(context->fanoutSocket) < 0);
+}
+
+namespace
+{
+
+// Single event, single module setup for the analysis worker tests. The
+// extractor splits each data word into 4 address and 4 data bits, the data
+// is accumulated into one histogram per address.
+struct WorkerTestSetup
+{
+    VMEConfig vmeConfig;
+    QUuid eventId;
+    QUuid moduleId;
+
+    WorkerTestSetup()
+    {
+        auto eventConfig = std::make_unique<EventConfig>();
+        auto moduleConfig = std::make_unique<ModuleConfig>();
+        eventId = eventConfig->getId();
+        moduleId = moduleConfig->getId();
+        eventConfig->addModuleConfig(moduleConfig.release());
+        vmeConfig.addEventConfig(eventConfig.release());
+    }
+
+    // retainValid: adds a RetainValid operator which depends on the order of
+    // events.
+    std::pair<std::shared_ptr<analysis::Analysis>, std::shared_ptr<analysis::Histo1DSink>>
+        makeAnalysis(bool retainValid = false) const
+    {
+        auto ana = std::make_shared<analysis::Analysis>();
+
+        auto ds = std::make_shared<analysis::Extractor>();
+        ds->setFilter(MultiWordDataFilter({ DataFilter("AAAADDDD") }));
+        // The random value added by default would make the results depend on
+        // the number of workers.
+        ds->setOptions(analysis::Extractor::Options::NoAddedRandom);
+        ds->setEventId(eventId);
+        ds->setModuleId(moduleId);
+        ana->addSource(ds);
+
+        auto sink = std::make_shared<analysis::Histo1DSink>();
+        sink->connectArrayToInputSlot(0, ds->getOutput(0));
+        ana->addOperator(eventId, 1, sink);
+
+        if (retainValid)
+        {
+            auto rv = std::make_shared<analysis::RetainValid>();
+            rv->connectArrayToInputSlot(0, ds->getOutput(0));
+            ana->addOperator(eventId, 1, rv);
+        }
+
+        return { ana, sink };
+    }
+};
+
+// Messages written to the queue are handed out to analysis_loop() in order.
+struct MessageQueue: public nng::InputReader, public nng::OutputWriter
+{
+    std::deque<nng::unique_msg> messages;
+
+    int writeMessage(nng::unique_msg &&msg) override
+    {
+        messages.emplace_back(std::move(msg));
+        return 0;
+    }
+
+    std::pair<nng::unique_msg, int> readMessage() override
+    {
+        if (messages.empty())
+            return { nng::make_unique_msg(), NNG_ETIMEDOUT };
+
+        auto msg = std::move(messages.front());
+        messages.pop_front();
+        return { std::move(msg), 0 };
+    }
+};
+
+// Small messages so that the events are spread over many messages and thus
+// over all workers.
+struct TestParsedEventsWriter: public ParsedEventsMessageWriter
+{
+    MessageQueue &queue;
+    u32 messageNumber = 0;
+    nng::unique_msg msg = nng::make_unique_msg();
+
+    explicit TestParsedEventsWriter(MessageQueue &queue_): queue(queue_) {}
+
+    nng_msg *getOutputMessage() override
+    {
+        if (!msg)
+        {
+            ParsedEventsMessageHeader header;
+            header.messageNumber = ++messageNumber;
+            msg = allocate_prepare_message(header, 1024);
+        }
+
+        return msg.get();
+    }
+
+    bool flushOutputMessage() override
+    {
+        if (msg)
+            queue.writeMessage(std::move(msg));
+        msg = nng::make_unique_msg();
+        return true;
+    }
+
+    bool hasDynamic(int, int, int) override { return false; }
+};
+
+void fill_test_events(MessageQueue &queue, size_t eventCount)
+{
+    TestParsedEventsWriter writer(queue);
+
+    for (size_t ev = 0; ev < eventCount; ++ev)
+    {
+        std::array<u32, 16> words;
+
+        for (size_t i = 0; i < words.size(); ++i)
+            words[i] = (i << 4) | ((ev * 7 + i * (ev % 5)) & 0xf);
+
+        mvlc::readout_parser::ModuleData moduleData{};
+        moduleData.data.data = words.data();
+        moduleData.data.size = words.size();
+        moduleData.dynamicSize = words.size();
+
+        ASSERT_TRUE(writer.consumeReadoutEventData(0, 0, &moduleData, 1));
+    }
+
+    writer.flushOutputMessage();
+    ASSERT_EQ(send_shutdown_message(queue), 0);
+}
+
+// Runs the events through analysis_loop() using the given number of workers.
+void run_analysis(AnalysisProcessingContext &context, const VMEConfig &vmeConfig,
+    unsigned workerCount, size_t eventCount)
+{
+    MessageQueue queue;
+    fill_test_events(queue, eventCount);
+
+    context.workerCount = workerCount;
+
+    if (workerCount > 1)
+        ASSERT_TRUE(setup_analysis_workers(context));
+
+    context.analysis->beginRun(context.runInfo, &vmeConfig);
+    context.setInputReader(&queue);
+    analysis_loop(context);
+    context.setInputReader(nullptr);
+    ASSERT_TRUE(queue.messages.empty());
+}
+
+void expect_equal_histos(const analysis::Histo1DSink &a, const analysis::Histo1DSink &b)
+{
+    ASSERT_EQ(a.getNumberOfHistos(), b.getNumberOfHistos());
+    ASSERT_GT(a.getNumberOfHistos(), 0);
+    double total = 0.0;
+
+    for (s32 hi = 0; hi < a.getNumberOfHistos(); ++hi)
+    {
+        auto ha = a.getHisto(hi);
+        auto hb = b.getHisto(hi);
+        ASSERT_EQ(ha->getNumberOfBins(), hb->getNumberOfBins());
+
+        for (u32 bin = 0; bin < ha->getNumberOfBins(); ++bin)
+        {
+            ASSERT_EQ(ha->getBinContent(bin), hb->getBinContent(bin))
+                << "histo=" << hi << ", bin=" << bin;
+            total += ha->getBinContent(bin);
+        }
+    }
+
+    ASSERT_GT(total, 0.0);
+}
+
+} // end anon namespace
+
+TEST(MultiCrateNng, analysis_workers_merge_matches_serial)
+{
+    const size_t EventCount = 5000;
+    WorkerTestSetup setup;
+
+    auto [serialAnalysis, serialSink] = setup.makeAnalysis();
+    auto serialContext = make_analysis_context(serialAnalysis, &setup.vmeConfig);
+    ASSERT_TRUE(serialContext);
+    run_analysis(*serialContext, setup.vmeConfig, 1, EventCount);
+
+    auto [parallelAnalysis, parallelSink] = setup.makeAnalysis();
+    auto context = make_analysis_context(parallelAnalysis, &setup.vmeConfig);
+    ASSERT_TRUE(context);
+    run_analysis(*context, setup.vmeConfig, 3, EventCount);
+
+    ASSERT_TRUE(use_parallel_analysis(*context));
+
+    // All workers got a share of the events.
+    for (const auto &worker: context->workers)
+        ASSERT_GT(worker->load.copy().messagesProcessed, 0u);
+
+    // analysis_loop() merged the worker histograms into the primary analysis.
+    expect_equal_histos(*serialSink, *parallelSink);
+
+    // Merging again does not change the result: the worker histograms were
+    // cleared by the previous merge.
+    merge_analysis_workers(*context);
+    expect_equal_histos(*serialSink, *parallelSink);
+}
+
+TEST(MultiCrateNng, analysis_workers_serial_fallback)
+{
+    const size_t EventCount = 1000;
+    WorkerTestSetup setup;
+
+    auto [serialAnalysis, serialSink] = setup.makeAnalysis(true);
+    auto serialContext = make_analysis_context(serialAnalysis, &setup.vmeConfig);
+    ASSERT_TRUE(serialContext);
+    run_analysis(*serialContext, setup.vmeConfig, 1, EventCount);
+    ASSERT_FALSE(use_parallel_analysis(*serialContext));
+
+    auto [analysis, sink] = setup.makeAnalysis(true);
+    auto context = make_analysis_context(analysis, &setup.vmeConfig);
+    ASSERT_TRUE(context);
+    ASSERT_FALSE(analysis->getEventOrderDependentOperators().empty());
+    run_analysis(*context, setup.vmeConfig, 3, EventCount);
+
+    ASSERT_EQ(context->workers.size(), 3u);
+    ASSERT_FALSE(use_parallel_analysis(*context));
+
+    // The primary analysis processed all events, the workers none.
+    for (const auto &worker: context->workers)
+        ASSERT_EQ(worker->load.copy().messagesProcessed, 0u);
+
+    expect_equal_histos(*serialSink, *sink);
+}
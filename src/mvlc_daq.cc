@@ -27,6 +27,7 @@
 #include "mvlc/mvlc_trigger_io_script.h"
 #include "mvlc/vmeconfig_to_crateconfig.h"
 #include "mvlc/mvlc_util.h"
+#include "mvlc_listfile_zstd.h"
 #include "util/strings.h"
 #include "vme_config_scripts.h"
 #include "vme_daq.h"
@@ -546,9 +547,9 @@ mvlc::listfile::SplitListfileSetup make_listfile_setup(ListFileOutputInfo &outIn
     using namespace mesytec::mvlc;
 
     listfile::SplitListfileSetup lfSetup;
-    lfSetup.entryType = (outInfo.format == ListFileFormat::ZIP
-                            ? listfile::ZipEntryInfo::ZIP
-                            : listfile::ZipEntryInfo::LZ4);
+    lfSetup.entryType = (outInfo.format == ListFileFormat::LZ4
+                            ? listfile::ZipEntryInfo::LZ4
+                            : listfile::ZipEntryInfo::ZIP);
     lfSetup.compressLevel = outInfo.compressionLevel;
     if (outInfo.flags & ListFileOutputInfo::SplitBySize)
         lfSetup.splitMode = listfile::ZipSplitMode::SplitBySize;
@@ -566,6 +567,16 @@ mvlc::listfile::SplitListfileSetup make_listfile_setup(ListFileOutputInfo &outIn
     lfSetup.filenamePrefix = lfPrefix.toStdString();
     lfSetup.preamble = preamble;
 
+    if (outInfo.format == ListFileFormat::ZSTD)
+    {
+        // The data is compressed by a ZstdWriteHandle and stored without ZIP
+        // compression. The preamble written by the SplitZipCreator at the
+        // start of each archive has to be a zstd frame too.
+        lfSetup.compressLevel = 0;
+        if (!preamble.empty())
+            lfSetup.preamble = zstd_compress_frame(preamble.data(), preamble.size(), outInfo.compressionLevel);
+    }
+
     return lfSetup;
 }
 
@@ -0,0 +1,1389 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "mvlc_listfile_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <stdexcept>
+#include <zlib.h>
+
+#include <mesytec-mvlc/mesytec-mvlc.h>
+
+#include "mvlc_listfile_zstd.h"
+
+using namespace mesytec::mvlc;
+
+namespace mesytec::mvme_mvlc
+{
+
+namespace
+{
+
+// "MVLC" and the two format suffixes of the listfile magic as little endian
+// words.
+static const u32 MagicWordMVLC = 0x434c564du;
+static const u32 MagicWordETH = 0x4854455fu;
+static const u32 MagicWordUSB = 0x4253555fu;
+
+static const u32 EthNoHeader = 0xffffffffu;
+
+static const char IndexFileMagic[] = "MVLCIDX1";
+static const size_t IndexFileMagicLen = 8;
+
+// Size of the inflate window needed to resume decompression at a deflate
+// block boundary.
+static const size_t InflateWindowSize = 32768;
+
+bool is_preamble_event(const FrameInfo &info)
+{
+    switch (info.sysEventSubType)
+    {
+        case system_event::subtype::EndianMarker:
+        case system_event::subtype::MVMEConfig:
+        case system_event::subtype::MVLCCrateConfig:
+            return true;
+
+        default:
+            break;
+    }
+
+    return false;
+}
+
+// Little endian binary IO for the sidecar file.
+
+template<typename T>
+void write_value(std::ostream &out, T value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template<typename T>
+T read_value(std::istream &in)
+{
+    T value = {};
+    if (!in.read(reinterpret_cast<char *>(&value), sizeof(value)))
+        throw std::runtime_error("listfile index: unexpected end of file");
+    return value;
+}
+
+void write_counts(std::ostream &out, const std::vector<u64> &counts)
+{
+    write_value<u32>(out, counts.size());
+    for (auto count: counts)
+        write_value<u64>(out, count);
+}
+
+std::vector<u64> read_counts(std::istream &in)
+{
+    std::vector<u64> result(read_value<u32>(in));
+    for (auto &count: result)
+        count = read_value<u64>(in);
+    return result;
+}
+
+// The inflate windows are stored zlib compressed. They contain listfile data
+// which compresses well.
+void write_window(std::ostream &out, const std::vector<u8> &window)
+{
+    write_value<u32>(out, window.size());
+
+    if (window.empty())
+    {
+        write_value<u32>(out, 0);
+        return;
+    }
+
+    std::vector<u8> buffer(compressBound(window.size()));
+    uLongf compressedSize = buffer.size();
+
+    if (compress2(buffer.data(), &compressedSize, window.data(), window.size(), Z_BEST_SPEED) != Z_OK)
+        throw std::runtime_error("listfile index: error compressing inflate window");
+
+    write_value<u32>(out, compressedSize);
+    out.write(reinterpret_cast<const char *>(buffer.data()), compressedSize);
+}
+
+std::vector<u8> read_window(std::istream &in, bool load)
+{
+    const auto windowSize = read_value<u32>(in);
+    const auto compressedSize = read_value<u32>(in);
+
+    if (!load || !windowSize)
+    {
+        in.seekg(compressedSize, std::ios::cur);
+        return {};
+    }
+
+    if (windowSize > InflateWindowSize)
+        throw std::runtime_error("listfile index: invalid inflate window size");
+
+    std::vector<u8> buffer(compressedSize);
+
+    if (!in.read(reinterpret_cast<char *>(buffer.data()), buffer.size()))
+        throw std::runtime_error("listfile index: unexpected end of file");
+
+    std::vector<u8> result(windowSize);
+    uLongf resultSize = result.size();
+
+    if (uncompress(result.data(), &resultSize, buffer.data(), buffer.size()) != Z_OK
+        || resultSize != windowSize)
+        throw std::runtime_error("listfile index: error uncompressing inflate window");
+
+    return result;
+}
+
+// Minimal ZIP directory reading. Only what is needed to find the compressed
+// data of the listfile entry. Handles ZIP64 archives.
+
+struct ZipEntryLocation
+{
+    std::string name;
+    u16 method = 0;
+    u64 compressedSize = 0;
+    u64 uncompressedSize = 0;
+    u64 dataOffset = 0;
+};
+
+template<typename T>
+T get_le(const std::vector<u8> &buffer, size_t offset)
+{
+    if (offset + sizeof(T) > buffer.size())
+        throw std::runtime_error("zip: truncated record");
+
+    T result = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+        result |= static_cast<T>(buffer[offset + i]) << (8 * i);
+    return result;
+}
+
+std::vector<u8> read_at(std::istream &in, u64 offset, size_t size)
+{
+    std::vector<u8> result(size);
+    in.clear();
+    in.seekg(offset);
+
+    if (!in.read(reinterpret_cast<char *>(result.data()), size))
+        throw std::runtime_error("zip: unexpected end of file");
+
+    return result;
+}
+
+std::vector<ZipEntryLocation> read_zip_directory(std::istream &in)
+{
+    static const u32 EOCDSignature = 0x06054b50u;
+    static const u32 EOCD64LocatorSignature = 0x07064b50u;
+    static const u32 EOCD64Signature = 0x06064b50u;
+    static const u32 CentralHeaderSignature = 0x02014b50u;
+    static const u32 LocalHeaderSignature = 0x04034b50u;
+    static const size_t EOCDSize = 22;
+    static const size_t MaxCommentSize = 0xffff;
+
+    in.clear();
+    in.seekg(0, std::ios::end);
+    const u64 fileSize = in.tellg();
+
+    if (fileSize < EOCDSize)
+        throw std::runtime_error("zip: file too small");
+
+    const u64 tailSize = std::min<u64>(fileSize, EOCDSize + MaxCommentSize);
+    const u64 tailOffset = fileSize - tailSize;
+    auto tail = read_at(in, tailOffset, tailSize);
+
+    // Search backwards for the end of central directory record.
+    ssize_t eocdPos = -1;
+
+    for (ssize_t pos = tail.size() - EOCDSize; pos >= 0; --pos)
+    {
+        if (get_le<u32>(tail, pos) == EOCDSignature)
+        {
+            eocdPos = pos;
+            break;
+        }
+    }
+
+    if (eocdPos < 0)
+        throw std::runtime_error("zip: end of central directory not found");
+
+    u64 entryCount = get_le<u16>(tail, eocdPos + 10);
+    u64 cdOffset = get_le<u32>(tail, eocdPos + 16);
+
+    if (entryCount == 0xffffu || cdOffset == 0xffffffffu)
+    {
+        const u64 locatorOffset = tailOffset + eocdPos - 20;
+        auto locator = read_at(in, locatorOffset, 20);
+
+        if (get_le<u32>(locator, 0) != EOCD64LocatorSignature)
+            throw std::runtime_error("zip: zip64 end of central directory locator not found");
+
+        auto eocd64 = read_at(in, get_le<u64>(locator, 8), 56);
+
+        if (get_le<u32>(eocd64, 0) != EOCD64Signature)
+            throw std::runtime_error("zip: zip64 end of central directory not found");
+
+        entryCount = get_le<u64>(eocd64, 32);
+        cdOffset = get_le<u64>(eocd64, 48);
+    }
+
+    std::vector<ZipEntryLocation> result;
+    u64 offset = cdOffset;
+
+    for (u64 i = 0; i < entryCount; ++i)
+    {
+        auto header = read_at(in, offset, 46);
+
+        if (get_le<u32>(header, 0) != CentralHeaderSignature)
+            throw std::runtime_error("zip: invalid central directory header");
+
+        ZipEntryLocation entry;
+        entry.method = get_le<u16>(header, 10);
+        entry.compressedSize = get_le<u32>(header, 20);
+        entry.uncompressedSize = get_le<u32>(header, 24);
+        const u16 nameLen = get_le<u16>(header, 28);
+        const u16 extraLen = get_le<u16>(header, 30);
+        const u16 commentLen = get_le<u16>(header, 32);
+        u64 localHeaderOffset = get_le<u32>(header, 42);
+
+        auto nameAndExtra = read_at(in, offset + 46, nameLen + extraLen);
+        entry.name.assign(nameAndExtra.begin(), nameAndExtra.begin() + nameLen);
+
+        // The zip64 extended information extra field contains the values
+        // which did not fit into the 32 bit fields in a fixed order.
+        for (size_t pos = nameLen; pos + 4 <= nameAndExtra.size();)
+        {
+            const u16 id = get_le<u16>(nameAndExtra, pos);
+            const u16 size = get_le<u16>(nameAndExtra, pos + 2);
+            size_t valuePos = pos + 4;
+
+            if (id == 0x0001u)
+            {
+                if (entry.uncompressedSize == 0xffffffffu)
+                {
+                    entry.uncompressedSize = get_le<u64>(nameAndExtra, valuePos);
+                    valuePos += 8;
+                }
+
+                if (entry.compressedSize == 0xffffffffu)
+                {
+                    entry.compressedSize = get_le<u64>(nameAndExtra, valuePos);
+                    valuePos += 8;
+                }
+
+                if (localHeaderOffset == 0xffffffffu)
+                    localHeaderOffset = get_le<u64>(nameAndExtra, valuePos);
+            }
+
+            pos += 4 + size;
+        }
+
+        auto localHeader = read_at(in, localHeaderOffset, 30);
+
+        if (get_le<u32>(localHeader, 0) != LocalHeaderSignature)
+            throw std::runtime_error("zip: invalid local file header");
+
+        entry.dataOffset = localHeaderOffset + 30
+            + get_le<u16>(localHeader, 26) + get_le<u16>(localHeader, 28);
+
+        result.emplace_back(std::move(entry));
+        offset += 46 + nameLen + extraLen + commentLen;
+    }
+
+    return result;
+}
+
+bool ends_with(const std::string &str, const std::string &suffix)
+{
+    return str.size() >= suffix.size()
+        && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool is_listfile_entry_name(const std::string &name)
+{
+    return ends_with(name, ".mvlclst") || ends_with(name, ".mvlclst.lz4");
+}
+
+bool file_exists(const std::string &filename)
+{
+    return std::ifstream(filename).good();
+}
+
+} // end anon namespace
+
+//
+// ListfileIndex
+//
+
+const ListfileCheckpoint *ListfileIndex::findCheckpoint(u64 timeticks) const
+{
+    const ListfileCheckpoint *result = nullptr;
+
+    for (const auto &cp: checkpoints)
+    {
+        if (cp.timeticks >= timeticks)
+            break;
+        result = &cp;
+    }
+
+    return result;
+}
+
+std::string index_filename(const std::string &archiveName)
+{
+    return archiveName + ".mvlcidx";
+}
+
+void write_index(const std::string &filename, const ListfileIndex &index)
+{
+    // Write to a temporary file first so that readers never see a partially
+    // written index.
+    const auto tmpFilename = filename + ".tmp";
+
+    {
+        std::ofstream out(tmpFilename, std::ios::binary | std::ios::trunc);
+
+        if (!out)
+            throw std::runtime_error("listfile index: could not open " + tmpFilename + " for writing");
+
+        out.write(IndexFileMagic, IndexFileMagicLen);
+        write_value<u32>(out, static_cast<u32>(index.format));
+        write_value<u32>(out, static_cast<u32>(index.encoding));
+        write_value<u32>(out, index.entryName.size());
+        out.write(index.entryName.data(), index.entryName.size());
+        write_value<u64>(out, index.totalBytes);
+        write_value<u64>(out, index.totalTimeticks);
+        write_counts(out, index.totalEventCounts);
+        write_value<u32>(out, index.checkpoints.size());
+
+        for (const auto &cp: index.checkpoints)
+        {
+            write_value<u64>(out, cp.uncompressedOffset);
+            write_value<u64>(out, cp.compressedOffset);
+            write_value<u64>(out, cp.accessOffset);
+            write_value<u8>(out, cp.accessBits);
+            write_window(out, cp.window);
+            write_value<u64>(out, cp.timeticks);
+            write_counts(out, cp.eventCounts);
+        }
+
+        if (!out.flush())
+            throw std::runtime_error("listfile index: error writing " + tmpFilename);
+    }
+
+    if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tmpFilename.c_str());
+        throw std::runtime_error("listfile index: could not rename " + tmpFilename + " to " + filename);
+    }
+}
+
+ListfileIndex read_index(const std::string &filename, bool loadWindows)
+{
+    std::ifstream in(filename, std::ios::binary);
+
+    if (!in)
+        throw std::runtime_error("listfile index: could not open " + filename);
+
+    char magic[IndexFileMagicLen] = {};
+
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, IndexFileMagic, IndexFileMagicLen) != 0)
+        throw std::runtime_error("listfile index: " + filename + " is not a listfile index");
+
+    ListfileIndex index;
+    index.format = static_cast<ListfileBufferFormat>(read_value<u32>(in));
+    index.encoding = static_cast<ListfileEntryEncoding>(read_value<u32>(in));
+    index.entryName.resize(read_value<u32>(in));
+
+    if (!in.read(index.entryName.data(), index.entryName.size()))
+        throw std::runtime_error("listfile index: unexpected end of file");
+
+    index.totalBytes = read_value<u64>(in);
+    index.totalTimeticks = read_value<u64>(in);
+    index.totalEventCounts = read_counts(in);
+    index.checkpoints.resize(read_value<u32>(in));
+
+    for (auto &cp: index.checkpoints)
+    {
+        cp.uncompressedOffset = read_value<u64>(in);
+        cp.compressedOffset = read_value<u64>(in);
+        cp.accessOffset = read_value<u64>(in);
+        cp.accessBits = read_value<u8>(in);
+        cp.window = read_window(in, loadWindows);
+        cp.timeticks = read_value<u64>(in);
+        cp.eventCounts = read_counts(in);
+    }
+
+    return index;
+}
+
+std::optional<ListfileIndex> load_index(const std::string &archiveName, bool loadWindows)
+{
+    auto filename = index_filename(archiveName);
+
+    if (!file_exists(filename))
+        return {};
+
+    try
+    {
+        return read_index(filename, loadWindows);
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+
+    return {};
+}
+
+//
+// ListfileIndexer
+//
+
+ListfileIndexer::ListfileIndexer(u64 interval)
+    : interval_(interval)
+{
+}
+
+void ListfileIndexer::beginEntry(const std::string &entryName, ListfileEntryEncoding encoding)
+{
+    index_ = {};
+    index_.entryName = entryName;
+    index_.encoding = encoding;
+    state_ = State::Magic;
+    offset_ = 0;
+    partialWord_ = 0;
+    partialBytes_ = 0;
+    skipWords_ = 0;
+    lastCheckpointOffset_ = 0;
+    // The first checkpoint of each entry is placed after the preamble.
+    checkpointRequested_ = true;
+    pending_ = {};
+}
+
+ListfileIndex ListfileIndexer::finishEntry()
+{
+    index_.format = format_;
+    index_.totalBytes = offset_;
+    index_.totalTimeticks = timeticks_;
+    index_.totalEventCounts = eventCounts_;
+    return std::move(index_);
+}
+
+void ListfileIndexer::resumeAt(const ListfileIndex &index, const ListfileCheckpoint &checkpoint)
+{
+    format_ = index.format;
+    state_ = State::FrameHeader;
+    offset_ = checkpoint.uncompressedOffset;
+    partialWord_ = 0;
+    partialBytes_ = 0;
+    skipWords_ = 0;
+    timeticks_ = checkpoint.timeticks;
+    eventCounts_ = checkpoint.eventCounts;
+    lastCheckpointOffset_ = offset_;
+    checkpointRequested_ = false;
+    pending_ = {};
+    setTimetickRange(startTimeticks_, stopTimeticks_);
+}
+
+void ListfileIndexer::requestCheckpoint(u64 compressedOffset, u8 accessBits, std::vector<u8> window)
+{
+    // A later access point is always closer to the next boundary, so it
+    // replaces any pending one.
+    pending_.compressedOffset = compressedOffset;
+    pending_.accessOffset = offset_;
+    pending_.accessBits = accessBits;
+    pending_.window = std::move(window);
+    checkpointRequested_ = true;
+}
+
+void ListfileIndexer::setTimetickRange(u64 startTimeticks, u64 stopTimeticks)
+{
+    startTimeticks_ = startTimeticks;
+    stopTimeticks_ = stopTimeticks;
+    rangeBegin_ = {};
+    rangeEnd_ = {};
+
+    if (timeticks_ >= startTimeticks_)
+        rangeBegin_ = offset_;
+
+    if (stopTimeticks_ && timeticks_ >= stopTimeticks_)
+        rangeEnd_ = offset_;
+}
+
+void ListfileIndexer::consume(const u8 *data, size_t size)
+{
+    const u8 *end = data + size;
+
+    while (data < end)
+    {
+        // Fast path: skip over frame contents and packet payload words that
+        // do not need to be looked at.
+        if (partialBytes_ == 0)
+        {
+            if (u32 skippable = skippableWords())
+            {
+                u32 words = std::min<u64>(skippable, (end - data) / sizeof(u32));
+
+                if (words)
+                {
+                    skipWords(words);
+                    data += words * sizeof(u32);
+                    offset_ += words * sizeof(u32);
+                    continue;
+                }
+            }
+        }
+
+        partialWord_ |= static_cast<u32>(*data++) << (8 * partialBytes_++);
+        ++offset_;
+
+        if (partialBytes_ == sizeof(u32))
+        {
+            u32 word = partialWord_;
+            partialWord_ = 0;
+            partialBytes_ = 0;
+            onWord(word, offset_ - sizeof(u32));
+        }
+    }
+}
+
+u32 ListfileIndexer::skippableWords() const
+{
+    switch (state_)
+    {
+        case State::FrameSkip:
+            return skipWords_;
+
+        case State::EthPayload:
+            if (ethNextHeader_ > ethPayloadPos_)
+                return std::min(ethNextHeader_ - ethPayloadPos_, ethWordsLeft_);
+            return 0;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+void ListfileIndexer::skipWords(u32 count)
+{
+    if (state_ == State::FrameSkip)
+    {
+        assert(count <= skipWords_);
+        if ((skipWords_ -= count) == 0)
+            state_ = State::FrameHeader;
+    }
+    else if (state_ == State::EthPayload)
+    {
+        assert(count <= ethWordsLeft_);
+        ethPayloadPos_ += count;
+        if ((ethWordsLeft_ -= count) == 0)
+            state_ = State::FrameHeader;
+    }
+}
+
+void ListfileIndexer::onWord(u32 word, u64 wordOffset)
+{
+    switch (state_)
+    {
+        case State::Magic:
+            {
+                const unsigned magicIndex = wordOffset / sizeof(u32);
+                magic_[magicIndex] = word;
+
+                if (magicIndex == 1)
+                {
+                    if (magic_[0] == MagicWordMVLC && magic_[1] == MagicWordETH)
+                        format_ = ListfileBufferFormat::MVLC_ETH;
+                    else if (magic_[0] == MagicWordMVLC && magic_[1] == MagicWordUSB)
+                        format_ = ListfileBufferFormat::MVLC_USB;
+                    else
+                        throw std::runtime_error("listfile index: entry does not start with an MVLC file magic");
+
+                    state_ = State::FrameHeader;
+                }
+            } break;
+
+        case State::FrameHeader:
+            {
+                // Readers of split listfiles may pass through the magic of
+                // the following parts.
+                if (word == MagicWordMVLC)
+                {
+                    skipWords_ = 1;
+                    state_ = State::FrameSkip;
+                    break;
+                }
+
+                const auto info = extract_frame_info(word);
+
+                if (info.type == frame_headers::SystemEvent)
+                {
+                    if (!is_preamble_event(info))
+                        onBoundary(wordOffset, true);
+
+                    if (info.sysEventSubType == system_event::subtype::UnixTimetick)
+                        onTimetick(wordOffset + (info.len + 1) * sizeof(u32));
+                }
+                else if (format_ == ListfileBufferFormat::MVLC_USB)
+                {
+                    if (!is_known_frame_header(word))
+                        break; // Not a frame header. Try the next word.
+
+                    // Continuation frames cannot be parsed without the frame
+                    // they continue.
+                    onBoundary(wordOffset, info.type == frame_headers::StackFrame);
+
+                    if (info.type == frame_headers::StackFrame)
+                        countEvent(info.stack);
+                }
+                else
+                {
+                    // ETH packet header0. The packet length and the position
+                    // of the first frame header follow in header1.
+                    ethHeader0_ = word;
+                    ethPacketOffset_ = wordOffset;
+                    state_ = State::EthHeader1;
+                    break;
+                }
+
+                if (info.len)
+                {
+                    skipWords_ = info.len;
+                    state_ = State::FrameSkip;
+                }
+            } break;
+
+        case State::FrameSkip:
+            skipWords(1);
+            break;
+
+        case State::EthHeader1:
+            {
+                eth::PayloadHeaderInfo info{ ethHeader0_, word };
+                const bool hasHeader = info.isNextHeaderPointerPresent();
+
+                // Packets are resumable if a frame starts at the beginning of
+                // the payload.
+                onBoundary(ethPacketOffset_, hasHeader && info.nextHeaderPointer() == 0);
+
+                ethWordsLeft_ = info.dataWordCount();
+                ethPayloadPos_ = 0;
+                ethNextHeader_ = hasHeader ? info.nextHeaderPointer() : EthNoHeader;
+                state_ = ethWordsLeft_ ? State::EthPayload : State::FrameHeader;
+            } break;
+
+        case State::EthPayload:
+            {
+                if (ethPayloadPos_ == ethNextHeader_)
+                {
+                    const auto info = extract_frame_info(word);
+
+                    if (info.type == frame_headers::StackFrame)
+                        countEvent(info.stack);
+
+                    ethNextHeader_ = ethPayloadPos_ + info.len + 1;
+                }
+
+                skipWords(1);
+            } break;
+    }
+}
+
+void ListfileIndexer::onBoundary(u64 offset, bool canResume)
+{
+    if (!canResume)
+        return;
+
+    if (!checkpointRequested_ && interval_ && offset >= lastCheckpointOffset_ + interval_)
+    {
+        checkpointRequested_ = true;
+        pending_ = {};
+    }
+
+    // The boundary may belong to a header word which started before the
+    // requested access point.
+    if (!checkpointRequested_ || (pending_.hasAccessPoint() && offset < pending_.accessOffset))
+        return;
+
+    ListfileCheckpoint cp = std::move(pending_);
+    cp.uncompressedOffset = offset;
+    cp.timeticks = timeticks_;
+    cp.eventCounts = eventCounts_;
+    index_.checkpoints.emplace_back(std::move(cp));
+
+    lastCheckpointOffset_ = offset;
+    checkpointRequested_ = false;
+    pending_ = {};
+}
+
+void ListfileIndexer::onTimetick(u64 frameEnd)
+{
+    ++timeticks_;
+
+    if (!rangeBegin_ && timeticks_ >= startTimeticks_)
+        rangeBegin_ = frameEnd;
+
+    if (!rangeEnd_ && stopTimeticks_ && timeticks_ >= stopTimeticks_)
+        rangeEnd_ = frameEnd;
+}
+
+void ListfileIndexer::countEvent(unsigned stack)
+{
+    // Stack 0 is reserved for direct command execution, event N is read out
+    // by stack N+1.
+    if (stack == 0)
+        return;
+
+    const unsigned eventIndex = stack - 1;
+
+    if (eventIndex >= eventCounts_.size())
+        eventCounts_.resize(eventIndex + 1);
+
+    ++eventCounts_[eventIndex];
+}
+
+//
+// IndexingWriteHandle
+//
+
+size_t IndexingWriteHandle::write(const u8 *data, size_t size)
+{
+    // Write first: a split listfile writer may start a new archive before
+    // writing the data. The indexer is switched to the new entry by the
+    // archive callbacks.
+    auto result = dest_->write(data, size);
+    indexer_.consume(data, size);
+    return result;
+}
+
+//
+// build_index
+//
+
+namespace
+{
+
+void index_deflate_entry(
+    std::istream &in, const ZipEntryLocation &entry, ListfileIndexer &indexer,
+    const IndexProgressCallback &progress, u64 span)
+{
+    static const size_t InputChunkSize = 1u << 16;
+    static const size_t OutputChunkSize = 1u << 18;
+    static const u64 ProgressInterval = u64(16) << 20;
+
+    z_stream strm = {};
+
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+        throw std::runtime_error("listfile index: inflateInit2 failed");
+
+    std::vector<u8> inBuf(InputChunkSize);
+    // The output buffer is prefixed with the last InflateWindowSize bytes of
+    // the preceding output so that the window can be copied at access points.
+    std::vector<u8> outBuf(InflateWindowSize + OutputChunkSize);
+    u8 *const outChunk = outBuf.data() + InflateWindowSize;
+
+    in.clear();
+    in.seekg(entry.dataOffset);
+
+    u64 compressedLeft = entry.compressedSize;
+    u64 totalIn = 0;
+    u64 totalOut = 0;
+    u64 lastPoint = 0;
+    u64 lastProgress = 0;
+    int ret = Z_OK;
+
+    // The start of the deflate stream is an access point without a window.
+    indexer.requestCheckpoint(entry.dataOffset);
+
+    try
+    {
+        do
+        {
+            if (strm.avail_in == 0 && compressedLeft)
+            {
+                size_t toRead = std::min<u64>(inBuf.size(), compressedLeft);
+                in.read(reinterpret_cast<char *>(inBuf.data()), toRead);
+                size_t bytesRead = in.gcount();
+                compressedLeft = bytesRead ? compressedLeft - bytesRead : 0;
+                strm.next_in = inBuf.data();
+                strm.avail_in = bytesRead;
+            }
+
+            const auto availIn = strm.avail_in;
+            strm.next_out = outChunk;
+            strm.avail_out = OutputChunkSize;
+
+            // Z_BLOCK makes inflate return at deflate block boundaries.
+            ret = inflate(&strm, Z_BLOCK);
+
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR)
+                throw std::runtime_error(std::string("listfile index: inflate error: ")
+                                         + (strm.msg ? strm.msg : "unknown error"));
+
+            if (ret == Z_BUF_ERROR && strm.avail_in == 0 && !compressedLeft)
+                throw std::runtime_error("listfile index: unexpected end of compressed data");
+
+            const size_t produced = OutputChunkSize - strm.avail_out;
+            totalIn += availIn - strm.avail_in;
+            indexer.consume(outChunk, produced);
+            totalOut += produced;
+
+            // At the end of a block which is not the last block of the
+            // stream (bit 7 set, bit 6 clear).
+            if ((strm.data_type & 128) && !(strm.data_type & 64)
+                && totalOut - lastPoint > span)
+            {
+                const size_t windowSize = std::min<u64>(totalOut, InflateWindowSize);
+                std::vector<u8> window(outChunk + produced - windowSize, outChunk + produced);
+                indexer.requestCheckpoint(entry.dataOffset + totalIn, strm.data_type & 7, std::move(window));
+                lastPoint = totalOut;
+            }
+
+            std::memmove(outBuf.data(), outBuf.data() + produced, InflateWindowSize);
+
+            if (progress && totalIn - lastProgress >= ProgressInterval)
+            {
+                progress(totalIn, entry.compressedSize);
+                lastProgress = totalIn;
+            }
+        } while (ret != Z_STREAM_END);
+    }
+    catch (...)
+    {
+        inflateEnd(&strm);
+        throw;
+    }
+
+    inflateEnd(&strm);
+
+    if (progress)
+        progress(totalIn, entry.compressedSize);
+}
+
+void index_entry_sequentially(
+    const std::string &archiveName, const ZipEntryLocation &entry, ListfileIndexer &indexer,
+    const IndexProgressCallback &progress, u64 span)
+{
+    static const size_t ChunkSize = 1u << 20;
+    static const u64 ProgressInterval = u64(16) << 20;
+
+    listfile::ZipReader zipReader;
+    zipReader.openArchive(archiveName);
+    std::unique_ptr<ZstdReadHandle> zstdReadHandle;
+    auto readHandle = open_listfile_entry(zipReader, entry.name, zstdReadHandle);
+
+    std::vector<u8> buffer(ChunkSize);
+    u64 totalOut = 0;
+    u64 lastPoint = 0;
+    u64 lastProgress = 0;
+
+    // Progress is reported in bytes of entry data.
+    auto bytesDone = [&] { return zstdReadHandle ? zstdReadHandle->compressedBytesRead() : totalOut; };
+
+    while (size_t bytesRead = readHandle->read(buffer.data(), buffer.size()))
+    {
+        indexer.consume(buffer.data(), bytesRead);
+        totalOut += bytesRead;
+
+        if (totalOut - lastPoint >= span)
+        {
+            indexer.requestCheckpoint();
+            lastPoint = totalOut;
+        }
+
+        if (progress && totalOut - lastProgress >= ProgressInterval)
+        {
+            progress(bytesDone(), entry.uncompressedSize);
+            lastProgress = totalOut;
+        }
+    }
+
+    if (progress)
+        progress(bytesDone(), entry.uncompressedSize);
+}
+
+bool is_zstd_entry(const std::string &archiveName, const ZipEntryLocation &entry)
+{
+    listfile::ZipReader zipReader;
+    zipReader.openArchive(archiveName);
+    return is_zstd_listfile(*zipReader.openEntry(entry.name));
+}
+
+} // end anon namespace
+
+ListfileIndex build_index(
+    const std::string &archiveName,
+    ListfileIndexer &indexer,
+    const IndexProgressCallback &progress,
+    u64 span)
+{
+    std::ifstream in(archiveName, std::ios::binary);
+
+    if (!in)
+        throw std::runtime_error("listfile index: could not open " + archiveName);
+
+    auto entries = read_zip_directory(in);
+
+    auto it = std::find_if(std::begin(entries), std::end(entries),
+                           [] (const ZipEntryLocation &e) { return is_listfile_entry_name(e.name); });
+
+    if (it == std::end(entries))
+        throw std::runtime_error("listfile index: no listfile found in " + archiveName);
+
+    const auto &entry = *it;
+    static const u16 ZipMethodStored = 0;
+    static const u16 ZipMethodDeflate = 8;
+
+    if (is_zstd_entry(archiveName, entry))
+    {
+        // The zstd frames are stored in a ZIP entry without or with minimal
+        // deflate compression. Frame level seeking is not implemented,
+        // checkpoints are placed at the given span.
+        indexer.beginEntry(entry.name, ListfileEntryEncoding::Zstd);
+        index_entry_sequentially(archiveName, entry, indexer, progress, span);
+    }
+    else if (entry.method == ZipMethodDeflate)
+    {
+        indexer.beginEntry(entry.name, ListfileEntryEncoding::Deflate);
+        index_deflate_entry(in, entry, indexer, progress, span);
+    }
+    else if (entry.method == ZipMethodStored)
+    {
+        // LZ4 compressed listfiles are stored in the archive without ZIP
+        // compression. There are no access points for LZ4 frames, the
+        // checkpoints are placed at the given span.
+        const bool isLZ4 = ends_with(entry.name, ".lz4");
+        indexer.beginEntry(entry.name, isLZ4 ? ListfileEntryEncoding::LZ4 : ListfileEntryEncoding::Stored);
+        index_entry_sequentially(archiveName, entry, indexer, progress, span);
+    }
+    else
+        throw std::runtime_error("listfile index: unsupported compression method in " + archiveName);
+
+    return indexer.finishEntry();
+}
+
+std::vector<std::string> split_listfile_parts(const std::string &archiveName)
+{
+    static const std::regex rePart(R"((.*_part)(\d+)(\.zip)$)");
+
+    std::smatch match;
+
+    if (!std::regex_match(archiveName, match, rePart))
+        return { archiveName };
+
+    const auto prefix = match[1].str();
+    const auto digits = match[2].str();
+    const auto suffix = match[3].str();
+
+    std::vector<std::string> result;
+
+    for (unsigned long part = std::stoul(digits);; ++part)
+    {
+        auto number = std::to_string(part);
+
+        if (number.size() < digits.size())
+            number.insert(0, digits.size() - number.size(), '0');
+
+        auto filename = prefix + number + suffix;
+
+        if (!file_exists(filename))
+            break;
+
+        result.emplace_back(std::move(filename));
+    }
+
+    return result;
+}
+
+std::string listfile_entry_name(const std::string &archiveName)
+{
+    std::ifstream in(archiveName, std::ios::binary);
+
+    if (!in)
+        throw std::runtime_error("listfile index: could not open " + archiveName);
+
+    auto entries = read_zip_directory(in);
+
+    auto it = std::find_if(std::begin(entries), std::end(entries),
+                           [] (const ZipEntryLocation &e) { return is_listfile_entry_name(e.name); });
+
+    if (it == std::end(entries))
+        throw std::runtime_error("listfile index: no listfile found in " + archiveName);
+
+    return it->name;
+}
+
+//
+// DeflateAccessReader
+//
+
+struct DeflateAccessReader::Private
+{
+    static const size_t InputChunkSize = 1u << 16;
+
+    std::ifstream archive;
+    z_stream strm = {};
+    bool initialized = false;
+    bool streamEnd = false;
+    u64 compressedBytesRead = 0;
+    std::vector<u8> inBuf;
+
+    ~Private()
+    {
+        if (initialized)
+            inflateEnd(&strm);
+    }
+};
+
+DeflateAccessReader::DeflateAccessReader(const std::string &archiveName, const ListfileCheckpoint &cp)
+    : d(std::make_unique<Private>())
+{
+    d->archive.open(archiveName, std::ios::binary);
+
+    if (!d->archive)
+        throw std::runtime_error("listfile index: could not open " + archiveName);
+
+    // If the block starts inside a byte the remaining bits of that byte have
+    // to be fed to inflate first.
+    d->archive.seekg(cp.compressedOffset - (cp.accessBits ? 1 : 0));
+
+    if (inflateInit2(&d->strm, -MAX_WBITS) != Z_OK)
+        throw std::runtime_error("listfile index: inflateInit2 failed");
+
+    d->initialized = true;
+
+    if (cp.accessBits)
+    {
+        int byte = d->archive.get();
+
+        if (byte == EOF)
+            throw std::runtime_error("listfile index: unexpected end of compressed data");
+
+        inflatePrime(&d->strm, cp.accessBits, byte >> (8 - cp.accessBits));
+        ++d->compressedBytesRead;
+    }
+
+    if (!cp.window.empty())
+        inflateSetDictionary(&d->strm, cp.window.data(), cp.window.size());
+
+    d->inBuf.resize(Private::InputChunkSize);
+}
+
+DeflateAccessReader::~DeflateAccessReader()
+{
+}
+
+size_t DeflateAccessReader::read(u8 *dest, size_t maxSize)
+{
+    auto &strm = d->strm;
+    strm.next_out = dest;
+    strm.avail_out = maxSize;
+
+    while (strm.avail_out && !d->streamEnd)
+    {
+        if (strm.avail_in == 0)
+        {
+            d->archive.read(reinterpret_cast<char *>(d->inBuf.data()), d->inBuf.size());
+            strm.next_in = d->inBuf.data();
+            strm.avail_in = d->archive.gcount();
+            d->compressedBytesRead += strm.avail_in;
+        }
+
+        int ret = inflate(&strm, Z_NO_FLUSH);
+
+        if (ret == Z_STREAM_END)
+            d->streamEnd = true;
+        else if (ret == Z_BUF_ERROR && strm.avail_in == 0)
+            throw std::runtime_error("listfile index: unexpected end of compressed data");
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+            throw std::runtime_error(std::string("listfile index: inflate error: ")
+                                     + (strm.msg ? strm.msg : "unknown error"));
+    }
+
+    return maxSize - strm.avail_out;
+}
+
+u64 DeflateAccessReader::compressedBytesRead() const
+{
+    // Input read ahead from the archive but not yet consumed by inflate is
+    // not counted.
+    return d->compressedBytesRead - d->strm.avail_in;
+}
+
+//
+// ListfileRangeReadHandle
+//
+
+struct ListfileRangeReadHandle::Private
+{
+    // Number of data bytes kept after the preamble to support the seek back
+    // done by the preamble reader after looking at the first data frame.
+    static const size_t DataHeadSize = 1u << 16;
+
+    listfile::ReadHandle *input = nullptr;
+    const ListfileIndex *index = nullptr;
+    std::string archiveName;
+    const ListfileCheckpoint *checkpoint = nullptr;
+
+    std::vector<u8> preamble;   // file magic and preamble
+    std::vector<u8> dataHead;   // the first bytes of data returned from read()
+    u64 pos = 0;                // position as seen by the user of the handle
+    u64 dataDelivered = 0;      // data bytes returned by read()
+    bool dataPrepared = false;
+    bool eof = false;
+
+    ListfileIndexer indexer;
+
+    // Direct inflate from an access point.
+    std::unique_ptr<DeflateAccessReader> inflater;
+
+    void prepareData();
+    size_t readSource(u8 *dest, size_t size);
+    void discard(u64 bytes);
+    size_t readData(u8 *dest, size_t maxSize);
+};
+
+void ListfileRangeReadHandle::Private::prepareData()
+{
+    if (checkpoint)
+    {
+        if (checkpoint->hasAccessPoint()
+            && index->encoding == ListfileEntryEncoding::Deflate
+            && !archiveName.empty())
+        {
+            inflater = std::make_unique<DeflateAccessReader>(archiveName, *checkpoint);
+            discard(checkpoint->uncompressedOffset - checkpoint->accessOffset);
+        }
+        else
+        {
+            discard(checkpoint->uncompressedOffset - preamble.size());
+        }
+    }
+
+    dataPrepared = true;
+}
+
+size_t ListfileRangeReadHandle::Private::readSource(u8 *dest, size_t size)
+{
+    if (inflater)
+        return inflater->read(dest, size);
+
+    return input->read(dest, size);
+}
+
+void ListfileRangeReadHandle::Private::discard(u64 bytes)
+{
+    std::vector<u8> buffer(std::min<u64>(bytes, 1u << 20));
+
+    while (bytes)
+    {
+        size_t bytesRead = readSource(buffer.data(), std::min<u64>(bytes, buffer.size()));
+
+        if (bytesRead == 0)
+        {
+            eof = true;
+            break;
+        }
+
+        bytes -= bytesRead;
+    }
+}
+
+size_t ListfileRangeReadHandle::Private::readData(u8 *dest, size_t maxSize)
+{
+    if (!dataPrepared)
+        prepareData();
+
+    size_t total = 0;
+
+    while (total < maxSize && !eof)
+    {
+        u8 *chunk = dest + total;
+        const u64 chunkBegin = indexer.offset();
+        size_t chunkSize = readSource(chunk, maxSize - total);
+
+        if (chunkSize == 0)
+        {
+            eof = true;
+            break;
+        }
+
+        indexer.consume(chunk, chunkSize);
+        const u64 chunkEnd = chunkBegin + chunkSize;
+
+        // Keep the part of the chunk inside the timetick range.
+        u64 keepBegin = indexer.rangeBegin() ? std::max(chunkBegin, *indexer.rangeBegin()) : chunkEnd;
+        u64 keepEnd = chunkEnd;
+
+        if (auto rangeEnd = indexer.rangeEnd())
+        {
+            keepEnd = std::min(keepEnd, *rangeEnd);
+
+            if (*rangeEnd <= chunkEnd)
+                eof = true;
+        }
+
+        if (keepBegin < keepEnd)
+        {
+            const size_t keepSize = keepEnd - keepBegin;
+            std::memmove(dest + total, chunk + (keepBegin - chunkBegin), keepSize);
+            total += keepSize;
+        }
+    }
+
+    return total;
+}
+
+ListfileRangeReadHandle::ListfileRangeReadHandle(
+    listfile::ReadHandle *input,
+    u64 startTimeticks, u64 stopTimeticks,
+    const ListfileIndex *index,
+    const std::string &archiveName)
+    : d(std::make_unique<Private>())
+{
+    d->input = input;
+    d->index = index;
+    d->archiveName = archiveName;
+
+    // Read and keep the file magic and the preamble.
+    auto preamble = listfile::read_preamble(*input);
+    d->preamble.resize(preamble.endOffset);
+    input->seek(0);
+
+    for (size_t offset = 0; offset < d->preamble.size();)
+    {
+        size_t bytesRead = input->read(d->preamble.data() + offset, d->preamble.size() - offset);
+
+        if (bytesRead == 0)
+            throw std::runtime_error("listfile index: unexpected end of listfile preamble");
+
+        offset += bytesRead;
+    }
+
+    d->indexer.beginEntry();
+    d->indexer.consume(d->preamble.data(), d->preamble.size());
+    d->indexer.setTimetickRange(startTimeticks, stopTimeticks);
+
+    if (index && startTimeticks)
+    {
+        d->checkpoint = index->findCheckpoint(startTimeticks);
+
+        // The first checkpoint directly follows the preamble. Resuming there
+        // picks up the counters of preceding split listfile parts.
+        if (!d->checkpoint && !index->checkpoints.empty())
+            d->checkpoint = &index->checkpoints.front();
+
+        if (d->checkpoint && d->checkpoint->uncompressedOffset < d->preamble.size())
+            d->checkpoint = nullptr;
+
+        if (d->checkpoint)
+            d->indexer.resumeAt(*index, *d->checkpoint);
+    }
+}
+
+ListfileRangeReadHandle::~ListfileRangeReadHandle()
+{
+}
+
+size_t ListfileRangeReadHandle::read(u8 *dest, size_t maxSize)
+{
+    size_t total = 0;
+    const u64 preambleSize = d->preamble.size();
+    const u64 bufferedEnd = preambleSize + d->dataHead.size();
+
+    // Serve the preamble and the buffered data head from memory.
+    while (total < maxSize && d->pos < bufferedEnd)
+    {
+        const u8 *src = nullptr;
+        size_t avail = 0;
+
+        if (d->pos < preambleSize)
+        {
+            src = d->preamble.data() + d->pos;
+            avail = preambleSize - d->pos;
+        }
+        else
+        {
+            const u64 headPos = d->pos - preambleSize;
+            src = d->dataHead.data() + headPos;
+            avail = d->dataHead.size() - headPos;
+        }
+
+        const size_t n = std::min(avail, maxSize - total);
+        std::memcpy(dest + total, src, n);
+        total += n;
+        d->pos += n;
+    }
+
+    if (total < maxSize)
+    {
+        // Data returned before but not kept in the head cannot be served
+        // again. Only happens after seeking back into the head once more
+        // than DataHeadSize data bytes have been read.
+        if (d->pos != preambleSize + d->dataDelivered)
+        {
+            if (total)
+                return total;
+
+            throw std::runtime_error(
+                "ListfileRangeReadHandle: data following the buffered head is not available anymore");
+        }
+
+        size_t n = d->readData(dest + total, maxSize - total);
+
+        if (d->dataHead.size() == d->dataDelivered && d->dataHead.size() < Private::DataHeadSize)
+        {
+            const size_t headBytes = std::min(n, Private::DataHeadSize - d->dataHead.size());
+            d->dataHead.insert(std::end(d->dataHead), dest + total, dest + total + headBytes);
+        }
+
+        d->dataDelivered += n;
+        d->pos += n;
+        total += n;
+    }
+
+    return total;
+}
+
+size_t ListfileRangeReadHandle::seek(size_t pos)
+{
+    const u64 livePos = d->preamble.size() + d->dataDelivered;
+    const u64 bufferedPos = d->preamble.size() + d->dataHead.size();
+
+    if (pos != livePos && pos > bufferedPos)
+    {
+        throw std::runtime_error("ListfileRangeReadHandle: seeking is only supported within the preamble");
+    }
+
+    d->pos = pos;
+    return pos;
+}
+
+const ListfileCheckpoint *ListfileRangeReadHandle::startCheckpoint() const
+{
+    return d->checkpoint;
+}
+
+}
@@ -0,0 +1,320 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __MVME_MVLC_LISTFILE_INDEX_H__
+#define __MVME_MVLC_LISTFILE_INDEX_H__
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <mesytec-mvlc/mvlc_listfile.h>
+
+#include "globals.h"
+#include "libmvme_export.h"
+#include "typedefs.h"
+
+namespace mesytec::mvme_mvlc
+{
+
+// Random access index for MVLC listfile archives.
+//
+// The index is stored in a sidecar file next to the archive (see
+// index_filename()) and holds periodic checkpoints into the uncompressed
+// listfile data. Each checkpoint points to a position in the stream where the
+// readout parser can resume (a frame or packet boundary) and records the
+// number of timeticks and events preceding it.
+//
+// Checkpoints created by the offline builder (build_index()) additionally
+// carry a deflate access point: the compressed offset of a deflate block
+// boundary plus the 32k inflate window needed to resume decompression there.
+// These allow replays to start at any checkpoint without decompressing the data
+// that comes before it. Checkpoints recorded during the DAQ do not have an
+// access point. Replays starting from them have to decompress and discard the
+// data up to the checkpoint but do not need to parse or analyze it.
+//
+// Timetick and event counters are cumulative over all parts of a split
+// listfile, i.e. the first checkpoint of part N holds the counts of all
+// preceding parts.
+
+// Encoding of the listfile entry inside the archive.
+enum class ListfileEntryEncoding: u8
+{
+    Unknown,
+    Stored,
+    Deflate,
+    LZ4,
+    Zstd,
+};
+
+struct LIBMVME_EXPORT ListfileCheckpoint
+{
+    // Offset into the uncompressed listfile data (including the file magic
+    // and preamble) of the frame/packet boundary to resume at.
+    u64 uncompressedOffset = 0;
+
+    // Deflate access point: offset of the first compressed byte of the block
+    // in the archive file, number of bits of the preceding byte belonging to
+    // the block and the inflate window. accessOffset is the uncompressed
+    // offset of the block start and is <= uncompressedOffset.
+    // compressedOffset is 0 if the checkpoint does not have an access point.
+    u64 compressedOffset = 0;
+    u64 accessOffset = 0;
+    u8 accessBits = 0;
+    std::vector<u8> window;
+
+    // Number of UnixTimetick system events preceding the checkpoint.
+    u64 timeticks = 0;
+    // Number of readout events preceding the checkpoint, indexed by event.
+    std::vector<u64> eventCounts;
+
+    bool hasAccessPoint() const { return compressedOffset != 0; }
+};
+
+struct LIBMVME_EXPORT ListfileIndex
+{
+    ListfileBufferFormat format = ListfileBufferFormat::MVLC_USB;
+    ListfileEntryEncoding encoding = ListfileEntryEncoding::Unknown;
+    std::string entryName;
+    // Size of the uncompressed listfile data and the counters at the end of
+    // the entry.
+    u64 totalBytes = 0;
+    u64 totalTimeticks = 0;
+    std::vector<u64> totalEventCounts;
+    // Sorted by uncompressedOffset.
+    std::vector<ListfileCheckpoint> checkpoints;
+
+    // Returns the last checkpoint with less than the given number of
+    // timeticks or nullptr if there is no such checkpoint.
+    const ListfileCheckpoint *findCheckpoint(u64 timeticks) const;
+};
+
+// Name of the sidecar file holding the index for the given archive.
+std::string LIBMVME_EXPORT index_filename(const std::string &archiveName);
+
+// Sidecar IO. Both functions throw std::runtime_error on error. If loadWindows
+// is false the inflate windows of the checkpoints are not loaded.
+void LIBMVME_EXPORT write_index(const std::string &filename, const ListfileIndex &index);
+ListfileIndex LIBMVME_EXPORT read_index(const std::string &filename, bool loadWindows = true);
+
+// Returns the index for the given archive if the sidecar exists and can be
+// read.
+std::optional<ListfileIndex> LIBMVME_EXPORT load_index(
+    const std::string &archiveName, bool loadWindows = true);
+
+// Incremental scanner for MVLC listfile data. The data passed to consume()
+// may be split at arbitrary positions. The scanner walks the frame (USB) or
+// packet (ETH) structure, counts timeticks and events and records a
+// checkpoint at the first boundary following each checkpoint request.
+// Throws std::runtime_error if the entry does not start with an MVLC file
+// magic.
+class LIBMVME_EXPORT ListfileIndexer
+{
+    public:
+        // interval: if non-zero a checkpoint is requested automatically each
+        // time interval bytes have been consumed since the last checkpoint.
+        explicit ListfileIndexer(u64 interval = 0);
+
+        // Starts a new listfile entry. The entry data must start with the file
+        // magic which is used to detect the format. Counters are kept so that
+        // they are cumulative across the parts of split listfiles. A
+        // checkpoint is recorded at the first boundary following the
+        // preamble.
+        void beginEntry(const std::string &entryName = {},
+                        ListfileEntryEncoding encoding = ListfileEntryEncoding::Unknown);
+
+        // Finishes the current entry and returns its index.
+        ListfileIndex finishEntry();
+
+        // Continues scanning at the given checkpoint of the index without
+        // processing the entry data preceding it.
+        void resumeAt(const ListfileIndex &index, const ListfileCheckpoint &checkpoint);
+
+        void consume(const u8 *data, size_t size);
+
+        // Requests a checkpoint at the next boundary at or after the current
+        // offset. The access point is stored with the checkpoint.
+        void requestCheckpoint(u64 compressedOffset = 0, u8 accessBits = 0,
+                               std::vector<u8> window = {});
+
+        // Timetick range used to cut replays: rangeBegin() is the end offset
+        // of the frame making the number of timeticks reach startTimeticks,
+        // rangeEnd() the same for stopTimeticks. Zero values mean no limit,
+        // in which case rangeBegin() is the current offset and rangeEnd()
+        // stays unset.
+        void setTimetickRange(u64 startTimeticks, u64 stopTimeticks);
+        std::optional<u64> rangeBegin() const { return rangeBegin_; }
+        std::optional<u64> rangeEnd() const { return rangeEnd_; }
+
+        ListfileBufferFormat format() const { return format_; }
+        u64 offset() const { return offset_; }
+        u64 timeticks() const { return timeticks_; }
+        const std::vector<u64> &eventCounts() const { return eventCounts_; }
+
+    private:
+        void onWord(u32 word, u64 wordOffset);
+        void onBoundary(u64 offset, bool canResume);
+        void onTimetick(u64 frameEnd);
+        void countEvent(unsigned stack);
+        u32 skippableWords() const;
+        void skipWords(u32 count);
+
+        enum class State
+        {
+            Magic,
+            FrameHeader,
+            FrameSkip,
+            EthHeader1,
+            EthPayload,
+        };
+
+        ListfileBufferFormat format_ = ListfileBufferFormat::MVLC_USB;
+        u64 interval_;
+        ListfileIndex index_;
+        State state_ = State::Magic;
+        u64 offset_ = 0;
+        u32 partialWord_ = 0;
+        unsigned partialBytes_ = 0;
+        u32 magic_[2] = {};
+        u32 skipWords_ = 0;
+        // ETH packet state
+        u32 ethHeader0_ = 0;
+        u64 ethPacketOffset_ = 0;
+        u32 ethWordsLeft_ = 0;
+        u32 ethPayloadPos_ = 0;
+        u32 ethNextHeader_ = 0;
+        u64 timeticks_ = 0;
+        std::vector<u64> eventCounts_;
+        u64 lastCheckpointOffset_ = 0;
+        bool checkpointRequested_ = false;
+        ListfileCheckpoint pending_;
+        u64 startTimeticks_ = 0;
+        u64 stopTimeticks_ = 0;
+        std::optional<u64> rangeBegin_;
+        std::optional<u64> rangeEnd_;
+};
+
+// WriteHandle passing the written data on to another handle and to an
+// indexer. Used to build the index while recording a listfile.
+class LIBMVME_EXPORT IndexingWriteHandle: public mesytec::mvlc::listfile::WriteHandle
+{
+    public:
+        IndexingWriteHandle(
+            std::shared_ptr<mesytec::mvlc::listfile::WriteHandle> dest,
+            ListfileIndexer &indexer)
+            : dest_(dest)
+            , indexer_(indexer)
+        {}
+
+        size_t write(const u8 *data, size_t size) override;
+
+    private:
+        std::shared_ptr<mesytec::mvlc::listfile::WriteHandle> dest_;
+        ListfileIndexer &indexer_;
+};
+
+using IndexProgressCallback = std::function<void (u64 bytesDone, u64 bytesTotal)>;
+
+// Offline index builder. Scans the listfile entry of the given archive and
+// returns its index. Deflate compressed entries get checkpoints with access
+// points about every 'span' uncompressed bytes. Other encodings (LZ4, zstd)
+// get checkpoints without access points. The indexer is used for counting so that
+// the parts of split listfiles can be indexed in sequence.
+// Throws std::runtime_error on error.
+ListfileIndex LIBMVME_EXPORT build_index(
+    const std::string &archiveName,
+    ListfileIndexer &indexer,
+    const IndexProgressCallback &progress = {},
+    u64 span = u64(64) << 20);
+
+// Returns the archive names of a split listfile starting with the given part,
+// e.g. run001_part003.zip, run001_part004.zip, ... Only existing files are
+// returned. For non-split archives the result contains just the given name.
+std::vector<std::string> LIBMVME_EXPORT split_listfile_parts(const std::string &archiveName);
+
+// Returns the name of the listfile entry of the given archive. Throws
+// std::runtime_error if the archive cannot be read or does not contain a
+// listfile.
+std::string LIBMVME_EXPORT listfile_entry_name(const std::string &archiveName);
+
+// Reads the uncompressed data of a deflate compressed listfile entry starting
+// at the access point of the given checkpoint, i.e. the first byte returned is
+// the one at checkpoint.accessOffset. The checkpoint is only used during
+// construction. Throws std::runtime_error on error.
+class LIBMVME_EXPORT DeflateAccessReader
+{
+    public:
+        DeflateAccessReader(const std::string &archiveName, const ListfileCheckpoint &checkpoint);
+        ~DeflateAccessReader();
+
+        // Returns 0 at the end of the deflate stream.
+        size_t read(u8 *dest, size_t maxSize);
+
+        // Number of compressed bytes consumed so far.
+        u64 compressedBytesRead() const;
+
+    private:
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+// mvlc ReadHandle restricting the replayed data to a timetick range.
+//
+// The file magic and preamble are read from the input handle and kept in
+// memory. Data reads then start at the checkpoint preceding startTimeticks:
+// directly from the archive if the checkpoint has a deflate access point,
+// otherwise by reading and discarding the input data up to the checkpoint.
+// Data up to the timetick frame reaching startTimeticks is skipped, reading
+// ends after the frame reaching stopTimeticks (0 means no limit).
+//
+// Seeking is supported within the preamble and the first data bytes as
+// needed by the listfile preamble readers. Reading across the end of the
+// buffered data head fails if data following it was returned before.
+class LIBMVME_EXPORT ListfileRangeReadHandle: public mesytec::mvlc::listfile::ReadHandle
+{
+    public:
+        // archiveName is used to open the archive for seeking to access
+        // points. If empty or if index is null the input handle is used for
+        // all reads.
+        ListfileRangeReadHandle(
+            mesytec::mvlc::listfile::ReadHandle *input,
+            u64 startTimeticks, u64 stopTimeticks,
+            const ListfileIndex *index = nullptr,
+            const std::string &archiveName = {});
+
+        ~ListfileRangeReadHandle() override;
+
+        size_t read(u8 *dest, size_t maxSize) override;
+        size_t seek(size_t pos) override;
+
+        // Checkpoint used as the starting point or nullptr if reading started
+        // at the beginning of the data.
+        const ListfileCheckpoint *startCheckpoint() const;
+
+    private:
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+}
+
+#endif /* __MVME_MVLC_LISTFILE_INDEX_H__ */
@@ -0,0 +1,484 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <zlib.h>
+
+#include "mvlc_listfile_index.h"
+
+using namespace mesytec::mvlc;
+using namespace mesytec::mvme_mvlc;
+
+namespace
+{
+
+u32 system_event_header(u8 subtype, u16 len)
+{
+    return (static_cast<u32>(frame_headers::SystemEvent) << frame_headers::TypeShift)
+        | (static_cast<u32>(subtype) << system_event::SubtypeShift)
+        | len;
+}
+
+u32 stack_frame_header(u8 stack, u16 len)
+{
+    return (static_cast<u32>(frame_headers::StackFrame) << frame_headers::TypeShift)
+        | (static_cast<u32>(stack) << frame_headers::StackNumShift)
+        | len;
+}
+
+// Synthetic MVLC_USB listfile data: magic, preamble, readout events for three
+// different events and one timetick after every 'eventsPerTick' events.
+struct TestListfile
+{
+    std::vector<u8> data;
+    size_t preambleSize = 0;
+    // End offsets of the timetick frames. tickEnds[0] is the end of the first
+    // timetick.
+    std::vector<u64> tickEnds;
+    std::vector<u64> eventCounts;
+
+    void push(u32 word)
+    {
+        auto bytes = reinterpret_cast<const u8 *>(&word);
+        data.insert(std::end(data), bytes, bytes + sizeof(word));
+    }
+};
+
+TestListfile make_test_listfile(unsigned ticks, unsigned eventsPerTick)
+{
+    TestListfile result;
+    std::mt19937 rng(42);
+
+    const char *magic = "MVLC_USB";
+    result.data.insert(std::end(result.data), magic, magic + 8);
+
+    result.push(system_event_header(system_event::subtype::EndianMarker, 1));
+    result.push(0x12345678u);
+    result.push(system_event_header(system_event::subtype::MVMEConfig, 100));
+    for (int i = 0; i < 100; ++i)
+        result.push(0x20202020u);
+
+    result.preambleSize = result.data.size();
+    result.push(system_event_header(system_event::subtype::BeginRun, 0));
+    result.eventCounts.resize(3);
+
+    for (unsigned tick = 0; tick < ticks; ++tick)
+    {
+        for (unsigned ev = 0; ev < eventsPerTick; ++ev)
+        {
+            const unsigned eventIndex = rng() % 3;
+            const u16 len = 1 + rng() % 64;
+            result.push(stack_frame_header(eventIndex + 1, len));
+            for (u16 i = 0; i < len; ++i)
+                result.push(rng());
+            ++result.eventCounts[eventIndex];
+        }
+
+        result.push(system_event_header(system_event::subtype::UnixTimetick, 2));
+        result.push(tick);
+        result.push(0);
+        result.tickEnds.push_back(result.data.size());
+    }
+
+    result.push(system_event_header(system_event::subtype::EndRun, 0));
+
+    return result;
+}
+
+// Writes the data as the deflate compressed entry "test.mvlclst" of a ZIP
+// archive.
+void write_test_archive(const std::string &filename, const std::vector<u8> &data)
+{
+    z_stream strm = {};
+    ASSERT_EQ(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    std::vector<u8> compressed(deflateBound(&strm, data.size()));
+    strm.next_in = const_cast<u8 *>(data.data());
+    strm.avail_in = data.size();
+    strm.next_out = compressed.data();
+    strm.avail_out = compressed.size();
+    ASSERT_EQ(deflate(&strm, Z_FINISH), Z_STREAM_END);
+    compressed.resize(strm.total_out);
+    deflateEnd(&strm);
+
+    const u32 crc = crc32(0, data.data(), data.size());
+    const std::string name = "test.mvlclst";
+
+    std::vector<u8> out;
+    auto put16 = [&out] (u16 v) { for (int i = 0; i < 2; ++i) out.push_back(v >> (8 * i)); };
+    auto put32 = [&out] (u32 v) { for (int i = 0; i < 4; ++i) out.push_back(v >> (8 * i)); };
+
+    put32(0x04034b50u); put16(20); put16(0); put16(8); put16(0); put16(0);
+    put32(crc); put32(compressed.size()); put32(data.size());
+    put16(name.size()); put16(0);
+    out.insert(std::end(out), std::begin(name), std::end(name));
+    out.insert(std::end(out), std::begin(compressed), std::end(compressed));
+
+    const u32 cdOffset = out.size();
+    put32(0x02014b50u); put16(20); put16(20); put16(0); put16(8); put16(0); put16(0);
+    put32(crc); put32(compressed.size()); put32(data.size());
+    put16(name.size()); put16(0); put16(0); put16(0); put16(0); put32(0); put32(0);
+    out.insert(std::end(out), std::begin(name), std::end(name));
+    const u32 cdSize = out.size() - cdOffset;
+
+    put32(0x06054b50u); put16(0); put16(0); put16(1); put16(1);
+    put32(cdSize); put32(cdOffset); put16(0);
+
+    std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+    f.write(reinterpret_cast<const char *>(out.data()), out.size());
+}
+
+class MemoryReadHandle: public listfile::ReadHandle
+{
+    public:
+        explicit MemoryReadHandle(const std::vector<u8> &data)
+            : data_(data)
+        {}
+
+        size_t read(u8 *dest, size_t maxSize) override
+        {
+            size_t n = std::min(maxSize, data_.size() - pos_);
+            std::memcpy(dest, data_.data() + pos_, n);
+            pos_ += n;
+            return n;
+        }
+
+        size_t seek(size_t pos) override
+        {
+            pos_ = std::min(pos, data_.size());
+            return pos_;
+        }
+
+    private:
+        const std::vector<u8> &data_;
+        size_t pos_ = 0;
+};
+
+std::vector<u8> read_all(listfile::ReadHandle &rh)
+{
+    std::vector<u8> result;
+    std::vector<u8> buffer(10000);
+
+    while (size_t n = rh.read(buffer.data(), buffer.size()))
+        result.insert(std::end(result), buffer.data(), buffer.data() + n);
+
+    return result;
+}
+
+}
+
+TEST(mvlc_listfile_index, IndexerCounts)
+{
+    auto lf = make_test_listfile(20, 100);
+
+    ListfileIndexer indexer(4096);
+    indexer.beginEntry("test.mvlclst");
+
+    // Feed the data in small odd sized chunks to test the handling of words
+    // and frames split across chunks.
+    for (size_t offset = 0; offset < lf.data.size(); offset += 7)
+        indexer.consume(lf.data.data() + offset, std::min<size_t>(7, lf.data.size() - offset));
+
+    auto index = indexer.finishEntry();
+
+    ASSERT_EQ(index.format, ListfileBufferFormat::MVLC_USB);
+    ASSERT_EQ(index.totalBytes, lf.data.size());
+    ASSERT_EQ(index.totalTimeticks, 20u);
+    ASSERT_EQ(index.totalEventCounts, lf.eventCounts);
+    ASSERT_GT(index.checkpoints.size(), 10u);
+
+    // The first checkpoint is placed directly after the preamble.
+    ASSERT_EQ(index.checkpoints.front().uncompressedOffset, lf.preambleSize);
+
+    u64 lastOffset = 0;
+
+    for (const auto &cp: index.checkpoints)
+    {
+        ASSERT_GE(cp.uncompressedOffset, lastOffset);
+        lastOffset = cp.uncompressedOffset;
+
+        // Checkpoints must point to stack frames or system events.
+        u32 header = 0;
+        std::memcpy(&header, lf.data.data() + cp.uncompressedOffset, sizeof(header));
+        auto info = extract_frame_info(header);
+        ASSERT_TRUE(info.type == frame_headers::StackFrame || info.type == frame_headers::SystemEvent);
+
+        // Rescan the prefix preceding the checkpoint and compare counters.
+        ListfileIndexer prefixIndexer;
+        prefixIndexer.beginEntry();
+        prefixIndexer.consume(lf.data.data(), cp.uncompressedOffset);
+        ASSERT_EQ(cp.timeticks, prefixIndexer.timeticks());
+        ASSERT_EQ(cp.eventCounts, prefixIndexer.eventCounts());
+    }
+}
+
+TEST(mvlc_listfile_index, IndexerCountsETH)
+{
+    // Stack frames split into ETH packets. The second packet header word
+    // holds the offset of the first frame header in the packet payload.
+    std::mt19937 rng(42);
+    std::vector<u32> frameWords;
+    std::vector<bool> isHeader;
+    std::vector<u64> eventCounts(2);
+
+    for (int i = 0; i < 500; ++i)
+    {
+        const unsigned eventIndex = rng() % 2;
+        const u16 len = rng() % 100;
+        frameWords.push_back(stack_frame_header(eventIndex + 1, len));
+        isHeader.push_back(true);
+        for (u16 j = 0; j < len; ++j)
+        {
+            frameWords.push_back(rng());
+            isHeader.push_back(false);
+        }
+        ++eventCounts[eventIndex];
+    }
+
+    TestListfile lf;
+    const char *magic = "MVLC_ETH";
+    lf.data.insert(std::end(lf.data), magic, magic + 8);
+    lf.push(system_event_header(system_event::subtype::EndianMarker, 1));
+    lf.push(0x12345678u);
+
+    const size_t PacketWords = 73;
+    unsigned ticks = 0;
+
+    for (size_t pos = 0; pos < frameWords.size(); pos += PacketWords)
+    {
+        const size_t count = std::min(PacketWords, frameWords.size() - pos);
+        u32 nextHeader = 0xffffu;
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            if (isHeader[pos + j])
+            {
+                nextHeader = j;
+                break;
+            }
+        }
+
+        lf.push((1u << 28) | count);
+        lf.push(nextHeader);
+        for (size_t j = 0; j < count; ++j)
+            lf.push(frameWords[pos + j]);
+
+        if ((pos / PacketWords) % 10 == 9)
+        {
+            lf.push(system_event_header(system_event::subtype::UnixTimetick, 0));
+            ++ticks;
+        }
+    }
+
+    ListfileIndexer indexer(1000);
+    indexer.beginEntry();
+
+    for (size_t offset = 0; offset < lf.data.size(); offset += 13)
+        indexer.consume(lf.data.data() + offset, std::min<size_t>(13, lf.data.size() - offset));
+
+    auto index = indexer.finishEntry();
+
+    ASSERT_EQ(index.format, ListfileBufferFormat::MVLC_ETH);
+    ASSERT_EQ(index.totalTimeticks, ticks);
+    ASSERT_EQ(index.totalEventCounts, eventCounts);
+    ASSERT_GT(index.checkpoints.size(), 5u);
+
+    for (const auto &cp: index.checkpoints)
+    {
+        // Checkpoints point to timeticks or to packets starting with a
+        // frame header.
+        u32 header0 = 0, header1 = 0;
+        std::memcpy(&header0, lf.data.data() + cp.uncompressedOffset, sizeof(header0));
+        std::memcpy(&header1, lf.data.data() + cp.uncompressedOffset + 4, sizeof(header1));
+        ASSERT_TRUE(extract_frame_info(header0).type == frame_headers::SystemEvent || header1 == 0);
+    }
+}
+
+TEST(mvlc_listfile_index, SidecarRoundTrip)
+{
+    ListfileIndex index;
+    index.format = ListfileBufferFormat::MVLC_ETH;
+    index.encoding = ListfileEntryEncoding::Deflate;
+    index.entryName = "run042.mvlclst";
+    index.totalBytes = 1234567;
+    index.totalTimeticks = 77;
+    index.totalEventCounts = { 1, 2, 3 };
+
+    for (int i = 0; i < 5; ++i)
+    {
+        ListfileCheckpoint cp;
+        cp.uncompressedOffset = 1000 * i + 10;
+        cp.compressedOffset = i ? 100 * i : 0;
+        cp.accessOffset = 1000 * i;
+        cp.accessBits = i;
+        cp.window.resize(i * 1000);
+        for (size_t j = 0; j < cp.window.size(); ++j)
+            cp.window[j] = j % 13;
+        cp.timeticks = 10 * i;
+        cp.eventCounts = { u64(i), u64(2 * i) };
+        index.checkpoints.push_back(cp);
+    }
+
+    const std::string filename = "test_mvlc_listfile_index.mvlcidx";
+    write_index(filename, index);
+    auto read = read_index(filename);
+    auto readNoWindows = read_index(filename, false);
+    std::remove(filename.c_str());
+
+    ASSERT_EQ(read.format, index.format);
+    ASSERT_EQ(read.encoding, index.encoding);
+    ASSERT_EQ(read.entryName, index.entryName);
+    ASSERT_EQ(read.totalBytes, index.totalBytes);
+    ASSERT_EQ(read.totalTimeticks, index.totalTimeticks);
+    ASSERT_EQ(read.totalEventCounts, index.totalEventCounts);
+    ASSERT_EQ(read.checkpoints.size(), index.checkpoints.size());
+    ASSERT_EQ(readNoWindows.checkpoints.size(), index.checkpoints.size());
+
+    for (size_t i = 0; i < index.checkpoints.size(); ++i)
+    {
+        const auto &a = index.checkpoints[i];
+        const auto &b = read.checkpoints[i];
+        ASSERT_EQ(a.uncompressedOffset, b.uncompressedOffset);
+        ASSERT_EQ(a.compressedOffset, b.compressedOffset);
+        ASSERT_EQ(a.accessOffset, b.accessOffset);
+        ASSERT_EQ(a.accessBits, b.accessBits);
+        ASSERT_EQ(a.window, b.window);
+        ASSERT_EQ(a.timeticks, b.timeticks);
+        ASSERT_EQ(a.eventCounts, b.eventCounts);
+        ASSERT_TRUE(readNoWindows.checkpoints[i].window.empty());
+        ASSERT_EQ(readNoWindows.checkpoints[i].timeticks, a.timeticks);
+    }
+
+    ASSERT_EQ(read.findCheckpoint(0), nullptr);
+    ASSERT_EQ(read.findCheckpoint(1), &read.checkpoints[0]);
+    ASSERT_EQ(read.findCheckpoint(25), &read.checkpoints[2]);
+    ASSERT_EQ(read.findCheckpoint(1000), &read.checkpoints[4]);
+}
+
+TEST(mvlc_listfile_index, BuildIndexAndReadRange)
+{
+    auto lf = make_test_listfile(50, 200);
+    const std::string archiveName = "test_mvlc_listfile_index.zip";
+    write_test_archive(archiveName, lf.data);
+
+    ListfileIndexer indexer;
+    auto index = build_index(archiveName, indexer, {}, 64 * 1024);
+
+    ASSERT_EQ(index.encoding, ListfileEntryEncoding::Deflate);
+    ASSERT_EQ(index.entryName, "test.mvlclst");
+    ASSERT_EQ(index.totalBytes, lf.data.size());
+    ASSERT_EQ(index.totalTimeticks, 50u);
+    ASSERT_EQ(index.totalEventCounts, lf.eventCounts);
+    ASSERT_GT(index.checkpoints.size(), 5u);
+
+    for (const auto &cp: index.checkpoints)
+    {
+        ASSERT_TRUE(cp.hasAccessPoint());
+        ASSERT_LE(cp.accessOffset, cp.uncompressedOffset);
+    }
+
+    const std::vector<u8> preamble(lf.data.begin(), lf.data.begin() + lf.preambleSize);
+
+    auto expected = [&] (u64 startTicks, u64 stopTicks)
+    {
+        u64 begin = startTicks ? lf.tickEnds[startTicks - 1] : lf.preambleSize;
+        u64 end = stopTicks ? lf.tickEnds[stopTicks - 1] : lf.data.size();
+        auto result = preamble;
+        result.insert(std::end(result), lf.data.begin() + begin, lf.data.begin() + end);
+        return result;
+    };
+
+    const std::vector<std::pair<u64, u64>> ranges = { {0, 0}, {1, 0}, {10, 20}, {33, 34}, {0, 5}, {49, 0} };
+
+    for (const auto &range: ranges)
+    {
+        // Inflate from the access points of the index.
+        {
+            MemoryReadHandle input(lf.data);
+            ListfileRangeReadHandle rh(&input, range.first, range.second, &index, archiveName);
+
+            if (range.first > 1)
+            {
+                ASSERT_NE(rh.startCheckpoint(), nullptr);
+                ASSERT_GT(rh.startCheckpoint()->uncompressedOffset, lf.preambleSize);
+            }
+
+            ASSERT_EQ(read_all(rh), expected(range.first, range.second))
+                << "start=" << range.first << ", stop=" << range.second;
+        }
+
+        // Read everything from the input handle.
+        {
+            MemoryReadHandle input(lf.data);
+            ListfileRangeReadHandle rh(&input, range.first, range.second);
+            ASSERT_EQ(read_all(rh), expected(range.first, range.second))
+                << "start=" << range.first << ", stop=" << range.second;
+        }
+    }
+
+    std::remove(archiveName.c_str());
+}
+
+TEST(mvlc_listfile_index, RangeReadHandleSeekInPreamble)
+{
+    auto lf = make_test_listfile(5, 10);
+    MemoryReadHandle input(lf.data);
+    ListfileRangeReadHandle rh(&input, 2, 0);
+
+    // Read past the end of the preamble, then seek back like the preamble
+    // readers do.
+    auto preamble = listfile::read_preamble(rh);
+    ASSERT_EQ(preamble.endOffset, lf.preambleSize);
+
+    std::vector<u8> magic(8);
+    rh.seek(0);
+    ASSERT_EQ(rh.read(magic.data(), magic.size()), 8u);
+    ASSERT_EQ(std::memcmp(magic.data(), "MVLC_USB", 8), 0);
+
+    rh.seek(preamble.endOffset);
+    auto data = read_all(rh);
+    std::vector<u8> expected(lf.data.begin() + lf.tickEnds[1], lf.data.end());
+    ASSERT_EQ(data, expected);
+}
+
+TEST(mvlc_listfile_index, RangeReadHandleReadAcrossDataHead)
+{
+    auto lf = make_test_listfile(50, 200);
+    const std::vector<u8> data(lf.data.begin() + lf.preambleSize, lf.data.end());
+    ASSERT_GT(data.size(), 3u << 16);
+
+    // Seek into the buffered data head and read across its end. The data
+    // continues seamlessly from the input.
+    {
+        MemoryReadHandle input(lf.data);
+        ListfileRangeReadHandle rh(&input, 0, 0);
+        std::vector<u8> buffer(1000);
+
+        rh.seek(lf.preambleSize);
+        ASSERT_EQ(rh.read(buffer.data(), buffer.size()), buffer.size());
+        rh.seek(lf.preambleSize + 100);
+
+        auto rest = read_all(rh);
+        ASSERT_EQ(rest, std::vector<u8>(data.begin() + 100, data.end()));
+    }
+
+    // Once more data than the head holds has been returned the bytes
+    // following the head are gone. Reading across the end of the head
+    // returns the buffered part, then fails instead of looping forever.
+    {
+        MemoryReadHandle input(lf.data);
+        ListfileRangeReadHandle rh(&input, 0, 0);
+        std::vector<u8> buffer(2u << 16);
+
+        rh.seek(lf.preambleSize);
+        ASSERT_EQ(rh.read(buffer.data(), buffer.size()), buffer.size());
+        rh.seek(lf.preambleSize + 100);
+
+        std::vector<u8> head(buffer.size());
+        const size_t n = rh.read(head.data(), head.size());
+        ASSERT_EQ(n, (1u << 16) - 100);
+        ASSERT_TRUE(std::equal(head.begin(), head.begin() + n, data.begin() + 100));
+        ASSERT_THROW(rh.read(head.data(), head.size()), std::runtime_error);
+    }
+}
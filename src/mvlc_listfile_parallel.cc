@@ -0,0 +1,516 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "mvlc_listfile_parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "mvlc_listfile_zstd.h"
+
+using namespace mesytec::mvlc;
+
+namespace mesytec::mvme_mvlc
+{
+
+namespace
+{
+
+static const u64 NoLimit = std::numeric_limits<u64>::max();
+
+// Reads the listfile entry of one part of a split listfile.
+class ZipPartSource: public ListfileSegmentSource
+{
+    public:
+        ZipPartSource(const std::string &archiveName, bool skipPreamble)
+        {
+            zipReader_.openArchive(archiveName);
+            // The parts are already decompressed in parallel, one thread per
+            // part is enough.
+            readHandle_ = open_listfile_entry(
+                zipReader_, listfile_entry_name(archiveName), zstdReadHandle_, 1);
+
+            if (skipPreamble)
+            {
+                auto preamble = listfile::read_preamble(*readHandle_);
+                readHandle_->seek(preamble.endOffset);
+            }
+
+            std::ifstream in(archiveName, std::ios::binary | std::ios::ate);
+            fileSize_ = in ? static_cast<u64>(in.tellg()) : 0u;
+        }
+
+        size_t read(u8 *dest, size_t maxSize) override
+        {
+            size_t bytesRead = readHandle_->read(dest, maxSize);
+            eof_ = bytesRead == 0;
+            return bytesRead;
+        }
+
+        // The ZIP reader does not report its input position. The size of the
+        // archive is accounted for once the part has been read completely.
+        u64 compressedBytesRead() const override
+        {
+            if (zstdReadHandle_)
+                return zstdReadHandle_->compressedBytesRead();
+
+            return eof_ ? fileSize_ : 0u;
+        }
+
+    private:
+        listfile::ZipReader zipReader_;
+        listfile::ReadHandle *readHandle_ = nullptr;
+        std::unique_ptr<ZstdReadHandle> zstdReadHandle_;
+        u64 fileSize_ = 0;
+        bool eof_ = false;
+};
+
+// Inflates the data in [begin, end) starting from a deflate access point.
+class DeflateSegmentSource: public ListfileSegmentSource
+{
+    public:
+        DeflateSegmentSource(const std::string &archiveName, const ListfileCheckpoint &cp,
+                             u64 begin, u64 end)
+            : reader_(archiveName, cp)
+            , skip_(begin - cp.accessOffset)
+            , left_(end == NoLimit ? NoLimit : end - begin)
+        {
+        }
+
+        size_t read(u8 *dest, size_t maxSize) override
+        {
+            // Data between the access point and the segment start belongs to
+            // the preceding segment.
+            while (skip_)
+            {
+                size_t bytesRead = reader_.read(dest, std::min<u64>(skip_, maxSize));
+
+                if (bytesRead == 0)
+                    throw std::runtime_error("parallel listfile read: unexpected end of deflate data");
+
+                skip_ -= bytesRead;
+            }
+
+            size_t bytesRead = reader_.read(dest, std::min<u64>(left_, maxSize));
+
+            if (left_ != NoLimit)
+                left_ -= bytesRead;
+
+            return bytesRead;
+        }
+
+        u64 compressedBytesRead() const override
+        {
+            return reader_.compressedBytesRead();
+        }
+
+    private:
+        DeflateAccessReader reader_;
+        u64 skip_;
+        u64 left_;
+};
+
+} // end anon namespace
+
+std::vector<ListfileSegment> make_split_listfile_segments(const std::vector<std::string> &parts)
+{
+    std::vector<ListfileSegment> result;
+
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        result.emplace_back([archiveName = parts[i], skipPreamble = i > 0] ()
+        {
+            return std::make_unique<ZipPartSource>(archiveName, skipPreamble);
+        });
+    }
+
+    return result;
+}
+
+std::vector<ListfileSegment> make_deflate_segments(const std::string &archiveName, const ListfileIndex &index)
+{
+    if (index.encoding != ListfileEntryEncoding::Deflate)
+        return {};
+
+    // Start offsets and access points of the segments.
+    std::vector<std::pair<u64, const ListfileCheckpoint *>> starts;
+
+    for (const auto &cp: index.checkpoints)
+    {
+        if (!cp.hasAccessPoint())
+            continue;
+
+        if (starts.empty())
+        {
+            // The first segment has to start at the beginning of the data.
+            if (cp.accessOffset != 0)
+                return {};
+
+            starts.emplace_back(0, &cp);
+        }
+        else if (cp.uncompressedOffset > starts.back().first)
+            starts.emplace_back(cp.uncompressedOffset, &cp);
+    }
+
+    std::vector<ListfileSegment> result;
+
+    for (size_t i = 0; i < starts.size(); ++i)
+    {
+        const u64 begin = starts[i].first;
+        const u64 end = i + 1 < starts.size() ? starts[i + 1].first : NoLimit;
+
+        result.emplace_back([archiveName, cp = *starts[i].second, begin, end] ()
+        {
+            return std::make_unique<DeflateSegmentSource>(archiveName, cp, begin, end);
+        });
+    }
+
+    return result;
+}
+
+//
+// ParallelListfileReadHandle
+//
+
+struct ParallelListfileReadHandle::Private
+{
+    // Number of data bytes kept from the start of the stream to support the
+    // seeks done by the listfile preamble readers.
+    static const size_t HeadSize = 4u << 20;
+
+    struct Buffer
+    {
+        size_t segment = 0;
+        u64 sequence = 0;
+        std::vector<u8> data;
+    };
+
+    struct SegmentState
+    {
+        std::deque<Buffer> queue;
+        u64 nextSequence = 0;   // next sequence number assigned by the worker
+        bool done = false;
+        std::exception_ptr error;
+    };
+
+    std::vector<ListfileSegment> segments;
+    size_t bufferSize = DefaultBufferSize;
+    size_t queueDepth = DefaultQueueDepth;
+
+    // Shared between the workers and the reader.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<SegmentState> states;
+    size_t nextSegment = 0; // next segment to be picked up by a worker
+    bool quit = false;
+    std::vector<std::thread> threads;
+
+    std::atomic<u64> compressedBytes;
+    std::atomic<u64> decompressedBytes;
+    std::atomic<u64> deliveredBytes;
+    std::atomic<u64> buffersDelivered;
+    std::atomic<u64> segmentsDone;
+
+    // Reader side.
+    size_t readSegment = 0;
+    u64 expectedSequence = 0;
+    Buffer current;
+    size_t currentPos = 0;
+    std::vector<u8> head;
+    u64 pos = 0;        // position as seen by the user of the handle
+    u64 streamPos = 0;  // number of bytes taken from the buffers
+
+    Private()
+        : compressedBytes(0)
+        , decompressedBytes(0)
+        , deliveredBytes(0)
+        , buffersDelivered(0)
+        , segmentsDone(0)
+    {}
+
+    void worker();
+    void decompressSegment(size_t index);
+    bool nextBuffer();
+    size_t readStream(u8 *dest, size_t maxSize);
+};
+
+void ParallelListfileReadHandle::Private::worker()
+{
+    while (true)
+    {
+        size_t index = 0;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            if (quit || nextSegment >= segments.size())
+                return;
+
+            index = nextSegment++;
+        }
+
+        try
+        {
+            decompressSegment(index);
+        }
+        catch (...)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                states[index].error = std::current_exception();
+                states[index].done = true;
+            }
+
+            cv.notify_all();
+        }
+    }
+}
+
+void ParallelListfileReadHandle::Private::decompressSegment(size_t index)
+{
+    auto source = segments[index]();
+    auto &state = states[index];
+    u64 lastCompressed = 0;
+    bool eof = false;
+
+    while (!eof)
+    {
+        Buffer buffer;
+        buffer.segment = index;
+        buffer.data.resize(bufferSize);
+        size_t used = 0;
+
+        while (used < bufferSize)
+        {
+            size_t bytesRead = source->read(buffer.data.data() + used, bufferSize - used);
+
+            if (bytesRead == 0)
+            {
+                eof = true;
+                break;
+            }
+
+            used += bytesRead;
+        }
+
+        buffer.data.resize(used);
+
+        const u64 compressed = source->compressedBytesRead();
+        compressedBytes += compressed - std::min(compressed, lastCompressed);
+        lastCompressed = std::max(compressed, lastCompressed);
+        decompressedBytes += used;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return quit || state.queue.size() < queueDepth; });
+
+            if (quit)
+                return;
+
+            if (used)
+            {
+                buffer.sequence = state.nextSequence++;
+                state.queue.emplace_back(std::move(buffer));
+            }
+
+            state.done = eof;
+        }
+
+        cv.notify_all();
+    }
+}
+
+bool ParallelListfileReadHandle::Private::nextBuffer()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (readSegment < states.size())
+    {
+        auto &state = states[readSegment];
+        cv.wait(lock, [&state] { return !state.queue.empty() || state.done; });
+
+        if (!state.queue.empty())
+        {
+            current = std::move(state.queue.front());
+            state.queue.pop_front();
+            lock.unlock();
+            cv.notify_all();
+
+            if (current.segment != readSegment || current.sequence != expectedSequence)
+                throw std::runtime_error("parallel listfile read: buffer sequence mismatch");
+
+            ++expectedSequence;
+            currentPos = 0;
+            ++buffersDelivered;
+            return true;
+        }
+
+        if (state.error)
+            std::rethrow_exception(state.error);
+
+        ++readSegment;
+        expectedSequence = 0;
+        ++segmentsDone;
+    }
+
+    return false;
+}
+
+size_t ParallelListfileReadHandle::Private::readStream(u8 *dest, size_t maxSize)
+{
+    size_t total = 0;
+
+    while (total < maxSize)
+    {
+        if (currentPos == current.data.size() && !nextBuffer())
+            break;
+
+        size_t n = std::min(maxSize - total, current.data.size() - currentPos);
+        std::memcpy(dest + total, current.data.data() + currentPos, n);
+
+        if (head.size() < HeadSize)
+        {
+            size_t toKeep = std::min(n, HeadSize - head.size());
+            head.insert(std::end(head), dest + total, dest + total + toKeep);
+        }
+
+        currentPos += n;
+        total += n;
+    }
+
+    streamPos += total;
+    deliveredBytes += total;
+    return total;
+}
+
+ParallelListfileReadHandle::ParallelListfileReadHandle(
+    std::vector<ListfileSegment> segments,
+    unsigned threads,
+    size_t bufferSize,
+    size_t queueDepth)
+    : d(std::make_unique<Private>())
+{
+    if (threads == 0)
+        threads = zstd_default_thread_count();
+
+    d->segments = std::move(segments);
+    d->bufferSize = std::max<size_t>(bufferSize, 1u);
+    d->queueDepth = std::max<size_t>(queueDepth, 1u);
+    d->states.resize(d->segments.size());
+
+    threads = std::min<size_t>(threads, std::max<size_t>(d->segments.size(), 1u));
+
+    for (unsigned i = 0; i < threads; ++i)
+        d->threads.emplace_back([this] { d->worker(); });
+}
+
+ParallelListfileReadHandle::~ParallelListfileReadHandle()
+{
+    {
+        std::unique_lock<std::mutex> lock(d->mutex);
+        d->quit = true;
+    }
+
+    d->cv.notify_all();
+
+    for (auto &t: d->threads)
+        t.join();
+}
+
+size_t ParallelListfileReadHandle::read(u8 *dest, size_t maxSize)
+{
+    size_t total = 0;
+
+    // Serve bytes already taken from the buffers from the kept head data.
+    if (d->pos < d->streamPos)
+    {
+        if (d->pos >= d->head.size())
+            throw std::runtime_error("parallel listfile read: position is outside the kept data");
+
+        size_t n = std::min<u64>(maxSize, std::min<u64>(d->head.size(), d->streamPos) - d->pos);
+        std::memcpy(dest, d->head.data() + d->pos, n);
+        d->pos += n;
+        total += n;
+    }
+
+    if (total < maxSize && d->pos == d->streamPos)
+    {
+        size_t n = d->readStream(dest + total, maxSize - total);
+        d->pos += n;
+        total += n;
+    }
+
+    return total;
+}
+
+size_t ParallelListfileReadHandle::seek(size_t pos)
+{
+    if (pos <= d->streamPos)
+    {
+        if (pos < d->streamPos && pos >= d->head.size())
+            throw std::runtime_error("parallel listfile read: cannot seek backwards outside the kept data");
+
+        d->pos = pos;
+        return d->pos;
+    }
+
+    d->pos = d->streamPos;
+    std::vector<u8> buffer(std::min<u64>(pos - d->streamPos, d->bufferSize));
+
+    while (d->pos < pos)
+    {
+        size_t n = d->readStream(buffer.data(), std::min<u64>(pos - d->pos, buffer.size()));
+
+        if (n == 0)
+            break;
+
+        d->pos += n;
+    }
+
+    return d->pos;
+}
+
+unsigned ParallelListfileReadHandle::threadCount() const
+{
+    return d->threads.size();
+}
+
+ParallelListfileReadHandle::Counters ParallelListfileReadHandle::counters() const
+{
+    Counters result = {};
+    result.compressedBytes = d->compressedBytes;
+    result.decompressedBytes = d->decompressedBytes;
+    result.deliveredBytes = d->deliveredBytes;
+    result.buffersDelivered = d->buffersDelivered;
+    result.segmentsDone = d->segmentsDone;
+    result.segmentsTotal = d->segments.size();
+    return result;
+}
+
+}
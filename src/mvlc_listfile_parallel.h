@@ -0,0 +1,125 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __MVME_MVLC_LISTFILE_PARALLEL_H__
+#define __MVME_MVLC_LISTFILE_PARALLEL_H__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mesytec-mvlc/mvlc_listfile.h>
+
+#include "libmvme_export.h"
+#include "mvlc_listfile_index.h"
+#include "typedefs.h"
+
+namespace mesytec::mvme_mvlc
+{
+
+// Parallel decompression of MVLC listfiles for the replay.
+//
+// The uncompressed listfile data is split into segments which can be
+// decompressed independently of each other: the parts of a split listfile or
+// the data between the deflate access points of a listfile index. A pool of
+// worker threads decompresses the segments into sequence numbered buffers.
+// ParallelListfileReadHandle hands the buffers out in order, so the readout
+// parser sees the same byte stream as with sequential decompression.
+
+// Data source of one segment. Used from a single worker thread.
+class LIBMVME_EXPORT ListfileSegmentSource
+{
+    public:
+        virtual ~ListfileSegmentSource() {}
+
+        // Returns 0 at the end of the segment.
+        virtual size_t read(u8 *dest, size_t maxSize) = 0;
+
+        // Compressed input consumed so far, 0 if unknown.
+        virtual u64 compressedBytesRead() const = 0;
+};
+
+// Opens the source of a segment. Called from the worker thread decompressing
+// the segment.
+using ListfileSegment = std::function<std::unique_ptr<ListfileSegmentSource> ()>;
+
+// One segment per part of a split listfile. The file magic and preamble are
+// only kept for the first part, matching the data returned by the
+// SplitZipReader. zstd compressed parts are detected and handled.
+std::vector<ListfileSegment> LIBMVME_EXPORT make_split_listfile_segments(
+    const std::vector<std::string> &parts);
+
+// One segment per deflate access point of the index. Returns an empty vector
+// if the index does not describe a deflate entry or lacks an access point at
+// the start of the data.
+std::vector<ListfileSegment> LIBMVME_EXPORT make_deflate_segments(
+    const std::string &archiveName, const ListfileIndex &index);
+
+// ReadHandle returning the data of the segments in order.
+//
+// Up to 'threads' segments are decompressed concurrently, each into its own
+// bounded queue of buffers. Errors from the workers are rethrown from read()
+// once the reader reaches the affected segment.
+//
+// Seeking is supported within the first data bytes as needed by the listfile
+// preamble readers and forward by discarding data.
+class LIBMVME_EXPORT ParallelListfileReadHandle: public mesytec::mvlc::listfile::ReadHandle
+{
+    public:
+        static const size_t DefaultBufferSize = 1u << 20;
+        static const size_t DefaultQueueDepth = 4;
+
+        // Per-stage counters. Updated by the workers and the reader.
+        struct Counters
+        {
+            u64 compressedBytes;    // compressed input consumed by the workers (if known)
+            u64 decompressedBytes;  // uncompressed data produced by the workers
+            u64 deliveredBytes;     // data returned in order from read()
+            u64 buffersDelivered;   // buffers consumed by read()
+            u64 segmentsDone;       // segments fully consumed by read()
+            u64 segmentsTotal;
+        };
+
+        // threads: number of worker threads. 0 selects
+        // zstd_default_thread_count().
+        explicit ParallelListfileReadHandle(
+            std::vector<ListfileSegment> segments,
+            unsigned threads = 0,
+            size_t bufferSize = DefaultBufferSize,
+            size_t queueDepth = DefaultQueueDepth);
+
+        // Stops and joins the workers.
+        ~ParallelListfileReadHandle() override;
+
+        size_t read(u8 *dest, size_t maxSize) override;
+        size_t seek(size_t pos) override;
+
+        unsigned threadCount() const;
+        Counters counters() const;
+
+    private:
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+}
+
+#endif /* __MVME_MVLC_LISTFILE_PARALLEL_H__ */
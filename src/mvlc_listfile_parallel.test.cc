@@ -0,0 +1,254 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <zlib.h>
+
+#include "mvlc_listfile_parallel.h"
+
+using namespace mesytec::mvlc;
+using namespace mesytec::mvme_mvlc;
+
+namespace
+{
+
+// Segment source returning a range of a memory buffer in small reads.
+class MemorySource: public ListfileSegmentSource
+{
+    public:
+        MemorySource(const std::vector<u8> &data, size_t begin, size_t end)
+            : data_(data)
+            , pos_(begin)
+            , end_(end)
+        {}
+
+        size_t read(u8 *dest, size_t maxSize) override
+        {
+            size_t n = std::min({ maxSize, end_ - pos_, size_t(777) });
+            std::memcpy(dest, data_.data() + pos_, n);
+            pos_ += n;
+            return n;
+        }
+
+        u64 compressedBytesRead() const override { return 0; }
+
+    private:
+        const std::vector<u8> &data_;
+        size_t pos_;
+        size_t end_;
+};
+
+std::vector<u8> make_test_data(size_t size)
+{
+    std::mt19937 rng(1234);
+    std::vector<u8> result(size);
+
+    for (auto &b: result)
+        b = rng();
+
+    return result;
+}
+
+std::vector<ListfileSegment> make_memory_segments(const std::vector<u8> &data, const std::vector<size_t> &bounds)
+{
+    std::vector<ListfileSegment> result;
+
+    for (size_t i = 0; i + 1 < bounds.size(); ++i)
+    {
+        result.emplace_back([&data, begin = bounds[i], end = bounds[i + 1]] ()
+        {
+            return std::make_unique<MemorySource>(data, begin, end);
+        });
+    }
+
+    return result;
+}
+
+std::vector<u8> read_all(listfile::ReadHandle &rh, size_t chunkSize = 10000)
+{
+    std::vector<u8> result;
+    std::vector<u8> buffer(chunkSize);
+
+    while (size_t n = rh.read(buffer.data(), buffer.size()))
+        result.insert(std::end(result), buffer.data(), buffer.data() + n);
+
+    return result;
+}
+
+// Minimal MVLC_USB listfile: magic, endian marker, timeticks with stack frames.
+std::vector<u8> make_test_listfile(unsigned frames)
+{
+    std::vector<u8> result;
+    std::mt19937 rng(42);
+
+    auto push = [&result] (u32 word)
+    {
+        auto bytes = reinterpret_cast<const u8 *>(&word);
+        result.insert(std::end(result), bytes, bytes + sizeof(word));
+    };
+
+    const char *magic = "MVLC_USB";
+    result.insert(std::end(result), magic, magic + 8);
+
+    push((u32(frame_headers::SystemEvent) << frame_headers::TypeShift)
+         | (u32(system_event::subtype::EndianMarker) << system_event::SubtypeShift) | 1);
+    push(0x12345678u);
+
+    for (unsigned i = 0; i < frames; ++i)
+    {
+        const u16 len = 1 + rng() % 64;
+        push((u32(frame_headers::StackFrame) << frame_headers::TypeShift)
+             | (1u << frame_headers::StackNumShift) | len);
+        for (u16 j = 0; j < len; ++j)
+            push(rng() % 1000);
+    }
+
+    return result;
+}
+
+// Writes the data as the deflate compressed entry "test.mvlclst" of a ZIP
+// archive.
+void write_test_archive(const std::string &filename, const std::vector<u8> &data)
+{
+    z_stream strm = {};
+    ASSERT_EQ(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY), Z_OK);
+    std::vector<u8> compressed(deflateBound(&strm, data.size()));
+    strm.next_in = const_cast<u8 *>(data.data());
+    strm.avail_in = data.size();
+    strm.next_out = compressed.data();
+    strm.avail_out = compressed.size();
+    ASSERT_EQ(deflate(&strm, Z_FINISH), Z_STREAM_END);
+    compressed.resize(strm.total_out);
+    deflateEnd(&strm);
+
+    const u32 crc = crc32(0, data.data(), data.size());
+    const std::string name = "test.mvlclst";
+
+    std::vector<u8> out;
+    auto put16 = [&out] (u16 v) { for (int i = 0; i < 2; ++i) out.push_back(v >> (8 * i)); };
+    auto put32 = [&out] (u32 v) { for (int i = 0; i < 4; ++i) out.push_back(v >> (8 * i)); };
+
+    put32(0x04034b50u); put16(20); put16(0); put16(8); put16(0); put16(0);
+    put32(crc); put32(compressed.size()); put32(data.size());
+    put16(name.size()); put16(0);
+    out.insert(std::end(out), std::begin(name), std::end(name));
+    out.insert(std::end(out), std::begin(compressed), std::end(compressed));
+
+    const u32 cdOffset = out.size();
+    put32(0x02014b50u); put16(20); put16(20); put16(0); put16(8); put16(0); put16(0);
+    put32(crc); put32(compressed.size()); put32(data.size());
+    put16(name.size()); put16(0); put16(0); put16(0); put16(0); put32(0); put32(0);
+    out.insert(std::end(out), std::begin(name), std::end(name));
+    const u32 cdSize = out.size() - cdOffset;
+
+    put32(0x06054b50u); put16(0); put16(0); put16(1); put16(1);
+    put32(cdSize); put32(cdOffset); put16(0);
+
+    std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+    f.write(reinterpret_cast<const char *>(out.data()), out.size());
+}
+
+}
+
+TEST(mvlc_listfile_parallel, SegmentsInOrder)
+{
+    const auto data = make_test_data(300000);
+    const std::vector<size_t> bounds = { 0, 1, 5000, 5000, 100000, 100001, 250000, 300000 };
+
+    for (unsigned threads: { 1, 2, 4, 8 })
+    {
+        // Small buffers and queues to exercise the blocking paths.
+        ParallelListfileReadHandle rh(make_memory_segments(data, bounds), threads, 1000, 2);
+        ASSERT_EQ(read_all(rh, 3333), data) << "threads=" << threads;
+
+        auto counters = rh.counters();
+        ASSERT_EQ(counters.decompressedBytes, data.size());
+        ASSERT_EQ(counters.deliveredBytes, data.size());
+        ASSERT_EQ(counters.segmentsDone, bounds.size() - 1);
+        ASSERT_EQ(counters.segmentsTotal, bounds.size() - 1);
+    }
+
+    // No segments at all.
+    ParallelListfileReadHandle rh({}, 2);
+    ASSERT_TRUE(read_all(rh).empty());
+}
+
+TEST(mvlc_listfile_parallel, Seek)
+{
+    const auto data = make_test_data(100000);
+    ParallelListfileReadHandle rh(make_memory_segments(data, { 0, 10, 50000, 100000 }), 3, 4096, 2);
+
+    auto read_at = [&rh] (size_t pos, size_t size)
+    {
+        std::vector<u8> result(size);
+        rh.seek(pos);
+        result.resize(rh.read(result.data(), result.size()));
+        return result;
+    };
+
+    auto expected_at = [&data] (size_t pos, size_t size)
+    {
+        return std::vector<u8>(data.begin() + pos, data.begin() + std::min(pos + size, data.size()));
+    };
+
+    // Like the preamble readers: read ahead, seek back, continue.
+    for (size_t pos: { 0, 8, 20000, 5, 60000, 99950 })
+        ASSERT_EQ(read_at(pos, 100), expected_at(pos, 100)) << "pos=" << pos;
+
+    ASSERT_EQ(rh.seek(data.size() + 100), data.size());
+}
+
+TEST(mvlc_listfile_parallel, WorkerErrors)
+{
+    const auto data = make_test_data(10000);
+    auto segments = make_memory_segments(data, { 0, 5000, 10000 });
+
+    segments.emplace_back([] () -> std::unique_ptr<ListfileSegmentSource>
+    {
+        throw std::runtime_error("segment error");
+    });
+
+    ParallelListfileReadHandle rh(std::move(segments), 2);
+
+    // The data preceding the failed segment is returned first.
+    std::vector<u8> buffer(data.size());
+    size_t total = 0;
+
+    while (total < buffer.size())
+        total += rh.read(buffer.data() + total, buffer.size() - total);
+
+    ASSERT_EQ(buffer, data);
+    ASSERT_THROW(rh.read(buffer.data(), buffer.size()), std::runtime_error);
+}
+
+TEST(mvlc_listfile_parallel, DeflateSegments)
+{
+    const auto data = make_test_listfile(20000);
+    const std::string archiveName = "test_mvlc_listfile_parallel.zip";
+    write_test_archive(archiveName, data);
+
+    ListfileIndexer indexer;
+    auto index = build_index(archiveName, indexer, {}, 64 * 1024);
+    auto segments = make_deflate_segments(archiveName, index);
+
+    ASSERT_GT(segments.size(), 5u);
+
+    {
+        ParallelListfileReadHandle rh(segments, 4, 100000, 2);
+        ASSERT_EQ(read_all(rh), data);
+
+        auto counters = rh.counters();
+        ASSERT_EQ(counters.segmentsDone, segments.size());
+        ASSERT_GT(counters.compressedBytes, 0u);
+    }
+
+    // Indexes without access points cannot be split.
+    for (auto &cp: index.checkpoints)
+        cp.compressedOffset = 0;
+
+    ASSERT_TRUE(make_deflate_segments(archiveName, index).empty());
+
+    std::remove(archiveName.c_str());
+}
@@ -8,6 +8,7 @@
 #include "listfile_replay.h"
 #include "mvlc/vmeconfig_to_crateconfig.h"
 #include "mvme_mvlc_listfile.h"
+#include "mvlc_listfile_zstd.h"
 
 using std::cerr;
 using std::cout;
@@ -53,10 +54,14 @@ int main(int argc, char *argv[])
 
         auto mvlcCrateConfig = vmeconfig_to_crateconfig(vmeConfig.get());
 
-        // Reopen the input listfile using the mesytec::mvlc::ZipReader
+        // Reopen the input listfile using the mesytec::mvlc::ZipReader.
+        // Compressed input is decompressed, the output is always written
+        // uncompressed.
         mvlc::listfile::ZipReader zipReader;
         zipReader.openArchive(listfileHandle.inputFilename.toStdString());
-        auto readHandle = zipReader.openEntry(listfileHandle.listfileFilename.toStdString());
+        std::unique_ptr<mvme_mvlc::ZstdReadHandle> zstdHandle;
+        auto readHandle = mvme_mvlc::open_listfile_entry(
+            zipReader, listfileHandle.listfileFilename.toStdString(), zstdHandle);
 
         // Read and skip past the preamble so that we do not read it again in the
         // loop below.
@@ -21,6 +21,7 @@
 #include "mvlc_listfile_worker.h"
 
 #include <cassert>
+#include <optional>
 #include <QCoreApplication>
 #include <QDebug>
 #include <QThread>
@@ -31,6 +32,9 @@
 #include <stdexcept>
 
 #include "mvlc/mvlc_util.h"
+#include "mvlc_listfile_index.h"
+#include "mvlc_listfile_parallel.h"
+#include "mvlc_listfile_zstd.h"
 #include "mvme_mvlc_listfile.h"
 #include "util/qt_fs.h"
 #include "util_zip.h"
@@ -78,6 +82,17 @@ struct MVLCListfileWorker::Private
     std::unique_ptr<mesytec::mvlc::ReplayWorker> mvlcReplayWorker;
     std::unique_ptr<mesytec::mvlc::listfile::ZipReader> mvlcZipReader;
     std::unique_ptr<mesytec::mvlc::listfile::SplitZipReader> mvlcSplitZipReader;
+    // Parallel decompression of zstd listfiles. Wraps the zip reader handles.
+    std::unique_ptr<mesytec::mvme_mvlc::ZstdReadHandle> zstdReadHandle;
+    // Parallel decompression of split listfile parts or deflate blocks. Used
+    // instead of the zip readers.
+    std::unique_ptr<mesytec::mvme_mvlc::ParallelListfileReadHandle> parallelReadHandle;
+    std::vector<std::string> parallelParts;
+    u64 parallelPartsDone = 0;
+    // Replay time range support. The range handle wraps the zip reader
+    // handles and has to be destroyed before them.
+    std::optional<mesytec::mvme_mvlc::ListfileIndex> listfileIndex;
+    std::unique_ptr<mesytec::mvme_mvlc::ListfileRangeReadHandle> rangeReadHandle;
 
     explicit Private(MVLCListfileWorker *q_)
         : q(q_)
@@ -94,6 +109,24 @@ struct MVLCListfileWorker::Private
         daqStats->totalBytesRead = counters.bytesRead;
         daqStats->totalBuffersRead = counters.buffersRead;
         daqStats->buffersFlushed = counters.buffersFlushed;
+
+        if (parallelReadHandle)
+        {
+            auto pc = parallelReadHandle->counters();
+            daqStats->replayCompressedBytes = pc.compressedBytes;
+            daqStats->replayDecompressedBytes = pc.decompressedBytes;
+            daqStats->replayDeliveredBytes = pc.deliveredBytes;
+            daqStats->replayDecompressionThreads = parallelReadHandle->threadCount();
+
+            // Emulates the archive changed callback of the SplitZipReader.
+            if (pc.segmentsDone > parallelPartsDone && pc.segmentsDone < parallelParts.size())
+            {
+                parallelPartsDone = pc.segmentsDone;
+                auto inputFilename = filepath_relative_to_cwd(QString::fromStdString(parallelParts[parallelPartsDone]));
+                logMessage(QSL("Now replaying from %1").arg(inputFilename));
+                emit q->currentFilenameChanged(inputFilename);
+            }
+        }
     }
 
     template<typename Cond>
@@ -212,10 +245,100 @@ void MVLCListfileWorker::start()
 
         mvlc::listfile::ReadHandle *readHandle = nullptr;
 
-        if (!d->replayHandle->options.replayAllParts)
+        const auto &options = d->replayHandle->options;
+        const u64 startTicks = options.replayStart.count();
+        const u64 stopTicks = options.replayStop.count();
+        const bool useRange = startTicks || stopTicks;
+        auto archiveName = d->replayHandle->inputFilename.toStdString();
+
+        d->rangeReadHandle = {};
+        d->zstdReadHandle = {};
+        d->parallelReadHandle = {};
+        d->parallelParts = {};
+        d->parallelPartsDone = 0;
+        d->listfileIndex = {};
+        d->mvlcZipReader = {};
+        d->mvlcSplitZipReader = {};
+
+        if (!options.replayAllParts)
+        {
+            if (useRange)
+                d->listfileIndex = mvme_mvlc::load_index(archiveName);
+        }
+        else if (useRange)
+        {
+            // Start at the part containing the start timetick. Requires the
+            // index files of all parts up to that part as the counters in
+            // the index are cumulative.
+            auto parts = mvme_mvlc::split_listfile_parts(archiveName);
+
+            for (const auto &part: parts)
+            {
+                auto partIndex = mvme_mvlc::load_index(part, false);
+
+                if (!partIndex)
+                    break;
+
+                if (partIndex->totalTimeticks >= startTicks || part == parts.back())
+                {
+                    if (part != archiveName)
+                    {
+                        logMessage(QSL("Skipping to listfile part %1")
+                                   .arg(filepath_relative_to_cwd(QString::fromStdString(part))));
+                        archiveName = part;
+                    }
+
+                    d->listfileIndex = mvme_mvlc::load_index(part);
+                    break;
+                }
+            }
+        }
+
+        // With an index the range handle inflates directly from the access
+        // points of single archives.
+        const bool useParallel = options.parallelDecompression
+            && (options.replayAllParts || !useRange || !d->listfileIndex);
+
+        if (options.parallelDecompression && !useParallel)
+            logMessage(QSL("Parallel decompression is not used for range replays of indexed archives."));
+
+        if (useParallel)
+        {
+            std::vector<mvme_mvlc::ListfileSegment> segments;
+
+            if (options.replayAllParts)
+            {
+                d->parallelParts = mvme_mvlc::split_listfile_parts(archiveName);
+                segments = mvme_mvlc::make_split_listfile_segments(d->parallelParts);
+            }
+            else
+            {
+                if (auto index = mvme_mvlc::load_index(archiveName))
+                    segments = mvme_mvlc::make_deflate_segments(archiveName, *index);
+
+                // Without deflate access points the archive is decompressed
+                // by a single thread, still running in parallel to the
+                // readout parser.
+                if (segments.empty())
+                {
+                    logMessage(QSL("No listfile index with deflate access points found,"
+                                   " decompressing using a single thread. Use mvme_listfile_index to create one."));
+                    segments = mvme_mvlc::make_split_listfile_segments({ archiveName });
+                }
+            }
+
+            const auto segmentCount = segments.size();
+            d->parallelReadHandle = std::make_unique<mvme_mvlc::ParallelListfileReadHandle>(std::move(segments));
+            readHandle = d->parallelReadHandle.get();
+
+            logMessage(QSL("Parallel decompression: %1 segments, %2 threads")
+                       .arg(segmentCount)
+                       .arg(d->parallelReadHandle->threadCount()));
+        }
+        else if (!options.replayAllParts)
         {
             d->mvlcZipReader = std::make_unique<mvlc::listfile::ZipReader>();
-            d->mvlcZipReader->openArchive(d->replayHandle->inputFilename.toStdString());
+            d->mvlcZipReader->openArchive(archiveName);
             readHandle = d->mvlcZipReader->openEntry(d->replayHandle->listfileFilename.toStdString());
         }
         else
@@ -230,10 +353,49 @@ void MVLCListfileWorker::start()
 
             d->mvlcSplitZipReader = std::make_unique<mvlc::listfile::SplitZipReader>();
             d->mvlcSplitZipReader->setArchiveChangedCallback(on_archive_changed);
-            d->mvlcSplitZipReader->openArchive(d->replayHandle->inputFilename.toStdString());
+            d->mvlcSplitZipReader->openArchive(archiveName);
             readHandle = d->mvlcSplitZipReader->openFirstListfileEntry();
         }
 
+        // The parallel handle decompresses zstd parts itself.
+        if (!d->parallelReadHandle)
+            readHandle = mvme_mvlc::make_listfile_read_handle(readHandle, d->zstdReadHandle);
+
+        if (d->zstdReadHandle)
+        {
+            logMessage(QSL("Decompressing zstd listfile using %1 threads")
+                       .arg(mvme_mvlc::zstd_default_thread_count()));
+        }
+
+        if (useRange)
+        {
+            if (!d->listfileIndex)
+                logMessage(QSL("No listfile index found, replaying from the start of the data."
+                               " Use mvme_listfile_index to create one."));
+
+            // Seeking to deflate access points is only done when replaying a
+            // single archive. Split replays discard data from the reader.
+            d->rangeReadHandle = std::make_unique<mvme_mvlc::ListfileRangeReadHandle>(
+                readHandle, startTicks, stopTicks,
+                d->listfileIndex ? &*d->listfileIndex : nullptr,
+                options.replayAllParts ? std::string{} : archiveName);
+
+            readHandle = d->rangeReadHandle.get();
+
+            logMessage(QSL("Replay range: %1 s to %2")
+                       .arg(startTicks)
+                       .arg(stopTicks ? QSL("%1 s").arg(stopTicks) : QSL("end")));
+
+            if (auto cp = d->rangeReadHandle->startCheckpoint())
+            {
+                logMessage(QSL("Starting at index checkpoint: offset=%1 MB, timeticks=%2%3")
+                           .arg(cp->uncompressedOffset / (1024.0 * 1024.0), 0, 'f', 2)
+                           .arg(cp->timeticks)
+                           .arg(cp->hasAccessPoint() && !options.replayAllParts
+                                ? QSL(", seeking to access point") : QString()));
+            }
+        }
+
         d->mvlcReplayWorker = std::make_unique<mvlc::ReplayWorker>(
             *d->snoopQueues,
             readHandle);
@@ -0,0 +1,587 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "mvlc_listfile_zstd.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <zstd.h>
+
+using namespace mesytec::mvlc;
+
+namespace mesytec::mvme_mvlc
+{
+
+namespace
+{
+
+// Fixed size pool of threads running the submitted tasks in FIFO order.
+// Pending tasks are dropped on destruction, their futures become invalid.
+class WorkerPool
+{
+    public:
+        explicit WorkerPool(unsigned threadCount)
+        {
+            for (unsigned i = 0; i < threadCount; ++i)
+                threads_.emplace_back([this] { loop(); });
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                quit_ = true;
+                tasks_.clear();
+            }
+
+            cv_.notify_all();
+
+            for (auto &t: threads_)
+                t.join();
+        }
+
+        template<typename F>
+        auto submit(F &&f) -> std::future<decltype(f())>
+        {
+            auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+            auto result = task->get_future();
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                tasks_.emplace_back([task] { (*task)(); });
+            }
+
+            cv_.notify_one();
+            return result;
+        }
+
+        size_t size() const { return threads_.size(); }
+
+    private:
+        void loop()
+        {
+            while (true)
+            {
+                std::function<void ()> task;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+
+                    if (quit_)
+                        return;
+
+                    task = std::move(tasks_.front());
+                    tasks_.pop_front();
+                }
+
+                task();
+            }
+        }
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::function<void ()>> tasks_;
+        bool quit_ = false;
+        std::vector<std::thread> threads_;
+};
+
+struct CCtxDeleter { void operator()(ZSTD_CCtx *ctx) const { ZSTD_freeCCtx(ctx); } };
+struct DCtxDeleter { void operator()(ZSTD_DCtx *ctx) const { ZSTD_freeDCtx(ctx); } };
+
+// Contexts are reused by the pool threads.
+ZSTD_CCtx *thread_cctx()
+{
+    thread_local std::unique_ptr<ZSTD_CCtx, CCtxDeleter> ctx(ZSTD_createCCtx());
+    return ctx.get();
+}
+
+ZSTD_DCtx *thread_dctx()
+{
+    thread_local std::unique_ptr<ZSTD_DCtx, DCtxDeleter> ctx(ZSTD_createDCtx());
+    return ctx.get();
+}
+
+void put_u32(u8 *dest, u32 value)
+{
+    for (int i = 0; i < 4; ++i)
+        dest[i] = value >> (8 * i);
+}
+
+u32 get_u32(const u8 *src)
+{
+    return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<u32>(src[3]) << 24);
+}
+
+std::vector<u8> compress_frame(ZSTD_CCtx *cctx, const u8 *data, size_t size, int level)
+{
+    if (!cctx)
+        throw std::runtime_error("zstd: could not create compression context");
+
+    std::vector<u8> result(ZstdFrameDescriptorSize + ZSTD_compressBound(size));
+
+    size_t compressedSize = ZSTD_compressCCtx(
+        cctx, result.data() + ZstdFrameDescriptorSize, result.size() - ZstdFrameDescriptorSize,
+        data, size, level);
+
+    if (ZSTD_isError(compressedSize))
+        throw std::runtime_error(std::string("zstd: compression failed: ") + ZSTD_getErrorName(compressedSize));
+
+    put_u32(result.data() + 0, ZstdFrameDescriptorMagic);
+    put_u32(result.data() + 4, 2 * sizeof(u32));
+    put_u32(result.data() + 8, compressedSize);
+    put_u32(result.data() + 12, size);
+    result.resize(ZstdFrameDescriptorSize + compressedSize);
+
+    return result;
+}
+
+std::vector<u8> decompress_frame(const std::vector<u8> &compressed, size_t uncompressedSize)
+{
+    auto dctx = thread_dctx();
+
+    if (!dctx)
+        throw std::runtime_error("zstd: could not create decompression context");
+
+    // The descriptor sizes have been checked against ZstdMaxFrameSize by the
+    // reader. Additionally cross-check with the size stored in the zstd frame
+    // header before allocating the output buffer.
+    const auto contentSize = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+
+    if (contentSize == ZSTD_CONTENTSIZE_ERROR)
+        throw std::runtime_error("zstd: invalid frame header in listfile data");
+
+    if (contentSize != ZSTD_CONTENTSIZE_UNKNOWN && contentSize != uncompressedSize)
+        throw std::runtime_error("zstd: frame size does not match its descriptor");
+
+    std::vector<u8> result(uncompressedSize);
+
+    size_t size = ZSTD_decompressDCtx(dctx, result.data(), result.size(),
+                                      compressed.data(), compressed.size());
+
+    if (ZSTD_isError(size))
+        throw std::runtime_error(std::string("zstd: decompression failed: ") + ZSTD_getErrorName(size));
+
+    if (size != uncompressedSize)
+        throw std::runtime_error("zstd: frame size does not match its descriptor");
+
+    return result;
+}
+
+unsigned resolve_thread_count(unsigned threads)
+{
+    return threads ? threads : zstd_default_thread_count();
+}
+
+} // end anon namespace
+
+std::vector<u8> zstd_compress_frame(const u8 *data, size_t size, int level)
+{
+    std::unique_ptr<ZSTD_CCtx, CCtxDeleter> cctx(ZSTD_createCCtx());
+    return compress_frame(cctx.get(), data, size, level);
+}
+
+bool is_zstd_listfile(listfile::ReadHandle &rh)
+{
+    u8 buffer[sizeof(u32)] = {};
+    rh.seek(0);
+    size_t bytesRead = rh.read(buffer, sizeof(buffer));
+    rh.seek(0);
+    return bytesRead == sizeof(buffer) && get_u32(buffer) == ZstdFrameDescriptorMagic;
+}
+
+unsigned zstd_default_thread_count()
+{
+    return std::clamp(std::thread::hardware_concurrency() / 2, 1u, 8u);
+}
+
+//
+// ZstdWriteHandle
+//
+
+struct ZstdWriteHandle::Private
+{
+    struct Frame
+    {
+        std::vector<u8> input;
+        std::vector<u8> output;
+    };
+
+    std::shared_ptr<listfile::WriteHandle> dest;
+    int level;
+    size_t frameSize;
+    size_t maxInFlight;
+    std::unique_ptr<WorkerPool> pool;
+    std::vector<u8> buffer;
+    std::deque<std::future<Frame>> inFlight;
+    FrameWrittenCallback frameWritten;
+    u64 bytesIn = 0;
+    u64 bytesOut = 0;
+
+    void submitBuffer();
+    // Writes out finished frames in order. If wait is true blocks until all
+    // frames are written, otherwise until less than maxInFlight frames are
+    // pending.
+    void writeFrames(bool wait);
+};
+
+void ZstdWriteHandle::Private::submitBuffer()
+{
+    if (buffer.empty())
+        return;
+
+    Frame frame;
+    frame.input = std::move(buffer);
+    buffer = {};
+    buffer.reserve(frameSize);
+
+    const int level_ = level;
+
+    inFlight.emplace_back(pool->submit([frame = std::move(frame), level_] () mutable
+    {
+        frame.output = compress_frame(thread_cctx(), frame.input.data(), frame.input.size(), level_);
+        return std::move(frame);
+    }));
+}
+
+void ZstdWriteHandle::Private::writeFrames(bool wait)
+{
+    while (!inFlight.empty())
+    {
+        auto &next = inFlight.front();
+
+        const bool mustWait = wait || inFlight.size() >= maxInFlight;
+
+        if (!mustWait && next.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            break;
+
+        auto frame = next.get();
+        inFlight.pop_front();
+
+        size_t written = dest->write(frame.output.data(), frame.output.size());
+
+        if (written != frame.output.size())
+            throw std::runtime_error("zstd: short write to listfile");
+
+        bytesOut += written;
+
+        if (frameWritten)
+            frameWritten(frame.input.data(), frame.input.size());
+    }
+}
+
+ZstdWriteHandle::ZstdWriteHandle(
+    std::shared_ptr<listfile::WriteHandle> dest, int level, unsigned threads, size_t frameSize)
+    : d(std::make_unique<Private>())
+{
+    threads = resolve_thread_count(threads);
+    d->dest = dest;
+    d->level = level;
+    d->frameSize = std::clamp(frameSize, size_t(1), ZstdMaxFrameSize);
+    d->maxInFlight = 2 * threads;
+    d->pool = std::make_unique<WorkerPool>(threads);
+    d->buffer.reserve(d->frameSize);
+}
+
+ZstdWriteHandle::~ZstdWriteHandle()
+{
+}
+
+size_t ZstdWriteHandle::write(const u8 *data, size_t size)
+{
+    const size_t result = size;
+
+    while (size)
+    {
+        const size_t n = std::min(size, d->frameSize - d->buffer.size());
+        d->buffer.insert(std::end(d->buffer), data, data + n);
+        data += n;
+        size -= n;
+
+        if (d->buffer.size() >= d->frameSize)
+        {
+            d->submitBuffer();
+            d->writeFrames(false);
+        }
+    }
+
+    d->bytesIn += result;
+    return result;
+}
+
+void ZstdWriteHandle::flush()
+{
+    d->submitBuffer();
+    d->writeFrames(true);
+}
+
+void ZstdWriteHandle::setFrameWrittenCallback(const FrameWrittenCallback &cb)
+{
+    d->frameWritten = cb;
+}
+
+u64 ZstdWriteHandle::bytesIn() const
+{
+    return d->bytesIn;
+}
+
+u64 ZstdWriteHandle::bytesOut() const
+{
+    return d->bytesOut;
+}
+
+//
+// ZstdReadHandle
+//
+
+struct ZstdReadHandle::Private
+{
+    listfile::ReadHandle *input = nullptr;
+    size_t maxInFlight = 0;
+    std::unique_ptr<WorkerPool> pool;
+    std::deque<std::future<std::vector<u8>>> inFlight;
+    bool inputEof = false;
+    u64 compressedBytesRead = 0;
+
+    std::vector<u8> frame;  // current uncompressed frame
+    u64 frameStart = 0;     // uncompressed offset of the current frame
+    size_t framePos = 0;    // read position inside the frame
+
+    size_t readExact(u8 *dest, size_t size);
+    bool readCompressedFrame(std::vector<u8> &compressed, u32 &uncompressedSize);
+    void readAhead();
+    bool nextFrame();
+    void restart();
+};
+
+size_t ZstdReadHandle::Private::readExact(u8 *dest, size_t size)
+{
+    size_t total = 0;
+
+    while (total < size)
+    {
+        size_t n = input->read(dest + total, size - total);
+
+        if (n == 0)
+            break;
+
+        total += n;
+    }
+
+    compressedBytesRead += total;
+    return total;
+}
+
+bool ZstdReadHandle::Private::readCompressedFrame(std::vector<u8> &compressed, u32 &uncompressedSize)
+{
+    while (true)
+    {
+        u8 header[2 * sizeof(u32)];
+        size_t n = readExact(header, sizeof(header));
+
+        if (n == 0)
+            return false;
+
+        if (n != sizeof(header))
+            throw std::runtime_error("zstd: unexpected end of listfile data");
+
+        const u32 magic = get_u32(header);
+        const u32 payloadSize = get_u32(header + 4);
+
+        if (magic == ZstdFrameDescriptorMagic && payloadSize == 2 * sizeof(u32))
+        {
+            u8 payload[2 * sizeof(u32)];
+
+            if (readExact(payload, sizeof(payload)) != sizeof(payload))
+                throw std::runtime_error("zstd: unexpected end of listfile data");
+
+            const u32 compressedSize = get_u32(payload);
+            uncompressedSize = get_u32(payload + 4);
+
+            // Sizes are read straight from the file. Reject corrupted
+            // descriptors instead of attempting huge allocations.
+            if (uncompressedSize > ZstdMaxFrameSize
+                || compressedSize > ZSTD_compressBound(ZstdMaxFrameSize))
+            {
+                throw std::runtime_error("zstd: invalid frame descriptor in listfile data");
+            }
+
+            compressed.resize(compressedSize);
+
+            if (readExact(compressed.data(), compressed.size()) != compressed.size())
+                throw std::runtime_error("zstd: unexpected end of listfile data");
+
+            return true;
+        }
+        else if ((magic & ZSTD_MAGIC_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START)
+        {
+            // Other skippable frames are ignored. Skipped in fixed size steps
+            // as the payload size is not bounded.
+            u8 skip[4096];
+
+            for (size_t remaining = payloadSize; remaining > 0;)
+            {
+                const size_t n = std::min(remaining, sizeof(skip));
+
+                if (readExact(skip, n) != n)
+                    throw std::runtime_error("zstd: unexpected end of listfile data");
+
+                remaining -= n;
+            }
+        }
+        else
+        {
+            throw std::runtime_error("zstd: missing frame descriptor in listfile data");
+        }
+    }
+}
+
+void ZstdReadHandle::Private::readAhead()
+{
+    while (!inputEof && inFlight.size() < maxInFlight)
+    {
+        std::vector<u8> compressed;
+        u32 uncompressedSize = 0;
+
+        if (!readCompressedFrame(compressed, uncompressedSize))
+        {
+            inputEof = true;
+            break;
+        }
+
+        inFlight.emplace_back(pool->submit([compressed = std::move(compressed), uncompressedSize]
+        {
+            return decompress_frame(compressed, uncompressedSize);
+        }));
+    }
+}
+
+bool ZstdReadHandle::Private::nextFrame()
+{
+    readAhead();
+
+    if (inFlight.empty())
+        return false;
+
+    frameStart += frame.size();
+    frame = inFlight.front().get();
+    framePos = 0;
+    inFlight.pop_front();
+
+    readAhead();
+    return true;
+}
+
+void ZstdReadHandle::Private::restart()
+{
+    // Futures of running tasks do not block on destruction.
+    inFlight.clear();
+    input->seek(0);
+    inputEof = false;
+    compressedBytesRead = 0;
+    frame.clear();
+    frameStart = 0;
+    framePos = 0;
+}
+
+ZstdReadHandle::ZstdReadHandle(listfile::ReadHandle *input, unsigned threads)
+    : d(std::make_unique<Private>())
+{
+    threads = resolve_thread_count(threads);
+    d->input = input;
+    d->maxInFlight = 2 * threads;
+    d->pool = std::make_unique<WorkerPool>(threads);
+}
+
+ZstdReadHandle::~ZstdReadHandle()
+{
+}
+
+size_t ZstdReadHandle::read(u8 *dest, size_t maxSize)
+{
+    size_t total = 0;
+
+    while (total < maxSize)
+    {
+        if (d->framePos == d->frame.size() && !d->nextFrame())
+            break;
+
+        const size_t n = std::min(maxSize - total, d->frame.size() - d->framePos);
+        std::memcpy(dest + total, d->frame.data() + d->framePos, n);
+        d->framePos += n;
+        total += n;
+    }
+
+    return total;
+}
+
+size_t ZstdReadHandle::seek(size_t pos)
+{
+    if (pos < d->frameStart)
+        d->restart();
+
+    // Move forward frame by frame until the position is inside the current
+    // frame or the end of the data is reached.
+    while (pos > d->frameStart + d->frame.size())
+    {
+        d->framePos = d->frame.size();
+
+        if (!d->nextFrame())
+            return d->frameStart + d->frame.size();
+    }
+
+    d->framePos = pos - d->frameStart;
+    return pos;
+}
+
+u64 ZstdReadHandle::compressedBytesRead() const
+{
+    return d->compressedBytesRead;
+}
+
+listfile::ReadHandle *make_listfile_read_handle(
+    listfile::ReadHandle *input,
+    std::unique_ptr<ZstdReadHandle> &zstdHandle,
+    unsigned threads)
+{
+    if (!is_zstd_listfile(*input))
+        return input;
+
+    zstdHandle = std::make_unique<ZstdReadHandle>(input, threads);
+    return zstdHandle.get();
+}
+
+listfile::ReadHandle *open_listfile_entry(
+    listfile::ZipReader &zipReader,
+    const std::string &entryName,
+    std::unique_ptr<ZstdReadHandle> &zstdHandle,
+    unsigned threads)
+{
+    return make_listfile_read_handle(zipReader.openEntry(entryName), zstdHandle, threads);
+}
+
+}
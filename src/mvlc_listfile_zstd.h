@@ -0,0 +1,163 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __MVME_MVLC_LISTFILE_ZSTD_H__
+#define __MVME_MVLC_LISTFILE_ZSTD_H__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mesytec-mvlc/mvlc_listfile.h>
+#include <mesytec-mvlc/mvlc_listfile_zip.h>
+
+#include "libmvme_export.h"
+#include "typedefs.h"
+
+namespace mesytec::mvme_mvlc
+{
+
+// Zstandard compressed MVLC listfiles.
+//
+// The compressed data is written to an uncompressed listfile entry of a ZIP
+// archive. It consists of a sequence of independent zstd frames, each preceded
+// by a skippable frame (the frame descriptor) holding the compressed and
+// uncompressed sizes of the following frame. The descriptors allow readers to
+// split the stream into frames without parsing the zstd data, so that frames
+// can be decompressed in parallel. The file magic and listfile preamble form
+// the first frame of each entry, see zstd_compress_frame(), which keeps each
+// part of a split listfile self-contained.
+//
+// Entries are recognized by their content (is_zstd_listfile()), not by their
+// name: the entry names are created by the mesytec-mvlc ZIP writers. Readers
+// should open entries using open_listfile_entry() or wrap already opened
+// handles using make_listfile_read_handle() so that compressed and
+// uncompressed listfiles are handled the same way.
+
+// Skippable frame magic used for the frame descriptors.
+static const u32 ZstdFrameDescriptorMagic = 0x184D2A5Bu;
+// Descriptor: magic, payload size (8), compressed size, uncompressed size.
+static const size_t ZstdFrameDescriptorSize = 4 * sizeof(u32);
+// Amount of uncompressed data per frame.
+static const size_t ZstdDefaultFrameSize = 4u << 20;
+// Upper limit for the uncompressed size of a frame. Larger frame sizes passed
+// to the ZstdWriteHandle are clamped. Readers reject frame descriptors
+// exceeding the limit as a format error.
+static const size_t ZstdMaxFrameSize = 16 * ZstdDefaultFrameSize;
+
+// Compresses the data into a single frame including the frame descriptor.
+// Throws std::runtime_error on error.
+std::vector<u8> LIBMVME_EXPORT zstd_compress_frame(const u8 *data, size_t size, int level);
+
+// Returns true if the data of the handle starts with a frame descriptor.
+// Seeks the handle back to the start.
+bool LIBMVME_EXPORT is_zstd_listfile(mesytec::mvlc::listfile::ReadHandle &rh);
+
+class ZstdReadHandle;
+
+// Returns a handle decompressing the data of the input handle if it contains a
+// zstd compressed listfile, the input handle itself otherwise. The
+// decompressing handle is stored in zstdHandle which has to outlive the use of
+// the returned handle.
+// threads: number of decompression threads, 0 selects
+// zstd_default_thread_count().
+LIBMVME_EXPORT mesytec::mvlc::listfile::ReadHandle *make_listfile_read_handle(
+    mesytec::mvlc::listfile::ReadHandle *input,
+    std::unique_ptr<ZstdReadHandle> &zstdHandle,
+    unsigned threads = 0);
+
+// Opens the named listfile entry of the archive and passes it through
+// make_listfile_read_handle(). Throws on error like ZipReader::openEntry().
+LIBMVME_EXPORT mesytec::mvlc::listfile::ReadHandle *open_listfile_entry(
+    mesytec::mvlc::listfile::ZipReader &zipReader,
+    const std::string &entryName,
+    std::unique_ptr<ZstdReadHandle> &zstdHandle,
+    unsigned threads = 0);
+
+// Default number of compression/decompression threads: half the number of
+// hardware threads, at least 1 and at most 8.
+unsigned LIBMVME_EXPORT zstd_default_thread_count();
+
+// WriteHandle compressing the data written to it into frames which are then
+// written to the destination handle. Full frames are compressed in parallel
+// by a pool of worker threads. The compressed frames are written to the
+// destination in order from within write() and flush(), i.e. from the thread
+// using the handle.
+//
+// flush() has to be called before the destination entry is closed. The
+// destructor discards data that has not been flushed.
+class LIBMVME_EXPORT ZstdWriteHandle: public mesytec::mvlc::listfile::WriteHandle
+{
+    public:
+        // Invoked with the uncompressed data of each frame after the frame
+        // has been written to the destination.
+        using FrameWrittenCallback = std::function<void (const u8 *data, size_t size)>;
+
+        // threads: number of compression threads. 0 selects
+        // zstd_default_thread_count().
+        ZstdWriteHandle(
+            std::shared_ptr<mesytec::mvlc::listfile::WriteHandle> dest,
+            int level = 3,
+            unsigned threads = 0,
+            size_t frameSize = ZstdDefaultFrameSize);
+
+        ~ZstdWriteHandle() override;
+
+        size_t write(const u8 *data, size_t size) override;
+
+        // Compresses the buffered data and writes out all pending frames.
+        void flush();
+
+        void setFrameWrittenCallback(const FrameWrittenCallback &cb);
+
+        u64 bytesIn() const;
+        u64 bytesOut() const;
+
+    private:
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+// ReadHandle decompressing the frames read from the input handle. Frames are
+// read ahead and decompressed in parallel by a pool of worker threads.
+//
+// Seeking backwards restarts decompression from the beginning of the input
+// unless the position is inside the current frame.
+class LIBMVME_EXPORT ZstdReadHandle: public mesytec::mvlc::listfile::ReadHandle
+{
+    public:
+        explicit ZstdReadHandle(mesytec::mvlc::listfile::ReadHandle *input, unsigned threads = 0);
+        ~ZstdReadHandle() override;
+
+        size_t read(u8 *dest, size_t maxSize) override;
+        size_t seek(size_t pos) override;
+
+        // Number of bytes read from the input handle so far.
+        u64 compressedBytesRead() const;
+
+    private:
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+}
+
+#endif /* __MVME_MVLC_LISTFILE_ZSTD_H__ */
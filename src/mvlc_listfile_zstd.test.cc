@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+
+#include "mvlc_listfile_zstd.h"
+
+using namespace mesytec::mvlc;
+using namespace mesytec::mvme_mvlc;
+
+namespace
+{
+
+class MemoryWriteHandle: public listfile::WriteHandle
+{
+    public:
+        size_t write(const u8 *data, size_t size) override
+        {
+            buffer.insert(std::end(buffer), data, data + size);
+            return size;
+        }
+
+        std::vector<u8> buffer;
+};
+
+class MemoryReadHandle: public listfile::ReadHandle
+{
+    public:
+        explicit MemoryReadHandle(const std::vector<u8> &data)
+            : data_(data)
+        {}
+
+        size_t read(u8 *dest, size_t maxSize) override
+        {
+            size_t n = std::min(maxSize, data_.size() - pos_);
+            std::memcpy(dest, data_.data() + pos_, n);
+            pos_ += n;
+            return n;
+        }
+
+        size_t seek(size_t pos) override
+        {
+            pos_ = std::min(pos, data_.size());
+            return pos_;
+        }
+
+    private:
+        const std::vector<u8> &data_;
+        size_t pos_ = 0;
+};
+
+// Compressible test data: a few repeating words with random noise.
+std::vector<u8> make_test_data(size_t size)
+{
+    std::mt19937 rng(1234);
+    std::vector<u8> result(size);
+
+    for (size_t i = 0; i < size; ++i)
+        result[i] = (i % 4 == 0) ? (rng() & 0xff) : static_cast<u8>(i / 4);
+
+    return result;
+}
+
+std::vector<u8> read_all(listfile::ReadHandle &rh, size_t chunkSize)
+{
+    std::vector<u8> result;
+    std::vector<u8> buffer(chunkSize);
+
+    while (size_t n = rh.read(buffer.data(), buffer.size()))
+        result.insert(std::end(result), buffer.data(), buffer.data() + n);
+
+    return result;
+}
+
+}
+
+TEST(mvlc_listfile_zstd, WriteReadRoundTrip)
+{
+    const auto preamble = make_test_data(333);
+    const auto data = make_test_data(100000);
+
+    auto dest = std::make_shared<MemoryWriteHandle>();
+
+    // The preamble is written as a separate frame like the SplitZipCreator
+    // does for each new archive.
+    auto preambleFrame = zstd_compress_frame(preamble.data(), preamble.size(), 3);
+    dest->write(preambleFrame.data(), preambleFrame.size());
+
+    std::vector<u8> written;
+
+    {
+        ZstdWriteHandle wh(dest, 3, 3, 1000);
+        wh.setFrameWrittenCallback([&written] (const u8 *data, size_t size)
+        {
+            written.insert(std::end(written), data, data + size);
+        });
+
+        for (size_t offset = 0; offset < data.size(); offset += 777)
+            wh.write(data.data() + offset, std::min<size_t>(777, data.size() - offset));
+
+        wh.flush();
+
+        ASSERT_EQ(wh.bytesIn(), data.size());
+        ASSERT_EQ(wh.bytesOut() + preambleFrame.size(), dest->buffer.size());
+    }
+
+    // Frames are reported in order after being written.
+    ASSERT_EQ(written, data);
+
+    MemoryReadHandle input(dest->buffer);
+    ASSERT_TRUE(is_zstd_listfile(input));
+
+    ZstdReadHandle rh(&input, 2);
+
+    auto expected = preamble;
+    expected.insert(std::end(expected), std::begin(data), std::end(data));
+
+    ASSERT_EQ(read_all(rh, 555), expected);
+    ASSERT_EQ(rh.compressedBytesRead(), dest->buffer.size());
+}
+
+TEST(mvlc_listfile_zstd, ReadSeek)
+{
+    const auto data = make_test_data(50000);
+    auto dest = std::make_shared<MemoryWriteHandle>();
+
+    {
+        ZstdWriteHandle wh(dest, 1, 2, 4096);
+        wh.write(data.data(), data.size());
+        wh.flush();
+    }
+
+    MemoryReadHandle input(dest->buffer);
+    ZstdReadHandle rh(&input, 2);
+
+    auto read_at = [&rh] (size_t pos, size_t size)
+    {
+        std::vector<u8> result(size);
+        rh.seek(pos);
+        result.resize(rh.read(result.data(), result.size()));
+        return result;
+    };
+
+    auto expected_at = [&data] (size_t pos, size_t size)
+    {
+        return std::vector<u8>(data.begin() + pos, data.begin() + std::min(pos + size, data.size()));
+    };
+
+    for (size_t pos: { 0, 10, 4096, 30000, 5000, 4095, 49990, 0 })
+        ASSERT_EQ(read_at(pos, 100), expected_at(pos, 100)) << "pos=" << pos;
+
+    // Seeking past the end stops at the end of the data.
+    ASSERT_EQ(rh.seek(data.size() + 100), data.size());
+}
+
+TEST(mvlc_listfile_zstd, SkippableFramesAndDetection)
+{
+    const auto data = make_test_data(1000);
+
+    std::vector<u8> buffer = { 0x50, 0x2a, 0x4d, 0x18, 3, 0, 0, 0, 1, 2, 3 };
+    auto frame = zstd_compress_frame(data.data(), data.size(), 3);
+
+    {
+        MemoryReadHandle input(buffer);
+        ASSERT_FALSE(is_zstd_listfile(input));
+    }
+
+    buffer.insert(std::end(buffer), std::begin(frame), std::end(frame));
+
+    MemoryReadHandle input(buffer);
+    ZstdReadHandle rh(&input, 1);
+    ASSERT_EQ(read_all(rh, 100), data);
+
+    // Plain listfile data is not detected as zstd.
+    const char *magic = "MVLC_USB";
+    std::vector<u8> plain(magic, magic + 8);
+    MemoryReadHandle plainInput(plain);
+    ASSERT_FALSE(is_zstd_listfile(plainInput));
+
+    // Truncated frames throw.
+    frame.resize(frame.size() - 1);
+    MemoryReadHandle truncInput(frame);
+    ZstdReadHandle truncRh(&truncInput, 1);
+    ASSERT_THROW(read_all(truncRh, 100), std::runtime_error);
+}
+
+TEST(mvlc_listfile_zstd, MakeListfileReadHandle)
+{
+    const auto data = make_test_data(1000);
+
+    // Plain data is returned as is.
+    {
+        MemoryReadHandle input(data);
+        std::unique_ptr<ZstdReadHandle> zstdHandle;
+        auto rh = make_listfile_read_handle(&input, zstdHandle, 1);
+        ASSERT_EQ(rh, &input);
+        ASSERT_FALSE(zstdHandle);
+        ASSERT_EQ(read_all(*rh, 100), data);
+    }
+
+    // Compressed data is decompressed.
+    {
+        const auto frame = zstd_compress_frame(data.data(), data.size(), 3);
+        MemoryReadHandle input(frame);
+        std::unique_ptr<ZstdReadHandle> zstdHandle;
+        auto rh = make_listfile_read_handle(&input, zstdHandle, 1);
+        ASSERT_TRUE(zstdHandle);
+        ASSERT_EQ(rh, zstdHandle.get());
+        ASSERT_EQ(read_all(*rh, 100), data);
+    }
+}
+
+TEST(mvlc_listfile_zstd, CorruptedFrameDescriptors)
+{
+    const auto data = make_test_data(1000);
+    const auto frame = zstd_compress_frame(data.data(), data.size(), 3);
+
+    auto read_corrupted = [&] (size_t offset, u32 value)
+    {
+        auto corrupted = frame;
+
+        for (int i = 0; i < 4; ++i)
+            corrupted[offset + i] = value >> (8 * i);
+
+        MemoryReadHandle input(corrupted);
+        ZstdReadHandle rh(&input, 1);
+        read_all(rh, 100);
+    };
+
+    // Huge compressed or uncompressed sizes are rejected before allocating.
+    ASSERT_THROW(read_corrupted(8, 0xffffffffu), std::runtime_error);
+    ASSERT_THROW(read_corrupted(12, 0xffffffffu), std::runtime_error);
+
+    // The uncompressed size must match the size in the zstd frame header.
+    ASSERT_THROW(read_corrupted(12, data.size() + 1), std::runtime_error);
+    ASSERT_THROW(read_corrupted(12, data.size() - 1), std::runtime_error);
+}
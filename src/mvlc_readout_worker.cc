@@ -37,6 +37,8 @@
 #include "mvlc_daq.h"
 #include "mvlc/mvlc_util.h"
 #include "mvlc/vmeconfig_to_crateconfig.h"
+#include "mvlc_listfile_index.h"
+#include "mvlc_listfile_zstd.h"
 #include "mvme_mvlc_listfile.h"
 #include "mvme_prometheus.h"
 #include "util/strings.h"
@@ -114,6 +116,9 @@ namespace mesytec::mvme
 {
 
 static const size_t ReadBufferSize = ::Megabytes(1);
+// Distance between the checkpoints of the listfile index created during the
+// DAQ in bytes of uncompressed listfile data.
+static const u64 ListfileIndexInterval = ::Megabytes(16);
 
 namespace
 {
@@ -244,6 +249,11 @@ struct MVLCReadoutWorker::Private
     std::unique_ptr<mesytec::mvlc::ReadoutWorker> mvlcReadoutWorker;
     std::unique_ptr<mesytec::mvlc::listfile::SplitZipCreator> mvlcZipCreator;
     std::shared_ptr<mesytec::mvlc::listfile::WriteHandle> listfileWriteHandle;
+    // Set for ListFileFormat::ZSTD. Same object as listfileWriteHandle.
+    std::shared_ptr<mvme_mvlc::ZstdWriteHandle> zstdWriteHandle;
+    // Builds the random access index sidecar of each listfile archive while
+    // writing. Counters are cumulative over split archives.
+    mvme_mvlc::ListfileIndexer listfileIndexer;
     mvlc::ReadoutBufferQueues *snoopQueues = nullptr;
 
     // lots of mvlc api layers
@@ -455,6 +465,7 @@ void MVLCReadoutWorker::start(quint32 cycles)
 
         // listfile handling
         d->listfileWriteHandle = {};
+        d->zstdWriteHandle = {};
 
         if (m_workerContext.listfileOutputInfo.enabled)
         {
@@ -480,17 +491,34 @@ void MVLCReadoutWorker::start(quint32 cycles)
             auto &outInfo = m_workerContext.listfileOutputInfo;
 
             if (outInfo.format == ListFileFormat::ZIP
-                || outInfo.format == ListFileFormat::LZ4)
+                || outInfo.format == ListFileFormat::LZ4
+                || outInfo.format == ListFileFormat::ZSTD)
             {
                 auto lfSetup = mvme_mvlc::make_listfile_setup(outInfo, preamble);
 
+                auto entryEncoding = mvme_mvlc::ListfileEntryEncoding::LZ4;
+
+                if (outInfo.format == ListFileFormat::ZSTD)
+                    entryEncoding = mvme_mvlc::ListfileEntryEncoding::Zstd;
+                else if (outInfo.format == ListFileFormat::ZIP)
+                    entryEncoding = (outInfo.compressionLevel == 0
+                                     ? mvme_mvlc::ListfileEntryEncoding::Stored
+                                     : mvme_mvlc::ListfileEntryEncoding::Deflate);
+
+                d->listfileIndexer = mvme_mvlc::ListfileIndexer(ListfileIndexInterval);
+
                 // Set the openArchiveCallback
-                lfSetup.openArchiveCallback = [this] (listfile::SplitZipCreator *zipCreator)
+                lfSetup.openArchiveCallback = [this, preamble, entryEncoding] (listfile::SplitZipCreator *zipCreator)
                 {
                     // Update daqStats here so that the GUI displays the current filename.
                     // FIXME: thread safety! horrible design!
                     m_workerContext.daqStats.listfileFilename =
                         QString::fromStdString(zipCreator->archiveName());
+
+                    // The preamble is written directly to the new entry by the
+                    // SplitZipCreator, bypassing the indexing write handle.
+                    d->listfileIndexer.beginEntry({}, entryEncoding);
+                    d->listfileIndexer.consume(preamble.data(), preamble.size());
                 };
 
                 // Set the closeArchiveCallback
@@ -511,6 +539,19 @@ void MVLCReadoutWorker::start(quint32 cycles)
                     // FIXME: thread safety for m_workerContext.getAnalysisJson()!
                     do_write("analysis.analysis", m_workerContext.getAnalysisJson().toJson());
                     do_write("mvme_run_notes.txt", m_workerContext.getRunNotes().toLocal8Bit());
+
+                    const auto indexFilename = mvme_mvlc::index_filename(zipCreator->archiveName());
+
+                    try
+                    {
+                        mvme_mvlc::write_index(indexFilename, d->listfileIndexer.finishEntry());
+                    }
+                    catch (const std::exception &e)
+                    {
+                        logMessage(QSL("Error writing listfile index %1: %2")
+                                   .arg(QString::fromStdString(indexFilename))
+                                   .arg(e.what()));
+                    }
                 };
 
                 d->mvlcZipCreator = std::make_unique<mvlc::listfile::SplitZipCreator>();
@@ -522,8 +563,35 @@ void MVLCReadoutWorker::start(quint32 cycles)
 
                 // This call writes out the preamble. The same happens if listfile splitting is
                 // enabled and a new archive is started by the SplitZipCreator.
-                d->listfileWriteHandle = std::shared_ptr<mvlc::listfile::WriteHandle>(
+                auto entryHandle = std::shared_ptr<mvlc::listfile::WriteHandle>(
                     d->mvlcZipCreator->createListfileEntry());
+
+                if (outInfo.format == ListFileFormat::ZSTD)
+                {
+                    const auto threads = outInfo.options.value("zstd_threads", 0u).toUInt();
+
+                    d->zstdWriteHandle = std::make_shared<mvme_mvlc::ZstdWriteHandle>(
+                        entryHandle, outInfo.compressionLevel, threads);
+
+                    // Frames are written with a delay and may end up in the
+                    // next archive of a split listfile. Index the data once
+                    // it has actually been written.
+                    d->zstdWriteHandle->setFrameWrittenCallback([this] (const u8 *data, size_t size)
+                    {
+                        d->listfileIndexer.consume(data, size);
+                    });
+
+                    d->listfileWriteHandle = d->zstdWriteHandle;
+
+                    logMessage(QSL("zstd compression: level=%1, threads=%2")
+                               .arg(outInfo.compressionLevel)
+                               .arg(threads ? threads : mvme_mvlc::zstd_default_thread_count()));
+                }
+                else
+                {
+                    d->listfileWriteHandle = std::make_shared<mvme_mvlc::IndexingWriteHandle>(
+                        entryHandle, d->listfileIndexer);
+                }
             }
 #ifdef MVLC_HAVE_ZMQ
             else if (outInfo.format == ListFileFormat::ZMQ_Ganil)
@@ -616,6 +684,10 @@ void MVLCReadoutWorker::start(quint32 cycles)
         mvlc_daq_shutdown(vmeConfig, d->mvlcCtrl, logger, errorLogger);
         m_workerContext.daqStats.stop();
 
+        // Write out the pending zstd frames before the archive is closed.
+        if (d->zstdWriteHandle)
+            d->zstdWriteHandle->flush();
+
         d->mvlcZipCreator.reset(); // destroy the ZipCreator to flush and close the listfile archive
 
         // In case we recorded a listfile and the run number was used increment
@@ -720,6 +792,7 @@ void MVLCReadoutWorker::stop()
 
     // Release the write handle to free up resources, e.g. zmq socket.
     d->listfileWriteHandle = {};
+    d->zstdWriteHandle = {};
 }
 
 void MVLCReadoutWorker::pause()
@@ -37,6 +37,7 @@
 #include "mvlc/vmeconfig_to_crateconfig.h"
 #include "vme_script.h"
 #include "util/perf.h"
+#include "util/profiling.h"
 
 using namespace vme_analysis_common;
 using namespace mesytec;
@@ -317,6 +318,8 @@ void MVLC_StreamWorker::setupParserCallbacks(
         logger->trace("f={}, ei={}, moduleData={}, moduleCount={}", lambdaName, ei,
                       reinterpret_cast<const void *>(moduleDataList), moduleCount);
 
+        MVME_PROFILE_SCOPE_INDEXED("multi_event_splitter", ei);
+
         mvme::multi_event_splitter::event_data(
             m_multiEventSplitter, m_multiEventSplitterCallbacks,
             userContext, ei, moduleDataList, moduleCount);
@@ -598,6 +601,9 @@ void MVLC_StreamWorker::start()
     for (auto c: bufferConsumers())
         c->beginRun(runInfo, vmeConfig, analysis);
 
+    disable_replicas_for_event_data_readers(analysis, moduleConsumers(),
+        [this] (const QString &msg) { logInfo(msg); });
+
     // Notify the world that we're up and running.
     setState(WorkerState::Running);
 
@@ -896,6 +902,10 @@ void MVLC_StreamWorker::processBuffer(
 
     try
     {
+        // The analysis is called from within the parser, so its timings show
+        // up as children of this scope.
+        MVME_PROFILE_SCOPE("readout_parser");
+
         ParseResult pr = readout_parser::parse_readout_buffer(
             static_cast<ConnectionType>(buffer->type()),
             m_parser,
@@ -0,0 +1,495 @@
+// Headless batch replay of MVME listfiles through an analysis.
+//
+// Each listfile is replayed through its own Analysis instance. Multiple files
+// are processed concurrently, each one using a replay and an analysis thread.
+// The histogram sinks of the per file analyses are summed into a single
+// analysis which is saved as an analysis session at the end. A JSON summary is
+// written for each input file.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <list>
+#include <lyra/lyra.hpp>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QUrl>
+
+#include "analysis/analysis.h"
+#include "analysis/analysis_session.h"
+#include "analysis/analysis_util.h"
+#include "listfile_replay.h"
+#include "listfile_replay_worker.h"
+#include "mvme_session.h"
+#include "stream_worker_base.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+using namespace mesytec::mvme::replay;
+
+namespace
+{
+
+struct FileResult
+{
+    QString listfile;
+    QString error;
+    std::unique_ptr<VMEConfig> vmeConfig;
+    MVMEStreamProcessorCounters counters;
+    std::chrono::duration<double> elapsed = {};
+    double timeticks = 0.0;
+    QJsonObject analysisStats;
+
+    double dataMB() const { return counters.bytesProcessed / (1024.0 * 1024.0); }
+
+    double eventRate() const
+    {
+        return elapsed.count() > 0.0 ? counters.totalEvents / elapsed.count() : 0.0;
+    }
+
+    double dataRate() const
+    {
+        return elapsed.count() > 0.0 ? dataMB() / elapsed.count() : 0.0;
+    }
+};
+
+// Replays a single listfile through the given analysis. Runs in its own
+// thread. The analysis has been created by the main thread so that its
+// deleteLater() deleter is processed by the main event loop.
+FileResult process_listfile(const QString &listfile, analysis::Analysis *analysis)
+{
+    FileResult result;
+    result.listfile = listfile;
+
+    auto info = gather_fileinfo(QUrl::fromLocalFile(listfile));
+
+    if (info.hasError())
+    {
+        if (!info.err.errorString.isEmpty())
+            result.error = info.err.errorString;
+        else if (info.err.errorCode)
+            result.error = QString::fromStdString(info.err.errorCode.message());
+        else
+        {
+            try
+            {
+                std::rethrow_exception(info.err.exceptionPtr);
+            }
+            catch (const std::exception &e)
+            {
+                result.error = e.what();
+            }
+        }
+
+        return result;
+    }
+
+    auto logger = [listfile] (const QString &msg)
+    {
+        spdlog::info("{}: {}", QFileInfo(listfile).fileName().toStdString(), msg.toStdString());
+    };
+
+    ReplayQueues bufferQueues;
+
+    auto replayWorker = make_replay_worker(info.handle, bufferQueues);
+    auto analysisWorker = make_analysis_worker(info.handle, bufferQueues);
+
+    if (!replayWorker || !analysisWorker)
+    {
+        result.error = QSL("Could not create replay workers");
+        return result;
+    }
+
+    RunInfo runInfo;
+    runInfo.runId = QFileInfo(listfile).completeBaseName();
+    runInfo.isReplay = true;
+    runInfo.keepAnalysisState = false;
+    runInfo.infoDict["replaySourceFile"] = listfile;
+
+    replayWorker->setLogger(logger);
+    replayWorker->setListfile(&info.handle);
+
+    analysisWorker->setAnalysis(analysis);
+    analysisWorker->setVMEConfig(info.vmeConfig.get());
+    analysisWorker->setRunInfo(runInfo);
+    analysis->beginRun(runInfo, info.vmeConfig.get(), logger);
+
+    auto tStart = std::chrono::steady_clock::now();
+
+    // The analysis worker only returns after being stopped. The replay worker
+    // returns once the listfile has been read completely. Stopping the analysis
+    // worker has to wait for it to be running as it resets its desired state
+    // when entering the running state.
+    std::atomic<bool> analysisStarted(false);
+    std::atomic<bool> analysisDone(false);
+
+    QObject::connect(analysisWorker.get(), &StreamWorkerBase::started,
+                     analysisWorker.get(), [&analysisStarted] { analysisStarted = true; },
+                     Qt::DirectConnection);
+
+    std::thread analysisThread([&analysisWorker, &analysisDone]
+    {
+        analysisWorker->start();
+        analysisDone = true;
+    });
+
+    replayWorker->start();
+
+    while (!analysisStarted && !analysisDone)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    analysisWorker->stop(true);
+    analysisThread.join();
+
+    result.elapsed = std::chrono::steady_clock::now() - tStart;
+    result.counters = analysisWorker->getCounters();
+    result.timeticks = analysis->getTimetickCount();
+    result.analysisStats = analysis::analysis_statistics_to_json(*analysis);
+    result.vmeConfig = std::move(info.vmeConfig);
+
+    return result;
+}
+
+QJsonObject to_json(const FileResult &result, const QString &analysisFilename)
+{
+    QJsonObject j;
+    j["listfile"] = result.listfile;
+    j["analysis"] = analysisFilename;
+
+    if (!result.error.isEmpty())
+    {
+        j["error"] = result.error;
+        return j;
+    }
+
+    const auto &c = result.counters;
+
+    j["elapsed_s"] = result.elapsed.count();
+    j["data_mb"] = result.dataMB();
+    j["rate_mbs"] = result.dataRate();
+    j["events"] = static_cast<qint64>(c.totalEvents);
+    j["rate_events_per_s"] = result.eventRate();
+    j["buffers"] = static_cast<qint64>(c.buffersProcessed);
+    j["buffers_with_errors"] = static_cast<qint64>(c.buffersWithErrors);
+    j["timeticks"] = result.timeticks;
+    j["analysis_statistics"] = result.analysisStats;
+
+    return j;
+}
+
+bool write_json_file(const QString &filename, const QJsonObject &json)
+{
+    QFile out(filename);
+
+    if (!out.open(QIODevice::WriteOnly))
+        return false;
+
+    auto bytes = QJsonDocument(json).toJson();
+    return out.write(bytes) == bytes.size();
+}
+
+// Reads one listfile name per line. Empty lines and lines starting with '#'
+// are skipped.
+std::vector<std::string> read_file_list(const std::string &filename)
+{
+    std::ifstream in(filename);
+
+    if (!in)
+        throw std::runtime_error("cannot open file list " + filename);
+
+    std::vector<std::string> result;
+    std::string line;
+
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (!line.empty() && line[0] != '#')
+            result.emplace_back(line);
+    }
+
+    return result;
+}
+
+// Summary file names are based on the full listfile name so that e.g.
+// run.zip and run.mvmelst do not collide. Listfiles with the same name in
+// different directories get their position on the command line appended.
+QStringList make_summary_filenames(const std::vector<std::string> &listfiles)
+{
+    QMap<QString, int> nameCounts;
+
+    for (const auto &listfile: listfiles)
+        ++nameCounts[QFileInfo(QString::fromStdString(listfile)).fileName()];
+
+    QStringList result;
+
+    for (size_t i = 0; i < listfiles.size(); ++i)
+    {
+        auto name = QFileInfo(QString::fromStdString(listfiles[i])).fileName();
+
+        if (nameCounts.value(name) > 1)
+            name += QSL("_%1").arg(i);
+
+        result.push_back(name + QSL(".summary.json"));
+    }
+
+    return result;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    mvme_init("mvme_batch_analysis", false);
+
+    bool opt_showHelp = false;
+    std::string opt_analysis;
+    std::string opt_session = "batch_analysis.msess";
+    std::string opt_summaryDir = ".";
+    std::string opt_fileList;
+    unsigned opt_jobs = std::max(1u, std::thread::hardware_concurrency() / 2);
+    std::vector<std::string> opt_listfiles;
+
+    auto cli
+        = lyra::help(opt_showHelp)
+
+        | lyra::opt(opt_analysis, "analysis")
+            ["--analysis"]("analysis config file (required)")
+            .required()
+
+        | lyra::opt(opt_session, "session")
+            ["--session"]("output filename of the merged analysis session (default batch_analysis.msess)")
+
+        | lyra::opt(opt_summaryDir, "dir")
+            ["--summary-dir"]("directory for the per listfile summary files (default .)")
+
+        | lyra::opt(opt_fileList, "file")
+            ["--file-list"]("text file containing additional listfile names, one per line")
+
+        | lyra::opt(opt_jobs, "jobs")
+            ["-j"]["--jobs"]("number of listfiles to process concurrently (default: half the number of cores)")
+
+        | lyra::arg(opt_listfiles, "listfile")
+            .cardinality(0, 100000)
+        ;
+
+    auto cliParseResult = cli.parse({ argc, argv });
+
+    if (!cliParseResult)
+    {
+        cerr << "Error parsing command line arguments: "
+            << cliParseResult.errorMessage() << endl;
+        return 1;
+    }
+
+    if (opt_showHelp)
+    {
+        cout << cli << endl;
+        cout << "Replays the given listfiles through the analysis without a GUI." << endl
+             << "Each file is processed by its own analysis instance. The histograms of all" << endl
+             << "files are summed up and saved as an analysis session. A JSON summary" << endl
+             << "(<listfile>.summary.json) is written for each listfile. Listfiles with the" << endl
+             << "same name in different directories get their index appended to the summary" << endl
+             << "name (<listfile>_<index>.summary.json)." << endl;
+        return 0;
+    }
+
+    try
+    {
+        if (!opt_fileList.empty())
+        {
+            auto names = read_file_list(opt_fileList);
+            std::copy(std::begin(names), std::end(names), std::back_inserter(opt_listfiles));
+        }
+    }
+    catch (const std::exception &e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    if (opt_listfiles.empty())
+    {
+        cerr << "Error: no listfiles given" << endl;
+        return 1;
+    }
+
+    opt_jobs = std::max(1u, opt_jobs);
+
+    const auto analysisFilename = QString::fromStdString(opt_analysis);
+    QByteArray analysisBlob;
+
+    {
+        QFile analysisFile(analysisFilename);
+
+        if (!analysisFile.open(QIODevice::ReadOnly))
+        {
+            cerr << "Error: cannot open analysis file " << opt_analysis
+                << ": " << analysisFile.errorString().toStdString() << endl;
+            return 1;
+        }
+
+        analysisBlob = analysisFile.readAll();
+    }
+
+    auto read_analysis = [&analysisBlob] ()
+    {
+        return analysis::read_analysis(QJsonDocument::fromJson(analysisBlob));
+    };
+
+    if (auto [ana, ec] = read_analysis(); ec)
+    {
+        cerr << "Error: cannot read analysis from " << opt_analysis << ": " << ec.message() << endl;
+        return 1;
+    }
+
+    QDir summaryDir(QString::fromStdString(opt_summaryDir));
+
+    if (!summaryDir.mkpath("."))
+    {
+        cerr << "Error: cannot create summary directory " << opt_summaryDir << endl;
+        return 1;
+    }
+
+    const auto summaryFilenames = make_summary_filenames(opt_listfiles);
+
+    struct Job
+    {
+        size_t fileIndex;
+        std::shared_ptr<analysis::Analysis> analysis;
+        std::future<FileResult> result;
+    };
+
+    // The merged analysis is set up using the VMEConfig of the first
+    // successfully processed listfile.
+    std::shared_ptr<analysis::Analysis> merged;
+    std::unique_ptr<VMEConfig> mergedVMEConfig;
+
+    std::list<Job> jobs;
+    size_t nextFile = 0;
+    size_t failedFiles = 0;
+    u64 totalEvents = 0;
+    u64 totalBytes = 0;
+    auto tStart = std::chrono::steady_clock::now();
+
+    auto finish_job = [&] (Job &job)
+    {
+        auto result = job.result.get();
+        auto summaryFilename = summaryDir.filePath(summaryFilenames[job.fileIndex]);
+
+        if (!write_json_file(summaryFilename, to_json(result, analysisFilename)))
+            cerr << "Error: could not write summary file " << summaryFilename.toStdString() << endl;
+
+        if (!result.error.isEmpty())
+        {
+            cerr << result.listfile.toStdString() << ": Error: " << result.error.toStdString() << endl;
+            ++failedFiles;
+            return;
+        }
+
+        cout << result.listfile.toStdString()
+            << ": events=" << result.counters.totalEvents
+            << ", data=" << result.dataMB() << " MB"
+            << ", elapsed=" << result.elapsed.count() << " s"
+            << ", rate=" << result.eventRate() << " events/s"
+            << ", " << result.dataRate() << " MB/s" << endl;
+
+        totalEvents += result.counters.totalEvents;
+        totalBytes += result.counters.bytesProcessed;
+
+        if (!merged)
+        {
+            mergedVMEConfig = std::move(result.vmeConfig);
+            merged = read_analysis().first;
+
+            RunInfo runInfo;
+            runInfo.runId = QSL("batch_analysis");
+            runInfo.isReplay = true;
+            merged->beginRun(runInfo, mergedVMEConfig.get());
+        }
+
+        if (auto failedSinks = analysis::merge_histogram_sinks(*merged, *job.analysis))
+        {
+            cerr << result.listfile.toStdString() << ": Warning: could not merge "
+                << failedSinks << " histogram sinks" << endl;
+        }
+    };
+
+    while (nextFile < opt_listfiles.size() || !jobs.empty())
+    {
+        while (nextFile < opt_listfiles.size() && jobs.size() < opt_jobs)
+        {
+            const size_t fileIndex = nextFile++;
+            auto listfile = QString::fromStdString(opt_listfiles[fileIndex]);
+            auto ana = read_analysis().first;
+            auto result = std::async(std::launch::async, process_listfile, listfile, ana.get());
+            jobs.emplace_back(Job{ fileIndex, ana, std::move(result) });
+        }
+
+        for (auto it = jobs.begin(); it != jobs.end(); )
+        {
+            if (it->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                finish_job(*it);
+                it = jobs.erase(it);
+            }
+            else
+                ++it;
+        }
+
+        // Runs the deleteLater() calls of finished analysis instances.
+        QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tStart;
+    const double totalMB = totalBytes / (1024.0 * 1024.0);
+
+    cout << "Processed " << opt_listfiles.size() - failedFiles << " of " << opt_listfiles.size()
+        << " listfiles: events=" << totalEvents
+        << ", data=" << totalMB << " MB"
+        << ", elapsed=" << elapsed.count() << " s"
+        << ", rate=" << totalEvents / elapsed.count() << " events/s"
+        << ", " << totalMB / elapsed.count() << " MB/s" << endl;
+
+    int ret = failedFiles ? 1 : 0;
+
+    if (merged)
+    {
+        auto sessionFilename = QString::fromStdString(opt_session);
+
+        if (QFileInfo(sessionFilename).suffix().isEmpty())
+            sessionFilename += analysis::SessionFileExtension;
+
+        merged->endRun();
+
+        if (auto res = analysis::save_analysis_session(sessionFilename, merged.get()); !res.first)
+        {
+            cerr << "Error saving analysis session to " << sessionFilename.toStdString()
+                << ": " << res.second.toStdString() << endl;
+            ret = 1;
+        }
+        else
+            cout << "Merged analysis session written to " << sessionFilename.toStdString() << endl;
+    }
+
+    merged = {};
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+
+    mvme_shutdown();
+    return ret;
+}
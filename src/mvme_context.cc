@@ -99,6 +99,10 @@ static const s64 LogBufferMaxEntries = 100 * 1000;
 
 static const int JSON_RPC_DefaultListenPort = 13800;
 static const int EventServer_DefaultListenPort = 13801;
+static const char *EventServer_DefaultSharedMemoryName = "mvme_event_server";
+static const int EventServer_DefaultSharedMemorySizeMB = 64;
+static const char *EventServer_DefaultOverflowPolicy = "block";
+static const int EventServer_DefaultClientQueueSizeMB = 16;
 
 // The number of DAQ run logfiles to keep in run_logs/
 static const unsigned Default_RunLogsMaxCount = 50;
@@ -2148,6 +2152,11 @@ void MVMEContext::newWorkspace(const QString &dirName)
     workspaceSettings->setValue(QSL("EventServer/Enabled"), false);
     workspaceSettings->setValue(QSL("EventServer/ListenAddress"), QString());
     workspaceSettings->setValue(QSL("EventServer/ListenPort"), EventServer_DefaultListenPort);
+    workspaceSettings->setValue(QSL("EventServer/SharedMemoryEnabled"), false);
+    workspaceSettings->setValue(QSL("EventServer/SharedMemoryName"), EventServer_DefaultSharedMemoryName);
+    workspaceSettings->setValue(QSL("EventServer/SharedMemorySizeMB"), EventServer_DefaultSharedMemorySizeMB);
+    workspaceSettings->setValue(QSL("EventServer/OverflowPolicy"), EventServer_DefaultOverflowPolicy);
+    workspaceSettings->setValue(QSL("EventServer/ClientQueueSizeMB"), EventServer_DefaultClientQueueSizeMB);
 
 
     // Force sync to create the mvmeworkspace.ini file
@@ -2227,6 +2236,11 @@ void MVMEContext::openWorkspace(const QString &dirName)
         set_default(QSL("EventServer/Enabled"), false);
         set_default(QSL("EventServer/ListenAddress"), QString());
         set_default(QSL("EventServer/ListenPort"), EventServer_DefaultListenPort);
+        set_default(QSL("EventServer/SharedMemoryEnabled"), false);
+        set_default(QSL("EventServer/SharedMemoryName"), EventServer_DefaultSharedMemoryName);
+        set_default(QSL("EventServer/SharedMemorySizeMB"), EventServer_DefaultSharedMemorySizeMB);
+        set_default(QSL("EventServer/OverflowPolicy"), EventServer_DefaultOverflowPolicy);
+        set_default(QSL("EventServer/ClientQueueSizeMB"), EventServer_DefaultClientQueueSizeMB);
         set_default(QSL("Logs/RunLogsMaxCount"), Default_RunLogsMaxCount);
 
         // listfile subdir
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <lyra/lyra.hpp>
+#include <regex>
+
+#include "mvlc_listfile_index.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+using namespace mesytec::mvme_mvlc;
+
+int main(int argc, char *argv[])
+{
+    bool opt_showHelp = false;
+    unsigned opt_spanMiB = 64;
+    std::vector<std::string> opt_archives;
+
+    auto cli
+        = lyra::help(opt_showHelp)
+
+        | lyra::opt(opt_spanMiB, "MiB")
+            ["--span"]("distance between index checkpoints in MiB of uncompressed data (default 64)")
+
+        | lyra::arg(opt_archives, "listfile archive")
+            .cardinality(1, 1000)
+        ;
+
+    auto cliParseResult = cli.parse({ argc, argv });
+
+    if (!cliParseResult)
+    {
+        cerr << "Error parsing command line arguments: "
+            << cliParseResult.errorMessage() << endl;
+        return 1;
+    }
+
+    if (opt_showHelp)
+    {
+        cout << cli << endl;
+        cout << "Builds random access index files (<archive>.mvlcidx) for mvlc listfile archives." << endl
+             << "Split listfiles are indexed starting from the given part up to the last existing part." << endl;
+        return 0;
+    }
+
+    if (opt_spanMiB == 0)
+    {
+        cerr << "Error: span must be greater than zero" << endl;
+        return 1;
+    }
+
+    static const std::regex reFirstPart(R"(.*_part0*1\.zip$)");
+    int ret = 0;
+
+    for (const auto &archive: opt_archives)
+    {
+        auto parts = split_listfile_parts(archive);
+
+        if (parts.size() > 1 && !std::regex_match(archive, reFirstPart))
+        {
+            cerr << "Warning: " << archive << " is not the first part of a split listfile."
+                << " Timeticks and event counts will be relative to this part." << endl;
+        }
+
+        // The indexer is shared between the parts of a split listfile to make
+        // the counters cumulative.
+        ListfileIndexer indexer;
+
+        try
+        {
+            for (const auto &part: parts)
+            {
+                int lastPercent = -1;
+
+                auto progress = [&] (u64 done, u64 total)
+                {
+                    int percent = total ? static_cast<int>(done * 100 / total) : 100;
+
+                    if (percent != lastPercent)
+                    {
+                        cout << "\r" << part << ": " << percent << "%" << std::flush;
+                        lastPercent = percent;
+                    }
+                };
+
+                auto index = build_index(part, indexer, progress, u64(opt_spanMiB) << 20);
+                auto indexFilename = index_filename(part);
+                write_index(indexFilename, index);
+
+                cout << "\r" << part << ": " << index.checkpoints.size() << " checkpoints, "
+                    << index.totalTimeticks << " timeticks -> " << indexFilename << endl;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            cout << endl;
+            cerr << "Error indexing " << archive << ": " << e.what() << endl;
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
@@ -50,7 +50,7 @@ int main(int argc, char *argv[])
     }
 
     argh::parser parser({"-h", "--help", "--log-level"});
-    parser.add_params({"--analysis", "--listfile"});
+    parser.add_params({"--analysis", "--listfile", "--analysis-workers"});
     parser.parse(argv);
 
     {
@@ -80,6 +80,8 @@ int main(int argc, char *argv[])
 
     std::string analysisFilename;
     parser("--analysis") >> analysisFilename;
+    unsigned analysisWorkers = 1;
+    parser("--analysis-workers", 1) >> analysisWorkers;
     std::string outputListfilename;
     parser("--listfile") >> outputListfilename;
     const bool overwriteListfile = parser["--overwrite-listfile"];
@@ -219,6 +221,7 @@ int main(int argc, char *argv[])
             {
                 ctx->setName(fmt::format("analysis_crate{}", crateId));
                 ctx->crateId = configs.crateConfig.crateId;
+                ctx->workerCount = analysisWorkers;
                 if (!outputListfilename.empty())
                     ctx->runInfo.runId = QFileInfo(outputListfilename.c_str()).baseName();
                 ctx->runInfo.isReplay = false;
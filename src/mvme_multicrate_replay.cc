@@ -7,6 +7,7 @@
 #include "analysis/analysis_util.h"
 #include "multi_crate.h"
 #include "mvlc_daq.h"
+#include "mvlc_listfile_zstd.h"
 #include "mvlc/vmeconfig_to_crateconfig.h"
 #include "mvme_session.h"
 #include "util/qt_monospace_textedit.h"
@@ -93,10 +94,11 @@ int main(int argc, char *argv[])
     }
 
     mvlc::listfile::ReadHandle *listfileReadHandle = {};
+    std::unique_ptr<mvme_mvlc::ZstdReadHandle> zstdReadHandle;
 
     try
     {
-        listfileReadHandle = zipReader.openEntry(listfileEntryName);
+        listfileReadHandle = mvme_mvlc::open_listfile_entry(zipReader, listfileEntryName, zstdReadHandle);
     }
     catch (const std::exception &e)
     {
@@ -13,6 +13,7 @@
 #include "multi_crate_nng.h"
 #include "multi_crate_nng_gui.h"
 #include "mvlc_daq.h"
+#include "mvlc_listfile_zstd.h"
 #include "mvlc/vmeconfig_to_crateconfig.h"
 #include "mvme_session.h"
 #include "qt_util.h"
@@ -48,7 +49,7 @@ int main(int argc, char *argv[])
     }
 
     argh::parser parser({"-h", "--help", "--log-level"});
-    parser.add_params({"--analysis"});
+    parser.add_params({"--analysis", "--analysis-workers"});
     parser.parse(argv);
 
     {
@@ -79,6 +80,8 @@ int main(int argc, char *argv[])
     std::string listfileFilename = parser.pos_args()[1];
     std::string analysisFilename;
     parser("--analysis") >> analysisFilename;
+    unsigned analysisWorkers = 1;
+    parser("--analysis-workers", 1) >> analysisWorkers;
 
     mvlc::listfile::SplitZipReader zipReader;
     try
@@ -100,10 +103,11 @@ int main(int argc, char *argv[])
     }
 
     mvlc::listfile::ReadHandle *listfileReadHandle = {};
+    std::unique_ptr<mvme_mvlc::ZstdReadHandle> zstdReadHandle;
 
     try
     {
-        listfileReadHandle = zipReader.openEntry(listfileEntryName);
+        listfileReadHandle = mvme_mvlc::open_listfile_entry(zipReader, listfileEntryName, zstdReadHandle);
     }
     catch (const std::exception &e)
     {
@@ -266,6 +270,7 @@ int main(int argc, char *argv[])
             {
                 ctx->setName(fmt::format("analysis_crate{}", crateId));
                 ctx->crateId = configs.crateConfig.crateId;
+                ctx->workerCount = analysisWorkers;
                 ctx->runInfo.runId = QFileInfo(listfileFilename.c_str()).baseName();
                 ctx->runInfo.isReplay = true;
                 ctx->runInfo.infoDict["replaySourceFile"] = listfileFilename.c_str();
@@ -1,10 +1,14 @@
 #include "mvme_prometheus.h"
 
+#include <chrono>
+#include <map>
 #include <prometheus/counter.h>
 #include <prometheus/gauge.h>
+#include <prometheus/histogram.h>
 #include <spdlog/spdlog.h>
 
 #include "stream_worker_base.h"
+#include "util/profiling.h"
 #include "vme_config.h"
 
 namespace mesytec::mvme
@@ -61,6 +65,9 @@ struct StreamProcCountersPromExporter::Private
         prometheus::Family<prometheus::Gauge> &module_hits_family_;
         std::array<PrometheusModuleHits, MaxVMEEvents> module_hits_;
 
+        // Scoped timer durations in seconds, one histogram per call path.
+        prometheus::Family<prometheus::Histogram> &profiling_durations_family_;
+
         Metrics(prometheus::Registry &registry)
             : bytes_processed_family_(prometheus::BuildGauge()
                                         .Name("analysis_bytes_processed")
@@ -89,6 +96,12 @@ struct StreamProcCountersPromExporter::Private
                                         .Name("analysis_module_hits")
                                         .Help("Per module processed events by the mvme analysis")
                                         .Register(registry))
+
+            , profiling_durations_family_(prometheus::BuildHistogram()
+                                        .Name("analysis_profiling_duration_seconds")
+                                        .Help("Scoped timer durations of the readout parser and the mvme analysis."
+                                              " Only updated while profiling is enabled.")
+                                        .Register(registry))
         {
             std::fill(std::begin(event_hits_), std::end(event_hits_), nullptr);
 
@@ -97,8 +110,18 @@ struct StreamProcCountersPromExporter::Private
         }
     };
 
+    struct ProfilingHisto
+    {
+        prometheus::Histogram *histo;
+        profiling::Entry prev;
+    };
+
+    static constexpr std::chrono::seconds ProfilingUpdateInterval = std::chrono::seconds(1);
+
     Logger logger_;
     std::unique_ptr<Metrics> metrics_;
+    std::map<std::string, ProfilingHisto> profilingHistos_;
+    std::chrono::steady_clock::time_point lastProfilingUpdate_;
 
     Private()
     {
@@ -162,6 +185,74 @@ struct StreamProcCountersPromExporter::Private
         }
     }
 
+    // Adds the profiling data accumulated since the last call to the
+    // histograms. Data lost by profiling::reset() is not subtracted so that
+    // the prometheus histograms stay monotonic.
+    void updateProfiling()
+    {
+        if (!metrics_) return;
+
+        if (!profiling::is_enabled())
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - lastProfilingUpdate_ < ProfilingUpdateInterval)
+            return;
+
+        lastProfilingUpdate_ = now;
+
+        const auto entries = profiling::snapshot();
+        std::vector<std::string> paths;
+        paths.reserve(entries.size());
+
+        for (const auto &entry: entries)
+        {
+            auto path = entry.name;
+
+            if (!entry.indexName.empty())
+                path += "[" + entry.indexName + "]";
+
+            if (entry.parent >= 0)
+                path = paths[entry.parent] + "/" + path;
+
+            paths.push_back(path);
+
+            auto it = profilingHistos_.find(path);
+
+            if (it == profilingHistos_.end())
+            {
+                // The last histogram bin is open ended and maps to the +Inf
+                // bucket.
+                prometheus::Histogram::BucketBoundaries bounds;
+
+                for (size_t bin = 0; bin + 1 < profiling::HistoBins; ++bin)
+                    bounds.push_back(profiling::histo_bin_upper_ns(bin) * 1e-9);
+
+                auto &histo = metrics_->profiling_durations_family_.Add({
+                    {"path", path},
+                    {"site", entry.name},
+                    {"index", entry.indexName},
+                    }, bounds);
+
+                it = profilingHistos_.emplace(path, ProfilingHisto{ &histo, {} }).first;
+            }
+
+            auto &prev = it->second.prev;
+
+            if (entry.hits < prev.hits)
+                prev = {};
+
+            std::vector<double> increments(profiling::HistoBins);
+
+            for (size_t bin = 0; bin < profiling::HistoBins; ++bin)
+                increments[bin] = entry.histo[bin] - std::min(entry.histo[bin], prev.histo[bin]);
+
+            it->second.histo->ObserveMultiple(increments, (entry.totalNs - std::min(entry.totalNs, prev.totalNs)) * 1e-9);
+            prev = entry;
+        }
+    }
+
     void update(const MVMEStreamProcessorCounters &counters)
     {
         if (!metrics_) return;
@@ -223,6 +314,9 @@ void StreamProcCountersPromExporter::endRun(const DAQStats &stats, const std::ex
     {
         d->update(streamWorker->getCounters());
     }
+
+    d->lastProfilingUpdate_ = {};
+    d->updateProfiling();
 }
 
 void StreamProcCountersPromExporter::processBuffer(s32 bufferType, u32 bufferNumber, const u32 *buffer, size_t bufferSize)
@@ -236,6 +330,8 @@ void StreamProcCountersPromExporter::processBuffer(s32 bufferType, u32 bufferNum
     {
         d->update(streamWorker->getCounters());
     }
+
+    d->updateProfiling();
 }
 
 }
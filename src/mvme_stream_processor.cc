@@ -233,6 +233,8 @@ void MVMEStreamProcessorPrivate::consumersBeginRun()
 
     for (auto &c: bufferConsumers)
         c->beginRun(runInfo, vmeConfig, analysis);
+
+    disable_replicas_for_event_data_readers(analysis, moduleConsumers, logger);
 }
 
 void MVMEStreamProcessor::endRun(const DAQStats &stats)
@@ -27,7 +27,6 @@
 #include "mesytec_diagnostics.h"
 #include "mvme_listfile.h"
 #include "mvme_workspace.h"
-#include "timed_block.h"
 #include "vme_analysis_common.h"
 
 #include <atomic>
@@ -1,8 +1,10 @@
 #include "replay_ui.h"
 #include "replay_ui_p.h"
 
+#include <QFormLayout>
 #include <QFutureWatcher>
 #include <QSet>
+#include <QSpinBox>
 #include <QStatusBar>
 #include <QTableView>
 #include <QThread>
@@ -10,6 +12,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <limits>
 
 
 #include "qt_util.h"
@@ -27,6 +30,8 @@ struct ReplayWidget::Private
     QFileSystemModel *model_browseFs_ = nullptr;
     BrowseFilterModel *model_browseFsProxy_ = nullptr;
     QueueTableModel *model_queue_ = nullptr;
+    QSpinBox *spin_replayStart_ = nullptr;
+    QSpinBox *spin_replayStop_ = nullptr;
 
     QTimer startGatherFileInfoTimer_;
     replay::FileInfoCache fileInfoCache_;
@@ -103,6 +108,29 @@ ReplayWidget::ReplayWidget(QWidget *parent)
     tb_queueReplay->addSeparator();
     tb_queueReplay->addAction(action_queueClear);
 
+    // replay options
+    {
+        d->spin_replayStart_ = new QSpinBox;
+        d->spin_replayStop_ = new QSpinBox;
+
+        for (auto spin: { d->spin_replayStart_, d->spin_replayStop_ })
+        {
+            spin->setMinimum(0);
+            spin->setMaximum(std::numeric_limits<int>::max());
+            spin->setSuffix(QSL(" s"));
+        }
+
+        d->spin_replayStart_->setSpecialValueText(QSL("begin"));
+        d->spin_replayStop_->setSpecialValueText(QSL("end"));
+        d->spin_replayStart_->setToolTip(QSL("Start each replay at the given number of seconds into the run."
+                                             " Uses the listfile index (.mvlcidx) to seek if available."));
+        d->spin_replayStop_->setToolTip(QSL("Stop each replay at the given number of seconds into the run."));
+
+        auto l = new QFormLayout(d->ui->stack_playToolsReplay);
+        l->addRow(QSL("Start"), d->spin_replayStart_);
+        l->addRow(QSL("Stop"), d->spin_replayStop_);
+    }
+
     auto tb_queueMerge = make_toolbar();
     make_hbox<0, 0>(d->ui->stack_playToolbarsMerge)->addWidget(tb_queueMerge);
     tb_queueMerge->addAction(action_queueStart);
@@ -183,6 +211,8 @@ replay::CommandHolder ReplayWidget::getCommand() const
                 ret.analysisBlob = d->fileInfoCache_.value(ret.queue.front())->handle.analysisBlob;
                 ret.analysisFilename = "<from " + ret.queue.front().fileName() + ">";
             }
+            ret.replayStart = std::chrono::seconds(d->spin_replayStart_->value());
+            ret.replayStop = std::chrono::seconds(d->spin_replayStop_->value());
             return ret;
         } break;
 
@@ -1 +1,31 @@
 #include "stream_processor_consumers.h"
+
+#include <QStringList>
+#include "analysis/analysis.h"
+#include "util/qt_str.h"
+
+void disable_replicas_for_event_data_readers(
+    analysis::Analysis *analysis,
+    const QVector<std::shared_ptr<IStreamModuleConsumer>> &consumers,
+    const StreamConsumerBase::Logger &logger)
+{
+    if (!analysis || !analysis->isUsingReplicas())
+        return;
+
+    QStringList readers;
+
+    for (const auto &c: consumers)
+    {
+        if (auto name = c->analysisEventDataReader(); !name.isEmpty())
+            readers.push_back(name);
+    }
+
+    if (readers.isEmpty())
+        return;
+
+    analysis->disableReplicas();
+
+    if (logger)
+        logger(QSL("Event-parallel replay disabled. The following components read per-event"
+                   " analysis data: %1").arg(readers.join(", ")));
+}
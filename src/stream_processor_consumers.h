@@ -2,7 +2,9 @@
 #define __MVME_STREAM_PROCESSOR_MODULE_CONSUMER_H__
 
 #include <QString>
+#include <QVector>
 #include <functional>
+#include <memory>
 #include <mesytec-mvlc/mvlc_readout_parser.h>
 #include "libmvme_export.h"
 #include "typedefs.h"
@@ -71,6 +73,14 @@ class LIBMVME_EXPORT IStreamModuleConsumer: public StreamConsumerBase
         virtual void processSystemEvent(s32 crateIndex, const u32 *header, u32 size) = 0;
         virtual void processTimetick() = 0;
 
+        // Returns a short name for log messages if the consumer reads
+        // per-event state of the primary A2 (data source outputs, condition
+        // bits) during the current run, an empty string otherwise. The primary
+        // A2 does not process events during event-parallel replays, so these
+        // are disabled while such a consumer is active. Called after
+        // beginRun().
+        virtual QString analysisEventDataReader() const { return {}; }
+
         //virtual void setEnabled(bool enabled) = 0;
 };
 
@@ -93,4 +103,12 @@ class LIBMVME_EXPORT IStreamBufferConsumer: public StreamConsumerBase
         virtual void processBuffer(s32 bufferType, u32 bufferNumber, const u32 *buffer, size_t bufferSize) = 0;
 };
 
+/* Disables event-parallel replay on the analysis if any of the consumers
+ * reports an analysisEventDataReader(). Must be called after the consumers
+ * beginRun() and before the first event is processed. */
+void LIBMVME_EXPORT disable_replicas_for_event_data_readers(
+    analysis::Analysis *analysis,
+    const QVector<std::shared_ptr<IStreamModuleConsumer>> &consumers,
+    const StreamConsumerBase::Logger &logger);
+
 #endif /* __MVME_STREAM_PROCESSOR_MODULE_CONSUMER_H__ */
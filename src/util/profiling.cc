@@ -0,0 +1,399 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include "util/profiling.h"
+
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+
+namespace mesytec::mvme::profiling
+{
+
+std::atomic<bool> g_profilingEnabled(false);
+
+struct Record
+{
+    CallSiteId site = 0;
+    u32 index = 0;
+    Record *parent = nullptr;
+
+    // Written by the owning thread, read by snapshot().
+    std::atomic<u64> hits = 0;
+    std::atomic<u64> totalNs = 0;
+    std::atomic<u64> selfNs = 0;
+    std::array<std::atomic<u64>, HistoBins> histo = {};
+
+    void clear()
+    {
+        hits = 0;
+        totalNs = 0;
+        selfNs = 0;
+
+        for (auto &bin: histo)
+            bin = 0;
+    }
+};
+
+struct ThreadData
+{
+    // Guards the record container. Taken by the owning thread only when
+    // creating a record.
+    std::mutex mutex;
+    std::deque<Record> records;
+
+    // Owner thread only below here.
+
+    // Last record used for each site and index. Hit as long as the site is
+    // reached through the same call path.
+    std::vector<std::vector<Record *>> cache;
+    std::map<std::tuple<Record *, CallSiteId, u32>, Record *> byPath;
+    ScopedTimer *current = nullptr;
+
+    std::atomic<bool> exited = false;
+
+    Record *getRecord(CallSiteId site, u32 index, Record *parent)
+    {
+        if (site < cache.size() && index < cache[site].size())
+        {
+            if (auto rec = cache[site][index]; rec && rec->parent == parent)
+                return rec;
+        }
+
+        return lookupRecord(site, index, parent);
+    }
+
+    Record *lookupRecord(CallSiteId site, u32 index, Record *parent);
+};
+
+namespace
+{
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::string> siteNames;
+    std::map<std::string, CallSiteId> sitesByName;
+    std::map<std::pair<CallSiteId, u32>, std::string> indexNames;
+    std::vector<std::shared_ptr<ThreadData>> threads;
+};
+
+Registry &registry()
+{
+    static Registry theRegistry;
+    return theRegistry;
+}
+
+// Registers the thread data on first use. The data is kept after the thread
+// exits so that its timings still show up in snapshots.
+struct ThreadDataHolder
+{
+    std::shared_ptr<ThreadData> data;
+
+    ThreadDataHolder()
+        : data(std::make_shared<ThreadData>())
+    {
+        auto &reg = registry();
+        std::lock_guard<std::mutex> guard(reg.mutex);
+        reg.threads.push_back(data);
+    }
+
+    ~ThreadDataHolder()
+    {
+        data->exited = true;
+    }
+};
+
+ThreadData &thread_data()
+{
+    thread_local ThreadDataHolder holder;
+    return *holder.data;
+}
+
+inline size_t histo_bin(u64 ns)
+{
+    size_t bin = 63 - __builtin_clzll(ns | 1u);
+    return std::min(bin, HistoBins - 1);
+}
+
+} // end anon namespace
+
+Record *ThreadData::lookupRecord(CallSiteId site, u32 index, Record *parent)
+{
+    // Records are never freed while the thread data exists, so the parent
+    // address identifies the call path.
+    auto key = std::make_tuple(parent, site, index);
+    Record *rec = nullptr;
+
+    if (auto it = byPath.find(key); it != byPath.end())
+    {
+        rec = it->second;
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            records.emplace_back();
+            rec = &records.back();
+            rec->site = site;
+            rec->index = index;
+            rec->parent = parent;
+        }
+
+        byPath[key] = rec;
+    }
+
+    if (site >= cache.size())
+        cache.resize(site + 1);
+
+    if (index >= cache[site].size())
+        cache[site].resize(index + 1, nullptr);
+
+    cache[site][index] = rec;
+
+    return rec;
+}
+
+CallSiteId register_call_site(const std::string &name)
+{
+    auto &reg = registry();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+
+    if (auto it = reg.sitesByName.find(name); it != reg.sitesByName.end())
+        return it->second;
+
+    CallSiteId id = reg.siteNames.size();
+    reg.siteNames.push_back(name);
+    reg.sitesByName[name] = id;
+    return id;
+}
+
+void set_index_name(CallSiteId site, u32 index, const std::string &name)
+{
+    auto &reg = registry();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+    reg.indexNames[{ site, index }] = name;
+}
+
+void set_enabled(bool enable)
+{
+    g_profilingEnabled = enable;
+}
+
+void reset()
+{
+    auto &reg = registry();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+
+    // Data of exited threads can be dropped. The records of running threads
+    // are cleared in place as the threads keep pointers to them.
+    reg.threads.erase(
+        std::remove_if(std::begin(reg.threads), std::end(reg.threads),
+                       [] (const auto &td) { return td->exited.load(); }),
+        std::end(reg.threads));
+
+    for (auto &td: reg.threads)
+    {
+        std::lock_guard<std::mutex> tdGuard(td->mutex);
+
+        for (auto &rec: td->records)
+            rec.clear();
+    }
+}
+
+void ScopedTimer::begin(CallSiteId site, u32 index)
+{
+    threadData_ = &thread_data();
+    parent_ = threadData_->current;
+    record_ = threadData_->getRecord(site, index, parent_ ? parent_->record_ : nullptr);
+    threadData_->current = this;
+    start_ = Clock::now();
+}
+
+void ScopedTimer::end()
+{
+    const u64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+    const auto relaxed = std::memory_order_relaxed;
+
+    record_->hits.fetch_add(1, relaxed);
+    record_->totalNs.fetch_add(ns, relaxed);
+    record_->selfNs.fetch_add(ns - std::min(childNs_, ns), relaxed);
+    record_->histo[histo_bin(ns)].fetch_add(1, relaxed);
+
+    threadData_->current = parent_;
+
+    if (parent_)
+        parent_->childNs_ += ns;
+}
+
+std::vector<Entry> snapshot()
+{
+    auto &reg = registry();
+    std::vector<Entry> merged;
+    std::vector<std::string> siteNames;
+    std::map<std::pair<CallSiteId, u32>, std::string> indexNames;
+
+    {
+        std::lock_guard<std::mutex> guard(reg.mutex);
+        siteNames = reg.siteNames;
+        indexNames = reg.indexNames;
+
+        // Records of all threads reached through the same call path are
+        // merged. Parents are always created before their children, so they
+        // come first in the record containers.
+        std::map<std::tuple<s32, CallSiteId, u32>, s32> mergedByPath;
+
+        for (auto &td: reg.threads)
+        {
+            std::lock_guard<std::mutex> tdGuard(td->mutex);
+            std::unordered_map<const Record *, s32> recordToMerged;
+
+            for (const auto &rec: td->records)
+            {
+                s32 parent = rec.parent ? recordToMerged.at(rec.parent) : -1;
+                auto key = std::make_tuple(parent, rec.site, rec.index);
+                auto it = mergedByPath.find(key);
+
+                if (it == mergedByPath.end())
+                {
+                    Entry entry;
+                    entry.site = rec.site;
+                    entry.index = rec.index;
+                    entry.parent = parent;
+                    merged.emplace_back(entry);
+                    it = mergedByPath.emplace(key, merged.size() - 1).first;
+                }
+
+                auto &entry = merged[it->second];
+                entry.hits += rec.hits.load(std::memory_order_relaxed);
+                entry.totalNs += rec.totalNs.load(std::memory_order_relaxed);
+                entry.selfNs += rec.selfNs.load(std::memory_order_relaxed);
+
+                for (size_t bin = 0; bin < HistoBins; ++bin)
+                    entry.histo[bin] += rec.histo[bin].load(std::memory_order_relaxed);
+
+                recordToMerged[&rec] = it->second;
+            }
+        }
+    }
+
+    for (auto &entry: merged)
+    {
+        entry.name = entry.site < siteNames.size() ? siteNames[entry.site] : std::string{};
+
+        if (auto it = indexNames.find({ entry.site, entry.index }); it != indexNames.end())
+            entry.indexName = it->second;
+        else if (entry.index)
+            entry.indexName = std::to_string(entry.index);
+    }
+
+    // Depth first ordering, children sorted by decreasing total time.
+    std::vector<std::vector<s32>> children(merged.size() + 1);
+
+    for (size_t i = 0; i < merged.size(); ++i)
+        children[merged[i].parent + 1].push_back(i);
+
+    for (auto &c: children)
+    {
+        std::stable_sort(std::begin(c), std::end(c), [&merged] (s32 a, s32 b)
+        {
+            return merged[a].totalNs > merged[b].totalNs;
+        });
+    }
+
+    std::vector<Entry> result;
+    result.reserve(merged.size());
+    std::vector<std::pair<s32, s32>> stack; // (merged index, new parent index)
+
+    for (auto it = children[0].rbegin(); it != children[0].rend(); ++it)
+        stack.emplace_back(*it, -1);
+
+    while (!stack.empty())
+    {
+        auto [idx, newParent] = stack.back();
+        stack.pop_back();
+
+        Entry entry = merged[idx];
+        entry.parent = newParent;
+        entry.depth = newParent >= 0 ? result[newParent].depth + 1 : 0;
+        result.emplace_back(std::move(entry));
+        const s32 newIndex = result.size() - 1;
+
+        const auto &c = children[idx + 1];
+
+        for (auto it = c.rbegin(); it != c.rend(); ++it)
+            stack.emplace_back(*it, newIndex);
+    }
+
+    return result;
+}
+
+void format_snapshot_tabular(std::ostream &out, const std::vector<Entry> &entries)
+{
+    u64 totalSelfNs = 0;
+    size_t nameWidth = 4;
+
+    auto entry_label = [] (const Entry &e)
+    {
+        auto label = std::string(e.depth * 2, ' ') + e.name;
+
+        if (!e.indexName.empty())
+            label += "[" + e.indexName + "]";
+
+        return label;
+    };
+
+    for (const auto &e: entries)
+    {
+        totalSelfNs += e.selfNs;
+        nameWidth = std::max(nameWidth, entry_label(e).size());
+    }
+
+    out << std::left << std::setw(nameWidth) << "site" << std::right
+        << std::setw(14) << "hits"
+        << std::setw(12) << "total ms"
+        << std::setw(12) << "self ms"
+        << std::setw(8) << "self %"
+        << std::setw(12) << "avg ns"
+        << std::endl;
+
+    out << std::fixed;
+
+    for (const auto &e: entries)
+    {
+        double selfPercent = totalSelfNs ? e.selfNs * 100.0 / totalSelfNs : 0.0;
+        double avgNs = e.hits ? static_cast<double>(e.totalNs) / e.hits : 0.0;
+
+        out << std::left << std::setw(nameWidth) << entry_label(e) << std::right
+            << std::setw(14) << e.hits
+            << std::setw(12) << std::setprecision(2) << e.totalNs * 1e-6
+            << std::setw(12) << std::setprecision(2) << e.selfNs * 1e-6
+            << std::setw(8) << std::setprecision(1) << selfPercent
+            << std::setw(12) << std::setprecision(0) << avgNs
+            << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,154 @@
+/* mvme - Mesytec VME Data Acquisition
+ *
+ * Copyright (C) 2016-2023 mesytec GmbH & Co. KG <info@mesytec.com>
+ *
+ * Author: Florian Lüke <f.lueke@mesytec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef __MVME_UTIL_PROFILING_H__
+#define __MVME_UTIL_PROFILING_H__
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "typedefs.h"
+
+// Hierarchical scoped timers for the readout data and analysis hot paths.
+//
+// Each call site is registered once by name and may be further split by an
+// index, e.g. the event index or the operator type. Timings are accumulated
+// in thread local records without locking. Nested scopes form a call tree:
+// records are kept per call path, i.e. the same site reached through
+// different enclosing scopes gets separate records. Each record holds the
+// hit count, the inclusive time, the self time excluding nested scopes and a
+// log2 histogram of the inclusive durations.
+//
+// Profiling is disabled by default. While disabled a scope costs a relaxed
+// atomic load and a branch. snapshot() merges the records of all threads and
+// can be called at any time from any thread.
+//
+// Built as the libmvme_profiling static library which liba2 and libmvme link
+// against so that it's usable from both the analysis runtime and the rest of
+// mvme.
+
+namespace mesytec::mvme::profiling
+{
+
+// Duration histogram: bin i counts durations in [2^i, 2^(i+1)) ns, the last
+// bin everything above.
+static const size_t HistoBins = 32;
+
+using CallSiteId = u32;
+
+// Returns the id of the call site with the given name, registering it if
+// needed. Thread-safe but takes a lock: keep the result, e.g. in a function
+// local static.
+CallSiteId register_call_site(const std::string &name);
+
+// Sets a name for an index of the call site, e.g. the operator type name.
+// Unnamed indexes are shown as numbers.
+void set_index_name(CallSiteId site, u32 index, const std::string &name);
+
+extern std::atomic<bool> g_profilingEnabled;
+
+inline bool is_enabled() { return g_profilingEnabled.load(std::memory_order_relaxed); }
+void set_enabled(bool enable);
+
+// Clears the records of all threads.
+void reset();
+
+struct Record;
+struct ThreadData;
+
+class ScopedTimer
+{
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit ScopedTimer(CallSiteId site, u32 index = 0)
+        {
+            if (is_enabled())
+                begin(site, index);
+        }
+
+        ~ScopedTimer()
+        {
+            if (record_)
+                end();
+        }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+        void begin(CallSiteId site, u32 index);
+        void end();
+
+        ThreadData *threadData_ = nullptr;
+        Record *record_ = nullptr;
+        ScopedTimer *parent_ = nullptr;
+        u64 childNs_ = 0;
+        Clock::time_point start_;
+};
+
+// Merged timings of one call site and index.
+struct Entry
+{
+    std::string name;       // call site name
+    std::string indexName;  // empty if the site is not indexed
+    CallSiteId site = 0;
+    u32 index = 0;
+    s32 parent = -1;        // index into the snapshot or -1 for root entries
+    u32 depth = 0;          // nesting depth in the call tree
+    u64 hits = 0;
+    u64 totalNs = 0;        // inclusive time
+    u64 selfNs = 0;         // time not spent in nested scopes
+    std::array<u64, HistoBins> histo = {};
+};
+
+// Returns the merged entries of all threads in call tree order: each entry is
+// followed by its children, siblings are sorted by decreasing total time.
+std::vector<Entry> snapshot();
+
+// Upper bound of histogram bin i in nanoseconds.
+inline double histo_bin_upper_ns(size_t bin) { return static_cast<double>(u64(1) << (bin + 1)); }
+
+// Prints the snapshot as a table with the call tree indented.
+void format_snapshot_tabular(std::ostream &out, const std::vector<Entry> &entries);
+
+}
+
+// Scope macros. The call site is registered on first use.
+#define MVME_PROFILE_CONCAT2(a, b) a##b
+#define MVME_PROFILE_CONCAT(a, b) MVME_PROFILE_CONCAT2(a, b)
+
+#define MVME_PROFILE_SCOPE(name) \
+    static const ::mesytec::mvme::profiling::CallSiteId MVME_PROFILE_CONCAT(profile_site_, __LINE__) = \
+        ::mesytec::mvme::profiling::register_call_site(name); \
+    ::mesytec::mvme::profiling::ScopedTimer MVME_PROFILE_CONCAT(profile_timer_, __LINE__)( \
+        MVME_PROFILE_CONCAT(profile_site_, __LINE__))
+
+#define MVME_PROFILE_SCOPE_INDEXED(name, index) \
+    static const ::mesytec::mvme::profiling::CallSiteId MVME_PROFILE_CONCAT(profile_site_, __LINE__) = \
+        ::mesytec::mvme::profiling::register_call_site(name); \
+    ::mesytec::mvme::profiling::ScopedTimer MVME_PROFILE_CONCAT(profile_timer_, __LINE__)( \
+        MVME_PROFILE_CONCAT(profile_site_, __LINE__), index)
+
+#endif /* __MVME_UTIL_PROFILING_H__ */
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <thread>
+
+#include "util/profiling.h"
+
+using namespace mesytec::mvme;
+
+namespace
+{
+
+void leaf(unsigned index)
+{
+    MVME_PROFILE_SCOPE_INDEXED("test_leaf", index);
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+void outer()
+{
+    MVME_PROFILE_SCOPE("test_outer");
+    leaf(0);
+    leaf(1);
+    leaf(1);
+}
+
+const profiling::Entry *find_entry(const std::vector<profiling::Entry> &entries,
+                                   const std::string &name, s32 parent, u32 index = 0)
+{
+    for (const auto &e: entries)
+    {
+        if (e.name == name && e.parent == parent && e.index == index)
+            return &e;
+    }
+
+    return nullptr;
+}
+
+}
+
+TEST(Profiling, CallTree)
+{
+    profiling::reset();
+    profiling::set_enabled(false);
+
+    // Disabled: nothing is recorded.
+    outer();
+
+    for (const auto &e: profiling::snapshot())
+        ASSERT_EQ(e.hits, 0u);
+
+    profiling::set_enabled(true);
+
+    auto site = profiling::register_call_site("test_leaf");
+    ASSERT_EQ(site, profiling::register_call_site("test_leaf"));
+    profiling::set_index_name(site, 1, "one");
+
+    // Two threads plus the leaf called outside of outer(), giving a second
+    // call path for it.
+    std::thread t(outer);
+    outer();
+    t.join();
+    leaf(0);
+
+    profiling::set_enabled(false);
+
+    auto entries = profiling::snapshot();
+
+    auto outerEntry = find_entry(entries, "test_outer", -1);
+    ASSERT_TRUE(outerEntry);
+    ASSERT_EQ(outerEntry->hits, 2u);
+    const s32 outerIndex = outerEntry - entries.data();
+
+    auto leaf0 = find_entry(entries, "test_leaf", outerIndex, 0);
+    auto leaf1 = find_entry(entries, "test_leaf", outerIndex, 1);
+    ASSERT_TRUE(leaf0 && leaf1);
+    ASSERT_EQ(leaf0->hits, 2u);
+    ASSERT_EQ(leaf1->hits, 4u);
+    ASSERT_EQ(leaf1->indexName, "one");
+    ASSERT_EQ(leaf1->depth, 1u);
+
+    // Children follow their parent, sorted by decreasing total time.
+    ASSERT_LT(outerIndex, leaf1 - entries.data());
+    ASSERT_LT(leaf1 - entries.data(), leaf0 - entries.data());
+
+    ASSERT_GE(outerEntry->totalNs, leaf0->totalNs + leaf1->totalNs);
+    ASSERT_EQ(outerEntry->selfNs, outerEntry->totalNs - leaf0->totalNs - leaf1->totalNs);
+    ASSERT_EQ(leaf1->selfNs, leaf1->totalNs);
+
+    u64 histoSum = 0;
+    for (auto count: leaf1->histo)
+        histoSum += count;
+    ASSERT_EQ(histoSum, leaf1->hits);
+
+    auto rootLeaf = find_entry(entries, "test_leaf", -1, 0);
+    ASSERT_TRUE(rootLeaf);
+    ASSERT_EQ(rootLeaf->hits, 1u);
+
+    std::ostringstream out;
+    profiling::format_snapshot_tabular(out, entries);
+    ASSERT_NE(out.str().find("  test_leaf[one]"), std::string::npos);
+
+    profiling::reset();
+
+    for (const auto &e: profiling::snapshot())
+        ASSERT_EQ(e.hits, 0u);
+}